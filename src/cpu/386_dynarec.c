@@ -965,6 +965,7 @@ exec386(int32_t cycs)
                 cpu_state.eflags &= ~(RF_FLAG);
 #endif
                 x86_opcodes[(opcode | cpu_state.op32) & 0x3ff](fetchdat);
+                cpu_instructions_executed++;
 
                 /* WBOX: Check if exit was requested (e.g., by syscall handler) */
                 if (cpu_exit_requested) {
@@ -622,6 +622,7 @@ extern int cpu_rom_prefetch_cycles;
 extern int cpu_waitstates;
 extern int cpu_flush_pending;
 extern int cpu_exit_requested;  /* WBOX: Flag to exit CPU loop immediately */
+extern uint64_t cpu_instructions_executed;  /* WBOX: Guest instructions run by exec386 */
 extern int cpu_old_paging;
 extern int cpu_cache_int_enabled;
 extern int cpu_cache_ext_enabled;
@@ -1019,6 +1019,16 @@ void mem_writel_phys(uint32_t addr, uint32_t val) {
         *(uint32_t *)&ram[addr] = val;
 }
 
+/*
+ * Host pointer to size bytes of RAM at a physical address, for bulk
+ * copies. Returns NULL if the range is not all RAM.
+ */
+uint8_t *mem_phys_ptr(uint32_t addr, uint32_t size) {
+    if (!ram || addr >= ram_size || size > ram_size - addr)
+        return NULL;
+    return &ram[addr];
+}
+
 /*
  * Memory mapping functions.
  */
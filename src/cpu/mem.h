@@ -191,6 +191,7 @@ extern uint32_t mem_readl_phys(uint32_t addr);
 extern void     mem_writeb_phys(uint32_t addr, uint8_t val);
 extern void     mem_writew_phys(uint32_t addr, uint16_t val);
 extern void     mem_writel_phys(uint32_t addr, uint32_t val);
+extern uint8_t *mem_phys_ptr(uint32_t addr, uint32_t size);
 
 /* Page write functions for dynarec */
 extern void     mem_write_ramb_page(uint32_t addr, uint8_t val, page_t *page);
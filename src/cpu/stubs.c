@@ -29,6 +29,7 @@
 /* Note: cpu_override is defined in cpu.c */
 int cpu = 0;
 int cpu_exit_requested = 0;  /* WBOX: Flag to exit CPU loop immediately */
+uint64_t cpu_instructions_executed = 0;  /* WBOX: Guest instructions run by exec386 */
 int fpu_type = 0;
 int fpu_softfloat = 1;
 int machine = 0;
@@ -13,6 +13,36 @@
 #define DISPLAY_DEFAULT_WIDTH   800
 #define DISPLAY_DEFAULT_HEIGHT  600
 
+/* Host input events buffered between polls */
+#define DISPLAY_INPUT_QUEUE_SIZE 256
+
+/* Host input event kinds */
+#define DISPLAY_INPUT_KEY           0
+#define DISPLAY_INPUT_MOUSE_MOVE    1
+#define DISPLAY_INPUT_MOUSE_BUTTON  2
+#define DISPLAY_INPUT_MOUSE_WHEEL   3
+
+/* Mouse buttons */
+#define DISPLAY_BUTTON_LEFT     0
+#define DISPLAY_BUTTON_RIGHT    1
+#define DISPLAY_BUTTON_MIDDLE   2
+
+/* Host input event, already in Windows terms (virtual keys, set 1 scan
+ * codes, frame buffer coordinates) so USER needs no SDL knowledge */
+typedef struct {
+    uint8_t type;       /* DISPLAY_INPUT_* */
+    uint8_t vk;         /* Virtual-key code (keys) */
+    uint8_t scancode;   /* Set 1 scan code (keys) */
+    uint8_t button;     /* DISPLAY_BUTTON_* (buttons) */
+    bool down;          /* Key or button pressed */
+    bool extended;      /* Extended key (E0 prefix) */
+    bool repeat;        /* Autorepeat */
+    uint8_t clicks;     /* Click count, 2 = double-click (buttons) */
+    int16_t wheel;      /* Wheel delta in WHEEL_DELTA units (wheel) */
+    int32_t x;          /* Pointer position (frame buffer coordinates) */
+    int32_t y;
+} display_input_t;
+
 /* Display context - manages SDL3 window and frame buffer */
 typedef struct {
     /* SDL handles (opaque to avoid SDL header dependency) */
@@ -30,6 +60,12 @@ typedef struct {
     bool initialized;
     bool dirty;         /* Needs redraw */
     bool quit_requested;
+
+    /* Input translated by display_poll_events, consumed by USER */
+    display_input_t input[DISPLAY_INPUT_QUEUE_SIZE];
+    uint32_t input_head;        /* Oldest event */
+    uint32_t input_count;
+    uint32_t input_dropped;     /* Events lost because the queue was full */
 } display_context_t;
 
 /*
@@ -53,10 +89,32 @@ void display_present(display_context_t *ctx);
 
 /*
  * Process SDL events
+ * Keyboard and mouse events are translated and queued for
+ * display_next_input; consecutive mouse moves are merged into one.
  * Returns true if quit was requested
  */
 bool display_poll_events(display_context_t *ctx);
 
+/*
+ * Append an input event for USER; a mouse move directly after another one
+ * replaces it, so a fast mouse costs one queue slot however many events
+ * SDL sends. The caller fills in the returned record.
+ * Returns NULL (and counts a drop) if the queue is full
+ */
+display_input_t *display_push_input(display_context_t *ctx, uint8_t type);
+
+/*
+ * Take the oldest queued input event
+ * Returns false if none is pending
+ */
+bool display_next_input(display_context_t *ctx, display_input_t *out);
+
+/*
+ * Sleep until an SDL event is pending or timeout_ms elapses
+ * Events are left queued for display_poll_events.
+ */
+void display_wait_events(display_context_t *ctx, int timeout_ms);
+
 /*
  * Fill a rectangle with a solid color
  */
@@ -0,0 +1,41 @@
+/*
+ * WBOX Display Input Queue
+ * Host input buffered between display_poll_events and USER; no SDL here
+ */
+#include "display.h"
+#include <string.h>
+
+display_input_t *display_push_input(display_context_t *ctx, uint8_t type)
+{
+    if (type == DISPLAY_INPUT_MOUSE_MOVE && ctx->input_count > 0) {
+        uint32_t last = (ctx->input_head + ctx->input_count - 1) % DISPLAY_INPUT_QUEUE_SIZE;
+        if (ctx->input[last].type == DISPLAY_INPUT_MOUSE_MOVE) {
+            return &ctx->input[last];
+        }
+    }
+
+    if (ctx->input_count == DISPLAY_INPUT_QUEUE_SIZE) {
+        ctx->input_dropped++;
+        return NULL;
+    }
+
+    uint32_t slot = (ctx->input_head + ctx->input_count) % DISPLAY_INPUT_QUEUE_SIZE;
+    ctx->input_count++;
+
+    display_input_t *in = &ctx->input[slot];
+    memset(in, 0, sizeof(*in));
+    in->type = type;
+    return in;
+}
+
+bool display_next_input(display_context_t *ctx, display_input_t *out)
+{
+    if (ctx->input_count == 0) {
+        return false;
+    }
+
+    *out = ctx->input[ctx->input_head];
+    ctx->input_head = (ctx->input_head + 1) % DISPLAY_INPUT_QUEUE_SIZE;
+    ctx->input_count--;
+    return true;
+}
@@ -39,6 +39,9 @@ void gdi_init_dc_defaults(gdi_dc_t *dc)
     dc->win_ext_x = 1;
     dc->win_ext_y = 1;
 
+    dc->dc_org_x = 0;
+    dc->dc_org_y = 0;
+
     dc->brush_org_x = 0;
     dc->brush_org_y = 0;
 
@@ -173,10 +176,16 @@ bool gdi_delete_dc(gdi_handle_table_t *table, uint32_t hdc)
     gdi_dc_t *saved = dc->saved_dc;
     while (saved) {
         gdi_dc_t *next = saved->saved_dc;
+        gdi_region_destroy(saved->clip_region);
         gdi_free_dc(table, saved);
         saved = next;
     }
 
+    /* Free clipping state */
+    gdi_region_destroy(dc->clip_region);
+    gdi_region_destroy(dc->vis_region);
+    gdi_region_destroy(dc->eff_region);
+
     /* Free the DC */
     gdi_free_handle(table, hdc);
     gdi_free_dc(table, dc);
@@ -184,6 +193,55 @@ bool gdi_delete_dc(gdi_handle_table_t *table, uint32_t hdc)
     return true;
 }
 
+/* Delete a GDI object of any type; stock objects report success */
+bool gdi_delete_object(gdi_handle_table_t *table, uint32_t hobject)
+{
+    /* Check object type */
+    uint8_t type;
+    void *obj = gdi_get_object_any(table, hobject, &type);
+    if (!obj) {
+        return false;
+    }
+
+    /* Cannot delete stock objects */
+    if (GDI_HANDLE_IS_STOCK(hobject)) {
+        return true;
+    }
+
+    /* Free based on type */
+    bool success = false;
+    switch (type) {
+        case GDI_OBJ_DC:
+            success = gdi_delete_dc(table, hobject);
+            break;
+        case GDI_OBJ_BRUSH:
+            success = gdi_free_handle(table, hobject);
+            if (success) gdi_free_brush(table, obj);
+            break;
+        case GDI_OBJ_PEN:
+            success = gdi_free_handle(table, hobject);
+            if (success) gdi_free_pen(table, obj);
+            break;
+        case GDI_OBJ_FONT:
+            success = gdi_free_handle(table, hobject);
+            if (success) gdi_free_font(table, obj);
+            break;
+        case GDI_OBJ_BITMAP:
+            success = gdi_free_handle(table, hobject);
+            if (success) gdi_free_bitmap(table, obj);
+            break;
+        case GDI_OBJ_REGION:
+            success = gdi_free_handle(table, hobject);
+            if (success) gdi_free_region(table, obj);
+            break;
+        default:
+            success = gdi_free_handle(table, hobject);
+            break;
+    }
+
+    return success;
+}
+
 /* Release window DC */
 int gdi_release_dc(gdi_handle_table_t *table, uint32_t hwnd, uint32_t hdc)
 {
@@ -291,6 +349,9 @@ uint32_t gdi_select_bitmap(gdi_handle_table_t *table, uint32_t hdc, uint32_t hbi
     dc->pitch = bitmap->pitch;
     dc->bits_per_pixel = bitmap->bits_per_pixel;
 
+    /* Surface size changed, re-clamp the clip region */
+    gdi_dc_update_clip(dc);
+
     return prev_handle;
 }
 
@@ -530,6 +591,18 @@ int gdi_save_dc(gdi_handle_table_t *table, uint32_t hdc)
     *saved = *dc;
     saved->saved_dc = dc->saved_dc;
 
+    /*
+     * The clip region is part of the saved state; the visible region, the
+     * DC origin and a window DC's surface binding are not
+     */
+    saved->clip_region = gdi_region_dup(dc->clip_region);
+    saved->vis_region = NULL;
+    saved->eff_region = NULL;
+    if (dc->clip_region && !saved->clip_region) {
+        gdi_free_dc(table, saved);
+        return 0;
+    }
+
     /* Link to chain */
     dc->saved_dc = saved;
     dc->save_level++;
@@ -559,20 +632,299 @@ bool gdi_restore_dc(gdi_handle_table_t *table, uint32_t hdc, int level)
         uint32_t handle = dc->handle;
         gdi_dc_t *next_saved = saved->saved_dc;
         int new_save_level = saved->save_level;
-
-        /* Copy saved state back */
+        gdi_region_t *vis_region = dc->vis_region;
+        gdi_region_t *eff_region = dc->eff_region;
+        int dc_org_x = dc->dc_org_x;
+        int dc_org_y = dc->dc_org_y;
+        uint32_t *pixels = dc->pixels;
+        int width = dc->width, height = dc->height, pitch = dc->pitch;
+        int bits_per_pixel = dc->bits_per_pixel;
+
+        /* Copy saved state back (the saved clip region is handed over) */
+        gdi_region_destroy(dc->clip_region);
         *dc = *saved;
         dc->handle = handle;
         dc->saved_dc = next_saved;
         dc->save_level = new_save_level;
+        dc->vis_region = vis_region;
+        dc->eff_region = eff_region;
+        dc->dc_org_x = dc_org_x;
+        dc->dc_org_y = dc_org_y;
+
+        /*
+         * A memory DC's surface is its selected bitmap, which is saved
+         * state; any other DC is bound to the live display surface.
+         */
+        if (dc->dc_type != DCTYPE_MEMORY) {
+            dc->pixels = pixels;
+            dc->width = width;
+            dc->height = height;
+            dc->pitch = pitch;
+            dc->bits_per_pixel = bits_per_pixel;
+        }
 
         /* Free the saved state */
         gdi_free_dc(table, saved);
     }
 
+    gdi_dc_update_clip(dc);
     return true;
 }
 
+/*
+ * Clipping
+ */
+
+void gdi_dc_update_clip(gdi_dc_t *dc)
+{
+    gdi_region_destroy(dc->eff_region);
+    dc->eff_region = NULL;
+
+    if (!dc->vis_region && !dc->clip_region) {
+        return;  /* Surface bounds only */
+    }
+
+    gdi_region_t *eff = gdi_region_create();
+    if (!eff) {
+        fprintf(stderr, "GDI: Failed to allocate clip region for DC 0x%X\n", dc->handle);
+        return;
+    }
+
+    bool ok = gdi_region_set_rect(eff, 0, 0, dc->width, dc->height);
+    if (ok && dc->vis_region) {
+        ok = gdi_region_intersect(eff, eff, dc->vis_region);
+    }
+    if (ok && dc->clip_region) {
+        gdi_region_t clip;
+        gdi_region_init(&clip);
+        ok = gdi_region_copy(&clip, dc->clip_region);
+        if (ok) {
+            gdi_region_offset(&clip, dc->dc_org_x, dc->dc_org_y);
+            ok = gdi_region_intersect(eff, eff, &clip);
+        }
+        gdi_region_cleanup(&clip);
+    }
+
+    if (!ok) {
+        fprintf(stderr, "GDI: Failed to compute clip region for DC 0x%X\n", dc->handle);
+        gdi_region_destroy(eff);
+        return;
+    }
+
+    dc->eff_region = eff;
+}
+
+void gdi_dc_set_vis_region(gdi_dc_t *dc, gdi_region_t *rgn, int org_x, int org_y)
+{
+    gdi_region_destroy(dc->vis_region);
+    dc->vis_region = rgn;
+    dc->dc_org_x = org_x;
+    dc->dc_org_y = org_y;
+    gdi_dc_update_clip(dc);
+}
+
+void gdi_clip_begin(gdi_dc_t *dc, const RECT *area, gdi_clip_iter_t *iter)
+{
+    iter->area.left = area->left > 0 ? area->left : 0;
+    iter->area.top = area->top > 0 ? area->top : 0;
+    iter->area.right = area->right < dc->width ? area->right : dc->width;
+    iter->area.bottom = area->bottom < dc->height ? area->bottom : dc->height;
+    iter->rects = NULL;
+    iter->index = 0;
+    iter->count = 0;
+
+    if (iter->area.left >= iter->area.right || iter->area.top >= iter->area.bottom) {
+        return;  /* Nothing visible */
+    }
+
+    if (!dc->eff_region) {
+        iter->count = 1;  /* Single unclipped rectangle */
+        return;
+    }
+
+    /* Skip bands above the area */
+    const gdi_region_t *rgn = dc->eff_region;
+    iter->rects = rgn->rects;
+    iter->index = gdi_region_find_band(rgn, iter->area.top);
+    iter->count = rgn->rect_count;
+}
+
+bool gdi_clip_next(gdi_clip_iter_t *iter, RECT *out)
+{
+    if (!iter->rects) {
+        if (iter->index >= iter->count) return false;
+        iter->index++;
+        *out = iter->area;
+        return true;
+    }
+
+    while (iter->index < iter->count) {
+        const RECT *r = &iter->rects[iter->index++];
+
+        /* Bands are sorted by y, so stop once past the area */
+        if (r->top >= iter->area.bottom) {
+            iter->index = iter->count;
+            return false;
+        }
+
+        out->left = r->left > iter->area.left ? r->left : iter->area.left;
+        out->top = r->top > iter->area.top ? r->top : iter->area.top;
+        out->right = r->right < iter->area.right ? r->right : iter->area.right;
+        out->bottom = r->bottom < iter->area.bottom ? r->bottom : iter->area.bottom;
+
+        if (out->left < out->right && out->top < out->bottom) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool gdi_clip_pt(gdi_dc_t *dc, int x, int y)
+{
+    if (x < 0 || x >= dc->width || y < 0 || y >= dc->height) {
+        return false;
+    }
+    return !dc->eff_region || gdi_region_pt_in(dc->eff_region, x, y);
+}
+
+/* Device-space rectangle covered by the DC (visible region extent or surface) */
+static void dc_device_rect(gdi_dc_t *dc, RECT *rect)
+{
+    if (dc->vis_region) {
+        *rect = dc->vis_region->bounds;
+        rect->left -= dc->dc_org_x;
+        rect->right -= dc->dc_org_x;
+        rect->top -= dc->dc_org_y;
+        rect->bottom -= dc->dc_org_y;
+    } else {
+        rect->left = 0;
+        rect->top = 0;
+        rect->right = dc->width;
+        rect->bottom = dc->height;
+    }
+}
+
+/* Get the clip region for modification, creating it from the device rect */
+static gdi_region_t *dc_get_clip_region(gdi_dc_t *dc)
+{
+    if (!dc->clip_region) {
+        RECT rect;
+        dc_device_rect(dc, &rect);
+
+        dc->clip_region = gdi_region_create();
+        if (!dc->clip_region) return NULL;
+        gdi_region_set_rect(dc->clip_region, rect.left, rect.top, rect.right, rect.bottom);
+    }
+    return dc->clip_region;
+}
+
+int gdi_ext_select_clip_rgn(gdi_dc_t *dc, const gdi_region_t *rgn, int mode)
+{
+    if (!rgn) {
+        if (mode != RGN_COPY) return RGN_ERROR;
+
+        /* Reset to no clipping */
+        gdi_region_destroy(dc->clip_region);
+        dc->clip_region = NULL;
+        gdi_dc_update_clip(dc);
+        return SIMPLEREGION;
+    }
+
+    int result;
+    if (mode == RGN_COPY) {
+        if (!dc->clip_region) {
+            dc->clip_region = gdi_region_create();
+            if (!dc->clip_region) return RGN_ERROR;
+        }
+        result = gdi_region_copy(dc->clip_region, rgn) ?
+                 gdi_region_complexity(dc->clip_region) : RGN_ERROR;
+    } else {
+        gdi_region_t *clip = dc_get_clip_region(dc);
+        if (!clip) return RGN_ERROR;
+        result = gdi_region_combine(clip, clip, rgn, mode);
+    }
+
+    gdi_dc_update_clip(dc);
+    return result;
+}
+
+int gdi_intersect_clip_rect(gdi_dc_t *dc, int left, int top, int right, int bottom)
+{
+    RECT rect = {
+        left - dc->win_org_x + dc->vp_org_x, top - dc->win_org_y + dc->vp_org_y,
+        right - dc->win_org_x + dc->vp_org_x, bottom - dc->win_org_y + dc->vp_org_y
+    };
+
+    if (!dc->clip_region) {
+        dc->clip_region = gdi_region_create();
+        if (!dc->clip_region) return RGN_ERROR;
+        gdi_region_set_rect(dc->clip_region, rect.left, rect.top, rect.right, rect.bottom);
+    } else if (!gdi_region_intersect_rect(dc->clip_region, &rect)) {
+        return RGN_ERROR;
+    }
+
+    gdi_dc_update_clip(dc);
+    return gdi_region_complexity(dc->clip_region);
+}
+
+int gdi_exclude_clip_rect(gdi_dc_t *dc, int left, int top, int right, int bottom)
+{
+    RECT rect = {
+        left - dc->win_org_x + dc->vp_org_x, top - dc->win_org_y + dc->vp_org_y,
+        right - dc->win_org_x + dc->vp_org_x, bottom - dc->win_org_y + dc->vp_org_y
+    };
+
+    gdi_region_t *clip = dc_get_clip_region(dc);
+    if (!clip || !gdi_region_subtract_rect(clip, &rect)) {
+        return RGN_ERROR;
+    }
+
+    gdi_dc_update_clip(dc);
+    return gdi_region_complexity(clip);
+}
+
+int gdi_offset_clip_rgn(gdi_dc_t *dc, int x, int y)
+{
+    if (!dc->clip_region) {
+        return SIMPLEREGION;  /* No clip region, nothing to move */
+    }
+
+    gdi_region_offset(dc->clip_region, x, y);
+    gdi_dc_update_clip(dc);
+    return gdi_region_complexity(dc->clip_region);
+}
+
+int gdi_get_clip_box(gdi_dc_t *dc, RECT *rect)
+{
+    int result;
+
+    if (dc->eff_region) {
+        *rect = dc->eff_region->bounds;
+        result = gdi_region_complexity(dc->eff_region);
+    } else {
+        rect->left = 0;
+        rect->top = 0;
+        rect->right = dc->width;
+        rect->bottom = dc->height;
+        result = SIMPLEREGION;
+    }
+
+    if (result == NULLREGION) {
+        memset(rect, 0, sizeof(*rect));
+        return result;
+    }
+
+    /* Surface to logical coordinates */
+    int ox = gdi_dc_offset_x(dc);
+    int oy = gdi_dc_offset_y(dc);
+    rect->left -= ox;
+    rect->right -= ox;
+    rect->top -= oy;
+    rect->bottom -= oy;
+
+    return result;
+}
+
 /*
  * Device capabilities
  */
@@ -6,6 +6,7 @@
 
 #include "gdi_objects.h"
 #include "gdi_handle_table.h"
+#include "gdi_region.h"
 #include "display.h"
 
 /*
@@ -24,6 +25,9 @@ uint32_t gdi_create_compatible_dc(gdi_handle_table_t *table, uint32_t hdc_ref);
 /* Delete a DC */
 bool gdi_delete_dc(gdi_handle_table_t *table, uint32_t hdc);
 
+/* Delete a GDI object of any type; stock objects report success */
+bool gdi_delete_object(gdi_handle_table_t *table, uint32_t hobject);
+
 /* Release a window DC (for GetDC/ReleaseDC pair) */
 int gdi_release_dc(gdi_handle_table_t *table, uint32_t hwnd, uint32_t hdc);
 
@@ -137,6 +141,64 @@ int gdi_save_dc(gdi_handle_table_t *table, uint32_t hdc);
 /* Restore DC state */
 bool gdi_restore_dc(gdi_handle_table_t *table, uint32_t hdc, int level);
 
+/*
+ * Clipping
+ *
+ * Drawing is clipped against eff_region, the intersection of the system
+ * visible region (set by USER for window DCs) and the application clip
+ * region (SelectClipRgn and friends). Both are optional; when neither is
+ * set only the surface bounds apply.
+ */
+
+/* Iterator over the visible parts of a surface-space rectangle */
+typedef struct gdi_clip_iter {
+    RECT area;                  /* Requested area, clamped to the surface */
+    const RECT *rects;          /* Clip rectangles (NULL = area is unclipped) */
+    int index;
+    int count;
+} gdi_clip_iter_t;
+
+/* Offset from logical to surface coordinates */
+static inline int gdi_dc_offset_x(const gdi_dc_t *dc)
+{
+    return dc->vp_org_x - dc->win_org_x + dc->dc_org_x;
+}
+
+static inline int gdi_dc_offset_y(const gdi_dc_t *dc)
+{
+    return dc->vp_org_y - dc->win_org_y + dc->dc_org_y;
+}
+
+/* Recompute the effective clip region after vis/clip changes */
+void gdi_dc_update_clip(gdi_dc_t *dc);
+
+/* Attach a visible region and surface origin to a DC (takes ownership of rgn) */
+void gdi_dc_set_vis_region(gdi_dc_t *dc, gdi_region_t *rgn, int org_x, int org_y);
+
+/* Start iterating the visible parts of a surface-space rectangle */
+void gdi_clip_begin(gdi_dc_t *dc, const RECT *area, gdi_clip_iter_t *iter);
+
+/* Get next visible rectangle, returns false when done */
+bool gdi_clip_next(gdi_clip_iter_t *iter, RECT *out);
+
+/* Check if a surface-space point is visible */
+bool gdi_clip_pt(gdi_dc_t *dc, int x, int y);
+
+/* ExtSelectClipRgn (rgn in device coords, NULL with RGN_COPY resets) */
+int gdi_ext_select_clip_rgn(gdi_dc_t *dc, const gdi_region_t *rgn, int mode);
+
+/* Intersect clip region with a logical rectangle */
+int gdi_intersect_clip_rect(gdi_dc_t *dc, int left, int top, int right, int bottom);
+
+/* Exclude a logical rectangle from the clip region */
+int gdi_exclude_clip_rect(gdi_dc_t *dc, int left, int top, int right, int bottom);
+
+/* Move the clip region */
+int gdi_offset_clip_rgn(gdi_dc_t *dc, int x, int y);
+
+/* Get clip box in logical coordinates, returns region complexity */
+int gdi_get_clip_box(gdi_dc_t *dc, RECT *rect);
+
 /*
  * Device capabilities
  */
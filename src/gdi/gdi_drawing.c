@@ -6,6 +6,10 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 /* Common ROP3 codes */
 #define ROP_BLACKNESS   0x00000042
 #define ROP_NOTSRCERASE 0x001100A6
@@ -23,42 +27,51 @@
 #define ROP_PATPAINT    0x00FB0A09
 #define ROP_WHITENESS   0x00FF0062
 
-/* Region complexity results */
-#define NULLREGION      1
-#define SIMPLEREGION    2
-#define COMPLEXREGION   3
-
-/* Combine region modes */
-#define RGN_AND         1
-#define RGN_OR          2
-#define RGN_XOR         3
-#define RGN_DIFF        4
-#define RGN_COPY        5
+/* ROP2 codes with fast paths */
+#define R2_NOP          11
+#define R2_COPYPEN      13
 
 /*
  * Clipping helpers
  */
 
+/* Transform a logical rectangle to surface coordinates */
+static void rect_to_surface(gdi_dc_t *dc, const RECT *rect, RECT *out)
+{
+    int ox = gdi_dc_offset_x(dc);
+    int oy = gdi_dc_offset_y(dc);
+
+    out->left = rect->left + ox;
+    out->top = rect->top + oy;
+    out->right = rect->right + ox;
+    out->bottom = rect->bottom + oy;
+}
+
 bool gdi_clip_rect(gdi_dc_t *dc, int *x, int *y, int *width, int *height)
 {
     /* Apply DC origin */
-    int ox = *x + dc->vp_org_x - dc->win_org_x;
-    int oy = *y + dc->vp_org_y - dc->win_org_y;
+    int ox = *x + gdi_dc_offset_x(dc);
+    int oy = *y + gdi_dc_offset_y(dc);
+
+    /* Clip to the clip box (surface bounds when unclipped) */
+    RECT box = { 0, 0, dc->width, dc->height };
+    if (dc->eff_region) {
+        box = dc->eff_region->bounds;
+    }
 
-    /* Clip to DC bounds */
-    if (ox < 0) {
-        *width += ox;
-        ox = 0;
+    if (ox < box.left) {
+        *width -= box.left - ox;
+        ox = box.left;
     }
-    if (oy < 0) {
-        *height += oy;
-        oy = 0;
+    if (oy < box.top) {
+        *height -= box.top - oy;
+        oy = box.top;
     }
-    if (ox + *width > dc->width) {
-        *width = dc->width - ox;
+    if (ox + *width > box.right) {
+        *width = box.right - ox;
     }
-    if (oy + *height > dc->height) {
-        *height = dc->height - oy;
+    if (oy + *height > box.bottom) {
+        *height = box.bottom - oy;
     }
 
     *x = ox;
@@ -70,20 +83,18 @@ bool gdi_clip_rect(gdi_dc_t *dc, int *x, int *y, int *width, int *height)
 bool gdi_pt_visible(gdi_dc_t *dc, int x, int y)
 {
     /* Apply DC origin */
-    x = x + dc->vp_org_x - dc->win_org_x;
-    y = y + dc->vp_org_y - dc->win_org_y;
-
-    return (x >= 0 && x < dc->width && y >= 0 && y < dc->height);
+    return gdi_clip_pt(dc, x + gdi_dc_offset_x(dc), y + gdi_dc_offset_y(dc));
 }
 
 bool gdi_rect_visible(gdi_dc_t *dc, const RECT *rect)
 {
-    int x = rect->left + dc->vp_org_x - dc->win_org_x;
-    int y = rect->top + dc->vp_org_y - dc->win_org_y;
-    int r = rect->right + dc->vp_org_x - dc->win_org_x;
-    int b = rect->bottom + dc->vp_org_y - dc->win_org_y;
+    RECT r;
+    rect_to_surface(dc, rect, &r);
 
-    return (x < dc->width && r > 0 && y < dc->height && b > 0);
+    gdi_clip_iter_t iter;
+    RECT visible;
+    gdi_clip_begin(dc, &r, &iter);
+    return gdi_clip_next(&iter, &visible);
 }
 
 /*
@@ -102,8 +113,8 @@ uint32_t gdi_apply_rop3(uint32_t dst, uint32_t src, uint32_t pat, uint32_t rop)
         int s = (src & mask) ? 1 : 0;
         int p = (pat & mask) ? 1 : 0;
 
-        /* Build index: bit 2 = dst, bit 1 = src, bit 0 = pat */
-        int index = (d << 2) | (s << 1) | p;
+        /* Build index: bit 2 = pat, bit 1 = src, bit 0 = dst */
+        int index = (p << 2) | (s << 1) | d;
 
         if (code & (1 << index)) {
             result |= mask;
@@ -139,6 +150,18 @@ uint32_t gdi_apply_rop2(uint32_t dst, uint32_t src, int rop2)
  * Rectangle operations
  */
 
+static void fill_solid(gdi_dc_t *dc, const RECT *r, uint32_t color)
+{
+    int width = r->right - r->left;
+
+    for (int row = r->top; row < r->bottom; row++) {
+        uint32_t *dst = dc->pixels + row * (dc->pitch / 4) + r->left;
+        for (int col = 0; col < width; col++) {
+            *dst++ = color;
+        }
+    }
+}
+
 int gdi_fill_rect(gdi_dc_t *dc, const RECT *rect, gdi_brush_t *brush)
 {
     if (!dc || !rect || !brush) return 0;
@@ -147,26 +170,17 @@ int gdi_fill_rect(gdi_dc_t *dc, const RECT *rect, gdi_brush_t *brush)
     /* NULL brush = no fill */
     if (brush->style == BS_NULL) return 1;
 
-    int x = rect->left;
-    int y = rect->top;
-    int width = rect->right - rect->left;
-    int height = rect->bottom - rect->top;
-
-    if (!gdi_clip_rect(dc, &x, &y, &width, &height)) {
-        return 1;  /* Nothing to draw, but not an error */
-    }
-
     uint32_t color = colorref_to_argb(brush->color);
 
-    /* Fill rectangle */
-    for (int row = y; row < y + height; row++) {
-        uint32_t *dst = dc->pixels + row * (dc->pitch / 4) + x;
-        for (int col = 0; col < width; col++) {
-            *dst++ = color;
-        }
+    RECT area, r;
+    gdi_clip_iter_t iter;
+    rect_to_surface(dc, rect, &area);
+    gdi_clip_begin(dc, &area, &iter);
+    while (gdi_clip_next(&iter, &r)) {
+        fill_solid(dc, &r, color);
+        dc->dirty = true;
     }
 
-    dc->dirty = true;
     return 1;
 }
 
@@ -225,24 +239,22 @@ bool gdi_invert_rect(gdi_dc_t *dc, const RECT *rect)
 {
     if (!dc || !rect || !dc->pixels) return false;
 
-    int x = rect->left;
-    int y = rect->top;
-    int width = rect->right - rect->left;
-    int height = rect->bottom - rect->top;
-
-    if (!gdi_clip_rect(dc, &x, &y, &width, &height)) {
-        return true;
-    }
-
-    for (int row = y; row < y + height; row++) {
-        uint32_t *dst = dc->pixels + row * (dc->pitch / 4) + x;
-        for (int col = 0; col < width; col++) {
-            *dst = ~(*dst) | 0xFF000000;  /* Invert RGB, keep alpha */
-            dst++;
+    RECT area, r;
+    gdi_clip_iter_t iter;
+    rect_to_surface(dc, rect, &area);
+    gdi_clip_begin(dc, &area, &iter);
+    while (gdi_clip_next(&iter, &r)) {
+        int width = r.right - r.left;
+        for (int row = r.top; row < r.bottom; row++) {
+            uint32_t *dst = dc->pixels + row * (dc->pitch / 4) + r.left;
+            for (int col = 0; col < width; col++) {
+                *dst = ~(*dst) | 0xFF000000;  /* Invert RGB, keep alpha */
+                dst++;
+            }
         }
+        dc->dirty = true;
     }
 
-    dc->dirty = true;
     return true;
 }
 
@@ -250,51 +262,27 @@ bool gdi_invert_rect(gdi_dc_t *dc, const RECT *rect)
  * BitBlt operations
  */
 
-bool gdi_pat_blt(gdi_dc_t *dc, int x, int y, int width, int height, uint32_t rop)
+static void pat_blt_rect(gdi_dc_t *dc, const RECT *r, uint32_t pat_color, uint32_t rop)
 {
-    if (!dc || !dc->pixels) return false;
-
-    /* Get pattern (brush) color */
-    uint32_t pat_color = 0xFFFFFFFF;  /* Default white */
-    if (dc->brush) {
-        if (dc->brush->style == BS_NULL) {
-            /* NULL brush - check ROP */
-            if ((rop >> 16) == 0x00) return true;  /* BLACKNESS */
-            if ((rop >> 16) == 0xFF) {
-                pat_color = 0xFFFFFFFF;  /* WHITENESS */
-            }
-        } else {
-            pat_color = colorref_to_argb(dc->brush->color);
-        }
-    }
-
-    if (!gdi_clip_rect(dc, &x, &y, &width, &height)) {
-        return true;
-    }
+    int width = r->right - r->left;
 
     /* Handle common ROP cases */
-    uint8_t rop_code = (rop >> 16) & 0xFF;
-
     switch (rop) {
         case ROP_BLACKNESS:
-            pat_color = 0xFF000000;
-            goto fill;
+            fill_solid(dc, r, 0xFF000000);
+            break;
+
         case ROP_WHITENESS:
-            pat_color = 0xFFFFFFFF;
-            goto fill;
+            fill_solid(dc, r, 0xFFFFFFFF);
+            break;
+
         case ROP_PATCOPY:
-        fill:
-            for (int row = y; row < y + height; row++) {
-                uint32_t *dst = dc->pixels + row * (dc->pitch / 4) + x;
-                for (int col = 0; col < width; col++) {
-                    *dst++ = pat_color;
-                }
-            }
+            fill_solid(dc, r, pat_color);
             break;
 
         case ROP_PATINVERT:
-            for (int row = y; row < y + height; row++) {
-                uint32_t *dst = dc->pixels + row * (dc->pitch / 4) + x;
+            for (int row = r->top; row < r->bottom; row++) {
+                uint32_t *dst = dc->pixels + row * (dc->pitch / 4) + r->left;
                 for (int col = 0; col < width; col++) {
                     *dst = (*dst ^ pat_color) | 0xFF000000;
                     dst++;
@@ -303,8 +291,8 @@ bool gdi_pat_blt(gdi_dc_t *dc, int x, int y, int width, int height, uint32_t rop
             break;
 
         case ROP_DSTINVERT:
-            for (int row = y; row < y + height; row++) {
-                uint32_t *dst = dc->pixels + row * (dc->pitch / 4) + x;
+            for (int row = r->top; row < r->bottom; row++) {
+                uint32_t *dst = dc->pixels + row * (dc->pitch / 4) + r->left;
                 for (int col = 0; col < width; col++) {
                     *dst = (~*dst) | 0xFF000000;
                     dst++;
@@ -314,8 +302,8 @@ bool gdi_pat_blt(gdi_dc_t *dc, int x, int y, int width, int height, uint32_t rop
 
         default:
             /* General case using ROP3 */
-            for (int row = y; row < y + height; row++) {
-                uint32_t *dst = dc->pixels + row * (dc->pitch / 4) + x;
+            for (int row = r->top; row < r->bottom; row++) {
+                uint32_t *dst = dc->pixels + row * (dc->pitch / 4) + r->left;
                 for (int col = 0; col < width; col++) {
                     *dst = gdi_apply_rop3(*dst, 0, pat_color, rop);
                     dst++;
@@ -323,11 +311,86 @@ bool gdi_pat_blt(gdi_dc_t *dc, int x, int y, int width, int height, uint32_t rop
             }
             break;
     }
+}
+
+bool gdi_pat_blt(gdi_dc_t *dc, int x, int y, int width, int height, uint32_t rop)
+{
+    if (!dc || !dc->pixels) return false;
+
+    /* Get pattern (brush) color */
+    uint32_t pat_color = 0xFFFFFFFF;  /* Default white */
+    if (dc->brush) {
+        if (dc->brush->style == BS_NULL) {
+            /* NULL brush - check ROP */
+            if ((rop >> 16) == 0x00) return true;  /* BLACKNESS */
+            if ((rop >> 16) == 0xFF) {
+                pat_color = 0xFFFFFFFF;  /* WHITENESS */
+            }
+        } else {
+            pat_color = colorref_to_argb(dc->brush->color);
+        }
+    }
+
+    /* Normalize negative extents */
+    if (width < 0) { x += width; width = -width; }
+    if (height < 0) { y += height; height = -height; }
+
+    RECT logical = { x, y, x + width, y + height };
+    RECT area, r;
+    gdi_clip_iter_t iter;
+    rect_to_surface(dc, &logical, &area);
+    gdi_clip_begin(dc, &area, &iter);
+    while (gdi_clip_next(&iter, &r)) {
+        pat_blt_rect(dc, &r, pat_color, rop);
+        dc->dirty = true;
+    }
 
-    dc->dirty = true;
     return true;
 }
 
+/* Pattern colour for source blits: white when there is no brush or a NULL brush */
+static uint32_t blt_pattern_color(const gdi_dc_t *dc)
+{
+    if (dc->brush && dc->brush->style != BS_NULL) {
+        return colorref_to_argb(dc->brush->color);
+    }
+    return 0xFFFFFFFF;
+}
+
+/* Combine one row of source pixels into the destination */
+static void blt_span(uint32_t *dst, const uint32_t *src, int w, uint32_t rop, uint32_t pat_color)
+{
+    switch (rop) {
+        case ROP_SRCCOPY:
+            memmove(dst, src, w * 4);
+            break;
+
+        case ROP_SRCAND:
+            for (int col = 0; col < w; col++) {
+                dst[col] = (dst[col] & src[col]) | 0xFF000000;
+            }
+            break;
+
+        case ROP_SRCPAINT:
+            for (int col = 0; col < w; col++) {
+                dst[col] = (dst[col] | src[col]) | 0xFF000000;
+            }
+            break;
+
+        case ROP_SRCINVERT:
+            for (int col = 0; col < w; col++) {
+                dst[col] = (dst[col] ^ src[col]) | 0xFF000000;
+            }
+            break;
+
+        default:
+            for (int col = 0; col < w; col++) {
+                dst[col] = gdi_apply_rop3(dst[col], src[col], pat_color, rop);
+            }
+            break;
+    }
+}
+
 bool gdi_bit_blt(gdi_dc_t *dst_dc, int dst_x, int dst_y, int width, int height,
                   gdi_dc_t *src_dc, int src_x, int src_y, uint32_t rop)
 {
@@ -338,80 +401,230 @@ bool gdi_bit_blt(gdi_dc_t *dst_dc, int dst_x, int dst_y, int width, int height,
         return gdi_pat_blt(dst_dc, dst_x, dst_y, width, height, rop);
     }
 
-    /* Clip destination */
-    int orig_dst_x = dst_x, orig_dst_y = dst_y;
-    if (!gdi_clip_rect(dst_dc, &dst_x, &dst_y, &width, &height)) {
-        return true;
-    }
-
-    /* Adjust source based on clipping */
-    src_x += (dst_x - orig_dst_x);
-    src_y += (dst_y - orig_dst_y);
+    /* Destination area and source position in surface coordinates */
+    RECT area = { dst_x, dst_y, dst_x + width, dst_y + height };
+    rect_to_surface(dst_dc, &area, &area);
+    src_x += gdi_dc_offset_x(src_dc);
+    src_y += gdi_dc_offset_y(src_dc);
 
-    /* Clip source */
+    /* Clip against the source surface */
     if (src_x < 0) {
-        width += src_x;
-        dst_x -= src_x;
+        area.left -= src_x;
         src_x = 0;
     }
     if (src_y < 0) {
-        height += src_y;
-        dst_y -= src_y;
+        area.top -= src_y;
         src_y = 0;
     }
-    if (src_x + width > src_dc->width) {
-        width = src_dc->width - src_x;
+    if (src_x + (area.right - area.left) > src_dc->width) {
+        area.right = area.left + (src_dc->width - src_x);
     }
-    if (src_y + height > src_dc->height) {
-        height = src_dc->height - src_y;
+    if (src_y + (area.bottom - area.top) > src_dc->height) {
+        area.bottom = area.top + (src_dc->height - src_y);
     }
 
-    if (width <= 0 || height <= 0) return true;
-
-    /* Get pattern color */
-    uint32_t pat_color = 0xFFFFFFFF;
-    if (dst_dc->brush && dst_dc->brush->style != BS_NULL) {
-        pat_color = colorref_to_argb(dst_dc->brush->color);
+    if (area.right <= area.left || area.bottom <= area.top) return true;
+
+    /* Source pixel for destination (x, y) is src_base[(y + sy) * src_pitch + x + sx] */
+    const uint32_t *src_base = src_dc->pixels;
+    int src_pitch = src_dc->pitch / 4;
+    int sx = src_x - area.left;
+    int sy = src_y - area.top;
+
+    /*
+     * Blits within one surface (scrolling) may overlap; snapshot the source
+     * so that clip rectangles can be processed in any order.
+     */
+    uint32_t *snapshot = NULL;
+    if (src_dc->pixels == dst_dc->pixels) {
+        int w = area.right - area.left;
+        int h = area.bottom - area.top;
+        snapshot = malloc((size_t)w * h * sizeof(uint32_t));
+        if (snapshot) {
+            for (int row = 0; row < h; row++) {
+                memcpy(snapshot + row * w,
+                       src_dc->pixels + (src_y + row) * src_pitch + src_x,
+                       w * sizeof(uint32_t));
+            }
+            src_base = snapshot;
+            src_pitch = w;
+            sx = -area.left;
+            sy = -area.top;
+        }
     }
 
-    /* Perform blit */
-    for (int row = 0; row < height; row++) {
-        uint32_t *dst = dst_dc->pixels + (dst_y + row) * (dst_dc->pitch / 4) + dst_x;
-        uint32_t *src = src_dc->pixels + (src_y + row) * (src_dc->pitch / 4) + src_x;
+    uint32_t pat_color = blt_pattern_color(dst_dc);
 
-        switch (rop) {
-            case ROP_SRCCOPY:
-                memcpy(dst, src, width * 4);
-                break;
+    /* Perform blit for each visible part of the destination */
+    RECT r;
+    gdi_clip_iter_t iter;
+    gdi_clip_begin(dst_dc, &area, &iter);
+    while (gdi_clip_next(&iter, &r)) {
+        int w = r.right - r.left;
 
-            case ROP_SRCAND:
-                for (int col = 0; col < width; col++) {
-                    dst[col] = (dst[col] & src[col]) | 0xFF000000;
-                }
-                break;
+        for (int row = r.top; row < r.bottom; row++) {
+            uint32_t *dst = dst_dc->pixels + row * (dst_dc->pitch / 4) + r.left;
+            const uint32_t *src = src_base + (row + sy) * src_pitch + r.left + sx;
 
-            case ROP_SRCPAINT:
-                for (int col = 0; col < width; col++) {
-                    dst[col] = (dst[col] | src[col]) | 0xFF000000;
-                }
-                break;
+            blt_span(dst, src, w, rop, pat_color);
+        }
+        dst_dc->dirty = true;
+    }
 
-            case ROP_SRCINVERT:
-                for (int col = 0; col < width; col++) {
-                    dst[col] = (dst[col] ^ src[col]) | 0xFF000000;
-                }
-                break;
+    free(snapshot);
+    return true;
+}
 
-            default:
-                for (int col = 0; col < width; col++) {
-                    dst[col] = gdi_apply_rop3(dst[col], src[col], pat_color, rop);
-                }
-                break;
+/*
+ * StretchBlt
+ *
+ * Source coordinates for every destination column and row are computed
+ * once per call with an incremental DDA, then each visible row is scaled
+ * into a span buffer and combined with the destination. Consecutive rows
+ * that map to the same source row reuse the span.
+ */
+
+/* Source sample for one destination column or row */
+typedef struct stretch_map {
+    int32_t idx;                /* First source tap (surface coordinates) */
+    int32_t idx2;               /* Second source tap for filtering */
+    uint32_t frac;              /* Weight of the second tap, 0..255 */
+} stretch_map_t;
+
+/*
+ * Build the source map for dst_count destination pixels starting at
+ * dst_first within a destination extent of dst_len, mapped onto the
+ * source extent [src_pos, src_pos + src_len) of a surface src_limit
+ * pixels wide. Returns the [lo, hi) range of entries whose source taps
+ * lie on the surface.
+ */
+static void stretch_build_map(stretch_map_t *map, int dst_first, int dst_count, int dst_len,
+                              int src_pos, int src_len, int src_limit, bool mirror,
+                              bool filter, int *lo, int *hi)
+{
+    *lo = dst_count;
+    *hi = 0;
+
+    if (filter) {
+        /* 16.16 fixed point: sample at pixel centres */
+        int64_t step = ((int64_t)src_len << 16) / dst_len;
+        int64_t pos = (((int64_t)(2 * dst_first + 1) * src_len) << 16) / (2 * dst_len) - 0x8000;
+
+        for (int i = 0; i < dst_count; i++, pos += step) {
+            int64_t p = mirror ? ((int64_t)(src_len - 1) << 16) - pos : pos;
+            if (p < 0) p = 0;
+            if (p > ((int64_t)(src_len - 1) << 16)) p = (int64_t)(src_len - 1) << 16;
+
+            int idx = src_pos + (int)(p >> 16);
+            map[i].idx = idx;
+            map[i].idx2 = idx + 1 < src_pos + src_len ? idx + 1 : idx;
+            map[i].frac = (uint32_t)(p >> 8) & 0xFF;
+
+            if (idx >= 0 && idx < src_limit) {
+                if (map[i].idx2 >= src_limit) map[i].idx2 = idx;
+                if (i < *lo) *lo = i;
+                *hi = i + 1;
+            }
+        }
+    } else {
+        /* Exact integer DDA: rel = floor(i * src_len / dst_len) */
+        int q = src_len / dst_len;
+        int r = src_len % dst_len;
+        int64_t start = (int64_t)dst_first * src_len;
+        int rel = (int)(start / dst_len);
+        int acc = (int)(start % dst_len);
+
+        for (int i = 0; i < dst_count; i++) {
+            int idx = src_pos + (mirror ? src_len - 1 - rel : rel);
+            map[i].idx = idx;
+            map[i].idx2 = idx;
+            map[i].frac = 0;
+
+            if (idx >= 0 && idx < src_limit) {
+                if (i < *lo) *lo = i;
+                *hi = i + 1;
+            }
+
+            rel += q;
+            acc += r;
+            if (acc >= dst_len) {
+                acc -= dst_len;
+                rel++;
+            }
         }
     }
+}
 
-    dst_dc->dirty = true;
-    return true;
+static void stretch_span_nearest(uint32_t *out, const uint32_t *src_row,
+                                 const stretch_map_t *xmap, int count)
+{
+    /* Unmirrored maps never step back: ends count - 1 apart are a 1:1 run */
+    if (xmap[count - 1].idx - xmap[0].idx == count - 1) {
+        memcpy(out, src_row + xmap[0].idx, (size_t)count * sizeof(uint32_t));
+        return;
+    }
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        out[i] = src_row[xmap[i].idx];
+        out[i + 1] = src_row[xmap[i + 1].idx];
+        out[i + 2] = src_row[xmap[i + 2].idx];
+        out[i + 3] = src_row[xmap[i + 3].idx];
+    }
+    for (; i < count; i++) {
+        out[i] = src_row[xmap[i].idx];
+    }
+}
+
+static void stretch_span_bilinear(uint32_t *out, const uint32_t *row0, const uint32_t *row1,
+                                  const stretch_map_t *xmap, int count, uint32_t fy)
+{
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i wy0 = _mm_set1_epi16((short)(256 - fy));
+    const __m128i wy1 = _mm_set1_epi16((short)fy);
+
+    for (int i = 0; i < count; i++) {
+        const stretch_map_t *m = &xmap[i];
+
+        /* Left and right taps of both rows as 16-bit channels */
+        __m128i top = _mm_unpacklo_epi32(_mm_cvtsi32_si128((int)row0[m->idx]),
+                                         _mm_cvtsi32_si128((int)row0[m->idx2]));
+        __m128i bot = _mm_unpacklo_epi32(_mm_cvtsi32_si128((int)row1[m->idx]),
+                                         _mm_cvtsi32_si128((int)row1[m->idx2]));
+        top = _mm_unpacklo_epi8(top, zero);
+        bot = _mm_unpacklo_epi8(bot, zero);
+
+        /* Vertical blend: at most 255 * 256, fits in 16 bits */
+        __m128i v = _mm_add_epi16(_mm_mullo_epi16(top, wy0), _mm_mullo_epi16(bot, wy1));
+        v = _mm_srli_epi16(v, 8);
+
+        /* Horizontal blend of the left (low) and right (high) halves */
+        __m128i wx = _mm_set_epi16((short)m->frac, (short)m->frac, (short)m->frac, (short)m->frac,
+                                   (short)(256 - m->frac), (short)(256 - m->frac),
+                                   (short)(256 - m->frac), (short)(256 - m->frac));
+        v = _mm_mullo_epi16(v, wx);
+        v = _mm_add_epi16(v, _mm_srli_si128(v, 8));
+        v = _mm_srli_epi16(v, 8);
+
+        out[i] = (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(v, v));
+    }
+#else
+    for (int i = 0; i < count; i++) {
+        const stretch_map_t *m = &xmap[i];
+        uint32_t a = row0[m->idx], b = row0[m->idx2];
+        uint32_t c = row1[m->idx], d = row1[m->idx2];
+        uint32_t fx = m->frac;
+        uint32_t result = 0;
+
+        for (int shift = 0; shift < 32; shift += 8) {
+            uint32_t top = (((a >> shift) & 0xFF) * (256 - fx) + ((b >> shift) & 0xFF) * fx) >> 8;
+            uint32_t bot = (((c >> shift) & 0xFF) * (256 - fx) + ((d >> shift) & 0xFF) * fx) >> 8;
+            result |= ((top * (256 - fy) + bot * fy) >> 8) << shift;
+        }
+        out[i] = result;
+    }
+#endif
 }
 
 bool gdi_stretch_blt(gdi_dc_t *dst_dc, int dst_x, int dst_y, int dst_w, int dst_h,
@@ -421,37 +634,442 @@ bool gdi_stretch_blt(gdi_dc_t *dst_dc, int dst_x, int dst_y, int dst_w, int dst_
     if (!dst_dc || !src_dc || !dst_dc->pixels || !src_dc->pixels) {
         return false;
     }
+    if (dst_w == 0 || dst_h == 0 || src_w == 0 || src_h == 0) return true;
+
+    /* Negative extents mirror the image */
+    bool mirror_x = (dst_w < 0) != (src_w < 0);
+    bool mirror_y = (dst_h < 0) != (src_h < 0);
+    if (dst_w < 0) { dst_x += dst_w; dst_w = -dst_w; }
+    if (dst_h < 0) { dst_y += dst_h; dst_h = -dst_h; }
+    if (src_w < 0) { src_x += src_w; src_w = -src_w; }
+    if (src_h < 0) { src_y += src_h; src_h = -src_h; }
+
+    /* Unscaled copies take the BitBlt path */
+    if (dst_w == src_w && dst_h == src_h && !mirror_x && !mirror_y) {
+        return gdi_bit_blt(dst_dc, dst_x, dst_y, dst_w, dst_h, src_dc, src_x, src_y, rop);
+    }
+
+    /* Surface coordinates */
+    RECT area = { dst_x, dst_y, dst_x + dst_w, dst_y + dst_h };
+    rect_to_surface(dst_dc, &area, &area);
+    src_x += gdi_dc_offset_x(src_dc);
+    src_y += gdi_dc_offset_y(src_dc);
+
+    /* Only the part of the destination on the surface needs a map */
+    RECT span_area = {
+        area.left > 0 ? area.left : 0,
+        area.top > 0 ? area.top : 0,
+        area.right < dst_dc->width ? area.right : dst_dc->width,
+        area.bottom < dst_dc->height ? area.bottom : dst_dc->height
+    };
+    int cols = span_area.right - span_area.left;
+    int rows = span_area.bottom - span_area.top;
+    if (cols <= 0 || rows <= 0) return true;
+
+    /*
+     * HALFTONE is approximated with bilinear filtering. BLACKONWHITE and
+     * WHITEONBLACK only differ for monochrome data, so on true-colour
+     * surfaces they behave like COLORONCOLOR.
+     */
+    bool filter = (dst_dc->stretch_mode == HALFTONE);
+
+    stretch_map_t *xmap = malloc((size_t)(cols + rows) * sizeof(stretch_map_t));
+    uint32_t *span = malloc((size_t)cols * sizeof(uint32_t));
+    if (!xmap || !span) {
+        free(xmap);
+        free(span);
+        return false;
+    }
+    stretch_map_t *ymap = xmap + cols;
+
+    int x_lo, x_hi, y_lo, y_hi;
+    stretch_build_map(xmap, span_area.left - area.left, cols, dst_w, src_x, src_w,
+                      src_dc->width, mirror_x, filter, &x_lo, &x_hi);
+    stretch_build_map(ymap, span_area.top - area.top, rows, dst_h, src_y, src_h,
+                      src_dc->height, mirror_y, filter, &y_lo, &y_hi);
+
+    /* Restrict to the destination range whose source lies on the surface */
+    RECT valid = {
+        span_area.left + x_lo, span_area.top + y_lo,
+        span_area.left + x_hi, span_area.top + y_hi
+    };
+
+    uint32_t pat = blt_pattern_color(dst_dc);
+
+    const uint32_t *src_base = src_dc->pixels;
+    int src_pitch = src_dc->pitch / 4;
+    int dst_pitch = dst_dc->pitch / 4;
+
+    /*
+     * Stretching within one surface may overlap: snapshot the band of
+     * source rows the visible rows read before writing any of them.
+     */
+    uint32_t *snapshot = NULL;
+    int band_top = 0;
+    if (src_dc->pixels == dst_dc->pixels && valid.left < valid.right && valid.top < valid.bottom) {
+        int band_bottom = 0;
+        band_top = src_dc->height;
+        for (int i = y_lo; i < y_hi; i++) {
+            int lo = ymap[i].idx < ymap[i].idx2 ? ymap[i].idx : ymap[i].idx2;
+            int hi = ymap[i].idx < ymap[i].idx2 ? ymap[i].idx2 : ymap[i].idx;
+            if (lo < band_top) band_top = lo;
+            if (hi + 1 > band_bottom) band_bottom = hi + 1;
+        }
+        snapshot = malloc((size_t)(band_bottom - band_top) * src_pitch * sizeof(uint32_t));
+        if (!snapshot) {
+            free(xmap);
+            free(span);
+            return false;
+        }
+        memcpy(snapshot, src_dc->pixels + band_top * src_pitch,
+               (size_t)(band_bottom - band_top) * src_pitch * sizeof(uint32_t));
+        src_base = snapshot;
+    }
+
+    RECT r;
+    gdi_clip_iter_t iter;
+    gdi_clip_begin(dst_dc, &valid, &iter);
+    while (gdi_clip_next(&iter, &r)) {
+        int w = r.right - r.left;
+        const stretch_map_t *xm = xmap + (r.left - span_area.left);
+        const stretch_map_t *last = NULL;
+
+        for (int py = r.top; py < r.bottom; py++) {
+            const stretch_map_t *ym = &ymap[py - span_area.top];
+            if (ym->idx < 0 || ym->idx >= src_dc->height) continue;
+
+            /* Rebuild the span only when the source row changes */
+            if (!last || last->idx != ym->idx || last->frac != ym->frac) {
+                const uint32_t *row0 = src_base + (ym->idx - band_top) * src_pitch;
+                if (filter) {
+                    const uint32_t *row1 = src_base + (ym->idx2 - band_top) * src_pitch;
+                    stretch_span_bilinear(span, row0, row1, xm, w, ym->frac);
+                } else {
+                    stretch_span_nearest(span, row0, xm, w);
+                }
+                last = ym;
+            }
+
+            blt_span(dst_dc->pixels + py * dst_pitch + r.left, span, w, rop, pat);
+        }
+        dst_dc->dirty = true;
+    }
+
+    free(snapshot);
+    free(xmap);
+    free(span);
+    return true;
+}
+
+/*
+ * Span output
+ *
+ * Lines, polygons and curves are all rasterised into horizontal spans in
+ * surface coordinates. Each span is clipped against the effective clip
+ * region and written with a solid fill for R2_COPYPEN, or through the
+ * DC's ROP2 mode otherwise.
+ */
+
+typedef struct {
+    gdi_dc_t *dc;
+    uint32_t color;
+    int rop2;
+} span_target_t;
+
+static void fill_rop2(gdi_dc_t *dc, const RECT *area, uint32_t color, int rop2)
+{
+    if (rop2 == R2_NOP) return;
+
+    RECT r;
+    gdi_clip_iter_t iter;
+    gdi_clip_begin(dc, area, &iter);
+    while (gdi_clip_next(&iter, &r)) {
+        if (rop2 == R2_COPYPEN) {
+            fill_solid(dc, &r, color);
+        } else {
+            int width = r.right - r.left;
+            for (int row = r.top; row < r.bottom; row++) {
+                uint32_t *dst = dc->pixels + row * (dc->pitch / 4) + r.left;
+                for (int col = 0; col < width; col++) {
+                    *dst = gdi_apply_rop2(*dst, color, rop2) | 0xFF000000;
+                    dst++;
+                }
+            }
+        }
+        dc->dirty = true;
+    }
+}
+
+/* Fill [x0, x1) on row y */
+static void span_emit(const span_target_t *t, int y, int x0, int x1)
+{
+    if (x0 >= x1) return;
+
+    RECT area = { x0, y, x1, y + 1 };
+    fill_rop2(t->dc, &area, t->color, t->rop2);
+}
+
+static void plot_pixel(const span_target_t *t, int x, int y)
+{
+    if (t->rop2 == R2_NOP || !gdi_clip_pt(t->dc, x, y)) return;
+
+    uint32_t *dst = t->dc->pixels + y * (t->dc->pitch / 4) + x;
+    if (t->rop2 == R2_COPYPEN) {
+        *dst = t->color;
+    } else {
+        *dst = gdi_apply_rop2(*dst, t->color, t->rop2) | 0xFF000000;
+    }
+    t->dc->dirty = true;
+}
+
+/* Rows [top, bottom) the clip region can touch */
+static void clip_rows(gdi_dc_t *dc, int *top, int *bottom)
+{
+    *top = 0;
+    *bottom = dc->height;
+    if (dc->eff_region) {
+        *top = dc->eff_region->bounds.top;
+        *bottom = dc->eff_region->bounds.bottom;
+    }
+}
+
+static bool pen_target(gdi_dc_t *dc, span_target_t *t, int *width)
+{
+    if (!dc->pen || dc->pen->style == PS_NULL) return false;
+
+    t->dc = dc;
+    t->color = colorref_to_argb(dc->pen->color);
+    t->rop2 = dc->rop2;
+    *width = dc->pen->width > 1 ? dc->pen->width : 1;
+    return true;
+}
+
+static bool brush_target(gdi_dc_t *dc, span_target_t *t)
+{
+    if (!dc->brush || dc->brush->style == BS_NULL) return false;
+
+    t->dc = dc;
+    t->color = colorref_to_argb(dc->brush->color);
+    t->rop2 = dc->rop2;
+    return true;
+}
+
+static void points_to_surface(gdi_dc_t *dc, const POINT *in, POINT *out, int count)
+{
+    int ox = gdi_dc_offset_x(dc);
+    int oy = gdi_dc_offset_y(dc);
+
+    for (int i = 0; i < count; i++) {
+        out[i].x = in[i].x + ox;
+        out[i].y = in[i].y + oy;
+    }
+}
+
+static uint64_t isqrt64(uint64_t v)
+{
+    uint64_t result = 0;
+    uint64_t bit = 1ull << 62;
+
+    while (bit > v) bit >>= 2;
+    while (bit) {
+        if (v >= result + bit) {
+            v -= result + bit;
+            result = (result >> 1) + bit;
+        } else {
+            result >>= 1;
+        }
+        bit >>= 2;
+    }
+    return result;
+}
+
+/* a / b rounded to nearest, b > 0 */
+static inline int div_round(int64_t a, int64_t b)
+{
+    return (int)(a >= 0 ? (a + b / 2) / b : -((-a + b / 2) / b));
+}
+
+/*
+ * Polygon scan conversion
+ *
+ * Classic edge table: non-horizontal edges are sorted by their top
+ * scanline and moved into an active list as the scan reaches them. The
+ * active list is kept sorted by x (insertion sort - it is almost always
+ * already in order). Edge x positions are stepped with an exact integer
+ * DDA (whole part plus remainder over the edge height) and walked once per scanline to produce spans under
+ * the ALTERNATE (even-odd) or WINDING (non-zero) rule. Pixels are sampled
+ * at integer coordinates with a half-open [left, right) rule, so shared
+ * edges are never filled twice.
+ */
+
+typedef struct {
+    int ymin;               /* First scanline covered */
+    int ymax;               /* Scanline just past the edge */
+    int dir;                /* +1 for downward edges, -1 for upward */
+    int64_t x;              /* x at the current scanline is x + rem / dy */
+    int64_t rem;            /* 0 <= rem < dy */
+    int64_t dy;             /* Edge height */
+    int64_t step;           /* Whole part of the x step per scanline */
+    int64_t step_rem;       /* Fractional part of the x step, over dy */
+    int xc;                 /* First pixel at or right of the edge */
+} raster_edge_t;
+
+#define RASTER_STACK_EDGES 64
+
+static int raster_edge_cmp(const void *a, const void *b)
+{
+    const raster_edge_t *ea = a;
+    const raster_edge_t *eb = b;
+    return (ea->ymin > eb->ymin) - (ea->ymin < eb->ymin);
+}
+
+/* Floor division for b > 0 */
+static inline int64_t floor_div(int64_t a, int64_t b)
+{
+    int64_t q = a / b;
+    return (a % b < 0) ? q - 1 : q;
+}
+
+static inline void raster_edge_advance(raster_edge_t *e, int64_t steps)
+{
+    int64_t rem = e->rem + steps * e->step_rem;
+    int64_t carry = floor_div(rem, e->dy);
+    e->x += steps * e->step + carry;
+    e->rem = rem - carry * e->dy;
+    e->xc = (int)(e->x + (e->rem > 0));
+}
+
+static bool raster_polygons(const span_target_t *t, const POINT *points, const int *counts,
+                            int num_polys, bool winding)
+{
+    int total = 0;
+    for (int i = 0; i < num_polys; i++) {
+        if (counts[i] >= 2) total += counts[i];
+    }
+    if (total == 0) return true;
+
+    raster_edge_t stack_edges[RASTER_STACK_EDGES];
+    raster_edge_t *stack_active[RASTER_STACK_EDGES];
+    raster_edge_t *edges = stack_edges;
+    raster_edge_t **active = stack_active;
+    if (total > RASTER_STACK_EDGES) {
+        edges = malloc(total * sizeof(*edges));
+        active = malloc(total * sizeof(*active));
+        if (!edges || !active) {
+            free(edges);
+            free(active);
+            return false;
+        }
+    }
+
+    /* Build the edge table */
+    int num_edges = 0;
+    int y_end = INT32_MIN;
+    const POINT *poly = points;
+    for (int i = 0; i < num_polys; poly += counts[i], i++) {
+        int n = counts[i];
+        if (n < 2) continue;
+
+        for (int j = 0; j < n; j++) {
+            const POINT *p = &poly[j];
+            const POINT *q = &poly[(j + 1) % n];
+            if (p->y == q->y) continue;
+
+            raster_edge_t *e = &edges[num_edges++];
+            const POINT *top = p->y < q->y ? p : q;
+            const POINT *bottom = p->y < q->y ? q : p;
+            e->ymin = top->y;
+            e->ymax = bottom->y;
+            e->dir = p->y < q->y ? 1 : -1;
+            e->dy = (int64_t)bottom->y - top->y;
+            e->step = floor_div((int64_t)bottom->x - top->x, e->dy);
+            e->step_rem = (int64_t)bottom->x - top->x - e->step * e->dy;
+            e->x = top->x;
+            e->rem = 0;
+            e->xc = top->x;
+            if (e->ymax > y_end) y_end = e->ymax;
+        }
+    }
+
+    if (num_edges > 0) {
+        qsort(edges, num_edges, sizeof(*edges), raster_edge_cmp);
 
-    /* Simple nearest-neighbor scaling */
-    for (int dy = 0; dy < dst_h; dy++) {
-        int sy = src_y + (dy * src_h) / dst_h;
-        if (sy < 0 || sy >= src_dc->height) continue;
+        int clip_top, clip_bottom;
+        clip_rows(t->dc, &clip_top, &clip_bottom);
+        if (y_end > clip_bottom) y_end = clip_bottom;
 
-        for (int dx = 0; dx < dst_w; dx++) {
-            int sx = src_x + (dx * src_w) / dst_w;
-            if (sx < 0 || sx >= src_dc->width) continue;
+        int y = edges[0].ymin > clip_top ? edges[0].ymin : clip_top;
+        int next = 0;
+        int num_active = 0;
 
-            int dest_px = dst_x + dx;
-            int dest_py = dst_y + dy;
-            if (dest_px < 0 || dest_px >= dst_dc->width) continue;
-            if (dest_py < 0 || dest_py >= dst_dc->height) continue;
+        while (y < y_end) {
+            /* Retire finished edges */
+            int kept = 0;
+            for (int i = 0; i < num_active; i++) {
+                if (active[i]->ymax > y) active[kept++] = active[i];
+            }
+            num_active = kept;
+
+            /* Activate edges reaching this scanline */
+            while (next < num_edges && edges[next].ymin <= y) {
+                raster_edge_t *e = &edges[next++];
+                if (e->ymax <= y) continue;
+                if (y > e->ymin) raster_edge_advance(e, y - e->ymin);
+                active[num_active++] = e;
+            }
+
+            if (num_active == 0) {
+                if (next >= num_edges) break;
+                y = edges[next].ymin;
+                continue;
+            }
 
-            uint32_t src_pixel = src_dc->pixels[sy * (src_dc->pitch / 4) + sx];
-            uint32_t *dst_pixel = &dst_dc->pixels[dest_py * (dst_dc->pitch / 4) + dest_px];
+            for (int i = 1; i < num_active; i++) {
+                raster_edge_t *e = active[i];
+                int j = i;
+                while (j > 0 && active[j - 1]->xc > e->xc) {
+                    active[j] = active[j - 1];
+                    j--;
+                }
+                active[j] = e;
+            }
 
-            if (rop == ROP_SRCCOPY) {
-                *dst_pixel = src_pixel;
+            if (winding) {
+                int wind = 0;
+                int start = 0;
+                for (int i = 0; i < num_active; i++) {
+                    int prev = wind;
+                    wind += active[i]->dir;
+                    if (prev == 0) {
+                        start = active[i]->xc;
+                    } else if (wind == 0) {
+                        span_emit(t, y, start, active[i]->xc);
+                    }
+                }
             } else {
-                uint32_t pat = 0xFFFFFFFF;
-                if (dst_dc->brush) {
-                    pat = colorref_to_argb(dst_dc->brush->color);
+                for (int i = 0; i + 1 < num_active; i += 2) {
+                    span_emit(t, y, active[i]->xc, active[i + 1]->xc);
                 }
-                *dst_pixel = gdi_apply_rop3(*dst_pixel, src_pixel, pat, rop);
             }
+
+            for (int i = 0; i < num_active; i++) {
+                raster_edge_t *e = active[i];
+                e->x += e->step;
+                e->rem += e->step_rem;
+                if (e->rem >= e->dy) {
+                    e->rem -= e->dy;
+                    e->x++;
+                }
+                e->xc = (int)(e->x + (e->rem > 0));
+            }
+            y++;
         }
     }
 
-    dst_dc->dirty = true;
+    if (edges != stack_edges) {
+        free(edges);
+        free(active);
+    }
     return true;
 }
 
@@ -459,27 +1077,71 @@ bool gdi_stretch_blt(gdi_dc_t *dst_dc, int dst_x, int dst_y, int dst_w, int dst_
  * Line drawing
  */
 
-bool gdi_line_to(gdi_dc_t *dc, int x, int y)
+/* Pen of width > 1: axis-aligned lines are rectangles, others a filled quad */
+static void draw_wide_line(const span_target_t *t, int width, int x0, int y0, int x1, int y1)
 {
-    if (!dc || !dc->pixels) return false;
-    if (!dc->pen || dc->pen->style == PS_NULL) {
-        dc->cur_x = x;
-        dc->cur_y = y;
-        return true;
+    int lo = (width - 1) / 2;
+    int hi = width - lo;
+
+    if (y0 == y1) {
+        RECT area = { x0 < x1 ? x0 : x1, y0 - lo, x0 < x1 ? x1 : x0, y0 + hi };
+        fill_rop2(t->dc, &area, t->color, t->rop2);
+        return;
+    }
+    if (x0 == x1) {
+        RECT area = { x0 - lo, y0 < y1 ? y0 : y1, x0 + hi, y0 < y1 ? y1 : y0 };
+        fill_rop2(t->dc, &area, t->color, t->rop2);
+        return;
     }
 
-    int x0 = dc->cur_x;
-    int y0 = dc->cur_y;
-    int x1 = x;
-    int y1 = y;
+    /* Offset both end points by half the width along the normal */
+    int64_t dx = x1 - x0;
+    int64_t dy = y1 - y0;
+    int64_t len2 = 2 * (int64_t)isqrt64((uint64_t)(dx * dx + dy * dy));
+    int nx = div_round(-dy * width, len2);
+    int ny = div_round(dx * width, len2);
+
+    POINT quad[4] = {
+        { x0 + nx, y0 + ny }, { x1 + nx, y1 + ny },
+        { x1 - nx, y1 - ny }, { x0 - nx, y0 - ny },
+    };
+    int count = 4;
+    raster_polygons(t, quad, &count, 1, true);
+}
 
-    /* Apply DC origin */
-    x0 += dc->vp_org_x - dc->win_org_x;
-    y0 += dc->vp_org_y - dc->win_org_y;
-    x1 += dc->vp_org_x - dc->win_org_x;
-    y1 += dc->vp_org_y - dc->win_org_y;
+/*
+ * Draw a line in surface coordinates. Like GDI, the end point is excluded
+ * unless include_last is set; horizontal and vertical lines go straight
+ * to span fills.
+ */
+static void draw_line(const span_target_t *t, int width, int x0, int y0, int x1, int y1,
+                      bool include_last)
+{
+    if (width > 1) {
+        draw_wide_line(t, width, x0, y0, x1, y1);
+        return;
+    }
 
-    uint32_t color = colorref_to_argb(dc->pen->color);
+    int last = include_last ? 1 : 0;
+
+    if (y0 == y1) {
+        if (x0 <= x1) {
+            span_emit(t, y0, x0, x1 + last);
+        } else {
+            span_emit(t, y0, x1 + 1 - last, x0 + 1);
+        }
+        return;
+    }
+
+    if (x0 == x1) {
+        RECT area = { x0, y0, x0 + 1, y1 + last };
+        if (y0 > y1) {
+            area.top = y1 + 1 - last;
+            area.bottom = y0 + 1;
+        }
+        fill_rop2(t->dc, &area, t->color, t->rop2);
+        return;
+    }
 
     /* Bresenham's line algorithm */
     int dx = abs(x1 - x0);
@@ -489,11 +1151,11 @@ bool gdi_line_to(gdi_dc_t *dc, int x, int y)
     int err = dx - dy;
 
     while (1) {
-        if (x0 >= 0 && x0 < dc->width && y0 >= 0 && y0 < dc->height) {
-            dc->pixels[y0 * (dc->pitch / 4) + x0] = color;
+        if (x0 == x1 && y0 == y1) {
+            if (include_last) plot_pixel(t, x0, y0);
+            break;
         }
-
-        if (x0 == x1 && y0 == y1) break;
+        plot_pixel(t, x0, y0);
 
         int e2 = 2 * err;
         if (e2 > -dy) {
@@ -505,35 +1167,60 @@ bool gdi_line_to(gdi_dc_t *dc, int x, int y)
             y0 += sy;
         }
     }
+}
+
+bool gdi_line_to(gdi_dc_t *dc, int x, int y)
+{
+    if (!dc || !dc->pixels) return false;
+
+    span_target_t pen;
+    int width;
+    if (pen_target(dc, &pen, &width)) {
+        int ox = gdi_dc_offset_x(dc);
+        int oy = gdi_dc_offset_y(dc);
+        draw_line(&pen, width, dc->cur_x + ox, dc->cur_y + oy, x + ox, y + oy, false);
+    }
 
     dc->cur_x = x;
     dc->cur_y = y;
-    dc->dirty = true;
     return true;
 }
 
 bool gdi_polyline(gdi_dc_t *dc, const POINT *points, int count)
 {
-    if (!dc || !points || count < 2) return false;
+    int counts[1] = { count };
+    return gdi_poly_polyline(dc, points, counts, 1);
+}
 
-    gdi_move_to(dc, points[0].x, points[0].y, NULL);
-    for (int i = 1; i < count; i++) {
-        gdi_line_to(dc, points[i].x, points[i].y);
+bool gdi_poly_polyline(gdi_dc_t *dc, const POINT *points, const int *counts, int num_polys)
+{
+    if (!dc || !points || !counts) return false;
+    if (!dc->pixels) return false;
+
+    span_target_t pen;
+    int width;
+    if (!pen_target(dc, &pen, &width)) return true;
+
+    int ox = gdi_dc_offset_x(dc);
+    int oy = gdi_dc_offset_y(dc);
+
+    const POINT *poly = points;
+    for (int i = 0; i < num_polys; poly += counts[i], i++) {
+        for (int j = 1; j < counts[i]; j++) {
+            draw_line(&pen, width, poly[j - 1].x + ox, poly[j - 1].y + oy,
+                      poly[j].x + ox, poly[j].y + oy, false);
+        }
     }
 
     return true;
 }
 
-bool gdi_poly_polyline(gdi_dc_t *dc, const POINT *points, const int *counts, int num_polys)
+bool gdi_polyline_to(gdi_dc_t *dc, const POINT *points, int count)
 {
-    if (!dc || !points || !counts) return false;
+    if (!dc || !points || count < 1) return false;
 
-    int point_index = 0;
-    for (int i = 0; i < num_polys; i++) {
-        if (counts[i] >= 2) {
-            gdi_polyline(dc, &points[point_index], counts[i]);
-        }
-        point_index += counts[i];
+    for (int i = 0; i < count; i++) {
+        gdi_line_to(dc, points[i].x, points[i].y);
     }
 
     return true;
@@ -551,21 +1238,55 @@ bool gdi_fill_rgn(gdi_handle_table_t *table, gdi_dc_t *dc, uint32_t hrgn, uint32
     gdi_brush_t *brush = gdi_get_object(table, hbrush, GDI_OBJ_BRUSH);
     if (!brush) return false;
 
-    return gdi_fill_rect(dc, &rgn->bounds, brush) != 0;
+    for (int i = 0; i < rgn->rect_count; i++) {
+        gdi_fill_rect(dc, &rgn->rects[i], brush);
+    }
+    return true;
 }
 
 bool gdi_frame_rgn(gdi_handle_table_t *table, gdi_dc_t *dc, uint32_t hrgn, uint32_t hbrush, int width, int height)
 {
-    (void)width;
-    (void)height;
-
     gdi_region_t *rgn = gdi_get_object(table, hrgn, GDI_OBJ_REGION);
     if (!rgn) return false;
 
     gdi_brush_t *brush = gdi_get_object(table, hbrush, GDI_OBJ_BRUSH);
     if (!brush) return false;
 
-    return gdi_frame_rect(dc, &rgn->bounds, brush) != 0;
+    if (width < 1) width = 1;
+    if (height < 1) height = 1;
+
+    /*
+     * The interior is the region shrunk by the frame size: the part that
+     * stays inside the region when moved by +-width and +-height.
+     */
+    gdi_region_t interior, moved, frame;
+    gdi_region_init(&interior);
+    gdi_region_init(&moved);
+    gdi_region_init(&frame);
+
+    static const int dirs[4][2] = { { 1, 0 }, { -1, 0 }, { 0, 1 }, { 0, -1 } };
+    bool ok = gdi_region_copy(&interior, rgn);
+    for (int i = 0; ok && i < 4; i++) {
+        ok = gdi_region_copy(&moved, rgn);
+        if (ok) {
+            gdi_region_offset(&moved, dirs[i][0] * width, dirs[i][1] * height);
+            ok = gdi_region_intersect(&interior, &interior, &moved);
+        }
+    }
+    if (ok) {
+        ok = gdi_region_subtract(&frame, rgn, &interior);
+    }
+
+    if (ok) {
+        for (int i = 0; i < frame.rect_count; i++) {
+            gdi_fill_rect(dc, &frame.rects[i], brush);
+        }
+    }
+
+    gdi_region_cleanup(&interior);
+    gdi_region_cleanup(&moved);
+    gdi_region_cleanup(&frame);
+    return ok;
 }
 
 bool gdi_invert_rgn(gdi_handle_table_t *table, gdi_dc_t *dc, uint32_t hrgn)
@@ -573,7 +1294,10 @@ bool gdi_invert_rgn(gdi_handle_table_t *table, gdi_dc_t *dc, uint32_t hrgn)
     gdi_region_t *rgn = gdi_get_object(table, hrgn, GDI_OBJ_REGION);
     if (!rgn) return false;
 
-    return gdi_invert_rect(dc, &rgn->bounds);
+    for (int i = 0; i < rgn->rect_count; i++) {
+        gdi_invert_rect(dc, &rgn->rects[i]);
+    }
+    return true;
 }
 
 bool gdi_paint_rgn(gdi_handle_table_t *table, gdi_dc_t *dc, uint32_t hrgn)
@@ -581,7 +1305,10 @@ bool gdi_paint_rgn(gdi_handle_table_t *table, gdi_dc_t *dc, uint32_t hrgn)
     gdi_region_t *rgn = gdi_get_object(table, hrgn, GDI_OBJ_REGION);
     if (!rgn || !dc->brush) return false;
 
-    return gdi_fill_rect(dc, &rgn->bounds, dc->brush) != 0;
+    for (int i = 0; i < rgn->rect_count; i++) {
+        gdi_fill_rect(dc, &rgn->rects[i], dc->brush);
+    }
+    return true;
 }
 
 /*
@@ -593,10 +1320,10 @@ COLORREF gdi_set_pixel(gdi_dc_t *dc, int x, int y, COLORREF color)
     if (!dc || !dc->pixels) return (COLORREF)-1;
 
     /* Apply DC origin */
-    x += dc->vp_org_x - dc->win_org_x;
-    y += dc->vp_org_y - dc->win_org_y;
+    x += gdi_dc_offset_x(dc);
+    y += gdi_dc_offset_y(dc);
 
-    if (x < 0 || x >= dc->width || y < 0 || y >= dc->height) {
+    if (!gdi_clip_pt(dc, x, y)) {
         return (COLORREF)-1;
     }
 
@@ -612,10 +1339,10 @@ COLORREF gdi_get_pixel(gdi_dc_t *dc, int x, int y)
 {
     if (!dc || !dc->pixels) return (COLORREF)-1;
 
-    x += dc->vp_org_x - dc->win_org_x;
-    y += dc->vp_org_y - dc->win_org_y;
+    x += gdi_dc_offset_x(dc);
+    y += gdi_dc_offset_y(dc);
 
-    if (x < 0 || x >= dc->width || y < 0 || y >= dc->height) {
+    if (!gdi_clip_pt(dc, x, y)) {
         return (COLORREF)-1;
     }
 
@@ -735,12 +1462,10 @@ uint32_t gdi_create_rect_rgn(gdi_handle_table_t *table, int left, int top, int r
     gdi_region_t *rgn = gdi_alloc_region(table);
     if (!rgn) return 0;
 
-    rgn->bounds.left = left;
-    rgn->bounds.top = top;
-    rgn->bounds.right = right;
-    rgn->bounds.bottom = bottom;
-    rgn->rect_count = 1;
-    rgn->rects = NULL;
+    if (!gdi_region_set_rect(rgn, left, top, right, bottom)) {
+        gdi_free_region(table, rgn);
+        return 0;
+    }
 
     uint32_t handle = gdi_alloc_handle(table, rgn, GDI_OBJ_REGION);
     if (!handle) {
@@ -757,12 +1482,7 @@ bool gdi_set_rect_rgn(gdi_handle_table_t *table, uint32_t hrgn, int left, int to
     gdi_region_t *rgn = gdi_get_object(table, hrgn, GDI_OBJ_REGION);
     if (!rgn) return false;
 
-    rgn->bounds.left = left;
-    rgn->bounds.top = top;
-    rgn->bounds.right = right;
-    rgn->bounds.bottom = bottom;
-
-    return true;
+    return gdi_region_set_rect(rgn, left, top, right, bottom);
 }
 
 int gdi_combine_rgn(gdi_handle_table_t *table, uint32_t hrgnDest, uint32_t hrgnSrc1, uint32_t hrgnSrc2, int mode)
@@ -770,84 +1490,530 @@ int gdi_combine_rgn(gdi_handle_table_t *table, uint32_t hrgnDest, uint32_t hrgnS
     gdi_region_t *dest = gdi_get_object(table, hrgnDest, GDI_OBJ_REGION);
     gdi_region_t *src1 = gdi_get_object(table, hrgnSrc1, GDI_OBJ_REGION);
 
-    if (!dest || !src1) return 0;
+    if (!dest || !src1) return RGN_ERROR;
 
     if (mode == RGN_COPY) {
-        dest->bounds = src1->bounds;
-        return SIMPLEREGION;
+        return gdi_region_combine(dest, src1, src1, mode);
     }
 
     gdi_region_t *src2 = gdi_get_object(table, hrgnSrc2, GDI_OBJ_REGION);
-    if (!src2) return 0;
-
-    /* Simplified: just use bounding box operations */
-    switch (mode) {
-        case RGN_AND:
-            dest->bounds.left = (src1->bounds.left > src2->bounds.left) ? src1->bounds.left : src2->bounds.left;
-            dest->bounds.top = (src1->bounds.top > src2->bounds.top) ? src1->bounds.top : src2->bounds.top;
-            dest->bounds.right = (src1->bounds.right < src2->bounds.right) ? src1->bounds.right : src2->bounds.right;
-            dest->bounds.bottom = (src1->bounds.bottom < src2->bounds.bottom) ? src1->bounds.bottom : src2->bounds.bottom;
-            break;
+    if (!src2) return RGN_ERROR;
 
-        case RGN_OR:
-            dest->bounds.left = (src1->bounds.left < src2->bounds.left) ? src1->bounds.left : src2->bounds.left;
-            dest->bounds.top = (src1->bounds.top < src2->bounds.top) ? src1->bounds.top : src2->bounds.top;
-            dest->bounds.right = (src1->bounds.right > src2->bounds.right) ? src1->bounds.right : src2->bounds.right;
-            dest->bounds.bottom = (src1->bounds.bottom > src2->bounds.bottom) ? src1->bounds.bottom : src2->bounds.bottom;
-            break;
+    return gdi_region_combine(dest, src1, src2, mode);
+}
 
-        default:
-            return 0;
+int gdi_get_rgn_box(gdi_handle_table_t *table, uint32_t hrgn, RECT *rect)
+{
+    gdi_region_t *rgn = gdi_get_object(table, hrgn, GDI_OBJ_REGION);
+    if (!rgn || !rect) return RGN_ERROR;
+
+    *rect = rgn->bounds;
+    return gdi_region_complexity(rgn);
+}
+
+int gdi_offset_rgn(gdi_handle_table_t *table, uint32_t hrgn, int x, int y)
+{
+    gdi_region_t *rgn = gdi_get_object(table, hrgn, GDI_OBJ_REGION);
+    if (!rgn) return RGN_ERROR;
+
+    gdi_region_offset(rgn, x, y);
+    return gdi_region_complexity(rgn);
+}
+
+bool gdi_pt_in_region(gdi_handle_table_t *table, uint32_t hrgn, int x, int y)
+{
+    gdi_region_t *rgn = gdi_get_object(table, hrgn, GDI_OBJ_REGION);
+    if (!rgn) return false;
+
+    return gdi_region_pt_in(rgn, x, y);
+}
+
+bool gdi_rect_in_region(gdi_handle_table_t *table, uint32_t hrgn, const RECT *rect)
+{
+    gdi_region_t *rgn = gdi_get_object(table, hrgn, GDI_OBJ_REGION);
+    if (!rgn || !rect) return false;
+
+    /* RectInRegion accepts unordered rectangles */
+    RECT r = *rect;
+    if (r.left > r.right) { int t = r.left; r.left = r.right; r.right = t; }
+    if (r.top > r.bottom) { int t = r.top; r.top = r.bottom; r.bottom = t; }
+
+    return gdi_region_rect_in(rgn, &r);
+}
+
+int gdi_equal_rgn(gdi_handle_table_t *table, uint32_t hrgn1, uint32_t hrgn2)
+{
+    gdi_region_t *rgn1 = gdi_get_object(table, hrgn1, GDI_OBJ_REGION);
+    gdi_region_t *rgn2 = gdi_get_object(table, hrgn2, GDI_OBJ_REGION);
+    if (!rgn1 || !rgn2) return -1;  /* ERROR */
+
+    return gdi_region_equal(rgn1, rgn2) ? 1 : 0;
+}
+
+/*
+ * Shape drawing
+ *
+ * Ellipses and rounded rectangles are described as one [left, right]
+ * pixel run per row, built from a midpoint-ellipse quadrant. The pen is
+ * the outer shape minus the shape deflated by the pen width, and the
+ * brush fills the inner shape, so each row costs at most three spans.
+ * Arcs, chords and pies reuse the same rows and additionally test each
+ * pixel against the start and end radials.
+ */
+
+/* Largest box the 64-bit midpoint and arc math handles exactly */
+#define SHAPE_MAX_EXTENT 0xFFFF
+
+/* Radials are scaled below this so their products with the radii fit */
+#define ARC_MAX_RADIAL   0x7FFF
+
+/*
+ * Midpoint ellipse quadrant with radii rx, ry: ext[dy] receives the
+ * largest dx of the boundary on row dy (0 <= dy <= ry).
+ */
+static void ellipse_quadrant(int rx, int ry, int *ext)
+{
+    for (int i = 0; i <= ry; i++) {
+        ext[i] = 0;
+    }
+    if (ry == 0) {
+        ext[0] = rx;
+        return;
+    }
+    if (rx == 0) return;
+
+    int64_t rx2 = (int64_t)rx * rx;
+    int64_t ry2 = (int64_t)ry * ry;
+    int64_t x = 0;
+    int64_t y = ry;
+    int64_t px = 0;
+    int64_t py = 2 * rx2 * y;
+
+    /* Region 1: |slope| < 1, step in x */
+    int64_t p = ry2 - rx2 * ry + rx2 / 4;
+    while (px < py) {
+        x++;
+        px += 2 * ry2;
+        if (p < 0) {
+            p += ry2 + px;
+        } else {
+            y--;
+            py -= 2 * rx2;
+            p += ry2 + px - py;
+        }
+        ext[y] = (int)x;
     }
 
-    if (dest->bounds.left >= dest->bounds.right || dest->bounds.top >= dest->bounds.bottom) {
-        return NULLREGION;
+    /* Region 2: |slope| >= 1, step in y */
+    p = ry2 * (2 * x + 1) * (2 * x + 1) / 4 + rx2 * (y - 1) * (y - 1) - rx2 * ry2;
+    while (y > 0) {
+        y--;
+        py -= 2 * rx2;
+        if (p > 0) {
+            p += rx2 - py;
+        } else {
+            x++;
+            px += 2 * ry2;
+            p += rx2 - py + px;
+        }
+        if (x > ext[y]) ext[y] = (int)x;
+    }
+
+    for (int i = 0; i <= ry; i++) {
+        if (ext[i] > rx) ext[i] = rx;
     }
 
-    return SIMPLEREGION;
+    /* Flat ellipses leave region 1 on the centre row short of (rx, 0) */
+    ext[0] = rx;
 }
 
-int gdi_get_rgn_box(gdi_handle_table_t *table, uint32_t hrgn, RECT *rect)
+/*
+ * Row runs of a w x h box with elliptic corners of size ew x eh: row r
+ * covers [xl[r], xr[r]] relative to the box. ew == w and eh == h gives an
+ * ellipse; corners smaller than two pixels give a plain rectangle.
+ */
+static bool shape_rows(int w, int h, int ew, int eh, int *xl, int *xr)
 {
-    gdi_region_t *rgn = gdi_get_object(table, hrgn, GDI_OBJ_REGION);
-    if (!rgn || !rect) return 0;
+    if (ew > w) ew = w;
+    if (eh > h) eh = h;
 
-    *rect = rgn->bounds;
+    if (ew < 2 || eh < 2) {
+        for (int r = 0; r < h; r++) {
+            xl[r] = 0;
+            xr[r] = w - 1;
+        }
+        return true;
+    }
 
-    if (rect->left >= rect->right || rect->top >= rect->bottom) {
-        return NULLREGION;
+    /* Even sizes put the centre between pixels: mirror with a one pixel offset */
+    int rx = (ew - 1) / 2;
+    int ry = (eh - 1) / 2;
+    int ox = (ew - 1) & 1;
+    int oy = (eh - 1) & 1;
+
+    int *ext = malloc((ry + 1) * sizeof(int));
+    if (!ext) return false;
+    ellipse_quadrant(rx, ry, ext);
+
+    int bottom_start = h - eh + ry + oy;
+    for (int r = 0; r < h; r++) {
+        int dy;
+        if (r <= ry) {
+            dy = ry - r;
+        } else if (r >= bottom_start) {
+            dy = r - bottom_start;
+        } else {
+            xl[r] = 0;
+            xr[r] = w - 1;
+            continue;
+        }
+        xl[r] = rx - ext[dy];
+        xr[r] = rx + ext[dy] + ox + (w - ew);
     }
 
-    return SIMPLEREGION;
+    free(ext);
+    return true;
+}
+
+/* Arc kinds (NtGdiArcInternal) */
+#define ARC_TYPE_ARC    0
+#define ARC_TYPE_ARCTO  1
+#define ARC_TYPE_CHORD  2
+#define ARC_TYPE_PIE    3
+
+/*
+ * Angular filter for arcs in doubled surface coordinates with y pointing
+ * up, so counterclockwise on screen is counterclockwise here. Doubling
+ * keeps the centre of even-sized boxes on the integer grid.
+ */
+typedef struct {
+    int type;
+    int64_t cx, cy;         /* Centre */
+    int64_t sx, sy;         /* Start radial */
+    int64_t ex, ey;         /* End radial */
+    bool full;              /* Radials coincide: whole ellipse */
+    POINT start;            /* Arc end points on the ellipse (surface) */
+    POINT end;
+} arc_sweep_t;
+
+static inline int64_t cross64(int64_t ax, int64_t ay, int64_t bx, int64_t by)
+{
+    return ax * by - ay * bx;
 }
 
 /*
- * Shape drawing (stubs for now)
+ * Pixels of a row where k * (x - x_ref) + c >= 0, as [*lo, *hi). The arc
+ * tests are linear in x along a row, so each is one such interval.
  */
+static void row_half_plane(int64_t k, int64_t c, int64_t x_ref, int64_t *lo, int64_t *hi)
+{
+    *lo = INT32_MIN;
+    *hi = INT32_MAX;
+    if (k > 0) {
+        *lo = x_ref - floor_div(c, k);
+    } else if (k < 0) {
+        *hi = x_ref + floor_div(c, -k) + 1;
+    } else if (c < 0) {
+        *lo = *hi = 0;
+    }
+}
+
+/*
+ * Row y of the sector: cross(a, v) >= 0 (or cross(v, a) when after is
+ * set), v being the doubled offset of x from the centre, strict if asked
+ */
+static void row_radial(const arc_sweep_t *arc, int64_t ax, int64_t ay, bool after,
+                       bool strict, int64_t left, int64_t y, int64_t *lo, int64_t *hi)
+{
+    /* v = (2 * (x - left) - hw, vy) with left the box's left edge */
+    int64_t hw = arc->cx - 2 * left;
+    int64_t vy = arc->cy - 2 * y;
+    int64_t k = after ? 2 * ay : -2 * ay;
+    int64_t c = after ? -(hw * ay) - vy * ax : ax * vy + ay * hw;
+    row_half_plane(k, strict ? c - 1 : c, left, lo, hi);
+}
+
+static void span_clipped(const span_target_t *t, int y, int x0, int x1, int64_t lo, int64_t hi)
+{
+    if (lo > x0) x0 = lo < x1 ? (int)lo : x1;
+    if (hi < x1) x1 = hi > x0 ? (int)hi : x0;
+    span_emit(t, y, x0, x1);
+}
+
+/*
+ * Emit the part of [x0, x1) on row y that the arc covers: the sector for
+ * the pen and pie fills, the side of the chord line the arc sweeps
+ * through for chord fills
+ */
+static void span_filtered(const span_target_t *t, const arc_sweep_t *arc, bool interior,
+                          int y, int x0, int x1)
+{
+    if (!arc || arc->full) {
+        span_emit(t, y, x0, x1);
+        return;
+    }
+
+    int64_t lo, hi, lo2, hi2;
+    if (interior && arc->type == ARC_TYPE_CHORD) {
+        /* cross(end - start, p - start) <= 0, doubled with y up */
+        int64_t dx = 2 * (int64_t)(arc->end.x - arc->start.x);
+        int64_t dy = 2 * (int64_t)(arc->start.y - arc->end.y);
+        int64_t vy = 2 * ((int64_t)arc->start.y - y);
+        row_half_plane(2 * dy, -dx * vy, arc->start.x, &lo, &hi);
+        span_clipped(t, y, x0, x1, lo, hi);
+        return;
+    }
+
+    int64_t left = x0;
+    int64_t se = cross64(arc->sx, arc->sy, arc->ex, arc->ey);
+    if (se > 0) {
+        /* Sweep under half a turn: between the radials */
+        row_radial(arc, arc->sx, arc->sy, false, false, left, y, &lo, &hi);
+        row_radial(arc, arc->ex, arc->ey, true, false, left, y, &lo2, &hi2);
+        span_clipped(t, y, x0, x1, lo > lo2 ? lo : lo2, hi < hi2 ? hi : hi2);
+    } else if (se < 0) {
+        /* Over half a turn: all but the open wedge from end to start */
+        row_radial(arc, arc->ex, arc->ey, false, true, left, y, &lo, &hi);
+        row_radial(arc, arc->sx, arc->sy, true, true, left, y, &lo2, &hi2);
+        if (lo2 > lo) lo = lo2;
+        if (hi2 < hi) hi = hi2;
+        if (lo >= hi) {
+            span_emit(t, y, x0, x1);
+        } else {
+            span_clipped(t, y, x0, x1, INT32_MIN, lo);
+            span_clipped(t, y, x0, x1, hi, INT32_MAX);
+        }
+    } else {
+        /* Half ellipse */
+        row_radial(arc, arc->sx, arc->sy, false, false, left, y, &lo, &hi);
+        span_clipped(t, y, x0, x1, lo, hi);
+    }
+}
+
+/* Normalise a logical box to surface coordinates; false if nothing to draw */
+static bool shape_box(gdi_dc_t *dc, int left, int top, int right, int bottom, RECT *out)
+{
+    RECT r = {
+        left < right ? left : right, top < bottom ? top : bottom,
+        left < right ? right : left, top < bottom ? bottom : top,
+    };
+    rect_to_surface(dc, &r, out);
+
+    int w = out->right - out->left;
+    int h = out->bottom - out->top;
+    return w > 0 && h > 0 && w <= SHAPE_MAX_EXTENT && h <= SHAPE_MAX_EXTENT;
+}
+
+/*
+ * Draw a box with elliptic corners: brush inside, pen of the current width
+ * along the boundary. With an arc filter, fill is limited to the sector
+ * (pie) or chord segment and the pen to the swept part of the boundary.
+ */
+static bool draw_shape(gdi_dc_t *dc, const RECT *box, int ew, int eh,
+                       const arc_sweep_t *arc, bool fill)
+{
+    span_target_t pen, brush;
+    int pw = 0;
+    if (!pen_target(dc, &pen, &pw)) pw = 0;
+    fill = fill && brush_target(dc, &brush);
+    if (pw == 0 && !fill) return true;
+
+    int w = box->right - box->left;
+    int h = box->bottom - box->top;
+    int iw = w - 2 * pw;
+    int ih = h - 2 * pw;
+    if (pw == 0 || iw <= 0 || ih <= 0) {
+        iw = 0;
+        ih = 0;
+    }
+
+    int *rows = malloc((size_t)(h + ih) * 2 * sizeof(int));
+    if (!rows) return false;
+    int *oxl = rows;
+    int *oxr = rows + h;
+    int *ixl = rows + 2 * h;
+    int *ixr = rows + 2 * h + ih;
+
+    if (!shape_rows(w, h, ew, eh, oxl, oxr) ||
+        (ih > 0 && !shape_rows(iw, ih, ew - 2 * pw, eh - 2 * pw, ixl, ixr))) {
+        free(rows);
+        return false;
+    }
+
+    int clip_top, clip_bottom;
+    clip_rows(dc, &clip_top, &clip_bottom);
+
+    for (int r = 0; r < h; r++) {
+        int y = box->top + r;
+        if (y < clip_top) continue;
+        if (y >= clip_bottom) break;
+
+        int ol = box->left + oxl[r];
+        int orr = box->left + oxr[r] + 1;
+
+        if (pw == 0) {
+            span_filtered(&brush, arc, true, y, ol, orr);
+            continue;
+        }
+
+        int ir = r - pw;
+        if (ir < 0 || ir >= ih) {
+            span_filtered(&pen, arc, false, y, ol, orr);
+            continue;
+        }
+
+        int il = box->left + pw + ixl[ir];
+        int irr = box->left + pw + ixr[ir] + 1;
+        if (il < ol) il = ol;
+        if (irr > orr) irr = orr;
+
+        span_filtered(&pen, arc, false, y, ol, il);
+        if (fill) span_filtered(&brush, arc, true, y, il, irr);
+        span_filtered(&pen, arc, false, y, irr, orr);
+    }
+
+    free(rows);
+    return true;
+}
 
 bool gdi_ellipse(gdi_dc_t *dc, int left, int top, int right, int bottom)
 {
-    /* Simplified: draw as rectangle */
-    return gdi_rectangle(dc, left, top, right, bottom);
+    if (!dc || !dc->pixels) return false;
+
+    RECT box;
+    if (!shape_box(dc, left, top, right, bottom, &box)) return true;
+
+    return draw_shape(dc, &box, box.right - box.left, box.bottom - box.top, NULL, true);
 }
 
 bool gdi_round_rect(gdi_dc_t *dc, int left, int top, int right, int bottom, int width, int height)
 {
-    (void)width;
-    (void)height;
-    /* Simplified: draw as rectangle */
-    return gdi_rectangle(dc, left, top, right, bottom);
+    if (!dc || !dc->pixels) return false;
+
+    RECT box;
+    if (!shape_box(dc, left, top, right, bottom, &box)) return true;
+
+    return draw_shape(dc, &box, abs(width), abs(height), NULL, true);
 }
 
 bool gdi_polygon(gdi_dc_t *dc, const POINT *points, int count)
 {
-    if (!dc || !points || count < 3) return false;
+    return gdi_poly_polygon(dc, points, &count, 1);
+}
+
+bool gdi_poly_polygon(gdi_dc_t *dc, const POINT *points, const int *counts, int num_polys)
+{
+    if (!dc || !points || !counts || num_polys <= 0) return false;
+    if (!dc->pixels) return false;
 
-    /* Draw outline */
-    gdi_polyline(dc, points, count);
-    /* Close the polygon */
-    gdi_move_to(dc, points[count-1].x, points[count-1].y, NULL);
-    gdi_line_to(dc, points[0].x, points[0].y);
+    int total = 0;
+    for (int i = 0; i < num_polys; i++) {
+        if (counts[i] < 0) return false;
+        total += counts[i];
+    }
+
+    POINT *pts = malloc((total > 0 ? total : 1) * sizeof(POINT));
+    if (!pts) return false;
+    points_to_surface(dc, points, pts, total);
+
+    span_target_t brush;
+    if (brush_target(dc, &brush)) {
+        raster_polygons(&brush, pts, counts, num_polys, dc->poly_fill_mode == WINDING);
+    }
+
+    span_target_t pen;
+    int width;
+    if (pen_target(dc, &pen, &width)) {
+        const POINT *poly = pts;
+        for (int i = 0; i < num_polys; poly += counts[i], i++) {
+            int n = counts[i];
+            for (int j = 0; j < n && n >= 2; j++) {
+                const POINT *p = &poly[j];
+                const POINT *q = &poly[(j + 1) % n];
+                draw_line(&pen, width, p->x, p->y, q->x, q->y, false);
+            }
+        }
+    }
+
+    free(pts);
+    return true;
+}
+
+/*
+ * Point where the radial through (dx, dy) (doubled, y up) meets the
+ * ellipse with doubled radii a, b centred on the sweep centre.
+ */
+static void arc_radial_point(const arc_sweep_t *arc, int64_t dx, int64_t dy,
+                             int64_t a, int64_t b, POINT *out)
+{
+    while (dx > ARC_MAX_RADIAL || dx < -ARC_MAX_RADIAL ||
+           dy > ARC_MAX_RADIAL || dy < -ARC_MAX_RADIAL) {
+        dx /= 2;
+        dy /= 2;
+    }
+    if (dx == 0 && dy == 0) dx = 1;
+
+    uint64_t den = isqrt64((uint64_t)(b * b * dx * dx) + (uint64_t)(a * a * dy * dy));
+    if (den == 0) den = 1;
+
+    int64_t vx = dx * a * b / (int64_t)den;
+    int64_t vy = dy * a * b / (int64_t)den;
+    out->x = (int)((arc->cx + vx + 1) >> 1);
+    out->y = (int)((arc->cy - vy + 1) >> 1);
+}
+
+static bool draw_arc(gdi_dc_t *dc, int type, int left, int top, int right, int bottom,
+                     int x_start, int y_start, int x_end, int y_end)
+{
+    if (!dc || !dc->pixels) return false;
+
+    RECT box;
+    if (!shape_box(dc, left, top, right, bottom, &box)) return true;
+
+    int ox = gdi_dc_offset_x(dc);
+    int oy = gdi_dc_offset_y(dc);
+    int w = box.right - box.left;
+    int h = box.bottom - box.top;
+
+    arc_sweep_t arc;
+    arc.type = type;
+    arc.cx = 2 * (int64_t)box.left + (w - 1);
+    arc.cy = 2 * (int64_t)box.top + (h - 1);
+    arc.sx = 2 * (int64_t)(x_start + ox) - arc.cx;
+    arc.sy = arc.cy - 2 * (int64_t)(y_start + oy);
+    arc.ex = 2 * (int64_t)(x_end + ox) - arc.cx;
+    arc.ey = arc.cy - 2 * (int64_t)(y_end + oy);
+    arc.full = cross64(arc.sx, arc.sy, arc.ex, arc.ey) == 0 &&
+               arc.sx * arc.ex + arc.sy * arc.ey > 0;
+    arc_radial_point(&arc, arc.sx, arc.sy, w - 1, h - 1, &arc.start);
+    arc_radial_point(&arc, arc.ex, arc.ey, w - 1, h - 1, &arc.end);
+
+    span_target_t pen;
+    int width;
+    bool has_pen = pen_target(dc, &pen, &width);
+
+    if (type == ARC_TYPE_ARCTO && has_pen) {
+        draw_line(&pen, width, dc->cur_x + ox, dc->cur_y + oy, arc.start.x, arc.start.y, false);
+    }
+
+    bool fill = type == ARC_TYPE_CHORD || type == ARC_TYPE_PIE;
+    if (!draw_shape(dc, &box, w, h, &arc, fill)) return false;
+
+    if (has_pen && !arc.full) {
+        if (type == ARC_TYPE_CHORD) {
+            draw_line(&pen, width, arc.end.x, arc.end.y, arc.start.x, arc.start.y, true);
+        } else if (type == ARC_TYPE_PIE) {
+            int cx = (int)((arc.cx + 1) >> 1);
+            int cy = (int)((arc.cy + 1) >> 1);
+            draw_line(&pen, width, arc.end.x, arc.end.y, cx, cy, true);
+            draw_line(&pen, width, cx, cy, arc.start.x, arc.start.y, true);
+        }
+    }
+
+    if (type == ARC_TYPE_ARCTO) {
+        dc->cur_x = arc.end.x - ox;
+        dc->cur_y = arc.end.y - oy;
+    }
 
     return true;
 }
@@ -855,15 +2021,23 @@ bool gdi_polygon(gdi_dc_t *dc, const POINT *points, int count)
 bool gdi_arc(gdi_dc_t *dc, int left, int top, int right, int bottom,
               int x_start, int y_start, int x_end, int y_end)
 {
-    (void)dc;
-    (void)left;
-    (void)top;
-    (void)right;
-    (void)bottom;
-    (void)x_start;
-    (void)y_start;
-    (void)x_end;
-    (void)y_end;
-    /* Not implemented */
-    return true;
+    return draw_arc(dc, ARC_TYPE_ARC, left, top, right, bottom, x_start, y_start, x_end, y_end);
+}
+
+bool gdi_arc_to(gdi_dc_t *dc, int left, int top, int right, int bottom,
+                int x_start, int y_start, int x_end, int y_end)
+{
+    return draw_arc(dc, ARC_TYPE_ARCTO, left, top, right, bottom, x_start, y_start, x_end, y_end);
+}
+
+bool gdi_chord(gdi_dc_t *dc, int left, int top, int right, int bottom,
+               int x_start, int y_start, int x_end, int y_end)
+{
+    return draw_arc(dc, ARC_TYPE_CHORD, left, top, right, bottom, x_start, y_start, x_end, y_end);
+}
+
+bool gdi_pie(gdi_dc_t *dc, int left, int top, int right, int bottom,
+             int x_start, int y_start, int x_end, int y_end)
+{
+    return draw_arc(dc, ARC_TYPE_PIE, left, top, right, bottom, x_start, y_start, x_end, y_end);
 }
@@ -8,6 +8,16 @@
 #include "gdi_handle_table.h"
 #include "gdi_dc.h"
 
+/* Stretch modes (SetStretchBltMode) */
+#define BLACKONWHITE    1
+#define WHITEONBLACK    2
+#define COLORONCOLOR    3
+#define HALFTONE        4
+
+/* Polygon fill modes (SetPolyFillMode) */
+#define ALTERNATE       1
+#define WINDING         2
+
 /*
  * Rectangle operations
  */
@@ -53,6 +63,9 @@ bool gdi_polyline(gdi_dc_t *dc, const POINT *points, int count);
 /* Draw multiple polylines */
 bool gdi_poly_polyline(gdi_dc_t *dc, const POINT *points, const int *counts, int num_polys);
 
+/* Draw lines from current position through points, updating current position */
+bool gdi_polyline_to(gdi_dc_t *dc, const POINT *points, int count);
+
 /*
  * Region operations
  */
@@ -82,10 +95,25 @@ bool gdi_round_rect(gdi_dc_t *dc, int left, int top, int right, int bottom, int
 /* Draw polygon */
 bool gdi_polygon(gdi_dc_t *dc, const POINT *points, int count);
 
+/* Draw multiple polygons filled as one shape */
+bool gdi_poly_polygon(gdi_dc_t *dc, const POINT *points, const int *counts, int num_polys);
+
 /* Draw arc */
 bool gdi_arc(gdi_dc_t *dc, int left, int top, int right, int bottom,
               int x_start, int y_start, int x_end, int y_end);
 
+/* Draw arc connected to current position, moving it to the arc end */
+bool gdi_arc_to(gdi_dc_t *dc, int left, int top, int right, int bottom,
+                int x_start, int y_start, int x_end, int y_end);
+
+/* Draw chord (arc closed by a line, filled) */
+bool gdi_chord(gdi_dc_t *dc, int left, int top, int right, int bottom,
+               int x_start, int y_start, int x_end, int y_end);
+
+/* Draw pie (arc closed by radials, filled) */
+bool gdi_pie(gdi_dc_t *dc, int left, int top, int right, int bottom,
+             int x_start, int y_start, int x_end, int y_end);
+
 /*
  * Pixel operations
  */
@@ -139,11 +167,23 @@ int gdi_combine_rgn(gdi_handle_table_t *table, uint32_t hrgnDest, uint32_t hrgnS
 /* Get region bounding box */
 int gdi_get_rgn_box(gdi_handle_table_t *table, uint32_t hrgn, RECT *rect);
 
+/* Move region */
+int gdi_offset_rgn(gdi_handle_table_t *table, uint32_t hrgn, int x, int y);
+
+/* Check if point is inside region */
+bool gdi_pt_in_region(gdi_handle_table_t *table, uint32_t hrgn, int x, int y);
+
+/* Check if any part of rectangle is inside region */
+bool gdi_rect_in_region(gdi_handle_table_t *table, uint32_t hrgn, const RECT *rect);
+
+/* Compare regions (1 = equal, 0 = different, -1 = error) */
+int gdi_equal_rgn(gdi_handle_table_t *table, uint32_t hrgn1, uint32_t hrgn2);
+
 /*
  * Clipping helpers
  */
 
-/* Clip rectangle to DC bounds */
+/* Clip rectangle to DC clip box (returns surface coordinates) */
 bool gdi_clip_rect(gdi_dc_t *dc, int *x, int *y, int *width, int *height);
 
 /* Check if point is visible in DC */
@@ -7,8 +7,15 @@
 #include <stdlib.h>
 #include <string.h>
 
+/*
+ * The guest's shared table mirrors each entry: wUpper carries the upper 16
+ * bits of the live handle (reuse count and type), which gdi32 compares
+ * against handles it is given. Free entries keep the reuse count of the
+ * next handle the slot will produce.
+ */
+
 /* Update shared table entry when a handle is allocated */
-static void update_shared_entry(gdi_handle_table_t *table, int index, uint8_t type, uint16_t reuse)
+static void update_shared_entry(gdi_handle_table_t *table, int index, uint32_t handle)
 {
     if (table->shared_table == NULL || index >= GDI_MAX_SHARED_HANDLES) {
         return;
@@ -17,18 +24,84 @@ static void update_shared_entry(gdi_handle_table_t *table, int index, uint8_t ty
     entry->pKernelAddress = 0;      /* Not used by guest */
     entry->wProcessId = WBOX_PROCESS_ID;
     entry->wCount = 1;              /* Reference count */
-    entry->wUpper = reuse & 0x7F;   /* Upper bits of handle */
-    entry->wType = type;            /* Object type */
+    entry->wUpper = (uint16_t)(handle >> 16);
+    entry->wType = GDI_HANDLE_TYPE(handle);
     entry->pUserAddress = 0;        /* Not used by guest */
 }
 
 /* Clear shared table entry when a handle is freed */
-static void clear_shared_entry(gdi_handle_table_t *table, int index)
+static void clear_shared_entry(gdi_handle_table_t *table, int index, uint16_t reuse)
 {
     if (table->shared_table == NULL || index >= GDI_MAX_SHARED_HANDLES) {
         return;
     }
-    memset(&table->shared_table[index], 0, sizeof(gdi_shared_handle_entry_t));
+    gdi_shared_handle_entry_t *entry = &table->shared_table[index];
+    memset(entry, 0, sizeof(gdi_shared_handle_entry_t));
+    entry->wUpper = (uint16_t)(GDI_MAKE_HANDLE(0, 0, reuse) >> 16);
+}
+
+/*
+ * Free list
+ *
+ * Free entries are threaded through next_free. Entries are appended at
+ * the tail and taken from the head, so a slot is reused only after every
+ * other free slot; together with the 7-bit reuse count this keeps stale
+ * handles from aliasing new objects under create/delete churn.
+ */
+
+static void free_list_append(gdi_handle_table_t *table, int index)
+{
+    table->entries[index].next_free = -1;
+    if (table->last_free >= 0) {
+        table->entries[table->last_free].next_free = index;
+    } else {
+        table->first_free = index;
+    }
+    table->last_free = index;
+}
+
+/* Double the entry array (up to GDI_MAX_HANDLES) and free-list the new entries */
+static bool grow_entries(gdi_handle_table_t *table)
+{
+    int old_capacity = table->capacity;
+    int new_capacity = old_capacity ? old_capacity * 2 : GDI_INITIAL_HANDLES;
+    if (new_capacity > GDI_MAX_HANDLES) {
+        new_capacity = GDI_MAX_HANDLES;
+    }
+    if (new_capacity <= old_capacity) {
+        return false;
+    }
+
+    gdi_handle_entry_t *entries = realloc(table->entries, new_capacity * sizeof(gdi_handle_entry_t));
+    if (!entries) {
+        return false;
+    }
+    table->entries = entries;
+    table->capacity = new_capacity;
+
+    for (int i = old_capacity; i < new_capacity; i++) {
+        entries[i].object = NULL;
+        entries[i].type = 0;
+        entries[i].flags = 0;
+        entries[i].reuse_count = 1;
+        entries[i].in_use = false;
+        free_list_append(table, i);
+    }
+
+    return true;
+}
+
+/* Look up a live, non-stock entry; the handle's reuse count must match */
+static gdi_handle_entry_t *lookup_entry(gdi_handle_table_t *table, uint32_t handle)
+{
+    int index = GDI_HANDLE_INDEX(handle);
+    if (index >= table->capacity) return NULL;
+
+    gdi_handle_entry_t *entry = &table->entries[index];
+    if (!entry->in_use) return NULL;
+    if ((entry->reuse_count & 0x7F) != GDI_HANDLE_REUSE(handle)) return NULL;
+
+    return entry;
 }
 
 /* Object pool sizes */
@@ -209,32 +282,61 @@ static void init_stock_handles(gdi_handle_table_t *table)
     table->dc_pen_color = RGB(0, 0, 0);          /* Default black */
 }
 
+/* Put every slot of a pool on its free list, lowest index on top */
+static bool pool_free_list_init(gdi_pool_free_list_t *list, int size)
+{
+    list->slots = malloc(size * sizeof(int));
+    if (!list->slots) return false;
+    for (int i = 0; i < size; i++) {
+        list->slots[i] = size - 1 - i;
+    }
+    list->count = size;
+    return true;
+}
+
+/* Pop a free pool slot, or -1 if the pool is exhausted */
+static inline int pool_take(gdi_pool_free_list_t *list)
+{
+    return list->count > 0 ? list->slots[--list->count] : -1;
+}
+
+static inline void pool_give(gdi_pool_free_list_t *list, int index)
+{
+    list->slots[list->count++] = index;
+}
+
 /* Allocate object pools */
 static int init_object_pools(gdi_handle_table_t *table)
 {
     table->dc_pool = calloc(DC_POOL_SIZE, sizeof(gdi_dc_t));
     if (!table->dc_pool) return -1;
     table->dc_pool_size = DC_POOL_SIZE;
+    if (!pool_free_list_init(&table->dc_free, DC_POOL_SIZE)) return -1;
 
     table->brush_pool = calloc(BRUSH_POOL_SIZE, sizeof(gdi_brush_t));
     if (!table->brush_pool) return -1;
     table->brush_pool_size = BRUSH_POOL_SIZE;
+    if (!pool_free_list_init(&table->brush_free, BRUSH_POOL_SIZE)) return -1;
 
     table->pen_pool = calloc(PEN_POOL_SIZE, sizeof(gdi_pen_t));
     if (!table->pen_pool) return -1;
     table->pen_pool_size = PEN_POOL_SIZE;
+    if (!pool_free_list_init(&table->pen_free, PEN_POOL_SIZE)) return -1;
 
     table->font_pool = calloc(FONT_POOL_SIZE, sizeof(gdi_font_t));
     if (!table->font_pool) return -1;
     table->font_pool_size = FONT_POOL_SIZE;
+    if (!pool_free_list_init(&table->font_free, FONT_POOL_SIZE)) return -1;
 
     table->bitmap_pool = calloc(BITMAP_POOL_SIZE, sizeof(gdi_bitmap_t));
     if (!table->bitmap_pool) return -1;
     table->bitmap_pool_size = BITMAP_POOL_SIZE;
+    if (!pool_free_list_init(&table->bitmap_free, BITMAP_POOL_SIZE)) return -1;
 
     table->region_pool = calloc(REGION_POOL_SIZE, sizeof(gdi_region_t));
     if (!table->region_pool) return -1;
     table->region_pool_size = REGION_POOL_SIZE;
+    if (!pool_free_list_init(&table->region_free, REGION_POOL_SIZE)) return -1;
 
     return 0;
 }
@@ -245,17 +347,15 @@ int gdi_handle_table_init(gdi_handle_table_t *table)
     memset(table, 0, sizeof(*table));
 
     /* Initialize handle entries */
-    for (int i = 0; i < GDI_MAX_HANDLES; i++) {
-        table->entries[i].object = NULL;
-        table->entries[i].type = 0;
-        table->entries[i].flags = 0;
-        table->entries[i].reuse_count = 0;
-        table->entries[i].in_use = false;
+    table->first_free = -1;
+    table->last_free = -1;
+    if (!grow_entries(table)) {
+        return -1;
     }
 
     /* Reserve index 0 (NULL handle) */
+    table->first_free = table->entries[0].next_free;
     table->entries[0].in_use = true;
-    table->next_free = 1;
     table->handle_count = 1;
 
     /* Initialize stock objects */
@@ -272,7 +372,7 @@ int gdi_handle_table_init(gdi_handle_table_t *table)
     }
 
     printf("GDI handle table initialized (%d handles, %d stock objects)\n",
-           GDI_MAX_HANDLES, GDI_STOCK_COUNT);
+           table->capacity, GDI_STOCK_COUNT);
     return 0;
 }
 
@@ -286,9 +386,15 @@ void gdi_handle_table_shutdown(gdi_handle_table_t *table)
     free(table->font_pool);
     free(table->bitmap_pool);
     free(table->region_pool);
+    free(table->dc_free.slots);
+    free(table->brush_free.slots);
+    free(table->pen_free.slots);
+    free(table->font_free.slots);
+    free(table->bitmap_free.slots);
+    free(table->region_free.slots);
 
     /* Free any dynamically allocated bitmap pixels */
-    for (int i = 0; i < GDI_MAX_HANDLES; i++) {
+    for (int i = 0; i < table->capacity; i++) {
         if (table->entries[i].in_use && table->entries[i].type == GDI_OBJ_BITMAP) {
             gdi_bitmap_t *bmp = table->entries[i].object;
             if (bmp && bmp->pixels) {
@@ -299,6 +405,7 @@ void gdi_handle_table_shutdown(gdi_handle_table_t *table)
 
     /* Free stock palette entries if allocated */
     free(table->stock_palette.entries);
+    free(table->entries);
 
     memset(table, 0, sizeof(*table));
 }
@@ -306,49 +413,33 @@ void gdi_handle_table_shutdown(gdi_handle_table_t *table)
 /* Allocate a handle */
 uint32_t gdi_alloc_handle(gdi_handle_table_t *table, void *object, uint8_t type)
 {
-    /* Find free slot */
-    int index = -1;
-    for (int i = table->next_free; i < GDI_MAX_HANDLES; i++) {
-        if (!table->entries[i].in_use) {
-            index = i;
-            break;
-        }
-    }
-    if (index < 0) {
-        /* Wrap around and search from beginning */
-        for (int i = 1; i < table->next_free; i++) {
-            if (!table->entries[i].in_use) {
-                index = i;
-                break;
-            }
-        }
-    }
-
-    if (index < 0) {
+    /* Take the free list head, growing the table when it runs dry */
+    if (table->first_free < 0 && !grow_entries(table)) {
         fprintf(stderr, "GDI: Handle table exhausted\n");
         return 0;
     }
 
-    /* Fill entry */
+    int index = table->first_free;
     gdi_handle_entry_t *entry = &table->entries[index];
+    table->first_free = entry->next_free;
+    if (table->first_free < 0) {
+        table->last_free = -1;
+    }
+
+    /* Fill entry (reuse count was advanced when the slot was freed) */
     entry->object = object;
     entry->type = type;
     entry->flags = 0;
-    entry->reuse_count++;
+    entry->next_free = -1;
     entry->in_use = true;
-
-    /* Update hint for next allocation */
-    table->next_free = index + 1;
-    if (table->next_free >= GDI_MAX_HANDLES) {
-        table->next_free = 1;
-    }
     table->handle_count++;
 
+    uint32_t handle = GDI_MAKE_HANDLE(index, type, entry->reuse_count);
+
     /* Update shared table entry for guest */
-    update_shared_entry(table, index, type, entry->reuse_count);
+    update_shared_entry(table, index, handle);
 
-    /* Build handle value */
-    return GDI_MAKE_HANDLE(index, type, entry->reuse_count);
+    return handle;
 }
 
 /* Get object from handle */
@@ -397,16 +488,8 @@ void *gdi_get_object(gdi_handle_table_t *table, uint32_t handle, uint8_t expecte
     }
 
     /* Regular handle */
-    int index = GDI_HANDLE_INDEX(handle);
-    if (index >= GDI_MAX_HANDLES) return NULL;
-
-    gdi_handle_entry_t *entry = &table->entries[index];
-    if (!entry->in_use) return NULL;
-    if (entry->type != expected_type) return NULL;
-
-    /* Validate reuse count */
-    uint16_t reuse = (handle >> GDI_HANDLE_REUSE_SHIFT) & 0x7F;
-    if ((entry->reuse_count & 0x7F) != reuse) return NULL;
+    gdi_handle_entry_t *entry = lookup_entry(table, handle);
+    if (!entry || entry->type != expected_type) return NULL;
 
     return entry->object;
 }
@@ -424,11 +507,8 @@ void *gdi_get_object_any(gdi_handle_table_t *table, uint32_t handle, uint8_t *ou
     }
 
     /* Regular handle */
-    int index = GDI_HANDLE_INDEX(handle);
-    if (index >= GDI_MAX_HANDLES) return NULL;
-
-    gdi_handle_entry_t *entry = &table->entries[index];
-    if (!entry->in_use) return NULL;
+    gdi_handle_entry_t *entry = lookup_entry(table, handle);
+    if (!entry) return NULL;
 
     if (out_type) *out_type = entry->type;
     return entry->object;
@@ -445,27 +525,25 @@ bool gdi_free_handle(gdi_handle_table_t *table, uint32_t handle)
     }
 
     int index = GDI_HANDLE_INDEX(handle);
-    if (index >= GDI_MAX_HANDLES) return false;
+    if (index == 0) return false;
 
-    gdi_handle_entry_t *entry = &table->entries[index];
-    if (!entry->in_use) return false;
+    gdi_handle_entry_t *entry = lookup_entry(table, handle);
+    if (!entry) return false;
 
     /* Validate type matches handle */
     uint8_t type = GDI_HANDLE_TYPE(handle);
     if (entry->type != type) return false;
 
-    /* Mark as free */
+    /* Mark as free and invalidate outstanding copies of the handle */
     entry->in_use = false;
     entry->object = NULL;
+    entry->reuse_count = (entry->reuse_count + 1) & 0x7F;
     table->handle_count--;
 
     /* Clear shared table entry */
-    clear_shared_entry(table, index);
+    clear_shared_entry(table, index, entry->reuse_count);
 
-    /* Update free hint */
-    if (index < table->next_free) {
-        table->next_free = index;
-    }
+    free_list_append(table, index);
 
     return true;
 }
@@ -488,10 +566,7 @@ bool gdi_handle_is_valid(gdi_handle_table_t *table, uint32_t handle)
         return true;  /* Stock handles are always valid */
     }
 
-    int index = GDI_HANDLE_INDEX(handle);
-    if (index >= GDI_MAX_HANDLES) return false;
-
-    return table->entries[index].in_use;
+    return lookup_entry(table, handle) != NULL;
 }
 
 /* Get object type from handle */
@@ -506,12 +581,11 @@ uint8_t gdi_handle_get_type(uint32_t handle)
 
 gdi_dc_t *gdi_alloc_dc(gdi_handle_table_t *table)
 {
-    for (int i = 0; i < table->dc_pool_size; i++) {
-        if (!table->dc_pool[i].in_use) {
-            memset(&table->dc_pool[i], 0, sizeof(gdi_dc_t));
-            table->dc_pool[i].in_use = true;
-            return &table->dc_pool[i];
-        }
+    int i = pool_take(&table->dc_free);
+    if (i >= 0) {
+        memset(&table->dc_pool[i], 0, sizeof(gdi_dc_t));
+        table->dc_pool[i].in_use = true;
+        return &table->dc_pool[i];
     }
     /* Pool exhausted, allocate dynamically */
     gdi_dc_t *dc = calloc(1, sizeof(gdi_dc_t));
@@ -525,7 +599,10 @@ void gdi_free_dc(gdi_handle_table_t *table, gdi_dc_t *dc)
 
     /* Check if it's from the pool */
     if (dc >= table->dc_pool && dc < table->dc_pool + table->dc_pool_size) {
-        dc->in_use = false;
+        if (dc->in_use) {
+            dc->in_use = false;
+            pool_give(&table->dc_free, (int)(dc - table->dc_pool));
+        }
     } else {
         free(dc);
     }
@@ -533,12 +610,11 @@ void gdi_free_dc(gdi_handle_table_t *table, gdi_dc_t *dc)
 
 gdi_brush_t *gdi_alloc_brush(gdi_handle_table_t *table)
 {
-    for (int i = 0; i < table->brush_pool_size; i++) {
-        if (!table->brush_pool[i].in_use) {
-            memset(&table->brush_pool[i], 0, sizeof(gdi_brush_t));
-            table->brush_pool[i].in_use = true;
-            return &table->brush_pool[i];
-        }
+    int i = pool_take(&table->brush_free);
+    if (i >= 0) {
+        memset(&table->brush_pool[i], 0, sizeof(gdi_brush_t));
+        table->brush_pool[i].in_use = true;
+        return &table->brush_pool[i];
     }
     gdi_brush_t *brush = calloc(1, sizeof(gdi_brush_t));
     if (brush) brush->in_use = true;
@@ -549,7 +625,10 @@ void gdi_free_brush(gdi_handle_table_t *table, gdi_brush_t *brush)
 {
     if (!brush) return;
     if (brush >= table->brush_pool && brush < table->brush_pool + table->brush_pool_size) {
-        brush->in_use = false;
+        if (brush->in_use) {
+            brush->in_use = false;
+            pool_give(&table->brush_free, (int)(brush - table->brush_pool));
+        }
     } else {
         free(brush);
     }
@@ -557,12 +636,11 @@ void gdi_free_brush(gdi_handle_table_t *table, gdi_brush_t *brush)
 
 gdi_pen_t *gdi_alloc_pen(gdi_handle_table_t *table)
 {
-    for (int i = 0; i < table->pen_pool_size; i++) {
-        if (!table->pen_pool[i].in_use) {
-            memset(&table->pen_pool[i], 0, sizeof(gdi_pen_t));
-            table->pen_pool[i].in_use = true;
-            return &table->pen_pool[i];
-        }
+    int i = pool_take(&table->pen_free);
+    if (i >= 0) {
+        memset(&table->pen_pool[i], 0, sizeof(gdi_pen_t));
+        table->pen_pool[i].in_use = true;
+        return &table->pen_pool[i];
     }
     gdi_pen_t *pen = calloc(1, sizeof(gdi_pen_t));
     if (pen) pen->in_use = true;
@@ -573,7 +651,10 @@ void gdi_free_pen(gdi_handle_table_t *table, gdi_pen_t *pen)
 {
     if (!pen) return;
     if (pen >= table->pen_pool && pen < table->pen_pool + table->pen_pool_size) {
-        pen->in_use = false;
+        if (pen->in_use) {
+            pen->in_use = false;
+            pool_give(&table->pen_free, (int)(pen - table->pen_pool));
+        }
     } else {
         free(pen);
     }
@@ -581,12 +662,11 @@ void gdi_free_pen(gdi_handle_table_t *table, gdi_pen_t *pen)
 
 gdi_font_t *gdi_alloc_font(gdi_handle_table_t *table)
 {
-    for (int i = 0; i < table->font_pool_size; i++) {
-        if (!table->font_pool[i].in_use) {
-            memset(&table->font_pool[i], 0, sizeof(gdi_font_t));
-            table->font_pool[i].in_use = true;
-            return &table->font_pool[i];
-        }
+    int i = pool_take(&table->font_free);
+    if (i >= 0) {
+        memset(&table->font_pool[i], 0, sizeof(gdi_font_t));
+        table->font_pool[i].in_use = true;
+        return &table->font_pool[i];
     }
     gdi_font_t *font = calloc(1, sizeof(gdi_font_t));
     if (font) font->in_use = true;
@@ -597,7 +677,10 @@ void gdi_free_font(gdi_handle_table_t *table, gdi_font_t *font)
 {
     if (!font) return;
     if (font >= table->font_pool && font < table->font_pool + table->font_pool_size) {
-        font->in_use = false;
+        if (font->in_use) {
+            font->in_use = false;
+            pool_give(&table->font_free, (int)(font - table->font_pool));
+        }
     } else {
         free(font);
     }
@@ -605,12 +688,11 @@ void gdi_free_font(gdi_handle_table_t *table, gdi_font_t *font)
 
 gdi_bitmap_t *gdi_alloc_bitmap(gdi_handle_table_t *table)
 {
-    for (int i = 0; i < table->bitmap_pool_size; i++) {
-        if (!table->bitmap_pool[i].in_use) {
-            memset(&table->bitmap_pool[i], 0, sizeof(gdi_bitmap_t));
-            table->bitmap_pool[i].in_use = true;
-            return &table->bitmap_pool[i];
-        }
+    int i = pool_take(&table->bitmap_free);
+    if (i >= 0) {
+        memset(&table->bitmap_pool[i], 0, sizeof(gdi_bitmap_t));
+        table->bitmap_pool[i].in_use = true;
+        return &table->bitmap_pool[i];
     }
     gdi_bitmap_t *bmp = calloc(1, sizeof(gdi_bitmap_t));
     if (bmp) bmp->in_use = true;
@@ -626,7 +708,10 @@ void gdi_free_bitmap(gdi_handle_table_t *table, gdi_bitmap_t *bitmap)
     bitmap->pixels = NULL;
 
     if (bitmap >= table->bitmap_pool && bitmap < table->bitmap_pool + table->bitmap_pool_size) {
-        bitmap->in_use = false;
+        if (bitmap->in_use) {
+            bitmap->in_use = false;
+            pool_give(&table->bitmap_free, (int)(bitmap - table->bitmap_pool));
+        }
     } else {
         free(bitmap);
     }
@@ -634,12 +719,11 @@ void gdi_free_bitmap(gdi_handle_table_t *table, gdi_bitmap_t *bitmap)
 
 gdi_region_t *gdi_alloc_region(gdi_handle_table_t *table)
 {
-    for (int i = 0; i < table->region_pool_size; i++) {
-        if (!table->region_pool[i].in_use) {
-            memset(&table->region_pool[i], 0, sizeof(gdi_region_t));
-            table->region_pool[i].in_use = true;
-            return &table->region_pool[i];
-        }
+    int i = pool_take(&table->region_free);
+    if (i >= 0) {
+        memset(&table->region_pool[i], 0, sizeof(gdi_region_t));
+        table->region_pool[i].in_use = true;
+        return &table->region_pool[i];
     }
     gdi_region_t *rgn = calloc(1, sizeof(gdi_region_t));
     if (rgn) rgn->in_use = true;
@@ -653,9 +737,14 @@ void gdi_free_region(gdi_handle_table_t *table, gdi_region_t *region)
     /* Free rectangle list if allocated */
     free(region->rects);
     region->rects = NULL;
+    region->rect_count = 0;
+    region->rect_capacity = 0;
 
     if (region >= table->region_pool && region < table->region_pool + table->region_pool_size) {
-        region->in_use = false;
+        if (region->in_use) {
+            region->in_use = false;
+            pool_give(&table->region_free, (int)(region - table->region_pool));
+        }
     } else {
         free(region);
     }
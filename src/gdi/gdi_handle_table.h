@@ -10,8 +10,9 @@
 #include <stdbool.h>
 
 /* Handle table configuration */
-#define GDI_MAX_HANDLES         4096
+#define GDI_INITIAL_HANDLES     4096        /* Entries allocated at startup */
 #define GDI_MAX_SHARED_HANDLES  65536       /* Shared table has 64K entries */
+#define GDI_MAX_HANDLES         GDI_MAX_SHARED_HANDLES  /* Growth limit (16-bit index) */
 #define GDI_HANDLE_INDEX_MASK   0x0000FFFF
 #define GDI_HANDLE_TYPE_SHIFT   16
 #define GDI_HANDLE_TYPE_MASK    0x007F0000
@@ -61,17 +62,26 @@ typedef struct gdi_handle_entry {
     void *object;               /* Pointer to host object */
     uint8_t type;               /* Object type (GDI_OBJ_*) */
     uint8_t flags;              /* Entry flags */
-    uint16_t reuse_count;       /* For handle validation */
+    uint16_t reuse_count;       /* Generation, bumped on free (7 bits used) */
+    int next_free;              /* Next entry on the free list (-1 = end) */
     bool in_use;
 } gdi_handle_entry_t;
 
 /* Handle entry flags */
 #define GDI_ENTRY_STOCK     0x01    /* Stock object, cannot be deleted */
 
+/* Free slots of an object pool, kept as a stack of pool indices */
+typedef struct gdi_pool_free_list {
+    int *slots;
+    int count;
+} gdi_pool_free_list_t;
+
 /* Handle table state */
 typedef struct gdi_handle_table {
-    gdi_handle_entry_t entries[GDI_MAX_HANDLES];
-    int next_free;              /* Next free index hint */
+    gdi_handle_entry_t *entries;    /* Grows by doubling up to GDI_MAX_HANDLES */
+    int capacity;               /* Number of entries allocated */
+    int first_free;             /* Free list head (-1 = empty) */
+    int last_free;              /* Free list tail - freed entries are reused FIFO */
     int handle_count;           /* Number of allocated handles */
 
     /* Guest-mapped shared handle table */
@@ -91,19 +101,25 @@ typedef struct gdi_handle_table {
     /* Stock object handles (cached) */
     uint32_t stock_handles[GDI_STOCK_COUNT];
 
-    /* Object pools (to avoid frequent malloc) */
+    /* Object pools (to avoid frequent malloc), each with its free slots */
     gdi_dc_t *dc_pool;
     int dc_pool_size;
+    gdi_pool_free_list_t dc_free;
     gdi_brush_t *brush_pool;
     int brush_pool_size;
+    gdi_pool_free_list_t brush_free;
     gdi_pen_t *pen_pool;
     int pen_pool_size;
+    gdi_pool_free_list_t pen_free;
     gdi_font_t *font_pool;
     int font_pool_size;
+    gdi_pool_free_list_t font_free;
     gdi_bitmap_t *bitmap_pool;
     int bitmap_pool_size;
+    gdi_pool_free_list_t bitmap_free;
     gdi_region_t *region_pool;
     int region_pool_size;
+    gdi_pool_free_list_t region_free;
 } gdi_handle_table_t;
 
 /*
@@ -196,6 +212,9 @@ void gdi_free_region(gdi_handle_table_t *table, gdi_region_t *region);
 /* Extract type from handle */
 #define GDI_HANDLE_TYPE(h)   (((h) & GDI_HANDLE_TYPE_MASK) >> GDI_HANDLE_TYPE_SHIFT)
 
+/* Extract reuse count from handle */
+#define GDI_HANDLE_REUSE(h)  (((h) & GDI_HANDLE_REUSE_MASK) >> GDI_HANDLE_REUSE_SHIFT)
+
 /* Check if handle is stock object */
 #define GDI_HANDLE_IS_STOCK(h) (((h) & GDI_HANDLE_STOCK_FLAG) != 0)
 
@@ -65,6 +65,9 @@ typedef struct gdi_dc {
     int win_org_x, win_org_y;
     int win_ext_x, win_ext_y;
 
+    /* Surface position of the DC origin (window DCs) */
+    int dc_org_x, dc_org_y;
+
     /* Brush origin */
     int brush_org_x, brush_org_y;
 
@@ -73,7 +76,9 @@ typedef struct gdi_dc {
     struct gdi_pen *pen;
     struct gdi_font *font;
     struct gdi_bitmap *bitmap;      /* For memory DCs */
-    struct gdi_region *clip_region;
+    struct gdi_region *clip_region;     /* App clip region (device coords, owned) */
+    struct gdi_region *vis_region;      /* System visible region (surface coords, owned) */
+    struct gdi_region *eff_region;      /* vis_region & clip_region (surface coords) */
     struct gdi_palette *palette;
 
     /* Previous selected objects (for returning old object on select) */
@@ -159,15 +164,15 @@ typedef struct gdi_bitmap {
 } gdi_bitmap_t;
 
 /*
- * Region object - simplified to rectangle list
+ * Region object - banded y-x rectangle list (see gdi_region.h)
  */
 typedef struct gdi_region {
     uint32_t handle;
-    RECT bounds;                /* Bounding rectangle */
+    RECT bounds;                /* Bounding rectangle (all zero when empty) */
 
-    /* For complex regions, could add rectangle list */
-    int rect_count;
-    RECT *rects;                /* Array of rectangles (NULL for simple rect) */
+    int rect_count;             /* Number of rectangles (0 = empty region) */
+    int rect_capacity;          /* Allocated entries in rects */
+    RECT *rects;                /* Sorted, non-overlapping rectangles */
 
     bool in_use;
 } gdi_region_t;
@@ -0,0 +1,710 @@
+/*
+ * WBOX GDI Region Engine Implementation
+ *
+ * The band-merging core follows the classic X11 miRegionOp algorithm:
+ * both inputs are walked band by band, each y-interval is classified as
+ * covered by one or both sources, and a per-operation callback emits the
+ * resulting rectangles. Bands are coalesced as they are produced.
+ */
+#include "gdi_region.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+/* Initial rectangle storage for a non-empty region */
+#define REGION_INITIAL_RECTS    8
+
+/* Band callbacks for region_op */
+typedef void (*overlap_fn)(gdi_region_t *out,
+                           const RECT *r1, const RECT *r1_end,
+                           const RECT *r2, const RECT *r2_end,
+                           int top, int bottom);
+typedef void (*non_overlap_fn)(gdi_region_t *out,
+                               const RECT *r, const RECT *r_end,
+                               int top, int bottom);
+
+/*
+ * Storage helpers
+ */
+
+static bool region_reserve(gdi_region_t *rgn, int count)
+{
+    if (rgn->rect_capacity < 0) return false;  /* Sticky allocation failure */
+    if (count <= rgn->rect_capacity) return true;
+
+    int new_cap = rgn->rect_capacity ? rgn->rect_capacity : REGION_INITIAL_RECTS;
+    while (new_cap < count) {
+        new_cap *= 2;
+    }
+
+    RECT *rects = realloc(rgn->rects, new_cap * sizeof(RECT));
+    if (!rects) {
+        fprintf(stderr, "GDI: Out of memory growing region to %d rects\n", new_cap);
+        rgn->rect_capacity = -1;
+        return false;
+    }
+
+    rgn->rects = rects;
+    rgn->rect_capacity = new_cap;
+    return true;
+}
+
+static inline void region_add_rect(gdi_region_t *rgn, int left, int top, int right, int bottom)
+{
+    if (!region_reserve(rgn, rgn->rect_count + 1)) return;
+
+    RECT *r = &rgn->rects[rgn->rect_count++];
+    r->left = left;
+    r->top = top;
+    r->right = right;
+    r->bottom = bottom;
+}
+
+/* Recompute the bounding box from the rectangle list */
+static void region_set_extents(gdi_region_t *rgn)
+{
+    if (rgn->rect_count == 0) {
+        memset(&rgn->bounds, 0, sizeof(rgn->bounds));
+        return;
+    }
+
+    const RECT *r = rgn->rects;
+    const RECT *end = r + rgn->rect_count;
+
+    /* Bands are sorted, so top and bottom come from the first and last rect */
+    rgn->bounds.left = r->left;
+    rgn->bounds.top = r->top;
+    rgn->bounds.right = end[-1].right;
+    rgn->bounds.bottom = end[-1].bottom;
+
+    for (; r < end; r++) {
+        if (r->left < rgn->bounds.left) rgn->bounds.left = r->left;
+        if (r->right > rgn->bounds.right) rgn->bounds.right = r->right;
+    }
+}
+
+/* Move the rectangle storage of src into dst, releasing dst's old storage */
+static void region_take(gdi_region_t *dst, gdi_region_t *src)
+{
+    free(dst->rects);
+    dst->rects = src->rects;
+    dst->rect_count = src->rect_count;
+    dst->rect_capacity = src->rect_capacity;
+    dst->bounds = src->bounds;
+
+    src->rects = NULL;
+    src->rect_count = 0;
+    src->rect_capacity = 0;
+}
+
+static inline bool rects_overlap(const RECT *a, const RECT *b)
+{
+    return a->right > b->left && a->left < b->right &&
+           a->bottom > b->top && a->top < b->bottom;
+}
+
+/*
+ * Lifetime
+ */
+
+void gdi_region_init(gdi_region_t *rgn)
+{
+    rgn->rects = NULL;
+    rgn->rect_count = 0;
+    rgn->rect_capacity = 0;
+    memset(&rgn->bounds, 0, sizeof(rgn->bounds));
+}
+
+void gdi_region_cleanup(gdi_region_t *rgn)
+{
+    free(rgn->rects);
+    gdi_region_init(rgn);
+}
+
+gdi_region_t *gdi_region_create(void)
+{
+    gdi_region_t *rgn = calloc(1, sizeof(gdi_region_t));
+    if (rgn) rgn->in_use = true;
+    return rgn;
+}
+
+void gdi_region_destroy(gdi_region_t *rgn)
+{
+    if (!rgn) return;
+    free(rgn->rects);
+    free(rgn);
+}
+
+gdi_region_t *gdi_region_dup(const gdi_region_t *src)
+{
+    if (!src) return NULL;
+
+    gdi_region_t *rgn = gdi_region_create();
+    if (!rgn) return NULL;
+
+    if (!gdi_region_copy(rgn, src)) {
+        gdi_region_destroy(rgn);
+        return NULL;
+    }
+    return rgn;
+}
+
+/*
+ * Construction
+ */
+
+void gdi_region_set_empty(gdi_region_t *rgn)
+{
+    rgn->rect_count = 0;
+    if (rgn->rect_capacity < 0) rgn->rect_capacity = 0;
+    memset(&rgn->bounds, 0, sizeof(rgn->bounds));
+}
+
+bool gdi_region_set_rect(gdi_region_t *rgn, int left, int top, int right, int bottom)
+{
+    /* Normalize like SetRectRgn does */
+    if (left > right) { int t = left; left = right; right = t; }
+    if (top > bottom) { int t = top; top = bottom; bottom = t; }
+
+    gdi_region_set_empty(rgn);
+    if (left == right || top == bottom) {
+        return true;
+    }
+
+    if (!region_reserve(rgn, 1)) return false;
+
+    region_add_rect(rgn, left, top, right, bottom);
+    rgn->bounds = rgn->rects[0];
+    return true;
+}
+
+bool gdi_region_copy(gdi_region_t *dst, const gdi_region_t *src)
+{
+    if (dst == src) return true;
+
+    gdi_region_set_empty(dst);
+    if (src->rect_count == 0) return true;
+
+    if (!region_reserve(dst, src->rect_count)) return false;
+
+    memcpy(dst->rects, src->rects, src->rect_count * sizeof(RECT));
+    dst->rect_count = src->rect_count;
+    dst->bounds = src->bounds;
+    return true;
+}
+
+/*
+ * Band coalescing (miCoalesce)
+ *
+ * prev_start is the start of the band before the one at cur_start. If
+ * the band at cur_start has the same x-extents as the previous band and
+ * they touch vertically, extend the previous band down and drop the
+ * current one, moving any bands appended after it into its place.
+ * Returns the start of the last band in the region, which is the band
+ * the next one should be compared against.
+ */
+static int region_coalesce(gdi_region_t *rgn, int prev_start, int cur_start)
+{
+    int end = rgn->rect_count;
+    int prev_count = cur_start - prev_start;
+
+    /* Count the rectangles of the current band only */
+    int cur_count = 0;
+    int band_top = rgn->rects[cur_start].top;
+    while (cur_start + cur_count < end && rgn->rects[cur_start + cur_count].top == band_top) {
+        cur_count++;
+    }
+
+    /* More bands follow: the next comparison starts at the last one */
+    int last_start = cur_start;
+    if (cur_start + cur_count != end) {
+        last_start = end - 1;
+        while (rgn->rects[last_start - 1].top == rgn->rects[last_start].top) {
+            last_start--;
+        }
+    }
+
+    if (cur_count != prev_count || cur_count == 0) {
+        return last_start;
+    }
+
+    RECT *prev = &rgn->rects[prev_start];
+    RECT *cur = &rgn->rects[cur_start];
+
+    if (prev->bottom != cur->top) {
+        return last_start;
+    }
+
+    for (int i = 0; i < cur_count; i++) {
+        if (prev[i].left != cur[i].left || prev[i].right != cur[i].right) {
+            return last_start;
+        }
+    }
+
+    int bottom = cur->bottom;
+    for (int i = 0; i < prev_count; i++) {
+        prev[i].bottom = bottom;
+    }
+
+    /* Close the gap left by the dropped band */
+    int tail = end - (cur_start + cur_count);
+    if (tail > 0) {
+        memmove(cur, cur + cur_count, tail * sizeof(RECT));
+    }
+    rgn->rect_count -= cur_count;
+
+    return tail > 0 ? last_start - cur_count : prev_start;
+}
+
+/* Find the end of the band starting at r */
+static inline const RECT *band_end(const RECT *r, const RECT *end)
+{
+    const RECT *e = r;
+    int top = r->top;
+    while (e != end && e->top == top) {
+        e++;
+    }
+    return e;
+}
+
+/*
+ * Generic region operation (both inputs must be non-empty)
+ */
+static bool region_op(gdi_region_t *dst, const gdi_region_t *rgn1, const gdi_region_t *rgn2,
+                      overlap_fn overlap, non_overlap_fn non_overlap1,
+                      non_overlap_fn non_overlap2)
+{
+    gdi_region_t out;
+    gdi_region_init(&out);
+
+    if (!region_reserve(&out, MAX(rgn1->rect_count, rgn2->rect_count) * 2)) {
+        return false;
+    }
+
+    const RECT *r1 = rgn1->rects;
+    const RECT *r1_end = r1 + rgn1->rect_count;
+    const RECT *r2 = rgn2->rects;
+    const RECT *r2_end = r2 + rgn2->rect_count;
+
+    int prev_band = 0;
+    int cur_band;
+    int ybot = MIN(rgn1->bounds.top, rgn2->bounds.top);
+    int ytop;
+
+    do {
+        const RECT *r1_band_end = band_end(r1, r1_end);
+        const RECT *r2_band_end = band_end(r2, r2_end);
+
+        /* Handle the part of the band covered by only one source */
+        cur_band = out.rect_count;
+        if (r1->top < r2->top) {
+            int top = MAX(r1->top, ybot);
+            int bot = MIN(r1->bottom, r2->top);
+            if (top != bot && non_overlap1) {
+                non_overlap1(&out, r1, r1_band_end, top, bot);
+            }
+            ytop = r2->top;
+        } else if (r2->top < r1->top) {
+            int top = MAX(r2->top, ybot);
+            int bot = MIN(r2->bottom, r1->top);
+            if (top != bot && non_overlap2) {
+                non_overlap2(&out, r2, r2_band_end, top, bot);
+            }
+            ytop = r1->top;
+        } else {
+            ytop = r1->top;
+        }
+
+        if (out.rect_count != cur_band) {
+            prev_band = region_coalesce(&out, prev_band, cur_band);
+        }
+
+        /* Handle the part covered by both sources */
+        ybot = MIN(r1->bottom, r2->bottom);
+        cur_band = out.rect_count;
+        if (ybot > ytop) {
+            overlap(&out, r1, r1_band_end, r2, r2_band_end, ytop, ybot);
+        }
+
+        if (out.rect_count != cur_band) {
+            prev_band = region_coalesce(&out, prev_band, cur_band);
+        }
+
+        /* Advance past finished bands */
+        if (r1->bottom == ybot) r1 = r1_band_end;
+        if (r2->bottom == ybot) r2 = r2_band_end;
+    } while (r1 != r1_end && r2 != r2_end);
+
+    /* Append whatever remains of the longer source, one band at a time */
+    if (r1 != r1_end) {
+        if (non_overlap1) {
+            do {
+                const RECT *r1_band_end = band_end(r1, r1_end);
+                cur_band = out.rect_count;
+                non_overlap1(&out, r1, r1_band_end, MAX(r1->top, ybot), r1->bottom);
+                if (out.rect_count != cur_band) {
+                    prev_band = region_coalesce(&out, prev_band, cur_band);
+                }
+                r1 = r1_band_end;
+            } while (r1 != r1_end);
+        }
+    } else if (r2 != r2_end && non_overlap2) {
+        do {
+            const RECT *r2_band_end = band_end(r2, r2_end);
+            cur_band = out.rect_count;
+            non_overlap2(&out, r2, r2_band_end, MAX(r2->top, ybot), r2->bottom);
+            if (out.rect_count != cur_band) {
+                prev_band = region_coalesce(&out, prev_band, cur_band);
+            }
+            r2 = r2_band_end;
+        } while (r2 != r2_end);
+    }
+
+    if (out.rect_capacity < 0) {
+        gdi_region_cleanup(&out);
+        return false;
+    }
+
+    region_set_extents(&out);
+    region_take(dst, &out);
+    return true;
+}
+
+/*
+ * Band callbacks
+ */
+
+static void non_overlap_copy(gdi_region_t *out, const RECT *r, const RECT *r_end,
+                             int top, int bottom)
+{
+    for (; r != r_end; r++) {
+        region_add_rect(out, r->left, top, r->right, bottom);
+    }
+}
+
+static void intersect_overlap(gdi_region_t *out,
+                              const RECT *r1, const RECT *r1_end,
+                              const RECT *r2, const RECT *r2_end,
+                              int top, int bottom)
+{
+    while (r1 != r1_end && r2 != r2_end) {
+        int left = MAX(r1->left, r2->left);
+        int right = MIN(r1->right, r2->right);
+
+        if (left < right) {
+            region_add_rect(out, left, top, right, bottom);
+        }
+
+        /* Advance whichever rectangle ends first */
+        if (r1->right < r2->right) {
+            r1++;
+        } else if (r2->right < r1->right) {
+            r2++;
+        } else {
+            r1++;
+            r2++;
+        }
+    }
+}
+
+/* Append [left, right) to the current band, merging with the last rect */
+static inline void union_merge(gdi_region_t *out, int band_start,
+                               int left, int right, int top, int bottom)
+{
+    if (out->rect_count > band_start) {
+        RECT *last = &out->rects[out->rect_count - 1];
+        if (last->right >= left) {
+            if (last->right < right) last->right = right;
+            return;
+        }
+    }
+    region_add_rect(out, left, top, right, bottom);
+}
+
+static void union_overlap(gdi_region_t *out,
+                          const RECT *r1, const RECT *r1_end,
+                          const RECT *r2, const RECT *r2_end,
+                          int top, int bottom)
+{
+    int band_start = out->rect_count;
+
+    while (r1 != r1_end && r2 != r2_end) {
+        if (r1->left < r2->left) {
+            union_merge(out, band_start, r1->left, r1->right, top, bottom);
+            r1++;
+        } else {
+            union_merge(out, band_start, r2->left, r2->right, top, bottom);
+            r2++;
+        }
+    }
+    for (; r1 != r1_end; r1++) {
+        union_merge(out, band_start, r1->left, r1->right, top, bottom);
+    }
+    for (; r2 != r2_end; r2++) {
+        union_merge(out, band_start, r2->left, r2->right, top, bottom);
+    }
+}
+
+static void subtract_overlap(gdi_region_t *out,
+                             const RECT *r1, const RECT *r1_end,
+                             const RECT *r2, const RECT *r2_end,
+                             int top, int bottom)
+{
+    int left = r1->left;
+
+    while (r1 != r1_end && r2 != r2_end) {
+        if (r2->right <= left) {
+            /* Subtrahend entirely to the left */
+            r2++;
+        } else if (r2->left <= left) {
+            /* Subtrahend covers the left edge of the minuend */
+            left = r2->right;
+            if (left >= r1->right) {
+                r1++;
+                if (r1 != r1_end) left = r1->left;
+            } else {
+                r2++;
+            }
+        } else if (r2->left < r1->right) {
+            /* Subtrahend splits the minuend */
+            region_add_rect(out, left, top, r2->left, bottom);
+            left = r2->right;
+            if (left >= r1->right) {
+                r1++;
+                if (r1 != r1_end) left = r1->left;
+            } else {
+                r2++;
+            }
+        } else {
+            /* Minuend finished before the subtrahend starts */
+            if (r1->right > left) {
+                region_add_rect(out, left, top, r1->right, bottom);
+            }
+            r1++;
+            if (r1 != r1_end) left = r1->left;
+        }
+    }
+
+    /* Remaining minuend rectangles are untouched */
+    while (r1 != r1_end) {
+        region_add_rect(out, left, top, r1->right, bottom);
+        r1++;
+        if (r1 != r1_end) left = r1->left;
+    }
+}
+
+/*
+ * Set operations
+ */
+
+bool gdi_region_union(gdi_region_t *dst, const gdi_region_t *a, const gdi_region_t *b)
+{
+    if (a == b || b->rect_count == 0) {
+        return gdi_region_copy(dst, a);
+    }
+    if (a->rect_count == 0) {
+        return gdi_region_copy(dst, b);
+    }
+
+    /* a is a single rectangle covering b (or vice versa) */
+    if (a->rect_count == 1 &&
+        a->bounds.left <= b->bounds.left && a->bounds.top <= b->bounds.top &&
+        a->bounds.right >= b->bounds.right && a->bounds.bottom >= b->bounds.bottom) {
+        return gdi_region_copy(dst, a);
+    }
+    if (b->rect_count == 1 &&
+        b->bounds.left <= a->bounds.left && b->bounds.top <= a->bounds.top &&
+        b->bounds.right >= a->bounds.right && b->bounds.bottom >= a->bounds.bottom) {
+        return gdi_region_copy(dst, b);
+    }
+
+    return region_op(dst, a, b, union_overlap, non_overlap_copy, non_overlap_copy);
+}
+
+bool gdi_region_intersect(gdi_region_t *dst, const gdi_region_t *a, const gdi_region_t *b)
+{
+    if (a == b) {
+        return gdi_region_copy(dst, a);
+    }
+    if (a->rect_count == 0 || b->rect_count == 0 || !rects_overlap(&a->bounds, &b->bounds)) {
+        gdi_region_set_empty(dst);
+        return true;
+    }
+
+    /* Two simple rectangles: no need to run the band machinery */
+    if (a->rect_count == 1 && b->rect_count == 1) {
+        return gdi_region_set_rect(dst,
+                                   MAX(a->bounds.left, b->bounds.left),
+                                   MAX(a->bounds.top, b->bounds.top),
+                                   MIN(a->bounds.right, b->bounds.right),
+                                   MIN(a->bounds.bottom, b->bounds.bottom));
+    }
+
+    return region_op(dst, a, b, intersect_overlap, NULL, NULL);
+}
+
+bool gdi_region_subtract(gdi_region_t *dst, const gdi_region_t *a, const gdi_region_t *b)
+{
+    if (a == b) {
+        gdi_region_set_empty(dst);
+        return true;
+    }
+    if (a->rect_count == 0 || b->rect_count == 0 || !rects_overlap(&a->bounds, &b->bounds)) {
+        return gdi_region_copy(dst, a);
+    }
+
+    return region_op(dst, a, b, subtract_overlap, non_overlap_copy, NULL);
+}
+
+bool gdi_region_xor(gdi_region_t *dst, const gdi_region_t *a, const gdi_region_t *b)
+{
+    gdi_region_t a_minus_b, b_minus_a;
+    gdi_region_init(&a_minus_b);
+    gdi_region_init(&b_minus_a);
+
+    bool ok = gdi_region_subtract(&a_minus_b, a, b) &&
+              gdi_region_subtract(&b_minus_a, b, a) &&
+              gdi_region_union(dst, &a_minus_b, &b_minus_a);
+
+    gdi_region_cleanup(&a_minus_b);
+    gdi_region_cleanup(&b_minus_a);
+    return ok;
+}
+
+/* Wrap a rectangle as a temporary single-rect region (no allocation) */
+static inline void region_from_rect(gdi_region_t *tmp, RECT *storage, const RECT *rect)
+{
+    *storage = *rect;
+    tmp->rects = storage;
+    tmp->bounds = *rect;
+    tmp->rect_capacity = 1;
+    tmp->rect_count = (rect->left < rect->right && rect->top < rect->bottom) ? 1 : 0;
+}
+
+bool gdi_region_union_rect(gdi_region_t *rgn, const RECT *rect)
+{
+    gdi_region_t tmp;
+    RECT storage;
+    region_from_rect(&tmp, &storage, rect);
+    return gdi_region_union(rgn, rgn, &tmp);
+}
+
+bool gdi_region_intersect_rect(gdi_region_t *rgn, const RECT *rect)
+{
+    gdi_region_t tmp;
+    RECT storage;
+    region_from_rect(&tmp, &storage, rect);
+    return gdi_region_intersect(rgn, rgn, &tmp);
+}
+
+bool gdi_region_subtract_rect(gdi_region_t *rgn, const RECT *rect)
+{
+    gdi_region_t tmp;
+    RECT storage;
+    region_from_rect(&tmp, &storage, rect);
+    return gdi_region_subtract(rgn, rgn, &tmp);
+}
+
+int gdi_region_combine(gdi_region_t *dst, const gdi_region_t *a, const gdi_region_t *b, int mode)
+{
+    bool ok;
+
+    switch (mode) {
+        case RGN_AND:  ok = gdi_region_intersect(dst, a, b); break;
+        case RGN_OR:   ok = gdi_region_union(dst, a, b); break;
+        case RGN_XOR:  ok = gdi_region_xor(dst, a, b); break;
+        case RGN_DIFF: ok = gdi_region_subtract(dst, a, b); break;
+        case RGN_COPY: ok = gdi_region_copy(dst, a); break;
+        default:
+            return RGN_ERROR;
+    }
+
+    return ok ? gdi_region_complexity(dst) : RGN_ERROR;
+}
+
+void gdi_region_offset(gdi_region_t *rgn, int dx, int dy)
+{
+    if (rgn->rect_count == 0 || (dx == 0 && dy == 0)) return;
+
+    for (int i = 0; i < rgn->rect_count; i++) {
+        rgn->rects[i].left += dx;
+        rgn->rects[i].right += dx;
+        rgn->rects[i].top += dy;
+        rgn->rects[i].bottom += dy;
+    }
+    rgn->bounds.left += dx;
+    rgn->bounds.right += dx;
+    rgn->bounds.top += dy;
+    rgn->bounds.bottom += dy;
+}
+
+/*
+ * Queries
+ */
+
+int gdi_region_complexity(const gdi_region_t *rgn)
+{
+    if (rgn->rect_count == 0) return NULLREGION;
+    if (rgn->rect_count == 1) return SIMPLEREGION;
+    return COMPLEXREGION;
+}
+
+int gdi_region_find_band(const gdi_region_t *rgn, int y)
+{
+    /* Binary search: bottoms are non-decreasing across the list */
+    int lo = 0;
+    int hi = rgn->rect_count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (rgn->rects[mid].bottom <= y) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+bool gdi_region_pt_in(const gdi_region_t *rgn, int x, int y)
+{
+    if (rgn->rect_count == 0) return false;
+    if (x < rgn->bounds.left || x >= rgn->bounds.right ||
+        y < rgn->bounds.top || y >= rgn->bounds.bottom) {
+        return false;
+    }
+
+    for (int i = gdi_region_find_band(rgn, y); i < rgn->rect_count; i++) {
+        const RECT *r = &rgn->rects[i];
+        if (r->top > y) break;          /* Past the band containing y */
+        if (r->left > x) break;         /* Rects in a band are sorted by x */
+        if (x < r->right) return true;
+    }
+    return false;
+}
+
+bool gdi_region_rect_in(const gdi_region_t *rgn, const RECT *rect)
+{
+    if (rgn->rect_count == 0) return false;
+    if (rect->left >= rect->right || rect->top >= rect->bottom) return false;
+    if (!rects_overlap(&rgn->bounds, rect)) return false;
+
+    for (int i = gdi_region_find_band(rgn, rect->top); i < rgn->rect_count; i++) {
+        const RECT *r = &rgn->rects[i];
+        if (r->top >= rect->bottom) break;
+        if (r->right > rect->left && r->left < rect->right) return true;
+    }
+    return false;
+}
+
+bool gdi_region_equal(const gdi_region_t *a, const gdi_region_t *b)
+{
+    if (a->rect_count != b->rect_count) return false;
+    if (a->rect_count == 0) return true;
+    if (memcmp(&a->bounds, &b->bounds, sizeof(RECT)) != 0) return false;
+
+    /* Coalesced banded regions have a canonical rectangle list */
+    return memcmp(a->rects, b->rects, a->rect_count * sizeof(RECT)) == 0;
+}
@@ -0,0 +1,107 @@
+/*
+ * WBOX GDI Region Engine
+ * Banded y-x rectangle regions (X11/Wine style)
+ *
+ * A region is stored as a list of non-overlapping rectangles sorted by
+ * top edge, then by left edge. Rectangles with the same top edge form a
+ * band and share the same bottom edge. Adjacent bands with identical
+ * x-extents are always coalesced, so two equal point sets always have
+ * identical rectangle lists.
+ */
+#ifndef WBOX_GDI_REGION_H
+#define WBOX_GDI_REGION_H
+
+#include "gdi_objects.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Region complexity results */
+#define RGN_ERROR       0
+#define NULLREGION      1
+#define SIMPLEREGION    2
+#define COMPLEXREGION   3
+
+/* Combine region modes */
+#define RGN_AND         1
+#define RGN_OR          2
+#define RGN_XOR         3
+#define RGN_DIFF        4
+#define RGN_COPY        5
+
+/*
+ * Lifetime
+ */
+
+/* Initialize an empty region (no allocation) */
+void gdi_region_init(gdi_region_t *rgn);
+
+/* Release the rectangle storage of a region */
+void gdi_region_cleanup(gdi_region_t *rgn);
+
+/* Allocate a standalone region not backed by a handle (e.g. DC clipping) */
+gdi_region_t *gdi_region_create(void);
+
+/* Free a region returned by gdi_region_create */
+void gdi_region_destroy(gdi_region_t *rgn);
+
+/* Duplicate a region (returns NULL if src is NULL or on allocation failure) */
+gdi_region_t *gdi_region_dup(const gdi_region_t *src);
+
+/*
+ * Construction
+ */
+
+/* Make the region empty */
+void gdi_region_set_empty(gdi_region_t *rgn);
+
+/* Set region to a single rectangle (empty if the rectangle is empty) */
+bool gdi_region_set_rect(gdi_region_t *rgn, int left, int top, int right, int bottom);
+
+/* Copy src into dst */
+bool gdi_region_copy(gdi_region_t *dst, const gdi_region_t *src);
+
+/*
+ * Set operations - dst may alias either source
+ */
+
+bool gdi_region_union(gdi_region_t *dst, const gdi_region_t *a, const gdi_region_t *b);
+bool gdi_region_intersect(gdi_region_t *dst, const gdi_region_t *a, const gdi_region_t *b);
+bool gdi_region_subtract(gdi_region_t *dst, const gdi_region_t *a, const gdi_region_t *b);
+bool gdi_region_xor(gdi_region_t *dst, const gdi_region_t *a, const gdi_region_t *b);
+
+/* Union/intersect/subtract with a single rectangle */
+bool gdi_region_union_rect(gdi_region_t *rgn, const RECT *rect);
+bool gdi_region_intersect_rect(gdi_region_t *rgn, const RECT *rect);
+bool gdi_region_subtract_rect(gdi_region_t *rgn, const RECT *rect);
+
+/* CombineRgn semantics: returns region complexity or RGN_ERROR */
+int gdi_region_combine(gdi_region_t *dst, const gdi_region_t *a, const gdi_region_t *b, int mode);
+
+/* Translate region */
+void gdi_region_offset(gdi_region_t *rgn, int dx, int dy);
+
+/*
+ * Queries
+ */
+
+/* Get complexity (NULLREGION, SIMPLEREGION, COMPLEXREGION) */
+int gdi_region_complexity(const gdi_region_t *rgn);
+
+/* Check if point is inside region */
+bool gdi_region_pt_in(const gdi_region_t *rgn, int x, int y);
+
+/* Check if any part of rectangle is inside region */
+bool gdi_region_rect_in(const gdi_region_t *rgn, const RECT *rect);
+
+/* Check if two regions cover the same area */
+bool gdi_region_equal(const gdi_region_t *a, const gdi_region_t *b);
+
+/* Index of the first rectangle whose bottom edge lies below y */
+int gdi_region_find_band(const gdi_region_t *rgn, int y);
+
+static inline bool gdi_region_is_empty(const gdi_region_t *rgn)
+{
+    return rgn->rect_count == 0;
+}
+
+#endif /* WBOX_GDI_REGION_H */
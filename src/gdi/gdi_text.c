@@ -136,26 +136,36 @@ const uint8_t *gdi_builtin_font_get_glyph(int codepoint)
 }
 
 /* Draw a single character */
-static void draw_char(gdi_dc_t *dc, int x, int y, uint16_t ch, uint32_t fg_color, uint32_t bg_color, bool opaque)
+static void draw_char(gdi_dc_t *dc, int x, int y, uint16_t ch, uint32_t fg_color, uint32_t bg_color,
+                      bool opaque, const RECT *bound)
 {
     const uint8_t *glyph = gdi_builtin_font_get_glyph(ch);
 
-    for (int row = 0; row < FONT_HEIGHT; row++) {
-        int py = y + row;
-        if (py < 0 || py >= dc->height) continue;
-
-        uint8_t bits = glyph[row];
-        for (int col = 0; col < FONT_WIDTH; col++) {
-            int px = x + col;
-            if (px < 0 || px >= dc->width) continue;
-
-            bool pixel_set = (bits & (0x80 >> col)) != 0;
-            uint32_t *dst = &dc->pixels[py * (dc->pitch / 4) + px];
+    /* Character cell, limited by the ETO_CLIPPED rectangle if any */
+    RECT cell = { x, y, x + FONT_WIDTH, y + FONT_HEIGHT };
+    if (bound) {
+        if (cell.left < bound->left) cell.left = bound->left;
+        if (cell.top < bound->top) cell.top = bound->top;
+        if (cell.right > bound->right) cell.right = bound->right;
+        if (cell.bottom > bound->bottom) cell.bottom = bound->bottom;
+    }
 
-            if (pixel_set) {
-                *dst = fg_color;
-            } else if (opaque) {
-                *dst = bg_color;
+    RECT r;
+    gdi_clip_iter_t iter;
+    gdi_clip_begin(dc, &cell, &iter);
+    while (gdi_clip_next(&iter, &r)) {
+        for (int py = r.top; py < r.bottom; py++) {
+            uint8_t bits = glyph[py - y];
+            uint32_t *dst = &dc->pixels[py * (dc->pitch / 4)];
+
+            for (int px = r.left; px < r.right; px++) {
+                bool pixel_set = (bits & (0x80 >> (px - x))) != 0;
+
+                if (pixel_set) {
+                    dst[px] = fg_color;
+                } else if (opaque) {
+                    dst[px] = bg_color;
+                }
             }
         }
     }
@@ -166,28 +176,50 @@ bool gdi_ext_text_out(gdi_dc_t *dc, int x, int y, uint32_t options,
                        const RECT *rect, const uint16_t *str, int count,
                        const int *dx)
 {
-    if (!dc || !dc->pixels || !str || count <= 0) return false;
+    if (!dc || !dc->pixels) return false;
+
+    /* No text is only valid for an opaque rectangle fill */
+    bool no_text = !str || count <= 0;
+    if (no_text && !(rect && (options & ETO_OPAQUE))) return false;
 
     /* Apply DC origin */
-    x += dc->vp_org_x - dc->win_org_x;
-    y += dc->vp_org_y - dc->win_org_y;
+    int ox = gdi_dc_offset_x(dc);
+    int oy = gdi_dc_offset_y(dc);
+    x += ox;
+    y += oy;
 
     /* Get colors */
     uint32_t fg_color = colorref_to_argb(dc->text_color);
     uint32_t bg_color = colorref_to_argb(dc->bk_color);
     bool opaque = (dc->bk_mode == OPAQUE) || (options & ETO_OPAQUE);
 
+    /* Option rectangle in surface coordinates */
+    RECT opt_rect;
+    if (rect) {
+        opt_rect.left = rect->left + ox;
+        opt_rect.top = rect->top + oy;
+        opt_rect.right = rect->right + ox;
+        opt_rect.bottom = rect->bottom + oy;
+    }
+
     /* Fill background rectangle if ETO_OPAQUE */
     if ((options & ETO_OPAQUE) && rect) {
-        for (int py = rect->top; py < rect->bottom && py < dc->height; py++) {
-            if (py < 0) continue;
-            for (int px = rect->left; px < rect->right && px < dc->width; px++) {
-                if (px < 0) continue;
-                dc->pixels[py * (dc->pitch / 4) + px] = bg_color;
+        RECT r;
+        gdi_clip_iter_t iter;
+        gdi_clip_begin(dc, &opt_rect, &iter);
+        while (gdi_clip_next(&iter, &r)) {
+            for (int py = r.top; py < r.bottom; py++) {
+                uint32_t *dst = &dc->pixels[py * (dc->pitch / 4)];
+                for (int px = r.left; px < r.right; px++) {
+                    dst[px] = bg_color;
+                }
             }
         }
+        dc->dirty = true;
     }
 
+    if (no_text) return true;
+
     /* Apply text alignment */
     if (dc->text_align & TA_CENTER) {
         int width = count * FONT_WIDTH;
@@ -212,22 +244,24 @@ bool gdi_ext_text_out(gdi_dc_t *dc, int x, int y, uint32_t options,
         if (ch < 32) continue;
 
         /* Check clipping if requested */
+        const RECT *bound = NULL;
         if ((options & ETO_CLIPPED) && rect) {
-            if (cur_x + FONT_WIDTH <= rect->left || cur_x >= rect->right) {
+            if (cur_x + FONT_WIDTH <= opt_rect.left || cur_x >= opt_rect.right) {
                 cur_x += dx ? dx[i] : FONT_WIDTH;
                 continue;
             }
+            bound = &opt_rect;
         }
 
-        draw_char(dc, cur_x, y, ch, fg_color, bg_color, opaque && !(options & ETO_OPAQUE));
+        draw_char(dc, cur_x, y, ch, fg_color, bg_color, opaque && !(options & ETO_OPAQUE), bound);
 
         cur_x += dx ? dx[i] : FONT_WIDTH;
     }
 
     /* Update current position if TA_UPDATECP */
     if (dc->text_align & TA_UPDATECP) {
-        dc->cur_x = cur_x - (dc->vp_org_x - dc->win_org_x);
-        dc->cur_y = y - (dc->vp_org_y - dc->win_org_y);
+        dc->cur_x = cur_x - ox;
+        dc->cur_y = y - oy;
     }
 
     dc->dirty = true;
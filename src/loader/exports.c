@@ -18,6 +18,18 @@ const IMAGE_EXPORT_DIRECTORY *exports_get_directory(const pe_image_t *pe)
         pe, pe->data_dirs[IMAGE_DIRECTORY_ENTRY_EXPORT].virtual_address);
 }
 
+bool exports_rva_is_code(const pe_image_t *pe, uint32_t rva)
+{
+    const pe_section_t *section = pe_get_section_by_rva(pe, rva);
+    return section &&
+           (section->characteristics & (IMAGE_SCN_MEM_EXECUTE | IMAGE_SCN_CNT_CODE)) != 0;
+}
+
+static int export_name_compare(const void *a, const void *b)
+{
+    return strcmp(((const export_name_t *)a)->name, ((const export_name_t *)b)->name);
+}
+
 int exports_parse(const pe_image_t *pe, loaded_module_t *mod)
 {
     const IMAGE_EXPORT_DIRECTORY *exp_dir = exports_get_directory(pe);
@@ -26,6 +38,8 @@ int exports_parse(const pe_image_t *pe, loaded_module_t *mod)
         mod->num_exports = 0;
         mod->exports = NULL;
         mod->ordinal_base = 0;
+        mod->num_export_names = 0;
+        mod->export_names = NULL;
         return 0;
     }
 
@@ -35,6 +49,10 @@ int exports_parse(const pe_image_t *pe, loaded_module_t *mod)
 
     mod->num_exports = exp_dir->NumberOfFunctions;
     mod->ordinal_base = exp_dir->Base;
+    mod->exports_data = false;
+    mod->exports_forwarded = false;
+    mod->num_export_names = 0;
+    mod->export_names = NULL;
 
     if (mod->num_exports == 0) {
         mod->exports = NULL;
@@ -78,55 +96,129 @@ int exports_parse(const pe_image_t *pe, loaded_module_t *mod)
             if (forwarder) {
                 mod->exports[i].is_forwarder = true;
                 mod->exports[i].forwarder_name = strdup(forwarder);
+                mod->exports_forwarded = true;
             }
+        } else if (func_rva != 0 && !mod->exports_data && !exports_rva_is_code(pe, func_rva)) {
+            mod->exports_data = true;
         }
     }
 
-    /* Associate names with ordinals */
-    if (name_ptrs && ordinals) {
+    /* Associate names with ordinals, keeping the name table order */
+    if (name_ptrs && ordinals && exp_dir->NumberOfNames > 0) {
+        mod->export_names = calloc(exp_dir->NumberOfNames, sizeof(export_name_t));
+        if (!mod->export_names) {
+            fprintf(stderr, "exports_parse: Out of memory\n");
+            return -1;
+        }
+
+        bool sorted = true;
         for (uint32_t i = 0; i < exp_dir->NumberOfNames; i++) {
             uint16_t ordinal_idx = ordinals[i];
-            if (ordinal_idx < mod->num_exports) {
-                const char *name = (const char *)pe_rva_to_ptr(pe, name_ptrs[i]);
-                if (name) {
-                    mod->exports[ordinal_idx].name = strdup(name);
-                }
+            if (ordinal_idx >= mod->num_exports) {
+                continue;
+            }
+            const char *name = (const char *)pe_rva_to_ptr(pe, name_ptrs[i]);
+            if (!name) {
+                continue;
+            }
+
+            export_name_t *entry = &mod->export_names[mod->num_export_names];
+            entry->name = strdup(name);
+            entry->index = ordinal_idx;
+            if (!entry->name) {
+                continue;
+            }
+            if (mod->num_export_names > 0 &&
+                strcmp(entry[-1].name, entry->name) > 0) {
+                sorted = false;
+            }
+            mod->num_export_names++;
+
+            if (!mod->exports[ordinal_idx].name) {
+                mod->exports[ordinal_idx].name = entry->name;
             }
         }
-    }
 
-    /* Print summary */
-    const char *dll_name = exp_dir->Name ?
-        (const char *)pe_rva_to_ptr(pe, exp_dir->Name) : "unknown";
-    printf("Parsed exports for %s: %u functions, %u named, ordinal base %u\n",
-           dll_name, exp_dir->NumberOfFunctions, exp_dir->NumberOfNames, exp_dir->Base);
+        /* The PE spec requires a sorted table; cope with linkers that
+         * do not (hints then miss and fall back to the search) */
+        if (!sorted) {
+            qsort(mod->export_names, mod->num_export_names, sizeof(export_name_t),
+                  export_name_compare);
+        }
+    }
 
     return 0;
 }
 
+void exports_free(loaded_module_t *mod)
+{
+    if (mod->exports) {
+        for (uint32_t i = 0; i < mod->num_exports; i++) {
+            free(mod->exports[i].forwarder_name);
+        }
+        free(mod->exports);
+    }
+    if (mod->export_names) {
+        for (uint32_t i = 0; i < mod->num_export_names; i++) {
+            free(mod->export_names[i].name);
+        }
+        free(mod->export_names);
+    }
+    mod->exports = NULL;
+    mod->num_exports = 0;
+    mod->export_names = NULL;
+    mod->num_export_names = 0;
+}
+
+static export_lookup_t export_result(const loaded_module_t *mod, uint32_t idx)
+{
+    export_lookup_t result;
+    result.found = true;
+    result.rva = mod->exports[idx].rva;
+    result.ordinal = mod->exports[idx].ordinal;
+    result.is_forwarder = mod->exports[idx].is_forwarder;
+    result.forwarder = mod->exports[idx].forwarder_name;
+    return result;
+}
+
 export_lookup_t exports_lookup_by_name(const loaded_module_t *mod, const char *name)
 {
     export_lookup_t result = { .found = false };
 
-    if (!mod || !name || !mod->exports) {
+    if (!mod || !name || !mod->exports || !mod->export_names) {
         return result;
     }
 
-    /* Linear search through exports looking for matching name */
-    for (uint32_t i = 0; i < mod->num_exports; i++) {
-        if (mod->exports[i].name && strcmp(mod->exports[i].name, name) == 0) {
-            result.found = true;
-            result.rva = mod->exports[i].rva;
-            result.ordinal = mod->exports[i].ordinal;
-            result.is_forwarder = mod->exports[i].is_forwarder;
-            result.forwarder = mod->exports[i].forwarder_name;
-            return result;
+    /* Binary search over the sorted name index */
+    uint32_t lo = 0;
+    uint32_t hi = mod->num_export_names;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(name, mod->export_names[mid].name);
+        if (cmp == 0) {
+            return export_result(mod, mod->export_names[mid].index);
+        }
+        if (cmp < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
         }
     }
 
     return result;
 }
 
+export_lookup_t exports_lookup_by_hint(const loaded_module_t *mod,
+                                       const char *name, uint16_t hint)
+{
+    if (mod && name && mod->exports && hint < mod->num_export_names &&
+        strcmp(mod->export_names[hint].name, name) == 0) {
+        return export_result(mod, mod->export_names[hint].index);
+    }
+
+    return exports_lookup_by_name(mod, name);
+}
+
 export_lookup_t exports_lookup_by_ordinal(const loaded_module_t *mod, uint16_t ordinal)
 {
     export_lookup_t result = { .found = false };
@@ -150,11 +242,5 @@ export_lookup_t exports_lookup_by_ordinal(const loaded_module_t *mod, uint16_t o
         return result;
     }
 
-    result.found = true;
-    result.rva = mod->exports[idx].rva;
-    result.ordinal = mod->exports[idx].ordinal;
-    result.is_forwarder = mod->exports[idx].is_forwarder;
-    result.forwarder = mod->exports[idx].forwarder_name;
-
-    return result;
+    return export_result(mod, idx);
 }
@@ -37,17 +37,33 @@ typedef struct {
 /*
  * Parse export directory of a PE image
  * Populates mod->exports array with all exported functions
+ * Only touches mod and pe, so DLLs can be parsed on worker threads
  * Returns 0 on success, -1 on error
  */
 int exports_parse(const pe_image_t *pe, loaded_module_t *mod);
 
+/*
+ * Free the export tables built by exports_parse
+ */
+void exports_free(loaded_module_t *mod);
+
 /*
  * Lookup export by name
+ * Binary search over the sorted name index
  * Returns result with found=false if not found
  */
 export_lookup_t exports_lookup_by_name(const loaded_module_t *mod,
                                        const char *name);
 
+/*
+ * Lookup export by name, trying an import hint first
+ * The hint (IMAGE_IMPORT_BY_NAME.Hint) is the name's index in the DLL's
+ * name pointer table; when it is stale this falls back to a binary search.
+ * Returns result with found=false if not found
+ */
+export_lookup_t exports_lookup_by_hint(const loaded_module_t *mod,
+                                       const char *name, uint16_t hint);
+
 /*
  * Lookup export by ordinal
  * Returns result with found=false if not found
@@ -61,4 +77,10 @@ export_lookup_t exports_lookup_by_ordinal(const loaded_module_t *mod,
  */
 const IMAGE_EXPORT_DIRECTORY *exports_get_directory(const pe_image_t *pe);
 
+/*
+ * Check if an RVA lies in a code section
+ * Exports elsewhere are data (e.g. msvcrt's _iob) and are read, not called
+ */
+bool exports_rva_is_code(const pe_image_t *pe, uint32_t rva);
+
 #endif /* WBOX_EXPORTS_H */
@@ -0,0 +1,575 @@
+/*
+ * WBOX Image Cache
+ * On-disk cache of relocated module images and their import bindings
+ *
+ * Entry file layout (host byte order; entries are not portable):
+ *   cache_header_t
+ *   image path (path_len bytes, padded to 8)
+ *   relocated image (size_of_image bytes, padded to 8)
+ *   cache_dep_t[num_deps]       at tables_offset
+ *   cache_bind_t[num_binds]     sorted by IAT RVA
+ */
+#include "image_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define CACHE_MAGIC     "WBOXIMG"
+#define CACHE_VERSION   1
+
+#define ALIGN8(x)       (((x) + 7) & ~(uint64_t)7)
+
+typedef struct {
+    char            magic[8];
+    uint32_t        version;
+    uint32_t        base_va;
+    uint32_t        size_of_image;
+    uint32_t        path_len;
+    pe_file_id_t    file_id;
+    uint64_t        tables_offset;      /* 0 until the entry is complete */
+    uint32_t        num_deps;
+    uint32_t        num_binds;
+} cache_header_t;
+
+typedef struct {
+    char            name[IMAGE_CACHE_DEP_NAME];
+    pe_file_id_t    file_id;
+    uint32_t        base_va;
+    uint32_t        reserved;
+} cache_dep_t;
+
+typedef struct {
+    uint32_t        iat_rva;
+    uint32_t        value;
+    uint32_t        dep;                /* Index into the dep table */
+} cache_bind_t;
+
+struct image_cache_entry {
+    char            *file;              /* Entry file name */
+    cache_header_t  header;
+
+    /* Entry read from the cache (hit) */
+    uint8_t         *map;
+    size_t          map_size;
+    const cache_dep_t  *deps;
+    const cache_bind_t *binds;
+    int8_t          *dep_state;         /* Per dep: 0 unchecked, 1 current, -1 stale */
+
+    /* Entry being written (miss, or hit with changed bindings) */
+    int             fd;
+    char            *tmp;
+
+    /* Bindings made this run, written on commit */
+    cache_dep_t     *new_deps;
+    uint32_t        num_new_deps;
+    uint32_t        new_deps_cap;
+    cache_bind_t    *new_binds;
+    uint32_t        num_new_binds;
+    uint32_t        new_binds_cap;
+    bool            dirty;
+};
+
+static bool file_id_known(const pe_file_id_t *id)
+{
+    return id->size != 0;
+}
+
+int image_cache_init(image_cache_t *cache, const char *dir)
+{
+    memset(cache, 0, sizeof(*cache));
+    if (!dir) {
+        return 0;
+    }
+
+#ifdef _WIN32
+    fprintf(stderr, "image_cache: not supported on this host, ignoring '%s'\n", dir);
+    return 0;
+#else
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "image_cache: cannot create '%s': %s\n", dir, strerror(errno));
+        return -1;
+    }
+
+    cache->dir = strdup(dir);
+    return cache->dir ? 0 : -1;
+#endif
+}
+
+void image_cache_free(image_cache_t *cache)
+{
+    free(cache->dir);
+    memset(cache, 0, sizeof(*cache));
+}
+
+#ifndef _WIN32
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t size)
+{
+    const uint8_t *p = data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+/* <dir>/<hash of path, file identity, base and format>.img */
+static char *entry_file_name(const image_cache_t *cache, const char *path,
+                             const pe_image_t *pe, uint32_t base_va)
+{
+    uint32_t version = CACHE_VERSION;
+    uint64_t hash = 0xCBF29CE484222325ull;
+    hash = fnv1a(hash, path, strlen(path));
+    hash = fnv1a(hash, &pe->file_id, sizeof(pe->file_id));
+    hash = fnv1a(hash, &base_va, sizeof(base_va));
+    hash = fnv1a(hash, &pe->size_of_image, sizeof(pe->size_of_image));
+    hash = fnv1a(hash, &version, sizeof(version));
+
+    size_t len = strlen(cache->dir) + 1 + 16 + 4 + 1;
+    char *file = malloc(len);
+    if (file) {
+        snprintf(file, len, "%s/%016llx.img", cache->dir, (unsigned long long)hash);
+    }
+    return file;
+}
+
+static bool write_all(int fd, const void *data, size_t size)
+{
+    const uint8_t *p = data;
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+static bool write_padding(int fd, uint64_t size)
+{
+    static const uint8_t zeros[8];
+    return write_all(fd, zeros, (size_t)(ALIGN8(size) - size));
+}
+
+static uint64_t image_offset(const cache_header_t *hdr)
+{
+    return sizeof(cache_header_t) + ALIGN8(hdr->path_len);
+}
+
+static uint64_t tables_offset(const cache_header_t *hdr)
+{
+    return image_offset(hdr) + ALIGN8(hdr->size_of_image);
+}
+
+/* Create a temp file next to the entry and write everything up to the tables */
+static bool start_file(image_cache_entry_t *entry, const char *path, const uint8_t *image)
+{
+    size_t len = strlen(entry->file) + 8;
+    entry->tmp = malloc(len);
+    if (!entry->tmp) {
+        return false;
+    }
+    snprintf(entry->tmp, len, "%s.XXXXXX", entry->file);
+
+    entry->fd = mkstemp(entry->tmp);
+    if (entry->fd < 0) {
+        free(entry->tmp);
+        entry->tmp = NULL;
+        return false;
+    }
+
+    cache_header_t hdr = entry->header;
+    hdr.tables_offset = 0;
+    hdr.num_deps = 0;
+    hdr.num_binds = 0;
+
+    return write_all(entry->fd, &hdr, sizeof(hdr)) &&
+           write_all(entry->fd, path, hdr.path_len) &&
+           write_padding(entry->fd, hdr.path_len) &&
+           write_all(entry->fd, image, hdr.size_of_image) &&
+           write_padding(entry->fd, hdr.size_of_image);
+}
+
+static void fill_header(cache_header_t *hdr, const char *path, const pe_image_t *pe,
+                        uint32_t base_va)
+{
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    hdr->version = CACHE_VERSION;
+    hdr->base_va = base_va;
+    hdr->size_of_image = pe->size_of_image;
+    hdr->path_len = (uint32_t)strlen(path);
+    hdr->file_id = pe->file_id;
+}
+
+/* A complete entry for exactly this file, path and base */
+static bool entry_valid(const uint8_t *map, size_t size, const cache_header_t *want,
+                        const char *path)
+{
+    if (size < sizeof(cache_header_t)) {
+        return false;
+    }
+
+    const cache_header_t *hdr = (const cache_header_t *)map;
+    if (memcmp(hdr->magic, want->magic, sizeof(hdr->magic)) != 0 ||
+        hdr->version != want->version ||
+        hdr->base_va != want->base_va ||
+        hdr->size_of_image != want->size_of_image ||
+        hdr->path_len != want->path_len ||
+        !image_cache_same_file(&hdr->file_id, &want->file_id)) {
+        return false;
+    }
+
+    if (hdr->tables_offset != tables_offset(hdr) ||
+        hdr->tables_offset + (uint64_t)hdr->num_deps * sizeof(cache_dep_t) +
+        (uint64_t)hdr->num_binds * sizeof(cache_bind_t) != size) {
+        return false;
+    }
+    if (memcmp(map + sizeof(cache_header_t), path, hdr->path_len) != 0) {
+        return false;
+    }
+
+    const cache_dep_t *deps = (const cache_dep_t *)(map + hdr->tables_offset);
+    const cache_bind_t *binds = (const cache_bind_t *)(deps + hdr->num_deps);
+    for (uint32_t i = 0; i < hdr->num_deps; i++) {
+        if (memchr(deps[i].name, '\0', sizeof(deps[i].name)) == NULL) {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < hdr->num_binds; i++) {
+        if (binds[i].dep >= hdr->num_deps ||
+            (i > 0 && binds[i].iat_rva <= binds[i - 1].iat_rva)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+image_cache_entry_t *image_cache_load(image_cache_t *cache, const char *path,
+                                      const pe_image_t *pe, uint32_t base_va,
+                                      uint8_t *image)
+{
+    if (!cache->dir || !file_id_known(&pe->file_id)) {
+        return NULL;
+    }
+
+    char *file = entry_file_name(cache, path, pe, base_va);
+    if (!file) {
+        return NULL;
+    }
+
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size <= 0) {
+        if (fd >= 0) close(fd);
+        free(file);
+        cache->misses++;
+        return NULL;
+    }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        free(file);
+        cache->misses++;
+        return NULL;
+    }
+
+    cache_header_t want;
+    fill_header(&want, path, pe, base_va);
+    image_cache_entry_t *entry = NULL;
+    if (entry_valid(map, (size_t)st.st_size, &want, path)) {
+        entry = calloc(1, sizeof(*entry));
+    }
+    if (!entry) {
+        /* Stale or foreign entry: lay the image out again and replace it */
+        munmap(map, (size_t)st.st_size);
+        free(file);
+        cache->misses++;
+        return NULL;
+    }
+
+    entry->file = file;
+    entry->fd = -1;
+    entry->map = map;
+    entry->map_size = (size_t)st.st_size;
+    entry->header = *(const cache_header_t *)map;
+    entry->deps = (const cache_dep_t *)(entry->map + entry->header.tables_offset);
+    entry->binds = (const cache_bind_t *)(entry->deps + entry->header.num_deps);
+    entry->dep_state = calloc(entry->header.num_deps ? entry->header.num_deps : 1, 1);
+    if (!entry->dep_state) {
+        image_cache_entry_free(entry);
+        cache->misses++;
+        return NULL;
+    }
+
+    memcpy(image, entry->map + image_offset(&entry->header), entry->header.size_of_image);
+    cache->hits++;
+    return entry;
+}
+
+image_cache_entry_t *image_cache_begin(image_cache_t *cache, const char *path,
+                                       const pe_image_t *pe, uint32_t base_va,
+                                       const uint8_t *image)
+{
+    if (!cache->dir || !file_id_known(&pe->file_id)) {
+        return NULL;
+    }
+
+    image_cache_entry_t *entry = calloc(1, sizeof(*entry));
+    if (!entry) {
+        return NULL;
+    }
+    entry->fd = -1;
+    fill_header(&entry->header, path, pe, base_va);
+    entry->file = entry_file_name(cache, path, pe, base_va);
+
+    if (!entry->file || !start_file(entry, path, image)) {
+        fprintf(stderr, "image_cache: cannot write entry for %s\n", path);
+        image_cache_entry_free(entry);
+        return NULL;
+    }
+
+    entry->dirty = true;
+    return entry;
+}
+
+static bool dep_current(image_cache_entry_t *entry, uint32_t index,
+                        image_cache_check_fn check, void *ctx)
+{
+    if (entry->dep_state[index] == 0) {
+        const cache_dep_t *rec = &entry->deps[index];
+        image_cache_dep_t dep = {
+            .name = rec->name,
+            .file_id = rec->file_id,
+            .base_va = rec->base_va,
+        };
+        entry->dep_state[index] = check(ctx, &dep) ? 1 : -1;
+        if (entry->dep_state[index] < 0) {
+            entry->dirty = true;
+        }
+    }
+    return entry->dep_state[index] > 0;
+}
+
+bool image_cache_use_bind(image_cache_entry_t *entry, uint32_t iat_rva,
+                          image_cache_check_fn check, void *ctx, uint32_t *value)
+{
+    if (!entry || !entry->binds) {
+        return false;
+    }
+
+    /* Binary search by IAT RVA */
+    uint32_t lo = 0, hi = entry->header.num_binds;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (entry->binds[mid].iat_rva < iat_rva) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == entry->header.num_binds || entry->binds[lo].iat_rva != iat_rva) {
+        return false;
+    }
+
+    const cache_bind_t *bind = &entry->binds[lo];
+    if (!dep_current(entry, bind->dep, check, ctx)) {
+        return false;
+    }
+
+    /* Carried over if the entry gets rewritten */
+    const cache_dep_t *rec = &entry->deps[bind->dep];
+    image_cache_dep_t dep = { .name = rec->name, .file_id = rec->file_id, .base_va = rec->base_va };
+    bool dirty = entry->dirty;
+    image_cache_record_bind(entry, iat_rva, bind->value, &dep);
+    entry->dirty = dirty;
+
+    *value = bind->value;
+    return true;
+}
+
+static int bind_compare(const void *a, const void *b)
+{
+    uint32_t x = ((const cache_bind_t *)a)->iat_rva;
+    uint32_t y = ((const cache_bind_t *)b)->iat_rva;
+    return (x > y) - (x < y);
+}
+
+void image_cache_record_bind(image_cache_entry_t *entry, uint32_t iat_rva,
+                             uint32_t value, const image_cache_dep_t *target)
+{
+    if (!entry || strlen(target->name) >= IMAGE_CACHE_DEP_NAME) {
+        return;
+    }
+
+    uint32_t dep;
+    for (dep = 0; dep < entry->num_new_deps; dep++) {
+        if (entry->new_deps[dep].base_va == target->base_va &&
+            strcmp(entry->new_deps[dep].name, target->name) == 0 &&
+            image_cache_same_file(&entry->new_deps[dep].file_id, &target->file_id)) {
+            break;
+        }
+    }
+    if (dep == entry->num_new_deps) {
+        if (entry->num_new_deps == entry->new_deps_cap) {
+            uint32_t cap = entry->new_deps_cap ? entry->new_deps_cap * 2 : 8;
+            cache_dep_t *deps = realloc(entry->new_deps, cap * sizeof(*deps));
+            if (!deps) return;
+            entry->new_deps = deps;
+            entry->new_deps_cap = cap;
+        }
+        cache_dep_t *rec = &entry->new_deps[entry->num_new_deps++];
+        memset(rec, 0, sizeof(*rec));
+        strcpy(rec->name, target->name);
+        rec->file_id = target->file_id;
+        rec->base_va = target->base_va;
+    }
+
+    if (entry->num_new_binds == entry->new_binds_cap) {
+        uint32_t cap = entry->new_binds_cap ? entry->new_binds_cap * 2 : 256;
+        cache_bind_t *binds = realloc(entry->new_binds, cap * sizeof(*binds));
+        if (!binds) return;
+        entry->new_binds = binds;
+        entry->new_binds_cap = cap;
+    }
+    entry->new_binds[entry->num_new_binds++] = (cache_bind_t){ iat_rva, value, dep };
+    entry->dirty = true;
+}
+
+int image_cache_commit(image_cache_t *cache, image_cache_entry_t *entry)
+{
+    if (!entry) {
+        return 0;
+    }
+    if (!entry->dirty) {
+        /* Hit with every binding still current */
+        image_cache_entry_free(entry);
+        return 0;
+    }
+
+    /* Rewriting a hit: the image comes from the old entry */
+    if (entry->fd < 0 &&
+        !start_file(entry, (const char *)entry->map + sizeof(cache_header_t),
+                    entry->map + image_offset(&entry->header))) {
+        goto fail;
+    }
+
+    /* Sort by slot; keep the last binding of a slot bound twice */
+    qsort(entry->new_binds, entry->num_new_binds, sizeof(cache_bind_t), bind_compare);
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < entry->num_new_binds; i++) {
+        if (n > 0 && entry->new_binds[n - 1].iat_rva == entry->new_binds[i].iat_rva) {
+            n--;
+        }
+        entry->new_binds[n++] = entry->new_binds[i];
+    }
+
+    cache_header_t hdr = entry->header;
+    hdr.tables_offset = tables_offset(&hdr);
+    hdr.num_deps = entry->num_new_deps;
+    hdr.num_binds = n;
+
+    if (!write_all(entry->fd, entry->new_deps, entry->num_new_deps * sizeof(cache_dep_t)) ||
+        !write_all(entry->fd, entry->new_binds, n * sizeof(cache_bind_t)) ||
+        pwrite(entry->fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) ||
+        close(entry->fd) != 0) {
+        entry->fd = -1;
+        goto fail;
+    }
+    entry->fd = -1;
+
+    if (rename(entry->tmp, entry->file) != 0) {
+        goto fail;
+    }
+    free(entry->tmp);
+    entry->tmp = NULL;
+
+    cache->stores++;
+    image_cache_entry_free(entry);
+    return 0;
+
+fail:
+    fprintf(stderr, "image_cache: cannot write %s: %s\n", entry->file, strerror(errno));
+    image_cache_entry_free(entry);
+    return -1;
+}
+
+void image_cache_entry_free(image_cache_entry_t *entry)
+{
+    if (!entry) {
+        return;
+    }
+
+    if (entry->fd >= 0) {
+        close(entry->fd);
+    }
+    if (entry->tmp) {
+        unlink(entry->tmp);
+        free(entry->tmp);
+    }
+    if (entry->map) {
+        munmap(entry->map, entry->map_size);
+    }
+    free(entry->dep_state);
+    free(entry->new_deps);
+    free(entry->new_binds);
+    free(entry->file);
+    free(entry);
+}
+
+#else /* _WIN32: the cache is never enabled */
+
+image_cache_entry_t *image_cache_load(image_cache_t *cache, const char *path,
+                                      const pe_image_t *pe, uint32_t base_va,
+                                      uint8_t *image)
+{
+    (void)cache; (void)path; (void)pe; (void)base_va; (void)image;
+    return NULL;
+}
+
+image_cache_entry_t *image_cache_begin(image_cache_t *cache, const char *path,
+                                       const pe_image_t *pe, uint32_t base_va,
+                                       const uint8_t *image)
+{
+    (void)cache; (void)path; (void)pe; (void)base_va; (void)image;
+    return NULL;
+}
+
+bool image_cache_use_bind(image_cache_entry_t *entry, uint32_t iat_rva,
+                          image_cache_check_fn check, void *ctx, uint32_t *value)
+{
+    (void)entry; (void)iat_rva; (void)check; (void)ctx; (void)value;
+    return false;
+}
+
+void image_cache_record_bind(image_cache_entry_t *entry, uint32_t iat_rva,
+                             uint32_t value, const image_cache_dep_t *target)
+{
+    (void)entry; (void)iat_rva; (void)value; (void)target;
+}
+
+int image_cache_commit(image_cache_t *cache, image_cache_entry_t *entry)
+{
+    (void)cache; (void)entry;
+    return 0;
+}
+
+void image_cache_entry_free(image_cache_entry_t *entry)
+{
+    (void)entry;
+}
+
+#endif
@@ -0,0 +1,105 @@
+/*
+ * WBOX Image Cache
+ * On-disk cache of relocated module images and their import bindings
+ *
+ * An entry holds one PE file laid out and relocated for one load address,
+ * plus the IAT values the loader bound for it. It is keyed by the file's
+ * identity (device, inode, size, mtime, ctime), its path and the load
+ * address. Each binding records the identity and base of the module it
+ * points into. A binding is only reused when that module is loaded from
+ * the same file at the same base in this run; otherwise the import is
+ * resolved again and the entry rewritten. Entries are written to a temp
+ * file and renamed into place, so concurrent instances never see a
+ * partial entry.
+ */
+#ifndef WBOX_IMAGE_CACHE_H
+#define WBOX_IMAGE_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "../pe/pe_loader.h"
+
+/* Longest module name a binding can point into */
+#define IMAGE_CACHE_DEP_NAME    64
+
+/* Cache state, owned by the loader */
+typedef struct image_cache {
+    char        *dir;                   /* Cache directory, NULL if disabled */
+    uint32_t    hits;                   /* Images mapped from the cache */
+    uint32_t    misses;                 /* Images laid out from the PE file */
+    uint32_t    stores;                 /* Entries written */
+    uint32_t    cached_binds;           /* IAT slots bound from the cache */
+} image_cache_t;
+
+/* Module a binding points into */
+typedef struct {
+    const char      *name;
+    pe_file_id_t    file_id;
+    uint32_t        base_va;
+} image_cache_dep_t;
+
+/* One module's entry: read from the cache or being written */
+typedef struct image_cache_entry image_cache_entry_t;
+
+/*
+ * Check that a recorded dependency is loaded from the same file at the
+ * same base in this run
+ */
+typedef bool (*image_cache_check_fn)(void *ctx, const image_cache_dep_t *dep);
+
+static inline bool image_cache_same_file(const pe_file_id_t *a, const pe_file_id_t *b)
+{
+    return memcmp(a, b, sizeof(*a)) == 0;
+}
+
+/*
+ * Enable the cache in dir (created if missing); NULL leaves it disabled
+ * Returns 0 on success, -1 if the directory cannot be created
+ */
+int image_cache_init(image_cache_t *cache, const char *dir);
+
+/* Release cache state */
+void image_cache_free(image_cache_t *cache);
+
+/*
+ * Look up the image of pe (loaded from path) relocated for base_va
+ * On a hit, copies size_of_image bytes into image and returns the entry
+ * with its recorded bindings. Returns NULL on a miss or if disabled.
+ */
+image_cache_entry_t *image_cache_load(image_cache_t *cache, const char *path,
+                                      const pe_image_t *pe, uint32_t base_va,
+                                      uint8_t *image);
+
+/*
+ * Start an entry for an image just laid out and relocated, before any
+ * IAT slot is bound; image is written out now
+ * Returns NULL if disabled or the entry cannot be created.
+ */
+image_cache_entry_t *image_cache_begin(image_cache_t *cache, const char *path,
+                                       const pe_image_t *pe, uint32_t base_va,
+                                       const uint8_t *image);
+
+/*
+ * Get the cached value of the IAT slot at iat_rva
+ * Returns false if the slot has no binding or the module it points into
+ * fails check; the caller then resolves the import and records it.
+ */
+bool image_cache_use_bind(image_cache_entry_t *entry, uint32_t iat_rva,
+                          image_cache_check_fn check, void *ctx, uint32_t *value);
+
+/* Record an IAT slot bound to value, inside module target */
+void image_cache_record_bind(image_cache_entry_t *entry, uint32_t iat_rva,
+                             uint32_t value, const image_cache_dep_t *target);
+
+/*
+ * Finish an entry once the module's imports are bound: writes it if new
+ * or if bindings changed, then frees it
+ * Returns 0 on success, -1 if it could not be written.
+ */
+int image_cache_commit(image_cache_t *cache, image_cache_entry_t *entry);
+
+/* Drop an entry without writing it */
+void image_cache_entry_free(image_cache_entry_t *entry);
+
+#endif /* WBOX_IMAGE_CACHE_H */
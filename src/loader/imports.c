@@ -5,6 +5,7 @@
 #include "imports.h"
 #include "exports.h"
 #include "stubs.h"
+#include "image_cache.h"
 #include "ntdll_stubs.h"
 #include "win32k_stubs.h"
 #include "../vm/vm.h"
@@ -34,6 +35,32 @@ bool imports_dll_uses_stubs(const char *dll_name)
            strcasecmp(dll_name, "win32u") == 0;
 }
 
+/*
+ * Split a forwarder string, "DLL.Function" or "DLL.#Ordinal", into the
+ * DLL file name (".dll" added if missing) and the function part
+ */
+static bool parse_forwarder(const char *forwarder, char fwd_dll[256], char fwd_func[256])
+{
+    const char *dot = strchr(forwarder, '.');
+    if (!dot) {
+        return false;
+    }
+
+    size_t dll_len = dot - forwarder;
+    if (dll_len >= 256) dll_len = 255;
+    strncpy(fwd_dll, forwarder, dll_len);
+    fwd_dll[dll_len] = '\0';
+
+    /* Add .dll extension if not present */
+    if (!strchr(fwd_dll, '.')) {
+        strncat(fwd_dll, ".dll", 256 - strlen(fwd_dll) - 1);
+    }
+
+    strncpy(fwd_func, dot + 1, 255);
+    fwd_func[255] = '\0';
+    return true;
+}
+
 uint32_t imports_resolve_function(module_manager_t *mgr, vm_context_t *vm,
                                   struct stub_manager *stubs,
                                   loaded_module_t *dll_mod,
@@ -71,7 +98,7 @@ uint32_t imports_resolve_function(module_manager_t *mgr, vm_context_t *vm,
     /* Try to resolve from the DLL's exports */
     export_lookup_t lookup;
     if (func_name) {
-        lookup = exports_lookup_by_name(dll_mod, func_name);
+        lookup = exports_lookup_by_hint(dll_mod, func_name, ordinal);
     } else {
         lookup = exports_lookup_by_ordinal(dll_mod, ordinal);
     }
@@ -82,28 +109,13 @@ uint32_t imports_resolve_function(module_manager_t *mgr, vm_context_t *vm,
 
     /* Handle forwarders by recursively resolving */
     if (lookup.is_forwarder) {
-        /* Parse forwarder string: "DLL.Function" or "DLL.#Ordinal" */
         char fwd_dll[256];
         char fwd_func[256];
-        const char *dot = strchr(lookup.forwarder, '.');
-        if (!dot) {
+        if (!parse_forwarder(lookup.forwarder, fwd_dll, fwd_func)) {
             fprintf(stderr, "Warning: Invalid forwarder format '%s'\n", lookup.forwarder);
             return 0;
         }
 
-        size_t dll_len = dot - lookup.forwarder;
-        if (dll_len >= sizeof(fwd_dll)) dll_len = sizeof(fwd_dll) - 1;
-        strncpy(fwd_dll, lookup.forwarder, dll_len);
-        fwd_dll[dll_len] = '\0';
-
-        /* Add .dll extension if not present */
-        if (!strchr(fwd_dll, '.')) {
-            strncat(fwd_dll, ".dll", sizeof(fwd_dll) - strlen(fwd_dll) - 1);
-        }
-
-        strncpy(fwd_func, dot + 1, sizeof(fwd_func) - 1);
-        fwd_func[sizeof(fwd_func) - 1] = '\0';
-
         /* Find or load target DLL */
         loaded_module_t *fwd_mod = module_find_by_name(mgr, fwd_dll);
         if (!fwd_mod) {
@@ -120,7 +132,7 @@ uint32_t imports_resolve_function(module_manager_t *mgr, vm_context_t *vm,
             uint16_t fwd_ord = (uint16_t)atoi(fwd_func + 1);
             return imports_resolve_function(mgr, vm, stubs, fwd_mod, NULL, fwd_ord, is_stub);
         } else {
-            /* Named forwarding */
+            /* Named forwarding (no hint) */
             return imports_resolve_function(mgr, vm, stubs, fwd_mod, fwd_func, 0, is_stub);
         }
     }
@@ -129,6 +141,154 @@ uint32_t imports_resolve_function(module_manager_t *mgr, vm_context_t *vm,
     return dll_mod->base_va + lookup.rva;
 }
 
+/*
+ * A cached binding is reusable if the module it points into is loaded from
+ * the same file at the same base. Modules served by stubs never are: their
+ * bindings depend on the stub tables, not on the file.
+ */
+static bool cached_dep_current(void *ctx, const image_cache_dep_t *dep)
+{
+    loaded_module_t *target = module_find_by_name((module_manager_t *)ctx, dep->name);
+    return target && !imports_dll_uses_stubs(target->name) &&
+           target->base_va == dep->base_va &&
+           image_cache_same_file(&target->pe.file_id, &dep->file_id);
+}
+
+/* Record a direct binding for the image cache */
+static void cache_record_bind(module_manager_t *mgr, loaded_module_t *mod,
+                              loaded_module_t *dll_mod, uint32_t iat_rva, uint32_t va)
+{
+    if (!mod->cache_entry || imports_dll_uses_stubs(dll_mod->name)) {
+        return;
+    }
+
+    /* Forwarders can land in another module */
+    loaded_module_t *target = module_find_by_address(mgr, va);
+    if (!target || imports_dll_uses_stubs(target->name)) {
+        return;
+    }
+
+    image_cache_dep_t dep = {
+        .name = target->name,
+        .file_id = target->pe.file_id,
+        .base_va = target->base_va,
+    };
+    image_cache_record_bind(mod->cache_entry, iat_rva, va, &dep);
+}
+
+/* Longest forwarder chain followed when deciding whether to defer */
+#define MAX_FORWARDER_DEPTH 8
+
+/*
+ * Check whether an import can wait for its first call
+ * Stub DLLs are bound now: their stubs are shared and as cheap as a thunk.
+ * That goes for forwarders into them too (kernel32!HeapAlloc ->
+ * NTDLL.RtlAllocateHeap), so chains are followed to where they end; a
+ * thunk there would only cost a stub slot later. Data exports are read
+ * through the IAT, not called, so they need the real address. Forwarders
+ * are only deferred into DLLs already loaded, so that binding never loads
+ * a DLL behind the process's back. A DLL with neither data exports nor
+ * forwarders needs no lookup at all.
+ */
+static bool import_can_defer(module_manager_t *mgr, loaded_module_t *dll_mod,
+                             const char *func_name, uint16_t ordinal, int depth)
+{
+    if (imports_dll_uses_stubs(dll_mod->name)) {
+        return false;
+    }
+    if (!dll_mod->exports_data && !dll_mod->exports_forwarded) {
+        return true;
+    }
+
+    export_lookup_t lookup = func_name ? exports_lookup_by_hint(dll_mod, func_name, ordinal)
+                                       : exports_lookup_by_ordinal(dll_mod, ordinal);
+    if (!lookup.found) {
+        return false;   /* Report it now */
+    }
+    if (lookup.is_forwarder) {
+        char fwd_dll[256];
+        char fwd_func[256];
+        if (depth >= MAX_FORWARDER_DEPTH || !parse_forwarder(lookup.forwarder, fwd_dll, fwd_func)) {
+            return false;
+        }
+        loaded_module_t *fwd_mod = module_find_by_name(mgr, fwd_dll);
+        if (!fwd_mod) {
+            return false;
+        }
+        if (fwd_func[0] == '#') {
+            return import_can_defer(mgr, fwd_mod, NULL, (uint16_t)atoi(fwd_func + 1), depth + 1);
+        }
+        return import_can_defer(mgr, fwd_mod, fwd_func, 0, depth + 1);
+    }
+    return exports_rva_is_code(&dll_mod->pe, lookup.rva);
+}
+
+/*
+ * Point an IAT slot at a new lazy binding thunk
+ * Returns the thunk VA, or 0 to bind the import now
+ */
+static uint32_t defer_import(module_manager_t *mgr, loaded_module_t *dll_mod,
+                             const char *func_name, uint16_t ordinal, uint32_t iat_entry_va)
+{
+    if (mgr->lazy_import_count == mgr->lazy_import_capacity) {
+        uint32_t capacity = mgr->lazy_import_capacity ? mgr->lazy_import_capacity * 2 : 256;
+        lazy_import_t *grown = realloc(mgr->lazy_imports, capacity * sizeof(lazy_import_t));
+        if (!grown) {
+            return 0;
+        }
+        mgr->lazy_imports = grown;
+        mgr->lazy_import_capacity = capacity;
+    }
+
+    uint32_t thunk_va = stubs_generate_lazy_thunk(mgr->stubs, mgr->lazy_import_count);
+    if (thunk_va == 0) {
+        return 0;       /* Stub region down to its reserve: bind the rest now */
+    }
+
+    lazy_import_t *imp = &mgr->lazy_imports[mgr->lazy_import_count++];
+    imp->dll_mod = dll_mod;
+    imp->func_name = func_name;
+    imp->ordinal = ordinal;
+    imp->iat_va = iat_entry_va;
+    imp->target = 0;
+    return thunk_va;
+}
+
+int imports_bind_lazy(module_manager_t *mgr, vm_context_t *vm,
+                      uint32_t index, uint32_t *target)
+{
+    if (index >= mgr->lazy_import_count) {
+        return -1;
+    }
+
+    lazy_import_t *imp = &mgr->lazy_imports[index];
+    if (imp->target == 0) {
+        bool is_stub = false;
+        uint32_t resolved_va = imports_resolve_function(
+            mgr, vm, mgr->stubs, imp->dll_mod, imp->func_name, imp->ordinal, &is_stub);
+        if (resolved_va == 0) {
+            if (imp->func_name) {
+                fprintf(stderr, "imports: Unresolved import %s!%s\n",
+                        imp->dll_mod->name, imp->func_name);
+            } else {
+                fprintf(stderr, "imports: Unresolved import %s!#%u\n",
+                        imp->dll_mod->name, imp->ordinal);
+            }
+            return -1;
+        }
+        imp->target = resolved_va;
+
+        /* Later calls through the IAT go straight to the target */
+        uint32_t iat_entry_phys = vm_va_to_phys(vm, imp->iat_va);
+        if (iat_entry_phys != 0) {
+            mem_writel_phys(iat_entry_phys, resolved_va);
+        }
+    }
+
+    *target = imp->target;
+    return 0;
+}
+
 static int resolve_dll_imports(module_manager_t *mgr, vm_context_t *vm,
                                loaded_module_t *mod, loaded_module_t *dll_mod,
                                const IMAGE_IMPORT_DESCRIPTOR *imp_desc,
@@ -173,12 +333,32 @@ static int resolve_dll_imports(module_manager_t *mgr, vm_context_t *vm,
                 continue;
             }
             func_name = name_entry->Name;
+            ordinal = name_entry->Hint;     /* Index into the DLL's name table */
         }
 
-        /* Resolve the function */
+        /* Resolve the function, take the binding from the image cache or
+         * leave it for the first call */
         bool is_stub = false;
-        uint32_t resolved_va = imports_resolve_function(
-            mgr, vm, mgr->stubs, dll_mod, func_name, ordinal, &is_stub);
+        bool cached = false;
+        bool lazy = false;
+        uint32_t resolved_va = 0;
+        uint32_t slot_rva = iat_rva + i * sizeof(uint32_t);
+        uint32_t iat_entry_va = iat_va + i * sizeof(uint32_t);
+        if (image_cache_use_bind(mod->cache_entry, slot_rva, cached_dep_current, mgr,
+                                 &resolved_va)) {
+            cached = true;
+            mgr->image_cache->cached_binds++;
+        } else if (mgr->lazy_binding && import_can_defer(mgr, dll_mod, func_name, ordinal, 0) &&
+                   (resolved_va = defer_import(mgr, dll_mod, func_name, ordinal,
+                                               iat_entry_va)) != 0) {
+            lazy = true;
+        } else {
+            resolved_va = imports_resolve_function(
+                mgr, vm, mgr->stubs, dll_mod, func_name, ordinal, &is_stub);
+            if (resolved_va != 0 && !is_stub) {
+                cache_record_bind(mgr, mod, dll_mod, slot_rva, resolved_va);
+            }
+        }
 
         if (resolved_va == 0) {
             if (func_name) {
@@ -193,7 +373,6 @@ static int resolve_dll_imports(module_manager_t *mgr, vm_context_t *vm,
         }
 
         /* Patch IAT entry in guest memory */
-        uint32_t iat_entry_va = iat_va + i * sizeof(uint32_t);
         uint32_t iat_entry_phys = vm_va_to_phys(vm, iat_entry_va);
         if (iat_entry_phys == 0) {
             fprintf(stderr, "imports: Failed to translate IAT VA 0x%08X\n",
@@ -205,19 +384,20 @@ static int resolve_dll_imports(module_manager_t *mgr, vm_context_t *vm,
 
         /* Update stats */
         stats->total_imports++;
-        if (is_stub) {
+        if (lazy) {
+            stats->lazy_imports++;
+        } else if (is_stub) {
             stats->stubbed_imports++;
         } else {
             stats->direct_imports++;
         }
 
         /* Debug output for known functions */
+        const char *how = lazy ? " (lazy)" : is_stub ? " (stub)" : cached ? " (cached)" : "";
         if (func_name) {
-            printf("  %s -> 0x%08X%s\n", func_name, resolved_va,
-                   is_stub ? " (stub)" : "");
+            printf("  %s -> 0x%08X%s\n", func_name, resolved_va, how);
         } else {
-            printf("  #%u -> 0x%08X%s\n", ordinal, resolved_va,
-                   is_stub ? " (stub)" : "");
+            printf("  #%u -> 0x%08X%s\n", ordinal, resolved_va, how);
         }
     }
 
@@ -270,9 +450,9 @@ int imports_resolve(module_manager_t *mgr, vm_context_t *vm,
         }
     }
 
-    printf("Import resolution complete: %u total, %u stubbed, %u direct, %u failed\n",
+    printf("Import resolution complete: %u total, %u stubbed, %u direct, %u lazy, %u failed\n",
            stats->total_imports, stats->stubbed_imports, stats->direct_imports,
-           stats->failed_imports);
+           stats->lazy_imports, stats->failed_imports);
 
     return (stats->failed_imports > 0) ? -1 : 0;
 }
@@ -283,5 +463,6 @@ void imports_print_stats(const import_stats_t *stats)
     printf("  Total:   %u\n", stats->total_imports);
     printf("  Stubbed: %u\n", stats->stubbed_imports);
     printf("  Direct:  %u\n", stats->direct_imports);
+    printf("  Lazy:    %u\n", stats->lazy_imports);
     printf("  Failed:  %u\n", stats->failed_imports);
 }
@@ -50,8 +50,22 @@ typedef struct {
     uint32_t stubbed_imports;            /* Imports resolved via stub */
     uint32_t direct_imports;             /* Imports resolved directly */
     uint32_t failed_imports;             /* Imports that failed to resolve */
+    uint32_t lazy_imports;               /* Imports left to bind on first call */
 } import_stats_t;
 
+/*
+ * Import bound on first call
+ * Its IAT slot holds a thunk that enters imports_bind_lazy with the
+ * import's number; binding patches the slot, so later calls go direct.
+ */
+typedef struct lazy_import {
+    loaded_module_t *dll_mod;            /* Module imported from */
+    const char      *func_name;          /* NULL for ordinal imports */
+    uint16_t        ordinal;             /* Ordinal, or the name's hint */
+    uint32_t        iat_va;              /* IAT slot in guest memory */
+    uint32_t        target;              /* Bound VA, 0 until first call */
+} lazy_import_t;
+
 /*
  * Resolve all imports for a loaded module
  * This is the main entry point - resolves imports from all DLLs
@@ -83,7 +97,7 @@ const IMAGE_IMPORT_DESCRIPTOR *imports_get_directory(const pe_image_t *pe);
  *   stubs      - Stub manager for generating stubs
  *   dll_mod    - Module to resolve from (the DLL)
  *   func_name  - Function name (NULL for ordinal import)
- *   ordinal    - Ordinal value (if func_name is NULL)
+ *   ordinal    - Ordinal value (if func_name is NULL), else the name's hint
  *   is_stub    - Output: set to true if resolved via stub
  */
 uint32_t imports_resolve_function(module_manager_t *mgr, vm_context_t *vm,
@@ -92,6 +106,16 @@ uint32_t imports_resolve_function(module_manager_t *mgr, vm_context_t *vm,
                                   const char *func_name, uint16_t ordinal,
                                   bool *is_stub);
 
+/*
+ * Bind a lazy import on its first call, from the thunk's SYSENTER
+ * Resolves it like a load-time import (exports, forwarders, stubs) and
+ * patches its IAT slot. Later calls through a stale copy of the thunk
+ * address get the same target.
+ * Returns 0 with *target set, -1 if the import cannot be resolved
+ */
+int imports_bind_lazy(module_manager_t *mgr, vm_context_t *vm,
+                      uint32_t index, uint32_t *target);
+
 /*
  * Check if a DLL is known and should have stubs generated
  * Currently only ntdll.dll returns true
@@ -7,7 +7,10 @@
 #include "exports.h"
 #include "imports.h"
 #include "stubs.h"
+#include "image_cache.h"
+#include "prefetch.h"
 #include "../vm/vm.h"
+#include "../vm/startup_profile.h"
 #include "../vm/paging.h"
 #include "../cpu/mem.h"
 
@@ -23,6 +26,7 @@
 int loader_init(loader_context_t *ctx, vm_context_t *vm)
 {
     memset(ctx, 0, sizeof(*ctx));
+    ctx->vm = vm;
 
     /* Initialize module manager */
     if (module_manager_init(&ctx->modules, vm) < 0) {
@@ -36,8 +40,9 @@ int loader_init(loader_context_t *ctx, vm_context_t *vm)
         return -1;
     }
 
-    /* Link stub manager to module manager */
+    /* Link stub manager and image cache to module manager */
     ctx->modules.stubs = &ctx->stubs;
+    ctx->modules.image_cache = &ctx->image_cache;
 
     printf("Loader initialized\n");
     return 0;
@@ -49,26 +54,54 @@ void loader_set_ntdll_path(loader_context_t *ctx, const char *path)
     module_manager_set_ntdll_path(&ctx->modules, path);
 }
 
+int loader_set_image_cache(loader_context_t *ctx, const char *dir)
+{
+    image_cache_free(&ctx->image_cache);
+    return image_cache_init(&ctx->image_cache, dir);
+}
+
+void loader_set_lazy_binding(loader_context_t *ctx, bool enable)
+{
+    ctx->modules.lazy_binding = enable;
+}
+
 static loaded_module_t *load_pe_internal(loader_context_t *ctx, vm_context_t *vm,
                                           const char *path, uint32_t preferred_base,
                                           bool is_main_exe)
 {
-    pe_image_t pe;
-
-    if (pe_load(path, &pe) != 0) {
-        fprintf(stderr, "loader: Failed to load PE file: %s\n", path);
-        return NULL;
+    startup_profile_t *prof = vm->profile;
+    int mark = startup_profile_begin(prof);
+
+    /* Parsed and laid out by a prefetch worker? */
+    prefetch_job_t *job = ctx->prefetch ? prefetch_take(ctx->prefetch, path) : NULL;
+    if (job && job->status != 0) {
+        prefetch_release(job);      /* Redo it here to report the error */
+        job = NULL;
     }
 
-    pe_dump_info(&pe);
+    loaded_module_t *mod;
+    if (job) {
+        mod = job->mod;
+        job->mod = NULL;
+    } else {
+        pe_image_t pe;
+        if (pe_load(path, &pe) != 0) {
+            fprintf(stderr, "loader: Failed to load PE file: %s\n", path);
+            return NULL;
+        }
 
-    /* Allocate module structure */
-    loaded_module_t *mod = calloc(1, sizeof(*mod));
-    if (!mod) {
-        fprintf(stderr, "loader: Out of memory for module\n");
-        pe_free(&pe);
-        return NULL;
+        /* Allocate module structure */
+        mod = calloc(1, sizeof(*mod));
+        if (!mod) {
+            fprintf(stderr, "loader: Out of memory for module\n");
+            pe_free(&pe);
+            return NULL;
+        }
+        mod->pe = pe;
     }
+    const pe_image_t pe = mod->pe;
+
+    pe_dump_info(&pe);
 
     /* Extract base name for module name */
     const char *base_name = strrchr(path, '/');
@@ -83,9 +116,9 @@ static loaded_module_t *load_pe_internal(loader_context_t *ctx, vm_context_t *vm
         }
     }
     strncpy(mod->name, base_name, sizeof(mod->name) - 1);
+    startup_profile_end(prof, mark, mod->name, PROFILE_PHASE_PARSE);
+    mark = startup_profile_begin(prof);
 
-    /* Store PE info */
-    mod->pe = pe;
     mod->is_main_exe = is_main_exe;
 
     /* Determine load address */
@@ -106,80 +139,75 @@ static loaded_module_t *load_pe_internal(loader_context_t *ctx, vm_context_t *vm
     printf("Loading %s at 0x%08X, entry point 0x%08X\n",
            mod->name, mod->base_va, mod->entry_point);
 
-    /* Allocate physical memory for the image */
+    /* Laid out by a worker? Only good for the base it relocated for */
+    bool prepared = job && job->image && job->base_va == load_base;
+
+    /* Allocate physical memory for the image, in load order */
     uint32_t image_phys = paging_alloc_phys(&vm->paging, pe.size_of_image);
     if (image_phys == 0) {
         fprintf(stderr, "loader: Failed to allocate physical memory\n");
+        prefetch_release(job);
         module_free(mod);
         return NULL;
     }
     mod->phys_base = image_phys;
 
-    /* Copy PE headers */
-    for (uint32_t i = 0; i < pe.size_of_headers; i++) {
-        mem_writeb_phys(image_phys + i, pe.file_data[i]);
+    /* Lay the image out in its physical frames (contiguous, zeroed) */
+    uint8_t *image = mem_phys_ptr(image_phys, pe.size_of_image);
+    if (!image) {
+        fprintf(stderr, "loader: Failed to copy PE image\n");
+        prefetch_release(job);
+        module_free(mod);
+        return NULL;
     }
 
-    /* Copy sections */
-    for (int i = 0; i < pe.num_sections; i++) {
-        const pe_section_t *sec = &pe.sections[i];
-        uint32_t sec_phys = image_phys + sec->virtual_address;
-        uint32_t copy_size = (sec->raw_size < sec->virtual_size)
-                           ? sec->raw_size : sec->virtual_size;
-
-        printf("  Section %s: VA=0x%08X size=0x%X -> phys=0x%08X\n",
-               sec->name, sec->virtual_address, sec->virtual_size, sec_phys);
-
-        /* Copy raw data */
-        for (uint32_t j = 0; j < copy_size; j++) {
-            mem_writeb_phys(sec_phys + j, pe.file_data[sec->raw_offset + j]);
+    /* Already relocated for this base by an earlier run? */
+    mod->cache_entry = image_cache_load(&ctx->image_cache, path, &pe, mod->base_va, image);
+    if (mod->cache_entry) {
+        printf("  Image mapped from cache\n");
+    } else {
+        if (prepared) {
+            memcpy(image, job->image, pe.size_of_image);
+        } else if (pe_map_image(&pe, image) != 0) {
+            fprintf(stderr, "loader: Failed to copy PE image\n");
+            prefetch_release(job);
+            module_free(mod);
+            return NULL;
         }
 
-        /* Zero-fill remainder (BSS-like) */
-        if (sec->virtual_size > copy_size) {
-            for (uint32_t j = copy_size; j < sec->virtual_size; j++) {
-                mem_writeb_phys(sec_phys + j, 0);
-            }
+        for (int i = 0; i < pe.num_sections; i++) {
+            const pe_section_t *sec = &pe.sections[i];
+            printf("  Section %s: VA=0x%08X size=0x%X -> phys=0x%08X\n",
+                   sec->name, sec->virtual_address, sec->virtual_size,
+                   image_phys + sec->virtual_address);
         }
-    }
 
-    /* Apply base relocations if needed */
-    if (pe.data_dirs[IMAGE_DIRECTORY_ENTRY_BASERELOC].size > 0) {
-        uint32_t reloc_rva = pe.data_dirs[IMAGE_DIRECTORY_ENTRY_BASERELOC].virtual_address;
-        uint32_t reloc_size = pe.data_dirs[IMAGE_DIRECTORY_ENTRY_BASERELOC].size;
-        int64_t delta = (int64_t)mod->base_va - (int64_t)pe.image_base;
-
-        if (delta != 0) {
-            printf("Applying relocations (delta=%lld)\n", (long long)delta);
-
-            uint32_t offset = 0;
-            while (offset < reloc_size) {
-                uint32_t block_rva = *(uint32_t *)(pe.file_data +
-                                      pe_rva_to_file_offset(&pe, reloc_rva + offset));
-                uint32_t block_size = *(uint32_t *)(pe.file_data +
-                                       pe_rva_to_file_offset(&pe, reloc_rva + offset + 4));
-
-                if (block_size == 0)
-                    break;
-
-                uint32_t entry_count = (block_size - 8) / 2;
-                for (uint32_t i = 0; i < entry_count; i++) {
-                    uint16_t entry = *(uint16_t *)(pe.file_data +
-                                      pe_rva_to_file_offset(&pe, reloc_rva + offset + 8 + i * 2));
-                    uint8_t type = entry >> 12;
-                    uint16_t off = entry & 0xFFF;
-
-                    if (type == IMAGE_REL_BASED_HIGHLOW) {
-                        uint32_t addr_phys = image_phys + block_rva + off;
-                        uint32_t val = mem_readl_phys(addr_phys);
-                        mem_writel_phys(addr_phys, val + (uint32_t)delta);
-                    }
-                }
-                offset += block_size;
+        /* Apply base relocations if needed */
+        if (mod->base_va != pe.image_base) {
+            startup_profile_end(prof, mark, mod->name, PROFILE_PHASE_MAP);
+            mark = startup_profile_begin(prof);
+            int fixups = prepared ? job->fixups : pe_relocate_image(&pe, image, mod->base_va);
+            if (fixups < 0) {
+                /* A half-relocated image must neither run nor be cached */
+                fprintf(stderr, "loader: Bad relocations in %s\n", mod->name);
+                prefetch_release(job);
+                module_free(mod);
+                return NULL;
+            } else if (fixups > 0) {
+                printf("Applied %d relocations (delta=%lld)\n", fixups,
+                       (long long)mod->base_va - (long long)pe.image_base);
             }
+            startup_profile_end(prof, mark, mod->name, PROFILE_PHASE_RELOCATE);
+            mark = startup_profile_begin(prof);
         }
+
+        /* Snapshot it before imports are bound */
+        mod->cache_entry = image_cache_begin(&ctx->image_cache, path, &pe, mod->base_va, image);
     }
 
+    bool exports_ready = job != NULL;
+    prefetch_release(job);
+
     /* Map the PE image into virtual address space */
     uint32_t map_flags = PTE_USER | PTE_WRITABLE;
     if (paging_map_range(&vm->paging, mod->base_va, image_phys,
@@ -189,19 +217,61 @@ static loaded_module_t *load_pe_internal(loader_context_t *ctx, vm_context_t *vm
         return NULL;
     }
 
+    startup_profile_end(prof, mark, mod->name, PROFILE_PHASE_MAP);
+    mark = startup_profile_begin(prof);
+
     /* Parse exports */
-    if (exports_parse(&pe, mod) < 0) {
+    if (!exports_ready && exports_parse(&pe, mod) < 0) {
         fprintf(stderr, "loader: Warning: Failed to parse exports for %s\n", mod->name);
+    } else if (exports_get_directory(&pe)) {
+        printf("Parsed exports for %s: %u functions, %u named, ordinal base %u\n",
+               mod->name, mod->num_exports, mod->num_export_names, mod->ordinal_base);
     }
+    startup_profile_end(prof, mark, mod->name, PROFILE_PHASE_PARSE);
 
     /* Add to module list */
-    mod->next = ctx->modules.modules;
-    ctx->modules.modules = mod;
-    ctx->modules.module_count++;
+    if (module_manager_add(&ctx->modules, mod) < 0) {
+        fprintf(stderr, "loader: Out of memory for module index\n");
+        module_free(mod);
+        return NULL;
+    }
 
     return mod;
 }
 
+/*
+ * Find the host file of a DLL and where it must be loaded (0 = its
+ * preferred base)
+ * Returns 0 on success, -1 if it cannot be found (quietly if quiet)
+ */
+static int locate_dll(module_manager_t *mgr, vm_context_t *vm, const char *dll_name,
+                      char dll_path[VFS_MAX_PATH], uint32_t *base, bool quiet)
+{
+    /* For ntdll.dll, use the configured path */
+    if (strcasecmp(dll_name, "ntdll.dll") == 0 || strcasecmp(dll_name, "ntdll") == 0) {
+        if (mgr->ntdll_path == NULL) {
+            if (!quiet) {
+                fprintf(stderr, "module_load_by_name: ntdll.dll requested but no path configured\n");
+                fprintf(stderr, "  Use --ntdll <path> to specify ntdll.dll location\n");
+            }
+            return -1;
+        }
+        snprintf(dll_path, VFS_MAX_PATH, "%s", mgr->ntdll_path);
+        *base = NTDLL_DEFAULT_BASE;
+        return 0;
+    }
+
+    /* For other DLLs, try to find them in the VFS */
+    if (vfs_find_dll(&vm->vfs_jail, dll_name, dll_path) != 0) {
+        if (!quiet) {
+            fprintf(stderr, "module_load_by_name: Cannot find DLL '%s' in VFS\n", dll_name);
+        }
+        return -1;
+    }
+    *base = 0;
+    return 0;
+}
+
 /* Implementation of module_load_by_name - loads DLL by name */
 loaded_module_t *module_load_by_name(module_manager_t *mgr, vm_context_t *vm,
                                      const char *dll_name)
@@ -212,25 +282,9 @@ loaded_module_t *module_load_by_name(module_manager_t *mgr, vm_context_t *vm,
         return existing;
     }
 
-    /* For ntdll.dll, use the configured path */
-    if (strcasecmp(dll_name, "ntdll.dll") == 0 || strcasecmp(dll_name, "ntdll") == 0) {
-        if (mgr->ntdll_path == NULL) {
-            fprintf(stderr, "module_load_by_name: ntdll.dll requested but no path configured\n");
-            fprintf(stderr, "  Use --ntdll <path> to specify ntdll.dll location\n");
-            return NULL;
-        }
-
-        /* Get loader context from stub manager link */
-        loader_context_t *ctx = (loader_context_t *)((char *)mgr -
-                                offsetof(loader_context_t, modules));
-
-        return load_pe_internal(ctx, vm, mgr->ntdll_path, NTDLL_DEFAULT_BASE, false);
-    }
-
-    /* For other DLLs, try to find them in the VFS */
     char dll_path[VFS_MAX_PATH];
-    if (vfs_find_dll(&vm->vfs_jail, dll_name, dll_path) != 0) {
-        fprintf(stderr, "module_load_by_name: Cannot find DLL '%s' in VFS\n", dll_name);
+    uint32_t base;
+    if (locate_dll(mgr, vm, dll_name, dll_path, &base, false) != 0) {
         return NULL;
     }
 
@@ -238,8 +292,51 @@ loaded_module_t *module_load_by_name(module_manager_t *mgr, vm_context_t *vm,
     loader_context_t *ctx = (loader_context_t *)((char *)mgr -
                             offsetof(loader_context_t, modules));
 
-    printf("Loading DLL: %s from %s\n", dll_name, dll_path);
-    return load_pe_internal(ctx, vm, dll_path, 0, false);
+    if (base == 0) {
+        printf("Loading DLL: %s from %s\n", dll_name, dll_path);
+    }
+    return load_pe_internal(ctx, vm, dll_path, base, false);
+}
+
+/* Queue the DLLs a PE image imports that are neither loaded nor queued */
+static void prefetch_imports(loader_context_t *ctx, vm_context_t *vm, const pe_image_t *pe)
+{
+    const IMAGE_IMPORT_DESCRIPTOR *imp_dir = imports_get_directory(pe);
+    for (; imp_dir && imp_dir->Name != 0; imp_dir++) {
+        const char *dll_name = (const char *)pe_rva_to_ptr(pe, imp_dir->Name);
+        if (!dll_name || module_find_by_name(&ctx->modules, dll_name) ||
+            prefetch_has(ctx->prefetch, dll_name)) {
+            continue;
+        }
+
+        char dll_path[VFS_MAX_PATH];
+        uint32_t base;
+        if (locate_dll(&ctx->modules, vm, dll_name, dll_path, &base, true) == 0) {
+            prefetch_submit(ctx->prefetch, dll_name, dll_path, base);
+        }
+    }
+}
+
+/* A worker has parsed a DLL: queue the DLLs it imports */
+static void prefetch_parsed(void *arg, const prefetch_job_t *job)
+{
+    loader_context_t *ctx = arg;
+    prefetch_imports(ctx, ctx->vm, &job->mod->pe);
+}
+
+/*
+ * Hand every DLL the executable depends on to the prefetch workers
+ * Only queues the executable's own imports: the rest of the import graph
+ * is queued as workers parse each DLL, whenever the loader calls into the
+ * pool. Loading runs in the usual order meanwhile and only waits for DLLs
+ * still being prepared.
+ */
+static void prefetch_dependencies(loader_context_t *ctx, vm_context_t *vm)
+{
+    ctx->prefetch = prefetch_create(prefetch_default_workers(), prefetch_parsed, ctx);
+    if (ctx->prefetch) {
+        prefetch_imports(ctx, vm, &ctx->main_module->pe);
+    }
 }
 
 /* Implementation of module_load - loads PE from path */
@@ -272,17 +369,24 @@ int loader_load_executable(loader_context_t *ctx, vm_context_t *vm,
     }
 
     /* Create LDR entry for main executable */
+    int mark = startup_profile_begin(vm->profile);
     if (module_create_ldr_entry(&ctx->modules, vm, ctx->main_module) < 0) {
         fprintf(stderr, "loader: Failed to create LDR entry for main exe\n");
         return -1;
     }
+    startup_profile_end(vm->profile, mark, ctx->main_module->name, PROFILE_PHASE_LDR_ENTRY);
+
+    /* Read and parse its dependencies in parallel */
+    prefetch_dependencies(ctx, vm);
 
     /* Resolve imports for main executable
      * This will recursively load any required DLLs */
     memset(&ctx->import_stats, 0, sizeof(ctx->import_stats));
+    mark = startup_profile_begin(vm->profile);
     if (imports_resolve(&ctx->modules, vm, ctx->main_module, &ctx->import_stats) < 0) {
         fprintf(stderr, "loader: Warning: Some imports failed to resolve\n");
     }
+    startup_profile_end(vm->profile, mark, ctx->main_module->name, PROFILE_PHASE_IMPORTS);
 
     /* Resolve imports for all loaded DLLs as well
      * DLLs like kernel32.dll import from ntdll.dll, etc.
@@ -299,25 +403,42 @@ int loader_load_executable(loader_context_t *ctx, vm_context_t *vm,
                 dll->pe.data_dirs[IMAGE_DIRECTORY_ENTRY_IMPORT].size > 0) {
                 import_stats_t dll_stats = {0};
                 printf("  Resolving imports for %s\n", dll->name);
+                mark = startup_profile_begin(vm->profile);
                 imports_resolve(&ctx->modules, vm, dll, &dll_stats);
+                startup_profile_end(vm->profile, mark, dll->name, PROFILE_PHASE_IMPORTS);
                 dll->imports_resolved = true;
                 imports_resolved++;
                 ctx->import_stats.total_imports += dll_stats.total_imports;
                 ctx->import_stats.stubbed_imports += dll_stats.stubbed_imports;
                 ctx->import_stats.direct_imports += dll_stats.direct_imports;
                 ctx->import_stats.failed_imports += dll_stats.failed_imports;
+                ctx->import_stats.lazy_imports += dll_stats.lazy_imports;
             }
             dll = dll->next;
         }
     } while (imports_resolved > 0);
 
-    /* Create LDR entries for any loaded DLLs */
+    /* Every DLL is loaded: drop what was prepared but never needed */
+    prefetch_destroy(ctx->prefetch);
+    ctx->prefetch = NULL;
+
+    /* All imports are bound: write new or changed cache entries */
     loaded_module_t *mod = ctx->modules.modules;
+    while (mod) {
+        image_cache_commit(&ctx->image_cache, mod->cache_entry);
+        mod->cache_entry = NULL;
+        mod = mod->next;
+    }
+
+    /* Create LDR entries for any loaded DLLs */
+    mod = ctx->modules.modules;
     while (mod) {
         if (!mod->is_main_exe && mod->ldr_entry_va == 0) {
+            mark = startup_profile_begin(vm->profile);
             if (module_create_ldr_entry(&ctx->modules, vm, mod) < 0) {
                 fprintf(stderr, "loader: Failed to create LDR entry for %s\n", mod->name);
             }
+            startup_profile_end(vm->profile, mark, mod->name, PROFILE_PHASE_LDR_ENTRY);
         }
         mod = mod->next;
     }
@@ -532,8 +653,10 @@ loaded_module_t *loader_get_main_module(loader_context_t *ctx)
 
 void loader_free(loader_context_t *ctx)
 {
+    prefetch_destroy(ctx->prefetch);
     module_manager_free(&ctx->modules);
     stubs_free(&ctx->stubs);
+    image_cache_free(&ctx->image_cache);
     memset(ctx, 0, sizeof(*ctx));
 }
 
@@ -554,5 +677,14 @@ void loader_print_status(const loader_context_t *ctx)
     printf("    Total:   %u\n", ctx->import_stats.total_imports);
     printf("    Stubbed: %u\n", ctx->import_stats.stubbed_imports);
     printf("    Direct:  %u\n", ctx->import_stats.direct_imports);
+    printf("    Lazy:    %u\n", ctx->import_stats.lazy_imports);
     printf("    Failed:  %u\n", ctx->import_stats.failed_imports);
+
+    if (ctx->image_cache.dir) {
+        printf("\n  Image Cache (%s):\n", ctx->image_cache.dir);
+        printf("    Hits:    %u\n", ctx->image_cache.hits);
+        printf("    Misses:  %u\n", ctx->image_cache.misses);
+        printf("    Stored:  %u\n", ctx->image_cache.stores);
+        printf("    Cached binds: %u\n", ctx->image_cache.cached_binds);
+    }
 }
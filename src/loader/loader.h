@@ -10,6 +10,7 @@
 #include "module.h"
 #include "stubs.h"
 #include "imports.h"
+#include "image_cache.h"
 
 
 /*
@@ -19,6 +20,9 @@ typedef struct loader_context {
     module_manager_t    modules;            /* Module tracking */
     stub_manager_t      stubs;              /* Stub code generation */
     import_stats_t      import_stats;       /* Import resolution statistics */
+    image_cache_t       image_cache;        /* Relocated image cache */
+    struct prefetch     *prefetch;          /* DLL prefetch workers, while loading */
+    vm_context_t        *vm;                /* VM being loaded into */
 
     loaded_module_t     *main_module;       /* The main executable */
     const char          *ntdll_path;        /* Path to ntdll.dll */
@@ -37,6 +41,21 @@ int loader_init(loader_context_t *ctx, vm_context_t *vm);
  */
 void loader_set_ntdll_path(loader_context_t *ctx, const char *path);
 
+/*
+ * Cache relocated, import-bound images in dir across runs
+ * Must be called before loader_load_executable
+ * Returns 0 on success, -1 if the cache directory is unusable
+ */
+int loader_set_image_cache(loader_context_t *ctx, const char *dir);
+
+/*
+ * Bind imports on their first call instead of at load time
+ * IAT slots start out pointing at thunks in the stub region; data imports,
+ * stub DLLs and forwarders into DLLs not yet loaded are still bound at
+ * load time. Must be called before loader_load_executable.
+ */
+void loader_set_lazy_binding(loader_context_t *ctx, bool enable);
+
 /*
  * Load the main executable and all its dependencies
  *
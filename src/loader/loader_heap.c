@@ -0,0 +1,194 @@
+/*
+ * WBOX Loader Heap
+ * Guest memory allocator for loader structures
+ */
+#include "loader_heap.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t align_size(uint32_t size)
+{
+    if (size == 0) {
+        size = 1;
+    }
+    return (size + LOADER_HEAP_ALIGN - 1) & ~(uint32_t)(LOADER_HEAP_ALIGN - 1);
+}
+
+int loader_heap_init(loader_heap_t *heap, uint32_t base_va, uint32_t reserve, uint32_t initial,
+                     loader_heap_commit_fn commit, loader_heap_clear_fn clear, void *ctx)
+{
+    memset(heap, 0, sizeof(*heap));
+    heap->base_va = base_va;
+    heap->reserve = reserve;
+    heap->commit = commit;
+    heap->clear = clear;
+    heap->ctx = ctx;
+
+    if (initial > reserve) {
+        initial = reserve;
+    }
+    if (initial > 0) {
+        if (commit(ctx, base_va, initial) != 0) {
+            return -1;
+        }
+        heap->committed = initial;
+    }
+    return 0;
+}
+
+static void remove_block(loader_heap_t *heap, uint32_t index)
+{
+    memmove(&heap->free_blocks[index], &heap->free_blocks[index + 1],
+            (heap->free_count - index - 1) * sizeof(loader_heap_block_t));
+    heap->free_count--;
+}
+
+/* Smallest free block that fits, or -1 */
+static int best_fit(const loader_heap_t *heap, uint32_t size)
+{
+    int best = -1;
+    for (uint32_t i = 0; i < heap->free_count; i++) {
+        uint32_t block_size = heap->free_blocks[i].size;
+        if (block_size == size) {
+            return (int)i;
+        }
+        if (block_size > size && (best < 0 || block_size < heap->free_blocks[best].size)) {
+            best = (int)i;
+        }
+    }
+    return best;
+}
+
+uint32_t loader_heap_alloc(loader_heap_t *heap, uint32_t size)
+{
+    if (size > heap->reserve) {
+        return 0;
+    }
+    size = align_size(size);
+
+    /* Recycle a freed block */
+    int index = best_fit(heap, size);
+    if (index >= 0) {
+        loader_heap_block_t *block = &heap->free_blocks[index];
+        uint32_t va = block->va;
+        if (block->size == size) {
+            remove_block(heap, (uint32_t)index);
+        } else {
+            block->va += size;
+            block->size -= size;
+        }
+        heap->clear(heap->ctx, va, size);
+        heap->in_use += size;
+        heap->reused++;
+        return va;
+    }
+
+    if (size > heap->reserve - heap->top) {
+        return 0;
+    }
+
+    /* Commit more of the reservation */
+    if (heap->top + size > heap->committed) {
+        uint32_t grow = heap->top + size - heap->committed;
+        grow = (grow + LOADER_HEAP_COMMIT_STEP - 1) / LOADER_HEAP_COMMIT_STEP * LOADER_HEAP_COMMIT_STEP;
+        if (grow > heap->reserve - heap->committed) {
+            grow = heap->reserve - heap->committed;
+        }
+        if (heap->commit(heap->ctx, heap->base_va + heap->committed, grow) != 0) {
+            return 0;
+        }
+        heap->committed += grow;
+    }
+
+    /* Space freed back to the top was used before */
+    uint32_t va = heap->base_va + heap->top;
+    if (heap->top < heap->high_water) {
+        uint32_t dirty = heap->high_water - heap->top;
+        heap->clear(heap->ctx, va, dirty < size ? dirty : size);
+    }
+    heap->top += size;
+    if (heap->top > heap->high_water) {
+        heap->high_water = heap->top;
+    }
+    heap->in_use += size;
+    return va;
+}
+
+/* Index of the first free block above va */
+static uint32_t find_insert(const loader_heap_t *heap, uint32_t va)
+{
+    uint32_t lo = 0, hi = heap->free_count;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (heap->free_blocks[mid].va <= va) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+void loader_heap_free(loader_heap_t *heap, uint32_t va, uint32_t size)
+{
+    size = align_size(size);
+    if (va < heap->base_va || va - heap->base_va > heap->top ||
+        size > heap->top - (va - heap->base_va)) {
+        return;     /* Not ours */
+    }
+
+    uint32_t i = find_insert(heap, va);
+    loader_heap_block_t *prev = i > 0 ? &heap->free_blocks[i - 1] : NULL;
+    loader_heap_block_t *next = i < heap->free_count ? &heap->free_blocks[i] : NULL;
+    if ((prev && prev->va + prev->size > va) || (next && va + size > next->va)) {
+        return;     /* Already free */
+    }
+    heap->in_use -= size;
+
+    /* Merge with the neighbours */
+    bool merge_prev = prev && prev->va + prev->size == va;
+    bool merge_next = next && va + size == next->va;
+    if (merge_prev && merge_next) {
+        prev->size += size + next->size;
+        remove_block(heap, i);
+        i--;
+    } else if (merge_prev) {
+        prev->size += size;
+        i--;
+    } else if (merge_next) {
+        next->va = va;
+        next->size += size;
+    } else {
+        if (heap->free_count == heap->free_capacity) {
+            uint32_t capacity = heap->free_capacity ? heap->free_capacity * 2 : 16;
+            loader_heap_block_t *grown = realloc(heap->free_blocks,
+                                                 capacity * sizeof(loader_heap_block_t));
+            if (!grown) {
+                return;     /* The block is lost, the heap stays consistent */
+            }
+            heap->free_blocks = grown;
+            heap->free_capacity = capacity;
+        }
+        memmove(&heap->free_blocks[i + 1], &heap->free_blocks[i],
+                (heap->free_count - i) * sizeof(loader_heap_block_t));
+        heap->free_blocks[i].va = va;
+        heap->free_blocks[i].size = size;
+        heap->free_count++;
+    }
+
+    /* A block reaching the top goes back to it */
+    loader_heap_block_t *block = &heap->free_blocks[i];
+    if (block->va + block->size == heap->base_va + heap->top) {
+        heap->top = block->va - heap->base_va;
+        remove_block(heap, i);
+    }
+}
+
+void loader_heap_destroy(loader_heap_t *heap)
+{
+    free(heap->free_blocks);
+    heap->free_blocks = NULL;
+    heap->free_count = 0;
+    heap->free_capacity = 0;
+}
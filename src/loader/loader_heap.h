@@ -0,0 +1,78 @@
+/*
+ * WBOX Loader Heap
+ * Guest memory allocator for LDR entries, module names and other loader
+ * structures
+ *
+ * The heap reserves a range of guest address space and commits it in
+ * steps as allocations need it. Freed blocks go on a host-side free list,
+ * sorted by address and coalesced with their neighbours; allocations
+ * reuse them best-fit before taking fresh space. A free block that ends
+ * at the top of the used space is handed back to it. Nothing about the
+ * heap lives in guest memory, so the guest cannot corrupt it.
+ */
+#ifndef WBOX_LOADER_HEAP_H
+#define WBOX_LOADER_HEAP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Allocation granularity */
+#define LOADER_HEAP_ALIGN       4
+
+/* Commit at least this much at a time */
+#define LOADER_HEAP_COMMIT_STEP (64 * 1024)
+
+/*
+ * Back [va, va + size) with zeroed, mapped guest memory
+ * Returns 0 on success, -1 on failure
+ */
+typedef int (*loader_heap_commit_fn)(void *ctx, uint32_t va, uint32_t size);
+
+/* Zero [va, va + size) of committed guest memory */
+typedef void (*loader_heap_clear_fn)(void *ctx, uint32_t va, uint32_t size);
+
+/* A free range */
+typedef struct loader_heap_block {
+    uint32_t va;
+    uint32_t size;
+} loader_heap_block_t;
+
+typedef struct loader_heap {
+    uint32_t                base_va;        /* Start of the reserved range */
+    uint32_t                reserve;        /* Bytes reserved */
+    uint32_t                committed;      /* Bytes backed by guest memory */
+    uint32_t                top;            /* Bytes handed out from base_va up */
+    uint32_t                high_water;     /* Highest top; above it memory is still zero */
+
+    loader_heap_block_t     *free_blocks;   /* Sorted by va, never adjacent */
+    uint32_t                free_count;
+    uint32_t                free_capacity;
+
+    uint32_t                in_use;         /* Bytes allocated and not freed */
+    uint32_t                reused;         /* Allocations served from free blocks */
+
+    loader_heap_commit_fn   commit;
+    loader_heap_clear_fn    clear;
+    void                    *ctx;
+} loader_heap_t;
+
+/*
+ * Reserve [base_va, base_va + reserve) and commit its first initial bytes
+ * Returns 0 on success, -1 if the initial commit fails
+ */
+int loader_heap_init(loader_heap_t *heap, uint32_t base_va, uint32_t reserve, uint32_t initial,
+                     loader_heap_commit_fn commit, loader_heap_clear_fn clear, void *ctx);
+
+/*
+ * Allocate size bytes of zeroed guest memory
+ * Returns the guest VA, or 0 if the reservation is used up
+ */
+uint32_t loader_heap_alloc(loader_heap_t *heap, uint32_t size);
+
+/* Return a block; size must be what it was allocated with */
+void loader_heap_free(loader_heap_t *heap, uint32_t va, uint32_t size);
+
+/* Free the host-side free list (guest memory stays mapped) */
+void loader_heap_destroy(loader_heap_t *heap);
+
+#endif /* WBOX_LOADER_HEAP_H */
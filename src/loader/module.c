@@ -3,6 +3,8 @@
  * Manages loaded PE modules and LDR data structures
  */
 #include "module.h"
+#include "image_cache.h"
+#include "exports.h"
 #include "../vm/vm.h"
 #include "../vm/paging.h"
 #include "../cpu/mem.h"
@@ -12,6 +14,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <ctype.h>
 #include <libgen.h>
 
 /* Helper: Write 32-bit value to virtual address */
@@ -41,38 +44,55 @@ static void write_virt_b(vm_context_t *vm, uint32_t virt, uint8_t val)
     }
 }
 
-int module_manager_init(module_manager_t *mgr, vm_context_t *vm)
+/* Zero committed loader heap memory, a page-contiguous run at a time */
+static void heap_clear(void *ctx, uint32_t va, uint32_t size)
 {
-    memset(mgr, 0, sizeof(*mgr));
-
-    /* Allocate loader heap in guest */
-    mgr->loader_heap_va = LOADER_HEAP_VA;
-    mgr->loader_heap_size = LOADER_HEAP_SIZE;
-    mgr->loader_heap_ptr = 0;
+    vm_context_t *vm = ctx;
+    while (size > 0) {
+        uint32_t chunk = PAGE_SIZE - (va & (PAGE_SIZE - 1));
+        if (chunk > size) {
+            chunk = size;
+        }
+        uint32_t phys = paging_get_phys(&vm->paging, va);
+        uint8_t *host = phys ? mem_phys_ptr(phys, chunk) : NULL;
+        if (host) {
+            memset(host, 0, chunk);
+        }
+        va += chunk;
+        size -= chunk;
+    }
+}
 
-    /* Allocate physical memory for loader heap */
-    mgr->loader_heap_phys = paging_alloc_phys(&vm->paging, LOADER_HEAP_SIZE);
-    if (mgr->loader_heap_phys == 0) {
-        fprintf(stderr, "module_manager_init: Failed to allocate loader heap\n");
+/* Back a new stretch of the loader heap (paging_alloc_phys hands out zeroed pages) */
+static int heap_commit(void *ctx, uint32_t va, uint32_t size)
+{
+    vm_context_t *vm = ctx;
+    uint32_t phys = paging_alloc_phys(&vm->paging, size);
+    if (phys == 0) {
+        fprintf(stderr, "module_manager: Failed to allocate loader heap\n");
         return -1;
     }
-
-    /* Map loader heap into guest address space */
-    uint32_t num_pages = (LOADER_HEAP_SIZE + PAGE_SIZE - 1) / PAGE_SIZE;
-    for (uint32_t i = 0; i < num_pages; i++) {
-        paging_map_page(&vm->paging,
-                        mgr->loader_heap_va + i * PAGE_SIZE,
-                        mgr->loader_heap_phys + i * PAGE_SIZE,
-                        PTE_PRESENT | PTE_WRITABLE | PTE_USER);
+    if (paging_map_range(&vm->paging, va, phys, size,
+                         PTE_PRESENT | PTE_WRITABLE | PTE_USER) != 0) {
+        fprintf(stderr, "module_manager: Failed to map loader heap\n");
+        return -1;
     }
+    return 0;
+}
+
+int module_manager_init(module_manager_t *mgr, vm_context_t *vm)
+{
+    memset(mgr, 0, sizeof(*mgr));
 
-    /* Clear the heap */
-    for (uint32_t i = 0; i < LOADER_HEAP_SIZE; i++) {
-        mem_writeb_phys(mgr->loader_heap_phys + i, 0);
+    /* Reserve the loader heap in guest; more is committed as it fills up */
+    if (loader_heap_init(&mgr->heap, LOADER_HEAP_VA, LOADER_HEAP_RESERVE, LOADER_HEAP_SIZE,
+                         heap_commit, heap_clear, vm) < 0) {
+        fprintf(stderr, "module_manager_init: Failed to allocate loader heap\n");
+        return -1;
     }
 
-    printf("Module manager: loader heap at VA 0x%08X (phys 0x%08X)\n",
-           mgr->loader_heap_va, mgr->loader_heap_phys);
+    printf("Module manager: loader heap at VA 0x%08X (%u KB committed, %u KB reserved)\n",
+           mgr->heap.base_va, mgr->heap.committed / 1024, mgr->heap.reserve / 1024);
 
     return 0;
 }
@@ -84,20 +104,18 @@ void module_manager_set_ntdll_path(module_manager_t *mgr, const char *path)
 
 uint32_t module_heap_alloc(module_manager_t *mgr, uint32_t size)
 {
-    /* Align to 4 bytes */
-    size = (size + 3) & ~3;
-
-    if (mgr->loader_heap_ptr + size > mgr->loader_heap_size) {
+    uint32_t va = loader_heap_alloc(&mgr->heap, size);
+    if (va == 0) {
         fprintf(stderr, "module_heap_alloc: Out of loader heap space\n");
-        return 0;
     }
-
-    uint32_t va = mgr->loader_heap_va + mgr->loader_heap_ptr;
-    mgr->loader_heap_ptr += size;
-
     return va;
 }
 
+void module_heap_free(module_manager_t *mgr, uint32_t va, uint32_t size)
+{
+    loader_heap_free(&mgr->heap, va, size);
+}
+
 uint32_t write_wide_string(vm_context_t *vm, uint32_t va, const char *str)
 {
     size_t len = strlen(str);
@@ -141,6 +159,26 @@ void list_insert_tail(vm_context_t *vm, uint32_t list_head_va, uint32_t entry_va
     }
 }
 
+void list_remove_entry(vm_context_t *vm, uint32_t entry_va)
+{
+    uint32_t entry_phys = paging_get_phys(&vm->paging, entry_va);
+    if (entry_phys == 0) {
+        return;
+    }
+    uint32_t flink = mem_readl_phys(entry_phys + 0);
+    uint32_t blink = mem_readl_phys(entry_phys + 4);
+
+    /* Never linked, or already removed */
+    if (flink == 0 || flink == entry_va) {
+        return;
+    }
+
+    write_virt_l(vm, blink + 0, flink);     /* Blink->Flink = Flink */
+    write_virt_l(vm, flink + 4, blink);     /* Flink->Blink = Blink */
+    mem_writel_phys(entry_phys + 0, entry_va);
+    mem_writel_phys(entry_phys + 4, entry_va);
+}
+
 int module_init_peb_ldr(module_manager_t *mgr, vm_context_t *vm)
 {
     /* Allocate PEB_LDR_DATA in loader heap */
@@ -198,6 +236,7 @@ int module_create_ldr_entry(module_manager_t *mgr, vm_context_t *vm,
     size_t name_len = strlen(mod->name);
     uint32_t name_va = module_heap_alloc(mgr, (name_len + 1) * 2);
     if (name_va == 0) {
+        module_heap_free(mgr, entry_va, sizeof(LDR_DATA_TABLE_ENTRY32));
         return -1;
     }
 
@@ -256,6 +295,7 @@ int module_create_ldr_entry(module_manager_t *mgr, vm_context_t *vm,
     write_virt_l(vm, entry_va + 0x14, entry_va + 0x10);  /* Blink -> self */
 
     mod->ldr_entry_va = entry_va;
+    mod->ldr_name_va = name_va;
 
     printf("  DllBase=0x%08X Size=0x%X EntryPoint=0x%08X\n",
            mod->base_va, mod->size, mod->entry_point);
@@ -327,68 +367,175 @@ int module_link_to_hash_table(module_manager_t *mgr, vm_context_t *vm,
     return 0;
 }
 
-loaded_module_t *module_find_by_name(module_manager_t *mgr, const char *name)
+/* File name part of a path */
+static const char *path_base_name(const char *path)
 {
-    /* Extract base name if path is given */
-    const char *base_name = strrchr(name, '/');
-    if (base_name) {
-        base_name++;
-    } else {
-        base_name = strrchr(name, '\\');
-        if (base_name) {
-            base_name++;
-        } else {
-            base_name = name;
+    const char *base = strrchr(path, '/');
+    if (base) {
+        return base + 1;
+    }
+    base = strrchr(path, '\\');
+    return base ? base + 1 : path;
+}
+
+/* FNV-1a over the ASCII-lowercased name */
+static uint32_t name_hash(const char *name)
+{
+    uint32_t hash = 2166136261u;
+    for (; *name; name++) {
+        hash ^= (uint8_t)tolower((unsigned char)*name);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/* Slot holding name, or the empty slot where it would go */
+static uint32_t name_index_slot(loaded_module_t **index, uint32_t mask, const char *name)
+{
+    uint32_t slot = name_hash(name) & mask;
+    while (index[slot] && strcasecmp(path_base_name(index[slot]->name), name) != 0) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/* Rebuild the name index for module_count + 1 modules at half load */
+static int name_index_grow(module_manager_t *mgr)
+{
+    uint32_t size = 64;
+    while (size < (mgr->module_count + 1) * 2) {
+        size *= 2;
+    }
+
+    loaded_module_t **index = calloc(size, sizeof(*index));
+    if (!index) {
+        return -1;
+    }
+
+    /* The list is newest first; keep the newest module of a name */
+    for (loaded_module_t *mod = mgr->modules; mod; mod = mod->next) {
+        uint32_t slot = name_index_slot(index, size - 1, path_base_name(mod->name));
+        if (index[slot] == NULL) {
+            index[slot] = mod;
         }
     }
 
-    loaded_module_t *mod = mgr->modules;
-    while (mod) {
-        /* Extract base name from module */
-        const char *mod_base = strrchr(mod->name, '/');
-        if (mod_base) {
-            mod_base++;
+    free(mgr->name_index);
+    mgr->name_index = index;
+    mgr->name_index_mask = size - 1;
+    return 0;
+}
+
+/* First position in the base index whose module starts at or after va */
+static uint32_t base_index_lower_bound(const module_manager_t *mgr, uint32_t va)
+{
+    uint32_t lo = 0, hi = mgr->module_count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (mgr->base_index[mid]->base_va < va) {
+            lo = mid + 1;
         } else {
-            mod_base = strrchr(mod->name, '\\');
-            if (mod_base) {
-                mod_base++;
-            } else {
-                mod_base = mod->name;
-            }
+            hi = mid;
         }
+    }
+    return lo;
+}
 
-        if (strcasecmp(base_name, mod_base) == 0) {
-            return mod;
+int module_manager_add(module_manager_t *mgr, loaded_module_t *mod)
+{
+    /* Make room in both indexes first so failure leaves nothing half-added */
+    if (mgr->module_count + 1 > mgr->base_index_capacity) {
+        uint32_t capacity = mgr->base_index_capacity ? mgr->base_index_capacity * 2 : 32;
+        loaded_module_t **index = realloc(mgr->base_index, capacity * sizeof(*index));
+        if (!index) {
+            return -1;
         }
-        mod = mod->next;
+        mgr->base_index = index;
+        mgr->base_index_capacity = capacity;
     }
-    return NULL;
+    if (!mgr->name_index || (mgr->module_count + 1) * 2 > mgr->name_index_mask + 1) {
+        if (name_index_grow(mgr) < 0) {
+            return -1;
+        }
+    }
+
+    uint32_t pos = base_index_lower_bound(mgr, mod->base_va);
+    memmove(&mgr->base_index[pos + 1], &mgr->base_index[pos],
+            (mgr->module_count - pos) * sizeof(*mgr->base_index));
+    mgr->base_index[pos] = mod;
+
+    mgr->name_index[name_index_slot(mgr->name_index, mgr->name_index_mask,
+                                    path_base_name(mod->name))] = mod;
+
+    mod->next = mgr->modules;
+    mgr->modules = mod;
+    mgr->module_count++;
+    return 0;
+}
+
+loaded_module_t *module_find_by_name(module_manager_t *mgr, const char *name)
+{
+    if (!mgr->name_index) {
+        return NULL;
+    }
+    return mgr->name_index[name_index_slot(mgr->name_index, mgr->name_index_mask,
+                                           path_base_name(name))];
 }
 
 loaded_module_t *module_find_by_base(module_manager_t *mgr, uint32_t base)
 {
-    loaded_module_t *mod = mgr->modules;
-    while (mod) {
-        if (mod->base_va == base) {
-            return mod;
-        }
-        mod = mod->next;
+    uint32_t pos = base_index_lower_bound(mgr, base);
+    if (pos < mgr->module_count && mgr->base_index[pos]->base_va == base) {
+        return mgr->base_index[pos];
     }
     return NULL;
 }
 
+loaded_module_t *module_find_by_address(module_manager_t *mgr, uint32_t va)
+{
+    /* Images do not overlap: only the last module starting at or below va
+     * can contain it */
+    uint32_t pos = base_index_lower_bound(mgr, va);
+    if (pos < mgr->module_count && mgr->base_index[pos]->base_va == va) {
+        return mgr->base_index[pos];
+    }
+    if (pos == 0) {
+        return NULL;
+    }
+
+    loaded_module_t *mod = mgr->base_index[pos - 1];
+    return (va - mod->base_va < mod->size) ? mod : NULL;
+}
+
+void module_free_ldr_entry(module_manager_t *mgr, vm_context_t *vm, loaded_module_t *mod)
+{
+    uint32_t entry_va = mod->ldr_entry_va;
+    if (entry_va == 0) {
+        return;
+    }
+
+    list_remove_entry(vm, entry_va + 0x00);     /* InLoadOrderLinks */
+    list_remove_entry(vm, entry_va + 0x08);     /* InMemoryOrderLinks */
+    list_remove_entry(vm, entry_va + 0x10);     /* InInitializationOrderLinks */
+    list_remove_entry(vm, entry_va + 0x3C);     /* HashLinks */
+
+    /* The name buffer as allocated, whatever the guest pointed the
+     * UNICODE_STRINGs at since */
+    module_heap_free(mgr, mod->ldr_name_va, (uint32_t)(strlen(mod->name) + 1) * 2);
+    module_heap_free(mgr, entry_va, sizeof(LDR_DATA_TABLE_ENTRY32));
+    mod->ldr_entry_va = 0;
+    mod->ldr_name_va = 0;
+}
+
 void module_free(loaded_module_t *mod)
 {
     if (!mod) return;
 
+    /* Drop an unfinished cache entry */
+    image_cache_entry_free(mod->cache_entry);
+
     /* Free export cache */
-    if (mod->exports) {
-        for (uint32_t i = 0; i < mod->num_exports; i++) {
-            free(mod->exports[i].name);
-            free(mod->exports[i].forwarder_name);
-        }
-        free(mod->exports);
-    }
+    exports_free(mod);
 
     /* Free PE image */
     pe_free(&mod->pe);
@@ -406,4 +553,18 @@ void module_manager_free(module_manager_t *mgr)
     }
     mgr->modules = NULL;
     mgr->module_count = 0;
+
+    free(mgr->name_index);
+    free(mgr->base_index);
+    mgr->name_index = NULL;
+    mgr->name_index_mask = 0;
+    mgr->base_index = NULL;
+    mgr->base_index_capacity = 0;
+
+    free(mgr->lazy_imports);
+    mgr->lazy_imports = NULL;
+    mgr->lazy_import_count = 0;
+    mgr->lazy_import_capacity = 0;
+
+    loader_heap_destroy(&mgr->heap);
 }
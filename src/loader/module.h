@@ -10,6 +10,7 @@
 #include <stddef.h>
 #include "../pe/pe_loader.h"
 #include "../vm/vm.h"
+#include "loader_heap.h"
 
 /* Maximum DLL name length */
 #define MAX_DLL_NAME 260
@@ -17,11 +18,15 @@
 /* Memory layout for loader structures */
 #define LOADER_STUB_REGION_VA    0x7F000000
 #define LOADER_STUB_REGION_SIZE  (64 * 1024)
-#define LOADER_HEAP_VA           0x7F010000
-#define LOADER_HEAP_SIZE         (64 * 1024)
+#define LOADER_HEAP_VA           0x7F100000
+#define LOADER_HEAP_RESERVE      (8 * 1024 * 1024)   /* Grows up to this */
+#define LOADER_HEAP_SIZE         (64 * 1024)         /* Committed at start */
 
 /* Forward declarations */
 struct stub_manager;
+struct image_cache;
+struct image_cache_entry;
+struct lazy_import;
 
 /*
  * Guest-side structures (must match Windows XP layout exactly)
@@ -80,13 +85,19 @@ typedef struct {
 
 /* Export entry (cached on host) */
 typedef struct {
-    char        *name;              /* Export name (NULL for ordinal-only) */
+    const char  *name;              /* First export name (NULL for ordinal-only) */
     uint16_t    ordinal;            /* Ordinal value */
     uint32_t    rva;                /* RVA of function */
     bool        is_forwarder;       /* Is this a forwarder? */
     char        *forwarder_name;    /* Forwarder string if applicable */
 } export_entry_t;
 
+/* Export name index entry, one per name in the PE name pointer table */
+typedef struct {
+    char        *name;              /* Export name (owned) */
+    uint32_t    index;              /* Index into exports */
+} export_name_t;
+
 /* Loaded module (host-side tracking) */
 typedef struct loaded_module {
     struct loaded_module *next;
@@ -100,15 +111,27 @@ typedef struct loaded_module {
 
     /* Guest structure address */
     uint32_t        ldr_entry_va;           /* LDR_DATA_TABLE_ENTRY guest VA */
+    uint32_t        ldr_name_va;            /* Its name buffer in the loader heap */
 
     /* Export table cache */
     uint32_t        num_exports;
     uint32_t        ordinal_base;           /* Base ordinal number */
     export_entry_t  *exports;
 
+    /* Named exports sorted by name; the same order as the PE name pointer
+     * table, so an import's hint is an index into it */
+    uint32_t        num_export_names;
+    export_name_t   *export_names;
+
+    bool            exports_data;           /* Some export is outside code sections */
+    bool            exports_forwarded;      /* Some export is a forwarder */
+
     bool            is_main_exe;            /* Is this the main executable? */
     bool            dll_main_called;        /* Has DllMain been called? */
     bool            imports_resolved;       /* Have imports been resolved? */
+
+    /* Image cache entry read or being written while the executable loads */
+    struct image_cache_entry *cache_entry;
 } loaded_module_t;
 
 /* Module manager state */
@@ -117,10 +140,7 @@ typedef struct module_manager {
     uint32_t        module_count;
 
     /* Guest memory allocator for loader structures */
-    uint32_t        loader_heap_va;         /* Base of loader heap in guest */
-    uint32_t        loader_heap_phys;       /* Physical address of heap */
-    uint32_t        loader_heap_ptr;        /* Current allocation offset */
-    uint32_t        loader_heap_size;       /* Total heap size */
+    loader_heap_t   heap;
 
     /* PEB_LDR_DATA address */
     uint32_t        ldr_data_va;
@@ -128,8 +148,23 @@ typedef struct module_manager {
     /* Stub manager (forward declared) */
     struct stub_manager *stubs;
 
+    /* Relocated image cache (forward declared) */
+    struct image_cache *image_cache;
+
     /* Path to ntdll.dll */
     const char      *ntdll_path;
+
+    /* Lookup indexes, maintained by module_manager_add */
+    loaded_module_t **name_index;           /* Open-addressed by case-folded base name */
+    uint32_t        name_index_mask;
+    loaded_module_t **base_index;           /* Sorted by base_va */
+    uint32_t        base_index_capacity;
+
+    /* Imports bound on first call, indexed by their thunk's import number */
+    bool            lazy_binding;
+    struct lazy_import *lazy_imports;
+    uint32_t        lazy_import_count;
+    uint32_t        lazy_import_capacity;
 } module_manager_t;
 
 /*
@@ -142,9 +177,13 @@ int module_manager_init(module_manager_t *mgr, vm_context_t *vm);
 /* Set ntdll.dll path */
 void module_manager_set_ntdll_path(module_manager_t *mgr, const char *path);
 
-/* Allocate from loader heap */
+/* Allocate zeroed memory from the loader heap, growing it if needed
+ * Returns the guest VA, or 0 when the heap's reservation is used up */
 uint32_t module_heap_alloc(module_manager_t *mgr, uint32_t size);
 
+/* Return a block to the loader heap; size as passed to module_heap_alloc */
+void module_heap_free(module_manager_t *mgr, uint32_t va, uint32_t size);
+
 /* Load a module (PE file) */
 loaded_module_t *module_load(module_manager_t *mgr, vm_context_t *vm,
                              const char *path, uint32_t preferred_base);
@@ -153,12 +192,20 @@ loaded_module_t *module_load(module_manager_t *mgr, vm_context_t *vm,
 loaded_module_t *module_load_by_name(module_manager_t *mgr, vm_context_t *vm,
                                      const char *dll_name);
 
-/* Find module by name */
+/* Add a loaded module to the module list and lookup indexes
+ * Returns 0 on success, -1 if out of memory */
+int module_manager_add(module_manager_t *mgr, loaded_module_t *mod);
+
+/* Find module by name (case-insensitive, directories ignored)
+ * If a name is loaded twice, the latest module is found. */
 loaded_module_t *module_find_by_name(module_manager_t *mgr, const char *name);
 
 /* Find module by base address */
 loaded_module_t *module_find_by_base(module_manager_t *mgr, uint32_t base);
 
+/* Find the module whose image contains a VA (e.g. a guest PC) */
+loaded_module_t *module_find_by_address(module_manager_t *mgr, uint32_t va);
+
 /* Initialize PEB_LDR_DATA structure */
 int module_init_peb_ldr(module_manager_t *mgr, vm_context_t *vm);
 
@@ -173,6 +220,10 @@ int module_init_ldrp_hash_table(module_manager_t *mgr, vm_context_t *vm, loaded_
 int module_link_to_hash_table(module_manager_t *mgr, vm_context_t *vm,
                               loaded_module_t *ntdll, loaded_module_t *mod);
 
+/* Unlink a module's LDR entry from the PEB lists and LdrpHashTable and
+ * return it and its name to the loader heap (for modules being unloaded) */
+void module_free_ldr_entry(module_manager_t *mgr, vm_context_t *vm, loaded_module_t *mod);
+
 /* Free a single module */
 void module_free(loaded_module_t *mod);
 
@@ -186,6 +237,9 @@ void module_manager_free(module_manager_t *mgr);
 /* Insert entry at tail of doubly-linked list */
 void list_insert_tail(vm_context_t *vm, uint32_t list_head_va, uint32_t entry_va);
 
+/* Unlink entry from its list and point it at itself */
+void list_remove_entry(vm_context_t *vm, uint32_t entry_va);
+
 /* Write wide string to guest memory, return length in bytes */
 uint32_t write_wide_string(vm_context_t *vm, uint32_t va, const char *str);
 
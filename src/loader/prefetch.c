@@ -0,0 +1,357 @@
+/*
+ * WBOX DLL Prefetcher
+ * Reads, parses and lays out dependency DLLs on a pool of worker threads
+ */
+#include "prefetch.h"
+#include "exports.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#ifndef _WIN32
+
+struct prefetch {
+    pthread_t       threads[PREFETCH_MAX_WORKERS];
+    uint32_t        num_threads;
+
+    prefetch_parsed_fn parsed;              /* Loader callback and its context */
+    void            *ctx;
+
+    pthread_mutex_t lock;
+    pthread_cond_t  work_ready;             /* A job was queued or stop set */
+    pthread_cond_t  job_done;               /* A job was parsed or finished */
+
+    prefetch_job_t  **jobs;                 /* In submission order */
+    uint32_t        job_count;
+    uint32_t        job_capacity;
+    uint32_t        next_job;               /* First job no worker has claimed */
+    uint32_t        next_report;            /* First job not yet passed to the callback */
+    bool            stop;
+};
+
+/* Read and parse one DLL; touches nothing but the job */
+static void parse_dll(prefetch_job_t *job)
+{
+    loaded_module_t *mod = calloc(1, sizeof(*mod));
+    if (!mod) {
+        return;
+    }
+    if (pe_load(job->path, &mod->pe) != 0) {
+        free(mod);
+        return;
+    }
+    job->mod = mod;
+
+    if (exports_parse(&mod->pe, mod) < 0) {
+        return;
+    }
+
+    const pe_image_t *pe = &mod->pe;
+    if (job->base_va == 0) {
+        job->base_va = pe->image_base ? pe->image_base : VM_DEFAULT_IMAGE_BASE;
+    }
+    job->status = 0;
+}
+
+/* Lay a parsed DLL out in a buffer of its own; left NULL if that fails */
+static void layout_dll(prefetch_job_t *job)
+{
+    const pe_image_t *pe = &job->mod->pe;
+    uint8_t *image = calloc(1, pe->size_of_image);
+    if (!image) {
+        return;
+    }
+    if (pe_map_image(pe, image) != 0) {
+        free(image);
+        job->status = -1;
+        return;
+    }
+    job->fixups = 0;
+    if (job->base_va != pe->image_base) {
+        job->fixups = pe_relocate_image(pe, image, job->base_va);
+    }
+    job->image = image;
+}
+
+static void *worker_main(void *arg)
+{
+    prefetch_t *pf = arg;
+
+    pthread_mutex_lock(&pf->lock);
+    for (;;) {
+        while (!pf->stop && pf->next_job == pf->job_count) {
+            pthread_cond_wait(&pf->work_ready, &pf->lock);
+        }
+        if (pf->stop) {
+            break;
+        }
+
+        prefetch_job_t *job = pf->jobs[pf->next_job++];
+        pthread_mutex_unlock(&pf->lock);
+
+        parse_dll(job);
+
+        /* Report the parse first: its imports are more work for the pool */
+        pthread_mutex_lock(&pf->lock);
+        job->parsed = true;
+        pthread_cond_broadcast(&pf->job_done);
+        if (job->status == 0 && !pf->stop) {
+            pthread_mutex_unlock(&pf->lock);
+
+            layout_dll(job);
+
+            pthread_mutex_lock(&pf->lock);
+        }
+        job->done = true;
+        pthread_cond_broadcast(&pf->job_done);
+    }
+    pthread_mutex_unlock(&pf->lock);
+    return NULL;
+}
+
+/*
+ * Hand parsed jobs to the callback in submission order, stopping at the
+ * first one still being parsed. Called with the lock held, on the
+ * loader's thread; the callback runs unlocked so it can submit more.
+ */
+static void report_parsed(prefetch_t *pf)
+{
+    while (pf->next_report < pf->job_count && pf->jobs[pf->next_report]->parsed) {
+        prefetch_job_t *job = pf->jobs[pf->next_report++];
+        if (job->status == 0 && pf->parsed) {
+            pthread_mutex_unlock(&pf->lock);
+            pf->parsed(pf->ctx, job);
+            pthread_mutex_lock(&pf->lock);
+        }
+    }
+}
+
+/* Wait for a job to finish, feeding the callback meanwhile; lock held */
+static void wait_done(prefetch_t *pf, prefetch_job_t *job)
+{
+    for (;;) {
+        report_parsed(pf);
+        if (job->done) {
+            return;
+        }
+        pthread_cond_wait(&pf->job_done, &pf->lock);
+    }
+}
+
+uint32_t prefetch_default_workers(void)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) {
+        return 1;
+    }
+    return cpus > PREFETCH_MAX_WORKERS ? PREFETCH_MAX_WORKERS : (uint32_t)cpus;
+}
+
+prefetch_t *prefetch_create(uint32_t num_workers, prefetch_parsed_fn parsed, void *ctx)
+{
+    if (num_workers > PREFETCH_MAX_WORKERS) {
+        num_workers = PREFETCH_MAX_WORKERS;
+    }
+    if (num_workers < 2) {
+        return NULL;
+    }
+
+    prefetch_t *pf = calloc(1, sizeof(*pf));
+    if (!pf) {
+        return NULL;
+    }
+    pf->parsed = parsed;
+    pf->ctx = ctx;
+    pthread_mutex_init(&pf->lock, NULL);
+    pthread_cond_init(&pf->work_ready, NULL);
+    pthread_cond_init(&pf->job_done, NULL);
+
+    for (uint32_t i = 0; i < num_workers; i++) {
+        if (pthread_create(&pf->threads[i], NULL, worker_main, pf) != 0) {
+            break;
+        }
+        pf->num_threads++;
+    }
+    if (pf->num_threads == 0) {
+        prefetch_destroy(pf);
+        return NULL;
+    }
+    return pf;
+}
+
+static prefetch_job_t *find_by_name(prefetch_t *pf, const char *name)
+{
+    for (uint32_t i = 0; i < pf->job_count; i++) {
+        if (strcasecmp(pf->jobs[i]->name, name) == 0) {
+            return pf->jobs[i];
+        }
+    }
+    return NULL;
+}
+
+int prefetch_submit(prefetch_t *pf, const char *name, const char *path, uint32_t base_va)
+{
+    if (strlen(name) >= MAX_DLL_NAME || strlen(path) >= VFS_MAX_PATH) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&pf->lock);
+    if (find_by_name(pf, name)) {
+        pthread_mutex_unlock(&pf->lock);
+        return 0;
+    }
+
+    if (pf->job_count == pf->job_capacity) {
+        uint32_t capacity = pf->job_capacity ? pf->job_capacity * 2 : 32;
+        prefetch_job_t **grown = realloc(pf->jobs, capacity * sizeof(prefetch_job_t *));
+        if (!grown) {
+            pthread_mutex_unlock(&pf->lock);
+            return -1;
+        }
+        pf->jobs = grown;
+        pf->job_capacity = capacity;
+    }
+
+    prefetch_job_t *job = calloc(1, sizeof(*job));
+    if (!job) {
+        pthread_mutex_unlock(&pf->lock);
+        return -1;
+    }
+    strcpy(job->name, name);
+    strcpy(job->path, path);
+    job->base_va = base_va;
+    job->status = -1;
+    pf->jobs[pf->job_count++] = job;
+
+    pthread_cond_signal(&pf->work_ready);
+    pthread_mutex_unlock(&pf->lock);
+    return 0;
+}
+
+bool prefetch_has(prefetch_t *pf, const char *name)
+{
+    pthread_mutex_lock(&pf->lock);
+    bool found = find_by_name(pf, name) != NULL;
+    pthread_mutex_unlock(&pf->lock);
+    return found;
+}
+
+uint32_t prefetch_count(prefetch_t *pf)
+{
+    pthread_mutex_lock(&pf->lock);
+    uint32_t count = pf->job_count;
+    pthread_mutex_unlock(&pf->lock);
+    return count;
+}
+
+void prefetch_poll(prefetch_t *pf)
+{
+    pthread_mutex_lock(&pf->lock);
+    report_parsed(pf);
+    pthread_mutex_unlock(&pf->lock);
+}
+
+const prefetch_job_t *prefetch_wait(prefetch_t *pf, uint32_t index)
+{
+    pthread_mutex_lock(&pf->lock);
+    prefetch_job_t *job = index < pf->job_count ? pf->jobs[index] : NULL;
+    if (job) {
+        wait_done(pf, job);
+    }
+    pthread_mutex_unlock(&pf->lock);
+    return job;
+}
+
+prefetch_job_t *prefetch_take(prefetch_t *pf, const char *path)
+{
+    pthread_mutex_lock(&pf->lock);
+    prefetch_job_t *job = NULL;
+    for (uint32_t i = 0; i < pf->job_count; i++) {
+        if (!pf->jobs[i]->taken && strcmp(pf->jobs[i]->path, path) == 0) {
+            job = pf->jobs[i];
+            break;
+        }
+    }
+    if (job) {
+        wait_done(pf, job);
+        job->taken = true;
+    } else {
+        report_parsed(pf);
+    }
+    pthread_mutex_unlock(&pf->lock);
+    return job;
+}
+
+void prefetch_destroy(prefetch_t *pf)
+{
+    if (!pf) {
+        return;
+    }
+
+    pthread_mutex_lock(&pf->lock);
+    pf->stop = true;
+    pthread_cond_broadcast(&pf->work_ready);
+    pthread_mutex_unlock(&pf->lock);
+    for (uint32_t i = 0; i < pf->num_threads; i++) {
+        pthread_join(pf->threads[i], NULL);
+    }
+
+    for (uint32_t i = 0; i < pf->job_count; i++) {
+        prefetch_release(pf->jobs[i]);
+        free(pf->jobs[i]);
+    }
+    free(pf->jobs);
+    pthread_cond_destroy(&pf->job_done);
+    pthread_cond_destroy(&pf->work_ready);
+    pthread_mutex_destroy(&pf->lock);
+    free(pf);
+}
+
+#else /* _WIN32 */
+
+/* No worker threads: the loader prepares every DLL itself */
+uint32_t prefetch_default_workers(void) { return 1; }
+prefetch_t *prefetch_create(uint32_t num_workers, prefetch_parsed_fn parsed, void *ctx)
+{
+    (void)num_workers; (void)parsed; (void)ctx;
+    return NULL;
+}
+int prefetch_submit(prefetch_t *pf, const char *name, const char *path, uint32_t base_va)
+{
+    (void)pf; (void)name; (void)path; (void)base_va;
+    return -1;
+}
+bool prefetch_has(prefetch_t *pf, const char *name) { (void)pf; (void)name; return false; }
+uint32_t prefetch_count(prefetch_t *pf) { (void)pf; return 0; }
+void prefetch_poll(prefetch_t *pf) { (void)pf; }
+const prefetch_job_t *prefetch_wait(prefetch_t *pf, uint32_t index)
+{
+    (void)pf; (void)index;
+    return NULL;
+}
+prefetch_job_t *prefetch_take(prefetch_t *pf, const char *path) { (void)pf; (void)path; return NULL; }
+void prefetch_destroy(prefetch_t *pf) { (void)pf; }
+
+#endif /* _WIN32 */
+
+void prefetch_release(prefetch_job_t *job)
+{
+    if (!job) {
+        return;
+    }
+    if (job->mod) {
+        exports_free(job->mod);
+        pe_free(&job->mod->pe);
+        free(job->mod);
+        job->mod = NULL;
+    }
+    free(job->image);
+    job->image = NULL;
+}
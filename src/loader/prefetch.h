@@ -0,0 +1,102 @@
+/*
+ * WBOX DLL Prefetcher
+ * Reads, parses and lays out dependency DLLs on a pool of worker threads
+ *
+ * The loader submits the DLLs an executable will need as it discovers them.
+ * A worker maps each file, parses its headers and exports, and lays the
+ * image out in a host buffer, relocated for its load address. The loader
+ * is told about each parsed DLL on its own thread, in submission order,
+ * whenever it calls into the pool, and queues the DLL's imports. It takes
+ * the results in the same order it always loaded DLLs, allocating guest
+ * frames as it goes, so the physical layout does not depend on thread
+ * timing, and only has to copy the image in, map and link it. Workers
+ * touch no loader state and no guest memory.
+ */
+#ifndef WBOX_PREFETCH_H
+#define WBOX_PREFETCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "module.h"
+
+/* Upper bound on worker threads */
+#define PREFETCH_MAX_WORKERS    8
+
+/* One DLL prepared by a worker */
+typedef struct prefetch_job {
+    char            name[MAX_DLL_NAME];     /* Name it was imported by */
+    char            path[VFS_MAX_PATH];     /* Host path of the file */
+    uint32_t        base_va;                /* Load address, 0 = image base */
+
+    /* Results, valid once done */
+    int             status;                 /* 0 = ready, -1 = failed */
+    loaded_module_t *mod;                   /* PE and exports; owned until taken */
+    uint8_t         *image;                 /* size_of_image bytes laid out at base_va,
+                                               NULL if not laid out; the pool's */
+    int             fixups;                 /* Relocations applied, -1 if bad */
+
+    bool            parsed;
+    bool            done;
+    bool            taken;
+} prefetch_job_t;
+
+/*
+ * Called on the loader's thread for each parsed DLL, in submission order,
+ * so it can submit the DLL's imports; job->mod->pe may be read. A worker
+ * may still be laying the image out.
+ */
+typedef void (*prefetch_parsed_fn)(void *ctx, const prefetch_job_t *job);
+
+/* Worker pool and submitted jobs (opaque) */
+typedef struct prefetch prefetch_t;
+
+/*
+ * Start a pool of num_workers threads (capped at PREFETCH_MAX_WORKERS)
+ * With no parsed callback, only submitted DLLs are prepared.
+ * Returns NULL for fewer than 2 workers, without thread support or on
+ * failure; the loader then does all the work itself.
+ */
+prefetch_t *prefetch_create(uint32_t num_workers, prefetch_parsed_fn parsed, void *ctx);
+
+/* Number of worker threads worth starting on this host */
+uint32_t prefetch_default_workers(void);
+
+/*
+ * Queue a DLL for preparation at base_va (0 = its preferred base)
+ * A name already submitted is not queued again.
+ * Returns 0 if queued or already known, -1 on error
+ */
+int prefetch_submit(prefetch_t *pf, const char *name, const char *path, uint32_t base_va);
+
+/* Check if a DLL name (case-insensitive) has been submitted */
+bool prefetch_has(prefetch_t *pf, const char *name);
+
+/* Number of jobs submitted so far */
+uint32_t prefetch_count(prefetch_t *pf);
+
+/* Run the parsed callback for DLLs parsed since the last call, without waiting */
+void prefetch_poll(prefetch_t *pf);
+
+/*
+ * Wait for job index (in submission order) to finish
+ * The job stays owned by the pool; its mod->pe may be read.
+ */
+const prefetch_job_t *prefetch_wait(prefetch_t *pf, uint32_t index);
+
+/*
+ * Take the prepared DLL at path, waiting for it if still in progress
+ * Returns NULL if the path was not submitted or was already taken. The
+ * caller owns the job's mod if it keeps it (set job->mod to NULL), copies
+ * the image into frames of its own and must hand the job back with
+ * prefetch_release.
+ */
+prefetch_job_t *prefetch_take(prefetch_t *pf, const char *path);
+
+/* Free a taken job's image buffer and its module, unless claimed
+ * The job itself stays with the pool until prefetch_destroy. */
+void prefetch_release(prefetch_job_t *job);
+
+/* Stop the workers and free every job, taken or not */
+void prefetch_destroy(prefetch_t *pf);
+
+#endif /* WBOX_PREFETCH_H */
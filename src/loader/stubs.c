@@ -7,6 +7,7 @@
 #include "../vm/vm.h"
 #include "../vm/paging.h"
 #include "../cpu/mem.h"
+#include "../nt/syscalls.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -58,6 +59,44 @@ int stubs_init(stub_manager_t *mgr, vm_context_t *vm)
     return 0;
 }
 
+/* FNV-1a over a function name */
+static uint32_t name_hash(const char *name)
+{
+    uint32_t hash = 2166136261u;
+    while (*name) {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/* Rebuild the registry hash with room for capacity entries at half load */
+static int registry_rehash(stub_manager_t *mgr, uint32_t capacity)
+{
+    uint32_t size = 16;
+    while (size < capacity * 2) {
+        size *= 2;
+    }
+
+    uint32_t *index = calloc(size, sizeof(uint32_t));
+    if (!index) {
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < mgr->registry_count; i++) {
+        uint32_t slot = name_hash(mgr->registry[i].name) & (size - 1);
+        while (index[slot] != 0) {
+            slot = (slot + 1) & (size - 1);
+        }
+        index[slot] = i + 1;
+    }
+
+    free(mgr->registry_index);
+    mgr->registry_index = index;
+    mgr->registry_index_mask = size - 1;
+    return 0;
+}
+
 static int registry_add(stub_manager_t *mgr, const char *name, uint32_t stub_va)
 {
     /* Grow registry if needed */
@@ -71,8 +110,24 @@ static int registry_add(stub_manager_t *mgr, const char *name, uint32_t stub_va)
         mgr->registry = new_registry;
         mgr->registry_capacity = new_capacity;
     }
+    if (!mgr->registry_index || (mgr->registry_count + 1) * 2 > mgr->registry_index_mask + 1) {
+        if (registry_rehash(mgr, mgr->registry_capacity) < 0) {
+            return -1;
+        }
+    }
 
-    mgr->registry[mgr->registry_count].name = strdup(name);
+    char *copy = strdup(name);
+    if (!copy) {
+        return -1;
+    }
+
+    uint32_t slot = name_hash(name) & mgr->registry_index_mask;
+    while (mgr->registry_index[slot] != 0) {
+        slot = (slot + 1) & mgr->registry_index_mask;
+    }
+    mgr->registry_index[slot] = mgr->registry_count + 1;
+
+    mgr->registry[mgr->registry_count].name = copy;
     mgr->registry[mgr->registry_count].stub_va = stub_va;
     mgr->registry_count++;
 
@@ -81,14 +136,77 @@ static int registry_add(stub_manager_t *mgr, const char *name, uint32_t stub_va)
 
 uint32_t stubs_lookup(stub_manager_t *mgr, const char *name)
 {
-    for (uint32_t i = 0; i < mgr->registry_count; i++) {
-        if (strcmp(mgr->registry[i].name, name) == 0) {
-            return mgr->registry[i].stub_va;
+    if (!mgr->registry_index) {
+        return 0;
+    }
+
+    uint32_t slot = name_hash(name) & mgr->registry_index_mask;
+    while (mgr->registry_index[slot] != 0) {
+        const stub_entry_t *entry = &mgr->registry[mgr->registry_index[slot] - 1];
+        if (strcmp(entry->name, name) == 0) {
+            return entry->stub_va;
         }
+        slot = (slot + 1) & mgr->registry_index_mask;
     }
     return 0;
 }
 
+/* Hash a definition table at half load; the first of duplicate names wins */
+static bool def_index_build(stub_def_index_t *index)
+{
+    uint32_t count = 0;
+    while (index->defs[count].name) {
+        count++;
+    }
+
+    uint32_t size = 16;
+    while (size < count * 2) {
+        size *= 2;
+    }
+
+    uint16_t *slots = calloc(size, sizeof(uint16_t));
+    if (!slots) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < count && i < UINT16_MAX; i++) {
+        uint32_t slot = name_hash(index->defs[i].name) & (size - 1);
+        while (slots[slot] != 0 && strcmp(index->defs[slots[slot] - 1].name, index->defs[i].name) != 0) {
+            slot = (slot + 1) & (size - 1);
+        }
+        if (slots[slot] == 0) {
+            slots[slot] = (uint16_t)(i + 1);
+        }
+    }
+
+    index->slots = slots;
+    index->mask = size - 1;
+    return true;
+}
+
+const stub_def_t *stub_def_index_lookup(stub_def_index_t *index, const char *name)
+{
+    if (!index->slots && !def_index_build(index)) {
+        /* Out of memory: fall back to a scan */
+        for (const stub_def_t *def = index->defs; def->name; def++) {
+            if (strcmp(def->name, name) == 0) {
+                return def;
+            }
+        }
+        return NULL;
+    }
+
+    uint32_t slot = name_hash(name) & index->mask;
+    while (index->slots[slot] != 0) {
+        const stub_def_t *def = &index->defs[index->slots[slot] - 1];
+        if (strcmp(def->name, name) == 0) {
+            return def;
+        }
+        slot = (slot + 1) & index->mask;
+    }
+    return NULL;
+}
+
 uint32_t stubs_generate(stub_manager_t *mgr, vm_context_t *vm,
                         const stub_def_t *def)
 {
@@ -164,6 +282,36 @@ uint32_t stubs_generate(stub_manager_t *mgr, vm_context_t *vm,
     return stub_va;
 }
 
+uint32_t stubs_generate_lazy_thunk(stub_manager_t *mgr, uint32_t index)
+{
+    if (mgr->stub_alloc_ptr + (STUB_LAZY_RESERVE + 1) * STUB_CODE_SIZE > mgr->stub_region_size) {
+        return 0;
+    }
+
+    uint32_t stub_va = mgr->stub_region_va + mgr->stub_alloc_ptr;
+    uint32_t stub_phys = mgr->stub_region_phys + mgr->stub_alloc_ptr;
+
+    /*
+     * Lazy binding thunk (13 bytes), entered with the caller's return
+     * address and arguments on the stack:
+     *   push eax                ; 50             (1 byte)
+     *   push index              ; 68 xx xx xx xx (5 bytes)
+     *   mov eax, LAZY_BIND      ; B8 xx xx xx xx (5 bytes)
+     *   sysenter                ; 0F 34          (2 bytes)
+     * The handler pops both, restores EAX and jumps to the bound target.
+     */
+    mem_writeb_phys(stub_phys + 0, 0x50);  /* PUSH EAX */
+    mem_writeb_phys(stub_phys + 1, 0x68);  /* PUSH imm32 */
+    mem_writel_phys(stub_phys + 2, index);
+    mem_writeb_phys(stub_phys + 6, 0xB8);  /* MOV EAX, imm32 */
+    mem_writel_phys(stub_phys + 7, WBOX_SYSCALL_LAZY_BIND);
+    mem_writeb_phys(stub_phys + 11, 0x0F); /* SYSENTER */
+    mem_writeb_phys(stub_phys + 12, 0x34);
+
+    mgr->stub_alloc_ptr += STUB_CODE_SIZE;
+    return stub_va;
+}
+
 uint32_t stubs_get_or_create(stub_manager_t *mgr, vm_context_t *vm,
                              const stub_def_t *def)
 {
@@ -185,5 +333,6 @@ void stubs_free(stub_manager_t *mgr)
         }
         free(mgr->registry);
     }
+    free(mgr->registry_index);
     memset(mgr, 0, sizeof(*mgr));
 }
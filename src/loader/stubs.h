@@ -42,11 +42,33 @@ typedef struct stub_manager {
     stub_entry_t *registry;
     uint32_t    registry_count;
     uint32_t    registry_capacity;
+
+    /* Open-addressed name hash over the registry: registry index + 1, 0 = empty */
+    uint32_t    *registry_index;
+    uint32_t    registry_index_mask;
 } stub_manager_t;
 
+/*
+ * Name index over a NULL-terminated table of stub definitions
+ * Declare one per table with only defs set; the hash is built on the
+ * first lookup.
+ */
+typedef struct {
+    const stub_def_t *defs;
+    uint16_t    *slots;             /* Table index + 1, 0 = empty */
+    uint32_t    mask;
+} stub_def_index_t;
+
 /* Size of each stub (padded to 16 bytes for alignment) */
 #define STUB_CODE_SIZE 16
 
+/*
+ * Stub slots lazy binding thunks leave free, so that stubs first needed
+ * when a lazy import binds still fit. Covers every entry of the ntdll and
+ * win32u stub tables.
+ */
+#define STUB_LAZY_RESERVE 1024
+
 /*
  * Initialize stub manager, allocate stub code region in guest
  * Returns 0 on success, -1 on error
@@ -60,6 +82,12 @@ int stubs_init(stub_manager_t *mgr, vm_context_t *vm);
 uint32_t stubs_generate(stub_manager_t *mgr, vm_context_t *vm,
                         const stub_def_t *def);
 
+/*
+ * Generate a lazy binding thunk for lazy import number index
+ * Returns VA of the thunk, or 0 if the stub region is down to its reserve
+ */
+uint32_t stubs_generate_lazy_thunk(stub_manager_t *mgr, uint32_t index);
+
 /*
  * Lookup existing stub by name
  * Returns VA of stub, or 0 if not found
@@ -73,6 +101,12 @@ uint32_t stubs_lookup(stub_manager_t *mgr, const char *name);
 uint32_t stubs_get_or_create(stub_manager_t *mgr, vm_context_t *vm,
                              const stub_def_t *def);
 
+/*
+ * Find a stub definition by name through its table's index
+ * Returns NULL if the name is not in the table
+ */
+const stub_def_t *stub_def_index_lookup(stub_def_index_t *index, const char *name);
+
 /*
  * Free stub manager resources
  */
@@ -760,16 +760,13 @@ static const stub_def_t win32k_known_stubs[] = {
 
 /*
  * Lookup a stub definition by function name
+ * Hashed; the index is built on the first call.
  * Returns pointer to stub_def_t if found, NULL otherwise
  */
 static inline const stub_def_t *win32k_lookup_stub(const char *name)
 {
-    for (const stub_def_t *def = win32k_known_stubs; def->name != NULL; def++) {
-        if (strcmp(def->name, name) == 0) {
-            return def;
-        }
-    }
-    return NULL;
+    static stub_def_index_t index = { .defs = win32k_known_stubs };
+    return stub_def_index_lookup(&index, name);
 }
 
 /*
@@ -16,6 +16,7 @@
 #include "cpu/codegen_public.h"
 #include "vm/vm.h"
 #include "vm/paging.h"
+#include "vm/startup_profile.h"
 #include "process/process.h"
 #include "nt/syscalls.h"
 #include "nt/heap.h"
@@ -34,6 +35,14 @@ static void print_usage(const char *progname)
     fprintf(stderr, "  -D: <path>    Map D: drive to host directory (etc. for A-Z)\n");
     fprintf(stderr, "  --jail <path> Legacy: Map C: drive to host directory\n");
     fprintf(stderr, "  --gui         Enable GUI mode (SDL3 window)\n");
+    fprintf(stderr, "  --image-cache <dir>\n");
+    fprintf(stderr, "                Cache relocated, import-bound DLL images in <dir>\n");
+    fprintf(stderr, "  --lazy-imports\n");
+    fprintf(stderr, "                Bind imported functions on their first call\n");
+    fprintf(stderr, "  --profile-startup\n");
+    fprintf(stderr, "                Time each startup phase per module and print a report\n");
+    fprintf(stderr, "  --profile-json <file>\n");
+    fprintf(stderr, "                Like --profile-startup, but write the report as JSON\n");
     fprintf(stderr, "\nExamples:\n");
     fprintf(stderr, "  %s -C: ~/winxp ./tests/pe/hello.exe\n", progname);
     fprintf(stderr, "  %s --gui -C: ~/winxp -D: ./tests/pe ./tests/pe/import_test.exe\n", progname);
@@ -65,6 +74,11 @@ int main(int argc, char *argv[])
     char drive_mappings[26][4096] = {{0}};  /* A-Z drive paths */
     int num_drives = 0;
     bool gui_mode = false;
+    const char *image_cache_dir = NULL;
+    bool lazy_imports = false;
+    bool profile_startup = false;
+    const char *profile_json = NULL;
+    startup_profile_t *profile = NULL;
 
     /* Parse command line options */
     for (int i = 1; i < argc; i++) {
@@ -88,6 +102,23 @@ int main(int argc, char *argv[])
             }
             strncpy(drive_mappings[2], argv[++i], sizeof(drive_mappings[2]) - 1);  /* C: = index 2 */
             num_drives++;
+        } else if (strcmp(argv[i], "--image-cache") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --image-cache requires a directory argument\n");
+                return 1;
+            }
+            image_cache_dir = argv[++i];
+        } else if (strcmp(argv[i], "--lazy-imports") == 0) {
+            lazy_imports = true;
+        } else if (strcmp(argv[i], "--profile-startup") == 0) {
+            profile_startup = true;
+        } else if (strcmp(argv[i], "--profile-json") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --profile-json requires a file argument\n");
+                return 1;
+            }
+            profile_json = argv[++i];
+            profile_startup = true;
         } else if (strcmp(argv[i], "--ntdll") == 0) {
             /* Legacy --ntdll option - now deprecated, ignore */
             fprintf(stderr, "Warning: --ntdll is deprecated, ntdll.dll is now loaded from VFS\n");
@@ -108,6 +139,14 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    /* Start the clock before anything else is set up */
+    if (profile_startup) {
+        profile = startup_profile_create(&cpu_instructions_executed, profile_json);
+        if (!profile) {
+            fprintf(stderr, "Warning: Startup profiling disabled\n");
+        }
+    }
+
     printf("=== WBOX - Windows Box ===\n");
     printf("Loading: %s\n\n", exe_path);
 
@@ -140,6 +179,9 @@ int main(int argc, char *argv[])
 
     /* Initialize GUI display if requested */
     vm.gui_mode = gui_mode;
+    vm.image_cache_dir = image_cache_dir;
+    vm.lazy_imports = lazy_imports;
+    vm.profile = profile;
     if (gui_mode) {
         printf("Initializing GUI display...\n");
         if (display_init(&vm.display, DISPLAY_DEFAULT_WIDTH, DISPLAY_DEFAULT_HEIGHT, "WBOX") != 0) {
@@ -285,8 +327,13 @@ int main(int argc, char *argv[])
 
     /* Start execution */
     printf("\nStarting execution at 0x%08X...\n", vm.entry_point);
+    const char *exe_name = strrchr(exe_path, '/');
+    startup_profile_enter_program(profile, exe_name ? exe_name + 1 : exe_path);
     vm_start(&vm);
 
+    /* No window: report at exit instead */
+    startup_profile_finish(profile);
+
     /* Print final state */
     printf("\nFinal CPU state:\n");
     printf("  EAX=%08X (return value / syscall result)\n", EAX);
@@ -298,6 +345,7 @@ cleanup:
         display_shutdown(&vm.display);
     }
     mem_close();
+    startup_profile_free(profile);
 
     return ret;
 }
@@ -0,0 +1,257 @@
+/*
+ * WBOX GDI Batching Implementation
+ */
+#include "gdi_batch.h"
+#include "../cpu/mem.h"
+#include "../vm/vm.h"
+#include "../vm/paging.h"
+#include "../gdi/gdi_dc.h"
+#include "../gdi/gdi_drawing.h"
+#include "../gdi/gdi_text.h"
+#include "../process/process.h"
+
+#include <stddef.h>
+#include <string.h>
+
+static void write_guest_dword(uint32_t guest_ptr, uint32_t value)
+{
+    vm_context_t *vm = vm_get_context();
+    if (!vm) return;
+
+    uint32_t phys = paging_get_phys(&vm->paging, guest_ptr);
+    if (phys) {
+        mem_writel_phys(phys, value);
+    }
+}
+
+static bool read_guest_dwords(uint32_t guest_ptr, uint32_t *out, uint32_t count)
+{
+    vm_context_t *vm = vm_get_context();
+    if (!vm) return false;
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t phys = paging_get_phys(&vm->paging, guest_ptr + i * 4);
+        if (!phys) return false;
+        out[i] = mem_readl_phys(phys);
+    }
+    return true;
+}
+
+/* Host copy of the queue, and scratch for realigning a record */
+static uint32_t g_batch_buffer[GDI_BATCH_BUFFER_DWORDS];
+static uint32_t g_batch_record[GDI_BATCH_BUFFER_DWORDS];
+
+/* PatBlt with an explicit brush (0 = the DC's brush) and pattern colors */
+static bool batch_pat_blt(gdi_handle_table_t *table, gdi_dc_t *dc, int x, int y, int width, int height, uint32_t rop,
+                          uint32_t hbrush, COLORREF fg_color, COLORREF bk_color)
+{
+    gdi_brush_t *saved_brush = dc->brush;
+    COLORREF saved_text = dc->text_color;
+    COLORREF saved_bk = dc->bk_color;
+
+    if (hbrush) {
+        gdi_brush_t *brush = gdi_get_object(table, hbrush, GDI_OBJ_BRUSH);
+        if (brush) dc->brush = brush;
+    }
+    if (fg_color != CLR_INVALID) dc->text_color = fg_color & 0x00FFFFFF;
+    if (bk_color != CLR_INVALID) dc->bk_color = bk_color & 0x00FFFFFF;
+
+    bool success = gdi_pat_blt(dc, x, y, width, height, rop);
+
+    dc->brush = saved_brush;
+    dc->text_color = saved_text;
+    dc->bk_color = saved_bk;
+    return success;
+}
+
+static bool batch_text_out(gdi_handle_table_t *table, gdi_dc_t *dc, const gdi_batch_textout_t *rec, uint32_t rec_size)
+{
+    /* String follows dx_size bytes of dx array in the buffer */
+    uint32_t header = offsetof(gdi_batch_textout_t, buffer);
+    if (rec->dx_size > rec_size - header ||
+        rec->count > (rec_size - header - rec->dx_size) / sizeof(uint16_t)) {
+        return false;
+    }
+    const uint16_t *str = (const uint16_t *)((const uint8_t *)rec->buffer + rec->dx_size);
+    const int *dx = rec->dx_size ? (const int *)rec->buffer : NULL;
+
+    COLORREF saved_text = dc->text_color;
+    COLORREF saved_bk = dc->bk_color;
+    int saved_bk_mode = dc->bk_mode;
+    int saved_align = dc->text_align;
+    gdi_font_t *saved_font = dc->font;
+
+    if (rec->fg_color != CLR_INVALID) dc->text_color = rec->fg_color & 0x00FFFFFF;
+    if (rec->bk_color != CLR_INVALID) dc->bk_color = rec->bk_color & 0x00FFFFFF;
+    dc->bk_mode = rec->bk_mode;
+    dc->text_align = (int)rec->text_align;
+    if (rec->hfont) {
+        gdi_font_t *font = gdi_get_object(table, rec->hfont, GDI_OBJ_FONT);
+        if (font) dc->font = font;
+    }
+
+    bool has_rect = (rec->options & (ETO_CLIPPED | ETO_OPAQUE)) != 0;
+    bool success = gdi_ext_text_out(dc, rec->x, rec->y, rec->options,
+                                    has_rect ? &rec->rect : NULL,
+                                    str, (int)rec->count, dx);
+
+    dc->text_color = saved_text;
+    dc->bk_color = saved_bk;
+    dc->bk_mode = saved_bk_mode;
+    dc->text_align = saved_align;
+    dc->font = saved_font;
+    return success;
+}
+
+/* Execute one record; returns true if it drew to the DC */
+static bool batch_execute(gdi_handle_table_t *table, gdi_dc_t *dc, uint32_t hdc, const gdi_batch_hdr_t *hdr, uint32_t size)
+{
+    switch (hdr->cmd) {
+        case GdiBCPatBlt: {
+            const gdi_batch_patblt_t *rec = (const void *)hdr;
+            if (!dc || size < sizeof(*rec)) return false;
+            return batch_pat_blt(table, dc, rec->x, rec->y, rec->width, rec->height, rec->rop,
+                                 rec->hbrush, rec->fg_color, rec->bk_color);
+        }
+
+        case GdiBCPolyPatBlt: {
+            const gdi_batch_polypatblt_t *rec = (const void *)hdr;
+            uint32_t header = offsetof(gdi_batch_polypatblt_t, rects);
+            if (!dc || size < header) return false;
+            uint32_t count = rec->count;
+            if (count > (size - header) / sizeof(gdi_batch_patrect_t)) {
+                count = (size - header) / sizeof(gdi_batch_patrect_t);
+            }
+            bool drew = false;
+            for (uint32_t i = 0; i < count; i++) {
+                const gdi_batch_patrect_t *pr = &rec->rects[i];
+                drew |= batch_pat_blt(table, dc, pr->r.left, pr->r.top, pr->r.right, pr->r.bottom,
+                                      rec->rop, pr->hbrush, rec->fg_color, rec->bk_color);
+            }
+            return drew;
+        }
+
+        case GdiBCTextOut:
+            if (!dc || size < offsetof(gdi_batch_textout_t, buffer)) return false;
+            return batch_text_out(table, dc, (const void *)hdr, size);
+
+        case GdiBCExtTextOut: {
+            const gdi_batch_exttextout_t *rec = (const void *)hdr;
+            if (!dc || size < sizeof(*rec)) return false;
+            COLORREF saved_bk = dc->bk_color;
+            dc->bk_color = rec->ul_bk_color & 0x00FFFFFF;
+            bool success = gdi_ext_text_out(dc, 0, 0, rec->options, &rec->rect, NULL, 0, NULL);
+            dc->bk_color = saved_bk;
+            return success;
+        }
+
+        case GdiBCSetBrushOrg: {
+            const gdi_batch_brushorg_t *rec = (const void *)hdr;
+            if (dc && size >= sizeof(*rec)) {
+                gdi_set_brush_org(dc, rec->origin.x, rec->origin.y, NULL);
+            }
+            return false;
+        }
+
+        case GdiBCExtSelClipRgn: {
+            const gdi_batch_clip_t *rec = (const void *)hdr;
+            if (!dc || size < sizeof(*rec)) return false;
+            if (rec->mode & GDIBS_NORECT) {
+                gdi_ext_select_clip_rgn(dc, NULL, (int)(rec->mode & ~GDIBS_NORECT));
+            } else {
+                gdi_region_t rgn;
+                gdi_region_init(&rgn);
+                gdi_region_set_rect(&rgn, rec->rect.left, rec->rect.top,
+                                    rec->rect.right, rec->rect.bottom);
+                gdi_ext_select_clip_rgn(dc, &rgn, (int)rec->mode);
+                gdi_region_cleanup(&rgn);
+            }
+            return false;
+        }
+
+        case GdiBCSelObj: {
+            const gdi_batch_object_t *rec = (const void *)hdr;
+            if (dc && size >= sizeof(*rec)) {
+                gdi_select_object(table, hdc, rec->hobject);
+            }
+            return false;
+        }
+
+        case GdiBCDelRgn:
+        case GdiBCDelObj: {
+            const gdi_batch_object_t *rec = (const void *)hdr;
+            if (size >= sizeof(*rec)) {
+                gdi_delete_object(table, rec->hobject);
+            }
+            return false;
+        }
+
+        default:
+            return false;
+    }
+}
+
+void gdi_batch_flush(gdi_handle_table_t *table, display_context_t *display, uint32_t teb)
+{
+    uint32_t batch = teb + TEB_GDI_TEB_BATCH;
+    uint32_t count;
+
+    if (!read_guest_dwords(teb + TEB_GDI_BATCH_COUNT, &count, 1) || count == 0) {
+        return;
+    }
+
+    uint32_t header[2];         /* Offset, HDC */
+    if (!read_guest_dwords(batch, header, 2)) {
+        return;
+    }
+    uint32_t used = header[0];
+    uint32_t hdc = header[1];
+    if (used > sizeof(g_batch_buffer)) {
+        used = sizeof(g_batch_buffer);
+    }
+
+    bool copied = read_guest_dwords(batch + 8, g_batch_buffer, (used + 3) / 4);
+
+    /* Reset the queue before executing so nested calls see it empty */
+    write_guest_dword(teb + TEB_GDI_BATCH_COUNT, 0);
+    write_guest_dword(batch, 0);
+    write_guest_dword(batch + 4, 0);
+
+    if (!copied) {
+        return;
+    }
+
+    gdi_dc_t *dc = hdc ? gdi_get_dc(table, hdc) : NULL;
+    bool drew = false;
+
+    const uint8_t *bytes = (const uint8_t *)g_batch_buffer;
+    uint32_t offset = 0;
+    while (count-- > 0 && offset + sizeof(gdi_batch_hdr_t) <= used) {
+        gdi_batch_hdr_t hdr;
+        memcpy(&hdr, bytes + offset, sizeof(hdr));
+        uint32_t size = (uint16_t)hdr.size;
+        if (size < sizeof(gdi_batch_hdr_t) || size > used - offset) {
+            break;
+        }
+
+        /* Records are packed back to back; realign odd-sized ones */
+        const gdi_batch_hdr_t *rec = (const void *)(bytes + offset);
+        if (offset & 3) {
+            memcpy(g_batch_record, bytes + offset, size);
+            rec = (const void *)g_batch_record;
+        }
+
+        drew |= batch_execute(table, dc, hdc, rec, size);
+
+        /* A DelObj may have deleted the batch DC */
+        if (dc && dc != gdi_get_dc(table, hdc)) {
+            dc = NULL;
+        }
+        offset += size;
+    }
+
+    if (drew && dc && dc->dc_type == DCTYPE_DIRECT && display) {
+        display->dirty = true;
+    }
+}
+
@@ -0,0 +1,122 @@
+/*
+ * WBOX GDI Batching
+ *
+ * gdi32 queues cheap calls (PatBlt, text output, object selection and
+ * deletion, clip and brush origin changes) as GDIBATCHHDR records in
+ * TEB.GdiTebBatch, all against GdiTebBatch.HDC, and counts them in
+ * TEB.GdiBatchCount. The queue is drained in order at NtGdiFlush and on
+ * entry to any other win32k call, so batched output is always in place
+ * before the call that follows it. Record layouts follow ReactOS
+ * (ntgdihdl.h).
+ */
+#ifndef WBOX_GDI_BATCH_H
+#define WBOX_GDI_BATCH_H
+
+#include <stdint.h>
+#include "../gdi/gdi_types.h"
+#include "../gdi/gdi_handle_table.h"
+#include "../gdi/display.h"
+
+#define GDI_BATCH_BUFFER_DWORDS 310
+
+/* GDIBATCHCMD */
+#define GdiBCPatBlt         0
+#define GdiBCPolyPatBlt     1
+#define GdiBCTextOut        2
+#define GdiBCExtTextOut     3
+#define GdiBCSetBrushOrg    4
+#define GdiBCExtSelClipRgn  5
+#define GdiBCSelObj         6
+#define GdiBCDelRgn         7
+#define GdiBCDelObj         8
+
+#define GDIBS_NORECT        0x80000000  /* ExtSelClipRgn without a rectangle */
+#define CLR_INVALID         0xFFFFFFFF
+
+typedef struct {
+    int16_t size;               /* Record size in bytes, header included */
+    int16_t cmd;                /* GDIBATCHCMD */
+} gdi_batch_hdr_t;
+
+typedef struct {
+    gdi_batch_hdr_t hdr;
+    int32_t x, y, width, height;
+    uint32_t hbrush;
+    uint32_t rop;
+    COLORREF fg_color;
+    COLORREF bk_color;
+    COLORREF brush_color;
+    int32_t icm_brush_color;
+    POINT viewport_org;
+    uint32_t ul_fg_color, ul_bk_color, ul_brush_color;
+} gdi_batch_patblt_t;
+
+typedef struct {
+    RECT r;                     /* x, y, width, height */
+    uint32_t hbrush;
+} gdi_batch_patrect_t;
+
+typedef struct {
+    gdi_batch_hdr_t hdr;
+    uint32_t rop;
+    uint32_t mode;
+    uint32_t count;
+    COLORREF fg_color;
+    COLORREF bk_color;
+    COLORREF brush_color;
+    uint32_t ul_fg_color, ul_bk_color, ul_brush_color;
+    POINT viewport_org;
+    gdi_batch_patrect_t rects[1];
+} gdi_batch_polypatblt_t;
+
+typedef struct {
+    gdi_batch_hdr_t hdr;
+    COLORREF fg_color;
+    COLORREF bk_color;
+    int32_t bk_mode;
+    uint32_t ul_fg_color, ul_bk_color;
+    int32_t x, y;
+    uint32_t options;
+    RECT rect;
+    uint32_t cs_cp;
+    uint32_t count;             /* Characters */
+    uint32_t dx_size;           /* Bytes of dx array preceding the string */
+    uint32_t hfont;
+    uint32_t text_align;
+    POINT viewport_org;
+    uint32_t buffer[1];         /* dx array, then the string */
+} gdi_batch_textout_t;
+
+typedef struct {
+    gdi_batch_hdr_t hdr;
+    uint32_t count;
+    uint32_t options;
+    RECT rect;
+    POINT viewport_org;
+    uint32_t ul_bk_color;
+} gdi_batch_exttextout_t;
+
+typedef struct {
+    gdi_batch_hdr_t hdr;
+    POINT origin;
+} gdi_batch_brushorg_t;
+
+typedef struct {
+    gdi_batch_hdr_t hdr;
+    uint32_t mode;
+    RECT rect;
+} gdi_batch_clip_t;
+
+typedef struct {
+    gdi_batch_hdr_t hdr;
+    uint32_t hobject;
+} gdi_batch_object_t;
+
+/*
+ * Drain the GDI batch queue in the TEB at teb
+ * Records run against the handles in table; output to a display DC marks
+ * display dirty. The queue is reset before the records run.
+ */
+void gdi_batch_flush(gdi_handle_table_t *table, display_context_t *display, uint32_t teb);
+
+#endif /* WBOX_GDI_BATCH_H */
@@ -12,7 +12,9 @@
 #include "../cpu/mem.h"
 #include "../vm/vm.h"
 #include "../vm/paging.h"
+#include "../loader/loader.h"
 #include "../user/user_callback.h"
+#include "../user/user_message.h"
 #include "../thread/thread.h"
 #include "../thread/scheduler.h"
 
@@ -620,8 +622,34 @@ int nt_syscall_handler(void)
 
         case WBOX_SYSCALL_WNDPROC_RETURN: {
             /* WndProc callback returned - ECX contains the result
-             * (saved by the return stub before loading syscall number into EAX) */
-            user_callback_return(ECX);
+             * (saved by the return stub before loading syscall number into EAX).
+             * The interrupted syscall's continuation sets EAX; finish it like
+             * any other win32k syscall unless it went back to user mode. */
+            if (user_callback_return(ECX) == USER_CALLBACK_COMPLETE) {
+                win32k_syscall_return();
+            }
+            return 1;
+        }
+
+        case WBOX_SYSCALL_LAZY_BIND: {
+            /* Lazy import thunk: [ESP] = import number, [ESP+4] = caller's EAX,
+             * then the caller's return address and arguments */
+            vm_context_t *vm = vm_get_context();
+            uint32_t index = readmemll(ESP);
+            uint32_t saved_eax = readmemll(ESP + 4);
+            uint32_t target = 0;
+            if (!vm || !vm->loader ||
+                imports_bind_lazy(&vm->loader->modules, vm, index, &target) < 0) {
+                fprintf(stderr, "SYSCALL: Lazy import %u cannot be bound, terminating\n", index);
+                if (vm) {
+                    vm_request_exit(vm, STATUS_ENTRYPOINT_NOT_FOUND);
+                }
+                cpu_exit_requested = 1;
+                return 1;
+            }
+            ESP += 8;
+            EAX = saved_eax;
+            cpu_state.pc = target;
             return 1;
         }
 
@@ -1450,11 +1478,17 @@ int nt_syscall_handler(void)
                 fprintf(stderr, "SYSCALL: NtCallbackReturn read result=0x%X from args\n", result_value);
             }
 
-            /* Mark the callback as completed */
-            user_callback_return(result_value);
-
-            /* Return to caller - but the callback loop will detect completion and restore state */
-            syscall_return(status);
+            /* Resume the win32k syscall that made the callback */
+            switch (user_callback_return(result_value)) {
+                case USER_CALLBACK_COMPLETE:
+                    win32k_syscall_return();
+                    break;
+                case USER_CALLBACK_CONTINUED:
+                    break;
+                case USER_CALLBACK_NONE:
+                    syscall_return(status);
+                    break;
+            }
             return 1;
         }
 
@@ -1615,6 +1649,8 @@ int nt_syscall_handler(void)
 
             /* Terminate the thread */
             thread_terminate(thread, exit_status);
+            msg_queue_thread_exit(thread);
+            user_callback_thread_exit(thread);
 
             /* Remove from scheduler */
             if (sched) {
@@ -1804,7 +1840,20 @@ int nt_syscall_handler(void)
                  * These handlers set EAX themselves with handles/values,
                  * so we use win32k_syscall_return() which preserves EAX. */
                 fprintf(stderr, "SYSCALL: win32k 0x%X (%s)\n", syscall_num, syscall_get_name(syscall_num));
-                win32k_syscall_dispatch(syscall_num);
+                wbox_scheduler_t *sched = scheduler_get_instance();
+                if (win32k_syscall_dispatch(syscall_num) == STATUS_PENDING) {
+                    if (sched && sched->syscall_parked) {
+                        /* Thread parked and rewound onto SYSENTER; the CPU state
+                         * now belongs to whichever thread runs next */
+                        sched->syscall_parked = false;
+                        return 1;
+                    }
+                    if (user_callback_entered()) {
+                        /* Guest now runs a window procedure; the syscall
+                         * finishes in its continuation when it returns */
+                        return 1;
+                    }
+                }
                 fprintf(stderr, "SYSCALL: win32k 0x%X returned 0x%X\n", syscall_num, EAX);
                 win32k_syscall_return();
                 return 1;
@@ -313,6 +313,7 @@
 /* Special internal syscalls for VM control */
 #define WBOX_SYSCALL_DLL_INIT_DONE  0xFFFE  /* DLL entry point completed */
 #define WBOX_SYSCALL_WNDPROC_RETURN 0xFFFD  /* WndProc callback returned */
+#define WBOX_SYSCALL_LAZY_BIND      0xFFFC  /* Lazy import thunk called */
 
 /* Pseudo syscalls for heap function interception */
 #define WBOX_SYSCALL_HEAP_ALLOC    0xFFF0  /* RtlAllocateHeap */
@@ -360,6 +361,7 @@
 #define STATUS_NO_TOKEN             0xC000007C
 #define STATUS_INFO_LENGTH_MISMATCH 0xC0000004
 #define STATUS_INTERNAL_ERROR       0xC00000E5
+#define STATUS_ENTRYPOINT_NOT_FOUND 0xC0000139
 
 /* Invalid handle sentinel value */
 #define INVALID_HANDLE_VALUE        ((uint32_t)-1)
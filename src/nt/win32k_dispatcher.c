@@ -3,6 +3,7 @@
  */
 #include "win32k_dispatcher.h"
 #include "win32k_syscalls.h"
+#include "gdi_batch.h"
 #include "../cpu/cpu.h"
 #include "../cpu/mem.h"
 #include "../vm/vm.h"
@@ -11,8 +12,12 @@
 #include "../gdi/gdi_drawing.h"
 #include "../gdi/gdi_text.h"
 #include "../user/user_syscalls.h"
+#include "../user/user_window.h"
+#include "../user/user_message.h"
+#include "../user/guest_wnd.h"
 #include "../process/process.h"
 
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -98,6 +103,48 @@ static void write_guest_byte(uint32_t guest_ptr, uint8_t value)
     }
 }
 
+/* Helper to read a RECT from guest memory */
+static bool read_guest_rect(uint32_t guest_ptr, RECT *rect)
+{
+    if (!guest_ptr) return false;
+
+    vm_context_t *vm = vm_get_context();
+    if (!vm) return false;
+
+    uint32_t phys = paging_get_phys(&vm->paging, guest_ptr);
+    if (!phys) return false;
+
+    rect->left = (int32_t)mem_readl_phys(phys);
+    rect->top = (int32_t)mem_readl_phys(phys + 4);
+    rect->right = (int32_t)mem_readl_phys(phys + 8);
+    rect->bottom = (int32_t)mem_readl_phys(phys + 12);
+    return true;
+}
+
+/* Helper to read an array of dwords from guest memory */
+static bool read_guest_dwords(uint32_t guest_ptr, uint32_t *out, uint32_t count)
+{
+    if (!guest_ptr) return false;
+
+    vm_context_t *vm = vm_get_context();
+    if (!vm) return false;
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t phys = paging_get_phys(&vm->paging, guest_ptr + i * 4);
+        if (!phys) return false;
+        out[i] = mem_readl_phys(phys);
+    }
+    return true;
+}
+
+static void write_guest_rect(uint32_t guest_ptr, const RECT *rect)
+{
+    write_guest_dword(guest_ptr, (uint32_t)rect->left);
+    write_guest_dword(guest_ptr + 4, (uint32_t)rect->top);
+    write_guest_dword(guest_ptr + 8, (uint32_t)rect->right);
+    write_guest_dword(guest_ptr + 12, (uint32_t)rect->bottom);
+}
+
 /* Initialize win32k */
 int win32k_init(display_context_t *display)
 {
@@ -176,52 +223,7 @@ ntstatus_t sys_NtGdiDeleteObjectApp(void)
 {
     uint32_t hobject = read_stack_arg(0);
 
-    /* Check object type */
-    uint8_t type;
-    void *obj = gdi_get_object_any(&g_gdi_handles, hobject, &type);
-    if (!obj) {
-        EAX = 0;
-        return STATUS_SUCCESS;
-    }
-
-    /* Cannot delete stock objects */
-    if (GDI_HANDLE_IS_STOCK(hobject)) {
-        EAX = 1;
-        return STATUS_SUCCESS;
-    }
-
-    /* Free based on type */
-    bool success = false;
-    switch (type) {
-        case GDI_OBJ_DC:
-            success = gdi_delete_dc(&g_gdi_handles, hobject);
-            break;
-        case GDI_OBJ_BRUSH:
-            success = gdi_free_handle(&g_gdi_handles, hobject);
-            if (success) gdi_free_brush(&g_gdi_handles, obj);
-            break;
-        case GDI_OBJ_PEN:
-            success = gdi_free_handle(&g_gdi_handles, hobject);
-            if (success) gdi_free_pen(&g_gdi_handles, obj);
-            break;
-        case GDI_OBJ_FONT:
-            success = gdi_free_handle(&g_gdi_handles, hobject);
-            if (success) gdi_free_font(&g_gdi_handles, obj);
-            break;
-        case GDI_OBJ_BITMAP:
-            success = gdi_free_handle(&g_gdi_handles, hobject);
-            if (success) gdi_free_bitmap(&g_gdi_handles, obj);
-            break;
-        case GDI_OBJ_REGION:
-            success = gdi_free_handle(&g_gdi_handles, hobject);
-            if (success) gdi_free_region(&g_gdi_handles, obj);
-            break;
-        default:
-            success = gdi_free_handle(&g_gdi_handles, hobject);
-            break;
-    }
-
-    EAX = success ? 1 : 0;
+    EAX = gdi_delete_object(&g_gdi_handles, hobject) ? 1 : 0;
     return STATUS_SUCCESS;
 }
 
@@ -397,6 +399,46 @@ ntstatus_t sys_NtGdiBitBlt(void)
     return STATUS_SUCCESS;
 }
 
+/* NtGdiStretchBlt */
+ntstatus_t sys_NtGdiStretchBlt(void)
+{
+    uint32_t hdc_dest = read_stack_arg(0);
+    int x_dest = (int)read_stack_arg(1);
+    int y_dest = (int)read_stack_arg(2);
+    int width_dest = (int)read_stack_arg(3);
+    int height_dest = (int)read_stack_arg(4);
+    uint32_t hdc_src = read_stack_arg(5);
+    int x_src = (int)read_stack_arg(6);
+    int y_src = (int)read_stack_arg(7);
+    int width_src = (int)read_stack_arg(8);
+    int height_src = (int)read_stack_arg(9);
+    uint32_t rop = read_stack_arg(10);
+    /* arg 11 is crBack */
+
+    gdi_dc_t *dst_dc = gdi_get_dc(&g_gdi_handles, hdc_dest);
+    gdi_dc_t *src_dc = gdi_get_dc(&g_gdi_handles, hdc_src);
+    if (!dst_dc) {
+        EAX = 0;
+        return STATUS_SUCCESS;
+    }
+
+    bool success;
+    if (src_dc) {
+        success = gdi_stretch_blt(dst_dc, x_dest, y_dest, width_dest, height_dest,
+                                  src_dc, x_src, y_src, width_src, height_src, rop);
+    } else {
+        /* Pattern-only ROP */
+        success = gdi_pat_blt(dst_dc, x_dest, y_dest, width_dest, height_dest, rop);
+    }
+
+    if (success && dst_dc->dc_type == DCTYPE_DIRECT && g_display) {
+        g_display->dirty = true;
+    }
+
+    EAX = success ? 1 : 0;
+    return STATUS_SUCCESS;
+}
+
 /* NtGdiExtTextOutW */
 ntstatus_t sys_NtGdiExtTextOutW(void)
 {
@@ -423,18 +465,7 @@ ntstatus_t sys_NtGdiExtTextOutW(void)
 
     /* Read optional rect */
     RECT rect = {0};
-    if (rect_ptr) {
-        vm_context_t *vm = vm_get_context();
-        if (vm) {
-            uint32_t phys = paging_get_phys(&vm->paging, rect_ptr);
-            if (phys) {
-                rect.left = (int32_t)mem_readl_phys(phys);
-                rect.top = (int32_t)mem_readl_phys(phys + 4);
-                rect.right = (int32_t)mem_readl_phys(phys + 8);
-                rect.bottom = (int32_t)mem_readl_phys(phys + 12);
-            }
-        }
-    }
+    read_guest_rect(rect_ptr, &rect);
 
     /* TODO: Read dx array if needed */
 
@@ -618,6 +649,233 @@ ntstatus_t sys_NtGdiFillRgn(void)
     return STATUS_SUCCESS;
 }
 
+/* NtGdiCombineRgn */
+ntstatus_t sys_NtGdiCombineRgn(void)
+{
+    uint32_t hrgn_dst = read_stack_arg(0);
+    uint32_t hrgn_src1 = read_stack_arg(1);
+    uint32_t hrgn_src2 = read_stack_arg(2);
+    int mode = (int)read_stack_arg(3);
+
+    EAX = gdi_combine_rgn(&g_gdi_handles, hrgn_dst, hrgn_src1, hrgn_src2, mode);
+    return STATUS_SUCCESS;
+}
+
+/* NtGdiSetRectRgn */
+ntstatus_t sys_NtGdiSetRectRgn(void)
+{
+    uint32_t hrgn = read_stack_arg(0);
+    int left = (int)read_stack_arg(1);
+    int top = (int)read_stack_arg(2);
+    int right = (int)read_stack_arg(3);
+    int bottom = (int)read_stack_arg(4);
+
+    bool success = gdi_set_rect_rgn(&g_gdi_handles, hrgn, left, top, right, bottom);
+
+    EAX = success ? 1 : 0;
+    return STATUS_SUCCESS;
+}
+
+/* NtGdiOffsetRgn */
+ntstatus_t sys_NtGdiOffsetRgn(void)
+{
+    uint32_t hrgn = read_stack_arg(0);
+    int x = (int)read_stack_arg(1);
+    int y = (int)read_stack_arg(2);
+
+    EAX = gdi_offset_rgn(&g_gdi_handles, hrgn, x, y);
+    return STATUS_SUCCESS;
+}
+
+/* NtGdiGetRgnBox */
+ntstatus_t sys_NtGdiGetRgnBox(void)
+{
+    uint32_t hrgn = read_stack_arg(0);
+    uint32_t rect_ptr = read_stack_arg(1);
+
+    RECT rect = {0};
+    int result = gdi_get_rgn_box(&g_gdi_handles, hrgn, &rect);
+    if (result != RGN_ERROR && rect_ptr) {
+        write_guest_rect(rect_ptr, &rect);
+    }
+
+    EAX = result;
+    return STATUS_SUCCESS;
+}
+
+/* NtGdiPtInRegion */
+ntstatus_t sys_NtGdiPtInRegion(void)
+{
+    uint32_t hrgn = read_stack_arg(0);
+    int x = (int)read_stack_arg(1);
+    int y = (int)read_stack_arg(2);
+
+    EAX = gdi_pt_in_region(&g_gdi_handles, hrgn, x, y) ? 1 : 0;
+    return STATUS_SUCCESS;
+}
+
+/* NtGdiRectInRegion */
+ntstatus_t sys_NtGdiRectInRegion(void)
+{
+    uint32_t hrgn = read_stack_arg(0);
+    uint32_t rect_ptr = read_stack_arg(1);
+
+    RECT rect;
+    if (!read_guest_rect(rect_ptr, &rect)) {
+        EAX = 0;
+        return STATUS_SUCCESS;
+    }
+
+    EAX = gdi_rect_in_region(&g_gdi_handles, hrgn, &rect) ? 1 : 0;
+    return STATUS_SUCCESS;
+}
+
+/* NtGdiEqualRgn */
+ntstatus_t sys_NtGdiEqualRgn(void)
+{
+    uint32_t hrgn1 = read_stack_arg(0);
+    uint32_t hrgn2 = read_stack_arg(1);
+
+    EAX = (uint32_t)gdi_equal_rgn(&g_gdi_handles, hrgn1, hrgn2);
+    return STATUS_SUCCESS;
+}
+
+/* NtGdiInvertRgn */
+ntstatus_t sys_NtGdiInvertRgn(void)
+{
+    uint32_t hdc = read_stack_arg(0);
+    uint32_t hrgn = read_stack_arg(1);
+
+    gdi_dc_t *dc = gdi_get_dc(&g_gdi_handles, hdc);
+    if (!dc) {
+        EAX = 0;
+        return STATUS_SUCCESS;
+    }
+
+    bool success = gdi_invert_rgn(&g_gdi_handles, dc, hrgn);
+
+    if (success && dc->dc_type == DCTYPE_DIRECT && g_display) {
+        g_display->dirty = true;
+    }
+
+    EAX = success ? 1 : 0;
+    return STATUS_SUCCESS;
+}
+
+/* NtGdiFrameRgn */
+ntstatus_t sys_NtGdiFrameRgn(void)
+{
+    uint32_t hdc = read_stack_arg(0);
+    uint32_t hrgn = read_stack_arg(1);
+    uint32_t hbrush = read_stack_arg(2);
+    int width = (int)read_stack_arg(3);
+    int height = (int)read_stack_arg(4);
+
+    gdi_dc_t *dc = gdi_get_dc(&g_gdi_handles, hdc);
+    if (!dc) {
+        EAX = 0;
+        return STATUS_SUCCESS;
+    }
+
+    bool success = gdi_frame_rgn(&g_gdi_handles, dc, hrgn, hbrush, width, height);
+
+    if (success && dc->dc_type == DCTYPE_DIRECT && g_display) {
+        g_display->dirty = true;
+    }
+
+    EAX = success ? 1 : 0;
+    return STATUS_SUCCESS;
+}
+
+/* NtGdiExtSelectClipRgn */
+ntstatus_t sys_NtGdiExtSelectClipRgn(void)
+{
+    uint32_t hdc = read_stack_arg(0);
+    uint32_t hrgn = read_stack_arg(1);
+    int mode = (int)read_stack_arg(2);
+
+    gdi_dc_t *dc = gdi_get_dc(&g_gdi_handles, hdc);
+    if (!dc) {
+        EAX = RGN_ERROR;
+        return STATUS_SUCCESS;
+    }
+
+    gdi_region_t *rgn = NULL;
+    if (hrgn) {
+        rgn = gdi_get_object(&g_gdi_handles, hrgn, GDI_OBJ_REGION);
+        if (!rgn) {
+            EAX = RGN_ERROR;
+            return STATUS_SUCCESS;
+        }
+    }
+
+    EAX = gdi_ext_select_clip_rgn(dc, rgn, mode);
+    return STATUS_SUCCESS;
+}
+
+/* NtGdiIntersectClipRect */
+ntstatus_t sys_NtGdiIntersectClipRect(void)
+{
+    uint32_t hdc = read_stack_arg(0);
+    int left = (int)read_stack_arg(1);
+    int top = (int)read_stack_arg(2);
+    int right = (int)read_stack_arg(3);
+    int bottom = (int)read_stack_arg(4);
+
+    gdi_dc_t *dc = gdi_get_dc(&g_gdi_handles, hdc);
+
+    EAX = dc ? gdi_intersect_clip_rect(dc, left, top, right, bottom) : RGN_ERROR;
+    return STATUS_SUCCESS;
+}
+
+/* NtGdiExcludeClipRect */
+ntstatus_t sys_NtGdiExcludeClipRect(void)
+{
+    uint32_t hdc = read_stack_arg(0);
+    int left = (int)read_stack_arg(1);
+    int top = (int)read_stack_arg(2);
+    int right = (int)read_stack_arg(3);
+    int bottom = (int)read_stack_arg(4);
+
+    gdi_dc_t *dc = gdi_get_dc(&g_gdi_handles, hdc);
+
+    EAX = dc ? gdi_exclude_clip_rect(dc, left, top, right, bottom) : RGN_ERROR;
+    return STATUS_SUCCESS;
+}
+
+/* NtGdiOffsetClipRgn */
+ntstatus_t sys_NtGdiOffsetClipRgn(void)
+{
+    uint32_t hdc = read_stack_arg(0);
+    int x = (int)read_stack_arg(1);
+    int y = (int)read_stack_arg(2);
+
+    gdi_dc_t *dc = gdi_get_dc(&g_gdi_handles, hdc);
+
+    EAX = dc ? gdi_offset_clip_rgn(dc, x, y) : RGN_ERROR;
+    return STATUS_SUCCESS;
+}
+
+/* NtGdiGetAppClipBox */
+ntstatus_t sys_NtGdiGetAppClipBox(void)
+{
+    uint32_t hdc = read_stack_arg(0);
+    uint32_t rect_ptr = read_stack_arg(1);
+
+    gdi_dc_t *dc = gdi_get_dc(&g_gdi_handles, hdc);
+    if (!dc) {
+        EAX = RGN_ERROR;
+        return STATUS_SUCCESS;
+    }
+
+    RECT rect;
+    int result = gdi_get_clip_box(dc, &rect);
+    write_guest_rect(rect_ptr, &rect);
+
+    EAX = result;
+    return STATUS_SUCCESS;
+}
+
 /* NtGdiRectangle */
 ntstatus_t sys_NtGdiRectangle(void)
 {
@@ -643,6 +901,188 @@ ntstatus_t sys_NtGdiRectangle(void)
     return STATUS_SUCCESS;
 }
 
+/* NtGdiEllipse */
+ntstatus_t sys_NtGdiEllipse(void)
+{
+    uint32_t hdc = read_stack_arg(0);
+    int left = (int)read_stack_arg(1);
+    int top = (int)read_stack_arg(2);
+    int right = (int)read_stack_arg(3);
+    int bottom = (int)read_stack_arg(4);
+
+    gdi_dc_t *dc = gdi_get_dc(&g_gdi_handles, hdc);
+    if (!dc) {
+        EAX = 0;
+        return STATUS_SUCCESS;
+    }
+
+    bool success = gdi_ellipse(dc, left, top, right, bottom);
+
+    if (success && dc->dc_type == DCTYPE_DIRECT && g_display) {
+        g_display->dirty = true;
+    }
+
+    EAX = success ? 1 : 0;
+    return STATUS_SUCCESS;
+}
+
+/* NtGdiRoundRect */
+ntstatus_t sys_NtGdiRoundRect(void)
+{
+    uint32_t hdc = read_stack_arg(0);
+    int left = (int)read_stack_arg(1);
+    int top = (int)read_stack_arg(2);
+    int right = (int)read_stack_arg(3);
+    int bottom = (int)read_stack_arg(4);
+    int width = (int)read_stack_arg(5);
+    int height = (int)read_stack_arg(6);
+
+    gdi_dc_t *dc = gdi_get_dc(&g_gdi_handles, hdc);
+    if (!dc) {
+        EAX = 0;
+        return STATUS_SUCCESS;
+    }
+
+    bool success = gdi_round_rect(dc, left, top, right, bottom, width, height);
+
+    if (success && dc->dc_type == DCTYPE_DIRECT && g_display) {
+        g_display->dirty = true;
+    }
+
+    EAX = success ? 1 : 0;
+    return STATUS_SUCCESS;
+}
+
+/* ARCTYPE values for NtGdiArcInternal */
+#define GdiTypeArc      0
+#define GdiTypeArcTo    1
+#define GdiTypeChord    2
+#define GdiTypePie      3
+
+/* NtGdiArcInternal */
+ntstatus_t sys_NtGdiArcInternal(void)
+{
+    uint32_t arc_type = read_stack_arg(0);
+    uint32_t hdc = read_stack_arg(1);
+    int left = (int)read_stack_arg(2);
+    int top = (int)read_stack_arg(3);
+    int right = (int)read_stack_arg(4);
+    int bottom = (int)read_stack_arg(5);
+    int x_start = (int)read_stack_arg(6);
+    int y_start = (int)read_stack_arg(7);
+    int x_end = (int)read_stack_arg(8);
+    int y_end = (int)read_stack_arg(9);
+
+    gdi_dc_t *dc = gdi_get_dc(&g_gdi_handles, hdc);
+    if (!dc) {
+        EAX = 0;
+        return STATUS_SUCCESS;
+    }
+
+    bool success;
+    switch (arc_type) {
+        case GdiTypeArc:
+            success = gdi_arc(dc, left, top, right, bottom, x_start, y_start, x_end, y_end);
+            break;
+        case GdiTypeArcTo:
+            success = gdi_arc_to(dc, left, top, right, bottom, x_start, y_start, x_end, y_end);
+            break;
+        case GdiTypeChord:
+            success = gdi_chord(dc, left, top, right, bottom, x_start, y_start, x_end, y_end);
+            break;
+        case GdiTypePie:
+            success = gdi_pie(dc, left, top, right, bottom, x_start, y_start, x_end, y_end);
+            break;
+        default:
+            success = false;
+            break;
+    }
+
+    if (success && dc->dc_type == DCTYPE_DIRECT && g_display) {
+        g_display->dirty = true;
+    }
+
+    EAX = success ? 1 : 0;
+    return STATUS_SUCCESS;
+}
+
+/* PolyPolyDraw functions */
+#define GdiPolyPolygon  1
+#define GdiPolyPolyLine 2
+#define GdiPolyBezier   3
+#define GdiPolyLineTo   4
+#define GdiPolyBezierTo 5
+#define GdiPolyPolyRgn  6
+
+/* Sanity limits for guest point arrays */
+#define POLYPOLY_MAX_POLYS  0x10000
+#define POLYPOLY_MAX_POINTS 0x100000
+
+/* NtGdiPolyPolyDraw */
+ntstatus_t sys_NtGdiPolyPolyDraw(void)
+{
+    uint32_t hdc = read_stack_arg(0);
+    uint32_t points_ptr = read_stack_arg(1);
+    uint32_t counts_ptr = read_stack_arg(2);
+    uint32_t num_polys = read_stack_arg(3);
+    uint32_t func = read_stack_arg(4);
+
+    EAX = 0;
+
+    if (func != GdiPolyPolygon && func != GdiPolyPolyLine && func != GdiPolyLineTo) {
+        /* Beziers and polygon regions are not supported */
+        return STATUS_SUCCESS;
+    }
+    if (num_polys == 0 || num_polys > POLYPOLY_MAX_POLYS) {
+        return STATUS_SUCCESS;
+    }
+
+    gdi_dc_t *dc = gdi_get_dc(&g_gdi_handles, hdc);
+    if (!dc) {
+        return STATUS_SUCCESS;
+    }
+
+    uint32_t *counts = malloc(num_polys * sizeof(uint32_t));
+    if (!counts || !read_guest_dwords(counts_ptr, counts, num_polys)) {
+        free(counts);
+        return STATUS_SUCCESS;
+    }
+
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < num_polys; i++) {
+        if (counts[i] > POLYPOLY_MAX_POINTS - total) {
+            free(counts);
+            return STATUS_SUCCESS;
+        }
+        total += counts[i];
+    }
+
+    POINT *points = malloc((total > 0 ? total : 1) * sizeof(POINT));
+    if (!points || !read_guest_dwords(points_ptr, (uint32_t *)points, total * 2)) {
+        free(points);
+        free(counts);
+        return STATUS_SUCCESS;
+    }
+
+    bool success;
+    if (func == GdiPolyLineTo) {
+        success = gdi_polyline_to(dc, points, (int)total);
+    } else if (func == GdiPolyPolygon) {
+        success = gdi_poly_polygon(dc, points, (const int *)counts, (int)num_polys);
+    } else {
+        success = gdi_poly_polyline(dc, points, (const int *)counts, (int)num_polys);
+    }
+
+    if (success && dc->dc_type == DCTYPE_DIRECT && g_display) {
+        g_display->dirty = true;
+    }
+
+    free(points);
+    free(counts);
+    EAX = success ? 1 : 0;
+    return STATUS_SUCCESS;
+}
+
 /* NtGdiGetDeviceCaps */
 ntstatus_t sys_NtGdiGetDeviceCaps(void)
 {
@@ -1073,7 +1513,7 @@ ntstatus_t sys_NtGdiGetDCObject(void)
 /* NtGdiFlush */
 ntstatus_t sys_NtGdiFlush(void)
 {
-    /* Force display update */
+    /* The batch was drained on dispatch entry; force display update */
     if (g_display && g_display->dirty) {
         display_present(g_display);
     }
@@ -1093,12 +1533,55 @@ ntstatus_t sys_NtGdiInit(void)
  * User Syscall Implementations
  */
 
+/* GetDCEx flags */
+#define DCX_WINDOW          0x00000001
+#define DCX_EXCLUDERGN      0x00000040
+#define DCX_INTERSECTRGN    0x00000080
+
+/*
+ * Attach a window's visible region to a DC so that drawing lands at the
+ * window's position on screen and is clipped against overlapping windows.
+ * The DC for HWND 0 keeps covering the whole screen.
+ */
+static void setup_window_dc(uint32_t hdc, WBOX_WND *wnd, bool client)
+{
+    gdi_dc_t *dc = gdi_get_dc(&g_gdi_handles, hdc);
+    if (!dc || !wnd) return;
+
+    gdi_region_t *vis = gdi_region_create();
+    if (!vis) return;
+
+    if (!user_window_calc_vis_rgn(wnd, client, vis)) {
+        fprintf(stderr, "win32k: Failed to compute visible region for hwnd 0x%X\n", wnd->hwnd);
+        gdi_region_destroy(vis);
+        return;
+    }
+
+    const WBOX_RECT *org = client ? &wnd->rcClient : &wnd->rcWindow;
+    gdi_dc_set_vis_region(dc, vis, org->left, org->top);
+}
+
+/* Release a window's update region */
+static void free_update_region(WBOX_WND *wnd)
+{
+    if (!wnd->hrgnUpdate) return;
+
+    gdi_region_t *rgn = gdi_get_object(&g_gdi_handles, wnd->hrgnUpdate, GDI_OBJ_REGION);
+    if (gdi_free_handle(&g_gdi_handles, wnd->hrgnUpdate) && rgn) {
+        gdi_free_region(&g_gdi_handles, rgn);
+    }
+    wnd->hrgnUpdate = 0;
+}
+
 /* NtUserGetDC */
 ntstatus_t sys_NtUserGetDC(void)
 {
     uint32_t hwnd = read_stack_arg(0);
 
     uint32_t hdc = gdi_create_window_dc(&g_gdi_handles, g_display, hwnd);
+    if (hdc && hwnd) {
+        setup_window_dc(hdc, user_window_from_hwnd(hwnd), true);
+    }
 
     EAX = hdc;
     return STATUS_SUCCESS;
@@ -1111,10 +1594,22 @@ ntstatus_t sys_NtUserGetDCEx(void)
     uint32_t hrgnClip = read_stack_arg(1);
     uint32_t flags = read_stack_arg(2);
 
-    (void)hrgnClip;
-    (void)flags;
-
     uint32_t hdc = gdi_create_window_dc(&g_gdi_handles, g_display, hwnd);
+    if (hdc && hwnd) {
+        setup_window_dc(hdc, user_window_from_hwnd(hwnd), !(flags & DCX_WINDOW));
+
+        /* Extra clipping region (screen coordinates) */
+        gdi_dc_t *dc = gdi_get_dc(&g_gdi_handles, hdc);
+        gdi_region_t *clip = hrgnClip ? gdi_get_object(&g_gdi_handles, hrgnClip, GDI_OBJ_REGION) : NULL;
+        if (dc && dc->vis_region && clip) {
+            if (flags & DCX_INTERSECTRGN) {
+                gdi_region_intersect(dc->vis_region, dc->vis_region, clip);
+            } else if (flags & DCX_EXCLUDERGN) {
+                gdi_region_subtract(dc->vis_region, dc->vis_region, clip);
+            }
+            gdi_dc_update_clip(dc);
+        }
+    }
 
     EAX = hdc;
     return STATUS_SUCCESS;
@@ -1126,6 +1621,9 @@ ntstatus_t sys_NtUserGetWindowDC(void)
     uint32_t hwnd = read_stack_arg(0);
 
     uint32_t hdc = gdi_create_window_dc(&g_gdi_handles, g_display, hwnd);
+    if (hdc && hwnd) {
+        setup_window_dc(hdc, user_window_from_hwnd(hwnd), false);
+    }
 
     EAX = hdc;
     return STATUS_SUCCESS;
@@ -1151,14 +1649,47 @@ ntstatus_t sys_NtUserBeginPaint(void)
     /* Create DC for painting */
     uint32_t hdc = gdi_create_window_dc(&g_gdi_handles, g_display, hwnd);
 
+    /* Paint rectangle in client coordinates (whole screen without a window) */
+    RECT paint = { 0, 0, g_display ? g_display->width : 800, g_display ? g_display->height : 600 };
+
+    WBOX_WND *wnd = hwnd ? user_window_from_hwnd(hwnd) : NULL;
+    gdi_dc_t *dc = gdi_get_dc(&g_gdi_handles, hdc);
+    if (wnd && dc) {
+        setup_window_dc(hdc, wnd, true);
+
+        paint.right = wnd->rcClient.right - wnd->rcClient.left;
+        paint.bottom = wnd->rcClient.bottom - wnd->rcClient.top;
+
+        /* Only the invalid part needs repainting */
+        gdi_region_t *update = wnd->hrgnUpdate ?
+            gdi_get_object(&g_gdi_handles, wnd->hrgnUpdate, GDI_OBJ_REGION) : NULL;
+        if (update && dc->vis_region) {
+            gdi_region_intersect(dc->vis_region, dc->vis_region, update);
+            gdi_dc_update_clip(dc);
+
+            if (gdi_region_is_empty(update)) {
+                memset(&paint, 0, sizeof(paint));
+            } else {
+                paint.left = update->bounds.left - wnd->rcClient.left;
+                paint.top = update->bounds.top - wnd->rcClient.top;
+                paint.right = update->bounds.right - wnd->rcClient.left;
+                paint.bottom = update->bounds.bottom - wnd->rcClient.top;
+            }
+        }
+
+        /* Validate the window */
+        free_update_region(wnd);
+        wnd->state &= ~(WNDS_SENDNCPAINT | WNDS_SENDERASEBACKGROUND);
+        wnd->guest_dirty |= WNDD_STATE;
+        msg_queue_update_paint(wnd);
+        guest_wnd_sync(wnd);
+    }
+
     /* Fill PAINTSTRUCT if provided */
     if (ps_ptr) {
         write_guest_dword(ps_ptr, hdc);           /* hdc */
         write_guest_dword(ps_ptr + 4, 1);         /* fErase */
-        write_guest_dword(ps_ptr + 8, 0);         /* rcPaint.left */
-        write_guest_dword(ps_ptr + 12, 0);        /* rcPaint.top */
-        write_guest_dword(ps_ptr + 16, g_display ? g_display->width : 800);   /* rcPaint.right */
-        write_guest_dword(ps_ptr + 20, g_display ? g_display->height : 600);  /* rcPaint.bottom */
+        write_guest_rect(ps_ptr + 8, &paint);     /* rcPaint */
         write_guest_dword(ps_ptr + 24, 0);        /* fRestore */
         write_guest_dword(ps_ptr + 28, 0);        /* fIncUpdate */
         /* rgbReserved[32] left as zeros */
@@ -1204,15 +1735,53 @@ ntstatus_t sys_NtUserInvalidateRect(void)
     uint32_t rect_ptr = read_stack_arg(1);
     uint32_t erase = read_stack_arg(2);
 
-    (void)hwnd;
-    (void)rect_ptr;
-    (void)erase;
-
     /* Mark display as dirty */
     if (g_display) {
         g_display->dirty = true;
     }
 
+    WBOX_WND *wnd = hwnd ? user_window_from_hwnd(hwnd) : NULL;
+    if (!wnd) {
+        EAX = 1;
+        return STATUS_SUCCESS;
+    }
+
+    /* Invalid area in screen coordinates, limited to the client area */
+    RECT client = { wnd->rcClient.left, wnd->rcClient.top, wnd->rcClient.right, wnd->rcClient.bottom };
+    RECT rect = client;
+    if (read_guest_rect(rect_ptr, &rect)) {
+        rect.left += client.left;
+        rect.top += client.top;
+        rect.right += client.left;
+        rect.bottom += client.top;
+        if (rect.left < client.left) rect.left = client.left;
+        if (rect.top < client.top) rect.top = client.top;
+        if (rect.right > client.right) rect.right = client.right;
+        if (rect.bottom > client.bottom) rect.bottom = client.bottom;
+    }
+
+    if (rect.left >= rect.right || rect.top >= rect.bottom) {
+        EAX = 1;
+        return STATUS_SUCCESS;
+    }
+
+    /* Accumulate into the update region */
+    gdi_region_t *update = wnd->hrgnUpdate ?
+        gdi_get_object(&g_gdi_handles, wnd->hrgnUpdate, GDI_OBJ_REGION) : NULL;
+    if (update) {
+        gdi_region_union_rect(update, &rect);
+    } else {
+        wnd->hrgnUpdate = gdi_create_rect_rgn(&g_gdi_handles, rect.left, rect.top,
+                                              rect.right, rect.bottom);
+    }
+
+    if (erase) {
+        wnd->state |= WNDS_SENDERASEBACKGROUND;
+        wnd->guest_dirty |= WNDD_STATE;
+    }
+    guest_wnd_sync(wnd);
+    msg_queue_update_paint(wnd);
+
     EAX = 1;
     return STATUS_SUCCESS;
 }
@@ -1282,11 +1851,11 @@ ntstatus_t sys_NtUserCallOneParam(void)
     uint32_t param = read_stack_arg(0);
     uint32_t routine = read_stack_arg(1);
 
-    (void)param;
-
     switch (routine) {
         case 21:  /* ONEPARAM_ROUTINE_GETINPUTEVENT */
-            EAX = 0;
+            /* MsgWaitForMultipleObjectsEx: param = MAKELONG(QS_*, MWMO_*),
+             * returns the queue event handle it adds to its wait */
+            EAX = msg_queue_set_wake_mask(msg_queue_current(), param);
             break;
         case 22:  /* ONEPARAM_ROUTINE_GETKEYBOARDLAYOUT */
             EAX = 0x04090409;  /* US English */
@@ -1366,10 +1935,15 @@ ntstatus_t win32k_syscall_dispatch(uint32_t syscall_num)
         }
     }
 
+    /* Execute queued GDI batch records before any win32k call */
+    gdi_batch_flush(&g_gdi_handles, g_display, cpu_state.seg_fs.base);
+
     uint32_t index = syscall_num - WIN32K_SYSCALL_BASE;
 
     switch (index) {
         /* GDI Syscalls */
+        case NtGdiArcInternal - WIN32K_SYSCALL_BASE:
+            return sys_NtGdiArcInternal();
         case NtGdiBitBlt - WIN32K_SYSCALL_BASE:
             return sys_NtGdiBitBlt();
         case NtGdiCreateBitmap - WIN32K_SYSCALL_BASE:
@@ -1380,20 +1954,34 @@ ntstatus_t win32k_syscall_dispatch(uint32_t syscall_num)
             return sys_NtGdiCreatePatternBrushInternal();
         case NtGdiCreatePen - WIN32K_SYSCALL_BASE:
             return sys_NtGdiCreatePen();
+        case NtGdiCombineRgn - WIN32K_SYSCALL_BASE:
+            return sys_NtGdiCombineRgn();
         case NtGdiCreateRectRgn - WIN32K_SYSCALL_BASE:
             return sys_NtGdiCreateRectRgn();
         case NtGdiCreateSolidBrush - WIN32K_SYSCALL_BASE:
             return sys_NtGdiCreateSolidBrush();
         case NtGdiDeleteObjectApp - WIN32K_SYSCALL_BASE:
             return sys_NtGdiDeleteObjectApp();
+        case NtGdiEllipse - WIN32K_SYSCALL_BASE:
+            return sys_NtGdiEllipse();
+        case NtGdiEqualRgn - WIN32K_SYSCALL_BASE:
+            return sys_NtGdiEqualRgn();
+        case NtGdiExcludeClipRect - WIN32K_SYSCALL_BASE:
+            return sys_NtGdiExcludeClipRect();
         case NtGdiExtGetObjectW - WIN32K_SYSCALL_BASE:
             return sys_NtGdiExtGetObjectW();
+        case NtGdiExtSelectClipRgn - WIN32K_SYSCALL_BASE:
+            return sys_NtGdiExtSelectClipRgn();
         case NtGdiExtTextOutW - WIN32K_SYSCALL_BASE:
             return sys_NtGdiExtTextOutW();
         case NtGdiFillRgn - WIN32K_SYSCALL_BASE:
             return sys_NtGdiFillRgn();
         case NtGdiFlush - WIN32K_SYSCALL_BASE:
             return sys_NtGdiFlush();
+        case NtGdiFrameRgn - WIN32K_SYSCALL_BASE:
+            return sys_NtGdiFrameRgn();
+        case NtGdiGetAppClipBox - WIN32K_SYSCALL_BASE:
+            return sys_NtGdiGetAppClipBox();
         case NtGdiGetDCObject - WIN32K_SYSCALL_BASE:
             return sys_NtGdiGetDCObject();
         case NtGdiGetAndSetDCDword - WIN32K_SYSCALL_BASE:
@@ -1404,6 +1992,8 @@ ntstatus_t win32k_syscall_dispatch(uint32_t syscall_num)
             return sys_NtGdiGetDCPoint();
         case NtGdiGetPixel - WIN32K_SYSCALL_BASE:
             return sys_NtGdiGetPixel();
+        case NtGdiGetRgnBox - WIN32K_SYSCALL_BASE:
+            return sys_NtGdiGetRgnBox();
         case NtGdiGetStockObject - WIN32K_SYSCALL_BASE:
             return sys_NtGdiGetStockObject();
         case NtGdiGetTextExtent - WIN32K_SYSCALL_BASE:
@@ -1414,18 +2004,34 @@ ntstatus_t win32k_syscall_dispatch(uint32_t syscall_num)
             return sys_NtGdiHfontCreate();
         case NtGdiInit - WIN32K_SYSCALL_BASE:
             return sys_NtGdiInit();
+        case NtGdiIntersectClipRect - WIN32K_SYSCALL_BASE:
+            return sys_NtGdiIntersectClipRect();
+        case NtGdiInvertRgn - WIN32K_SYSCALL_BASE:
+            return sys_NtGdiInvertRgn();
         case NtGdiLineTo - WIN32K_SYSCALL_BASE:
             return sys_NtGdiLineTo();
         case NtGdiMoveTo - WIN32K_SYSCALL_BASE:
             return sys_NtGdiMoveTo();
+        case NtGdiOffsetClipRgn - WIN32K_SYSCALL_BASE:
+            return sys_NtGdiOffsetClipRgn();
+        case NtGdiOffsetRgn - WIN32K_SYSCALL_BASE:
+            return sys_NtGdiOffsetRgn();
         case NtGdiOpenDCW - WIN32K_SYSCALL_BASE:
             return sys_NtGdiOpenDCW();
         case NtGdiPatBlt - WIN32K_SYSCALL_BASE:
             return sys_NtGdiPatBlt();
+        case NtGdiPolyPolyDraw - WIN32K_SYSCALL_BASE:
+            return sys_NtGdiPolyPolyDraw();
+        case NtGdiPtInRegion - WIN32K_SYSCALL_BASE:
+            return sys_NtGdiPtInRegion();
         case NtGdiRectangle - WIN32K_SYSCALL_BASE:
             return sys_NtGdiRectangle();
+        case NtGdiRectInRegion - WIN32K_SYSCALL_BASE:
+            return sys_NtGdiRectInRegion();
         case NtGdiRestoreDC - WIN32K_SYSCALL_BASE:
             return sys_NtGdiRestoreDC();
+        case NtGdiRoundRect - WIN32K_SYSCALL_BASE:
+            return sys_NtGdiRoundRect();
         case NtGdiSaveDC - WIN32K_SYSCALL_BASE:
             return sys_NtGdiSaveDC();
         case NtGdiSelectBitmap - WIN32K_SYSCALL_BASE:
@@ -1440,6 +2046,10 @@ ntstatus_t win32k_syscall_dispatch(uint32_t syscall_num)
             return sys_NtGdiSetBrushOrg();
         case NtGdiSetPixel - WIN32K_SYSCALL_BASE:
             return sys_NtGdiSetPixel();
+        case NtGdiSetRectRgn - WIN32K_SYSCALL_BASE:
+            return sys_NtGdiSetRectRgn();
+        case NtGdiStretchBlt - WIN32K_SYSCALL_BASE:
+            return sys_NtGdiStretchBlt();
 
         /* User Syscalls */
         case NtUserBeginPaint - WIN32K_SYSCALL_BASE:
@@ -1484,18 +2094,30 @@ ntstatus_t win32k_syscall_dispatch(uint32_t syscall_num)
             return sys_NtUserCreateWindowEx();
         case NtUserShowWindow - WIN32K_SYSCALL_BASE:
             return sys_NtUserShowWindow();
+        case NtUserSetWindowLong - WIN32K_SYSCALL_BASE:
+            return sys_NtUserSetWindowLong();
+        case NtUserSetWindowPos - WIN32K_SYSCALL_BASE:
+            return sys_NtUserSetWindowPos();
 
         /* Message queue syscalls */
         case NtUserPeekMessage - WIN32K_SYSCALL_BASE:
             return sys_NtUserPeekMessage();
         case NtUserGetMessage - WIN32K_SYSCALL_BASE:
             return sys_NtUserGetMessage();
+        case NtUserWaitMessage - WIN32K_SYSCALL_BASE:
+            return sys_NtUserWaitMessage();
         case NtUserTranslateMessage - WIN32K_SYSCALL_BASE:
             return sys_NtUserTranslateMessage();
         case NtUserDispatchMessage - WIN32K_SYSCALL_BASE:
             return sys_NtUserDispatchMessage();
         case NtUserPostMessage - WIN32K_SYSCALL_BASE:
             return sys_NtUserPostMessage();
+        case NtUserSetTimer - WIN32K_SYSCALL_BASE:
+            return sys_NtUserSetTimer();
+        case NtUserSetSystemTimer - WIN32K_SYSCALL_BASE:
+            return sys_NtUserSetSystemTimer();
+        case NtUserKillTimer - WIN32K_SYSCALL_BASE:
+            return sys_NtUserKillTimer();
         case NtUserMessageCall - WIN32K_SYSCALL_BASE:
             return sys_NtUserMessageCall();
         case NtUserDefSetText - WIN32K_SYSCALL_BASE:
@@ -1508,6 +2130,8 @@ ntstatus_t win32k_syscall_dispatch(uint32_t syscall_num)
             return sys_NtUserGetForegroundWindow();
         case NtUserSetActiveWindow - WIN32K_SYSCALL_BASE:
             return sys_NtUserSetActiveWindow();
+        case NtUserSetCapture - WIN32K_SYSCALL_BASE:
+            return sys_NtUserSetCapture();
 
         /* Input syscalls */
         case NtUserGetKeyState - WIN32K_SYSCALL_BASE:
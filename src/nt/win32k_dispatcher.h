@@ -51,6 +51,7 @@ ntstatus_t sys_NtGdiSelectBitmap(void);
 ntstatus_t sys_NtGdiGetAndSetDCDword(void);
 ntstatus_t sys_NtGdiPatBlt(void);
 ntstatus_t sys_NtGdiBitBlt(void);
+ntstatus_t sys_NtGdiStretchBlt(void);
 ntstatus_t sys_NtGdiExtTextOutW(void);
 ntstatus_t sys_NtGdiGetTextExtent(void);
 ntstatus_t sys_NtGdiGetTextExtentExW(void);
@@ -58,7 +59,25 @@ ntstatus_t sys_NtGdiCreateSolidBrush(void);
 ntstatus_t sys_NtGdiCreatePen(void);
 ntstatus_t sys_NtGdiCreateRectRgn(void);
 ntstatus_t sys_NtGdiFillRgn(void);
+ntstatus_t sys_NtGdiCombineRgn(void);
+ntstatus_t sys_NtGdiSetRectRgn(void);
+ntstatus_t sys_NtGdiOffsetRgn(void);
+ntstatus_t sys_NtGdiGetRgnBox(void);
+ntstatus_t sys_NtGdiPtInRegion(void);
+ntstatus_t sys_NtGdiRectInRegion(void);
+ntstatus_t sys_NtGdiEqualRgn(void);
+ntstatus_t sys_NtGdiInvertRgn(void);
+ntstatus_t sys_NtGdiFrameRgn(void);
+ntstatus_t sys_NtGdiExtSelectClipRgn(void);
+ntstatus_t sys_NtGdiIntersectClipRect(void);
+ntstatus_t sys_NtGdiExcludeClipRect(void);
+ntstatus_t sys_NtGdiOffsetClipRgn(void);
+ntstatus_t sys_NtGdiGetAppClipBox(void);
 ntstatus_t sys_NtGdiRectangle(void);
+ntstatus_t sys_NtGdiEllipse(void);
+ntstatus_t sys_NtGdiRoundRect(void);
+ntstatus_t sys_NtGdiArcInternal(void);
+ntstatus_t sys_NtGdiPolyPolyDraw(void);
 ntstatus_t sys_NtGdiGetDeviceCaps(void);
 ntstatus_t sys_NtGdiSetPixel(void);
 ntstatus_t sys_NtGdiGetPixel(void);
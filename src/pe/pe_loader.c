@@ -8,6 +8,13 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 /* DOS header (simplified) */
 typedef struct {
     uint16_t e_magic;      /* MZ signature */
@@ -91,7 +98,8 @@ typedef struct {
     uint32_t characteristics;
 } section_header_t;
 
-static int read_file(const char *path, uint8_t **data, size_t *size)
+#ifdef _WIN32
+static int read_file(const char *path, pe_image_t *pe)
 {
     FILE *f = fopen(path, "rb");
     if (!f) {
@@ -109,31 +117,82 @@ static int read_file(const char *path, uint8_t **data, size_t *size)
         return -1;
     }
 
-    *data = malloc(len);
-    if (!*data) {
+    uint8_t *data = malloc(len);
+    if (!data) {
         fprintf(stderr, "pe_load: out of memory\n");
         fclose(f);
         return -1;
     }
 
-    if (fread(*data, 1, len, f) != (size_t)len) {
+    if (fread(data, 1, len, f) != (size_t)len) {
         fprintf(stderr, "pe_load: read error on '%s'\n", path);
-        free(*data);
+        free(data);
         fclose(f);
         return -1;
     }
 
     fclose(f);
-    *size = len;
+    pe->file_data = data;
+    pe->file_size = len;
+    pe->file_mapped = false;
+    return 0;
+}
+#else
+/*
+ * Map the file read-only. Pages are faulted in from the page cache as the
+ * headers, directories and sections are touched, and shared with every
+ * other load of the same file.
+ */
+static int read_file(const char *path, pe_image_t *pe)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "pe_load: cannot open file '%s'\n", path);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+        fprintf(stderr, "pe_load: empty or invalid file '%s'\n", path);
+        close(fd);
+        return -1;
+    }
+
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "pe_load: cannot map '%s'\n", path);
+        return -1;
+    }
+
+    pe->file_data = data;
+    pe->file_size = (size_t)st.st_size;
+    pe->file_mapped = true;
+
+    pe->file_id.dev = (uint64_t)st.st_dev;
+    pe->file_id.ino = (uint64_t)st.st_ino;
+    pe->file_id.size = (uint64_t)st.st_size;
+#ifdef __APPLE__
+    pe->file_id.mtime_sec = st.st_mtimespec.tv_sec;
+    pe->file_id.mtime_nsec = st.st_mtimespec.tv_nsec;
+    pe->file_id.ctime_sec = st.st_ctimespec.tv_sec;
+    pe->file_id.ctime_nsec = st.st_ctimespec.tv_nsec;
+#else
+    pe->file_id.mtime_sec = st.st_mtim.tv_sec;
+    pe->file_id.mtime_nsec = st.st_mtim.tv_nsec;
+    pe->file_id.ctime_sec = st.st_ctim.tv_sec;
+    pe->file_id.ctime_nsec = st.st_ctim.tv_nsec;
+#endif
     return 0;
 }
+#endif
 
 int pe_load(const char *path, pe_image_t *pe)
 {
     memset(pe, 0, sizeof(*pe));
 
-    /* Read entire file into memory */
-    if (read_file(path, &pe->file_data, &pe->file_size) != 0) {
+    /* Map the file; everything below parses it in place */
+    if (read_file(path, pe) != 0) {
         return -1;
     }
 
@@ -178,6 +237,12 @@ int pe_load(const char *path, pe_image_t *pe)
         goto fail;
     }
 
+    size_t section_off = (size_t)pe_offset + 4 + sizeof(coff_header_t) + coff->size_of_optional_header;
+    if (section_off > size) {
+        fprintf(stderr, "pe_load: optional header past end of file\n");
+        goto fail;
+    }
+
     /* Parse optional header */
     optional_header32_t *opt = (optional_header32_t *)(data + pe_offset + 4 + sizeof(coff_header_t));
     if (opt->magic != IMAGE_NT_OPTIONAL_HDR32_MAGIC) {
@@ -203,6 +268,9 @@ int pe_load(const char *path, pe_image_t *pe)
     if (num_dirs > IMAGE_NUMBEROF_DIRECTORY_ENTRIES) {
         num_dirs = IMAGE_NUMBEROF_DIRECTORY_ENTRIES;
     }
+    if (num_dirs > (coff->size_of_optional_header - sizeof(optional_header32_t)) / 8) {
+        num_dirs = (coff->size_of_optional_header - sizeof(optional_header32_t)) / 8;
+    }
 
     uint8_t *dir_ptr = (uint8_t *)opt + sizeof(optional_header32_t);
     for (uint32_t i = 0; i < num_dirs; i++) {
@@ -223,7 +291,13 @@ int pe_load(const char *path, pe_image_t *pe)
         goto fail;
     }
 
-    uint8_t *section_ptr = data + pe_offset + 4 + sizeof(coff_header_t) + coff->size_of_optional_header;
+    /* A mapped file has nothing readable past its end */
+    if (section_off + (size_t)pe->num_sections * sizeof(section_header_t) > size) {
+        fprintf(stderr, "pe_load: section table past end of file\n");
+        goto fail;
+    }
+
+    uint8_t *section_ptr = data + section_off;
     for (uint16_t i = 0; i < pe->num_sections; i++) {
         section_header_t *sh = (section_header_t *)(section_ptr + i * sizeof(section_header_t));
 
@@ -248,8 +322,17 @@ fail:
 void pe_free(pe_image_t *pe)
 {
     if (pe->file_data) {
+#ifndef _WIN32
+        if (pe->file_mapped) {
+            munmap(pe->file_data, pe->file_size);
+        } else {
+            free(pe->file_data);
+        }
+#else
         free(pe->file_data);
+#endif
         pe->file_data = NULL;
+        pe->file_size = 0;
     }
     if (pe->sections) {
         free(pe->sections);
@@ -306,6 +389,129 @@ const void *pe_rva_to_ptr(const pe_image_t *pe, uint32_t rva)
     return pe->file_data + file_offset;
 }
 
+int pe_map_image(const pe_image_t *pe, uint8_t *image)
+{
+    uint32_t image_size = pe->size_of_image;
+
+    /* Headers */
+    uint32_t header_size = pe->size_of_headers;
+    if (header_size > pe->file_size) header_size = (uint32_t)pe->file_size;
+    if (header_size > image_size) header_size = image_size;
+    memcpy(image, pe->file_data, header_size);
+
+    for (uint16_t i = 0; i < pe->num_sections; i++) {
+        const pe_section_t *sec = &pe->sections[i];
+        uint32_t copy_size = (sec->raw_size < sec->virtual_size)
+                           ? sec->raw_size : sec->virtual_size;
+
+        if (sec->virtual_address > image_size ||
+            sec->virtual_size > image_size - sec->virtual_address) {
+            fprintf(stderr, "pe_map_image: section %s outside the image\n", sec->name);
+            return -1;
+        }
+        if (copy_size > 0 &&
+            (sec->raw_offset > pe->file_size || copy_size > pe->file_size - sec->raw_offset)) {
+            fprintf(stderr, "pe_map_image: section %s outside the file\n", sec->name);
+            return -1;
+        }
+
+        memcpy(image + sec->virtual_address, pe->file_data + sec->raw_offset, copy_size);
+    }
+
+    return 0;
+}
+
+int pe_relocate_image(const pe_image_t *pe, uint8_t *image, uint32_t new_base)
+{
+    const pe_data_directory_t *dir = &pe->data_dirs[IMAGE_DIRECTORY_ENTRY_BASERELOC];
+    uint32_t image_size = pe->size_of_image;
+    uint32_t delta = new_base - pe->image_base;
+
+    if (delta == 0 || dir->size == 0) {
+        return 0;
+    }
+    if (dir->virtual_address > image_size || dir->size > image_size - dir->virtual_address) {
+        fprintf(stderr, "pe_relocate_image: relocation directory outside the image\n");
+        return -1;
+    }
+
+    const uint8_t *block = image + dir->virtual_address;
+    const uint8_t *end = block + dir->size;
+    int applied = 0;
+
+    /* Blocks: page RVA, block size, then 16-bit entries (type:4, offset:12) */
+    while (end - block >= 8) {
+        uint32_t page_rva, block_size;
+        memcpy(&page_rva, block, 4);
+        memcpy(&block_size, block + 4, 4);
+
+        if (block_size == 0) {
+            break;
+        }
+        if (block_size < 8 || block_size > (size_t)(end - block) || page_rva >= image_size) {
+            fprintf(stderr, "pe_relocate_image: bad block at RVA 0x%08X\n", page_rva);
+            return -1;
+        }
+
+        uint8_t *page = image + page_rva;
+        uint32_t room = image_size - page_rva;   /* Bytes from page to image end */
+        const uint8_t *entry = block + 8;
+        uint32_t count = (block_size - 8) / 2;
+
+        for (uint32_t i = 0; i < count; i++) {
+            uint16_t e;
+            memcpy(&e, entry + i * 2, 2);
+            uint32_t off = e & 0xFFF;
+
+            switch (e >> 12) {
+                case IMAGE_REL_BASED_HIGHLOW:
+                    if (off + 4 <= room) {
+                        uint32_t v;
+                        memcpy(&v, page + off, 4);
+                        v += delta;
+                        memcpy(page + off, &v, 4);
+                        applied++;
+                    }
+                    break;
+
+                case IMAGE_REL_BASED_HIGH:
+                case IMAGE_REL_BASED_LOW:
+                    if (off + 2 <= room) {
+                        uint16_t v;
+                        memcpy(&v, page + off, 2);
+                        v += (e >> 12) == IMAGE_REL_BASED_HIGH ? (uint16_t)(delta >> 16)
+                                                               : (uint16_t)delta;
+                        memcpy(page + off, &v, 2);
+                        applied++;
+                    }
+                    break;
+
+                case IMAGE_REL_BASED_HIGHADJ:
+                    /* The next entry holds the low half of the value */
+                    if (i + 1 < count && off + 2 <= room) {
+                        uint16_t hi, lo;
+                        memcpy(&hi, page + off, 2);
+                        memcpy(&lo, entry + ++i * 2, 2);
+                        uint32_t v = ((uint32_t)hi << 16) + (uint32_t)(int32_t)(int16_t)lo;
+                        v += delta + 0x8000;
+                        hi = (uint16_t)(v >> 16);
+                        memcpy(page + off, &hi, 2);
+                        applied++;
+                    }
+                    break;
+
+                default:
+                    /* IMAGE_REL_BASED_ABSOLUTE is padding; others are not x86 */
+                    break;
+            }
+        }
+
+        block += block_size;
+    }
+
+    return applied;
+}
+
 void pe_dump_info(const pe_image_t *pe)
 {
     printf("PE Image Info:\n");
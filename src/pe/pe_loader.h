@@ -40,7 +40,10 @@
 
 /* Base relocation types */
 #define IMAGE_REL_BASED_ABSOLUTE         0
+#define IMAGE_REL_BASED_HIGH             1
+#define IMAGE_REL_BASED_LOW              2
 #define IMAGE_REL_BASED_HIGHLOW          3
+#define IMAGE_REL_BASED_HIGHADJ          4
 
 /* Section info */
 typedef struct {
@@ -58,6 +61,18 @@ typedef struct {
     uint32_t size;
 } pe_data_directory_t;
 
+/* Identity of an image file on disk (from stat), for caches keyed by file;
+ * all zero if unknown */
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t  mtime_sec;
+    int64_t  mtime_nsec;
+    int64_t  ctime_sec;
+    int64_t  ctime_nsec;
+} pe_file_id_t;
+
 /* Loaded PE image info */
 typedef struct {
     /* Image info from optional header */
@@ -75,9 +90,12 @@ typedef struct {
     /* Data directories */
     pe_data_directory_t data_dirs[IMAGE_NUMBEROF_DIRECTORY_ENTRIES];
 
-    /* Raw file data (owned by pe_image_t) */
+    /* Raw file data (owned by pe_image_t): a read-only mapping of the
+     * file, or a heap copy if file_mapped is false. Never written to. */
     uint8_t *file_data;
     size_t   file_size;
+    bool     file_mapped;
+    pe_file_id_t file_id;
 
     /* Subsystem info */
     uint16_t subsystem;
@@ -96,6 +114,8 @@ typedef struct {
 
 /*
  * Load a PE file from disk
+ * The file is mapped read-only and parsed in place; it stays mapped until
+ * pe_free.
  * Returns 0 on success, -1 on error
  */
 int pe_load(const char *path, pe_image_t *pe);
@@ -123,6 +143,23 @@ uint32_t pe_rva_to_file_offset(const pe_image_t *pe, uint32_t rva);
  */
 const void *pe_rva_to_ptr(const pe_image_t *pe, uint32_t rva);
 
+/*
+ * Lay out a PE image as it appears in memory
+ * Copies the headers and each section's raw data into image, which holds
+ * size_of_image bytes and must be zeroed beforehand; BSS and alignment
+ * gaps are left zero.
+ * Returns 0 on success, -1 if a section does not fit the image or file
+ */
+int pe_map_image(const pe_image_t *pe, uint8_t *image);
+
+/*
+ * Apply base relocations to an image mapped by pe_map_image
+ * The relocation blocks are read from the mapped image and the fixups
+ * patched in place for a load at new_base.
+ * Returns the number of fixups applied, or -1 on malformed relocations
+ */
+int pe_relocate_image(const pe_image_t *pe, uint8_t *image, uint32_t new_base);
+
 /*
  * Print PE info to stdout (for debugging)
  */
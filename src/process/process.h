@@ -25,7 +25,9 @@
 #define TEB_LAST_ERROR          0x34  /* Last error value */
 #define TEB_WIN32_THREAD_INFO   0x40  /* Win32ThreadInfo (set by win32k) */
 #define TEB_TLS_SLOTS           0xE10 /* TLS slots array (64 slots) */
+#define TEB_GDI_BATCH_COUNT     0xF70 /* GdiBatchCount (records queued in GdiTebBatch) */
 #define TEB_ACTIVATION_CONTEXT_STACK_PTR 0x1A8 /* ActivationContextStackPointer */
+#define TEB_GDI_TEB_BATCH       0x1D4 /* GdiTebBatch: Offset, HDC, Buffer[310] */
 #define TEB_WIN32_CLIENT_INFO   0x6CC /* Win32ClientInfo[62] - 248 bytes for CLIENTINFO */
 #define TEB_SIZE                0x1000 /* Minimum TEB size */
 
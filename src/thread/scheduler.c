@@ -264,8 +264,12 @@ void scheduler_check_timeouts(wbox_scheduler_t *sched)
                 thread->wait_status = STATUS_TIMEOUT;
 
                 /* Update saved context's EAX to return the wait result
-                 * (syscall return value is passed via EAX) */
-                thread->context.eax = STATUS_TIMEOUT;
+                 * (syscall return value is passed via EAX). Restarted
+                 * syscalls keep the syscall number there instead. */
+                if (!thread->wait_restart) {
+                    thread->context.eax = STATUS_TIMEOUT;
+                }
+                thread->wait_restart = false;
 
                 /* Remove from wait lists */
                 for (int i = 0; i < thread->wait_count; i++) {
@@ -486,6 +490,76 @@ uint32_t scheduler_block_thread(wbox_scheduler_t *sched,
     return thread->wait_status;
 }
 
+bool scheduler_park_syscall(wbox_scheduler_t *sched,
+                            void **objects, int *types, int count,
+                            uint64_t timeout)
+{
+    (void)types;
+
+    if (!sched || !sched->current_thread || sched->current_thread->is_idle_thread) {
+        return false;
+    }
+
+    if (count > THREAD_WAIT_OBJECTS) {
+        return false;
+    }
+
+    wbox_thread_t *thread = sched->current_thread;
+
+    /* Set up wait blocks (always WaitAny; the syscall re-checks on restart) */
+    thread->wait_count = count;
+    thread->wait_type = WAIT_TYPE_ANY;
+    thread->wait_timeout = timeout;
+    thread->alertable = false;
+    thread->wait_restart = true;
+
+    for (int i = 0; i < count; i++) {
+        wbox_wait_block_t *wb = &thread->wait_blocks[i];
+        wb->thread = thread;
+        wb->object = objects[i];
+        wb->wait_key = i;
+        wb->next = NULL;
+
+        if (objects[i]) {
+            wbox_dispatcher_header_t *header = (wbox_dispatcher_header_t *)objects[i];
+            wb->next = (wbox_wait_block_t *)header->wait_list;
+            header->wait_list = (struct wbox_wait_block *)wb;
+        }
+    }
+
+    /* Save context with EIP back on the 2-byte SYSENTER. EAX still holds the
+     * syscall number and EDX the argument pointer, so resuming the thread
+     * simply issues the same syscall again. */
+    thread_save_context(thread);
+    thread->context.eip = cpu_state.pc - 2;
+
+    thread->state = THREAD_STATE_WAITING;
+    thread->wait_status = 0xDEADBEEF;
+    sched->syscall_parked = true;
+
+    /* Run something else. If nothing is ready this drops to the idle thread
+     * and stops the CPU; the main loop then sleeps until a wakeup. */
+    scheduler_switch(sched);
+    return true;
+}
+
+uint64_t scheduler_next_timeout(wbox_scheduler_t *sched)
+{
+    if (!sched) {
+        return 0;
+    }
+
+    uint64_t next = 0;
+    for (wbox_thread_t *thread = sched->all_threads; thread; thread = thread->next) {
+        if (thread->state == THREAD_STATE_WAITING && thread->wait_timeout != 0) {
+            if (next == 0 || thread->wait_timeout < next) {
+                next = thread->wait_timeout;
+            }
+        }
+    }
+    return next;
+}
+
 void scheduler_signal_object(wbox_scheduler_t *sched, void *object, int type)
 {
     if (!sched || !object) {
@@ -572,7 +646,10 @@ void scheduler_signal_object(wbox_scheduler_t *sched, void *object, int type)
             /* Wake the thread */
             thread->wait_status = wait_status;
             /* Update saved context's EAX to return the wait result */
-            thread->context.eax = wait_status;
+            if (!thread->wait_restart) {
+                thread->context.eax = wait_status;
+            }
+            thread->wait_restart = false;
             thread->wait_count = 0;
             thread->wait_timeout = 0;
             thread->state = THREAD_STATE_READY;
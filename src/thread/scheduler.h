@@ -35,6 +35,7 @@ typedef struct wbox_scheduler {
     bool idle;                          /* No runnable threads */
     bool preemption_pending;            /* Thread switch needed */
     uint64_t time_offset;               /* Offset added to system time (for fast-forwarding) */
+    bool syscall_parked;                /* Current syscall parked its thread (no return) */
 
     /* VM reference */
     struct vm_context *vm;
@@ -114,6 +115,31 @@ uint32_t scheduler_block_thread(wbox_scheduler_t *sched,
                                 wbox_wait_type_t wait_type, uint64_t timeout,
                                 bool alertable);
 
+/*
+ * Park the current thread inside a syscall until an object is signaled
+ * Unlike scheduler_block_thread this never waits on the host: the thread's
+ * context is rewound onto its SYSENTER so the whole syscall runs again once
+ * any object is signaled or the timeout expires, and the wait status is not
+ * delivered. Sets sched->syscall_parked; the caller must return without
+ * touching the guest registers, which may now belong to another thread.
+ * @param sched Scheduler
+ * @param objects Array of sync object pointers
+ * @param types Array of handle types for each object
+ * @param count Number of objects
+ * @param timeout Absolute timeout in 100ns units (0 = infinite)
+ * @return true if parked, false if the thread cannot be parked
+ */
+bool scheduler_park_syscall(wbox_scheduler_t *sched,
+                            void **objects, int *types, int count,
+                            uint64_t timeout);
+
+/*
+ * Get the earliest timeout of any waiting thread
+ * @param sched Scheduler
+ * @return Absolute timeout in 100ns units, 0 if no thread has one
+ */
+uint64_t scheduler_next_timeout(wbox_scheduler_t *sched);
+
 /*
  * Signal that an object has become signaled
  * Wakes threads waiting on this object as appropriate
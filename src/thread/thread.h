@@ -11,6 +11,7 @@
 /* Forward declarations */
 struct vm_context;
 struct wbox_scheduler;
+struct _WBOX_CALLBACK_STATE;
 union wbox_sync_object;
 
 /*
@@ -128,6 +129,7 @@ typedef struct wbox_thread {
     int wait_count;                             /* Number of objects being waited on */
     wbox_wait_type_t wait_type;                 /* WaitAll or WaitAny */
     bool alertable;                             /* Can be alerted during wait */
+    bool wait_restart;                          /* Re-run the blocked syscall on wake */
 
     /* Scheduling */
     int8_t priority;                            /* -15 to +15 */
@@ -148,6 +150,9 @@ typedef struct wbox_thread {
 
     /* Message queue (for GUI threads, NULL if not a GUI thread) */
     void *msg_queue;
+
+    /* Window procedure callbacks in progress, innermost first */
+    struct _WBOX_CALLBACK_STATE *callbacks;
 } wbox_thread_t;
 
 /*
@@ -13,6 +13,118 @@ static desktop_heap_t g_desktop_heap = {0};
 /* Cached VM context for memory writes */
 static vm_context_t *g_vm = NULL;
 
+/*
+ * Heap blocks
+ *
+ * Every block starts with a header holding its size and the size of the
+ * block before it, so a freed block merges with both neighbours in
+ * constant time. Free blocks sit on per-size-class lists, linked through
+ * their data. Data is cleared on free, so blocks come out of the heap
+ * zeroed and a stale WND or CLS reads as destroyed (handle 0).
+ */
+typedef struct {
+    uint32_t size;          /* Whole block, header included; bit 0 = in use */
+    uint32_t prev_size;     /* Size of the block before (0 for the first) */
+} heap_block_t;
+
+#define BLOCK_HEADER    8
+#define BLOCK_ALIGN     8
+#define BLOCK_USED      0x1u
+#define BLOCK_NONE      0xFFFFFFFFu
+
+/* Free-list links in a free block's data; offset 0 (the object handle)
+ * is left zero */
+#define FREE_NEXT       4
+#define FREE_PREV       8
+#define BLOCK_MIN       24      /* Header + links, aligned */
+
+static heap_block_t *block_at(uint32_t off)
+{
+    return (heap_block_t *)(g_desktop_heap.host_base + off);
+}
+
+static uint32_t *block_link(uint32_t off, uint32_t link)
+{
+    return (uint32_t *)(g_desktop_heap.host_base + off + BLOCK_HEADER + link);
+}
+
+static uint32_t block_size(uint32_t off)
+{
+    return block_at(off)->size & ~BLOCK_USED;
+}
+
+/* Size class: bin b holds blocks of 2^(b+4) up to 2^(b+5)-1 bytes */
+static int block_bin(uint32_t size)
+{
+    int bin = 0;
+    for (size >>= 5; size && bin < DESKTOP_HEAP_BINS - 1; size >>= 1) {
+        bin++;
+    }
+    return bin;
+}
+
+static void free_list_insert(uint32_t off)
+{
+    int bin = block_bin(block_size(off));
+    uint32_t head = g_desktop_heap.free_lists[bin];
+
+    *block_link(off, FREE_NEXT) = head;
+    *block_link(off, FREE_PREV) = BLOCK_NONE;
+    if (head != BLOCK_NONE) {
+        *block_link(head, FREE_PREV) = off;
+    }
+    g_desktop_heap.free_lists[bin] = off;
+}
+
+static void free_list_remove(uint32_t off)
+{
+    uint32_t next = *block_link(off, FREE_NEXT);
+    uint32_t prev = *block_link(off, FREE_PREV);
+
+    if (prev != BLOCK_NONE) {
+        *block_link(prev, FREE_NEXT) = next;
+    } else {
+        g_desktop_heap.free_lists[block_bin(block_size(off))] = next;
+    }
+    if (next != BLOCK_NONE) {
+        *block_link(next, FREE_PREV) = prev;
+    }
+
+    *block_link(off, FREE_NEXT) = 0;
+    *block_link(off, FREE_PREV) = 0;
+}
+
+/* Tell the block after off (if any) how big off is now */
+static void block_set_size(uint32_t off, uint32_t size, uint32_t used)
+{
+    block_at(off)->size = size | used;
+    if (off + size < DESKTOP_HEAP_SIZE) {
+        block_at(off + size)->prev_size = size;
+    }
+}
+
+/* Smallest free block of at least size bytes, or BLOCK_NONE */
+static uint32_t free_list_find(uint32_t size)
+{
+    int bin = block_bin(size);
+
+    /* Blocks in the matching class may be too small; first fit */
+    for (uint32_t off = g_desktop_heap.free_lists[bin]; off != BLOCK_NONE;
+         off = *block_link(off, FREE_NEXT)) {
+        if (block_size(off) >= size) {
+            return off;
+        }
+    }
+
+    /* Any block of a larger class fits */
+    for (bin++; bin < DESKTOP_HEAP_BINS; bin++) {
+        if (g_desktop_heap.free_lists[bin] != BLOCK_NONE) {
+            return g_desktop_heap.free_lists[bin];
+        }
+    }
+    return BLOCK_NONE;
+}
+
 int desktop_heap_init(vm_context_t *vm)
 {
     if (g_desktop_heap.initialized) {
@@ -44,16 +156,22 @@ int desktop_heap_init(vm_context_t *vm)
         return -1;
     }
 
-    /* Zero out the heap */
-    for (uint32_t i = 0; i < DESKTOP_HEAP_SIZE; i++) {
-        mem_writeb_phys(phys + i, 0);
-    }
-
     /* Initialize the context */
     g_desktop_heap.base_va = DESKTOP_HEAP_BASE_VA;
     g_desktop_heap.limit_va = DESKTOP_HEAP_LIMIT_VA;
     g_desktop_heap.phys_base = phys;
-    g_desktop_heap.alloc_offset = 0;
+    g_desktop_heap.host_base = ram + phys;
+    g_desktop_heap.used_bytes = 0;
+    g_desktop_heap.used_blocks = 0;
+
+    /* Zero out the heap; it starts as one free block */
+    memset(g_desktop_heap.host_base, 0, DESKTOP_HEAP_SIZE);
+    for (int i = 0; i < DESKTOP_HEAP_BINS; i++) {
+        g_desktop_heap.free_lists[i] = BLOCK_NONE;
+    }
+    block_set_size(0, DESKTOP_HEAP_SIZE, 0);
+    free_list_insert(0);
+
     g_desktop_heap.initialized = true;
 
     printf("USER: Desktop heap initialized at VA 0x%08X-0x%08X (phys 0x%08X)\n",
@@ -84,106 +202,135 @@ uint32_t desktop_heap_alloc(uint32_t size)
         return 0;
     }
 
-    if (size == 0) {
+    if (size == 0 || size > DESKTOP_HEAP_SIZE - BLOCK_HEADER) {
         return 0;
     }
 
-    /* Align size to 4 bytes */
-    size = (size + 3) & ~3;
+    /* Header + data, aligned to 8 bytes */
+    uint32_t need = (size + BLOCK_HEADER + BLOCK_ALIGN - 1) & ~(BLOCK_ALIGN - 1);
+    if (need < BLOCK_MIN) {
+        need = BLOCK_MIN;
+    }
 
-    /* Check if we have enough space */
-    if (g_desktop_heap.alloc_offset + size > DESKTOP_HEAP_SIZE) {
-        fprintf(stderr, "desktop_heap_alloc: out of space (need %u, have %u)\n",
-                size, DESKTOP_HEAP_SIZE - g_desktop_heap.alloc_offset);
+    uint32_t off = free_list_find(need);
+    if (off == BLOCK_NONE) {
+        fprintf(stderr, "desktop_heap_alloc: out of space (need %u, %u bytes in %u blocks in use)\n",
+                need, g_desktop_heap.used_bytes, g_desktop_heap.used_blocks);
         return 0;
     }
+    free_list_remove(off);
+
+    /* Split off the tail if it can hold a block of its own */
+    uint32_t have = block_size(off);
+    if (have - need >= BLOCK_MIN) {
+        block_set_size(off + need, have - need, 0);
+        block_at(off + need)->prev_size = need;
+        free_list_insert(off + need);
+        have = need;
+    }
+    block_set_size(off, have, BLOCK_USED);
 
-    /* Calculate virtual address */
-    uint32_t va = g_desktop_heap.base_va + g_desktop_heap.alloc_offset;
-
-    /* Advance allocation pointer */
-    g_desktop_heap.alloc_offset += size;
+    g_desktop_heap.used_bytes += have;
+    g_desktop_heap.used_blocks++;
 
-    return va;
+    return g_desktop_heap.base_va + off + BLOCK_HEADER;
 }
 
-void desktop_heap_write(uint32_t va, const void *data, uint32_t size)
+void desktop_heap_free(uint32_t va)
 {
-    if (!g_desktop_heap.initialized || !data || size == 0) {
+    if (!g_desktop_heap.initialized || va == 0) {
         return;
     }
 
-    /* Validate address is within heap */
-    if (va < g_desktop_heap.base_va || va + size > g_desktop_heap.limit_va) {
-        fprintf(stderr, "desktop_heap_write: address 0x%08X out of range\n", va);
+    uint32_t off = va - g_desktop_heap.base_va - BLOCK_HEADER;
+    if (va < g_desktop_heap.base_va + BLOCK_HEADER || va >= g_desktop_heap.limit_va ||
+        (off & (BLOCK_ALIGN - 1)) || !(block_at(off)->size & BLOCK_USED)) {
+        fprintf(stderr, "desktop_heap_free: 0x%08X is not an allocated block\n", va);
         return;
     }
 
-    /* Calculate physical address */
-    uint32_t offset = va - g_desktop_heap.base_va;
-    uint32_t phys = g_desktop_heap.phys_base + offset;
+    uint32_t size = block_size(off);
+    g_desktop_heap.used_bytes -= size;
+    g_desktop_heap.used_blocks--;
+
+    memset(g_desktop_heap.host_base + off + BLOCK_HEADER, 0, size - BLOCK_HEADER);
+
+    /* Merge with a free block after... */
+    uint32_t next = off + size;
+    if (next < DESKTOP_HEAP_SIZE && !(block_at(next)->size & BLOCK_USED)) {
+        free_list_remove(next);
+        size += block_size(next);
+        memset(block_at(next), 0, BLOCK_HEADER);
+    }
 
-    /* Write data via physical memory */
-    const uint8_t *src = (const uint8_t *)data;
-    for (uint32_t i = 0; i < size; i++) {
-        mem_writeb_phys(phys + i, src[i]);
+    /* ...and before */
+    uint32_t prev_size = block_at(off)->prev_size;
+    if (prev_size && !(block_at(off - prev_size)->size & BLOCK_USED)) {
+        uint32_t prev = off - prev_size;
+        free_list_remove(prev);
+        size += prev_size;
+        memset(block_at(off), 0, BLOCK_HEADER);
+        off = prev;
     }
+
+    block_set_size(off, size, 0);
+    free_list_insert(off);
 }
 
-void desktop_heap_write32(uint32_t va, uint32_t value)
+/* Host address of [va, va+size), or NULL (logged) if outside the heap */
+static uint8_t *heap_range(const char *what, uint32_t va, uint32_t size)
 {
     if (!g_desktop_heap.initialized) {
-        return;
+        return NULL;
     }
 
-    if (va < g_desktop_heap.base_va || va + 4 > g_desktop_heap.limit_va) {
-        fprintf(stderr, "desktop_heap_write32: address 0x%08X out of range\n", va);
-        return;
+    if (va < g_desktop_heap.base_va || va + size > g_desktop_heap.limit_va) {
+        fprintf(stderr, "%s: address 0x%08X out of range\n", what, va);
+        return NULL;
     }
 
-    uint32_t offset = va - g_desktop_heap.base_va;
-    uint32_t phys = g_desktop_heap.phys_base + offset;
-
-    /* Write as little-endian */
-    mem_writeb_phys(phys + 0, (value >> 0) & 0xFF);
-    mem_writeb_phys(phys + 1, (value >> 8) & 0xFF);
-    mem_writeb_phys(phys + 2, (value >> 16) & 0xFF);
-    mem_writeb_phys(phys + 3, (value >> 24) & 0xFF);
+    return g_desktop_heap.host_base + (va - g_desktop_heap.base_va);
 }
 
-void desktop_heap_write16(uint32_t va, uint16_t value)
+void desktop_heap_write(uint32_t va, const void *data, uint32_t size)
 {
-    if (!g_desktop_heap.initialized) {
+    if (!data || size == 0) {
         return;
     }
 
-    if (va < g_desktop_heap.base_va || va + 2 > g_desktop_heap.limit_va) {
-        fprintf(stderr, "desktop_heap_write16: address 0x%08X out of range\n", va);
-        return;
+    uint8_t *dst = heap_range("desktop_heap_write", va, size);
+    if (dst) {
+        memcpy(dst, data, size);
     }
-
-    uint32_t offset = va - g_desktop_heap.base_va;
-    uint32_t phys = g_desktop_heap.phys_base + offset;
-
-    mem_writeb_phys(phys + 0, (value >> 0) & 0xFF);
-    mem_writeb_phys(phys + 1, (value >> 8) & 0xFF);
 }
 
-void desktop_heap_write8(uint32_t va, uint8_t value)
+void desktop_heap_write32(uint32_t va, uint32_t value)
 {
-    if (!g_desktop_heap.initialized) {
-        return;
+    uint8_t *dst = heap_range("desktop_heap_write32", va, 4);
+    if (dst) {
+        memcpy(dst, &value, 4);     /* Host and guest are little-endian */
     }
+}
 
-    if (va < g_desktop_heap.base_va || va + 1 > g_desktop_heap.limit_va) {
-        fprintf(stderr, "desktop_heap_write8: address 0x%08X out of range\n", va);
-        return;
+void desktop_heap_write16(uint32_t va, uint16_t value)
+{
+    uint8_t *dst = heap_range("desktop_heap_write16", va, 2);
+    if (dst) {
+        memcpy(dst, &value, 2);
     }
+}
 
-    uint32_t offset = va - g_desktop_heap.base_va;
-    uint32_t phys = g_desktop_heap.phys_base + offset;
+void desktop_heap_write8(uint32_t va, uint8_t value)
+{
+    uint8_t *dst = heap_range("desktop_heap_write8", va, 1);
+    if (dst) {
+        *dst = value;
+    }
+}
 
-    mem_writeb_phys(phys, value);
+void *desktop_heap_host_ptr(uint32_t va, uint32_t size)
+{
+    return heap_range("desktop_heap_host_ptr", va, size);
 }
 
 bool desktop_heap_contains(uint32_t va)
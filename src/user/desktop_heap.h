@@ -105,6 +105,9 @@
 #define LUNISTR_BUFFER          0x08  /* PWSTR Buffer (overlaps with bAnsi in union) */
 /* Actually the union makes this tricky - we need to check ReactOS layout carefully */
 
+/* Free lists of the desktop heap, by power-of-two size class */
+#define DESKTOP_HEAP_BINS       20
+
 /*
  * Desktop heap context
  */
@@ -112,7 +115,10 @@ typedef struct {
     uint32_t base_va;       /* Guest virtual address (0x01000000) */
     uint32_t limit_va;      /* End of heap (0x01100000) */
     uint32_t phys_base;     /* Physical memory base */
-    uint32_t alloc_offset;  /* Current allocation offset from base */
+    uint8_t *host_base;     /* Host mapping of the heap (contiguous in guest RAM) */
+    uint32_t free_lists[DESKTOP_HEAP_BINS];  /* First free block per size class */
+    uint32_t used_bytes;    /* Bytes in allocated blocks, headers included */
+    uint32_t used_blocks;   /* Number of allocated blocks */
     bool initialized;
 } desktop_heap_t;
 
@@ -135,11 +141,18 @@ desktop_heap_t *desktop_heap_get(void);
 
 /*
  * Allocate memory from the desktop heap
- * size: Bytes to allocate (will be 4-byte aligned)
- * Returns guest virtual address, or 0 on failure
+ * size: Bytes to allocate (will be 8-byte aligned)
+ * Returns guest virtual address of zeroed memory, or 0 on failure
  */
 uint32_t desktop_heap_alloc(uint32_t size);
 
+/*
+ * Return a block to the desktop heap
+ * va: Address returned by desktop_heap_alloc (0 is ignored)
+ * The block is cleared, so stale guest readers see a zero handle.
+ */
+void desktop_heap_free(uint32_t va);
+
 /*
  * Write data to the desktop heap at a specific offset
  * va: Guest virtual address in desktop heap
@@ -163,6 +176,13 @@ void desktop_heap_write16(uint32_t va, uint16_t value);
  */
 void desktop_heap_write8(uint32_t va, uint8_t value);
 
+/*
+ * Get a host pointer to size bytes of the desktop heap at va
+ * The heap is one contiguous block of guest RAM, so the pointer stays valid
+ * for the lifetime of the heap. Returns NULL if the range is out of bounds.
+ */
+void *desktop_heap_host_ptr(uint32_t va, uint32_t size);
+
 /*
  * Check if an address is within the desktop heap
  */
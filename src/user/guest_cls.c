@@ -57,10 +57,9 @@ uint32_t guest_cls_create(WBOX_CLS *host_cls)
 
 void guest_cls_destroy(uint32_t guest_va)
 {
-    /* With a bump allocator, we can't really free memory.
-     * Just mark as destroyed by clearing the atom. */
+    /* Freed blocks are cleared, so the CLS reads as destroyed (atom 0) */
     if (guest_va && desktop_heap_contains(guest_va)) {
-        desktop_heap_write16(guest_va + CLS_ATOMCLASSNAME, 0);
+        desktop_heap_free(guest_va);
     }
 }
 
@@ -17,6 +17,7 @@ uint32_t guest_cls_create(WBOX_CLS *host_cls);
 
 /*
  * Destroy a guest CLS structure
+ * Returns its memory to the desktop heap
  */
 void guest_cls_destroy(uint32_t guest_va);
 
@@ -7,7 +7,19 @@
 #include <stdio.h>
 #include <string.h>
 
-/* Forward declaration - we need user_window.h which already includes WBOX_WND */
+/* Store a field of a guest WND through its host mapping */
+static void wnd_put32(uint8_t *wnd, uint32_t offset, uint32_t value)
+{
+    memcpy(wnd + offset, &value, sizeof(value));
+}
+
+static void wnd_put_rect(uint8_t *wnd, uint32_t offset, const WBOX_RECT *rect)
+{
+    wnd_put32(wnd, offset + 0, (uint32_t)rect->left);
+    wnd_put32(wnd, offset + 4, (uint32_t)rect->top);
+    wnd_put32(wnd, offset + 8, (uint32_t)rect->right);
+    wnd_put32(wnd, offset + 12, (uint32_t)rect->bottom);
+}
 
 uint32_t guest_wnd_create(WBOX_WND *host_wnd)
 {
@@ -141,6 +153,10 @@ uint32_t guest_wnd_create(WBOX_WND *host_wnd)
         }
     }
 
+    /* Everything is written; later syncs only copy what changes */
+    host_wnd->guest_wnd = desktop_heap_host_ptr(guest_va, wnd_size);
+    host_wnd->guest_dirty = 0;
+
     printf("USER: Created guest WND at 0x%08X for hwnd 0x%08X (size %u)\n",
            guest_va, host_wnd->hwnd, wnd_size);
 
@@ -149,71 +165,68 @@ uint32_t guest_wnd_create(WBOX_WND *host_wnd)
 
 void guest_wnd_destroy(uint32_t guest_va)
 {
-    /* With a bump allocator, we can't really free memory.
-     * In a real implementation we'd use a proper heap allocator.
-     * For now, just mark the WND as destroyed by clearing the handle. */
+    /* Freed blocks are cleared, so the WND reads as destroyed (handle 0) */
     if (guest_va && desktop_heap_contains(guest_va)) {
-        desktop_heap_write32(guest_va + WND_HEAD_H, 0);
+        desktop_heap_free(guest_va);
     }
 }
 
 void guest_wnd_sync(WBOX_WND *host_wnd)
 {
-    if (!host_wnd || !host_wnd->guest_wnd_va) {
+    if (!host_wnd || !host_wnd->guest_wnd || !host_wnd->guest_dirty) {
         return;
     }
 
-    uint32_t guest_va = host_wnd->guest_wnd_va;
+    uint8_t *wnd = host_wnd->guest_wnd;
+    uint32_t dirty = host_wnd->guest_dirty;
+    host_wnd->guest_dirty = 0;
 
-    /* Update state */
-    desktop_heap_write32(guest_va + WND_STATE, host_wnd->state);
-    desktop_heap_write32(guest_va + WND_STATE2, host_wnd->state2);
+    if (dirty & WNDD_STATE) {
+        wnd_put32(wnd, WND_STATE, host_wnd->state);
+        wnd_put32(wnd, WND_STATE2, host_wnd->state2);
+    }
 
-    /* Update styles */
-    desktop_heap_write32(guest_va + WND_EXSTYLE, host_wnd->exStyle);
-    desktop_heap_write32(guest_va + WND_STYLE, host_wnd->style);
+    if (dirty & WNDD_STYLE) {
+        wnd_put32(wnd, WND_EXSTYLE, host_wnd->exStyle);
+        wnd_put32(wnd, WND_STYLE, host_wnd->style);
+    }
 
-    /* Update rectangles */
-    desktop_heap_write32(guest_va + WND_RCWINDOW + 0, (uint32_t)host_wnd->rcWindow.left);
-    desktop_heap_write32(guest_va + WND_RCWINDOW + 4, (uint32_t)host_wnd->rcWindow.top);
-    desktop_heap_write32(guest_va + WND_RCWINDOW + 8, (uint32_t)host_wnd->rcWindow.right);
-    desktop_heap_write32(guest_va + WND_RCWINDOW + 12, (uint32_t)host_wnd->rcWindow.bottom);
+    if (dirty & WNDD_RECTS) {
+        wnd_put_rect(wnd, WND_RCWINDOW, &host_wnd->rcWindow);
+        wnd_put_rect(wnd, WND_RCCLIENT, &host_wnd->rcClient);
+    }
 
-    desktop_heap_write32(guest_va + WND_RCCLIENT + 0, (uint32_t)host_wnd->rcClient.left);
-    desktop_heap_write32(guest_va + WND_RCCLIENT + 4, (uint32_t)host_wnd->rcClient.top);
-    desktop_heap_write32(guest_va + WND_RCCLIENT + 8, (uint32_t)host_wnd->rcClient.right);
-    desktop_heap_write32(guest_va + WND_RCCLIENT + 12, (uint32_t)host_wnd->rcClient.bottom);
+    if (dirty & WNDD_WNDPROC) {
+        wnd_put32(wnd, WND_LPFNWNDPROC, host_wnd->lpfnWndProc);
+    }
 
-    /* Update window procedure */
-    desktop_heap_write32(guest_va + WND_LPFNWNDPROC, host_wnd->lpfnWndProc);
+    if (dirty & WNDD_HINSTANCE) {
+        wnd_put32(wnd, WND_HMODULE, host_wnd->hInstance);
+    }
 
-    /* Update user data */
-    desktop_heap_write32(guest_va + WND_DWUSERDATA, host_wnd->dwUserData);
+    if (dirty & WNDD_USERDATA) {
+        wnd_put32(wnd, WND_DWUSERDATA, host_wnd->dwUserData);
+    }
 
-    /* Update menu */
-    desktop_heap_write32(guest_va + WND_IDMENU, host_wnd->IDMenu);
+    if (dirty & WNDD_MENU) {
+        wnd_put32(wnd, WND_IDMENU, host_wnd->IDMenu);
+    }
 }
 
 void guest_wnd_update_hierarchy(WBOX_WND *host_wnd)
 {
-    if (!host_wnd || !host_wnd->guest_wnd_va) {
+    if (!host_wnd || !host_wnd->guest_wnd) {
         return;
     }
 
-    uint32_t guest_va = host_wnd->guest_wnd_va;
+    uint8_t *wnd = host_wnd->guest_wnd;
 
     /* Get guest VAs for linked windows */
-    uint32_t next_va = guest_wnd_get_va(host_wnd->spwndNext);
-    uint32_t prev_va = guest_wnd_get_va(host_wnd->spwndPrev);
-    uint32_t parent_va = guest_wnd_get_va(host_wnd->spwndParent);
-    uint32_t child_va = guest_wnd_get_va(host_wnd->spwndChild);
-    uint32_t owner_va = guest_wnd_get_va(host_wnd->spwndOwner);
-
-    desktop_heap_write32(guest_va + WND_SPWNDNEXT, next_va);
-    desktop_heap_write32(guest_va + WND_SPWNDPREV, prev_va);
-    desktop_heap_write32(guest_va + WND_SPWNDPARENT, parent_va);
-    desktop_heap_write32(guest_va + WND_SPWNDCHILD, child_va);
-    desktop_heap_write32(guest_va + WND_SPWNDOWNER, owner_va);
+    wnd_put32(wnd, WND_SPWNDNEXT, guest_wnd_get_va(host_wnd->spwndNext));
+    wnd_put32(wnd, WND_SPWNDPREV, guest_wnd_get_va(host_wnd->spwndPrev));
+    wnd_put32(wnd, WND_SPWNDPARENT, guest_wnd_get_va(host_wnd->spwndParent));
+    wnd_put32(wnd, WND_SPWNDCHILD, guest_wnd_get_va(host_wnd->spwndChild));
+    wnd_put32(wnd, WND_SPWNDOWNER, guest_wnd_get_va(host_wnd->spwndOwner));
 }
 
 void guest_wnd_set_dialog_pointer(uint32_t guest_va, uint32_t dialog_info)
@@ -17,13 +17,15 @@ uint32_t guest_wnd_create(WBOX_WND *host_wnd);
 
 /*
  * Destroy a guest WND structure
- * Note: Currently just marks it as free since we use a bump allocator
+ * Returns its memory to the desktop heap
  */
 void guest_wnd_destroy(uint32_t guest_va);
 
 /*
  * Synchronize host WBOX_WND data to guest WND
- * Call this after modifying WBOX_WND fields to update the guest copy
+ * Copies only the fields flagged in host_wnd->guest_dirty (WNDD_*) and
+ * clears the flags. Set the flags when modifying WBOX_WND fields, then call
+ * this to update the guest copy.
  */
 void guest_wnd_sync(WBOX_WND *host_wnd);
 
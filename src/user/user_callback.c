@@ -9,10 +9,12 @@
 #include "../vm/vm.h"
 #include "../vm/paging.h"
 #include "../process/process.h"
+#include "../thread/thread.h"
 #include "../cpu/cpu.h"
 #include "../cpu/mem.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 /* TEB address (standard Windows) */
@@ -41,15 +43,24 @@ static void clear_callbackwnd_cache(void)
     writememll(clientinfo_va + CI_CALLBACKWND_PACTCTX, 0);
 }
 
-/* Callback stack for nested calls */
-WBOX_CALLBACK_STATE g_callback_stack[MAX_CALLBACK_DEPTH];
-int g_callback_depth = 0;
+/* Callbacks in progress in host context (no guest thread running) */
+static WBOX_CALLBACK_STATE *g_host_callbacks = NULL;
+
+/* Set when a syscall has set up the guest to run on (callback or restart) */
+static bool g_callback_entered = false;
 
 /* Address of the WndProc return stub in guest memory */
 static uint32_t g_wndproc_return_stub = 0;
 
-/* Flag to request callback exit */
-static volatile bool g_callback_exit_requested = false;
+/* Innermost callback of the running thread */
+static WBOX_CALLBACK_STATE **callback_stack(void)
+{
+    wbox_thread_t *thread = thread_get_current();
+    if (thread && !thread->is_idle_thread) {
+        return &thread->callbacks;
+    }
+    return &g_host_callbacks;
+}
 
 int user_callback_init(vm_context_t *vm)
 {
@@ -88,30 +99,11 @@ int user_callback_init(vm_context_t *vm)
     mem_writeb_phys(kusd_phys + stub_offset + 9, 0xCC);  /* INT3 - should never reach */
 
     g_wndproc_return_stub = stub_va;
-    g_callback_depth = 0;
 
     printf("WndProc return stub at 0x%08X\n", stub_va);
     return 0;
 }
 
-uint32_t user_call_wndproc(vm_context_t *vm, WBOX_WND *wnd,
-                           uint32_t msg, uint32_t wParam, uint32_t lParam)
-{
-    if (!wnd) return 0;
-
-    /* Get WndProc address */
-    uint32_t wndproc = wnd->lpfnWndProc;
-    if (wndproc == 0 && wnd->pcls) {
-        wndproc = wnd->pcls->lpfnWndProc;
-    }
-
-    if (wndproc == 0) {
-        return 0;
-    }
-
-    return user_call_wndproc_addr(vm, wndproc, wnd->hwnd, msg, wParam, lParam);
-}
-
 /*
  * WINDOWPROC_CALLBACK_ARGUMENTS structure offsets (from ReactOS callback.h)
  * Total size: 32 bytes
@@ -174,69 +166,50 @@ static inline bool is_atom(uint32_t val)
 /* Callback index for window procedure */
 #define USER32_CALLBACK_WINDOWPROC 0
 
-uint32_t user_call_wndproc_addr(vm_context_t *vm, uint32_t wndproc,
-                                uint32_t hwnd, uint32_t msg,
-                                uint32_t wParam, uint32_t lParam)
+/* Run the continuation of a callback that is not made (no procedure) */
+static ntstatus_t callback_finish_now(user_callback_cont_t cont, const uint32_t *ctx)
 {
-    if (!vm || wndproc == 0) return 0;
-
-    /* Check callback depth */
-    if (g_callback_depth >= MAX_CALLBACK_DEPTH) {
-        fprintf(stderr, "user_call_wndproc: Callback depth exceeded!\n");
-        return 0;
+    uint32_t local[USER_CALLBACK_CTX_WORDS] = {0};
+    if (ctx) {
+        memcpy(local, ctx, sizeof(local));
     }
-
-    /* Check that return stub is initialized */
-    if (g_wndproc_return_stub == 0) {
-        /* Initialize on first use */
-        if (user_callback_init(vm) != 0) {
-            return 0;
-        }
+    if (!cont) {
+        EAX = 0;
+        return STATUS_SUCCESS;
     }
+    return cont(0, local);
+}
 
+/*
+ * Point the guest at User32CallWindowProcFromKernel with a
+ * WINDOWPROC_CALLBACK_ARGUMENTS block on its stack
+ * Returns false if user32 has not registered its callback table.
+ */
+static bool enter_kernel_callback(WBOX_CALLBACK_STATE *state, uint32_t wndproc,
+                                  uint32_t hwnd, uint32_t msg,
+                                  uint32_t wParam, uint32_t lParam)
+{
     /* Get PEB address from TEB (TEB+0x30 = PEB pointer) */
-    uint32_t teb_va = 0x7FFDF000;  /* Standard TEB address */
-    uint32_t peb_va = readmemll(teb_va + 0x30);
+    uint32_t peb_va = readmemll(TEB_VA + 0x30);
     if (peb_va == 0) {
         fprintf(stderr, "user_call_wndproc: Cannot read PEB address from TEB\n");
-        return 0;
+        return false;
     }
 
     /* Read KernelCallbackTable from PEB */
     uint32_t callback_table = readmemll(peb_va + PEB_KERNELCALLBACKTABLE);
     if (callback_table == 0) {
         fprintf(stderr, "user_call_wndproc: KernelCallbackTable not set - falling back to direct call\n");
-        /* Fall back to direct WndProc call (old behavior) */
-        goto direct_call;
+        return false;
     }
 
     /* Read User32CallWindowProcFromKernel address from callback table */
     uint32_t callback_handler = readmemll(callback_table + USER32_CALLBACK_WINDOWPROC * 4);
     if (callback_handler == 0) {
         fprintf(stderr, "user_call_wndproc: WindowProc callback handler not set\n");
-        goto direct_call;
+        return false;
     }
 
-    fprintf(stderr, "USER: Using kernel callback mechanism (handler=0x%08X)\n", callback_handler);
-
-    /* Get current callback state slot */
-    WBOX_CALLBACK_STATE *state = &g_callback_stack[g_callback_depth];
-    g_callback_depth++;
-
-    /* Save current CPU state */
-    state->saved_eip = cpu_state.pc;
-    state->saved_esp = ESP;
-    state->saved_eax = EAX;
-    state->saved_ebx = EBX;
-    state->saved_ecx = ECX;
-    state->saved_edx = EDX;
-    state->saved_esi = ESI;
-    state->saved_edi = EDI;
-    state->saved_ebp = EBP;
-    state->active = true;
-    state->completed = false;
-    state->result = 0;
-
     /* Calculate argument size and allocate on stack
      * For WM_NCCREATE/WM_CREATE, we need to serialize CREATESTRUCT with strings
      * Buffer layout: [WPCB_ARGS(32)][CREATESTRUCT(48)][lpszName][lpszClass]
@@ -368,45 +341,142 @@ uint32_t user_call_wndproc_addr(vm_context_t *vm, uint32_t wndproc,
 
     fprintf(stderr, "USER: Calling callback 0x%08X(args=0x%X, len=%d) for WndProc 0x%08X(hwnd=0x%X, msg=0x%X)\n",
             callback_handler, args_va, arg_length, wndproc, hwnd, msg);
+    return true;
+}
+
+/* Fallback: call WndProc(hwnd, msg, wParam, lParam) directly */
+static void enter_direct_call(uint32_t wndproc, uint32_t hwnd, uint32_t msg,
+                              uint32_t wParam, uint32_t lParam)
+{
+    /* Set up stdcall stack frame for WndProc(hwnd, msg, wParam, lParam) */
+    ESP -= 4; writememll(ESP, lParam);
+    ESP -= 4; writememll(ESP, wParam);
+    ESP -= 4; writememll(ESP, msg);
+    ESP -= 4; writememll(ESP, hwnd);
+    ESP -= 4; writememll(ESP, g_wndproc_return_stub);
+
+    cpu_state.pc = wndproc;
+
+    fprintf(stderr, "USER: Direct call WndProc 0x%08X(hwnd=0x%X, msg=0x%X, wParam=0x%X, lParam=0x%X)\n",
+            wndproc, hwnd, msg, wParam, lParam);
+}
+
+ntstatus_t user_call_wndproc(vm_context_t *vm, WBOX_WND *wnd,
+                             uint32_t msg, uint32_t wParam, uint32_t lParam,
+                             user_callback_cont_t cont, const uint32_t *ctx)
+{
+    if (!wnd) {
+        return callback_finish_now(cont, ctx);
+    }
+
+    /* Get WndProc address */
+    uint32_t wndproc = wnd->lpfnWndProc;
+    if (wndproc == 0 && wnd->pcls) {
+        wndproc = wnd->pcls->lpfnWndProc;
+    }
+
+    return user_call_wndproc_addr(vm, wndproc, wnd->hwnd, msg, wParam, lParam, cont, ctx);
+}
+
+ntstatus_t user_call_wndproc_addr(vm_context_t *vm, uint32_t wndproc,
+                                  uint32_t hwnd, uint32_t msg,
+                                  uint32_t wParam, uint32_t lParam,
+                                  user_callback_cont_t cont, const uint32_t *ctx)
+{
+    if (!vm || wndproc == 0) {
+        return callback_finish_now(cont, ctx);
+    }
+
+    WBOX_CALLBACK_STATE **stack = callback_stack();
+    int depth = *stack ? (*stack)->depth : 0;
+
+    /* Check callback depth */
+    if (depth >= MAX_CALLBACK_DEPTH) {
+        fprintf(stderr, "user_call_wndproc: Callback depth exceeded!\n");
+        return callback_finish_now(cont, ctx);
+    }
+
+    /* Check that return stub is initialized */
+    if (g_wndproc_return_stub == 0) {
+        /* Initialize on first use */
+        if (user_callback_init(vm) != 0) {
+            return callback_finish_now(cont, ctx);
+        }
+    }
+
+    WBOX_CALLBACK_STATE *state = calloc(1, sizeof(WBOX_CALLBACK_STATE));
+    if (!state) {
+        return callback_finish_now(cont, ctx);
+    }
+
+    /* Save the CPU state of the syscall; EIP is just past its SYSENTER */
+    state->saved_eip = cpu_state.pc;
+    state->saved_esp = ESP;
+    state->saved_eax = EAX;
+    state->saved_ebx = EBX;
+    state->saved_ecx = ECX;
+    state->saved_edx = EDX;
+    state->saved_esi = ESI;
+    state->saved_edi = EDI;
+    state->saved_ebp = EBP;
+    state->cont = cont;
+    if (ctx) {
+        memcpy(state->ctx, ctx, sizeof(state->ctx));
+    }
+
+    if (!enter_kernel_callback(state, wndproc, hwnd, msg, wParam, lParam)) {
+        enter_direct_call(wndproc, hwnd, msg, wParam, lParam);
+    }
 
     /* Set CallbackWnd cache so ValidateHwnd can find the WND */
     WBOX_WND *wnd = user_window_from_hwnd(hwnd);
-    uint32_t guest_wnd_va = wnd ? wnd->guest_wnd_va : 0;
-    if (guest_wnd_va) {
-        set_callbackwnd_cache(hwnd, guest_wnd_va);
-        fprintf(stderr, "USER: Set CallbackWnd cache hwnd=0x%X pwnd=0x%X\n", hwnd, guest_wnd_va);
+    state->hwnd = hwnd;
+    state->guest_wnd_va = wnd ? wnd->guest_wnd_va : 0;
+    if (state->guest_wnd_va) {
+        set_callbackwnd_cache(hwnd, state->guest_wnd_va);
     }
 
-    /* Clear exit flag */
-    g_callback_exit_requested = false;
+    state->depth = depth + 1;
+    state->outer = *stack;
+    *stack = state;
 
-    /* Execute guest code until callback completes */
-    int max_iterations = 10000000;  /* Safety limit */
-    int iter = 0;
+    /* Back to the main loop, which now runs the window procedure */
+    g_callback_entered = true;
+    return STATUS_PENDING;
+}
 
-    while (!state->completed && !vm->exit_requested && iter < max_iterations) {
-        exec386(1000);
-        iter++;
-    }
+bool user_callback_entered(void)
+{
+    bool entered = g_callback_entered;
+    g_callback_entered = false;
+    return entered;
+}
 
-    if (iter >= max_iterations) {
-        fprintf(stderr, "user_call_wndproc: Callback timeout! hwnd=0x%X msg=0x%X\n",
-                hwnd, msg);
+user_callback_result_t user_callback_return(uint32_t result)
+{
+    WBOX_CALLBACK_STATE **stack = callback_stack();
+    WBOX_CALLBACK_STATE *state = *stack;
+    if (!state) {
+        fprintf(stderr, "user_callback_return: No active callback!\n");
+        return USER_CALLBACK_NONE;
     }
+    *stack = state->outer;
 
-    /* Get result (stored by user_callback_return) */
-    uint32_t result = state->result;
-    fprintf(stderr, "USER: WndProc returned 0x%X (iter=%d, completed=%d)\n",
-            result, iter, state->completed);
+    fprintf(stderr, "USER: WndProc returned 0x%X (hwnd=0x%X, depth=%d)\n",
+            result, state->hwnd, state->depth);
 
-    /* Clear CallbackWnd cache */
-    if (guest_wnd_va) {
+    /* The CallbackWnd cache belongs to the enclosing callback again */
+    WBOX_CALLBACK_STATE *outer = state->outer;
+    if (outer && outer->guest_wnd_va) {
+        set_callbackwnd_cache(outer->hwnd, outer->guest_wnd_va);
+    } else if (state->guest_wnd_va) {
         clear_callbackwnd_cache();
     }
 
-    /* Restore CPU state */
+    /* Back into the interrupted syscall */
     cpu_state.pc = state->saved_eip;
     ESP = state->saved_esp;
+    EAX = state->saved_eax;
     EBX = state->saved_ebx;
     ECX = state->saved_ecx;
     EDX = state->saved_edx;
@@ -414,112 +484,54 @@ uint32_t user_call_wndproc_addr(vm_context_t *vm, uint32_t wndproc,
     EDI = state->saved_edi;
     EBP = state->saved_ebp;
 
-    state->active = false;
-    g_callback_depth--;
-
-    /* Reset CPU exit flag since we're returning from a controlled callback */
-    cpu_exit_requested = 0;
-
-    return result;
-
-direct_call:
-    /* Fallback: direct WndProc call (old behavior) */
-    {
-        WBOX_CALLBACK_STATE *state = &g_callback_stack[g_callback_depth];
-        g_callback_depth++;
-
-        state->saved_eip = cpu_state.pc;
-        state->saved_esp = ESP;
-        state->saved_eax = EAX;
-        state->saved_ebx = EBX;
-        state->saved_ecx = ECX;
-        state->saved_edx = EDX;
-        state->saved_esi = ESI;
-        state->saved_edi = EDI;
-        state->saved_ebp = EBP;
-        state->active = true;
-        state->completed = false;
-        state->result = 0;
-        state->callback_args_va = 0;
-
-        /* Set up stdcall stack frame for WndProc(hwnd, msg, wParam, lParam) */
-        ESP -= 4; writememll(ESP, lParam);
-        ESP -= 4; writememll(ESP, wParam);
-        ESP -= 4; writememll(ESP, msg);
-        ESP -= 4; writememll(ESP, hwnd);
-        ESP -= 4; writememll(ESP, g_wndproc_return_stub);
-
-        cpu_state.pc = wndproc;
-
-        fprintf(stderr, "USER: Direct call WndProc 0x%08X(hwnd=0x%X, msg=0x%X, wParam=0x%X, lParam=0x%X)\n",
-                wndproc, hwnd, msg, wParam, lParam);
-
-        /* Set CallbackWnd cache */
-        WBOX_WND *dc_wnd = user_window_from_hwnd(hwnd);
-        uint32_t dc_guest_wnd_va = dc_wnd ? dc_wnd->guest_wnd_va : 0;
-        if (dc_guest_wnd_va) {
-            set_callbackwnd_cache(hwnd, dc_guest_wnd_va);
-        }
-
-        g_callback_exit_requested = false;
-        int max_iterations = 10000000;
-        int iter = 0;
-
-        while (!state->completed && !vm->exit_requested && iter < max_iterations) {
-            exec386(1000);
-            iter++;
-        }
+    user_callback_cont_t cont = state->cont;
+    uint32_t ctx[USER_CALLBACK_CTX_WORDS];
+    memcpy(ctx, state->ctx, sizeof(ctx));
+    free(state);
 
-        uint32_t result = state->result;
-        fprintf(stderr, "USER: WndProc returned 0x%X (iter=%d, completed=%d)\n",
-                result, iter, state->completed);
-
-        /* Clear CallbackWnd cache */
-        if (dc_guest_wnd_va) {
-            clear_callbackwnd_cache();
-        }
-
-        cpu_state.pc = state->saved_eip;
-        ESP = state->saved_esp;
-        EBX = state->saved_ebx;
-        ECX = state->saved_ecx;
-        EDX = state->saved_edx;
-        ESI = state->saved_esi;
-        EDI = state->saved_edi;
-        EBP = state->saved_ebp;
-
-        state->active = false;
-        g_callback_depth--;
-        cpu_exit_requested = 0;
+    ntstatus_t status = STATUS_SUCCESS;
+    if (cont) {
+        status = cont(result, ctx);
+    } else {
+        EAX = result;
+    }
 
-        return result;
+    if (status == STATUS_PENDING) {
+        /* A new callback or a restart has set up the guest already */
+        g_callback_entered = false;
+        return USER_CALLBACK_CONTINUED;
     }
+    return USER_CALLBACK_COMPLETE;
 }
 
-void user_callback_return(uint32_t result)
+ntstatus_t user_callback_restart_syscall(void)
 {
-    if (g_callback_depth <= 0) {
-        fprintf(stderr, "user_callback_return: No active callback!\n");
+    /* EAX and EDX are the syscall's again; back onto the 2-byte SYSENTER */
+    cpu_state.pc -= 2;
+    g_callback_entered = true;
+    return STATUS_PENDING;
+}
+
+void user_callback_thread_exit(wbox_thread_t *thread)
+{
+    if (!thread) {
         return;
     }
 
-    /* Get current callback state */
-    WBOX_CALLBACK_STATE *state = &g_callback_stack[g_callback_depth - 1];
-
-    /* Store result and mark as completed */
-    state->result = result;
-    state->completed = true;
-
-    /* Stop execution to return to the callback caller */
-    cpu_exit_requested = 1;
+    while (thread->callbacks) {
+        WBOX_CALLBACK_STATE *state = thread->callbacks;
+        thread->callbacks = state->outer;
+        free(state);
+    }
 }
 
 bool user_callback_active(void)
 {
-    return g_callback_depth > 0;
+    return *callback_stack() != NULL;
 }
 
 int user_callback_get_depth(void)
 {
-    return g_callback_depth;
+    WBOX_CALLBACK_STATE *state = *callback_stack();
+    return state ? state->depth : 0;
 }
@@ -1,20 +1,43 @@
 /*
  * WBOX User Callback Mechanism
  * Allows kernel to invoke guest window procedures
+ *
+ * A callback is a kernel-to-user transition, not a nested run of the CPU:
+ * the syscall that needs a window procedure saves its continuation in a
+ * callback frame, points the guest at the procedure and returns to the
+ * main loop with STATUS_PENDING. When the procedure returns (return stub
+ * or NtCallbackReturn), the frame is popped, the registers of the
+ * interrupted syscall are restored and the continuation finishes it.
+ * Frames live on a per-thread list, so callback depth costs no host stack
+ * and a thread may be switched out or parked inside a callback.
  */
 #ifndef WBOX_USER_CALLBACK_H
 #define WBOX_USER_CALLBACK_H
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "../nt/syscalls.h"
 
 /* Forward declarations */
 typedef struct vm_context vm_context_t;
 typedef struct _WBOX_WND WBOX_WND;
+struct wbox_thread;
+
+/* Words of caller state a continuation can carry */
+#define USER_CALLBACK_CTX_WORDS 8
+
+/*
+ * Continuation of a syscall that called into user mode
+ * Runs with the registers of the interrupted syscall restored; ctx is the
+ * state passed when the callback was started. Returns STATUS_SUCCESS once
+ * EAX holds the syscall's return value, or STATUS_PENDING if it started
+ * another callback or restarted the syscall (user_callback_restart_syscall).
+ */
+typedef ntstatus_t (*user_callback_cont_t)(uint32_t result, uint32_t *ctx);
 
-/* Callback state - tracks nested callbacks */
+/* Callback frame - one per callback in progress on a thread */
 typedef struct _WBOX_CALLBACK_STATE {
-    /* Saved CPU state */
+    /* CPU state of the interrupted syscall */
     uint32_t saved_eip;
     uint32_t saved_esp;
     uint32_t saved_eax;
@@ -25,21 +48,30 @@ typedef struct _WBOX_CALLBACK_STATE {
     uint32_t saved_edi;
     uint32_t saved_ebp;
 
-    /* Callback status */
-    bool active;
-    bool completed;
-    uint32_t result;
+    /* Window the callback runs for (CallbackWnd cache) */
+    uint32_t hwnd;
+    uint32_t guest_wnd_va;
 
     /* For kernel callback mechanism: pointer to WINDOWPROC_CALLBACK_ARGUMENTS */
     uint32_t callback_args_va;
+
+    /* How to finish the syscall */
+    user_callback_cont_t cont;
+    uint32_t ctx[USER_CALLBACK_CTX_WORDS];
+
+    int depth;                              /* 1 for the outermost callback */
+    struct _WBOX_CALLBACK_STATE *outer;     /* Enclosing callback, or NULL */
 } WBOX_CALLBACK_STATE;
 
-/* Maximum callback nesting depth */
-#define MAX_CALLBACK_DEPTH 16
+/* Maximum callback nesting depth per thread (runaway recursion guard) */
+#define MAX_CALLBACK_DEPTH 256
 
-/* Callback stack for nested calls */
-extern WBOX_CALLBACK_STATE g_callback_stack[MAX_CALLBACK_DEPTH];
-extern int g_callback_depth;
+/* Result of user_callback_return */
+typedef enum {
+    USER_CALLBACK_NONE,         /* No callback was active */
+    USER_CALLBACK_COMPLETE,     /* Interrupted syscall finished: return to its caller */
+    USER_CALLBACK_CONTINUED     /* Guest state already set up (new callback, restart) */
+} user_callback_result_t;
 
 /*
  * Initialize callback subsystem
@@ -48,8 +80,11 @@ extern int g_callback_depth;
 int user_callback_init(vm_context_t *vm);
 
 /*
- * Call a window procedure
- * Saves CPU state, sets up stdcall frame, executes until return
+ * Call a window's procedure from a syscall
+ * Enters user mode and returns STATUS_PENDING; cont finishes the syscall
+ * once the procedure returns. If the window has no procedure (or the call
+ * cannot be made) cont runs right away with a result of 0 and its status
+ * is returned. The syscall handler should return what this returns.
  *
  * Parameters:
  *   vm      - VM context
@@ -57,25 +92,44 @@ int user_callback_init(vm_context_t *vm);
  *   msg     - Message ID (WM_*)
  *   wParam  - Word parameter
  *   lParam  - Long parameter
- *
- * Returns: LRESULT from window procedure
+ *   cont    - Continuation
+ *   ctx     - USER_CALLBACK_CTX_WORDS words handed to cont (may be NULL)
  */
-uint32_t user_call_wndproc(vm_context_t *vm, WBOX_WND *wnd,
-                           uint32_t msg, uint32_t wParam, uint32_t lParam);
+ntstatus_t user_call_wndproc(vm_context_t *vm, WBOX_WND *wnd,
+                             uint32_t msg, uint32_t wParam, uint32_t lParam,
+                             user_callback_cont_t cont, const uint32_t *ctx);
 
 /*
  * Call a window procedure by address
  * Like user_call_wndproc but takes explicit wndproc address and hwnd
  */
-uint32_t user_call_wndproc_addr(vm_context_t *vm, uint32_t wndproc,
-                                uint32_t hwnd, uint32_t msg,
-                                uint32_t wParam, uint32_t lParam);
+ntstatus_t user_call_wndproc_addr(vm_context_t *vm, uint32_t wndproc,
+                                  uint32_t hwnd, uint32_t msg,
+                                  uint32_t wParam, uint32_t lParam,
+                                  user_callback_cont_t cont, const uint32_t *ctx);
+
+/*
+ * Check (and clear) whether the last syscall entered a callback or was
+ * restarted. The syscall dispatcher must then leave the CPU state alone.
+ */
+bool user_callback_entered(void);
 
 /*
  * Handle callback return syscall
  * Called when guest code returns from WndProc
  */
-void user_callback_return(uint32_t result);
+user_callback_result_t user_callback_return(uint32_t result);
+
+/*
+ * Rewind the syscall being continued so it runs again from the top
+ * For continuations; returns STATUS_PENDING.
+ */
+ntstatus_t user_callback_restart_syscall(void);
+
+/*
+ * Drop the callback frames of an exiting thread
+ */
+void user_callback_thread_exit(struct wbox_thread *thread);
 
 /*
  * Check if we're currently in a callback
@@ -16,14 +16,27 @@ static WBOX_CLS *g_class_list = NULL;
 /* System classes array (indexed by ICLS_*) */
 static WBOX_CLS *g_system_classes[ICLS_CTL_MAX] = {0};
 
-/* Atom table for class names */
-#define MAX_ATOMS   1024
+/* Atom table for class names
+ * Atoms are chained into hash buckets by case-folded name; unused slots
+ * form a free list through the same link. */
+#define MAX_ATOMS       1024
+#define ATOM_HASH_SIZE  256         /* Power of two */
+#define ATOM_NONE       0xFFFF      /* End of a chain */
 static struct {
     wchar_t name[MAX_CLASSNAME];
+    uint32_t hash;
+    uint16_t next;                  /* Next atom in bucket, or next free slot */
     bool used;
 } g_atom_table[MAX_ATOMS];
+static uint16_t g_atom_buckets[ATOM_HASH_SIZE];
+static uint16_t g_atom_free = ATOM_NONE;
 static uint16_t g_next_atom = 0xC000;  /* User atoms start at 0xC000 */
 
+/* Class index: by case-folded name and by atom */
+#define CLASS_HASH_SIZE 256         /* Power of two */
+static WBOX_CLS *g_class_by_name[CLASS_HASH_SIZE];
+static WBOX_CLS *g_class_by_atom[CLASS_HASH_SIZE];
+
 /* System class definitions */
 static const struct {
     const wchar_t *name;
@@ -56,11 +69,89 @@ static int wcsicmp_local(const wchar_t *s1, const wchar_t *s2)
     return towlower(*s1) - towlower(*s2);
 }
 
+/* Case-insensitive FNV-1a hash, over the part of the name that is stored */
+static uint32_t name_hash(const wchar_t *name)
+{
+    uint32_t hash = 2166136261u;
+    for (int i = 0; name[i] && i < MAX_CLASSNAME - 1; i++) {
+        hash = (hash ^ (uint32_t)towlower(name[i])) * 16777619u;
+    }
+    return hash;
+}
+
+static void atom_table_reset(void)
+{
+    memset(g_atom_table, 0, sizeof(g_atom_table));
+    for (int i = 0; i < ATOM_HASH_SIZE; i++) {
+        g_atom_buckets[i] = ATOM_NONE;
+    }
+    for (int i = 0; i < MAX_ATOMS; i++) {
+        g_atom_table[i].next = (i + 1 < MAX_ATOMS) ? (uint16_t)(i + 1) : ATOM_NONE;
+    }
+    g_atom_free = 0;
+}
+
+/* Find a name's slot in the atom table; returns ATOM_NONE if absent */
+static uint16_t atom_lookup(const wchar_t *name, uint32_t hash)
+{
+    uint16_t i = g_atom_buckets[hash & (ATOM_HASH_SIZE - 1)];
+    while (i != ATOM_NONE) {
+        if (g_atom_table[i].hash == hash && wcsicmp_local(g_atom_table[i].name, name) == 0) {
+            return i;
+        }
+        i = g_atom_table[i].next;
+    }
+    return ATOM_NONE;
+}
+
+/* Add a class to the list and both indexes */
+static void class_link(WBOX_CLS *cls)
+{
+    cls->nameHash = name_hash(cls->szClassName);
+
+    cls->pclsNext = g_class_list;
+    g_class_list = cls;
+
+    WBOX_CLS **name_bucket = &g_class_by_name[cls->nameHash & (CLASS_HASH_SIZE - 1)];
+    cls->pclsNameNext = *name_bucket;
+    *name_bucket = cls;
+
+    WBOX_CLS **atom_bucket = &g_class_by_atom[cls->atomClassName & (CLASS_HASH_SIZE - 1)];
+    cls->pclsAtomNext = *atom_bucket;
+    *atom_bucket = cls;
+}
+
+static void class_unlink(WBOX_CLS *cls)
+{
+    WBOX_CLS **pp;
+
+    for (pp = &g_class_list; *pp; pp = &(*pp)->pclsNext) {
+        if (*pp == cls) {
+            *pp = cls->pclsNext;
+            break;
+        }
+    }
+    for (pp = &g_class_by_name[cls->nameHash & (CLASS_HASH_SIZE - 1)]; *pp; pp = &(*pp)->pclsNameNext) {
+        if (*pp == cls) {
+            *pp = cls->pclsNameNext;
+            break;
+        }
+    }
+    for (pp = &g_class_by_atom[cls->atomClassName & (CLASS_HASH_SIZE - 1)]; *pp; pp = &(*pp)->pclsAtomNext) {
+        if (*pp == cls) {
+            *pp = cls->pclsAtomNext;
+            break;
+        }
+    }
+}
+
 int user_class_init(void)
 {
     g_class_list = NULL;
     memset(g_system_classes, 0, sizeof(g_system_classes));
-    memset(g_atom_table, 0, sizeof(g_atom_table));
+    memset(g_class_by_name, 0, sizeof(g_class_by_name));
+    memset(g_class_by_atom, 0, sizeof(g_class_by_atom));
+    atom_table_reset();
     g_next_atom = 0xC000;
 
     /* Register system classes */
@@ -90,6 +181,8 @@ void user_class_shutdown(void)
 
     g_class_list = NULL;
     memset(g_system_classes, 0, sizeof(g_system_classes));
+    memset(g_class_by_name, 0, sizeof(g_class_by_name));
+    memset(g_class_by_atom, 0, sizeof(g_class_by_atom));
 }
 
 uint16_t user_class_add_atom(const wchar_t *name)
@@ -99,23 +192,39 @@ uint16_t user_class_add_atom(const wchar_t *name)
     }
 
     /* Check if atom already exists */
-    for (int i = 0; i < MAX_ATOMS; i++) {
-        if (g_atom_table[i].used && wcsicmp_local(g_atom_table[i].name, name) == 0) {
-            return 0xC000 + i;
-        }
+    uint32_t hash = name_hash(name);
+    uint16_t i = atom_lookup(name, hash);
+    if (i != ATOM_NONE) {
+        return 0xC000 + i;
     }
 
     /* Allocate new atom */
-    for (int i = 0; i < MAX_ATOMS; i++) {
-        if (!g_atom_table[i].used) {
-            wcsncpy(g_atom_table[i].name, name, MAX_CLASSNAME - 1);
-            g_atom_table[i].name[MAX_CLASSNAME - 1] = 0;
-            g_atom_table[i].used = true;
-            return 0xC000 + i;
-        }
+    i = g_atom_free;
+    if (i == ATOM_NONE) {
+        return 0;  /* Table full */
     }
+    g_atom_free = g_atom_table[i].next;
+
+    wcsncpy(g_atom_table[i].name, name, MAX_CLASSNAME - 1);
+    g_atom_table[i].name[MAX_CLASSNAME - 1] = 0;
+    g_atom_table[i].hash = hash;
+    g_atom_table[i].used = true;
 
-    return 0;  /* Table full */
+    uint16_t *bucket = &g_atom_buckets[hash & (ATOM_HASH_SIZE - 1)];
+    g_atom_table[i].next = *bucket;
+    *bucket = i;
+
+    return 0xC000 + i;
+}
+
+uint16_t user_class_find_atom(const wchar_t *name)
+{
+    if (!name || !name[0]) {
+        return 0;
+    }
+
+    uint16_t i = atom_lookup(name, name_hash(name));
+    return i != ATOM_NONE ? 0xC000 + i : 0;
 }
 
 const wchar_t *user_class_get_atom_name(uint16_t atom)
@@ -158,9 +267,8 @@ uint16_t user_class_register(WBOX_CLS *cls)
         cls->extraBytes = calloc(1, cls->cbClsExtra);
     }
 
-    /* Add to list */
-    cls->pclsNext = g_class_list;
-    g_class_list = cls;
+    /* Add to list and index */
+    class_link(cls);
 
     /* Create guest CLS in desktop heap if initialized */
     if (desktop_heap_get()) {
@@ -175,45 +283,47 @@ uint16_t user_class_register(WBOX_CLS *cls)
 
 bool user_class_unregister(const wchar_t *className, uint32_t hInstance)
 {
-    WBOX_CLS **pp = &g_class_list;
+    if (!className) {
+        return false;
+    }
 
-    while (*pp) {
-        WBOX_CLS *cls = *pp;
+    uint32_t hash = name_hash(className);
+    WBOX_CLS *cls = g_class_by_name[hash & (CLASS_HASH_SIZE - 1)];
 
-        if (wcsicmp_local(cls->szClassName, className) == 0) {
-            /* System classes can't be unregistered */
-            if (cls->flags & CSF_SYSTEMCLASS) {
-                return false;
-            }
-
-            /* Check instance match for non-global classes */
-            if (!(cls->style & CS_GLOBALCLASS) && cls->hModule != hInstance) {
-                pp = &cls->pclsNext;
-                continue;
-            }
+    for (; cls; cls = cls->pclsNameNext) {
+        if (cls->nameHash != hash || wcsicmp_local(cls->szClassName, className) != 0) {
+            continue;
+        }
 
-            /* Can't unregister if windows still using it */
-            if (cls->cWndReferenceCount > 0) {
-                return false;
-            }
+        /* System classes can't be unregistered */
+        if (cls->flags & CSF_SYSTEMCLASS) {
+            return false;
+        }
 
-            /* Remove from list */
-            *pp = cls->pclsNext;
+        /* Check instance match for non-global classes */
+        if (!(cls->style & CS_GLOBALCLASS) && cls->hModule != hInstance) {
+            continue;
+        }
 
-            /* Destroy guest CLS */
-            if (cls->guest_cls_va) {
-                guest_cls_destroy(cls->guest_cls_va);
-            }
+        /* Can't unregister if windows still using it */
+        if (cls->cWndReferenceCount > 0) {
+            return false;
+        }
 
-            /* Free */
-            if (cls->lpszMenuName) free(cls->lpszMenuName);
-            if (cls->extraBytes) free(cls->extraBytes);
-            free(cls);
+        /* Remove from list and index */
+        class_unlink(cls);
 
-            return true;
+        /* Destroy guest CLS */
+        if (cls->guest_cls_va) {
+            guest_cls_destroy(cls->guest_cls_va);
         }
 
-        pp = &cls->pclsNext;
+        /* Free */
+        if (cls->lpszMenuName) free(cls->lpszMenuName);
+        if (cls->extraBytes) free(cls->extraBytes);
+        free(cls);
+
+        return true;
     }
 
     return false;
@@ -225,13 +335,17 @@ WBOX_CLS *user_class_find(const wchar_t *className, uint32_t hInstance)
         return NULL;
     }
 
-    /* Check if className is actually an atom (low word) */
-    if (((uintptr_t)className & 0xFFFF0000) == 0) {
+    /* Check if className is actually an atom (low word); host pointers
+     * are 64-bit, so only the whole value tells them apart */
+    if ((uintptr_t)className <= 0xFFFF) {
         return user_class_find_by_atom((uint16_t)(uintptr_t)className);
     }
 
-    for (WBOX_CLS *cls = g_class_list; cls; cls = cls->pclsNext) {
-        if (wcsicmp_local(cls->szClassName, className) == 0) {
+    /* Buckets keep registration order, newest first, like the class list */
+    uint32_t hash = name_hash(className);
+    WBOX_CLS *cls = g_class_by_name[hash & (CLASS_HASH_SIZE - 1)];
+    for (; cls; cls = cls->pclsNameNext) {
+        if (cls->nameHash == hash && wcsicmp_local(cls->szClassName, className) == 0) {
             /* Global classes match any instance */
             if (cls->style & CS_GLOBALCLASS) {
                 return cls;
@@ -256,7 +370,8 @@ WBOX_CLS *user_class_find_by_atom(uint16_t atom)
         return NULL;
     }
 
-    for (WBOX_CLS *cls = g_class_list; cls; cls = cls->pclsNext) {
+    WBOX_CLS *cls = g_class_by_atom[atom & (CLASS_HASH_SIZE - 1)];
+    for (; cls; cls = cls->pclsAtomNext) {
         if (cls->atomClassName == atom) {
             return cls;
         }
@@ -358,9 +473,8 @@ int user_class_register_system_classes(void)
         /* Register with atom */
         cls->atomClassName = user_class_add_atom(cls->szClassName);
 
-        /* Add to class list */
-        cls->pclsNext = g_class_list;
-        g_class_list = cls;
+        /* Add to class list and index */
+        class_link(cls);
 
         /* Store in system classes array */
         int icls = system_class_defs[i].icls;
@@ -82,6 +82,9 @@
  */
 typedef struct _WBOX_CLS {
     struct _WBOX_CLS *pclsNext;     /* Next class in list */
+    struct _WBOX_CLS *pclsNameNext; /* Next class in the same name bucket */
+    struct _WBOX_CLS *pclsAtomNext; /* Next class in the same atom bucket */
+    uint32_t nameHash;              /* Case-insensitive hash of szClassName */
 
     /* Class info */
     uint16_t atomClassName;          /* Class atom */
@@ -199,9 +202,16 @@ int user_class_register_system_classes(void);
 
 /*
  * Allocate a class atom for a name
+ * Returns the existing atom if the name (case-insensitive) already has one
  */
 uint16_t user_class_add_atom(const wchar_t *name);
 
+/*
+ * Look up the atom of a name without adding it
+ * Returns 0 if the name has no atom
+ */
+uint16_t user_class_find_atom(const wchar_t *name);
+
 /*
  * Get atom name
  */
@@ -0,0 +1,345 @@
+/*
+ * WBOX USER Input Implementation
+ */
+#include "user_input.h"
+#include "user_window.h"
+
+#include <stdio.h>
+
+/* Foreground window: receives keyboard input through its thread's focus */
+static uint32_t g_hwnd_foreground = 0;
+
+/* Window with mouse capture (any thread), 0 if none */
+static uint32_t g_hwnd_capture = 0;
+
+/* Physical key state, updated as input is routed */
+static uint8_t g_async_keys[256];
+
+uint32_t user_input_set_focus(WBOX_MSG_QUEUE *queue, uint32_t hwnd)
+{
+    if (!queue) {
+        return 0;
+    }
+
+    uint32_t oldFocus = queue->hwndFocus;
+
+    if (oldFocus != hwnd) {
+        /* Send WM_KILLFOCUS to old window */
+        if (oldFocus != 0) {
+            msg_queue_post(oldFocus, WM_KILLFOCUS, hwnd, 0);
+        }
+
+        /* Update focus */
+        queue->hwndFocus = hwnd;
+
+        /* Send WM_SETFOCUS to new window */
+        if (hwnd != 0) {
+            msg_queue_post(hwnd, WM_SETFOCUS, oldFocus, 0);
+        }
+    }
+
+    return oldFocus;
+}
+
+uint32_t user_input_activate(WBOX_MSG_QUEUE *queue, uint32_t hwnd, uint32_t how)
+{
+    if (!queue) {
+        return 0;
+    }
+
+    uint32_t oldActive = queue->hwndActive;
+
+    if (oldActive != hwnd) {
+        /* Deactivate old window */
+        if (oldActive != 0) {
+            msg_queue_post(oldActive, WM_ACTIVATE, WA_INACTIVE, hwnd);
+        }
+
+        /* Update active window */
+        queue->hwndActive = hwnd;
+        g_hwnd_foreground = hwnd;
+
+        /* Activate new window */
+        if (hwnd != 0) {
+            msg_queue_post(hwnd, WM_ACTIVATE, how, oldActive);
+        }
+    }
+
+    return oldActive;
+}
+
+uint32_t user_input_get_foreground(void)
+{
+    return g_hwnd_foreground;
+}
+
+uint32_t user_input_set_capture(WBOX_MSG_QUEUE *queue, uint32_t hwnd)
+{
+    if (!queue) {
+        return 0;
+    }
+
+    uint32_t oldCapture = queue->hwndCapture;
+
+    if (oldCapture != hwnd) {
+        queue->hwndCapture = hwnd;
+        if (hwnd != 0 || g_hwnd_capture == oldCapture) {
+            g_hwnd_capture = hwnd;
+        }
+        if (oldCapture != 0) {
+            msg_queue_post(oldCapture, WM_CAPTURECHANGED, 0, hwnd);
+        }
+    }
+
+    return oldCapture;
+}
+
+uint8_t user_input_async_key_state(int vk)
+{
+    return g_async_keys[vk & 0xFF];
+}
+
+/* Record a key or button transition; a press flips the toggle bit */
+static void update_key_state(uint8_t vk, bool down)
+{
+    if (down) {
+        if (!(g_async_keys[vk] & 0x80)) {
+            g_async_keys[vk] ^= 0x01;
+        }
+        g_async_keys[vk] |= 0x80;
+    } else {
+        g_async_keys[vk] &= ~0x80;
+    }
+}
+
+static bool key_down(uint8_t vk)
+{
+    return (g_async_keys[vk] & 0x80) != 0;
+}
+
+/* MK_* flags for mouse messages */
+static uint32_t mouse_key_flags(void)
+{
+    uint32_t flags = 0;
+    if (key_down(VK_LBUTTON)) flags |= MK_LBUTTON;
+    if (key_down(VK_RBUTTON)) flags |= MK_RBUTTON;
+    if (key_down(VK_MBUTTON)) flags |= MK_MBUTTON;
+    if (key_down(VK_SHIFT)) flags |= MK_SHIFT;
+    if (key_down(VK_CONTROL)) flags |= MK_CONTROL;
+    return flags;
+}
+
+static WBOX_WND *top_level_of(WBOX_WND *wnd)
+{
+    WBOX_WND *desktop = user_window_get_desktop();
+    while (wnd && wnd->spwndParent && wnd->spwndParent != desktop) {
+        wnd = wnd->spwndParent;
+    }
+    return wnd;
+}
+
+/*
+ * Foreground window, falling back to the topmost visible top-level window
+ * for apps that never activate one
+ */
+static WBOX_WND *foreground_window(void)
+{
+    WBOX_WND *wnd = g_hwnd_foreground ? user_window_from_hwnd(g_hwnd_foreground) : NULL;
+    if (wnd) {
+        return wnd;
+    }
+
+    WBOX_WND *desktop = user_window_get_desktop();
+    for (wnd = desktop ? desktop->spwndChild : NULL; wnd; wnd = wnd->spwndNext) {
+        if (user_window_is_visible(wnd)) {
+            return wnd;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Keyboard: to the focus window of the foreground thread, or as WM_SYSKEY*
+ * to its active window if nothing has focus
+ */
+static void route_key(const display_input_t *in)
+{
+    bool was_down = key_down(in->vk);
+    update_key_state(in->vk, in->down);
+
+    WBOX_WND *fg = foreground_window();
+    WBOX_MSG_QUEUE *queue = fg ? msg_queue_for_window(fg) : NULL;
+    if (!queue) {
+        return;
+    }
+
+    bool alt = key_down(VK_MENU);
+    bool sys = in->vk == VK_MENU || in->vk == VK_F10 || (alt && !key_down(VK_CONTROL));
+
+    uint32_t target = queue->hwndFocus;
+    if (target == 0) {
+        target = queue->hwndActive ? queue->hwndActive : fg->hwnd;
+        sys = true;
+    }
+
+    uint32_t message;
+    if (in->down) {
+        message = sys ? WM_SYSKEYDOWN : WM_KEYDOWN;
+    } else {
+        message = sys ? WM_SYSKEYUP : WM_KEYUP;
+    }
+
+    /* Repeat count, scan code, extended, context (ALT), previous, transition */
+    uint32_t lParam = 1 | ((uint32_t)in->scancode << 16);
+    if (in->extended) lParam |= 1u << 24;
+    if (alt) lParam |= 1u << 29;
+    if (was_down) lParam |= 1u << 30;
+    if (!in->down) lParam |= 1u << 31;
+
+    queue->keyState[in->vk] = g_async_keys[in->vk];
+    msg_queue_post_input(queue, target, message, in->vk, lParam);
+}
+
+static uint32_t hit_test(const WBOX_WND *wnd, int x, int y)
+{
+    if (x >= wnd->rcClient.left && x < wnd->rcClient.right &&
+        y >= wnd->rcClient.top && y < wnd->rcClient.bottom) {
+        return HTCLIENT;
+    }
+    if ((wnd->style & WS_CAPTION) == WS_CAPTION && y < wnd->rcClient.top) {
+        return HTCAPTION;
+    }
+    return HTBORDER;
+}
+
+/*
+ * Window that gets a mouse event at (x, y): the capture window, or the
+ * window under the pointer. Returns NULL over the bare desktop.
+ */
+static WBOX_WND *mouse_target(int x, int y, uint32_t *hit)
+{
+    if (g_hwnd_capture) {
+        WBOX_WND *wnd = user_window_from_hwnd(g_hwnd_capture);
+        if (wnd) {
+            /* Captured input is always client-area input */
+            *hit = HTCLIENT;
+            return wnd;
+        }
+        g_hwnd_capture = 0;     /* Window is gone */
+    }
+
+    WBOX_WND *wnd = user_window_from_point(x, y);
+    if (!wnd || wnd == user_window_get_desktop()) {
+        return NULL;
+    }
+    *hit = hit_test(wnd, x, y);
+    return wnd;
+}
+
+/* Client-area messages get client coordinates, non-client ones screen
+ * coordinates and the hit-test code */
+static void post_mouse(WBOX_WND *wnd, uint32_t hit, uint32_t client_msg, uint32_t nc_msg,
+                       int x, int y)
+{
+    WBOX_MSG_QUEUE *queue = msg_queue_for_window(wnd);
+    if (hit == HTCLIENT) {
+        msg_queue_post_input(queue, wnd->hwnd, client_msg, mouse_key_flags(),
+                             MAKELPARAM(x - wnd->rcClient.left, y - wnd->rcClient.top));
+    } else {
+        msg_queue_post_input(queue, wnd->hwnd, nc_msg, hit, MAKELPARAM(x, y));
+    }
+}
+
+static void route_mouse_move(const display_input_t *in)
+{
+    uint32_t hit;
+    WBOX_WND *wnd = mouse_target(in->x, in->y, &hit);
+    if (wnd) {
+        post_mouse(wnd, hit, WM_MOUSEMOVE, WM_NCMOUSEMOVE, in->x, in->y);
+    }
+}
+
+static void route_mouse_button(const display_input_t *in)
+{
+    static const uint8_t button_vk[] = { VK_LBUTTON, VK_RBUTTON, VK_MBUTTON };
+    static const uint32_t client_base[] = { WM_LBUTTONDOWN, WM_RBUTTONDOWN, WM_MBUTTONDOWN };
+    static const uint32_t nc_base[] = { WM_NCLBUTTONDOWN, WM_NCRBUTTONDOWN, WM_NCMBUTTONDOWN };
+
+    update_key_state(button_vk[in->button], in->down);
+
+    uint32_t hit;
+    WBOX_WND *wnd = mouse_target(in->x, in->y, &hit);
+    if (!wnd) {
+        return;
+    }
+
+    /* A click outside the active window activates its top-level window */
+    if (in->down && !g_hwnd_capture) {
+        WBOX_WND *top = top_level_of(wnd);
+        WBOX_MSG_QUEUE *queue = msg_queue_for_window(top);
+        if (queue && queue->hwndActive != top->hwnd) {
+            user_input_activate(queue, top->hwnd, WA_CLICKACTIVE);
+        }
+        if (queue) {
+            WBOX_WND *focus = user_window_from_hwnd(queue->hwndFocus);
+            if (!focus || top_level_of(focus) != top) {
+                user_input_set_focus(queue, top->hwnd);
+            }
+        }
+    }
+
+    /* DOWN, UP and DBLCLK are consecutive; client double-clicks need CS_DBLCLKS */
+    uint32_t offset = 1;
+    if (in->down) {
+        bool dblclk = in->clicks == 2 &&
+                      (hit != HTCLIENT || (wnd->pcls && (wnd->pcls->style & CS_DBLCLKS)));
+        offset = dblclk ? 2 : 0;
+    }
+    post_mouse(wnd, hit, client_base[in->button] + offset, nc_base[in->button] + offset,
+               in->x, in->y);
+}
+
+/* The wheel goes to the focus window, with screen coordinates */
+static void route_mouse_wheel(const display_input_t *in)
+{
+    WBOX_WND *fg = foreground_window();
+    WBOX_MSG_QUEUE *queue = fg ? msg_queue_for_window(fg) : NULL;
+    if (!queue) {
+        return;
+    }
+
+    uint32_t target = queue->hwndFocus ? queue->hwndFocus : fg->hwnd;
+    msg_queue_post_input(queue, target, WM_MOUSEWHEEL,
+                         MAKELPARAM(mouse_key_flags(), in->wheel), MAKELPARAM(in->x, in->y));
+}
+
+void user_input_process(display_context_t *display)
+{
+    display_input_t in;
+
+    while (display_next_input(display, &in)) {
+        switch (in.type) {
+            case DISPLAY_INPUT_KEY:
+                route_key(&in);
+                break;
+            case DISPLAY_INPUT_MOUSE_MOVE:
+                msg_set_cursor_pos(in.x, in.y);
+                route_mouse_move(&in);
+                break;
+            case DISPLAY_INPUT_MOUSE_BUTTON:
+                msg_set_cursor_pos(in.x, in.y);
+                route_mouse_button(&in);
+                break;
+            case DISPLAY_INPUT_MOUSE_WHEEL:
+                msg_set_cursor_pos(in.x, in.y);
+                route_mouse_wheel(&in);
+                break;
+        }
+    }
+
+    if (display->input_dropped) {
+        fprintf(stderr, "user_input: dropped %u host input events (queue full)\n",
+                display->input_dropped);
+        display->input_dropped = 0;
+    }
+}
@@ -0,0 +1,50 @@
+/*
+ * WBOX USER Input
+ * Routes host keyboard and mouse input to window message queues
+ *
+ * The display translates SDL events into display_input_t records; this
+ * module hit-tests them against the window tree and posts WM_KEY*,
+ * WM_*BUTTON*, WM_NC* and WM_MOUSEMOVE to the queue of the thread owning
+ * the target window. It also owns the system-wide input state: the
+ * foreground window, mouse capture and the asynchronous key state.
+ */
+#ifndef WBOX_USER_INPUT_H
+#define WBOX_USER_INPUT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../gdi/display.h"
+#include "user_message.h"
+
+/* Virtual keys the router looks at */
+#define VK_LBUTTON      0x01
+#define VK_RBUTTON      0x02
+#define VK_MBUTTON      0x04
+#define VK_SHIFT        0x10
+#define VK_CONTROL      0x11
+#define VK_MENU         0x12
+#define VK_F10          0x79
+
+/* Route all input queued by the display */
+void user_input_process(display_context_t *display);
+
+/* Move keyboard focus within a queue; posts WM_KILLFOCUS/WM_SETFOCUS
+ * Returns the previous focus window. */
+uint32_t user_input_set_focus(WBOX_MSG_QUEUE *queue, uint32_t hwnd);
+
+/* Make a window the queue's active window and the foreground window;
+ * posts WM_ACTIVATE (how = WA_ACTIVE or WA_CLICKACTIVE)
+ * Returns the previous active window. */
+uint32_t user_input_activate(WBOX_MSG_QUEUE *queue, uint32_t hwnd, uint32_t how);
+
+/* Get the foreground window (0 if none) */
+uint32_t user_input_get_foreground(void);
+
+/* Capture the mouse for a window of the queue's thread (0 releases)
+ * Returns the previous capture window. */
+uint32_t user_input_set_capture(WBOX_MSG_QUEUE *queue, uint32_t hwnd);
+
+/* Physical key state: bit 7 = down, bit 0 = toggled */
+uint8_t user_input_async_key_state(int vk);
+
+#endif /* WBOX_USER_INPUT_H */
@@ -1,19 +1,42 @@
 /*
  * WBOX User Message Queue Implementation
+ *
+ * Every GUI thread gets its own queue. Posted and input messages live in
+ * doubly linked lists of pooled nodes, so appending and removing a message
+ * that matched a filter are both O(1). WM_QUIT and WM_PAINT are not queued:
+ * they are synthesized from the quit flag and the window update state.
  */
 #include "user_message.h"
 #include "user_window.h"
+#include "user_callback.h"
 #include "../vm/vm.h"
 #include "../vm/paging.h"
 #include "../cpu/mem.h"
+#include "../nt/sync.h"
+#include "../thread/thread.h"
+#include "../thread/scheduler.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <sys/time.h>
 
-/* Global message queue */
-WBOX_MSG_QUEUE g_msg_queue;
+/* Message nodes are carved from chunks of this many */
+#define MSG_NODE_CHUNK 256
+
+/* All live queues */
+static WBOX_MSG_QUEUE *g_queues = NULL;
+
+/* Queue used while no scheduler exists; adopted by the main thread */
+static WBOX_MSG_QUEUE *g_boot_queue = NULL;
+
+/* Recycled message nodes */
+static WBOX_MSG_NODE *g_free_nodes = NULL;
+
+/* Cursor position stamped on new messages */
+static int32_t g_cursor_x = 0;
+static int32_t g_cursor_y = 0;
 
 /* Start time for tick count */
 static struct timeval g_start_time;
@@ -21,8 +44,6 @@ static bool g_time_initialized = false;
 
 void msg_queue_init(void)
 {
-    memset(&g_msg_queue, 0, sizeof(g_msg_queue));
-
     /* Initialize start time for GetTickCount */
     if (!g_time_initialized) {
         gettimeofday(&g_start_time, NULL);
@@ -47,65 +68,760 @@ uint32_t msg_get_tick_count(void)
     return ms;
 }
 
+void msg_set_cursor_pos(int32_t x, int32_t y)
+{
+    g_cursor_x = x;
+    g_cursor_y = y;
+}
+
+/*
+ * Message node pool
+ */
+
+static WBOX_MSG_NODE *msg_node_alloc(void)
+{
+    if (!g_free_nodes) {
+        WBOX_MSG_NODE *chunk = malloc(MSG_NODE_CHUNK * sizeof(WBOX_MSG_NODE));
+        if (!chunk) {
+            return NULL;
+        }
+        for (int i = 0; i < MSG_NODE_CHUNK; i++) {
+            chunk[i].next = g_free_nodes;
+            g_free_nodes = &chunk[i];
+        }
+    }
+
+    WBOX_MSG_NODE *node = g_free_nodes;
+    g_free_nodes = node->next;
+    return node;
+}
+
+static void msg_node_free(WBOX_MSG_NODE *node)
+{
+    node->next = g_free_nodes;
+    g_free_nodes = node;
+}
+
+/*
+ * Message lists
+ */
+
+static bool msg_list_push(WBOX_MSG_LIST *list, uint32_t hwnd, uint32_t message,
+                          uint32_t wParam, uint32_t lParam)
+{
+    WBOX_MSG_NODE *node = msg_node_alloc();
+    if (!node) {
+        fprintf(stderr, "msg_queue: out of memory for message 0x%X\n", message);
+        return false;
+    }
+
+    node->msg.hwnd = hwnd;
+    node->msg.message = message;
+    node->msg.wParam = wParam;
+    node->msg.lParam = lParam;
+    node->msg.time = msg_get_tick_count();
+    node->msg.pt_x = g_cursor_x;
+    node->msg.pt_y = g_cursor_y;
+
+    node->next = NULL;
+    node->prev = list->tail;
+    if (list->tail) {
+        list->tail->next = node;
+    } else {
+        list->head = node;
+    }
+    list->tail = node;
+    list->count++;
+    return true;
+}
+
+static void msg_list_unlink(WBOX_MSG_LIST *list, WBOX_MSG_NODE *node)
+{
+    if (node->prev) {
+        node->prev->next = node->next;
+    } else {
+        list->head = node->next;
+    }
+    if (node->next) {
+        node->next->prev = node->prev;
+    } else {
+        list->tail = node->prev;
+    }
+    list->count--;
+    msg_node_free(node);
+}
+
+static void msg_list_clear(WBOX_MSG_LIST *list)
+{
+    while (list->head) {
+        msg_list_unlink(list, list->head);
+    }
+}
+
+/*
+ * Map an input message to its QS_* queue status class
+ */
+static uint32_t msg_input_bits(uint32_t message)
+{
+    if (message >= WM_KEYDOWN && message <= 0x0109) {   /* WM_KEYFIRST..WM_KEYLAST */
+        return QS_KEY;
+    }
+    if (message == WM_MOUSEMOVE || message == WM_NCMOUSEMOVE) {
+        return QS_MOUSEMOVE;
+    }
+    return QS_MOUSEBUTTON;
+}
+
+/*
+ * Timers
+ */
+
+/* Timer clock in ms, on the scheduler's time base so park deadlines match */
+static uint64_t msg_timer_now(void)
+{
+    return scheduler_get_time_100ns() / 10000;
+}
+
+uint32_t msg_queue_set_timer(WBOX_MSG_QUEUE *queue, uint32_t hwnd, uint32_t id,
+                             uint32_t elapse, uint32_t proc, uint32_t flags)
+{
+    if (!queue) {
+        return 0;
+    }
+    return user_timer_set(&queue->timers, hwnd, id, elapse, proc, flags, msg_timer_now());
+}
+
+bool msg_queue_kill_timer(WBOX_MSG_QUEUE *queue, uint32_t hwnd, uint32_t id, uint32_t flags)
+{
+    return queue && user_timer_kill(&queue->timers, hwnd, id, flags);
+}
+
+void msg_queue_kill_window_timers(WBOX_WND *wnd)
+{
+    WBOX_MSG_QUEUE *queue = msg_queue_for_window(wnd);
+    if (queue) {
+        user_timer_kill_window(&queue->timers, wnd->hwnd);
+    }
+}
+
+void msg_queue_check_timers(WBOX_MSG_QUEUE *queue)
+{
+    if (queue && queue->timers.count > 0 &&
+        user_timer_expire(&queue->timers, msg_timer_now()) > 0) {
+        msg_queue_wake(queue, QS_TIMER);
+    }
+}
+
+/*
+ * Paint set
+ *
+ * A window sits in its owner queue's paint set while it is visible and has
+ * an update region or pending non-client/erase work. Everything that changes
+ * those reports it through msg_queue_update_paint, so synthesizing WM_PAINT
+ * takes the head of the set instead of walking the window tree.
+ */
+
+static bool wnd_needs_paint(WBOX_WND *wnd)
+{
+    return wnd != user_window_get_desktop() &&
+           !(wnd->state & WNDS_DESTROYED) &&
+           user_window_is_visible(wnd) &&
+           (wnd->hrgnUpdate ||
+            (wnd->state & (WNDS_SENDNCPAINT | WNDS_SENDERASEBACKGROUND | WNDS_NONCPAINT | WNDS_ERASEBACKGROUND)));
+}
+
+static int wnd_depth(const WBOX_WND *wnd)
+{
+    int depth = 0;
+    while (wnd->spwndParent) {
+        wnd = wnd->spwndParent;
+        depth++;
+    }
+    return depth;
+}
+
+/*
+ * Paint order is a pre-order walk of the window tree: a parent before its
+ * children, and siblings from the top of the z-order down. Windows in
+ * unrelated trees (not yet linked) keep the order they were added in.
+ */
+static bool wnd_paints_before(const WBOX_WND *a, const WBOX_WND *b)
+{
+    const WBOX_WND *pa = a;
+    const WBOX_WND *pb = b;
+    int da = wnd_depth(a);
+    int db = wnd_depth(b);
+
+    while (da > db) {
+        pa = pa->spwndParent;
+        da--;
+    }
+    while (db > da) {
+        pb = pb->spwndParent;
+        db--;
+    }
+
+    /* One is an ancestor of the other */
+    if (pa == pb) {
+        return pa == a;
+    }
+
+    /* Climb to the children of the common ancestor and compare siblings */
+    while (pa->spwndParent != pb->spwndParent) {
+        pa = pa->spwndParent;
+        pb = pb->spwndParent;
+    }
+    if (!pa->spwndParent) {
+        return false;
+    }
+    for (const WBOX_WND *sib = pa->spwndNext; sib; sib = sib->spwndNext) {
+        if (sib == pb) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void paint_set_insert(WBOX_MSG_QUEUE *queue, WBOX_WND *wnd)
+{
+    /* Invalidation mostly runs parent-first, so search from the tail */
+    WBOX_WND *after = queue->paintTail;
+    while (after && wnd_paints_before(wnd, after)) {
+        after = after->paint_prev;
+    }
+
+    wnd->paint_prev = after;
+    wnd->paint_next = after ? after->paint_next : queue->paintHead;
+    if (wnd->paint_next) {
+        wnd->paint_next->paint_prev = wnd;
+    } else {
+        queue->paintTail = wnd;
+    }
+    if (after) {
+        after->paint_next = wnd;
+    } else {
+        queue->paintHead = wnd;
+    }
+    wnd->paint_queue = queue;
+    queue->paintCount++;
+}
+
+static void paint_set_remove(WBOX_WND *wnd)
+{
+    WBOX_MSG_QUEUE *queue = wnd->paint_queue;
+
+    if (wnd->paint_prev) {
+        wnd->paint_prev->paint_next = wnd->paint_next;
+    } else {
+        queue->paintHead = wnd->paint_next;
+    }
+    if (wnd->paint_next) {
+        wnd->paint_next->paint_prev = wnd->paint_prev;
+    } else {
+        queue->paintTail = wnd->paint_prev;
+    }
+    wnd->paint_next = NULL;
+    wnd->paint_prev = NULL;
+    wnd->paint_queue = NULL;
+    queue->paintCount--;
+}
+
+void msg_queue_update_paint(WBOX_WND *wnd)
+{
+    if (!wnd) {
+        return;
+    }
+
+    bool needs_paint = wnd_needs_paint(wnd);
+    if (needs_paint == (wnd->paint_queue != NULL)) {
+        return;
+    }
+
+    if (!needs_paint) {
+        paint_set_remove(wnd);
+        return;
+    }
+
+    WBOX_MSG_QUEUE *queue = msg_queue_for_window(wnd);
+    if (!queue) {
+        return;
+    }
+    paint_set_insert(queue, wnd);
+    msg_queue_wake(queue, QS_PAINT);
+}
+
+static bool wnd_is_within(const WBOX_WND *wnd, const WBOX_WND *root)
+{
+    for (; wnd; wnd = wnd->spwndParent) {
+        if (wnd == root) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void msg_queue_reorder_paint(WBOX_WND *wnd)
+{
+    if (!wnd || (!wnd->paint_queue && !wnd->spwndChild)) {
+        return;
+    }
+
+    /* Children may belong to other threads, so check every queue */
+    for (WBOX_MSG_QUEUE *queue = g_queues; queue; queue = queue->next) {
+        WBOX_WND *moved = NULL;
+        WBOX_WND *next;
+
+        for (WBOX_WND *entry = queue->paintHead; entry; entry = next) {
+            next = entry->paint_next;
+            if (wnd_is_within(entry, wnd)) {
+                paint_set_remove(entry);
+                entry->paint_next = moved;
+                moved = entry;
+            }
+        }
+
+        for (WBOX_WND *entry = moved; entry; entry = next) {
+            next = entry->paint_next;
+            paint_set_insert(queue, entry);
+        }
+    }
+}
+
+void msg_queue_remove_paint(WBOX_WND *wnd)
+{
+    if (wnd && wnd->paint_queue) {
+        paint_set_remove(wnd);
+    }
+}
+
+/*
+ * Queue lookup
+ */
+
+static WBOX_MSG_QUEUE *msg_queue_create(uint32_t thread_id)
+{
+    WBOX_MSG_QUEUE *queue = calloc(1, sizeof(WBOX_MSG_QUEUE));
+    if (!queue) {
+        return NULL;
+    }
+
+    queue->threadId = thread_id;
+    queue->next = g_queues;
+    g_queues = queue;
+    return queue;
+}
+
+static WBOX_MSG_QUEUE *msg_queue_for_thread(wbox_thread_t *thread)
+{
+    if (!thread->msg_queue) {
+        /* The main thread inherits anything queued before the scheduler ran */
+        if (thread->thread_id == WBOX_THREAD_ID && g_boot_queue) {
+            thread->msg_queue = g_boot_queue;
+            g_boot_queue = NULL;
+        } else {
+            thread->msg_queue = msg_queue_create(thread->thread_id);
+        }
+    }
+    return thread->msg_queue;
+}
+
+static WBOX_MSG_QUEUE *msg_queue_for_thread_id(uint32_t thread_id)
+{
+    wbox_scheduler_t *sched = scheduler_get_instance();
+    if (sched) {
+        for (wbox_thread_t *thread = sched->all_threads; thread; thread = thread->next) {
+            if (thread->thread_id == thread_id) {
+                return msg_queue_for_thread(thread);
+            }
+        }
+    }
+
+    if (thread_id == WBOX_THREAD_ID && (!sched || !sched->all_threads)) {
+        if (!g_boot_queue) {
+            g_boot_queue = msg_queue_create(WBOX_THREAD_ID);
+        }
+        return g_boot_queue;
+    }
+    return NULL;
+}
+
+WBOX_MSG_QUEUE *msg_queue_current(void)
+{
+    wbox_thread_t *thread = thread_get_current();
+    if (thread && !thread->is_idle_thread) {
+        return msg_queue_for_thread(thread);
+    }
+
+    /* Host context (no guest thread running): use the main thread's queue */
+    return msg_queue_for_thread_id(WBOX_THREAD_ID);
+}
+
+WBOX_MSG_QUEUE *msg_queue_for_window(WBOX_WND *wnd)
+{
+    if (!wnd) {
+        return NULL;
+    }
+    return msg_queue_for_thread_id(wnd->thread_id);
+}
+
+void msg_queue_thread_exit(wbox_thread_t *thread)
+{
+    WBOX_MSG_QUEUE *queue = thread ? thread->msg_queue : NULL;
+    if (!queue) {
+        return;
+    }
+    thread->msg_queue = NULL;
+
+    /* Release threads blocked in SendMessage to us */
+    WBOX_SENT_MSG *sent;
+    while ((sent = msg_queue_next_sent(queue)) != NULL) {
+        msg_queue_reply(sent, 0);
+    }
+    while ((sent = queue->sentActive) != NULL) {
+        queue->sentActive = sent->next;
+        sent->next = NULL;
+        msg_queue_reply(sent, 0);
+    }
+
+    /* Our own unanswered sends are freed by their receivers */
+    while ((sent = queue->pendingSend) != NULL) {
+        queue->pendingSend = sent->outerSend;
+        if (sent->done) {
+            free(sent);
+        } else {
+            sent->sender = NULL;
+        }
+    }
+
+    msg_list_clear(&queue->posted);
+    msg_list_clear(&queue->input);
+    user_timer_heap_free(&queue->timers);
+
+    /* Windows the thread leaves behind are no longer painted */
+    while (queue->paintHead) {
+        paint_set_remove(queue->paintHead);
+    }
+
+    if (queue->wakeEvent) {
+        vm_context_t *vm = vm_get_context();
+        if (queue->wakeEventHandle && vm) {
+            handles_remove(&vm->handles, queue->wakeEventHandle);
+        } else {
+            sync_free_object(queue->wakeEvent, HANDLE_TYPE_EVENT);
+        }
+    }
+
+    for (WBOX_MSG_QUEUE **pp = &g_queues; *pp; pp = &(*pp)->next) {
+        if (*pp == queue) {
+            *pp = queue->next;
+            break;
+        }
+    }
+    free(queue);
+}
+
+/*
+ * Wakeups
+ */
+
+/*
+ * Create the queue's wake event on first use
+ */
+static bool msg_queue_ensure_wake_event(WBOX_MSG_QUEUE *queue)
+{
+    if (!queue->wakeEvent) {
+        queue->wakeEvent = sync_create_event(WBOX_DISP_EVENT_NOTIFICATION, false);
+    }
+    return queue->wakeEvent != NULL;
+}
+
+void msg_queue_wake(WBOX_MSG_QUEUE *queue, uint32_t qs_bits)
+{
+    if (!queue) {
+        return;
+    }
+
+    queue->changeBits |= qs_bits & ~QS_SMRESULT;
+
+    if (!queue->wakeEvent || !(queue->wakeMask & qs_bits)) {
+        return;
+    }
+
+    /* Manual-reset: stays signaled until the next wait resets it */
+    queue->wakeEvent->header.signal_state = 1;
+    scheduler_signal_object(scheduler_get_instance(), queue->wakeEvent, HANDLE_TYPE_EVENT);
+}
+
+/* Park until the queue is woken or the absolute deadline (ms, 0 = none) */
+static bool msg_queue_park(WBOX_MSG_QUEUE *queue, uint64_t deadline)
+{
+    wbox_scheduler_t *sched = scheduler_get_instance();
+
+    if (!sched || !queue || !msg_queue_ensure_wake_event(queue)) {
+        return false;
+    }
+
+    queue->wakeMask = QS_ALLINPUT | QS_ALLPOSTMESSAGE | QS_SMRESULT;
+    queue->wakeEvent->header.signal_state = 0;
+
+    void *objects[1] = { queue->wakeEvent };
+    int types[1] = { HANDLE_TYPE_EVENT };
+    return scheduler_park_syscall(sched, objects, types, 1, deadline * 10000);
+}
+
+bool msg_queue_wait(WBOX_MSG_QUEUE *queue)
+{
+    /* Sleep no longer than the next timer; the restarted syscall then finds
+     * it ready, so an idle thread wakes once per timer period */
+    uint64_t due = queue ? user_timer_next_due(&queue->timers, msg_timer_now()) : 0;
+    return msg_queue_park(queue, due);
+}
+
+bool msg_queue_throttle_peek(WBOX_MSG_QUEUE *queue, bool found)
+{
+    if (!queue) {
+        return false;
+    }
+
+    if (found) {
+        queue->emptyPeeks = 0;
+        queue->peekThrottled = false;
+        return false;
+    }
+
+    uint64_t now = msg_timer_now();
+    bool spinning = now - queue->lastEmptyPeek < PEEK_SPIN_GAP_MS;
+    queue->lastEmptyPeek = now;
+
+    /* This is the restart of a throttled peek: report the empty queue */
+    if (queue->peekThrottled) {
+        queue->peekThrottled = false;
+        return false;
+    }
+
+    if (!spinning) {
+        queue->emptyPeeks = 0;
+    }
+    if (++queue->emptyPeeks < PEEK_SPIN_THRESHOLD) {
+        return false;
+    }
+
+    uint64_t deadline = now + PEEK_THROTTLE_MS;
+    uint64_t due = user_timer_next_due(&queue->timers, now);
+    if (due != 0 && due < deadline) {
+        deadline = due;
+    }
+
+    queue->peekThrottled = true;
+    if (!msg_queue_park(queue, deadline)) {
+        queue->peekThrottled = false;
+        return false;
+    }
+    return true;
+}
+
+uint32_t msg_queue_set_wake_mask(WBOX_MSG_QUEUE *queue, uint32_t wake_mask)
+{
+    vm_context_t *vm = vm_get_context();
+    if (!vm || !queue || !msg_queue_ensure_wake_event(queue)) {
+        return 0;
+    }
+
+    if (!queue->wakeEventHandle) {
+        queue->wakeEventHandle = handles_add_object(&vm->handles, HANDLE_TYPE_EVENT,
+                                                    queue->wakeEvent);
+    }
+
+    /* LOWORD = QS_* mask, HIWORD = MWMO_* flags. MWMO_INPUTAVAILABLE also
+     * counts input that was already pending, not just new arrivals. */
+    uint32_t flags = wake_mask >> 16;
+    queue->wakeMask = wake_mask & 0xFFFF;
+
+    uint32_t pending = (flags & 0x0004) ? msg_queue_status_bits(queue) : queue->changeBits;
+    queue->wakeEvent->header.signal_state = (pending & queue->wakeMask) ? 1 : 0;
+
+    return queue->wakeEventHandle;
+}
+
+void msg_queue_clear_wake_mask(WBOX_MSG_QUEUE *queue)
+{
+    if (queue) {
+        queue->wakeMask = 0;
+    }
+}
+
+/*
+ * Posting
+ */
+
 bool msg_queue_post(uint32_t hwnd, uint32_t message, uint32_t wParam, uint32_t lParam)
 {
-    if (g_msg_queue.count >= 256) {
-        fprintf(stderr, "msg_queue_post: queue full!\n");
+    WBOX_MSG_QUEUE *queue = hwnd ? msg_queue_for_window(user_window_from_hwnd(hwnd))
+                                 : msg_queue_current();
+    if (!queue) {
         return false;
     }
 
-    WBOX_MSG *msg = &g_msg_queue.messages[g_msg_queue.tail];
-    msg->hwnd = hwnd;
-    msg->message = message;
-    msg->wParam = wParam;
-    msg->lParam = lParam;
-    msg->time = msg_get_tick_count();
-    msg->pt_x = g_msg_queue.mouseX;
-    msg->pt_y = g_msg_queue.mouseY;
+    /* Back-pressure: refuse instead of growing without bound, so a runaway
+     * poster sees PostMessage fail as it would on Windows */
+    if (queue->posted.count >= MSG_QUEUE_POST_QUOTA) {
+        if (queue->postsRejected++ == 0) {
+            fprintf(stderr, "msg_queue_post: thread %u queue over quota (%u messages)\n",
+                    queue->threadId, queue->posted.count);
+        }
+        return false;
+    }
 
-    g_msg_queue.tail = (g_msg_queue.tail + 1) % 256;
-    g_msg_queue.count++;
+    if (!msg_list_push(&queue->posted, hwnd, message, wParam, lParam)) {
+        return false;
+    }
+    if (queue->posted.count > queue->postedPeak) {
+        queue->postedPeak = queue->posted.count;
+    }
 
+    msg_queue_wake(queue, QS_POSTMESSAGE | QS_ALLPOSTMESSAGE);
+    return true;
+}
+
+bool msg_queue_post_input(WBOX_MSG_QUEUE *queue, uint32_t hwnd, uint32_t message,
+                          uint32_t wParam, uint32_t lParam)
+{
+    if (!queue) {
+        return false;
+    }
+
+    /* Like Windows, keep only the latest of consecutive mouse moves: if the
+     * newest queued input is a move for the same window, update it */
+    WBOX_MSG_NODE *tail = queue->input.tail;
+    if ((message == WM_MOUSEMOVE || message == WM_NCMOUSEMOVE) && tail &&
+        tail->msg.message == message && tail->msg.hwnd == hwnd) {
+        tail->msg.wParam = wParam;
+        tail->msg.lParam = lParam;
+        tail->msg.time = msg_get_tick_count();
+        tail->msg.pt_x = g_cursor_x;
+        tail->msg.pt_y = g_cursor_y;
+        return true;
+    }
+
+    if (!msg_list_push(&queue->input, hwnd, message, wParam, lParam)) {
+        return false;
+    }
+
+    msg_queue_wake(queue, msg_input_bits(message));
     return true;
 }
 
 void msg_queue_post_quit(int exitCode)
 {
-    g_msg_queue.quitPosted = true;
-    g_msg_queue.exitCode = exitCode;
+    WBOX_MSG_QUEUE *queue = msg_queue_current();
+    if (!queue) {
+        return;
+    }
 
-    /* Post WM_QUIT to the queue */
-    msg_queue_post(0, WM_QUIT, exitCode, 0);
+    queue->quitPosted = true;
+    queue->exitCode = exitCode;
+    msg_queue_wake(queue, QS_POSTMESSAGE | QS_ALLPOSTMESSAGE);
 }
 
+/*
+ * Cross-thread SendMessage
+ */
+
+WBOX_SENT_MSG *msg_queue_send(WBOX_MSG_QUEUE *target, uint32_t hwnd, uint32_t message,
+                              uint32_t wParam, uint32_t lParam)
+{
+    WBOX_MSG_QUEUE *sender = msg_queue_current();
+    if (!target || !sender) {
+        return NULL;
+    }
+
+    WBOX_SENT_MSG *sent = calloc(1, sizeof(WBOX_SENT_MSG));
+    if (!sent) {
+        return NULL;
+    }
+
+    sent->msg.hwnd = hwnd;
+    sent->msg.message = message;
+    sent->msg.wParam = wParam;
+    sent->msg.lParam = lParam;
+    sent->msg.time = msg_get_tick_count();
+    sent->msg.pt_x = g_cursor_x;
+    sent->msg.pt_y = g_cursor_y;
+    sent->sender = sender;
+
+    if (target->sentTail) {
+        target->sentTail->next = sent;
+    } else {
+        target->sentHead = sent;
+    }
+    target->sentTail = sent;
+
+    /* A window procedure called back during a send may send again */
+    sent->outerSend = sender->pendingSend;
+    sent->callbackDepth = user_callback_get_depth();
+    sender->pendingSend = sent;
+    msg_queue_wake(target, QS_SENDMESSAGE);
+    return sent;
+}
+
+WBOX_SENT_MSG *msg_queue_next_sent(WBOX_MSG_QUEUE *queue)
+{
+    WBOX_SENT_MSG *sent = queue ? queue->sentHead : NULL;
+    if (sent) {
+        queue->sentHead = sent->next;
+        if (!queue->sentHead) {
+            queue->sentTail = NULL;
+        }
+        sent->next = NULL;
+    }
+    return sent;
+}
+
+void msg_queue_reply(WBOX_SENT_MSG *sent, uint32_t result)
+{
+    sent->result = result;
+    sent->done = true;
+
+    if (!sent->sender) {
+        free(sent);
+        return;
+    }
+    msg_queue_wake(sent->sender, QS_SMRESULT);
+}
+
+/*
+ * Retrieval
+ */
+
 /*
  * Check if a message matches the filter criteria
  */
 static bool msg_matches_filter(const WBOX_MSG *msg, uint32_t hwndFilter,
                                uint32_t msgFilterMin, uint32_t msgFilterMax)
 {
-    /* hwndFilter: 0 = all, -1 = thread-specific, else = specific window */
-    if (hwndFilter != 0 && hwndFilter != (uint32_t)-1) {
-        if (msg->hwnd != hwndFilter) {
-            /* Also check if hwndFilter is parent of msg->hwnd */
-            WBOX_WND *filter_wnd = user_window_from_hwnd(hwndFilter);
-            WBOX_WND *msg_wnd = user_window_from_hwnd(msg->hwnd);
-            if (!filter_wnd || !msg_wnd) {
-                return false;
-            }
-            /* Check if msg_wnd is a child of filter_wnd */
-            bool is_child = false;
-            WBOX_WND *parent = msg_wnd->spwndParent;
-            while (parent) {
-                if (parent == filter_wnd) {
-                    is_child = true;
-                    break;
-                }
-                parent = parent->spwndParent;
-            }
-            if (!is_child) {
-                return false;
+    /* hwndFilter: 0 = all, -1 = thread messages only, else = window and children */
+    if (hwndFilter == (uint32_t)-1) {
+        if (msg->hwnd != 0) {
+            return false;
+        }
+    } else if (hwndFilter != 0 && msg->hwnd != hwndFilter) {
+        WBOX_WND *filter_wnd = user_window_from_hwnd(hwndFilter);
+        WBOX_WND *msg_wnd = user_window_from_hwnd(msg->hwnd);
+        if (!filter_wnd || !msg_wnd) {
+            return false;
+        }
+        /* Check if msg_wnd is a child of filter_wnd */
+        bool is_child = false;
+        WBOX_WND *parent = msg_wnd->spwndParent;
+        while (parent) {
+            if (parent == filter_wnd) {
+                is_child = true;
+                break;
             }
+            parent = parent->spwndParent;
+        }
+        if (!is_child) {
+            return false;
         }
     }
 
@@ -120,94 +836,86 @@ static bool msg_matches_filter(const WBOX_MSG *msg, uint32_t hwndFilter,
 }
 
 /*
- * Find the first window that needs painting
+ * Take the first message in a list that matches the filter
  */
-static WBOX_WND *find_window_needing_paint(void)
-{
-    /* Walk all windows and check for update region */
-    WBOX_WND *desktop = user_window_get_desktop();
-    if (!desktop) return NULL;
-
-    /* Simple DFS through window hierarchy */
-    WBOX_WND *wnd = desktop->spwndChild;
-    while (wnd) {
-        /* Check if this window needs painting */
-        if (user_window_is_visible(wnd) &&
-            (wnd->state & (WNDS_SENDNCPAINT | WNDS_SENDERASEBACKGROUND | WNDS_NONCPAINT | WNDS_ERASEBACKGROUND))) {
-            return wnd;
-        }
-
-        /* Check children first (depth-first) */
-        if (wnd->spwndChild) {
-            wnd = wnd->spwndChild;
-        } else if (wnd->spwndNext) {
-            wnd = wnd->spwndNext;
-        } else {
-            /* Go back up and find next sibling */
-            while (wnd->spwndParent && wnd->spwndParent != desktop && !wnd->spwndParent->spwndNext) {
-                wnd = wnd->spwndParent;
+static bool msg_list_take(WBOX_MSG_LIST *list, WBOX_MSG *out_msg, uint32_t hwndFilter,
+                          uint32_t msgFilterMin, uint32_t msgFilterMax, bool remove)
+{
+    for (WBOX_MSG_NODE *node = list->head; node; node = node->next) {
+        if (msg_matches_filter(&node->msg, hwndFilter, msgFilterMin, msgFilterMax)) {
+            if (out_msg) {
+                *out_msg = node->msg;
             }
-            if (wnd->spwndParent && wnd->spwndParent != desktop) {
-                wnd = wnd->spwndParent->spwndNext;
-            } else {
-                break;
+            if (remove) {
+                msg_list_unlink(list, node);
             }
+            return true;
         }
     }
+    return false;
+}
 
+/*
+ * Find the next window of this queue to paint, restricted to hwndFilter
+ * if one is given
+ */
+static WBOX_WND *find_window_needing_paint(const WBOX_MSG_QUEUE *queue, uint32_t hwndFilter)
+{
+    if (hwndFilter == 0) {
+        return queue->paintHead;
+    }
+
+    for (WBOX_WND *wnd = queue->paintHead; wnd; wnd = wnd->paint_next) {
+        if (wnd->hwnd == hwndFilter) {
+            return wnd;
+        }
+    }
     return NULL;
 }
 
-bool msg_queue_peek(WBOX_MSG *out_msg, uint32_t hwndFilter,
+bool msg_queue_peek(WBOX_MSG_QUEUE *queue, WBOX_MSG *out_msg, uint32_t hwndFilter,
                     uint32_t msgFilterMin, uint32_t msgFilterMax,
                     uint32_t flags)
 {
     bool remove = (flags & PM_REMOVE) != 0;
 
-    /* First, check posted messages */
-    int i = g_msg_queue.head;
-    int checked = 0;
-    while (checked < g_msg_queue.count) {
-        WBOX_MSG *msg = &g_msg_queue.messages[i];
-
-        if (msg_matches_filter(msg, hwndFilter, msgFilterMin, msgFilterMax)) {
-            /* Found a matching message */
-            if (out_msg) {
-                *out_msg = *msg;
-            }
+    if (!queue) {
+        return false;
+    }
 
-            if (remove) {
-                /* Remove from queue - shift remaining messages */
-                if (i == g_msg_queue.head) {
-                    g_msg_queue.head = (g_msg_queue.head + 1) % 256;
-                } else {
-                    /* Need to compact the queue - not ideal but simple */
-                    int src = (i + 1) % 256;
-                    int dst = i;
-                    int remaining = g_msg_queue.count - checked - 1;
-                    for (int j = 0; j < remaining; j++) {
-                        g_msg_queue.messages[dst] = g_msg_queue.messages[src];
-                        dst = (dst + 1) % 256;
-                        src = (src + 1) % 256;
-                    }
-                    g_msg_queue.tail = (g_msg_queue.tail - 1 + 256) % 256;
-                }
-                g_msg_queue.count--;
-            }
+    /* Posted messages first */
+    if (msg_list_take(&queue->posted, out_msg, hwndFilter, msgFilterMin, msgFilterMax, remove)) {
+        return true;
+    }
 
-            return true;
+    /* WM_QUIT once no matching posted message is left; it ignores filters */
+    if (queue->quitPosted) {
+        if (out_msg) {
+            out_msg->hwnd = 0;
+            out_msg->message = WM_QUIT;
+            out_msg->wParam = (uint32_t)queue->exitCode;
+            out_msg->lParam = 0;
+            out_msg->time = msg_get_tick_count();
+            out_msg->pt_x = g_cursor_x;
+            out_msg->pt_y = g_cursor_y;
+        }
+        if (remove) {
+            queue->quitPosted = false;
         }
+        return true;
+    }
 
-        i = (i + 1) % 256;
-        checked++;
+    /* Then hardware input */
+    if (msg_list_take(&queue->input, out_msg, hwndFilter, msgFilterMin, msgFilterMax, remove)) {
+        return true;
     }
 
     /* If no filter or filter includes WM_PAINT, check for windows needing paint */
-    if (msgFilterMin == 0 && msgFilterMax == 0 ||
+    if ((msgFilterMin == 0 && msgFilterMax == 0) ||
         (WM_PAINT >= msgFilterMin && WM_PAINT <= msgFilterMax)) {
 
-        WBOX_WND *paint_wnd = find_window_needing_paint();
-        if (paint_wnd && (hwndFilter == 0 || hwndFilter == paint_wnd->hwnd)) {
+        WBOX_WND *paint_wnd = find_window_needing_paint(queue, hwndFilter);
+        if (paint_wnd) {
             /* Synthesize WM_PAINT message */
             if (out_msg) {
                 out_msg->hwnd = paint_wnd->hwnd;
@@ -215,20 +923,65 @@ bool msg_queue_peek(WBOX_MSG *out_msg, uint32_t hwndFilter,
                 out_msg->wParam = 0;
                 out_msg->lParam = 0;
                 out_msg->time = msg_get_tick_count();
-                out_msg->pt_x = g_msg_queue.mouseX;
-                out_msg->pt_y = g_msg_queue.mouseY;
+                out_msg->pt_x = g_cursor_x;
+                out_msg->pt_y = g_cursor_y;
             }
             /* Note: WM_PAINT is not removed - it persists until validated */
             return true;
         }
     }
 
+    /* Timers last, so a short period cannot starve painting */
+    msg_queue_check_timers(queue);
+    WBOX_TIMER timer;
+    if (user_timer_take(&queue->timers, hwndFilter, msgFilterMin, msgFilterMax,
+                        remove, msg_timer_now(), &timer)) {
+        if (out_msg) {
+            out_msg->hwnd = timer.hwnd;
+            out_msg->message = (timer.flags & TMRF_SYSTEM) ? WM_SYSTIMER : WM_TIMER;
+            out_msg->wParam = timer.id;
+            out_msg->lParam = timer.proc;
+            out_msg->time = msg_get_tick_count();
+            out_msg->pt_x = g_cursor_x;
+            out_msg->pt_y = g_cursor_y;
+        }
+        return true;
+    }
+
     return false;
 }
 
-bool msg_queue_has_messages(void)
+uint32_t msg_queue_status_bits(WBOX_MSG_QUEUE *queue)
+{
+    uint32_t bits = 0;
+
+    if (!queue) {
+        return 0;
+    }
+
+    if (queue->posted.count > 0 || queue->quitPosted) {
+        bits |= QS_POSTMESSAGE | QS_ALLPOSTMESSAGE;
+    }
+    for (WBOX_MSG_NODE *node = queue->input.head; node; node = node->next) {
+        bits |= msg_input_bits(node->msg.message);
+    }
+    if (queue->sentHead) {
+        bits |= QS_SENDMESSAGE;
+    }
+    if (queue->paintHead) {
+        bits |= QS_PAINT;
+    }
+    msg_queue_check_timers(queue);
+    if (user_timer_any_ready(&queue->timers)) {
+        bits |= QS_TIMER;
+    }
+
+    return bits;
+}
+
+bool msg_queue_has_messages(WBOX_MSG_QUEUE *queue)
 {
-    return g_msg_queue.count > 0 || find_window_needing_paint() != NULL;
+    return msg_queue_status_bits(queue) != 0;
 }
 
 void msg_write_to_guest(vm_context_t *vm, uint32_t guest_addr, const WBOX_MSG *msg)
@@ -7,9 +7,13 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "user_timer.h"
 
-/* Forward declaration */
+/* Forward declarations */
 typedef struct vm_context vm_context_t;
+typedef struct _WBOX_WND WBOX_WND;
+struct wbox_event;
+struct wbox_thread;
 
 /* MSG structure (28 bytes, matches Windows) */
 typedef struct _WBOX_MSG {
@@ -22,12 +26,49 @@ typedef struct _WBOX_MSG {
     int32_t pt_y;       /* Cursor Y */
 } WBOX_MSG;
 
-/* Message queue (one per thread, but we only have one thread for now) */
+/* Queued message (doubly linked so filtered removal is O(1)) */
+typedef struct _WBOX_MSG_NODE {
+    WBOX_MSG msg;
+    struct _WBOX_MSG_NODE *prev;
+    struct _WBOX_MSG_NODE *next;
+} WBOX_MSG_NODE;
+
+/* FIFO of queued messages */
+typedef struct _WBOX_MSG_LIST {
+    WBOX_MSG_NODE *head;
+    WBOX_MSG_NODE *tail;
+    uint32_t count;
+} WBOX_MSG_LIST;
+
+/* Cross-thread SendMessage waiting for the receiver to run its wndproc.
+ * Owned by the sender, which frees it after reading the result; if the
+ * sender is gone (sender == NULL) the receiver frees it on reply. */
+typedef struct _WBOX_SENT_MSG {
+    WBOX_MSG msg;
+    struct _WBOX_MSG_QUEUE *sender;
+    uint32_t result;
+    bool done;
+    struct _WBOX_SENT_MSG *next;        /* Receiver's sentHead or sentActive list */
+    struct _WBOX_SENT_MSG *outerSend;   /* Sender's enclosing pending send */
+    int callbackDepth;                  /* Sender's callback depth when sent */
+} WBOX_SENT_MSG;
+
+/* Message queue (one per GUI thread, created on first use) */
 typedef struct _WBOX_MSG_QUEUE {
-    WBOX_MSG messages[256];  /* Circular buffer */
-    int head;                /* Next message to read */
-    int tail;                /* Next slot to write */
-    int count;               /* Messages in queue */
+    uint32_t threadId;       /* Owning thread */
+
+    /* Message sources, retrieved in this order (after sent messages):
+     * posted, quit, input, paint, timers */
+    WBOX_MSG_LIST posted;    /* PostMessage / PostThreadMessage */
+    WBOX_MSG_LIST input;     /* Keyboard and mouse input */
+    WBOX_SENT_MSG *sentHead; /* Inbound cross-thread SendMessage */
+    WBOX_SENT_MSG *sentTail;
+    WBOX_SENT_MSG *sentActive; /* Inbound sends whose wndproc is running, innermost first */
+    WBOX_SENT_MSG *pendingSend; /* Our own outbound SendMessages, innermost first */
+
+    /* Posted-message accounting (see MSG_QUEUE_POST_QUOTA) */
+    uint32_t postedPeak;     /* Highest posted.count seen */
+    uint32_t postsRejected;  /* Posts refused because the quota was hit */
 
     /* Focus/capture state */
     uint32_t hwndFocus;      /* Keyboard focus window */
@@ -37,15 +78,63 @@ typedef struct _WBOX_MSG_QUEUE {
     /* Keyboard state */
     uint8_t keyState[256];   /* Per-key up/down state */
 
-    /* Mouse position */
-    int32_t mouseX;
-    int32_t mouseY;
-
-    /* Quit flag */
+    /* Quit flag: WM_QUIT is synthesized once posted messages are drained */
     bool quitPosted;
     int exitCode;
+
+    /* Wakeup state: the event is signaled when a QS_* class in wakeMask
+     * arrives; changeBits collects classes that arrived since the last
+     * GetMessage/PeekMessage/WaitMessage */
+    struct wbox_event *wakeEvent;
+    uint32_t wakeEventHandle;   /* NT handle, created for MsgWaitForMultipleObjects */
+    uint32_t wakeMask;
+    uint32_t changeBits;
+
+    /* Windows needing WM_PAINT, kept in paint order (parents before
+     * children, siblings in z-order) so the next one is the head */
+    WBOX_WND *paintHead;
+    WBOX_WND *paintTail;
+    uint32_t paintCount;
+
+    /* SetTimer timers; WM_TIMER is synthesized from ready ones */
+    WBOX_TIMER_HEAP timers;
+
+    /* PeekMessage busy-loop detection (see msg_queue_throttle_peek) */
+    uint32_t emptyPeeks;        /* Consecutive empty peeks in quick succession */
+    uint64_t lastEmptyPeek;     /* Time of the last one (ms) */
+    bool peekThrottled;         /* Restarting after a throttled wait */
+
+    struct _WBOX_MSG_QUEUE *next;   /* All queues */
 } WBOX_MSG_QUEUE;
 
+/* Posted messages a queue may hold before PostMessage fails (Windows'
+ * default USERPostMessageLimit); the input list is not limited */
+#define MSG_QUEUE_POST_QUOTA 10000
+
+/* PeekMessage throttling: empty peeks less than PEEK_SPIN_GAP_MS apart
+ * count as spinning; from the PEEK_SPIN_THRESHOLD'th on, every other one
+ * waits up to PEEK_THROTTLE_MS for the queue to be woken */
+#define PEEK_SPIN_GAP_MS        2
+#define PEEK_SPIN_THRESHOLD     64
+#define PEEK_THROTTLE_MS        5
+
+/* Queue status classes (GetQueueStatus / MsgWaitForMultipleObjects) */
+#define QS_KEY          0x0001
+#define QS_MOUSEMOVE    0x0002
+#define QS_MOUSEBUTTON  0x0004
+#define QS_POSTMESSAGE  0x0008
+#define QS_TIMER        0x0010
+#define QS_PAINT        0x0020
+#define QS_SENDMESSAGE  0x0040
+#define QS_HOTKEY       0x0080
+#define QS_ALLPOSTMESSAGE 0x0100
+#define QS_RAWINPUT     0x0400
+#define QS_MOUSE        (QS_MOUSEMOVE | QS_MOUSEBUTTON)
+#define QS_INPUT        (QS_MOUSE | QS_KEY | QS_RAWINPUT)
+#define QS_ALLEVENTS    (QS_INPUT | QS_POSTMESSAGE | QS_TIMER | QS_PAINT | QS_HOTKEY)
+#define QS_ALLINPUT     (QS_ALLEVENTS | QS_SENDMESSAGE)
+#define QS_SMRESULT     0x8000  /* Internal: reply to our SendMessage arrived */
+
 /* PeekMessage flags */
 #define PM_NOREMOVE     0x0000
 #define PM_REMOVE       0x0001
@@ -85,6 +174,16 @@ typedef struct _WBOX_MSG_QUEUE {
 #define WM_NCHITTEST    0x0084
 #define WM_NCPAINT      0x0085
 #define WM_NCACTIVATE   0x0086
+#define WM_NCMOUSEMOVE  0x00A0
+#define WM_NCLBUTTONDOWN 0x00A1
+#define WM_NCLBUTTONUP  0x00A2
+#define WM_NCLBUTTONDBLCLK 0x00A3
+#define WM_NCRBUTTONDOWN 0x00A4
+#define WM_NCRBUTTONUP  0x00A5
+#define WM_NCRBUTTONDBLCLK 0x00A6
+#define WM_NCMBUTTONDOWN 0x00A7
+#define WM_NCMBUTTONUP  0x00A8
+#define WM_NCMBUTTONDBLCLK 0x00A9
 #define WM_KEYDOWN      0x0100
 #define WM_KEYUP        0x0101
 #define WM_CHAR         0x0102
@@ -94,6 +193,7 @@ typedef struct _WBOX_MSG_QUEUE {
 #define WM_COMMAND      0x0111
 #define WM_SYSCOMMAND   0x0112
 #define WM_TIMER        0x0113
+#define WM_SYSTIMER     0x0118
 #define WM_MOUSEMOVE    0x0200
 #define WM_LBUTTONDOWN  0x0201
 #define WM_LBUTTONUP    0x0202
@@ -105,6 +205,7 @@ typedef struct _WBOX_MSG_QUEUE {
 #define WM_MBUTTONUP    0x0208
 #define WM_MBUTTONDBLCLK 0x0209
 #define WM_MOUSEWHEEL   0x020A
+#define WM_CAPTURECHANGED 0x0215
 #define WM_USER         0x0400
 
 /* WM_SIZE wParam values */
@@ -112,6 +213,19 @@ typedef struct _WBOX_MSG_QUEUE {
 #define SIZE_MINIMIZED  1
 #define SIZE_MAXIMIZED  2
 
+/* Mouse message key flags (wParam) */
+#define MK_LBUTTON      0x0001
+#define MK_RBUTTON      0x0002
+#define MK_SHIFT        0x0004
+#define MK_CONTROL      0x0008
+#define MK_MBUTTON      0x0010
+
+/* WM_NCHITTEST codes */
+#define HTNOWHERE       0
+#define HTCLIENT        1
+#define HTCAPTION       2
+#define HTBORDER        18
+
 /* WM_ACTIVATE wParam values */
 #define WA_INACTIVE     0
 #define WA_ACTIVE       1
@@ -124,28 +238,106 @@ typedef struct _WBOX_MSG_QUEUE {
 #define GET_X_LPARAM(lp) ((int16_t)LOWORD(lp))
 #define GET_Y_LPARAM(lp) ((int16_t)HIWORD(lp))
 
-/* Global message queue */
-extern WBOX_MSG_QUEUE g_msg_queue;
-
-/* Initialize message queue */
+/* Initialize the message subsystem */
 void msg_queue_init(void);
 
-/* Post a message to the queue */
+/* Get the calling thread's queue, creating it on first use */
+WBOX_MSG_QUEUE *msg_queue_current(void);
+
+/* Get the queue of the thread that owns a window (NULL if it has exited) */
+WBOX_MSG_QUEUE *msg_queue_for_window(WBOX_WND *wnd);
+
+/* Free a thread's queue when it terminates; pending sends are answered */
+void msg_queue_thread_exit(struct wbox_thread *thread);
+
+/* Post a message to the queue of the window's thread (hwnd 0 = caller's)
+ * Returns false if the window is gone or the target is over quota */
 bool msg_queue_post(uint32_t hwnd, uint32_t message, uint32_t wParam, uint32_t lParam);
 
-/* Post quit message */
+/* Queue a keyboard or mouse message
+ * A mouse move replaces a move for the same window still at the tail. */
+bool msg_queue_post_input(WBOX_MSG_QUEUE *queue, uint32_t hwnd, uint32_t message,
+                          uint32_t wParam, uint32_t lParam);
+
+/* Post quit message to the calling thread's queue */
 void msg_queue_post_quit(int exitCode);
 
-/* Peek at messages in the queue
+/* Peek at messages in a queue (sent messages are not returned here)
  * Returns true if a message was found
  * If PM_REMOVE is set in flags, the message is removed from the queue
  */
-bool msg_queue_peek(WBOX_MSG *out_msg, uint32_t hwndFilter,
+bool msg_queue_peek(WBOX_MSG_QUEUE *queue, WBOX_MSG *out_msg, uint32_t hwndFilter,
                     uint32_t msgFilterMin, uint32_t msgFilterMax,
                     uint32_t flags);
 
 /* Check if queue has any messages */
-bool msg_queue_has_messages(void);
+bool msg_queue_has_messages(WBOX_MSG_QUEUE *queue);
+
+/* Queue a SendMessage for another thread's window and push it as the
+ * caller's pending send; the receiver answers with msg_queue_reply */
+WBOX_SENT_MSG *msg_queue_send(WBOX_MSG_QUEUE *target, uint32_t hwnd, uint32_t message,
+                              uint32_t wParam, uint32_t lParam);
+
+/* Take the oldest inbound sent message (NULL if none) */
+WBOX_SENT_MSG *msg_queue_next_sent(WBOX_MSG_QUEUE *queue);
+
+/* Answer a sent message and wake its sender */
+void msg_queue_reply(WBOX_SENT_MSG *sent, uint32_t result);
+
+/* Note that messages of the given QS_* classes arrived; wakes waiters */
+void msg_queue_wake(WBOX_MSG_QUEUE *queue, uint32_t qs_bits);
+
+/* QS_* classes of everything currently pending in the queue */
+uint32_t msg_queue_status_bits(WBOX_MSG_QUEUE *queue);
+
+/* Park the calling thread until its queue is woken
+ * The syscall is restarted on wake (see scheduler_park_syscall).
+ * Returns false if the thread cannot be parked; the caller must poll.
+ */
+bool msg_queue_wait(WBOX_MSG_QUEUE *queue);
+
+/* Account for a PeekMessage that found (or did not find) a message
+ * A thread spinning on an empty queue is parked briefly, until input, a
+ * post, a timer or PEEK_THROTTLE_MS; its restarted peek then returns
+ * whatever is there without waiting again. Returns true if parked. */
+bool msg_queue_throttle_peek(WBOX_MSG_QUEUE *queue, bool found);
+
+/* Set the MsgWaitForMultipleObjects wake mask and return the queue's
+ * event handle (signaled at once if matching input is already pending) */
+uint32_t msg_queue_set_wake_mask(WBOX_MSG_QUEUE *queue, uint32_t wake_mask);
+
+/* Clear the MsgWaitForMultipleObjects wake mask
+ * Done by GetMessage/PeekMessage, which user32 always calls after a wait. */
+void msg_queue_clear_wake_mask(WBOX_MSG_QUEUE *queue);
+
+/* Add a window to or remove it from its thread's paint set after its
+ * visibility, update region or WNDS_*PAINT/ERASE state changed */
+void msg_queue_update_paint(WBOX_WND *wnd);
+
+/* Re-sort a window and its descendants in the paint set after they were
+ * moved in the window tree */
+void msg_queue_reorder_paint(WBOX_WND *wnd);
+
+/* Remove a window from the paint set (window destruction) */
+void msg_queue_remove_paint(WBOX_WND *wnd);
+
+/* Create or reset a timer in a queue (see user_timer_set); the elapse
+ * is clamped to USER_TIMER_MINIMUM..USER_TIMER_MAXIMUM
+ * Returns the timer id, or 0 on failure. */
+uint32_t msg_queue_set_timer(WBOX_MSG_QUEUE *queue, uint32_t hwnd, uint32_t id,
+                             uint32_t elapse, uint32_t proc, uint32_t flags);
+
+/* Remove a timer from a queue */
+bool msg_queue_kill_timer(WBOX_MSG_QUEUE *queue, uint32_t hwnd, uint32_t id, uint32_t flags);
+
+/* Remove the timers of a window (window destruction) */
+void msg_queue_kill_window_timers(WBOX_WND *wnd);
+
+/* Mark expired timers ready and wake the queue for them (QS_TIMER) */
+void msg_queue_check_timers(WBOX_MSG_QUEUE *queue);
+
+/* Set the cursor position stamped on queued messages */
+void msg_set_cursor_pos(int32_t x, int32_t y);
 
 /* Get current tick count (for message timestamps) */
 uint32_t msg_get_tick_count(void);
@@ -281,7 +281,7 @@ uint32_t user_fill_userconnect(WBOX_USERCONNECT *uc)
     /* Allocate guest memory for SERVERINFO if not already done */
     if (g_serverinfo_guest_va == 0) {
         /* Use a fixed address in shared user space */
-        g_serverinfo_guest_va = 0x7F020000;  /* After loader heap region */
+        g_serverinfo_guest_va = 0x7F020000;  /* After the loader stub region */
 
         /* Allocate physical memory for SERVERINFO */
         uint32_t si_size = sizeof(WBOX_SERVERINFO);
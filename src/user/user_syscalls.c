@@ -8,11 +8,13 @@
 #include "user_window.h"
 #include "user_message.h"
 #include "user_callback.h"
+#include "user_input.h"
 #include "desktop_heap.h"
 #include "guest_wnd.h"
 #include "../nt/syscalls.h"
 #include "../nt/win32k_syscalls.h"
 #include "../vm/vm.h"
+#include "../vm/startup_profile.h"
 #include "../vm/paging.h"
 #include "../gdi/display.h"
 #include "../cpu/cpu.h"
@@ -719,6 +721,51 @@ ntstatus_t sys_NtUserGetClassInfoEx(void)
     return sys_NtUserGetClassInfo();
 }
 
+/*
+ * CreateWindowEx continuations
+ * ctx: [0] hwnd, [1] CREATESTRUCT on the guest stack, [2] ESP to restore
+ */
+static ntstatus_t create_window_create_done(uint32_t result, uint32_t *ctx)
+{
+    ESP = ctx[2];  /* Restore stack */
+
+    WBOX_WND *wnd = user_window_from_hwnd(ctx[0]);
+    if (!wnd) {
+        EAX = 0;
+        return STATUS_SUCCESS;
+    }
+
+    if (result == (uint32_t)-1) {
+        /* WM_CREATE returned -1 - destroy window and fail */
+        fprintf(stderr, "USER: WM_CREATE returned -1, destroying window\n");
+        user_window_destroy(wnd);
+        EAX = 0;
+        return STATUS_SUCCESS;
+    }
+
+    EAX = wnd->hwnd;
+    return STATUS_SUCCESS;
+}
+
+static ntstatus_t create_window_nccreate_done(uint32_t result, uint32_t *ctx)
+{
+    WBOX_WND *wnd = user_window_from_hwnd(ctx[0]);
+    if (!wnd || result == 0) {
+        /* Gone, or WM_NCCREATE returned FALSE: destroy and fail without WM_CREATE */
+        if (wnd) {
+            fprintf(stderr, "USER: WM_NCCREATE returned FALSE, destroying window\n");
+            user_window_destroy(wnd);
+        }
+        ESP = ctx[2];
+        EAX = 0;
+        return STATUS_SUCCESS;
+    }
+
+    /* Send WM_CREATE message via callback with CREATESTRUCT pointer */
+    return user_call_wndproc(vm_get_context(), wnd, WM_CREATE, 0, ctx[1],
+                             create_window_create_done, ctx);
+}
+
 /*
  * NtUserCreateWindowEx - create a window
  * Syscall number: 348 (0x15C)
@@ -844,6 +891,9 @@ ntstatus_t sys_NtUserCreateWindowEx(void)
 
     printf("USER: Created window hwnd=0x%08X, wndproc=0x%08X\n", wnd->hwnd, wnd->lpfnWndProc);
 
+    /* Startup ends with the first window */
+    startup_profile_first_window(vm_get_context()->profile);
+
     /* Allocate CREATESTRUCT on the guest stack for WM_NCCREATE/WM_CREATE
      * CREATESTRUCTW layout:
      *   +0  lpCreateParams  (4 bytes)
@@ -904,29 +954,11 @@ ntstatus_t sys_NtUserCreateWindowEx(void)
     writememll(createstruct_va + 40, class_buf_va); /* lpszClass */
     writememll(createstruct_va + 44, dwExStyle);    /* dwExStyle */
 
-    /* Send WM_NCCREATE message via callback with CREATESTRUCT pointer */
-    uint32_t result = user_call_wndproc(vm, wnd, WM_NCCREATE, 0, createstruct_va);
-    if (result == 0) {
-        /* WM_NCCREATE returned FALSE - normally we'd destroy and fail
-         * For debugging, continue anyway to see what happens next */
-        fprintf(stderr, "USER: WM_NCCREATE returned FALSE (ignoring for debug)\n");
-    }
-
-    /* Send WM_CREATE message via callback with CREATESTRUCT pointer */
-    result = user_call_wndproc(vm, wnd, WM_CREATE, 0, createstruct_va);
-    if (result == (uint32_t)-1) {
-        /* WM_CREATE returned -1 - destroy window and fail */
-        fprintf(stderr, "USER: WM_CREATE returned -1, destroying window\n");
-        ESP = saved_esp;  /* Restore stack */
-        user_window_destroy(wnd);
-        EAX = 0;
-        return STATUS_SUCCESS;
-    }
-
-    ESP = saved_esp;  /* Restore stack */
-
-    EAX = wnd->hwnd;
-    return STATUS_SUCCESS;
+    /* Send WM_NCCREATE message via callback with CREATESTRUCT pointer;
+     * WM_CREATE follows in its continuation */
+    uint32_t ctx[USER_CALLBACK_CTX_WORDS] = { wnd->hwnd, createstruct_va, saved_esp };
+    return user_call_wndproc(vm, wnd, WM_NCCREATE, 0, createstruct_va,
+                             create_window_nccreate_done, ctx);
 }
 
 /*
@@ -942,6 +974,71 @@ bool user_is_client_pfn_init(void) { return g_client_pfn_init; }
  */
 bool user_is_initialized(void) { return g_user_initialized; }
 
+/* A host window close has been turned into WM_QUIT */
+static bool g_host_quit_posted = false;
+
+/*
+ * Pump SDL events into the message queue
+ * A quit request from the host window becomes WM_QUIT (posted once).
+ */
+static void poll_display_input(vm_context_t *vm)
+{
+    if (!vm || !vm->gui_mode) {
+        return;
+    }
+
+    display_poll_events(&vm->display);
+    user_input_process(&vm->display);
+
+    if (vm->display.quit_requested && !g_host_quit_posted) {
+        g_host_quit_posted = true;
+        msg_queue_post_quit(0);
+    }
+}
+
+/* A sent message's window procedure returned: answer it and run the
+ * syscall that dispatched it again */
+static ntstatus_t sent_message_done(uint32_t result, uint32_t *ctx)
+{
+    (void)ctx;
+
+    WBOX_MSG_QUEUE *queue = msg_queue_current();
+    WBOX_SENT_MSG *sent = queue ? queue->sentActive : NULL;
+    if (sent) {
+        queue->sentActive = sent->next;
+        sent->next = NULL;
+        msg_queue_reply(sent, result);
+    }
+    return user_callback_restart_syscall();
+}
+
+/*
+ * Run the window procedure of the oldest message another thread sent to
+ * this one. Windows does this inside Get/PeekMessage and while a sender
+ * waits. The calling syscall restarts when the procedure returns, so all
+ * sent messages are handled before it goes on.
+ * Returns false if none is pending; otherwise the syscall returns *status.
+ */
+static bool dispatch_sent_message(vm_context_t *vm, WBOX_MSG_QUEUE *queue, ntstatus_t *status)
+{
+    WBOX_SENT_MSG *sent;
+    while ((sent = msg_queue_next_sent(queue)) != NULL) {
+        WBOX_WND *wnd = user_window_from_hwnd(sent->msg.hwnd);
+        if (!wnd) {
+            msg_queue_reply(sent, 0);
+            continue;
+        }
+
+        sent->next = queue->sentActive;
+        queue->sentActive = sent;
+        *status = user_call_wndproc(vm, wnd, sent->msg.message,
+                                    sent->msg.wParam, sent->msg.lParam,
+                                    sent_message_done, NULL);
+        return true;
+    }
+    return false;
+}
+
 /*
  * NtUserPeekMessage - peek at message queue
  * Syscall number: 479
@@ -964,20 +1061,29 @@ ntstatus_t sys_NtUserPeekMessage(void)
     uint32_t removeFlags  = read_stack_arg(4);
 
     vm_context_t *vm = vm_get_context();
+    WBOX_MSG_QUEUE *queue = msg_queue_current();
 
     /* Poll SDL events first to generate new messages */
-    if (vm && vm->gui_mode) {
-        display_poll_events(&vm->display);
-
-        /* Check if quit was requested via SDL */
-        if (vm->display.quit_requested) {
-            msg_queue_post_quit(0);
-        }
+    poll_display_input(vm);
+    ntstatus_t status;
+    if (dispatch_sent_message(vm, queue, &status)) {
+        return status;
     }
 
     /* Try to get a message */
     WBOX_MSG msg;
-    bool found = msg_queue_peek(&msg, hwnd, msgFilterMin, msgFilterMax, removeFlags);
+    bool found = msg_queue_peek(queue, &msg, hwnd, msgFilterMin, msgFilterMax, removeFlags);
+
+    /* An app spinning on an empty queue gets parked for a moment; the
+     * peek restarts when woken and then returns without waiting */
+    if (msg_queue_throttle_peek(queue, found)) {
+        return STATUS_PENDING;
+    }
+
+    if (queue) {
+        queue->changeBits = 0;
+    }
+    msg_queue_clear_wake_mask(queue);
 
     if (found && pMsg != 0) {
         msg_write_to_guest(vm, pMsg, &msg);
@@ -1007,39 +1113,47 @@ ntstatus_t sys_NtUserGetMessage(void)
     uint32_t msgFilterMax = read_stack_arg(3);
 
     vm_context_t *vm = vm_get_context();
+    WBOX_MSG_QUEUE *queue = msg_queue_current();
+    if (!queue) {
+        EAX = (uint32_t)-1;
+        return STATUS_SUCCESS;
+    }
 
-    /* Block until message available */
     WBOX_MSG msg;
-    bool found = false;
-
-    while (!found) {
-        /* Poll SDL events */
-        if (vm && vm->gui_mode) {
-            display_poll_events(&vm->display);
-
-            /* Check if quit was requested via SDL */
-            if (vm->display.quit_requested) {
-                msg_queue_post_quit(0);
-            }
+    poll_display_input(vm);
+    ntstatus_t status;
+    if (dispatch_sent_message(vm, queue, &status)) {
+        return status;
+    }
+    bool found = msg_queue_peek(queue, &msg, hwnd, msgFilterMin, msgFilterMax, PM_REMOVE);
+
+    if (!found) {
+        /* Park the thread on the queue's wake event; posting, input, timers
+         * and invalidation wake it and the syscall runs again from the top */
+        if (msg_queue_wait(queue)) {
+            return STATUS_PENDING;
         }
 
-        /* Check for message */
-        found = msg_queue_peek(&msg, hwnd, msgFilterMin, msgFilterMax, PM_REMOVE);
-
-        if (!found) {
-            /* No message - yield briefly and try again */
-            /* In a real implementation we'd use select() or similar */
-            /* For now, just present the display and continue */
+        /* Cannot switch threads here (no scheduler), poll instead */
+        while (!found) {
             if (vm && vm->gui_mode) {
                 display_present(&vm->display);
             }
 
-            /* Small delay to avoid busy-spinning */
             struct timespec ts = { 0, 10000000 };  /* 10ms */
             nanosleep(&ts, NULL);
+
+            poll_display_input(vm);
+            if (dispatch_sent_message(vm, queue, &status)) {
+                return status;
+            }
+            found = msg_queue_peek(queue, &msg, hwnd, msgFilterMin, msgFilterMax, PM_REMOVE);
         }
     }
 
+    queue->changeBits = 0;
+    msg_queue_clear_wake_mask(queue);
+
     if (pMsg != 0) {
         msg_write_to_guest(vm, pMsg, &msg);
     }
@@ -1054,6 +1168,45 @@ ntstatus_t sys_NtUserGetMessage(void)
     return STATUS_SUCCESS;
 }
 
+/*
+ * NtUserWaitMessage - wait until new input arrives in the queue
+ * Syscall number: 586
+ *
+ * Returns: BOOL
+ */
+ntstatus_t sys_NtUserWaitMessage(void)
+{
+    vm_context_t *vm = vm_get_context();
+    WBOX_MSG_QUEUE *queue = msg_queue_current();
+    if (!queue) {
+        EAX = 0;
+        return STATUS_SUCCESS;
+    }
+
+    poll_display_input(vm);
+    ntstatus_t status;
+    if (dispatch_sent_message(vm, queue, &status)) {
+        return status;
+    }
+
+    /* Only messages that arrived since the last Get/PeekMessage count */
+    msg_queue_check_timers(queue);
+    if (!queue->changeBits) {
+        if (msg_queue_wait(queue)) {
+            return STATUS_PENDING;
+        }
+
+        /* Cannot park (no scheduler): wait one polling interval */
+        struct timespec ts = { 0, 10000000 };  /* 10ms */
+        nanosleep(&ts, NULL);
+        poll_display_input(vm);
+    }
+
+    queue->changeBits = 0;
+    EAX = 1;
+    return STATUS_SUCCESS;
+}
+
 /*
  * NtUserTranslateMessage - translate virtual key messages to char messages
  * Syscall number: 571
@@ -1090,7 +1243,8 @@ ntstatus_t sys_NtUserTranslateMessage(void)
     char ch = 0;
     if (vk >= 'A' && vk <= 'Z') {
         /* Check shift state */
-        bool shift = (g_msg_queue.keyState[0x10] & 0x80) != 0;  /* VK_SHIFT */
+        WBOX_MSG_QUEUE *queue = msg_queue_current();
+        bool shift = queue && (queue->keyState[0x10] & 0x80) != 0;  /* VK_SHIFT */
         ch = shift ? vk : (vk + 32);  /* Lowercase if not shifted */
     } else if (vk >= '0' && vk <= '9') {
         ch = (char)vk;
@@ -1110,6 +1264,14 @@ ntstatus_t sys_NtUserTranslateMessage(void)
     return STATUS_SUCCESS;
 }
 
+/* DispatchMessage returns what the window procedure returned */
+static ntstatus_t dispatch_message_done(uint32_t result, uint32_t *ctx)
+{
+    (void)ctx;
+    EAX = result;
+    return STATUS_SUCCESS;
+}
+
 /*
  * NtUserDispatchMessage - dispatch message to window procedure
  * Syscall number: 362
@@ -1129,6 +1291,18 @@ ntstatus_t sys_NtUserDispatchMessage(void)
     WBOX_MSG msg;
     msg_read_from_guest(vm, pMsg, &msg);
 
+    /* WM_TIMER with a TIMERPROC goes to the proc, window or not */
+    if ((msg.message == WM_TIMER || msg.message == WM_SYSTIMER) && msg.lParam != 0) {
+        WBOX_MSG_QUEUE *queue = msg_queue_current();
+        if (!queue || !user_timer_has_proc(&queue->timers, msg.lParam)) {
+            EAX = 0;
+            return STATUS_SUCCESS;
+        }
+        return user_call_wndproc_addr(vm, msg.lParam, msg.hwnd, msg.message,
+                                      msg.wParam, msg_get_tick_count(),
+                                      dispatch_message_done, NULL);
+    }
+
     /* Find the window */
     WBOX_WND *wnd = user_window_from_hwnd(msg.hwnd);
     if (!wnd) {
@@ -1150,10 +1324,81 @@ ntstatus_t sys_NtUserDispatchMessage(void)
     }
 
     /* Call the window procedure via callback mechanism */
-    uint32_t result = user_call_wndproc_addr(vm, wndproc, msg.hwnd,
-                                              msg.message, msg.wParam, msg.lParam);
+    return user_call_wndproc_addr(vm, wndproc, msg.hwnd, msg.message,
+                                  msg.wParam, msg.lParam, dispatch_message_done, NULL);
+}
 
-    EAX = result;
+/*
+ * Queue that holds a window's timers (the caller's for thread timers)
+ * Returns NULL if hwnd names no window.
+ */
+static WBOX_MSG_QUEUE *timer_queue_for_hwnd(uint32_t hwnd)
+{
+    if (hwnd == 0) {
+        return msg_queue_current();
+    }
+    WBOX_WND *wnd = user_window_from_hwnd(hwnd);
+    return wnd ? msg_queue_for_window(wnd) : NULL;
+}
+
+/*
+ * NtUserSetTimer - create or reset a timer
+ * Syscall number: 544
+ *
+ * Parameters:
+ *   arg0: HWND hwnd            - Window receiving WM_TIMER (0 = thread timer)
+ *   arg1: UINT_PTR nIDEvent    - Timer id (ignored for new thread timers)
+ *   arg2: UINT uElapse         - Period in milliseconds
+ *   arg3: TIMERPROC lpTimerFunc - Callback, or 0 to deliver to the wndproc
+ *
+ * Returns: UINT_PTR timer id (0 on failure)
+ */
+ntstatus_t sys_NtUserSetTimer(void)
+{
+    uint32_t hwnd   = read_stack_arg(0);
+    uint32_t id     = read_stack_arg(1);
+    uint32_t elapse = read_stack_arg(2);
+    uint32_t proc   = read_stack_arg(3);
+
+    EAX = msg_queue_set_timer(timer_queue_for_hwnd(hwnd), hwnd, id, elapse, proc, 0);
+    return STATUS_SUCCESS;
+}
+
+/*
+ * NtUserSetSystemTimer - create or reset a timer delivering WM_SYSTIMER
+ * Syscall number: 540
+ *
+ * Parameters: as NtUserSetTimer
+ *
+ * Returns: UINT_PTR timer id (0 on failure)
+ */
+ntstatus_t sys_NtUserSetSystemTimer(void)
+{
+    uint32_t hwnd   = read_stack_arg(0);
+    uint32_t id     = read_stack_arg(1);
+    uint32_t elapse = read_stack_arg(2);
+    uint32_t proc   = read_stack_arg(3);
+
+    EAX = msg_queue_set_timer(timer_queue_for_hwnd(hwnd), hwnd, id, elapse, proc, TMRF_SYSTEM);
+    return STATUS_SUCCESS;
+}
+
+/*
+ * NtUserKillTimer - destroy a timer
+ * Syscall number: 458
+ *
+ * Parameters:
+ *   arg0: HWND hwnd            - Window passed to SetTimer
+ *   arg1: UINT_PTR uIDEvent    - Timer id
+ *
+ * Returns: BOOL
+ */
+ntstatus_t sys_NtUserKillTimer(void)
+{
+    uint32_t hwnd = read_stack_arg(0);
+    uint32_t id   = read_stack_arg(1);
+
+    EAX = msg_queue_kill_timer(timer_queue_for_hwnd(hwnd), hwnd, id, 0) ? 1 : 0;
     return STATUS_SUCCESS;
 }
 
@@ -1235,6 +1480,9 @@ ntstatus_t sys_NtUserShowWindow(void)
 
         /* Mark for repaint */
         wnd->state |= WNDS_SENDNCPAINT | WNDS_SENDERASEBACKGROUND;
+        wnd->guest_dirty |= WNDD_STATE;
+        guest_wnd_sync(wnd);
+        msg_queue_update_paint(wnd);
     }
 
     printf("USER: ShowWindow(hwnd=0x%X, cmd=%d) -> wasVisible=%d\n",
@@ -1245,36 +1493,124 @@ ntstatus_t sys_NtUserShowWindow(void)
 }
 
 /*
- * NtUserSetFocus - set keyboard focus
- * Syscall number: 527
+ * NtUserSetWindowLong - set a window attribute or extra-bytes value
+ * Syscall number: 546
  *
  * Parameters:
- *   arg0: HWND hwnd            - Window to receive focus
+ *   arg0: HWND hwnd            - Window handle
+ *   arg1: int index            - GWL_* index or extra-bytes offset
+ *   arg2: LONG value           - New value
+ *   arg3: BOOL ansi            - ANSI caller (ignored)
  *
- * Returns: HWND (previous focus window)
+ * Returns: LONG (previous value)
  */
-ntstatus_t sys_NtUserSetFocus(void)
+ntstatus_t sys_NtUserSetWindowLong(void)
 {
     uint32_t hwnd = read_stack_arg(0);
+    int index = (int)read_stack_arg(1);
+    uint32_t value = read_stack_arg(2);
 
-    uint32_t oldFocus = g_msg_queue.hwndFocus;
+    WBOX_WND *wnd = user_window_from_hwnd(hwnd);
+    if (!wnd) {
+        EAX = 0;
+        return STATUS_SUCCESS;
+    }
 
-    if (oldFocus != hwnd) {
-        /* Send WM_KILLFOCUS to old window */
-        if (oldFocus != 0) {
-            msg_queue_post(oldFocus, WM_KILLFOCUS, hwnd, 0);
-        }
+    /* Only the changed field is copied to the guest WND */
+    EAX = user_window_set_long(wnd, index, value);
+    return STATUS_SUCCESS;
+}
+
+/*
+ * NtUserSetWindowPos - move, resize, show or hide a window
+ * Syscall number: 548
+ *
+ * Parameters:
+ *   arg0: HWND hwnd            - Window handle
+ *   arg1: HWND hwndInsertAfter - Z-order position (ignored)
+ *   arg2: int x                - New left edge
+ *   arg3: int y                - New top edge
+ *   arg4: int cx               - New width
+ *   arg5: int cy               - New height
+ *   arg6: UINT flags           - SWP_* flags
+ *
+ * Returns: BOOL
+ */
+ntstatus_t sys_NtUserSetWindowPos(void)
+{
+    uint32_t hwnd = read_stack_arg(0);
+    int x = (int)read_stack_arg(2);
+    int y = (int)read_stack_arg(3);
+    int cx = (int)read_stack_arg(4);
+    int cy = (int)read_stack_arg(5);
+    uint32_t flags = read_stack_arg(6);
+
+    WBOX_WND *wnd = user_window_from_hwnd(hwnd);
+    if (!wnd) {
+        EAX = 0;
+        return STATUS_SUCCESS;
+    }
+
+    WBOX_RECT old = wnd->rcWindow;
+    if (flags & SWP_NOMOVE) {
+        x = old.left;
+        y = old.top;
+    }
+    if (flags & SWP_NOSIZE) {
+        cx = old.right - old.left;
+        cy = old.bottom - old.top;
+    }
+    if (cx < 0) cx = 0;
+    if (cy < 0) cy = 0;
 
-        /* Update focus */
-        g_msg_queue.hwndFocus = hwnd;
+    bool moved = x != old.left || y != old.top;
+    bool sized = cx != old.right - old.left || cy != old.bottom - old.top;
+
+    /* Layout code repeats positions a lot; an unchanged rect costs nothing */
+    if (moved || sized) {
+        user_window_set_pos(wnd, x, y, cx, cy, flags);
+    }
+
+    if (flags & SWP_HIDEWINDOW) {
+        user_window_show(wnd, SW_HIDE);
+    } else if (flags & SWP_SHOWWINDOW) {
+        user_window_show(wnd, SW_SHOWNA);
+    }
+
+    if (moved) {
+        msg_queue_post(hwnd, WM_MOVE, 0, MAKELPARAM(wnd->rcClient.left, wnd->rcClient.top));
+    }
+    if (sized) {
+        int width = wnd->rcClient.right - wnd->rcClient.left;
+        int height = wnd->rcClient.bottom - wnd->rcClient.top;
+        msg_queue_post(hwnd, WM_SIZE, SIZE_RESTORED, MAKELPARAM(width, height));
 
-        /* Send WM_SETFOCUS to new window */
-        if (hwnd != 0) {
-            msg_queue_post(hwnd, WM_SETFOCUS, oldFocus, 0);
+        if (!(flags & SWP_NOREDRAW) && user_window_is_visible(wnd)) {
+            wnd->state |= WNDS_SENDNCPAINT | WNDS_SENDERASEBACKGROUND;
+            wnd->guest_dirty |= WNDD_STATE;
+            guest_wnd_sync(wnd);
+            msg_queue_update_paint(wnd);
         }
     }
 
-    EAX = oldFocus;
+    EAX = 1;
+    return STATUS_SUCCESS;
+}
+
+/*
+ * NtUserSetFocus - set keyboard focus
+ * Syscall number: 527
+ *
+ * Parameters:
+ *   arg0: HWND hwnd            - Window to receive focus
+ *
+ * Returns: HWND (previous focus window)
+ */
+ntstatus_t sys_NtUserSetFocus(void)
+{
+    uint32_t hwnd = read_stack_arg(0);
+
+    EAX = user_input_set_focus(msg_queue_current(), hwnd);
     return STATUS_SUCCESS;
 }
 
@@ -1286,7 +1622,7 @@ ntstatus_t sys_NtUserSetFocus(void)
  */
 ntstatus_t sys_NtUserGetForegroundWindow(void)
 {
-    EAX = g_msg_queue.hwndActive;
+    EAX = user_input_get_foreground();
     return STATUS_SUCCESS;
 }
 
@@ -1303,24 +1639,29 @@ ntstatus_t sys_NtUserSetActiveWindow(void)
 {
     uint32_t hwnd = read_stack_arg(0);
 
-    uint32_t oldActive = g_msg_queue.hwndActive;
-
-    if (oldActive != hwnd) {
-        /* Deactivate old window */
-        if (oldActive != 0) {
-            msg_queue_post(oldActive, WM_ACTIVATE, WA_INACTIVE, hwnd);
-        }
+    EAX = user_input_activate(msg_queue_current(), hwnd, WA_ACTIVE);
+    return STATUS_SUCCESS;
+}
 
-        /* Update active window */
-        g_msg_queue.hwndActive = hwnd;
+/*
+ * NtUserSetCapture - capture the mouse
+ * Syscall number: 509
+ *
+ * Parameters:
+ *   arg0: HWND hwnd            - Window to receive all mouse input (0 = release)
+ *
+ * Returns: HWND (previous capture window of this thread)
+ */
+ntstatus_t sys_NtUserSetCapture(void)
+{
+    uint32_t hwnd = read_stack_arg(0);
 
-        /* Activate new window */
-        if (hwnd != 0) {
-            msg_queue_post(hwnd, WM_ACTIVATE, WA_ACTIVE, oldActive);
-        }
+    if (hwnd != 0 && !user_window_from_hwnd(hwnd)) {
+        EAX = 0;
+        return STATUS_SUCCESS;
     }
 
-    EAX = oldActive;
+    EAX = user_input_set_capture(msg_queue_current(), hwnd);
     return STATUS_SUCCESS;
 }
 
@@ -1337,7 +1678,8 @@ ntstatus_t sys_NtUserGetKeyState(void)
 {
     int vKey = (int)read_stack_arg(0);
 
-    uint8_t state = g_msg_queue.keyState[vKey & 0xFF];
+    WBOX_MSG_QUEUE *queue = msg_queue_current();
+    uint8_t state = queue ? queue->keyState[vKey & 0xFF] : 0;
 
     /* Return format: high bit set if key is down */
     uint16_t result = (state & 0x80) ? 0x8000 : 0;
@@ -1360,8 +1702,11 @@ ntstatus_t sys_NtUserGetKeyState(void)
  */
 ntstatus_t sys_NtUserGetAsyncKeyState(void)
 {
-    /* For now, same as GetKeyState */
-    return sys_NtUserGetKeyState();
+    int vKey = (int)read_stack_arg(0);
+
+    /* Physical state: high bit set if the key is down now */
+    EAX = (user_input_async_key_state(vKey) & 0x80) ? 0x8000 : 0;
+    return STATUS_SUCCESS;
 }
 
 /* DISPLAY_DEVICE state flags */
@@ -1667,11 +2012,16 @@ ntstatus_t sys_NtUserFindWindowEx(void)
             class_atom = atom_result;
             fprintf(stderr, "  -> Class atom: 0x%04X\n", class_atom);
         } else if (classNameBuf[0] != 0) {
-            /* It's a string - look up class by name to get atom */
+            /* It's a string - windows match by class atom, and classes of
+             * every instance with this name share it. Classes registered
+             * under a caller-supplied atom only have a synthetic name. */
             fprintf(stderr, "  -> Class name: '%ls'\n", classNameBuf);
-            WBOX_CLS *cls = user_class_find(classNameBuf, 0);
-            if (cls) {
-                class_atom = cls->atomClassName;
+            class_atom = user_class_find_atom(classNameBuf);
+            if (class_atom == 0) {
+                WBOX_CLS *cls = user_class_find(classNameBuf, 0);
+                class_atom = cls ? cls->atomClassName : 0;
+            }
+            if (class_atom != 0) {
                 fprintf(stderr, "  -> Found class with atom: 0x%04X\n", class_atom);
             } else {
                 /* Class not found - no windows can match */
@@ -2075,6 +2425,16 @@ static uint32_t def_wndproc_kernel(uint32_t hwnd, uint32_t msg, uint32_t wParam,
     }
 }
 
+/* Same-thread SendMessage: ctx[0] is the ResultInfo pointer */
+static ntstatus_t send_message_done(uint32_t result, uint32_t *ctx)
+{
+    if (ctx[0] != 0) {
+        writememll(ctx[0], result);
+    }
+    EAX = 1;
+    return STATUS_SUCCESS;
+}
+
 /*
  * NtUserMessageCall - message passing and default window procedure
  * Syscall number: 459
@@ -2113,14 +2473,55 @@ ntstatus_t sys_NtUserMessageCall(void)
             break;
 
         case FNID_SENDMESSAGE:
-            /* SendMessage - call the window procedure directly */
             {
                 WBOX_WND *wnd = user_window_from_hwnd(hwnd);
-                if (wnd) {
-                    vm_context_t *vm = vm_get_context();
-                    result = user_call_wndproc(vm, wnd, msg, wParam, lParam);
+                if (!wnd) {
+                    break;
+                }
+
+                vm_context_t *vm = vm_get_context();
+                WBOX_MSG_QUEUE *queue = msg_queue_current();
+                WBOX_MSG_QUEUE *target = msg_queue_for_window(wnd);
+
+                /* Another thread's window: queue the message there and park
+                 * until it has been answered. The syscall restarts on every
+                 * wake; a pending send made at the current callback depth
+                 * tells a restart from a new send. */
+                if (queue && target && target != queue) {
+                    WBOX_SENT_MSG *sent = queue->pendingSend;
+                    if (!sent || sent->callbackDepth != user_callback_get_depth()) {
+                        sent = msg_queue_send(target, hwnd, msg, wParam, lParam);
+                        if (!sent) {
+                            break;
+                        }
+                    }
+
+                    /* Serve sends aimed at us so two threads sending to each
+                     * other cannot deadlock */
+                    ntstatus_t status;
+                    if (dispatch_sent_message(vm, queue, &status)) {
+                        return status;
+                    }
+
+                    if (!sent->done && msg_queue_wait(queue)) {
+                        return STATUS_PENDING;
+                    }
+
+                    queue->pendingSend = sent->outerSend;
+                    if (sent->done) {
+                        result = sent->result;
+                        free(sent);
+                    } else {
+                        /* Could not wait; the receiver frees it when it replies */
+                        sent->sender = NULL;
+                    }
                     handled = true;
+                    break;
                 }
+
+                /* Same thread: call the window procedure directly */
+                uint32_t ctx[USER_CALLBACK_CTX_WORDS] = { resultInfo };
+                return user_call_wndproc(vm, wnd, msg, wParam, lParam, send_message_done, ctx);
             }
             break;
 
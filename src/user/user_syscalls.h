@@ -37,6 +37,12 @@ ntstatus_t sys_NtUserCreateWindowEx(void);
 /* NtUserShowWindow - show/hide a window */
 ntstatus_t sys_NtUserShowWindow(void);
 
+/* NtUserSetWindowLong - set a window attribute */
+ntstatus_t sys_NtUserSetWindowLong(void);
+
+/* NtUserSetWindowPos - move/resize a window */
+ntstatus_t sys_NtUserSetWindowPos(void);
+
 /*
  * Message queue syscalls
  */
@@ -47,12 +53,24 @@ ntstatus_t sys_NtUserPeekMessage(void);
 /* NtUserGetMessage - get message from queue (blocking) */
 ntstatus_t sys_NtUserGetMessage(void);
 
+/* NtUserWaitMessage - wait for new input in the queue */
+ntstatus_t sys_NtUserWaitMessage(void);
+
 /* NtUserTranslateMessage - translate key messages */
 ntstatus_t sys_NtUserTranslateMessage(void);
 
 /* NtUserDispatchMessage - dispatch message to window procedure */
 ntstatus_t sys_NtUserDispatchMessage(void);
 
+/* NtUserSetTimer - create or reset a timer */
+ntstatus_t sys_NtUserSetTimer(void);
+
+/* NtUserSetSystemTimer - create or reset a WM_SYSTIMER timer */
+ntstatus_t sys_NtUserSetSystemTimer(void);
+
+/* NtUserKillTimer - destroy a timer */
+ntstatus_t sys_NtUserKillTimer(void);
+
 /* NtUserPostMessage - post message to window */
 ntstatus_t sys_NtUserPostMessage(void);
 
@@ -78,6 +96,9 @@ ntstatus_t sys_NtUserGetForegroundWindow(void);
 /* NtUserSetActiveWindow - set active window */
 ntstatus_t sys_NtUserSetActiveWindow(void);
 
+/* NtUserSetCapture - capture the mouse */
+ntstatus_t sys_NtUserSetCapture(void);
+
 /*
  * Input syscalls
  */
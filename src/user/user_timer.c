@@ -0,0 +1,303 @@
+/*
+ * WBOX USER Timers Implementation
+ */
+#include "user_timer.h"
+#include "user_message.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Thread timer ids are allocated below this (Windows uses 1..32767) */
+#define TIMER_ID_LIMIT  0x8000
+
+static bool timer_before(const WBOX_TIMER *a, const WBOX_TIMER *b)
+{
+    return a->due < b->due;
+}
+
+static void timer_swap(WBOX_TIMER_HEAP *heap, uint32_t i, uint32_t j)
+{
+    WBOX_TIMER tmp = heap->timers[i];
+    heap->timers[i] = heap->timers[j];
+    heap->timers[j] = tmp;
+}
+
+static void timer_sift_up(WBOX_TIMER_HEAP *heap, uint32_t i)
+{
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if (!timer_before(&heap->timers[i], &heap->timers[parent])) {
+            break;
+        }
+        timer_swap(heap, i, parent);
+        i = parent;
+    }
+}
+
+static void timer_sift_down(WBOX_TIMER_HEAP *heap, uint32_t i)
+{
+    for (;;) {
+        uint32_t left = 2 * i + 1;
+        uint32_t right = left + 1;
+        uint32_t smallest = i;
+
+        if (left < heap->count && timer_before(&heap->timers[left], &heap->timers[smallest])) {
+            smallest = left;
+        }
+        if (right < heap->count && timer_before(&heap->timers[right], &heap->timers[smallest])) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            break;
+        }
+        timer_swap(heap, i, smallest);
+        i = smallest;
+    }
+}
+
+/* Restore heap order after timers[i].due changed */
+static void timer_fix(WBOX_TIMER_HEAP *heap, uint32_t i)
+{
+    timer_sift_up(heap, i);
+    timer_sift_down(heap, i);
+}
+
+static void timer_remove_at(WBOX_TIMER_HEAP *heap, uint32_t i)
+{
+    heap->count--;
+    if (i < heap->count) {
+        heap->timers[i] = heap->timers[heap->count];
+        timer_fix(heap, i);
+    }
+}
+
+static int timer_find(const WBOX_TIMER_HEAP *heap, uint32_t hwnd, uint32_t id, uint32_t flags)
+{
+    for (uint32_t i = 0; i < heap->count; i++) {
+        const WBOX_TIMER *timer = &heap->timers[i];
+        if (timer->hwnd == hwnd && timer->id == id &&
+            (timer->flags & TMRF_SYSTEM) == (flags & TMRF_SYSTEM)) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static uint32_t timer_alloc_id(WBOX_TIMER_HEAP *heap, uint32_t flags)
+{
+    for (uint32_t tries = 1; tries < TIMER_ID_LIMIT; tries++) {
+        heap->nextId = heap->nextId + 1 < TIMER_ID_LIMIT ? heap->nextId + 1 : 1;
+        if (timer_find(heap, 0, heap->nextId, flags) < 0) {
+            return heap->nextId;
+        }
+    }
+    return 0;
+}
+
+void user_timer_heap_free(WBOX_TIMER_HEAP *heap)
+{
+    free(heap->timers);
+    memset(heap, 0, sizeof(*heap));
+}
+
+uint32_t user_timer_set(WBOX_TIMER_HEAP *heap, uint32_t hwnd, uint32_t id,
+                        uint32_t elapse, uint32_t proc, uint32_t flags, uint64_t now)
+{
+    /* Windows clamps rather than rejects out-of-range periods */
+    if (elapse < USER_TIMER_MINIMUM) {
+        elapse = USER_TIMER_MINIMUM;
+    } else if (elapse > USER_TIMER_MAXIMUM) {
+        elapse = USER_TIMER_MAXIMUM;
+    }
+    flags &= TMRF_SYSTEM;
+
+    int index = (hwnd != 0 || id != 0) ? timer_find(heap, hwnd, id, flags) : -1;
+    if (index < 0) {
+        if (hwnd == 0) {
+            id = timer_alloc_id(heap, flags);
+            if (id == 0) {
+                return 0;
+            }
+        }
+
+        if (heap->count == heap->capacity) {
+            uint32_t capacity = heap->capacity ? heap->capacity * 2 : 16;
+            WBOX_TIMER *timers = realloc(heap->timers, capacity * sizeof(WBOX_TIMER));
+            if (!timers) {
+                return 0;
+            }
+            heap->timers = timers;
+            heap->capacity = capacity;
+        }
+        index = (int)heap->count++;
+    }
+
+    /* Resetting an existing timer restarts its period and drops a pending
+     * WM_TIMER, as SetTimer does on Windows */
+    WBOX_TIMER *timer = &heap->timers[index];
+    timer->hwnd = hwnd;
+    timer->id = id;
+    timer->elapse = elapse;
+    timer->proc = proc;
+    timer->flags = flags;
+    timer->due = now + elapse;
+    timer_fix(heap, (uint32_t)index);
+
+    return id;
+}
+
+bool user_timer_kill(WBOX_TIMER_HEAP *heap, uint32_t hwnd, uint32_t id, uint32_t flags)
+{
+    int index = timer_find(heap, hwnd, id, flags);
+    if (index < 0) {
+        return false;
+    }
+    timer_remove_at(heap, (uint32_t)index);
+    return true;
+}
+
+void user_timer_kill_window(WBOX_TIMER_HEAP *heap, uint32_t hwnd)
+{
+    /* Compact out the window's timers, then rebuild the heap bottom-up */
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < heap->count; i++) {
+        if (heap->timers[i].hwnd != hwnd) {
+            heap->timers[kept++] = heap->timers[i];
+        }
+    }
+    if (kept == heap->count) {
+        return;
+    }
+    heap->count = kept;
+    for (uint32_t i = kept / 2; i-- > 0; ) {
+        timer_sift_down(heap, i);
+    }
+}
+
+/* Expired timers form a subtree at the root, so only it is visited */
+static uint32_t timer_expire_from(WBOX_TIMER_HEAP *heap, uint32_t i, uint64_t now)
+{
+    if (i >= heap->count || heap->timers[i].due > now) {
+        return 0;
+    }
+
+    uint32_t fired = 0;
+    if (!(heap->timers[i].flags & TMRF_READY)) {
+        heap->timers[i].flags |= TMRF_READY;
+        fired = 1;
+    }
+    return fired + timer_expire_from(heap, 2 * i + 1, now) +
+           timer_expire_from(heap, 2 * i + 2, now);
+}
+
+uint32_t user_timer_expire(WBOX_TIMER_HEAP *heap, uint64_t now)
+{
+    return timer_expire_from(heap, 0, now);
+}
+
+bool user_timer_has_proc(const WBOX_TIMER_HEAP *heap, uint32_t proc)
+{
+    for (uint32_t i = 0; i < heap->count; i++) {
+        if (heap->timers[i].proc == proc) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool user_timer_any_ready(const WBOX_TIMER_HEAP *heap)
+{
+    /* Ready timers keep their expired due time, so one is at the root */
+    return heap->count > 0 && (heap->timers[0].flags & TMRF_READY);
+}
+
+uint64_t user_timer_next_due(const WBOX_TIMER_HEAP *heap, uint64_t now)
+{
+    if (heap->count == 0) {
+        return 0;
+    }
+    if (heap->timers[0].due > now) {
+        return heap->timers[0].due;
+    }
+
+    /* The root is overdue (ready but filtered out by the reader): the
+     * waiter should sleep until the next timer that is still to come */
+    uint64_t next = 0;
+    for (uint32_t i = 1; i < heap->count; i++) {
+        uint64_t due = heap->timers[i].due;
+        if (due > now && (next == 0 || due < next)) {
+            next = due;
+        }
+    }
+    return next;
+}
+
+static bool timer_matches_filter(const WBOX_TIMER *timer, uint32_t hwndFilter,
+                                 uint32_t msgFilterMin, uint32_t msgFilterMax)
+{
+    if (hwndFilter == 0xFFFFFFFF) {
+        if (timer->hwnd != 0) {
+            return false;
+        }
+    } else if (hwndFilter != 0 && timer->hwnd != hwndFilter) {
+        return false;
+    }
+
+    if (msgFilterMin != 0 || msgFilterMax != 0) {
+        uint32_t message = (timer->flags & TMRF_SYSTEM) ? WM_SYSTIMER : WM_TIMER;
+        if (message < msgFilterMin || message > msgFilterMax) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Every ancestor of a ready timer is due no later and so is ready too;
+ * the walk stops at the first timer that is not */
+static void timer_find_ready(const WBOX_TIMER_HEAP *heap, uint32_t i, uint32_t hwndFilter,
+                             uint32_t msgFilterMin, uint32_t msgFilterMax, int *best)
+{
+    if (i >= heap->count || !(heap->timers[i].flags & TMRF_READY)) {
+        return;
+    }
+
+    const WBOX_TIMER *timer = &heap->timers[i];
+    if (timer_matches_filter(timer, hwndFilter, msgFilterMin, msgFilterMax)) {
+        /* Nothing below is due earlier */
+        if (*best < 0 || timer->due < heap->timers[*best].due) {
+            *best = (int)i;
+        }
+        return;
+    }
+
+    timer_find_ready(heap, 2 * i + 1, hwndFilter, msgFilterMin, msgFilterMax, best);
+    timer_find_ready(heap, 2 * i + 2, hwndFilter, msgFilterMin, msgFilterMax, best);
+}
+
+bool user_timer_take(WBOX_TIMER_HEAP *heap, uint32_t hwndFilter,
+                     uint32_t msgFilterMin, uint32_t msgFilterMax,
+                     bool remove, uint64_t now, WBOX_TIMER *out)
+{
+    int best = -1;
+    timer_find_ready(heap, 0, hwndFilter, msgFilterMin, msgFilterMax, &best);
+    if (best < 0) {
+        return false;
+    }
+
+    WBOX_TIMER *timer = &heap->timers[best];
+    if (out) {
+        *out = *timer;
+    }
+
+    if (remove) {
+        /* Re-arm on the original cadence; periods the reader slept through
+         * collapse into the one WM_TIMER just delivered */
+        timer->flags &= ~TMRF_READY;
+        timer->due += timer->elapse;
+        if (timer->due <= now) {
+            timer->due = now + timer->elapse;
+        }
+        timer_fix(heap, (uint32_t)best);
+    }
+    return true;
+}
@@ -0,0 +1,76 @@
+/*
+ * WBOX USER Timers
+ * SetTimer/SetSystemTimer timers of one message queue
+ *
+ * Timers live in a binary min-heap ordered by due time, so the next
+ * deadline (used to park GetMessage) is the root. As on Windows, an expired
+ * timer only becomes "ready"; WM_TIMER is synthesized when the queue is
+ * read and at most one is pending per timer, however late the reader is.
+ * Times are absolute milliseconds; the caller supplies the clock.
+ */
+#ifndef WBOX_USER_TIMER_H
+#define WBOX_USER_TIMER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Elapse limits (USER_TIMER_MINIMUM / USER_TIMER_MAXIMUM) */
+#define USER_TIMER_MINIMUM  0x0000000A
+#define USER_TIMER_MAXIMUM  0x7FFFFFFF
+
+/* Timer flags */
+#define TMRF_SYSTEM     0x0001      /* SetSystemTimer: delivers WM_SYSTIMER */
+#define TMRF_READY      0x0002      /* Expired, WM_TIMER pending */
+
+typedef struct _WBOX_TIMER {
+    uint32_t hwnd;          /* Target window (0 = thread timer) */
+    uint32_t id;            /* nIDEvent */
+    uint32_t elapse;        /* Period in ms */
+    uint32_t proc;          /* Guest TIMERPROC (passed as lParam), or 0 */
+    uint32_t flags;         /* TMRF_* */
+    uint64_t due;           /* Next expiry (ms) */
+} WBOX_TIMER;
+
+typedef struct _WBOX_TIMER_HEAP {
+    WBOX_TIMER *timers;     /* Min-heap on due */
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t nextId;        /* Last id handed out to a thread timer */
+} WBOX_TIMER_HEAP;
+
+/* Free all timers */
+void user_timer_heap_free(WBOX_TIMER_HEAP *heap);
+
+/* Create or reset a timer; a thread timer (hwnd 0) with an unused id gets
+ * a fresh one. Returns the timer id, or 0 on failure. */
+uint32_t user_timer_set(WBOX_TIMER_HEAP *heap, uint32_t hwnd, uint32_t id,
+                        uint32_t elapse, uint32_t proc, uint32_t flags, uint64_t now);
+
+/* Remove a timer; returns false if there is none */
+bool user_timer_kill(WBOX_TIMER_HEAP *heap, uint32_t hwnd, uint32_t id, uint32_t flags);
+
+/* Remove every timer of a window (window destruction) */
+void user_timer_kill_window(WBOX_TIMER_HEAP *heap, uint32_t hwnd);
+
+/* Mark timers whose due time has passed as ready
+ * Returns the number that became ready (were not ready before). */
+uint32_t user_timer_expire(WBOX_TIMER_HEAP *heap, uint64_t now);
+
+/* Check if a timer was set with this TIMERPROC (DispatchMessage only
+ * calls procs that really belong to a timer) */
+bool user_timer_has_proc(const WBOX_TIMER_HEAP *heap, uint32_t proc);
+
+/* Check if any timer is ready */
+bool user_timer_any_ready(const WBOX_TIMER_HEAP *heap);
+
+/* Earliest due time after now (0 if none): what a waiter should sleep until */
+uint64_t user_timer_next_due(const WBOX_TIMER_HEAP *heap, uint64_t now);
+
+/* Find the ready timer due first that matches the GetMessage filters
+ * (hwndFilter 0 = any, 0xFFFFFFFF = thread timers only). With remove set
+ * the timer is re-armed for its next period. Returns false if none. */
+bool user_timer_take(WBOX_TIMER_HEAP *heap, uint32_t hwndFilter,
+                     uint32_t msgFilterMin, uint32_t msgFilterMax,
+                     bool remove, uint64_t now, WBOX_TIMER *out);
+
+#endif /* WBOX_USER_TIMER_H */
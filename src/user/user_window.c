@@ -3,8 +3,10 @@
  */
 #include "user_window.h"
 #include "user_handle_table.h"
+#include "user_message.h"
 #include "guest_wnd.h"
 #include "desktop_heap.h"
+#include "../thread/thread.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -45,6 +47,7 @@ static WBOX_WND *window_create_internal(
     }
 
     wnd->hwnd = hwnd;
+    wnd->thread_id = thread_get_current_id();
     wnd->pcls = pcls;
     wnd->lpfnWndProc = pcls ? pcls->lpfnWndProc : 0;
     wnd->style = style;
@@ -214,6 +217,18 @@ WBOX_WND *user_window_create(
     return wnd;
 }
 
+/* Drop references to a dying owner from the windows under root */
+static void window_forget_owner(WBOX_WND *root, WBOX_WND *owner)
+{
+    for (WBOX_WND *child = root->spwndChild; child; child = child->spwndNext) {
+        if (child->spwndOwner == owner) {
+            child->spwndOwner = NULL;
+            guest_wnd_update_hierarchy(child);
+        }
+        window_forget_owner(child, owner);
+    }
+}
+
 void user_window_destroy(WBOX_WND *wnd)
 {
     if (!wnd) return;
@@ -232,9 +247,16 @@ void user_window_destroy(WBOX_WND *wnd)
         user_window_destroy(wnd->spwndChild);
     }
 
-    /* Unlink from hierarchy */
+    /* Stop painting it and drop its timers, then unlink from hierarchy */
+    msg_queue_remove_paint(wnd);
+    msg_queue_kill_window_timers(wnd);
     user_window_unlink(wnd);
 
+    /* Owned windows must not keep pointing at the freed guest WND */
+    if (g_desktop_window) {
+        window_forget_owner(g_desktop_window, wnd);
+    }
+
     /* Release class reference */
     if (wnd->pcls) {
         user_class_release(wnd->pcls);
@@ -243,6 +265,8 @@ void user_window_destroy(WBOX_WND *wnd)
     /* Destroy guest WND */
     if (wnd->guest_wnd_va) {
         guest_wnd_destroy(wnd->guest_wnd_va);
+        wnd->guest_wnd_va = 0;
+        wnd->guest_wnd = NULL;
     }
 
     /* Free resources */
@@ -299,6 +323,9 @@ void user_window_link_child(WBOX_WND *parent, WBOX_WND *child)
     /* Update guest WND hierarchy pointers */
     guest_wnd_update_hierarchy(child);
     guest_wnd_update_hierarchy(parent);
+
+    /* The subtree's paint order changed */
+    msg_queue_reorder_paint(child);
 }
 
 void user_window_unlink(WBOX_WND *wnd)
@@ -346,6 +373,9 @@ void user_window_set_pos(WBOX_WND *wnd, int x, int y, int cx, int cy, uint32_t f
 
     /* Recalculate client rect */
     user_window_calc_client_rect(wnd);
+
+    wnd->guest_dirty |= WNDD_RECTS;
+    guest_wnd_sync(wnd);
 }
 
 void user_window_calc_client_rect(WBOX_WND *wnd)
@@ -452,6 +482,10 @@ void user_window_show(WBOX_WND *wnd, int nCmdShow)
             wnd->state &= ~(WNDS_MINIMIZED | WNDS_MAXIMIZED);
             break;
     }
+
+    wnd->guest_dirty |= WNDD_STATE | WNDD_STYLE;
+    guest_wnd_sync(wnd);
+    msg_queue_update_paint(wnd);
 }
 
 bool user_window_is_visible(WBOX_WND *wnd)
@@ -460,6 +494,87 @@ bool user_window_is_visible(WBOX_WND *wnd)
     return (wnd->state & WNDS_VISIBLE) != 0;
 }
 
+static bool rect_contains(const WBOX_RECT *rc, int x, int y)
+{
+    return x >= rc->left && x < rc->right && y >= rc->top && y < rc->bottom;
+}
+
+WBOX_WND *user_window_from_point(int x, int y)
+{
+    WBOX_WND *wnd = g_desktop_window;
+    if (!wnd) return NULL;
+
+    /* The first child is the top of the z-order */
+    WBOX_WND *child = wnd->spwndChild;
+    while (child) {
+        if (!(child->state & WNDS_VISIBLE) || !rect_contains(&child->rcWindow, x, y)) {
+            child = child->spwndNext;
+            continue;
+        }
+
+        /* Disabled controls are transparent to the mouse; their parent gets it */
+        if ((child->state & WNDS_DISABLED) && (child->style & WS_CHILD)) {
+            break;
+        }
+
+        wnd = child;
+
+        /* Children are clipped to the client area */
+        child = rect_contains(&wnd->rcClient, x, y) ? wnd->spwndChild : NULL;
+    }
+
+    return wnd;
+}
+
+/* Subtract the window rects of visible windows in [first, stop) */
+static bool subtract_windows(gdi_region_t *rgn, WBOX_WND *first, WBOX_WND *stop)
+{
+    for (WBOX_WND *w = first; w && w != stop; w = w->spwndNext) {
+        if (!user_window_is_visible(w)) continue;
+
+        RECT r = { w->rcWindow.left, w->rcWindow.top, w->rcWindow.right, w->rcWindow.bottom };
+        if (!gdi_region_subtract_rect(rgn, &r)) return false;
+        if (gdi_region_is_empty(rgn)) break;
+    }
+    return true;
+}
+
+bool user_window_calc_vis_rgn(WBOX_WND *wnd, bool client, gdi_region_t *rgn)
+{
+    gdi_region_set_empty(rgn);
+    if (!wnd) return true;
+
+    /* The window and all its ancestors (except the desktop) must be visible */
+    for (WBOX_WND *w = wnd; w && w->spwndParent; w = w->spwndParent) {
+        if (!user_window_is_visible(w)) return true;
+    }
+
+    const WBOX_RECT *start = client ? &wnd->rcClient : &wnd->rcWindow;
+    if (!gdi_region_set_rect(rgn, start->left, start->top, start->right, start->bottom)) {
+        return false;
+    }
+
+    /* Clip to ancestors and remove siblings above us at every level */
+    for (WBOX_WND *w = wnd; w->spwndParent && !gdi_region_is_empty(rgn); w = w->spwndParent) {
+        WBOX_WND *parent = w->spwndParent;
+        RECT pr = { parent->rcClient.left, parent->rcClient.top,
+                    parent->rcClient.right, parent->rcClient.bottom };
+        if (!gdi_region_intersect_rect(rgn, &pr)) return false;
+
+        /* First child is top of z-order; top-level windows always clip siblings */
+        if (parent == g_desktop_window || (w->style & WS_CLIPSIBLINGS)) {
+            if (!subtract_windows(rgn, parent->spwndChild, w)) return false;
+        }
+    }
+
+    /* Remove children */
+    if ((wnd->style & WS_CLIPCHILDREN) && !gdi_region_is_empty(rgn)) {
+        if (!subtract_windows(rgn, wnd->spwndChild, NULL)) return false;
+    }
+
+    return true;
+}
+
 void user_window_set_text(WBOX_WND *wnd, const wchar_t *text)
 {
     if (!wnd) return;
@@ -521,9 +636,11 @@ uint32_t user_window_set_long(WBOX_WND *wnd, int index, uint32_t value)
     switch (index) {
         case GWL_WNDPROC:
             wnd->lpfnWndProc = value;
+            wnd->guest_dirty |= WNDD_WNDPROC;
             break;
         case GWL_HINSTANCE:
             wnd->hInstance = value;
+            wnd->guest_dirty |= WNDD_HINSTANCE;
             break;
         case GWL_STYLE:
             wnd->style = value;
@@ -532,15 +649,20 @@ uint32_t user_window_set_long(WBOX_WND *wnd, int index, uint32_t value)
             else wnd->state &= ~WNDS_VISIBLE;
             if (value & WS_DISABLED) wnd->state |= WNDS_DISABLED;
             else wnd->state &= ~WNDS_DISABLED;
+            wnd->guest_dirty |= WNDD_STYLE | WNDD_STATE;
+            msg_queue_update_paint(wnd);
             break;
         case GWL_EXSTYLE:
             wnd->exStyle = value;
+            wnd->guest_dirty |= WNDD_STYLE;
             break;
         case GWL_USERDATA:
             wnd->dwUserData = value;
+            wnd->guest_dirty |= WNDD_USERDATA;
             break;
         case GWL_ID:
             wnd->IDMenu = value;
+            wnd->guest_dirty |= WNDD_MENU;
             break;
         default:
             /* Positive indices are window extra bytes */
@@ -550,6 +672,7 @@ uint32_t user_window_set_long(WBOX_WND *wnd, int index, uint32_t value)
             break;
     }
 
+    guest_wnd_sync(wnd);
     return old;
 }
 
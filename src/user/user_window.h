@@ -9,9 +9,11 @@
 #include <stdbool.h>
 #include <wchar.h>
 #include "user_class.h"
+#include "../gdi/gdi_region.h"
 
-/* Forward declaration */
+/* Forward declarations */
 struct _WBOX_WND;
+struct _WBOX_MSG_QUEUE;
 
 /* Rectangle structure */
 typedef struct _WBOX_RECT {
@@ -96,6 +98,15 @@ typedef struct _WBOX_RECT {
 #define SW_SHOWDEFAULT      10
 #define SW_FORCEMINIMIZE    11
 
+/* SetWindowPos flags */
+#define SWP_NOSIZE          0x0001
+#define SWP_NOMOVE          0x0002
+#define SWP_NOZORDER        0x0004
+#define SWP_NOREDRAW        0x0008
+#define SWP_NOACTIVATE      0x0010
+#define SWP_SHOWWINDOW      0x0040
+#define SWP_HIDEWINDOW      0x0080
+
 /* Internal window state flags */
 #define WNDS_VISIBLE            0x00000001
 #define WNDS_DISABLED           0x00000002
@@ -109,12 +120,22 @@ typedef struct _WBOX_RECT {
 #define WNDS_NONCPAINT          0x00000200
 #define WNDS_ERASEBACKGROUND    0x00000400
 
+/* Fields changed since the guest WND was last synced (guest_wnd_sync) */
+#define WNDD_STATE              0x00000001  /* state, state2 */
+#define WNDD_STYLE              0x00000002  /* style, exStyle */
+#define WNDD_RECTS              0x00000004  /* rcWindow, rcClient */
+#define WNDD_WNDPROC            0x00000008
+#define WNDD_HINSTANCE          0x00000010
+#define WNDD_USERDATA           0x00000020
+#define WNDD_MENU               0x00000040  /* IDMenu */
+
 /*
  * Window object structure (WND)
  */
 typedef struct _WBOX_WND {
     /* Handle */
     uint32_t hwnd;                      /* USER handle */
+    uint32_t thread_id;                 /* Creating thread (owns the window's messages) */
 
     /* Class */
     WBOX_CLS *pcls;                     /* Pointer to window class */
@@ -162,6 +183,13 @@ typedef struct _WBOX_WND {
 
     /* Guest WND in desktop heap */
     uint32_t guest_wnd_va;              /* Guest VA of WND structure */
+    uint8_t *guest_wnd;                 /* Host mapping of the guest WND */
+    uint32_t guest_dirty;               /* WNDD_* fields not yet synced */
+
+    /* Owner queue's paint set (see msg_queue_update_paint) */
+    struct _WBOX_MSG_QUEUE *paint_queue; /* Queue whose paint set holds us, or NULL */
+    struct _WBOX_WND *paint_next;       /* Next window to paint */
+    struct _WBOX_WND *paint_prev;       /* Previous window to paint */
 } WBOX_WND;
 
 /*
@@ -239,6 +267,13 @@ void user_window_show(WBOX_WND *wnd, int nCmdShow);
  */
 bool user_window_is_visible(WBOX_WND *wnd);
 
+/*
+ * Find the window under a screen point (WindowFromPoint)
+ * Descends through visible children in z-order; a disabled child yields
+ * its parent. Returns the desktop if no other window is hit.
+ */
+WBOX_WND *user_window_from_point(int x, int y);
+
 /*
  * Set window text
  */
@@ -280,6 +315,18 @@ uint32_t user_window_set_long(WBOX_WND *wnd, int index, uint32_t value);
 #define DWL_DLGPROC     4
 #define DWL_USER        8
 
+/*
+ * Compute the visible region of a window in screen coordinates
+ * Starts from the client (or whole window) rectangle, clips to every
+ * ancestor's client area and removes overlapping higher siblings and,
+ * with WS_CLIPCHILDREN, visible children.
+ * @param wnd Window
+ * @param client true for the client area, false for the whole window
+ * @param rgn Region to receive the result
+ * @return false on allocation failure
+ */
+bool user_window_calc_vis_rgn(WBOX_WND *wnd, bool client, gdi_region_t *rgn);
+
 /*
  * Find a child window matching class and/or title
  * @param parent Parent window to search in
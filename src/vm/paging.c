@@ -127,8 +127,13 @@ uint32_t paging_alloc_phys(paging_context_t *ctx, uint32_t size)
     ctx->phys_alloc_ptr += size;
 
     /* Zero the allocated memory */
-    for (uint32_t i = 0; i < size; i++) {
-        mem_writeb_phys(addr + i, 0);
+    uint8_t *host = mem_phys_ptr(addr, size);
+    if (host) {
+        memset(host, 0, size);
+    } else {
+        for (uint32_t i = 0; i < size; i++) {
+            mem_writeb_phys(addr + i, 0);
+        }
     }
 
     return addr;
@@ -0,0 +1,283 @@
+/*
+ * WBOX Startup Profiler
+ * Times each startup phase per module on a monotonic clock
+ */
+#include "startup_profile.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const char *phase_names[PROFILE_PHASE_COUNT] = {
+    "parse", "map", "relocate", "imports", "ldr_entry", "dll_main", "first_window"
+};
+
+uint64_t startup_profile_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t read_instructions(const startup_profile_t *sp)
+{
+    return sp->instructions ? *sp->instructions : 0;
+}
+
+startup_profile_t *startup_profile_create(const uint64_t *instructions, const char *json_path)
+{
+    startup_profile_t *sp = calloc(1, sizeof(*sp));
+    if (!sp) {
+        return NULL;
+    }
+    sp->instructions = instructions;
+    sp->json_path = json_path;
+    sp->program_mark = -1;
+    sp->start_ns = startup_profile_now_ns();
+    return sp;
+}
+
+void startup_profile_free(startup_profile_t *sp)
+{
+    if (!sp) {
+        return;
+    }
+    free(sp->records);
+    free(sp);
+}
+
+int startup_profile_begin(startup_profile_t *sp)
+{
+    if (!sp) {
+        return -1;
+    }
+
+    /* Too deep: the time stays with the enclosing phase */
+    int mark = sp->depth;
+    if (mark < STARTUP_PROFILE_MAX_DEPTH) {
+        profile_frame_t *frame = &sp->frames[sp->depth++];
+        frame->start_ns = startup_profile_now_ns();
+        frame->start_instructions = read_instructions(sp);
+        frame->child_ns = 0;
+        frame->child_instructions = 0;
+    }
+    return mark;
+}
+
+static profile_record_t *find_record(startup_profile_t *sp, const char *module,
+                                     profile_phase_t phase)
+{
+    for (uint32_t i = 0; i < sp->record_count; i++) {
+        profile_record_t *rec = &sp->records[i];
+        if (rec->phase == phase && strcmp(rec->module, module) == 0) {
+            return rec;
+        }
+    }
+
+    if (sp->record_count == sp->record_capacity) {
+        uint32_t capacity = sp->record_capacity ? sp->record_capacity * 2 : 64;
+        profile_record_t *grown = realloc(sp->records, capacity * sizeof(profile_record_t));
+        if (!grown) {
+            return NULL;
+        }
+        sp->records = grown;
+        sp->record_capacity = capacity;
+    }
+
+    profile_record_t *rec = &sp->records[sp->record_count++];
+    memset(rec, 0, sizeof(*rec));
+    strncpy(rec->module, module, sizeof(rec->module) - 1);
+    rec->phase = phase;
+    return rec;
+}
+
+void startup_profile_end(startup_profile_t *sp, int mark, const char *module,
+                         profile_phase_t phase)
+{
+    if (!sp || mark < 0 || mark >= sp->depth) {
+        return;
+    }
+
+    profile_frame_t *frame = &sp->frames[mark];
+    uint64_t elapsed = startup_profile_now_ns() - frame->start_ns;
+    uint64_t executed = read_instructions(sp) - frame->start_instructions;
+    sp->depth = mark;
+
+    profile_record_t *rec = find_record(sp, module ? module : "?", phase);
+    if (rec) {
+        rec->ns += elapsed > frame->child_ns ? elapsed - frame->child_ns : 0;
+        rec->instructions += executed > frame->child_instructions ?
+                             executed - frame->child_instructions : 0;
+        rec->calls++;
+    }
+
+    if (mark > 0) {
+        sp->frames[mark - 1].child_ns += elapsed;
+        sp->frames[mark - 1].child_instructions += executed;
+    }
+}
+
+void startup_profile_enter_program(startup_profile_t *sp, const char *module)
+{
+    if (!sp || sp->program_mark >= 0) {
+        return;
+    }
+    strncpy(sp->program, module, sizeof(sp->program) - 1);
+    sp->program_mark = startup_profile_begin(sp);
+}
+
+void startup_profile_first_window(startup_profile_t *sp)
+{
+    if (!sp || sp->first_window_ns != 0) {
+        return;
+    }
+    sp->first_window_ns = startup_profile_now_ns() - sp->start_ns;
+    if (sp->first_window_ns == 0) {
+        sp->first_window_ns = 1;
+    }
+
+    if (sp->program_mark >= 0) {
+        startup_profile_end(sp, sp->program_mark, sp->program, PROFILE_PHASE_FIRST_WINDOW);
+        sp->program_mark = -1;
+    }
+    startup_profile_finish(sp);
+}
+
+const char *startup_profile_phase_name(profile_phase_t phase)
+{
+    return phase < PROFILE_PHASE_COUNT ? phase_names[phase] : "?";
+}
+
+static int compare_records(const void *a, const void *b)
+{
+    const profile_record_t *ra = a;
+    const profile_record_t *rb = b;
+    if (ra->ns != rb->ns) {
+        return ra->ns < rb->ns ? 1 : -1;
+    }
+    return strcmp(ra->module, rb->module);
+}
+
+void startup_profile_sort(startup_profile_t *sp)
+{
+    if (sp && sp->record_count > 1) {
+        qsort(sp->records, sp->record_count, sizeof(profile_record_t), compare_records);
+    }
+}
+
+static void phase_totals(const startup_profile_t *sp, uint64_t ns[PROFILE_PHASE_COUNT],
+                         uint64_t instructions[PROFILE_PHASE_COUNT])
+{
+    memset(ns, 0, PROFILE_PHASE_COUNT * sizeof(uint64_t));
+    memset(instructions, 0, PROFILE_PHASE_COUNT * sizeof(uint64_t));
+    for (uint32_t i = 0; i < sp->record_count; i++) {
+        ns[sp->records[i].phase] += sp->records[i].ns;
+        instructions[sp->records[i].phase] += sp->records[i].instructions;
+    }
+}
+
+void startup_profile_report(startup_profile_t *sp, FILE *out)
+{
+    if (!sp) {
+        return;
+    }
+    startup_profile_sort(sp);
+
+    uint64_t total_ns = startup_profile_now_ns() - sp->start_ns;
+    fprintf(out, "\n=== Startup profile: %.3f ms total", total_ns / 1e6);
+    if (sp->first_window_ns) {
+        fprintf(out, ", first window at %.3f ms", sp->first_window_ns / 1e6);
+    }
+    fprintf(out, " ===\n");
+
+    uint64_t ns[PROFILE_PHASE_COUNT], instructions[PROFILE_PHASE_COUNT];
+    phase_totals(sp, ns, instructions);
+    fprintf(out, "Phase totals:\n");
+    for (int p = 0; p < PROFILE_PHASE_COUNT; p++) {
+        if (ns[p] || instructions[p]) {
+            fprintf(out, "  %-13s %10.3f ms %14llu instructions\n",
+                    phase_names[p], ns[p] / 1e6, (unsigned long long)instructions[p]);
+        }
+    }
+
+    fprintf(out, "By module, slowest first:\n");
+    fprintf(out, "  %10s %14s  %-13s %s\n", "ms", "instructions", "phase", "module");
+    for (uint32_t i = 0; i < sp->record_count; i++) {
+        const profile_record_t *rec = &sp->records[i];
+        fprintf(out, "  %10.3f %14llu  %-13s %s\n", rec->ns / 1e6,
+                (unsigned long long)rec->instructions, phase_names[rec->phase], rec->module);
+    }
+}
+
+static void write_json_string(FILE *out, const char *s)
+{
+    fputc('"', out);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+int startup_profile_write_json(startup_profile_t *sp, FILE *out)
+{
+    if (!sp) {
+        return -1;
+    }
+    startup_profile_sort(sp);
+
+    uint64_t total_ns = startup_profile_now_ns() - sp->start_ns;
+    fprintf(out, "{\n  \"total_ms\": %.3f,\n  \"first_window_ms\": ", total_ns / 1e6);
+    if (sp->first_window_ns) {
+        fprintf(out, "%.3f,\n", sp->first_window_ns / 1e6);
+    } else {
+        fprintf(out, "null,\n");
+    }
+
+    uint64_t ns[PROFILE_PHASE_COUNT], instructions[PROFILE_PHASE_COUNT];
+    phase_totals(sp, ns, instructions);
+    fprintf(out, "  \"phases\": {");
+    for (int p = 0; p < PROFILE_PHASE_COUNT; p++) {
+        fprintf(out, "%s\n    \"%s\": { \"ms\": %.3f, \"instructions\": %llu }",
+                p ? "," : "", phase_names[p], ns[p] / 1e6, (unsigned long long)instructions[p]);
+    }
+    fprintf(out, "\n  },\n  \"records\": [");
+
+    for (uint32_t i = 0; i < sp->record_count; i++) {
+        const profile_record_t *rec = &sp->records[i];
+        fprintf(out, "%s\n    { \"module\": ", i ? "," : "");
+        write_json_string(out, rec->module);
+        fprintf(out, ", \"phase\": \"%s\", \"ms\": %.3f, \"instructions\": %llu, \"calls\": %u }",
+                phase_names[rec->phase], rec->ns / 1e6,
+                (unsigned long long)rec->instructions, rec->calls);
+    }
+    fprintf(out, "\n  ]\n}\n");
+    return ferror(out) ? -1 : 0;
+}
+
+void startup_profile_finish(startup_profile_t *sp)
+{
+    if (!sp || sp->finished) {
+        return;
+    }
+    sp->finished = true;
+
+    if (sp->json_path) {
+        FILE *f = fopen(sp->json_path, "w");
+        if (f) {
+            int rc = startup_profile_write_json(sp, f);
+            if (fclose(f) == 0 && rc == 0) {
+                printf("Startup profile written to %s\n", sp->json_path);
+                return;
+            }
+        }
+        fprintf(stderr, "startup_profile: Cannot write %s, printing instead\n", sp->json_path);
+    }
+    startup_profile_report(sp, stdout);
+}
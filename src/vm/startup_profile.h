@@ -0,0 +1,133 @@
+/*
+ * WBOX Startup Profiler
+ * Times each startup phase per module on a monotonic clock
+ *
+ * The loader and the VM bracket their work with begin/end pairs: PE
+ * parsing, laying the image out, relocation, import binding, LDR entries,
+ * DllMain and the first window. Phases nest (resolving imports loads more
+ * DLLs), so each record holds self time only: what nested phases spent is
+ * charged to them, not to the enclosing one. Records with the same module
+ * and phase add up. Guest instructions are counted the same way.
+ *
+ * Every call accepts a NULL profile and does nothing, so call sites need
+ * no checks when profiling is off.
+ */
+#ifndef WBOX_STARTUP_PROFILE_H
+#define WBOX_STARTUP_PROFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Longest module name kept */
+#define STARTUP_PROFILE_NAME_MAX    64
+
+/* Deepest phase nesting tracked */
+#define STARTUP_PROFILE_MAX_DEPTH   16
+
+typedef enum {
+    PROFILE_PHASE_PARSE,            /* Read headers, sections and exports */
+    PROFILE_PHASE_MAP,              /* Allocate, lay out and map the image */
+    PROFILE_PHASE_RELOCATE,         /* Apply base relocations */
+    PROFILE_PHASE_IMPORTS,          /* Bind the module's imports */
+    PROFILE_PHASE_LDR_ENTRY,        /* Build its LDR_DATA_TABLE_ENTRY */
+    PROFILE_PHASE_DLL_MAIN,         /* Run DllMain(DLL_PROCESS_ATTACH) */
+    PROFILE_PHASE_FIRST_WINDOW,     /* Entry point to the first window */
+    PROFILE_PHASE_COUNT
+} profile_phase_t;
+
+/* Time and guest instructions one module spent in one phase */
+typedef struct profile_record {
+    char            module[STARTUP_PROFILE_NAME_MAX];
+    profile_phase_t phase;
+    uint64_t        ns;
+    uint64_t        instructions;
+    uint32_t        calls;
+} profile_record_t;
+
+/* An open phase */
+typedef struct profile_frame {
+    uint64_t        start_ns;
+    uint64_t        start_instructions;
+    uint64_t        child_ns;           /* Spent in phases nested inside */
+    uint64_t        child_instructions;
+} profile_frame_t;
+
+typedef struct startup_profile {
+    uint64_t        start_ns;           /* When profiling began */
+    uint64_t        first_window_ns;    /* Since start_ns, 0 = no window yet */
+    const uint64_t  *instructions;      /* Guest instruction counter, may be NULL */
+
+    profile_record_t *records;
+    uint32_t        record_count;
+    uint32_t        record_capacity;
+
+    profile_frame_t frames[STARTUP_PROFILE_MAX_DEPTH];
+    int             depth;
+
+    char            program[STARTUP_PROFILE_NAME_MAX];  /* Main executable */
+    int             program_mark;       /* Its open first_window phase, -1 = none */
+
+    const char      *json_path;         /* Write JSON here instead of printing */
+    bool            finished;
+} startup_profile_t;
+
+/* Nanoseconds on the monotonic clock */
+uint64_t startup_profile_now_ns(void);
+
+/*
+ * Create a profile starting now
+ * instructions points at a counter the CPU increments per guest
+ * instruction (NULL = don't count). json_path selects JSON output for
+ * startup_profile_finish. Returns NULL on allocation failure.
+ */
+startup_profile_t *startup_profile_create(const uint64_t *instructions, const char *json_path);
+
+/* Free a profile */
+void startup_profile_free(startup_profile_t *sp);
+
+/*
+ * Open a phase
+ * Returns a mark to pass to the matching startup_profile_end.
+ */
+int startup_profile_begin(startup_profile_t *sp);
+
+/*
+ * Close the phase opened with mark and charge its self time to module
+ * Frames an error path left open above mark are dropped.
+ */
+void startup_profile_end(startup_profile_t *sp, int mark, const char *module,
+                         profile_phase_t phase);
+
+/*
+ * The main executable starts running: open its first_window phase
+ * It stays open, with DLL loads and the like nested inside, until
+ * startup_profile_first_window closes it.
+ */
+void startup_profile_enter_program(startup_profile_t *sp, const char *module);
+
+/*
+ * The first window was created: close the first_window phase and emit
+ * the profile. Later calls do nothing.
+ */
+void startup_profile_first_window(startup_profile_t *sp);
+
+/* Short name of a phase ("dll_main", ...) */
+const char *startup_profile_phase_name(profile_phase_t phase);
+
+/* Sort records slowest first */
+void startup_profile_sort(startup_profile_t *sp);
+
+/* Print per-phase totals and every record, slowest first */
+void startup_profile_report(startup_profile_t *sp, FILE *out);
+
+/* Write the records, slowest first, as JSON; returns 0 on success */
+int startup_profile_write_json(startup_profile_t *sp, FILE *out);
+
+/*
+ * Emit the report, or the JSON file if one was requested
+ * Only the first call does anything.
+ */
+void startup_profile_finish(startup_profile_t *sp);
+
+#endif /* WBOX_STARTUP_PROFILE_H */
@@ -3,17 +3,20 @@
  * Sets up protected mode execution environment for PE binaries
  */
 #include "vm.h"
+#include "startup_profile.h"
 #include "../cpu/cpu.h"
 #include "../cpu/mem.h"
 #include "../cpu/platform.h"
 #include "../cpu/x86.h"
 #include "../loader/loader.h"
 #include "../thread/scheduler.h"
+#include "../user/user_input.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
 
 /* Global VM context pointer for syscall handler access */
 static vm_context_t *g_vm_context = NULL;
@@ -461,6 +464,49 @@ void vm_setup_cpu_state(vm_context_t *vm)
            teb_self, teb_tid);
 }
 
+/* Longest single idle sleep, so the main loop still notices exit requests */
+#define VM_IDLE_MAX_MS 100
+
+/* Host events are pumped at most this often while guest code is running;
+ * SDL_PollEvent is far too slow to call after every slice of exec386 */
+#define VM_DISPLAY_POLL_MS 8
+
+static uint64_t vm_host_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/*
+ * Sleep while no guest thread is runnable
+ * Wakes at the earliest wait timeout, or earlier on host input in GUI mode,
+ * so an idle GUI process does not spin.
+ */
+static void vm_idle_wait(vm_context_t *vm, wbox_scheduler_t *sched)
+{
+    int timeout_ms = VM_IDLE_MAX_MS;
+
+    uint64_t deadline = scheduler_next_timeout(sched);
+    if (deadline != 0) {
+        uint64_t now = scheduler_get_time_100ns();
+        uint64_t ms = deadline > now ? (deadline - now + 9999) / 10000 : 0;
+        if (ms < (uint64_t)timeout_ms) {
+            timeout_ms = (int)ms;
+        }
+    }
+
+    if (timeout_ms == 0) {
+        return;
+    }
+
+    if (vm->gui_mode && vm->display.initialized) {
+        display_wait_events(&vm->display, timeout_ms);
+    } else {
+        usleep((useconds_t)timeout_ms * 1000);
+    }
+}
+
 void vm_start(vm_context_t *vm)
 {
     printf("\n=== Starting VM execution ===\n\n");
@@ -537,6 +583,8 @@ void vm_start(vm_context_t *vm)
         }
     }
 
+    uint64_t last_display_poll = 0;
+
     /* Run until exit is requested */
     while (!vm->exit_requested) {
         /* Execute some CPU cycles if we have a running thread (not idle thread) */
@@ -550,16 +598,24 @@ void vm_start(vm_context_t *vm)
             }
         }
 
-        /* Process display events and render if in GUI mode */
-        if (vm->gui_mode && vm->display.initialized) {
+        /* Process display events and render if in GUI mode. When the CPU is
+         * idle there is nothing to slow down, so poll every time round. */
+        bool cpu_idle = sched && sched->current_thread && sched->current_thread->is_idle_thread;
+        if (vm->gui_mode && vm->display.initialized &&
+            (cpu_idle || vm_host_ms() - last_display_poll >= VM_DISPLAY_POLL_MS)) {
+            last_display_poll = vm_host_ms();
+
             /* Process SDL events */
             if (display_poll_events(&vm->display)) {
-                /* Quit requested via SDL (window close, ESC) */
+                /* Quit requested via SDL (window close) */
                 vm->exit_requested = 1;
                 vm->exit_code = 0;
                 break;
             }
 
+            /* Deliver input now, so a thread parked in GetMessage wakes */
+            user_input_process(&vm->display);
+
             /* Present frame buffer to screen */
             display_present(&vm->display);
         }
@@ -575,8 +631,9 @@ void vm_start(vm_context_t *vm)
                 /* Threads became ready (e.g., from timeout), switch to them */
                 scheduler_switch(sched);
             } else {
-                /* No runnable threads, sleep briefly */
-                usleep(1000);  /* 1ms idle sleep */
+                /* No runnable threads: sleep until the next wait timeout or,
+                 * in GUI mode, until host input arrives */
+                vm_idle_wait(vm, sched);
             }
         }
     }
@@ -810,7 +867,9 @@ int vm_init_dlls(vm_context_t *vm)
             (m)->entry_point != 0 && (m)->entry_point != (m)->base_va) { \
             printf("  Initializing %s (entry=0x%08X, ESP=0x%08X)...", (m)->name, (m)->entry_point, ESP); \
             fflush(stdout); \
+            int mark = startup_profile_begin(vm->profile); \
             int r = vm_call_dll_entry(vm, (m)->entry_point, (m)->base_va, 1); \
+            startup_profile_end(vm->profile, mark, (m)->name, PROFILE_PHASE_DLL_MAIN); \
             printf(" [post ESP=0x%08X]", ESP); \
             if (r) { printf(" OK\n"); initialized++; } \
             else { printf(" FAILED\n"); } \
@@ -902,6 +961,12 @@ int vm_load_pe_with_dlls(vm_context_t *vm, const char *exe_path,
         loader_set_ntdll_path(loader, ntdll_path);
     }
 
+    /* A broken cache directory only costs the cache */
+    if (vm->image_cache_dir && loader_set_image_cache(loader, vm->image_cache_dir) < 0) {
+        fprintf(stderr, "vm_load_pe_with_dlls: Image cache disabled\n");
+    }
+    loader_set_lazy_binding(loader, vm->lazy_imports);
+
     /* Store loader in VM context */
     vm->loader = loader;
 
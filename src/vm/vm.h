@@ -22,6 +22,9 @@ struct heap_state;
 /* Forward declaration for scheduler */
 struct wbox_scheduler;
 
+/* Forward declaration for startup profiler */
+struct startup_profile;
+
 /* Memory layout constants */
 #define VM_PHYS_MEM_SIZE       (256 * 1024 * 1024)  /* 256MB physical memory */
 #define VM_KERNEL_BASE         0x80000000           /* Kernel space starts at 2GB */
@@ -42,9 +45,9 @@ struct wbox_scheduler;
  *   0x7XXXXX00 - 0x7DXXXXXX: DLLs (kernel32, ntdll, etc.)
  *   0x7E000000: GDI shared handle table (1MB)
  *   0x7F000000: Loader stub region
- *   0x7F010000: Loader heap
  *   0x7F020000: USER shared info
  *   0x7F030000: USER handle table
+ *   0x7F100000: Loader heap (8MB reserved, committed as it grows)
  *   0x7FFDE000: PEB
  *   0x7FFDF000: TEB
  *   0x7FFE0000: KUSER_SHARED_DATA
@@ -114,6 +117,15 @@ typedef struct vm_context {
     display_context_t display;
     bool gui_mode;
 
+    /* Relocated image cache directory (NULL = no cache) */
+    const char *image_cache_dir;
+
+    /* Bind imports on first call instead of at load time */
+    bool lazy_imports;
+
+    /* Startup phase timings (NULL = not profiling) */
+    struct startup_profile *profile;
+
     /* Thread scheduler (for multi-threading support) */
     struct wbox_scheduler *scheduler;
 } vm_context_t;
@@ -0,0 +1,288 @@
+/*
+ * Desktop heap tests
+ *
+ * Runs the desktop heap allocator over a fake guest RAM: blocks come out
+ * zeroed and aligned, a freed block is reused by the next allocation of
+ * its size class, neighbours coalesce in either order until the heap is
+ * one block again, bad frees are ignored, and create/destroy churn of
+ * WND and CLS sized blocks stays within a bounded part of the heap.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "user/desktop_heap.h"
+#include "vm/vm.h"
+#include "vm/paging.h"
+#include "cpu/mem.h"
+#include "test_util.h"
+
+#define PHYS_BASE       0x00100000
+#define PHYS_SIZE       (2 * 1024 * 1024)
+#define CHURN_WINDOWS   300
+#define CHURN_ROUNDS    50
+
+/*
+ * Fake guest: the heap only needs RAM behind its physical allocation
+ */
+
+uint8_t *ram;
+
+uint32_t paging_alloc_phys(paging_context_t *ctx, uint32_t size)
+{
+    size = (size + PAGE_SIZE - 1) & PAGE_MASK;
+    if (ctx->phys_alloc_ptr + size > PHYS_BASE + PHYS_SIZE) {
+        return 0;
+    }
+    uint32_t addr = ctx->phys_alloc_ptr;
+    ctx->phys_alloc_ptr += size;
+    return addr;
+}
+
+int paging_map_range(paging_context_t *ctx, uint32_t virt, uint32_t phys,
+                     uint32_t size, uint32_t flags)
+{
+    (void)ctx;
+    (void)flags;
+    return virt == DESKTOP_HEAP_BASE_VA && size == DESKTOP_HEAP_SIZE &&
+           phys >= PHYS_BASE ? 0 : -1;
+}
+
+/*
+ * Helpers
+ */
+
+static vm_context_t vm;
+
+static void init(void)
+{
+    desktop_heap_shutdown();
+    memset(ram, 0xCC, PHYS_BASE + PHYS_SIZE);   /* Guest RAM starts dirty */
+    memset(&vm, 0, sizeof(vm));
+    vm.paging.phys_alloc_ptr = PHYS_BASE;
+    CHECK(desktop_heap_init(&vm) == 0, "init");
+}
+
+static bool is_zero(uint32_t va, uint32_t size)
+{
+    const uint8_t *p = desktop_heap_host_ptr(va, size);
+    if (!p) {
+        return false;
+    }
+    for (uint32_t i = 0; i < size; i++) {
+        if (p[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void scribble(uint32_t va, uint32_t size)
+{
+    memset(desktop_heap_host_ptr(va, size), 0xA5, size);
+}
+
+/* The heap is back to one free block: the largest allocation fits */
+static bool heap_is_empty(void)
+{
+    desktop_heap_t *heap = desktop_heap_get();
+    if (heap->used_blocks || heap->used_bytes) {
+        return false;
+    }
+    uint32_t va = desktop_heap_alloc(DESKTOP_HEAP_SIZE - 8);
+    if (!va) {
+        return false;
+    }
+    desktop_heap_free(va);
+    return true;
+}
+
+/*
+ * Tests
+ */
+
+static void test_alloc(void)
+{
+    init();
+    desktop_heap_t *heap = desktop_heap_get();
+
+    uint32_t a = desktop_heap_alloc(1);
+    uint32_t b = desktop_heap_alloc(WND_BASE_SIZE + 40);
+    uint32_t c = desktop_heap_alloc(CLS_SIZE);
+    CHECK(a && b && c, "allocations succeed");
+    CHECK(desktop_heap_contains(a) && desktop_heap_contains(b) && desktop_heap_contains(c),
+          "blocks inside the heap");
+    CHECK(!(a & 7) && !(b & 7) && !(c & 7), "blocks 8-byte aligned");
+    CHECK(a + 16 <= b && b + WND_BASE_SIZE + 40 <= c, "blocks do not overlap");
+    CHECK(is_zero(b, WND_BASE_SIZE + 40) && is_zero(c, CLS_SIZE), "blocks zeroed");
+    CHECK(heap->used_blocks == 3, "used block count");
+
+    CHECK(desktop_heap_alloc(0) == 0, "zero-size allocation fails");
+    CHECK(desktop_heap_alloc(DESKTOP_HEAP_SIZE) == 0, "oversized allocation fails");
+    CHECK(heap->used_blocks == 3, "failed allocations take nothing");
+
+    /* Bad frees are reported and ignored */
+    desktop_heap_free(0);
+    desktop_heap_free(b + 8);
+    desktop_heap_free(DESKTOP_HEAP_BASE_VA - 16);
+    desktop_heap_free(DESKTOP_HEAP_LIMIT_VA);
+    CHECK(heap->used_blocks == 3, "bad frees ignored");
+    desktop_heap_free(b);
+    desktop_heap_free(b);
+    CHECK(heap->used_blocks == 2, "double free ignored");
+
+    desktop_heap_free(a);
+    desktop_heap_free(c);
+    CHECK(heap_is_empty(), "heap empty after freeing everything");
+}
+
+/* A freed block is handed out again, cleared, to a request of its class */
+static void test_reuse(void)
+{
+    init();
+
+    uint32_t blocks[8];
+    for (int i = 0; i < 8; i++) {
+        blocks[i] = desktop_heap_alloc(WND_BASE_SIZE);
+        scribble(blocks[i], WND_BASE_SIZE);
+    }
+
+    desktop_heap_free(blocks[3]);
+    CHECK(is_zero(blocks[3], 4) && is_zero(blocks[3] + 12, WND_BASE_SIZE - 12),
+          "freed block cleared but for its free-list links");
+
+    uint32_t again = desktop_heap_alloc(WND_BASE_SIZE);
+    CHECK(again == blocks[3], "same-size allocation reuses the hole");
+    CHECK(is_zero(again, WND_BASE_SIZE), "reused block zeroed");
+
+    /* A smaller request splits the hole; the rest stays usable */
+    desktop_heap_free(blocks[5]);
+    uint32_t small = desktop_heap_alloc(32);
+    CHECK(small == blocks[5], "smaller allocation takes the hole");
+    uint32_t tail = desktop_heap_alloc(64);
+    CHECK(tail > small && tail < blocks[6], "split remainder reused");
+
+    /* A request no hole can hold goes past the in-use blocks */
+    desktop_heap_free(blocks[1]);
+    uint32_t big = desktop_heap_alloc(WND_BASE_SIZE * 4);
+    CHECK(big > blocks[7], "too-large request skips the hole");
+    CHECK(desktop_heap_alloc(WND_BASE_SIZE) == blocks[1], "hole still free");
+}
+
+/* Neighbours coalesce whichever side is freed first */
+static void test_coalesce(void)
+{
+    init();
+
+    uint32_t a = desktop_heap_alloc(100);
+    uint32_t b = desktop_heap_alloc(100);
+    uint32_t c = desktop_heap_alloc(100);
+    uint32_t d = desktop_heap_alloc(100);
+    uint32_t guard = desktop_heap_alloc(100);
+    CHECK(a && b && c && d && guard, "allocations succeed");
+
+    /* Free the outer two, then the middle one: a..c becomes one block */
+    desktop_heap_free(a);
+    desktop_heap_free(c);
+    desktop_heap_free(b);
+    uint32_t merged = desktop_heap_alloc(d - a - 8);
+    CHECK(merged == a, "merged with both neighbours");
+    desktop_heap_free(merged);
+
+    /* Freeing d joins it to the merged block from the left */
+    desktop_heap_free(d);
+    merged = desktop_heap_alloc(guard - a - 8);
+    CHECK(merged == a, "merged with the block before");
+    CHECK(is_zero(merged, guard - a - 8), "merged block zeroed, headers included");
+    desktop_heap_free(merged);
+
+    /* The guard merges with everything on both sides */
+    desktop_heap_free(guard);
+    CHECK(heap_is_empty(), "heap back to one block");
+}
+
+/* Exhaust the heap, then give it all back */
+static void test_exhaust(void)
+{
+    init();
+    desktop_heap_t *heap = desktop_heap_get();
+
+    static uint32_t blocks[DESKTOP_HEAP_SIZE / 1000];
+    uint32_t count = 0;
+    uint32_t va;
+    while (count < sizeof(blocks) / sizeof(blocks[0]) &&
+           (va = desktop_heap_alloc(1000)) != 0) {
+        blocks[count++] = va;
+    }
+    CHECK(count == DESKTOP_HEAP_SIZE / 1008, "heap fills up");
+    CHECK(desktop_heap_alloc(1000) == 0, "full heap refuses allocations");
+    CHECK(heap->used_blocks == count, "used block count when full");
+
+    /* Free every other block: lots of space, but no 2000-byte hole */
+    for (uint32_t i = 0; i < count; i += 2) {
+        desktop_heap_free(blocks[i]);
+    }
+    CHECK(desktop_heap_alloc(2000) == 0, "fragmented heap has no 2000-byte hole");
+    va = desktop_heap_alloc(1000);
+    CHECK(va && (va - blocks[0]) % 2016 == 0, "1000-byte hole reused");
+    desktop_heap_free(va);
+
+    /* Then the rest, in reverse */
+    for (uint32_t i = count; i-- > 0; ) {
+        desktop_heap_free(blocks[i]);
+    }
+    CHECK(heap->used_blocks == 0 && heap->used_bytes == 0, "nothing in use");
+    CHECK(heap_is_empty(), "heap back to one block after exhaustion");
+}
+
+/* Window and class create/destroy churn keeps reusing the same space */
+static void test_churn(void)
+{
+    init();
+
+    static uint32_t wnds[CHURN_WINDOWS];
+    uint32_t high = 0;
+    uint32_t seed = 1;
+
+    uint32_t cls = desktop_heap_alloc(CLS_SIZE);
+    for (int round = 0; round < CHURN_ROUNDS; round++) {
+        for (int i = 0; i < CHURN_WINDOWS; i++) {
+            seed = seed * 1103515245 + 12345;
+            uint32_t extra = (seed >> 16) % 4 * 8;
+            wnds[i] = desktop_heap_alloc(WND_BASE_SIZE + extra);
+            if (wnds[i] + WND_BASE_SIZE + extra > high) {
+                high = wnds[i] + WND_BASE_SIZE + extra;
+            }
+        }
+        for (int i = 0; i < CHURN_WINDOWS; i++) {
+            desktop_heap_free(wnds[(i * 7) % CHURN_WINDOWS]);
+        }
+    }
+    desktop_heap_free(cls);
+
+    uint32_t bound = DESKTOP_HEAP_BASE_VA + 2 * CHURN_WINDOWS * (WND_BASE_SIZE + 32 + 8);
+    printf("desktop heap churn: high water 0x%X bytes (bound 0x%X)\n",
+           high - DESKTOP_HEAP_BASE_VA, bound - DESKTOP_HEAP_BASE_VA);
+    CHECK(high <= bound, "churn stays within twice one round's footprint");
+    CHECK(heap_is_empty(), "heap empty after churn");
+}
+
+int main(void)
+{
+    ram = calloc(1, PHYS_BASE + PHYS_SIZE);
+    if (!ram) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    test_alloc();
+    test_reuse();
+    test_coalesce();
+    test_exhaust();
+    test_churn();
+
+    desktop_heap_shutdown();
+    free(ram);
+    return test_finish();
+}
@@ -0,0 +1,496 @@
+/*
+ * DLL prefetch tests
+ *
+ * Writes a tree of DLL files (relocated code, export tables, each
+ * importing the next two) to a temp directory and loads it the way the
+ * loader does: the root is submitted, the rest of the tree is queued from
+ * the parsed callback, and each taken image is copied into frames of a
+ * fake guest memory allocated in load order. Every image, export table
+ * and frame address must match what the loader builds on its own, one
+ * DLL after another. Times both, with the files in the page cache and
+ * evicted from it. Also checks duplicate names, missing files, the
+ * default base, taking twice and tearing down with jobs left over.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "loader/prefetch.h"
+#include "loader/exports.h"
+#include "loader/imports.h"
+#include "test_util.h"
+
+#define NUM_DLLS        16
+#define TEXT_SIZE       (1024 * 1024)
+#define NUM_EXPORTS     2000
+#define IMAGE_BASE      0x10000000
+#define LOAD_BASE       0x6F000000
+#define IDATA_SIZE      0x1000
+#define ROUNDS          5
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char dir[64];
+static char names[NUM_DLLS][32];
+static char paths[NUM_DLLS][128];
+
+static void put16(uint8_t *p, uint16_t v) { memcpy(p, &v, 2); }
+static void put32(uint8_t *p, uint32_t v) { memcpy(p, &v, 4); }
+
+static void put_section(uint8_t *hdr, const char *name, uint32_t rva, uint32_t vsize,
+                        uint32_t raw, uint32_t raw_size, uint32_t flags)
+{
+    memcpy(hdr, name, strlen(name));
+    put32(hdr + 8, vsize);
+    put32(hdr + 12, rva);
+    put32(hdr + 16, raw_size);
+    put32(hdr + 20, raw);
+    put32(hdr + 36, flags);
+}
+
+/*
+ * .text (a HIGHLOW fixup every 16 bytes), .edata, .reloc and .idata, with
+ * file and section alignment 0x1000 so raw offsets equal RVAs. DLL i
+ * imports DLLs 2i+1 and 2i+2.
+ */
+static void write_dll(const char *path, uint32_t index)
+{
+    uint32_t pages = TEXT_SIZE / 0x1000;
+    uint32_t reloc_size = pages * (8 + 256 * 2);
+    uint32_t edata_size = 40 + NUM_EXPORTS * 10 + NUM_EXPORTS * 16 + 32;
+    edata_size = (edata_size + 0xFFF) & ~0xFFFu;
+
+    uint32_t text_rva = 0x1000;
+    uint32_t edata_rva = text_rva + TEXT_SIZE;
+    uint32_t reloc_rva = edata_rva + edata_size;
+    uint32_t idata_rva = (reloc_rva + reloc_size + 0xFFF) & ~0xFFFu;
+    uint32_t image_size = idata_rva + IDATA_SIZE;
+
+    uint8_t *file = calloc(1, image_size);
+    uint32_t seed = index * 7919 + 1;
+    for (uint32_t i = 0; i < TEXT_SIZE; i++) {
+        seed = seed * 1103515245 + 12345;
+        file[text_rva + i] = (uint8_t)(seed >> 16);
+    }
+
+    /* Headers */
+    put16(file, 0x5A4D);
+    put32(file + 0x3C, 0x40);
+    put32(file + 0x40, 0x00004550);
+    uint8_t *coff = file + 0x44;
+    put16(coff, 0x014C);
+    put16(coff + 2, 4);
+    put16(coff + 16, 0xE0);
+    put16(coff + 18, 0x2102);
+    uint8_t *opt = coff + 20;
+    put16(opt, 0x10B);
+    put32(opt + 28, IMAGE_BASE);
+    put32(opt + 32, 0x1000);
+    put32(opt + 36, 0x1000);
+    put32(opt + 56, image_size);
+    put32(opt + 60, 0x1000);
+    put32(opt + 92, 16);
+    put32(opt + 96, edata_rva);                 /* Export directory */
+    put32(opt + 100, edata_size);
+    put32(opt + 96 + 8, idata_rva);             /* Import directory */
+    put32(opt + 100 + 8, 3 * sizeof(IMAGE_IMPORT_DESCRIPTOR));
+    put32(opt + 96 + 5 * 8, reloc_rva);         /* Base relocations */
+    put32(opt + 100 + 5 * 8, reloc_size);
+    uint8_t *sec = opt + 0xE0;
+    put_section(sec, ".text", text_rva, TEXT_SIZE, text_rva, TEXT_SIZE, 0x60000020);
+    put_section(sec + 40, ".edata", edata_rva, edata_size, edata_rva, edata_size, 0x40000040);
+    put_section(sec + 80, ".reloc", reloc_rva, reloc_size, reloc_rva, reloc_size, 0x42000040);
+    put_section(sec + 120, ".idata", idata_rva, IDATA_SIZE, idata_rva, IDATA_SIZE, 0xC0000040);
+
+    /* Exports: directory, EAT, name pointers, ordinals, sorted names */
+    uint8_t *ed = file + edata_rva;
+    uint32_t eat = edata_rva + 40;
+    uint32_t npt = eat + NUM_EXPORTS * 4;
+    uint32_t ords = npt + NUM_EXPORTS * 4;
+    uint32_t str = ords + NUM_EXPORTS * 2;
+    put32(ed + 16, 1);
+    put32(ed + 20, NUM_EXPORTS);
+    put32(ed + 24, NUM_EXPORTS);
+    put32(ed + 28, eat);
+    put32(ed + 32, npt);
+    put32(ed + 36, ords);
+    for (uint32_t i = 0; i < NUM_EXPORTS; i++) {
+        put32(file + eat + i * 4, text_rva + i * 0x40);
+        put32(file + npt + i * 4, str);
+        put16(file + ords + i * 2, (uint16_t)i);
+        str += sprintf((char *)file + str, "Fn%05u_%u", i, index) + 1;
+    }
+
+    /* Fixups point at absolute addresses inside the image */
+    uint8_t *reloc = file + reloc_rva;
+    for (uint32_t p = 0; p < pages; p++) {
+        uint32_t page_rva = text_rva + p * 0x1000;
+        put32(reloc, page_rva);
+        put32(reloc + 4, 8 + 256 * 2);
+        for (uint32_t e = 0; e < 256; e++) {
+            put16(reloc + 8 + e * 2, (uint16_t)((IMAGE_REL_BASED_HIGHLOW << 12) | (e * 16)));
+            put32(file + page_rva + e * 16, IMAGE_BASE + page_rva + e * 16);
+        }
+        reloc += 8 + 256 * 2;
+    }
+
+    /* Imports: just the descriptors' DLL names */
+    IMAGE_IMPORT_DESCRIPTOR *desc = (IMAGE_IMPORT_DESCRIPTOR *)(file + idata_rva);
+    uint32_t name_rva = idata_rva + 3 * sizeof(IMAGE_IMPORT_DESCRIPTOR);
+    for (uint32_t child = 2 * index + 1; child <= 2 * index + 2 && child < NUM_DLLS; child++) {
+        desc->Name = name_rva;
+        name_rva += sprintf((char *)file + name_rva, "%s", names[child]) + 1;
+        desc++;
+    }
+
+    /* Clean pages, so they can be dropped from the page cache */
+    FILE *f = fopen(path, "wb");
+    CHECK(f && fwrite(file, 1, image_size, f) == image_size, "write DLL");
+    if (f) {
+        fflush(f);
+        fsync(fileno(f));
+        fclose(f);
+    }
+    free(file);
+}
+
+/* Drop the DLL files from the page cache; false if most of them stay resident */
+static bool evict_files(void)
+{
+    size_t resident = 0, total = 0;
+    for (uint32_t i = 0; i < NUM_DLLS; i++) {
+        int fd = open(paths[i], O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            if (fd >= 0) close(fd);
+            return false;
+        }
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+        size_t pages = ((size_t)st.st_size + 0xFFF) / 0x1000;
+        void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        unsigned char *vec = malloc(pages);
+        if (map != MAP_FAILED && vec && mincore(map, (size_t)st.st_size, vec) == 0) {
+            for (size_t p = 0; p < pages; p++) {
+                resident += vec[p] & 1;
+            }
+            total += pages;
+        }
+        free(vec);
+        if (map != MAP_FAILED) munmap(map, (size_t)st.st_size);
+        close(fd);
+    }
+    return total > 0 && resident * 4 < total;
+}
+
+/*
+ * Fake guest memory: the loader's physical frames, handed out zeroed in
+ * allocation order
+ */
+typedef struct {
+    uint8_t *mem;
+    uint32_t size;
+    uint32_t used;
+} arena_t;
+
+static uint8_t *arena_alloc(arena_t *arena, uint32_t size)
+{
+    size = (size + 0xFFF) & ~0xFFFu;
+    if (size > arena->size - arena->used) {
+        return NULL;
+    }
+    uint8_t *p = arena->mem + arena->used;
+    arena->used += size;
+    memset(p, 0, size);
+    return p;
+}
+
+/* What the loader does without workers */
+typedef struct {
+    loaded_module_t mod;
+    uint8_t *image;
+} reference_t;
+
+static void prepare_reference(reference_t *ref, arena_t *arena, const char *path, uint32_t base)
+{
+    memset(ref, 0, sizeof(*ref));
+    CHECK(pe_load(path, &ref->mod.pe) == 0, "reference load");
+    CHECK(exports_parse(&ref->mod.pe, &ref->mod) == 0, "reference exports");
+    ref->image = arena_alloc(arena, ref->mod.pe.size_of_image);
+    CHECK(ref->image && pe_map_image(&ref->mod.pe, ref->image) == 0, "reference map");
+    CHECK(pe_relocate_image(&ref->mod.pe, ref->image, base) > 0, "reference relocate");
+}
+
+static void free_reference(reference_t *ref)
+{
+    exports_free(&ref->mod);
+    pe_free(&ref->mod.pe);
+}
+
+static void compare(const prefetch_job_t *job, const uint8_t *frames, const reference_t *ref)
+{
+    const loaded_module_t *mod = job->mod;
+    CHECK(job->status == 0 && mod && job->image && frames, "job ready");
+    if (!mod || !job->image || !frames) {
+        return;
+    }
+    CHECK(job->base_va == LOAD_BASE, "job base");
+    CHECK(mod->pe.size_of_image == ref->mod.pe.size_of_image, "same image size");
+    CHECK(memcmp(frames, ref->image, ref->mod.pe.size_of_image) == 0, "same image");
+    CHECK(job->fixups == (int)(TEXT_SIZE / 16), "all fixups applied");
+    CHECK(mod->num_exports == ref->mod.num_exports &&
+          mod->num_export_names == ref->mod.num_export_names, "same export counts");
+    for (uint32_t i = 0; i < mod->num_export_names && i < ref->mod.num_export_names; i++) {
+        if (strcmp(mod->export_names[i].name, ref->mod.export_names[i].name) != 0 ||
+            mod->export_names[i].index != ref->mod.export_names[i].index) {
+            CHECK(false, "same export names");
+            break;
+        }
+    }
+    CHECK(!mod->exports_data && !mod->exports_forwarded, "code exports only");
+}
+
+/* The loader's parsed callback: queue the DLL's imports */
+typedef struct {
+    prefetch_t *pf;
+    uint32_t calls;
+} loader_t;
+
+static void on_parsed(void *arg, const prefetch_job_t *job)
+{
+    loader_t *loader = arg;
+    const pe_image_t *pe = &job->mod->pe;
+    const IMAGE_IMPORT_DESCRIPTOR *imp = (const IMAGE_IMPORT_DESCRIPTOR *)pe_rva_to_ptr(
+        pe, pe->data_dirs[IMAGE_DIRECTORY_ENTRY_IMPORT].virtual_address);
+    for (; imp && imp->Name != 0; imp++) {
+        const char *name = (const char *)pe_rva_to_ptr(pe, imp->Name);
+        if (name && !prefetch_has(loader->pf, name)) {
+            char path[256];
+            snprintf(path, sizeof(path), "%s/%s", dir, name);
+            CHECK(prefetch_submit(loader->pf, name, path, LOAD_BASE) == 0, "submit import");
+        }
+    }
+    loader->calls++;
+}
+
+/* Load the tree one DLL after another; returns the time taken */
+static double load_serial(reference_t *refs, arena_t *arena)
+{
+    arena->used = 0;
+    double start = now_sec();
+    for (uint32_t i = 0; i < NUM_DLLS; i++) {
+        prepare_reference(&refs[i], arena, paths[i], LOAD_BASE);
+    }
+    return now_sec() - start;
+}
+
+/*
+ * Load the tree through the pool, in the same order, copying each image
+ * into frames allocated as it is taken; returns the time taken
+ */
+static double load_prefetched(prefetch_t **pf_out, prefetch_job_t **jobs, uint8_t **frames,
+                              arena_t *arena, uint32_t workers)
+{
+    static loader_t loader;
+    arena->used = 0;
+    double start = now_sec();
+    loader.calls = 0;
+    loader.pf = prefetch_create(workers, on_parsed, &loader);
+    *pf_out = loader.pf;
+    CHECK(loader.pf != NULL, "pool started");
+    if (!loader.pf) {
+        return 0;
+    }
+
+    /* Only the root is known up front */
+    CHECK(prefetch_submit(loader.pf, names[0], paths[0], LOAD_BASE) == 0, "submit root");
+    for (uint32_t i = 0; i < NUM_DLLS; i++) {
+        jobs[i] = prefetch_take(loader.pf, paths[i]);
+        frames[i] = NULL;
+        if (jobs[i] && jobs[i]->image) {
+            uint32_t size = jobs[i]->mod->pe.size_of_image;
+            frames[i] = arena_alloc(arena, size);
+            if (frames[i]) {
+                memcpy(frames[i], jobs[i]->image, size);
+            }
+        }
+    }
+    double elapsed = now_sec() - start;
+    CHECK(prefetch_count(loader.pf) == NUM_DLLS && loader.calls == NUM_DLLS,
+          "whole tree queued from the callback");
+    return elapsed;
+}
+
+static void release_jobs(prefetch_job_t **jobs)
+{
+    for (uint32_t i = 0; i < NUM_DLLS; i++) {
+        prefetch_release(jobs[i]);
+    }
+}
+
+static void test_prefetch(void)
+{
+    for (uint32_t i = 0; i < NUM_DLLS; i++) {
+        snprintf(names[i], sizeof(names[i]), "dep%02u.dll", i);
+        snprintf(paths[i], sizeof(paths[i]), "%s/dep%02u.dll", dir, i);
+    }
+    for (uint32_t i = 0; i < NUM_DLLS; i++) {
+        write_dll(paths[i], i);
+    }
+
+    uint32_t workers = prefetch_default_workers();
+    if (workers < 4) {
+        workers = 4;    /* Exercise the pool even on one core */
+    }
+    arena_t serial_mem = { .size = NUM_DLLS * (TEXT_SIZE + 0x100000) };
+    arena_t pool_mem = serial_mem;
+    serial_mem.mem = malloc(serial_mem.size);
+    pool_mem.mem = malloc(pool_mem.size);
+
+    /* Best of a few rounds each, from the page cache and from disk */
+    static reference_t refs[NUM_DLLS];
+    prefetch_job_t *jobs[NUM_DLLS];
+    uint8_t *frames[NUM_DLLS];
+    prefetch_t *pf = NULL;
+    double serial[2] = { 1e9, 1e9 }, parallel[2] = { 1e9, 1e9 };
+    bool cold_ok = true;
+    for (int cold = 0; cold < 2; cold++) {
+        for (int round = 0; round < ROUNDS; round++) {
+            if (cold) cold_ok &= evict_files();
+            double t = load_serial(refs, &serial_mem);
+            if (t < serial[cold]) serial[cold] = t;
+            for (uint32_t i = 0; i < NUM_DLLS; i++) {
+                free_reference(&refs[i]);
+            }
+
+            if (cold) cold_ok &= evict_files();
+            t = load_prefetched(&pf, jobs, frames, &pool_mem, workers);
+            if (t < parallel[cold]) parallel[cold] = t;
+            release_jobs(jobs);
+            prefetch_destroy(pf);
+        }
+    }
+
+    /* The same images, exports and frame layout as the serial loader */
+    load_serial(refs, &serial_mem);
+    load_prefetched(&pf, jobs, frames, &pool_mem, workers);
+    if (!pf) {
+        return;
+    }
+    for (uint32_t i = 0; i < NUM_DLLS; i++) {
+        CHECK(jobs[i] != NULL, "take");
+        if (jobs[i]) {
+            compare(jobs[i], frames[i], &refs[i]);
+            CHECK(frames[i] == pool_mem.mem + (refs[i].image - serial_mem.mem),
+                  "frames allocated in load order");
+        }
+    }
+    CHECK(pool_mem.used == serial_mem.used, "no frames beyond the loaded images");
+
+    /* Workers read ahead while the loader copies and links: faster from
+     * disk as long as reading the files is what takes the time and there
+     * is a spare CPU to lay images out on */
+    bool disk_bound = cold_ok && serial[1] > serial[0] * 1.5 && prefetch_default_workers() > 1;
+    CHECK(!disk_bound || parallel[1] < serial[1], "prefetching beats serial loading from disk");
+    for (int cold = 0; cold < 2; cold++) {
+        printf("load %u DLLs (%u MB, %s): serial %.1f ms, %u workers %.1f ms (%.2fx)\n",
+               NUM_DLLS, (unsigned)(NUM_DLLS * TEXT_SIZE >> 20),
+               cold ? (cold_ok ? "cold cache" : "cold cache unavailable") : "warm cache",
+               serial[cold] * 1e3, workers, parallel[cold] * 1e3,
+               parallel[cold] > 0 ? serial[cold] / parallel[cold] : 0.0);
+    }
+
+    /* Names are deduplicated case-insensitively; a path is taken once */
+    CHECK(prefetch_has(pf, "DEP03.DLL"), "name lookup ignores case");
+    CHECK(prefetch_submit(pf, "DEP03.DLL", paths[3], LOAD_BASE) == 0 &&
+          prefetch_count(pf) == NUM_DLLS, "duplicate not queued");
+    CHECK(prefetch_take(pf, paths[3]) == NULL, "taken once");
+    CHECK(prefetch_take(pf, "/nonexistent/never.dll") == NULL, "unknown path");
+
+    /* The loader keeps the module, the pool frees the rest */
+    loaded_module_t *kept = jobs[0]->mod;
+    jobs[0]->mod = NULL;
+    for (uint32_t i = 0; i < NUM_DLLS; i++) {
+        prefetch_release(jobs[i]);
+    }
+    exports_free(kept);
+    pe_free(&kept->pe);
+    free(kept);
+
+    /* A missing file fails without a module */
+    CHECK(prefetch_submit(pf, "missing.dll", "/nonexistent/missing.dll", 0) == 0, "submit missing");
+    const prefetch_job_t *missing = prefetch_wait(pf, NUM_DLLS);
+    CHECK(missing && missing->status != 0 && !missing->mod, "missing file fails");
+
+    /* Base 0 means the image's preferred base: laid out without fixups */
+    CHECK(prefetch_submit(pf, "again.dll", paths[1], 0) == 0, "submit at image base");
+    const prefetch_job_t *again = prefetch_wait(pf, NUM_DLLS + 1);
+    CHECK(again && again->status == 0 && again->base_va == IMAGE_BASE && again->fixups == 0,
+          "preferred base");
+
+    /* Left over: laid out but never taken, and queued behind a stop; the
+     * pool frees their images (checked under ASan) */
+    CHECK(prefetch_submit(pf, "late.dll", paths[2], LOAD_BASE) == 0, "submit late");
+    const prefetch_job_t *late = prefetch_wait(pf, NUM_DLLS + 2);
+    CHECK(late && late->status == 0 && late->image, "late job laid out");
+    CHECK(prefetch_submit(pf, "later.dll", paths[4], LOAD_BASE) == 0, "submit later");
+    prefetch_destroy(pf);
+
+    /* Torn down with the whole tree in flight and nothing taken */
+    pf = prefetch_create(workers, NULL, NULL);
+    for (uint32_t i = 0; pf && i < NUM_DLLS; i++) {
+        prefetch_submit(pf, names[i], paths[i], LOAD_BASE);
+    }
+    prefetch_destroy(pf);
+
+    for (uint32_t i = 0; i < NUM_DLLS; i++) {
+        free_reference(&refs[i]);
+    }
+
+    /* Without a callback only what is submitted is prepared */
+    pf = prefetch_create(2, NULL, NULL);
+    CHECK(pf && prefetch_submit(pf, names[5], paths[5], LOAD_BASE) == 0, "pool without callback");
+    if (pf) {
+        const prefetch_job_t *alone = prefetch_wait(pf, 0);
+        CHECK(alone && alone->status == 0 && alone->mod && alone->image &&
+              prefetch_count(pf) == 1, "laid out, imports not queued");
+        prefetch_destroy(pf);
+    }
+
+    CHECK(prefetch_create(1, NULL, NULL) == NULL, "no pool for one worker");
+    free(serial_mem.mem);
+    free(pool_mem.mem);
+}
+
+static void cleanup(void)
+{
+    for (uint32_t i = 0; i < NUM_DLLS; i++) {
+        unlink(paths[i]);
+    }
+    rmdir(dir);
+}
+
+int main(void)
+{
+    snprintf(dir, sizeof(dir), "/tmp/wbox_prefetch_test.XXXXXX");
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    test_prefetch();
+    cleanup();
+
+    return test_finish();
+}
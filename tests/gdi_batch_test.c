@@ -0,0 +1,475 @@
+/*
+ * GDI batch tests
+ *
+ * Queues GDIBATCHHDR records in a fake TEB and drains them with
+ * gdi_batch_flush: a mixed batch of PatBlt, PolyPatBlt, object selection,
+ * brush origin, clip and delete records must leave the same pixels and DC
+ * state as the equivalent direct calls, and the queue must be reset.
+ * Malformed counts and record sizes, unknown commands, odd-sized records,
+ * a full buffer, an oversized offset and a batch that deletes its own DC
+ * must neither crash nor run records they should not.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "nt/gdi_batch.h"
+#include "gdi/gdi_dc.h"
+#include "gdi/gdi_drawing.h"
+#include "vm/vm.h"
+#include "vm/paging.h"
+#include "cpu/mem.h"
+#include "process/process.h"
+#include "test_util.h"
+
+#define TEB_VA          0x7FFDE000
+#define TEB_PHYS        0x00200000
+#define TEB_SIZE        0x1000
+#define SCREEN_W        64
+#define SCREEN_H        48
+#define CMD_UNKNOWN     99
+
+/*
+ * Fake guest: one mapped page holding the TEB
+ */
+
+static vm_context_t vm;
+static uint8_t teb_mem[TEB_SIZE];
+
+vm_context_t *vm_get_context(void)
+{
+    return &vm;
+}
+
+uint32_t paging_get_phys(paging_context_t *ctx, uint32_t virt)
+{
+    (void)ctx;
+    if (virt < TEB_VA || virt - TEB_VA >= TEB_SIZE) {
+        return 0;
+    }
+    return TEB_PHYS + (virt - TEB_VA);
+}
+
+uint32_t mem_readl_phys(uint32_t addr)
+{
+    uint32_t val = 0;
+    if (addr >= TEB_PHYS && addr - TEB_PHYS + 4 <= TEB_SIZE) {
+        memcpy(&val, &teb_mem[addr - TEB_PHYS], 4);
+    }
+    return val;
+}
+
+void mem_writel_phys(uint32_t addr, uint32_t val)
+{
+    if (addr >= TEB_PHYS && addr - TEB_PHYS + 4 <= TEB_SIZE) {
+        memcpy(&teb_mem[addr - TEB_PHYS], &val, 4);
+    }
+}
+
+/*
+ * Batch builder
+ */
+
+static uint8_t queue[GDI_BATCH_BUFFER_DWORDS * 4];
+static uint32_t queue_used;
+static uint32_t queue_count;
+
+static void queue_reset(void)
+{
+    memset(queue, 0, sizeof(queue));
+    queue_used = 0;
+    queue_count = 0;
+}
+
+static void queue_raw(const void *rec, uint32_t size)
+{
+    if (queue_used + size > sizeof(queue)) {
+        CHECK(false, "test record fits the queue");
+        return;
+    }
+    memcpy(queue + queue_used, rec, size);
+    queue_used += size;
+    queue_count++;
+}
+
+static void queue_patblt(int x, int y, int w, int h, uint32_t rop, uint32_t hbrush)
+{
+    gdi_batch_patblt_t rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.hdr.size = sizeof(rec);
+    rec.hdr.cmd = GdiBCPatBlt;
+    rec.x = x;
+    rec.y = y;
+    rec.width = w;
+    rec.height = h;
+    rec.hbrush = hbrush;
+    rec.rop = rop;
+    rec.fg_color = CLR_INVALID;
+    rec.bk_color = CLR_INVALID;
+    queue_raw(&rec, sizeof(rec));
+}
+
+static void queue_object(int16_t cmd, uint32_t hobject)
+{
+    gdi_batch_object_t rec = { { sizeof(rec), cmd }, hobject };
+    queue_raw(&rec, sizeof(rec));
+}
+
+static void queue_unknown(uint32_t size)
+{
+    uint8_t rec[64] = {0};
+    gdi_batch_hdr_t hdr = { (int16_t)size, CMD_UNKNOWN };
+    memcpy(rec, &hdr, sizeof(hdr));
+    queue_raw(rec, size);
+}
+
+/* Write the queue into the TEB with the given count and offset */
+static void submit(uint32_t hdc, uint32_t count, uint32_t offset)
+{
+    memset(teb_mem, 0, sizeof(teb_mem));
+    uint32_t batch = TEB_GDI_TEB_BATCH;
+    uint32_t room = TEB_SIZE - batch - 8;
+    memcpy(&teb_mem[batch], &offset, 4);
+    memcpy(&teb_mem[batch + 4], &hdc, 4);
+    memcpy(&teb_mem[batch + 8], queue, sizeof(queue) < room ? sizeof(queue) : room);
+    memcpy(&teb_mem[TEB_GDI_BATCH_COUNT], &count, 4);
+}
+
+static uint32_t teb_dword(uint32_t offset)
+{
+    uint32_t val;
+    memcpy(&val, &teb_mem[offset], 4);
+    return val;
+}
+
+static bool queue_is_reset(void)
+{
+    return teb_dword(TEB_GDI_BATCH_COUNT) == 0 && teb_dword(TEB_GDI_TEB_BATCH) == 0 &&
+           teb_dword(TEB_GDI_TEB_BATCH + 4) == 0;
+}
+
+/*
+ * Surfaces: the batch target and an oracle drawn with direct calls
+ */
+
+static gdi_handle_table_t table;
+static uint32_t screen_px[SCREEN_W * SCREEN_H];
+static uint32_t oracle_px[SCREEN_W * SCREEN_H];
+static display_context_t screen = { .pixels = screen_px, .width = SCREEN_W,
+                                    .height = SCREEN_H, .pitch = SCREEN_W * 4 };
+static display_context_t oracle = { .pixels = oracle_px, .width = SCREEN_W,
+                                    .height = SCREEN_H, .pitch = SCREEN_W * 4 };
+
+static void clear_surfaces(void)
+{
+    memset(screen_px, 0, sizeof(screen_px));
+    memset(oracle_px, 0, sizeof(oracle_px));
+    screen.dirty = false;
+}
+
+static bool same_pixels(void)
+{
+    return memcmp(screen_px, oracle_px, sizeof(screen_px)) == 0;
+}
+
+static bool all_zero(void)
+{
+    for (int i = 0; i < SCREEN_W * SCREEN_H; i++) {
+        if (screen_px[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Direct PatBlt with an explicit brush, as the batch applies it */
+static void oracle_patblt(gdi_dc_t *dc, int x, int y, int w, int h, uint32_t rop, uint32_t hbrush)
+{
+    gdi_brush_t *saved = dc->brush;
+    if (hbrush) {
+        dc->brush = gdi_get_object(&table, hbrush, GDI_OBJ_BRUSH);
+    }
+    gdi_pat_blt(dc, x, y, w, h, rop);
+    dc->brush = saved;
+}
+
+/*
+ * Tests
+ */
+
+static void test_mixed(void)
+{
+    clear_surfaces();
+    uint32_t hdc = gdi_create_display_dc(&table, &screen);
+    uint32_t odc = gdi_create_display_dc(&table, &oracle);
+    gdi_dc_t *dc = gdi_get_dc(&table, hdc);
+    gdi_dc_t *ref = gdi_get_dc(&table, odc);
+    uint32_t red = gdi_create_solid_brush(&table, RGB(255, 0, 0));
+    uint32_t green = gdi_create_solid_brush(&table, RGB(0, 255, 0));
+    uint32_t blue = gdi_create_solid_brush(&table, RGB(0, 0, 255));
+    uint32_t temp = gdi_create_solid_brush(&table, RGB(1, 2, 3));
+    CHECK(dc && ref && red && green && blue && temp, "setup");
+
+    /* Select, fill with the selected brush and an explicit one */
+    queue_reset();
+    queue_object(GdiBCSelObj, red);
+    queue_patblt(2, 2, 20, 10, PATCOPY, 0);
+    queue_patblt(10, 6, 8, 30, PATCOPY, blue);
+
+    /* Two rectangles in one PolyPatBlt, one with its own brush */
+    struct {
+        gdi_batch_polypatblt_t rec;
+        gdi_batch_patrect_t more;
+    } poly;
+    memset(&poly, 0, sizeof(poly));
+    poly.rec.hdr.size = sizeof(poly);
+    poly.rec.hdr.cmd = GdiBCPolyPatBlt;
+    poly.rec.rop = PATINVERT;
+    poly.rec.count = 2;
+    poly.rec.fg_color = CLR_INVALID;
+    poly.rec.bk_color = CLR_INVALID;
+    poly.rec.rects[0] = (gdi_batch_patrect_t){ { 30, 0, 10, 10 }, 0 };
+    poly.more = (gdi_batch_patrect_t){ { 35, 5, 10, 10 }, green };
+    queue_raw(&poly, sizeof(poly));
+
+    /* Brush origin, then a clip rectangle that cuts the next fill */
+    gdi_batch_brushorg_t org = { { sizeof(org), GdiBCSetBrushOrg }, { 3, 4 } };
+    queue_raw(&org, sizeof(org));
+    gdi_batch_clip_t clip = { { sizeof(clip), GdiBCExtSelClipRgn }, RGN_COPY, { 0, 20, 64, 48 } };
+    queue_raw(&clip, sizeof(clip));
+    queue_object(GdiBCSelObj, green);
+    queue_patblt(0, 16, 40, 10, PATCOPY, 0);
+
+    /* Delete a brush the app no longer needs */
+    queue_object(GdiBCDelObj, temp);
+
+    submit(hdc, queue_count, queue_used);
+    gdi_batch_flush(&table, &screen, TEB_VA);
+
+    /* The same calls made directly */
+    gdi_select_object(&table, odc, red);
+    oracle_patblt(ref, 2, 2, 20, 10, PATCOPY, 0);
+    oracle_patblt(ref, 10, 6, 8, 30, PATCOPY, blue);
+    oracle_patblt(ref, 30, 0, 10, 10, PATINVERT, 0);
+    oracle_patblt(ref, 35, 5, 10, 10, PATINVERT, green);
+    gdi_set_brush_org(ref, 3, 4, NULL);
+    gdi_region_t rgn;
+    gdi_region_init(&rgn);
+    gdi_region_set_rect(&rgn, 0, 20, 64, 48);
+    gdi_ext_select_clip_rgn(ref, &rgn, RGN_COPY);
+    gdi_region_cleanup(&rgn);
+    gdi_select_object(&table, odc, green);
+    oracle_patblt(ref, 0, 16, 40, 10, PATCOPY, 0);
+
+    CHECK(!all_zero(), "batch drew");
+    CHECK(same_pixels(), "batch output matches direct calls");
+    CHECK(queue_is_reset(), "count, offset and HDC reset");
+    CHECK(screen.dirty, "display marked dirty");
+    CHECK(dc->brush == gdi_get_object(&table, green, GDI_OBJ_BRUSH), "last selection kept");
+    CHECK(dc->brush_org_x == 3 && dc->brush_org_y == 4, "brush origin set");
+    CHECK(dc->clip_region != NULL, "clip region selected");
+    CHECK(gdi_get_object(&table, temp, GDI_OBJ_BRUSH) == NULL, "deleted brush gone");
+    CHECK(gdi_get_object(&table, blue, GDI_OBJ_BRUSH) != NULL, "explicit brush kept");
+
+    /* Draining again with the queue reset does nothing */
+    screen.dirty = false;
+    gdi_batch_flush(&table, &screen, TEB_VA);
+    CHECK(!screen.dirty && same_pixels(), "empty queue is a no-op");
+
+    gdi_delete_object(&table, red);
+    gdi_delete_object(&table, green);
+    gdi_delete_object(&table, blue);
+    gdi_delete_dc(&table, hdc);
+    gdi_delete_dc(&table, odc);
+}
+
+/* Counts that disagree with the records, and broken record sizes */
+static void test_malformed(void)
+{
+    uint32_t hdc = gdi_create_display_dc(&table, &screen);
+    uint32_t odc = gdi_create_display_dc(&table, &oracle);
+    gdi_dc_t *ref = gdi_get_dc(&table, odc);
+    uint32_t brush = gdi_create_solid_brush(&table, RGB(200, 100, 50));
+
+    /* A count past the records runs what is there and stops */
+    clear_surfaces();
+    queue_reset();
+    queue_patblt(0, 0, 8, 8, PATCOPY, brush);
+    queue_patblt(8, 8, 8, 8, PATCOPY, brush);
+    submit(hdc, 1000, queue_used);
+    gdi_batch_flush(&table, &screen, TEB_VA);
+    oracle_patblt(ref, 0, 0, 8, 8, PATCOPY, brush);
+    oracle_patblt(ref, 8, 8, 8, 8, PATCOPY, brush);
+    CHECK(same_pixels(), "count past the records");
+    CHECK(queue_is_reset(), "reset after a count past the records");
+
+    /* A short count leaves the rest unrun */
+    clear_surfaces();
+    submit(hdc, 1, queue_used);
+    gdi_batch_flush(&table, &screen, TEB_VA);
+    oracle_patblt(ref, 0, 0, 8, 8, PATCOPY, brush);
+    CHECK(same_pixels(), "short count runs only the first record");
+    CHECK(queue_is_reset(), "reset after a short count");
+
+    /* An offset that cuts a record off drops that record */
+    clear_surfaces();
+    submit(hdc, 2, queue_used - 4);
+    gdi_batch_flush(&table, &screen, TEB_VA);
+    oracle_patblt(ref, 0, 0, 8, 8, PATCOPY, brush);
+    CHECK(same_pixels(), "truncated record not run");
+
+    /* Zero, negative and oversized sizes stop the drain */
+    static const int16_t bad_sizes[] = { 0, 2, -4, 0x7FF0 };
+    for (unsigned i = 0; i < sizeof(bad_sizes) / sizeof(bad_sizes[0]); i++) {
+        clear_surfaces();
+        queue_reset();
+        queue_patblt(0, 0, 8, 8, PATCOPY, brush);
+        gdi_batch_hdr_t bad = { bad_sizes[i], GdiBCPatBlt };
+        queue_raw(&bad, sizeof(bad));
+        queue_patblt(20, 20, 8, 8, PATCOPY, brush);
+        submit(hdc, queue_count, queue_used);
+        gdi_batch_flush(&table, &screen, TEB_VA);
+        oracle_patblt(ref, 0, 0, 8, 8, PATCOPY, brush);
+        CHECK(same_pixels(), "bad record size stops the drain");
+        CHECK(queue_is_reset(), "reset after a bad record size");
+    }
+
+    /* A record too small for its command is skipped */
+    clear_surfaces();
+    queue_reset();
+    gdi_batch_patblt_t small;
+    memset(&small, 0, sizeof(small));
+    small.hdr.size = 12;
+    small.hdr.cmd = GdiBCPatBlt;
+    queue_raw(&small, 12);
+    queue_patblt(4, 4, 8, 8, PATCOPY, brush);
+    submit(hdc, queue_count, queue_used);
+    gdi_batch_flush(&table, &screen, TEB_VA);
+    oracle_patblt(ref, 4, 4, 8, 8, PATCOPY, brush);
+    CHECK(same_pixels(), "short record skipped");
+
+    /* No DC: drawing records are dropped, the queue still resets */
+    clear_surfaces();
+    queue_reset();
+    queue_patblt(0, 0, 8, 8, PATCOPY, brush);
+    submit(0, queue_count, queue_used);
+    gdi_batch_flush(&table, &screen, TEB_VA);
+    CHECK(all_zero() && !screen.dirty, "no DC, nothing drawn");
+    CHECK(queue_is_reset(), "reset without a DC");
+
+    gdi_delete_object(&table, brush);
+    gdi_delete_dc(&table, hdc);
+    gdi_delete_dc(&table, odc);
+}
+
+/* Unknown commands and odd-sized records are stepped over */
+static void test_unknown(void)
+{
+    uint32_t hdc = gdi_create_display_dc(&table, &screen);
+    uint32_t odc = gdi_create_display_dc(&table, &oracle);
+    gdi_dc_t *ref = gdi_get_dc(&table, odc);
+    uint32_t brush = gdi_create_solid_brush(&table, RGB(10, 200, 30));
+
+    clear_surfaces();
+    queue_reset();
+    queue_unknown(8);
+    queue_patblt(0, 0, 8, 8, PATCOPY, brush);
+    queue_unknown(6);                           /* Leaves the next record unaligned */
+    queue_patblt(16, 0, 8, 8, PATCOPY, brush);
+    queue_unknown(4);
+    queue_patblt(32, 0, 8, 8, PATCOPY, brush);
+    submit(hdc, queue_count, queue_used);
+    gdi_batch_flush(&table, &screen, TEB_VA);
+
+    oracle_patblt(ref, 0, 0, 8, 8, PATCOPY, brush);
+    oracle_patblt(ref, 16, 0, 8, 8, PATCOPY, brush);
+    oracle_patblt(ref, 32, 0, 8, 8, PATCOPY, brush);
+    CHECK(same_pixels(), "records around unknown commands run, realigned");
+    CHECK(queue_is_reset(), "reset after unknown commands");
+
+    gdi_delete_object(&table, brush);
+    gdi_delete_dc(&table, hdc);
+    gdi_delete_dc(&table, odc);
+}
+
+/* A queue filled to the last byte, and an offset past the buffer */
+static void test_full(void)
+{
+    uint32_t hdc = gdi_create_display_dc(&table, &screen);
+    uint32_t odc = gdi_create_display_dc(&table, &oracle);
+    gdi_dc_t *ref = gdi_get_dc(&table, odc);
+    uint32_t brush = gdi_create_solid_brush(&table, RGB(90, 90, 250));
+
+    /* PatBlts until the last one ends exactly at the end of the buffer */
+    clear_surfaces();
+    queue_reset();
+    uint32_t patblt = sizeof(gdi_batch_patblt_t);
+    uint32_t fits = sizeof(queue) / patblt;
+    uint32_t pad = sizeof(queue) - fits * patblt;
+    if (pad >= sizeof(gdi_batch_hdr_t)) {
+        queue_unknown(pad);
+    }
+    for (uint32_t i = 0; i < fits; i++) {
+        queue_patblt((int)(i % 16) * 4, (int)(i / 16) * 4, 3, 3, PATCOPY, brush);
+        oracle_patblt(ref, (int)(i % 16) * 4, (int)(i / 16) * 4, 3, 3, PATCOPY, brush);
+    }
+    CHECK(queue_used == sizeof(queue), "queue filled to the last byte");
+    submit(hdc, queue_count, queue_used);
+    gdi_batch_flush(&table, &screen, TEB_VA);
+    CHECK(same_pixels(), "full queue runs every record");
+    CHECK(queue_is_reset(), "reset after a full queue");
+
+    /* An offset past the buffer is clamped to it */
+    clear_surfaces();
+    submit(hdc, queue_count, 0x10000);
+    gdi_batch_flush(&table, &screen, TEB_VA);
+    memset(oracle_px, 0, sizeof(oracle_px));
+    for (uint32_t i = 0; i < fits; i++) {
+        oracle_patblt(ref, (int)(i % 16) * 4, (int)(i / 16) * 4, 3, 3, PATCOPY, brush);
+    }
+    CHECK(same_pixels(), "oversized offset clamped to the buffer");
+    CHECK(queue_is_reset(), "reset after an oversized offset");
+
+    gdi_delete_object(&table, brush);
+    gdi_delete_dc(&table, hdc);
+    gdi_delete_dc(&table, odc);
+}
+
+/* A batch that deletes its own DC drops the records after it */
+static void test_delete_dc(void)
+{
+    uint32_t hdc = gdi_create_display_dc(&table, &screen);
+    uint32_t brush = gdi_create_solid_brush(&table, RGB(255, 255, 0));
+
+    clear_surfaces();
+    queue_reset();
+    queue_object(GdiBCDelObj, hdc);
+    queue_patblt(0, 0, 8, 8, PATCOPY, brush);
+    queue_object(GdiBCSelObj, brush);
+    submit(hdc, queue_count, queue_used);
+    gdi_batch_flush(&table, &screen, TEB_VA);
+
+    CHECK(gdi_get_dc(&table, hdc) == NULL, "batch DC deleted");
+    CHECK(all_zero() && !screen.dirty, "nothing drawn after the DC is gone");
+    CHECK(queue_is_reset(), "reset after deleting the DC");
+
+    gdi_delete_object(&table, brush);
+}
+
+int main(void)
+{
+    if (gdi_handle_table_init(&table) < 0) {
+        fprintf(stderr, "handle table init failed\n");
+        return 1;
+    }
+
+    test_mixed();
+    test_malformed();
+    test_unknown();
+    test_full();
+    test_delete_dc();
+
+    gdi_handle_table_shutdown(&table);
+    return test_finish();
+}
@@ -0,0 +1,210 @@
+/*
+ * GDI handle table churn benchmark
+ *
+ * Creates and deletes brushes and pens the way CreateSolidBrush, CreatePen
+ * and DeleteObject do (pool object plus handle), with a steady population
+ * of live objects: once just below the object pools' size, where scanning
+ * the pools was slowest, and once close to the old fixed handle table
+ * size. Also checks pool slot reuse, that stale handles are rejected,
+ * that the table grows past its initial size, and that the guest-visible
+ * shared entries track the live handles.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "gdi/gdi_handle_table.h"
+#include "test_util.h"
+
+#define LIVE_HANDLES    3900
+#define CHURN_CYCLES    2000000
+#define GROW_HANDLES    20000
+#define POOL_LIVE       300         /* Brushes and pens, just below the pools' size */
+
+static gdi_handle_table_t table;
+static gdi_shared_handle_entry_t shared[GDI_MAX_SHARED_HANDLES];
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void check_shared_entry(uint32_t handle)
+{
+    const gdi_shared_handle_entry_t *entry = &shared[GDI_HANDLE_INDEX(handle)];
+    CHECK(entry->wUpper == (uint16_t)(handle >> 16), "shared wUpper matches handle");
+    CHECK(entry->wType == GDI_HANDLE_TYPE(handle), "shared wType matches handle");
+}
+
+/* CreateSolidBrush / CreatePen: pool object first, then its handle */
+static uint32_t create_object(uint8_t type, uint32_t color)
+{
+    void *object;
+    if (type == GDI_OBJ_PEN) {
+        gdi_pen_t *pen = gdi_alloc_pen(&table);
+        pen->color = color;
+        object = pen;
+    } else {
+        gdi_brush_t *brush = gdi_alloc_brush(&table);
+        brush->color = color;
+        object = brush;
+    }
+    return gdi_alloc_handle(&table, object, type);
+}
+
+/* DeleteObject: release the handle, then the object */
+static bool delete_object(uint32_t handle)
+{
+    uint8_t type;
+    void *object = gdi_get_object_any(&table, handle, &type);
+    if (!object || !gdi_free_handle(&table, handle)) {
+        return false;
+    }
+    if (type == GDI_OBJ_PEN) {
+        gdi_free_pen(&table, object);
+    } else {
+        gdi_free_brush(&table, object);
+    }
+    return true;
+}
+
+/* Churn brushes and pens with live_count objects kept alive */
+static void bench_churn(int live_count)
+{
+    static uint32_t live[LIVE_HANDLES];
+
+    for (int i = 0; i < live_count; i++) {
+        live[i] = create_object((i & 1) ? GDI_OBJ_PEN : GDI_OBJ_BRUSH, (uint32_t)i);
+        CHECK(live[i] != 0, "populate");
+    }
+
+    uint32_t seed = 12345;
+    double start = now_sec();
+    for (int i = 0; i < CHURN_CYCLES; i++) {
+        seed = seed * 1103515245 + 12345;
+        int slot = (seed >> 8) % live_count;
+        uint8_t type = (slot & 1) ? GDI_OBJ_PEN : GDI_OBJ_BRUSH;
+
+        delete_object(live[slot]);
+        live[slot] = create_object(type, (uint32_t)slot);
+    }
+    double elapsed = now_sec() - start;
+
+    printf("churn: %d create/delete cycles with %d live brushes and pens: %.3f s (%.1f ns/cycle)\n",
+           CHURN_CYCLES, live_count, elapsed, elapsed * 1e9 / CHURN_CYCLES);
+
+    for (int i = 0; i < live_count; i++) {
+        uint8_t type;
+        void *object = gdi_get_object_any(&table, live[i], &type);
+        CHECK(object != NULL, "live handle resolves");
+        CHECK(type == ((i & 1) ? GDI_OBJ_PEN : GDI_OBJ_BRUSH), "live handle type");
+        CHECK(object && (type == GDI_OBJ_PEN ? ((gdi_pen_t *)object)->color :
+                         ((gdi_brush_t *)object)->color) == (uint32_t)i, "live object intact");
+        check_shared_entry(live[i]);
+        CHECK(delete_object(live[i]), "delete");
+    }
+}
+
+/* Freed pool slots are handed out again, each only once */
+static void test_pool_reuse(void)
+{
+    static gdi_brush_t *brushes[LIVE_HANDLES];
+    int count = table.brush_pool_size + 2;
+    for (int i = 0; i < count; i++) {
+        brushes[i] = gdi_alloc_brush(&table);
+        CHECK(brushes[i] != NULL, "allocate brush");
+    }
+    CHECK(brushes[0] >= table.brush_pool &&
+          brushes[0] < table.brush_pool + table.brush_pool_size, "pool used first");
+    CHECK(brushes[count - 1] < table.brush_pool ||
+          brushes[count - 1] >= table.brush_pool + table.brush_pool_size,
+          "heap once the pool is full");
+
+    gdi_brush_t *freed = brushes[17];
+    brushes[17]->color = 0x123456;
+    gdi_free_brush(&table, freed);
+    gdi_free_brush(&table, freed);      /* Double free must not list it twice */
+    brushes[17] = gdi_alloc_brush(&table);
+    CHECK(brushes[17] == freed && freed->color == 0, "freed slot reused, cleared");
+    gdi_brush_t *next = gdi_alloc_brush(&table);
+    CHECK(next < table.brush_pool || next >= table.brush_pool + table.brush_pool_size,
+          "slot not handed out twice");
+    gdi_free_brush(&table, next);
+
+    for (int i = 0; i < count; i++) {
+        gdi_free_brush(&table, brushes[i]);
+    }
+    CHECK(table.brush_free.count == table.brush_pool_size, "all slots free again");
+}
+
+static void test_stale_handles(void)
+{
+    int object;
+    uint32_t h = gdi_alloc_handle(&table, &object, GDI_OBJ_PEN);
+    CHECK(gdi_get_object(&table, h, GDI_OBJ_PEN) == &object, "fresh handle resolves");
+    CHECK(gdi_get_object(&table, h, GDI_OBJ_BRUSH) == NULL, "wrong type rejected");
+
+    CHECK(gdi_free_handle(&table, h), "free");
+    CHECK(!gdi_free_handle(&table, h), "double free rejected");
+    CHECK(gdi_get_object(&table, h, GDI_OBJ_PEN) == NULL, "freed handle rejected");
+    CHECK(!gdi_handle_is_valid(&table, h), "freed handle invalid");
+
+    /* Cycle the same slot until it comes back: the old handle must stay dead */
+    uint32_t index = GDI_HANDLE_INDEX(h);
+    for (int i = 0; i < table.capacity * 2; i++) {
+        uint32_t h2 = gdi_alloc_handle(&table, &object, GDI_OBJ_PEN);
+        bool same_slot = GDI_HANDLE_INDEX(h2) == index;
+        CHECK(!same_slot || h2 != h, "reused slot gets a new handle");
+        CHECK(gdi_get_object(&table, h, GDI_OBJ_PEN) == NULL, "stale handle stays dead");
+        gdi_free_handle(&table, h2);
+        if (same_slot) break;
+    }
+}
+
+static void test_growth(void)
+{
+    static uint32_t handles[GROW_HANDLES];
+    static int objects[GROW_HANDLES];
+    int initial = table.capacity;
+
+    for (int i = 0; i < GROW_HANDLES; i++) {
+        handles[i] = gdi_alloc_handle(&table, &objects[i], GDI_OBJ_REGION);
+        CHECK(handles[i] != 0, "allocate past initial size");
+    }
+    CHECK(table.capacity > initial, "table grew");
+
+    for (int i = 0; i < GROW_HANDLES; i++) {
+        CHECK(gdi_get_object(&table, handles[i], GDI_OBJ_REGION) == &objects[i], "grown handle resolves");
+        check_shared_entry(handles[i]);
+    }
+    for (int i = 0; i < GROW_HANDLES; i++) {
+        CHECK(gdi_free_handle(&table, handles[i]), "free grown handle");
+    }
+
+    printf("growth: %d handles live, table capacity %d -> %d\n", GROW_HANDLES, initial, table.capacity);
+}
+
+int main(void)
+{
+    if (gdi_handle_table_init(&table) < 0) {
+        fprintf(stderr, "FAIL: gdi_handle_table_init\n");
+        return 1;
+    }
+    gdi_set_shared_table(&table, shared, GDI_SHARED_TABLE_ADDR);
+
+    bench_churn(POOL_LIVE);
+    bench_churn(LIVE_HANDLES);
+    test_pool_reuse();
+    test_stale_handles();
+    test_growth();
+
+    CHECK(table.handle_count == 1, "all handles released");
+
+    gdi_handle_table_shutdown(&table);
+
+    return test_finish();
+}
@@ -0,0 +1,256 @@
+/*
+ * GDI region engine tests
+ *
+ * Checks union, intersection, difference and XOR against a bitmap of the
+ * covered pixels, for hand-picked cases that used to break band coalescing
+ * and for random regions. Every result must also be in canonical form:
+ * sorted bands, no touching rectangles within a band, no two touching
+ * bands with the same x-extents, and correct bounds.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "gdi/gdi_region.h"
+#include "test_util.h"
+
+#define GRID            48
+#define RANDOM_CASES    4000
+
+typedef struct {
+    bool px[GRID][GRID];        /* [y][x] */
+} bitmap_t;
+
+static void rasterize(const gdi_region_t *rgn, bitmap_t *bm)
+{
+    memset(bm, 0, sizeof(*bm));
+    for (int i = 0; i < rgn->rect_count; i++) {
+        const RECT *r = &rgn->rects[i];
+        for (int y = r->top; y < r->bottom; y++) {
+            for (int x = r->left; x < r->right; x++) {
+                bm->px[y][x] = true;
+            }
+        }
+    }
+}
+
+static bool combine_px(bool a, bool b, int mode)
+{
+    switch (mode) {
+        case RGN_AND:  return a && b;
+        case RGN_OR:   return a || b;
+        case RGN_XOR:  return a != b;
+        case RGN_DIFF: return a && !b;
+        default:       return a;
+    }
+}
+
+/* Structural invariants of a banded region; returns false on the first violation */
+static bool is_canonical(const gdi_region_t *rgn)
+{
+    const RECT *r = rgn->rects;
+    int n = rgn->rect_count;
+    if (n == 0) {
+        return rgn->bounds.left == 0 && rgn->bounds.top == 0 &&
+               rgn->bounds.right == 0 && rgn->bounds.bottom == 0;
+    }
+
+    RECT ext = r[0];
+    for (int i = 0; i < n; i++) {
+        if (r[i].left >= r[i].right || r[i].top >= r[i].bottom) return false;
+        if (r[i].left < ext.left) ext.left = r[i].left;
+        if (r[i].right > ext.right) ext.right = r[i].right;
+        if (r[i].bottom > ext.bottom) ext.bottom = r[i].bottom;
+    }
+
+    int prev = -1, prev_count = 0;
+    for (int band = 0; band < n; ) {
+        /* Same band: same bottom, sorted by x, separated */
+        int end = band + 1;
+        while (end < n && r[end].top == r[band].top) {
+            if (r[end].bottom != r[band].bottom) return false;
+            if (r[end].left <= r[end - 1].right) return false;
+            end++;
+        }
+        int count = end - band;
+
+        if (prev >= 0) {
+            /* Bands go down, and touching ones must differ in x */
+            if (r[band].top < r[prev].bottom) return false;
+            if (r[band].top == r[prev].bottom && count == prev_count) {
+                bool same = true;
+                for (int k = 0; k < count; k++) {
+                    if (r[prev + k].left != r[band + k].left ||
+                        r[prev + k].right != r[band + k].right) {
+                        same = false;
+                        break;
+                    }
+                }
+                if (same) return false;
+            }
+        }
+        prev = band;
+        prev_count = count;
+        band = end;
+    }
+
+    return memcmp(&ext, &rgn->bounds, sizeof(RECT)) == 0;
+}
+
+static void set_rects(gdi_region_t *rgn, const RECT *rects, int count)
+{
+    gdi_region_set_empty(rgn);
+    for (int i = 0; i < count; i++) {
+        gdi_region_union_rect(rgn, &rects[i]);
+    }
+}
+
+/* Run one combine mode and compare it pixel by pixel with the oracle */
+static bool check_op(const gdi_region_t *a, const gdi_region_t *b, int mode)
+{
+    bitmap_t ba, bb, out;
+    rasterize(a, &ba);
+    rasterize(b, &bb);
+
+    gdi_region_t dst;
+    gdi_region_init(&dst);
+    int kind = gdi_region_combine(&dst, a, b, mode);
+    rasterize(&dst, &out);
+
+    bool ok = kind != RGN_ERROR && is_canonical(&dst);
+    for (int y = 0; ok && y < GRID; y++) {
+        for (int x = 0; x < GRID; x++) {
+            bool expect = combine_px(ba.px[y][x], bb.px[y][x], mode);
+            if (out.px[y][x] != expect || gdi_region_pt_in(&dst, x, y) != expect) {
+                ok = false;
+                break;
+            }
+        }
+    }
+    gdi_region_cleanup(&dst);
+    return ok;
+}
+
+static bool check_all_ops(const gdi_region_t *a, const gdi_region_t *b)
+{
+    return check_op(a, b, RGN_OR) && check_op(a, b, RGN_AND) &&
+           check_op(a, b, RGN_DIFF) && check_op(b, a, RGN_DIFF) &&
+           check_op(a, b, RGN_XOR);
+}
+
+static void test_tail_bands(void)
+{
+    /* One band on the left, two trailing bands on the right */
+    static const RECT ra[] = { { 0, 0, 10, 10 }, { 20, 0, 30, 10 } };
+    static const RECT rb[] = { { 0, 10, 10, 20 }, { 20, 30, 30, 40 } };
+    gdi_region_t a, b, u;
+    gdi_region_init(&a);
+    gdi_region_init(&b);
+    gdi_region_init(&u);
+    set_rects(&a, ra, 2);
+    set_rects(&b, rb, 2);
+
+    CHECK(gdi_region_union(&u, &a, &b), "union");
+    CHECK(!gdi_region_pt_in(&u, 25, 15), "gap between bands stays empty");
+    CHECK(gdi_region_pt_in(&u, 25, 35), "trailing band kept");
+    CHECK(u.rect_count == 4 && is_canonical(&u), "bands coalesced correctly");
+    CHECK(check_all_ops(&a, &b), "all operations");
+
+    gdi_region_cleanup(&a);
+    gdi_region_cleanup(&b);
+    gdi_region_cleanup(&u);
+}
+
+static void test_subtract_coalesce(void)
+{
+    /* Removing the right part of two stacked bands leaves one rectangle */
+    static const RECT ra[] = { { 0, 0, 1, 10 }, { 0, 10, 3, 13 } };
+    static const RECT rb[] = { { 1, 10, 3, 13 } };
+    gdi_region_t a, b, d, expect;
+    gdi_region_init(&a);
+    gdi_region_init(&b);
+    gdi_region_init(&d);
+    gdi_region_init(&expect);
+    set_rects(&a, ra, 2);
+    set_rects(&b, rb, 1);
+    gdi_region_set_rect(&expect, 0, 0, 1, 13);
+
+    CHECK(gdi_region_subtract(&d, &a, &b), "subtract");
+    CHECK(gdi_region_equal(&d, &expect), "difference coalesced");
+    CHECK(check_all_ops(&a, &b), "all operations");
+
+    /* XOR of two overlapping frames is the same shape built either way */
+    gdi_region_set_rect(&a, 2, 2, 20, 20);
+    gdi_region_set_rect(&b, 6, 6, 26, 14);
+    CHECK(gdi_region_xor(&d, &a, &b), "xor");
+    CHECK(gdi_region_xor(&expect, &b, &a), "xor reversed");
+    CHECK(gdi_region_equal(&d, &expect), "xor is canonical");
+    CHECK(check_all_ops(&a, &b), "xor operations");
+
+    gdi_region_cleanup(&a);
+    gdi_region_cleanup(&b);
+    gdi_region_cleanup(&d);
+    gdi_region_cleanup(&expect);
+}
+
+static void random_region(gdi_region_t *rgn)
+{
+    gdi_region_set_empty(rgn);
+    int count = rand() % 6;
+    for (int i = 0; i < count; i++) {
+        RECT r;
+        r.left = rand() % GRID;
+        r.top = rand() % GRID;
+        r.right = r.left + 1 + rand() % (GRID - r.left);
+        r.bottom = r.top + 1 + rand() % (GRID - r.top);
+        if (rand() % 4 == 0) {
+            gdi_region_subtract_rect(rgn, &r);
+        } else {
+            gdi_region_union_rect(rgn, &r);
+        }
+    }
+}
+
+static void test_random(void)
+{
+    gdi_region_t a, b, alias;
+    gdi_region_init(&a);
+    gdi_region_init(&b);
+    gdi_region_init(&alias);
+    srand(12345);
+
+    int bad = 0;
+    for (int i = 0; i < RANDOM_CASES; i++) {
+        random_region(&a);
+        random_region(&b);
+        if (!is_canonical(&a) || !is_canonical(&b) || !check_all_ops(&a, &b)) {
+            bad++;
+        }
+
+        /* Results written over a source must match fresh ones */
+        gdi_region_t fresh;
+        gdi_region_init(&fresh);
+        gdi_region_copy(&alias, &a);
+        gdi_region_union(&fresh, &a, &b);
+        gdi_region_union(&alias, &alias, &b);
+        if (!gdi_region_equal(&fresh, &alias)) {
+            bad++;
+        }
+        gdi_region_cleanup(&fresh);
+    }
+    CHECK(bad == 0, "random regions match the bitmap oracle");
+
+    gdi_region_cleanup(&a);
+    gdi_region_cleanup(&b);
+    gdi_region_cleanup(&alias);
+}
+
+int main(void)
+{
+    test_tail_bands();
+    test_subtract_coalesce();
+    test_random();
+
+    return test_finish();
+}
@@ -0,0 +1,482 @@
+/*
+ * GDI shape fill tests
+ *
+ * Pixel-exact checks of the filled shape rasteriser on a fake display:
+ * small ellipses against golden bitmaps and larger ones for symmetry and
+ * convex rows; pie and chord fills (and wide-pen arcs) against the ellipse
+ * fill masked by a per-pixel sector or chord-side test; polygons under
+ * ALTERNATE and WINDING against a per-pixel crossing count, including
+ * self-intersecting and multi-contour ones.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "gdi/gdi_dc.h"
+#include "gdi/gdi_drawing.h"
+#include "test_util.h"
+
+#define SCREEN_W        64
+#define SCREEN_H        48
+#define RANDOM_ARCS     3000
+#define RANDOM_POLYS    2000
+
+/*
+ * Surface
+ */
+
+static gdi_handle_table_t table;
+static uint32_t screen_px[SCREEN_W * SCREEN_H];
+static display_context_t screen = { .pixels = screen_px, .width = SCREEN_W,
+                                    .height = SCREEN_H, .pitch = SCREEN_W * 4 };
+static uint32_t hdc;
+static gdi_dc_t *dc;
+
+typedef uint8_t mask_t[SCREEN_H][SCREEN_W];
+
+static void clear(void)
+{
+    memset(screen_px, 0, sizeof(screen_px));
+}
+
+static void grab(mask_t out)
+{
+    for (int y = 0; y < SCREEN_H; y++) {
+        for (int x = 0; x < SCREEN_W; x++) {
+            out[y][x] = screen_px[y * SCREEN_W + x] != 0;
+        }
+    }
+}
+
+static void dump(const char *what, mask_t got, mask_t want)
+{
+    fprintf(stderr, "%s: got (#) / want (o), x marks both\n", what);
+    for (int y = 0; y < SCREEN_H; y++) {
+        for (int x = 0; x < SCREEN_W; x++) {
+            fputc(got[y][x] ? (want[y][x] ? 'x' : '#') : (want[y][x] ? 'o' : '.'), stderr);
+        }
+        fputc('\n', stderr);
+    }
+}
+
+static uint32_t seed = 1;
+
+static int rnd(int lo, int hi)
+{
+    seed = seed * 1103515245 + 12345;
+    return lo + (int)((seed >> 8) % (uint32_t)(hi - lo + 1));
+}
+
+/*
+ * Oracles
+ */
+
+static int64_t cross(int64_t ax, int64_t ay, int64_t bx, int64_t by)
+{
+    return ax * by - ay * bx;
+}
+
+static uint64_t isqrt(uint64_t v)
+{
+    uint64_t r = 0;
+    while ((r + 1) * (r + 1) <= v) r++;
+    return r;
+}
+
+/*
+ * Arc geometry as GDI defines it: doubled coordinates, y up, centre of
+ * the inclusive box, radials from the centre through the given points
+ */
+typedef struct {
+    int64_t cx, cy, sx, sy, ex, ey;
+    bool full;
+    int start_x, start_y, end_x, end_y;
+} arc_t;
+
+static void radial_point(const arc_t *a, int64_t dx, int64_t dy, int64_t ra, int64_t rb,
+                         int *x, int *y)
+{
+    while (dx > 0x7FFF || dx < -0x7FFF || dy > 0x7FFF || dy < -0x7FFF) {
+        dx /= 2;
+        dy /= 2;
+    }
+    if (dx == 0 && dy == 0) dx = 1;
+    uint64_t den = isqrt((uint64_t)(rb * rb * dx * dx) + (uint64_t)(ra * ra * dy * dy));
+    if (den == 0) den = 1;
+    *x = (int)((a->cx + dx * ra * rb / (int64_t)den + 1) >> 1);
+    *y = (int)((a->cy - dy * ra * rb / (int64_t)den + 1) >> 1);
+}
+
+static void arc_setup(arc_t *a, int l, int t, int r, int b, int xs, int ys, int xe, int ye)
+{
+    int w = r - l;
+    int h = b - t;
+    a->cx = 2 * (int64_t)l + (w - 1);
+    a->cy = 2 * (int64_t)t + (h - 1);
+    a->sx = 2 * (int64_t)xs - a->cx;
+    a->sy = a->cy - 2 * (int64_t)ys;
+    a->ex = 2 * (int64_t)xe - a->cx;
+    a->ey = a->cy - 2 * (int64_t)ye;
+    a->full = cross(a->sx, a->sy, a->ex, a->ey) == 0 && a->sx * a->ex + a->sy * a->ey > 0;
+    radial_point(a, a->sx, a->sy, w - 1, h - 1, &a->start_x, &a->start_y);
+    radial_point(a, a->ex, a->ey, w - 1, h - 1, &a->end_x, &a->end_y);
+}
+
+/* Counterclockwise from the start radial to the end radial */
+static bool in_sweep(const arc_t *a, int x, int y)
+{
+    if (a->full) return true;
+    int64_t vx = 2 * (int64_t)x - a->cx;
+    int64_t vy = a->cy - 2 * (int64_t)y;
+    int64_t se = cross(a->sx, a->sy, a->ex, a->ey);
+    if (se > 0) {
+        return cross(a->sx, a->sy, vx, vy) >= 0 && cross(vx, vy, a->ex, a->ey) >= 0;
+    }
+    if (se < 0) {
+        return !(cross(a->ex, a->ey, vx, vy) > 0 && cross(vx, vy, a->sx, a->sy) > 0);
+    }
+    return cross(a->sx, a->sy, vx, vy) >= 0;
+}
+
+/* The side of the chord from start to end that the arc sweeps through */
+static bool in_chord(const arc_t *a, int x, int y)
+{
+    if (a->full) return true;
+    int64_t dx = 2 * (int64_t)(a->end_x - a->start_x);
+    int64_t dy = 2 * (int64_t)(a->start_y - a->end_y);
+    int64_t vx = 2 * (int64_t)(x - a->start_x);
+    int64_t vy = 2 * (int64_t)(a->start_y - y);
+    return cross(dx, dy, vx, vy) <= 0;
+}
+
+/*
+ * Polygon coverage of the pixel at (x, y): edges crossing the scanline
+ * at or left of x, counted half-open in y
+ */
+static bool in_polygons(const POINT *pts, const int *counts, int num_polys, bool winding,
+                        int x, int y)
+{
+    int crossings = 0;
+    int wind = 0;
+    for (int i = 0; i < num_polys; pts += counts[i], i++) {
+        for (int j = 0; j < counts[i]; j++) {
+            const POINT *p = &pts[j];
+            const POINT *q = &pts[(j + 1) % counts[i]];
+            if (p->y == q->y) continue;
+            const POINT *top = p->y < q->y ? p : q;
+            const POINT *bottom = p->y < q->y ? q : p;
+            if (y < top->y || y >= bottom->y) continue;
+
+            int64_t dy = bottom->y - top->y;
+            int64_t ex = (int64_t)top->x * dy + (int64_t)(bottom->x - top->x) * (y - top->y);
+            if (ex <= (int64_t)x * dy) {
+                crossings++;
+                wind += p->y < q->y ? 1 : -1;
+            }
+        }
+    }
+    return winding ? wind != 0 : (crossings & 1) != 0;
+}
+
+/*
+ * Tests
+ */
+
+static void use_pen(uint32_t hpen)
+{
+    gdi_select_object(&table, hdc, hpen);
+}
+
+static void use_brush(uint32_t hbrush)
+{
+    gdi_select_object(&table, hdc, hbrush);
+}
+
+/* Small ellipses are exactly the midpoint rasterisation */
+static void test_ellipse_golden(void)
+{
+    static const struct {
+        int w, h;
+        const char *rows;
+    } cases[] = {
+        { 1, 1, "#" },
+        { 2, 2, "##" "##" },
+        { 3, 3, ".#." "###" ".#." },
+        { 4, 4, ".##." "####" "####" ".##." },
+        { 5, 5, ".###." "#####" "#####" "#####" ".###." },
+        { 7, 4, ".#####." "#######" "#######" ".#####." },
+        { 20, 3, "..################.." "####################" "..################.." },
+        { 3, 6, ".#." "###" "###" "###" "###" ".#." },
+        { 8, 8, "..####.." ".######." "########" "########"
+                "########" "########" ".######." "..####.." },
+        { 9, 7, "..#####.." ".#######." "#########" "#########"
+                "#########" ".#######." "..#####.." },
+    };
+
+    use_pen(table.stock_handles[GDI_STOCK_NULL_PEN]);
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        int w = cases[i].w;
+        int h = cases[i].h;
+        clear();
+        gdi_ellipse(dc, 10, 5, 10 + w, 5 + h);
+
+        bool ok = true;
+        for (int y = 0; y < SCREEN_H; y++) {
+            for (int x = 0; x < SCREEN_W; x++) {
+                bool in_box = x >= 10 && x < 10 + w && y >= 5 && y < 5 + h;
+                bool want = in_box && cases[i].rows[(y - 5) * w + (x - 10)] == '#';
+                ok &= (screen_px[y * SCREEN_W + x] != 0) == want;
+            }
+        }
+        if (!ok) {
+            fprintf(stderr, "ellipse %dx%d:\n", w, h);
+            for (int y = 5; y < 5 + h; y++) {
+                for (int x = 10; x < 10 + w; x++) {
+                    fputc(screen_px[y * SCREEN_W + x] ? '#' : '.', stderr);
+                }
+                fputc('\n', stderr);
+            }
+        }
+        CHECK(ok, "ellipse matches its golden bitmap");
+    }
+}
+
+/* Larger ellipses: symmetric, one run per row, widest in the middle, box-tight */
+static void test_ellipse_shape(void)
+{
+    static mask_t got;
+    int bad_symmetry = 0, bad_rows = 0, bad_box = 0;
+
+    use_pen(table.stock_handles[GDI_STOCK_NULL_PEN]);
+    for (int w = 1; w <= 40; w++) {
+        for (int h = 1; h <= 40; h += (w % 5) + 1) {
+            clear();
+            gdi_ellipse(dc, 2, 3, 2 + w, 3 + h);
+            grab(got);
+
+            int prev_width = 0;
+            bool touches_left = false, touches_right = false;
+            for (int y = 0; y < SCREEN_H; y++) {
+                int first = -1, last = -1, count = 0;
+                for (int x = 0; x < SCREEN_W; x++) {
+                    if (!got[y][x]) continue;
+                    if (first < 0) first = x;
+                    last = x;
+                    count++;
+                    bool in_box = x >= 2 && x < 2 + w && y >= 3 && y < 3 + h;
+                    if (!in_box) {
+                        bad_box++;
+                        continue;
+                    }
+                    bad_symmetry += !got[y][2 + w - 1 - (x - 2)] || !got[3 + h - 1 - (y - 3)][x];
+                }
+                if (y < 3 || y >= 3 + h) continue;
+
+                bad_rows += count == 0 || last - first + 1 != count;
+                int width = count;
+                if (y - 3 <= (h - 1) / 2) {
+                    bad_rows += width < prev_width;
+                }
+                prev_width = width;
+                touches_left |= first == 2;
+                touches_right |= last == 2 + w - 1;
+            }
+            bad_box += !touches_left || !touches_right;
+        }
+    }
+    CHECK(bad_symmetry == 0, "ellipse symmetric about both axes");
+    CHECK(bad_rows == 0, "ellipse rows are single runs widening to the middle");
+    CHECK(bad_box == 0, "ellipse fills exactly its box's extent");
+}
+
+/* Draw the arc kind into got and its oracle into want */
+enum { SHAPE_PIE, SHAPE_CHORD, SHAPE_ARC };
+
+static void arc_case(int kind, int l, int t, int r, int b, int xs, int ys, int xe, int ye,
+                     mask_t got, mask_t want)
+{
+    arc_t a;
+    arc_setup(&a, l, t, r, b, xs, ys, xe, ye);
+
+    clear();
+    if (kind == SHAPE_PIE) {
+        gdi_pie(dc, l, t, r, b, xs, ys, xe, ye);
+    } else if (kind == SHAPE_CHORD) {
+        gdi_chord(dc, l, t, r, b, xs, ys, xe, ye);
+    } else {
+        gdi_arc(dc, l, t, r, b, xs, ys, xe, ye);
+    }
+    grab(got);
+
+    /* The whole ellipse (or the wide pen's ring) with the same tools */
+    clear();
+    gdi_ellipse(dc, l, t, r, b);
+    grab(want);
+
+    for (int y = 0; y < SCREEN_H; y++) {
+        for (int x = 0; x < SCREEN_W; x++) {
+            bool keep = kind == SHAPE_CHORD ? in_chord(&a, x, y) : in_sweep(&a, x, y);
+            want[y][x] &= keep;
+        }
+    }
+}
+
+/* Pie, chord and wide-pen arc against the ellipse masked per pixel */
+static void test_arcs(void)
+{
+    static mask_t got, want;
+    static const char *names[] = { "pie", "chord", "arc" };
+    int mismatches[3] = { 0, 0, 0 };
+
+    uint32_t brush = gdi_create_solid_brush(&table, RGB(255, 255, 255));
+    uint32_t wide = gdi_create_pen(&table, PS_SOLID, 4, RGB(255, 255, 255));
+
+    /* Fixed radials: each quadrant boundary, half turns, full, tiny sweeps */
+    static const int radials[][4] = {
+        { 40, 20, 20, 0 }, { 20, 0, 40, 20 }, { 0, 20, 40, 20 }, { 40, 20, 0, 20 },
+        { 20, 40, 20, 0 }, { 40, 20, 40, 20 }, { 40, 20, 80, 40 }, { 40, 21, 40, 19 },
+        { 40, 19, 40, 21 }, { 0, 0, 40, 40 }, { 40, 40, 0, 0 }, { 21, 20, 19, 20 },
+    };
+    for (int kind = SHAPE_PIE; kind <= SHAPE_ARC; kind++) {
+        /* Arcs are pen only: the ellipse oracle then draws just the ring */
+        use_pen(kind == SHAPE_ARC ? wide : table.stock_handles[GDI_STOCK_NULL_PEN]);
+        use_brush(kind == SHAPE_ARC ? table.stock_handles[GDI_STOCK_NULL_BRUSH] : brush);
+        for (size_t i = 0; i < sizeof(radials) / sizeof(radials[0]); i++) {
+            const int *p = radials[i];
+            arc_case(kind, 4, 2, 37, 39, p[0], p[1], p[2], p[3], got, want);
+            if (memcmp(got, want, sizeof(got)) != 0) {
+                if (mismatches[kind]++ == 0) dump(names[kind], got, want);
+            }
+        }
+
+        for (int i = 0; i < RANDOM_ARCS; i++) {
+            /* Boxes of every parity, some hanging off the surface */
+            int l = rnd(-8, 50);
+            int t = rnd(-8, 40);
+            int r = l + rnd(1, 40);
+            int b = t + rnd(1, 40);
+            int xs = rnd(-30, 90), ys = rnd(-30, 80);
+            int xe = rnd(-30, 90), ye = rnd(-30, 80);
+            if (i % 7 == 0) {
+                /* Radials through the centre's own row or column */
+                ys = (t + b - 1) / 2;
+                xe = (l + r - 1) / 2;
+            }
+            arc_case(kind, l, t, r, b, xs, ys, xe, ye, got, want);
+            if (memcmp(got, want, sizeof(got)) != 0) {
+                if (mismatches[kind]++ == 0) {
+                    fprintf(stderr, "%s (%d,%d)-(%d,%d) from (%d,%d) to (%d,%d)\n",
+                            names[kind], l, t, r, b, xs, ys, xe, ye);
+                    dump(names[kind], got, want);
+                }
+            }
+        }
+    }
+    CHECK(mismatches[SHAPE_PIE] == 0, "pie fill is the ellipse inside the sweep");
+    CHECK(mismatches[SHAPE_CHORD] == 0, "chord fill is the ellipse on the arc's side");
+    CHECK(mismatches[SHAPE_ARC] == 0, "wide arc is the pen ring inside the sweep");
+
+    use_pen(table.stock_handles[GDI_STOCK_NULL_PEN]);
+    use_brush(table.stock_handles[GDI_STOCK_WHITE_BRUSH]);
+    gdi_delete_object(&table, wide);
+    gdi_delete_object(&table, brush);
+}
+
+/* Polygon fills under both rules against the crossing count */
+static void poly_case(const POINT *pts, const int *counts, int num_polys, bool winding,
+                      int *mismatches)
+{
+    static mask_t got, want;
+
+    dc->poly_fill_mode = winding ? WINDING : ALTERNATE;
+    clear();
+    gdi_poly_polygon(dc, pts, counts, num_polys);
+    grab(got);
+
+    for (int y = 0; y < SCREEN_H; y++) {
+        for (int x = 0; x < SCREEN_W; x++) {
+            want[y][x] = in_polygons(pts, counts, num_polys, winding, x, y);
+        }
+    }
+    if (memcmp(got, want, sizeof(got)) != 0 && (*mismatches)++ == 0) {
+        dump(winding ? "winding polygon" : "alternate polygon", got, want);
+    }
+}
+
+static void test_polygons(void)
+{
+    int mismatches[2] = { 0, 0 };
+
+    use_pen(table.stock_handles[GDI_STOCK_NULL_PEN]);
+    use_brush(table.stock_handles[GDI_STOCK_WHITE_BRUSH]);
+
+    /* Pentagram: the centre is a hole under ALTERNATE only */
+    static const POINT star[] = { { 32, 2 }, { 44, 40 }, { 12, 16 }, { 52, 16 }, { 20, 40 } };
+    int star_count = 5;
+    for (int winding = 0; winding <= 1; winding++) {
+        poly_case(star, &star_count, 1, winding, &mismatches[winding]);
+        CHECK((screen_px[24 * SCREEN_W + 32] != 0) == winding, "pentagram centre by fill rule");
+    }
+
+    /* Two nested squares, same and opposite orientation */
+    static const POINT nested[] = {
+        { 4, 4 }, { 40, 4 }, { 40, 40 }, { 4, 40 },
+        { 12, 12 }, { 30, 12 }, { 30, 30 }, { 12, 30 },
+        { 12, 12 }, { 12, 30 }, { 30, 30 }, { 30, 12 },
+    };
+    static const int nested_counts[] = { 4, 4 };
+    for (int winding = 0; winding <= 1; winding++) {
+        poly_case(nested, nested_counts, 2, winding, &mismatches[winding]);
+        CHECK((screen_px[20 * SCREEN_W + 20] != 0) == winding, "same-orientation hole by fill rule");
+        int same_counts[] = { 4, 4 };
+        POINT opposite[8];
+        memcpy(opposite, nested, 4 * sizeof(POINT));
+        memcpy(opposite + 4, nested + 8, 4 * sizeof(POINT));
+        poly_case(opposite, same_counts, 2, winding, &mismatches[winding]);
+        CHECK(screen_px[20 * SCREEN_W + 20] == 0, "opposite-orientation hole under both rules");
+    }
+
+    /* Random contours, self-intersecting and off the surface */
+    POINT pts[16];
+    int counts[3];
+    for (int i = 0; i < RANDOM_POLYS; i++) {
+        int num_polys = rnd(1, 3);
+        int total = 0;
+        for (int p = 0; p < num_polys; p++) {
+            counts[p] = rnd(3, 5);
+            for (int j = 0; j < counts[p]; j++) {
+                pts[total + j].x = rnd(-10, 74);
+                pts[total + j].y = rnd(-10, 58);
+                if (j > 0 && rnd(0, 5) == 0) {
+                    pts[total + j].y = pts[total + j - 1].y;    /* Horizontal edge */
+                }
+            }
+            total += counts[p];
+        }
+        poly_case(pts, counts, num_polys, i & 1, &mismatches[i & 1]);
+    }
+    CHECK(mismatches[0] == 0, "ALTERNATE fill matches the crossing parity");
+    CHECK(mismatches[1] == 0, "WINDING fill matches the winding number");
+    dc->poly_fill_mode = ALTERNATE;
+}
+
+int main(void)
+{
+    gdi_handle_table_init(&table);
+    hdc = gdi_create_display_dc(&table, &screen);
+    dc = gdi_get_dc(&table, hdc);
+    if (!dc) {
+        fprintf(stderr, "no display DC\n");
+        return 1;
+    }
+    use_brush(table.stock_handles[GDI_STOCK_WHITE_BRUSH]);
+
+    test_ellipse_golden();
+    test_ellipse_shape();
+    test_arcs();
+    test_polygons();
+
+    gdi_delete_dc(&table, hdc);
+    return test_finish();
+}
@@ -0,0 +1,336 @@
+/*
+ * GDI StretchBlt tests
+ *
+ * Stretches between fake display surfaces: COLORONCOLOR up- and
+ * down-scales with every mirroring must pick exactly the nearest source
+ * pixel, HALFTONE must stay within rounding of a bilinear reference and
+ * keep flat colours exact, stretching within one surface must read the
+ * source as it was before the call, and ROPs with a pattern must treat a
+ * NULL brush as no pattern.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "gdi/gdi_dc.h"
+#include "gdi/gdi_drawing.h"
+#include "test_util.h"
+
+#define SRC_W           40
+#define SRC_H           30
+#define DST_W           64
+#define DST_H           48
+#define SENTINEL        0xFF123456
+#define ROP_SRCCOPY     0x00CC0020
+#define ROP_MERGECOPY   0x00C000CA      /* src & pat */
+
+/*
+ * Surfaces
+ */
+
+static gdi_handle_table_t table;
+static uint32_t src_px[SRC_W * SRC_H];
+static uint32_t dst_px[DST_W * DST_H];
+static uint32_t ref_px[DST_W * DST_H];
+static uint32_t out_px[DST_W * DST_H];
+static display_context_t src_surface = { .pixels = src_px, .width = SRC_W,
+                                         .height = SRC_H, .pitch = SRC_W * 4 };
+static display_context_t dst_surface = { .pixels = dst_px, .width = DST_W,
+                                         .height = DST_H, .pitch = DST_W * 4 };
+static display_context_t ref_surface = { .pixels = ref_px, .width = DST_W,
+                                         .height = DST_H, .pitch = DST_W * 4 };
+static display_context_t out_surface = { .pixels = out_px, .width = DST_W,
+                                         .height = DST_H, .pitch = DST_W * 4 };
+static uint32_t hdc_src, hdc_dst, hdc_ref, hdc_out;
+static gdi_dc_t *dc_src, *dc_dst, *dc_ref, *dc_out;
+
+/* Every pixel distinct, so a wrong tap is always visible */
+static void fill_unique(uint32_t *px, int w, int h)
+{
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            px[y * w + x] = 0xFF000000 | (uint32_t)(x << 16) | (uint32_t)(y << 8) | (uint32_t)((x * 7 + y) & 0xFF);
+        }
+    }
+}
+
+/* Smooth gradients, so filtering error stays within rounding */
+static void fill_gradient(uint32_t *px, int w, int h)
+{
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            px[y * w + x] = 0xFF000000 | (uint32_t)(x * 6 << 16) | (uint32_t)(y * 8 << 8) | (uint32_t)((x + y) * 3);
+        }
+    }
+}
+
+static void fill_value(uint32_t *px, int count, uint32_t value)
+{
+    for (int i = 0; i < count; i++) {
+        px[i] = value;
+    }
+}
+
+/*
+ * A stretch from the source rectangle onto the destination rectangle,
+ * both with positive extents; mirroring is passed as a negative source
+ * extent, the way callers flip images
+ */
+typedef struct {
+    int dx, dy, dw, dh;
+    int sx, sy, sw, sh;
+    bool mirror_x, mirror_y;
+} stretch_t;
+
+static bool stretch(gdi_dc_t *dst, gdi_dc_t *src, const stretch_t *s, uint32_t rop)
+{
+    int sx = s->mirror_x ? s->sx + s->sw : s->sx;
+    int sy = s->mirror_y ? s->sy + s->sh : s->sy;
+    int sw = s->mirror_x ? -s->sw : s->sw;
+    int sh = s->mirror_y ? -s->sh : s->sh;
+    return gdi_stretch_blt(dst, s->dx, s->dy, s->dw, s->dh, src, sx, sy, sw, sh, rop);
+}
+
+/* Source coordinate for destination offset i, nearest or at pixel centres */
+static int nearest_tap(int i, int dst_len, int src_pos, int src_len, bool mirror)
+{
+    int rel = (int)((int64_t)i * src_len / dst_len);
+    return src_pos + (mirror ? src_len - 1 - rel : rel);
+}
+
+static double centre_tap(int i, int dst_len, int src_len, bool mirror)
+{
+    double p = (i + 0.5) * src_len / dst_len - 0.5;
+    if (p < 0) p = 0;
+    if (p > src_len - 1) p = src_len - 1;
+    return mirror ? src_len - 1 - p : p;
+}
+
+/* Expected COLORONCOLOR result of s over a destination holding before */
+static void nearest_oracle(uint32_t *out, const uint32_t *before, const uint32_t *src,
+                           int src_pitch, const stretch_t *s)
+{
+    memcpy(out, before, sizeof(dst_px));
+    for (int y = s->dy; y < s->dy + s->dh; y++) {
+        for (int x = s->dx; x < s->dx + s->dw; x++) {
+            if (x < 0 || x >= DST_W || y < 0 || y >= DST_H) continue;
+            int tx = nearest_tap(x - s->dx, s->dw, s->sx, s->sw, s->mirror_x);
+            int ty = nearest_tap(y - s->dy, s->dh, s->sy, s->sh, s->mirror_y);
+            out[y * DST_W + x] = src[ty * src_pitch + tx];
+        }
+    }
+}
+
+static int channel_error(uint32_t a, uint32_t b)
+{
+    int worst = 0;
+    for (int shift = 0; shift < 24; shift += 8) {
+        int d = abs((int)((a >> shift) & 0xFF) - (int)((b >> shift) & 0xFF));
+        if (d > worst) worst = d;
+    }
+    return worst;
+}
+
+static uint32_t bilinear(const uint32_t *src, int src_pitch, const stretch_t *s, int x, int y)
+{
+    double px = centre_tap(x - s->dx, s->dw, s->sw, s->mirror_x);
+    double py = centre_tap(y - s->dy, s->dh, s->sh, s->mirror_y);
+    int x0 = (int)px, y0 = (int)py;
+    int x1 = x0 + 1 < s->sw ? x0 + 1 : x0;
+    int y1 = y0 + 1 < s->sh ? y0 + 1 : y0;
+    double fx = px - x0, fy = py - y0;
+
+    const uint32_t *r0 = src + (s->sy + y0) * src_pitch + s->sx;
+    const uint32_t *r1 = src + (s->sy + y1) * src_pitch + s->sx;
+    uint32_t result = 0xFF000000;
+    for (int shift = 0; shift < 24; shift += 8) {
+        double a = (r0[x0] >> shift) & 0xFF, b = (r0[x1] >> shift) & 0xFF;
+        double c = (r1[x0] >> shift) & 0xFF, d = (r1[x1] >> shift) & 0xFF;
+        double v = (a * (1 - fx) + b * fx) * (1 - fy) + (c * (1 - fx) + d * fx) * fy;
+        result |= (uint32_t)(v + 0.5) << shift;
+    }
+    return result;
+}
+
+static const stretch_t cases[] = {
+    {  2,  3, 40, 30,   0,  0, 20, 15, false, false },   /* 2x up */
+    {  0,  0, 63, 47,   3,  2, 21, 16, false, false },   /* 3x up */
+    {  5,  5, 13,  9,   1,  1,  7,  5, false, false },   /* Uneven up */
+    {  1,  2, 20, 15,   0,  0, 40, 30, false, false },   /* 2x down */
+    { 10,  4, 13, 10,   2,  3, 37, 26, false, false },   /* Uneven down */
+    {  4,  4, 30, 10,   0,  5, 40, 20, false, false },   /* Up in x, down in y */
+    {  3,  1, 50, 40,   5,  5, 25, 20, true,  false },   /* Mirror x */
+    {  3,  1, 25, 20,   0,  0, 40, 30, false, true  },   /* Mirror y */
+    {  0,  0, 64, 48,   1,  1, 38, 28, true,  true  },   /* Both */
+    {-10, -6, 80, 60,   0,  0, 40, 30, false, false },   /* Hangs off the surface */
+    { 20, 10, 40, 30,   0,  0, 40, 25, true,  true  },   /* Same x scale, mirrored */
+    {  6,  8, 40, 35,   0,  0, 40, 30, false, false },   /* Same x scale, y up */
+};
+#define NUM_CASES (int)(sizeof(cases) / sizeof(cases[0]))
+
+/*
+ * Tests
+ */
+
+static void test_coloroncolor(void)
+{
+    static uint32_t want[DST_W * DST_H];
+    int mismatches = 0;
+
+    fill_unique(src_px, SRC_W, SRC_H);
+    dc_dst->stretch_mode = COLORONCOLOR;
+    for (int i = 0; i < NUM_CASES; i++) {
+        fill_value(dst_px, DST_W * DST_H, SENTINEL);
+        nearest_oracle(want, dst_px, src_px, SRC_W, &cases[i]);
+        CHECK(stretch(dc_dst, dc_src, &cases[i], ROP_SRCCOPY), "stretch succeeds");
+        if (memcmp(dst_px, want, sizeof(want)) != 0) {
+            fprintf(stderr, "COLORONCOLOR case %d differs\n", i);
+            mismatches++;
+        }
+    }
+    CHECK(mismatches == 0, "COLORONCOLOR picks the nearest source pixel");
+}
+
+static void test_halftone(void)
+{
+    int worst = 0;
+    int outside = 0;
+
+    fill_gradient(src_px, SRC_W, SRC_H);
+    dc_dst->stretch_mode = HALFTONE;
+    for (int i = 0; i < NUM_CASES; i++) {
+        const stretch_t *s = &cases[i];
+        fill_value(dst_px, DST_W * DST_H, SENTINEL);
+        stretch(dc_dst, dc_src, s, ROP_SRCCOPY);
+
+        for (int y = 0; y < DST_H; y++) {
+            for (int x = 0; x < DST_W; x++) {
+                bool inside = x >= s->dx && x < s->dx + s->dw && y >= s->dy && y < s->dy + s->dh;
+                uint32_t got = dst_px[y * DST_W + x];
+                if (!inside) {
+                    outside += got != SENTINEL;
+                    continue;
+                }
+                int err = channel_error(got, bilinear(src_px, SRC_W, s, x, y));
+                if (err > worst) worst = err;
+            }
+        }
+    }
+    printf("HALFTONE worst channel error %d\n", worst);
+    CHECK(worst <= 2, "HALFTONE within rounding of bilinear filtering");
+    CHECK(outside == 0, "HALFTONE writes only the destination rectangle");
+
+    /* A flat colour stays exact through the filter */
+    fill_value(src_px, SRC_W * SRC_H, 0xFFC08040);
+    fill_value(dst_px, DST_W * DST_H, 0);
+    stretch_t flat = { 0, 0, 61, 43, 0, 0, 17, 13, true, false };
+    stretch(dc_dst, dc_src, &flat, ROP_SRCCOPY);
+    int off = 0;
+    for (int i = 0; i < DST_W * DST_H; i++) {
+        bool inside = i % DST_W < 61 && i / DST_W < 43;
+        off += inside && dst_px[i] != 0xFFC08040;
+    }
+    CHECK(off == 0, "HALFTONE keeps a flat colour exact");
+}
+
+/* Source and destination overlap on one surface */
+static void test_overlap(void)
+{
+    static uint32_t before[DST_W * DST_H], want[DST_W * DST_H];
+    static const stretch_t overlaps[] = {
+        { 10,  8, 40, 32,   4,  4, 20, 16, false, false },   /* Grows over itself */
+        {  2,  1, 20, 16,   8,  6, 40, 32, false, false },   /* Shrinks over itself */
+        {  5,  5, 50, 40,   0,  0, 30, 24, true,  true  },   /* Mirrored, down-right */
+        {  0,  0, 60, 20,   4, 10, 30, 30, false, true  },   /* Band below the target */
+    };
+    int mismatches = 0;
+
+    for (int mode = COLORONCOLOR; mode <= HALFTONE; mode++) {
+        dc_dst->stretch_mode = mode;
+        dc_out->stretch_mode = mode;
+        for (size_t i = 0; i < sizeof(overlaps) / sizeof(overlaps[0]); i++) {
+            const stretch_t *s = &overlaps[i];
+            fill_unique(dst_px, DST_W, DST_H);
+            memcpy(before, dst_px, sizeof(before));
+
+            /* Reference: the same stretch between two untouched copies */
+            memcpy(ref_px, before, sizeof(ref_px));
+            memcpy(out_px, before, sizeof(out_px));
+            stretch(dc_out, dc_ref, s, ROP_SRCCOPY);
+            if (mode == COLORONCOLOR) {
+                nearest_oracle(want, before, before, DST_W, s);
+                mismatches += memcmp(out_px, want, sizeof(want)) != 0;
+            }
+
+            stretch(dc_dst, dc_dst, s, ROP_SRCCOPY);
+            if (memcmp(dst_px, out_px, sizeof(out_px)) != 0) {
+                fprintf(stderr, "overlap case %zu (mode %d) differs\n", i, mode);
+                mismatches++;
+            }
+        }
+    }
+    CHECK(mismatches == 0, "stretch within a surface reads the original source");
+}
+
+/* ROPs with a pattern: a NULL brush is no pattern, a solid brush is its colour */
+static void test_null_brush(void)
+{
+    static uint32_t want[DST_W * DST_H];
+    const stretch_t s = { 3, 3, 50, 40, 0, 0, 25, 20, false, false };
+    uint32_t red = gdi_create_solid_brush(&table, RGB(255, 0, 0));
+
+    fill_unique(src_px, SRC_W, SRC_H);
+    dc_dst->stretch_mode = COLORONCOLOR;
+    fill_value(dst_px, DST_W * DST_H, SENTINEL);
+    nearest_oracle(want, dst_px, src_px, SRC_W, &s);
+
+    gdi_select_object(&table, hdc_dst, table.stock_handles[GDI_STOCK_NULL_BRUSH]);
+    stretch(dc_dst, dc_src, &s, ROP_MERGECOPY);
+    int diff = 0;
+    for (int i = 0; i < DST_W * DST_H; i++) {
+        diff += (dst_px[i] & 0xFFFFFF) != (want[i] & 0xFFFFFF);
+    }
+    CHECK(diff == 0, "MERGECOPY with a NULL brush copies the source");
+
+    gdi_select_object(&table, hdc_dst, red);
+    fill_value(dst_px, DST_W * DST_H, SENTINEL);
+    stretch(dc_dst, dc_src, &s, ROP_MERGECOPY);
+    diff = 0;
+    for (int i = 0; i < DST_W * DST_H; i++) {
+        uint32_t mask = dst_px[i] == SENTINEL ? 0xFFFFFF : 0xFF0000;
+        diff += (dst_px[i] & 0xFFFFFF) != (want[i] & mask);
+    }
+    CHECK(diff == 0, "MERGECOPY with a solid brush masks by its colour");
+
+    gdi_select_object(&table, hdc_dst, table.stock_handles[GDI_STOCK_WHITE_BRUSH]);
+    gdi_delete_object(&table, red);
+}
+
+int main(void)
+{
+    gdi_handle_table_init(&table);
+    hdc_src = gdi_create_display_dc(&table, &src_surface);
+    hdc_dst = gdi_create_display_dc(&table, &dst_surface);
+    hdc_ref = gdi_create_display_dc(&table, &ref_surface);
+    hdc_out = gdi_create_display_dc(&table, &out_surface);
+    dc_src = gdi_get_dc(&table, hdc_src);
+    dc_dst = gdi_get_dc(&table, hdc_dst);
+    dc_ref = gdi_get_dc(&table, hdc_ref);
+    dc_out = gdi_get_dc(&table, hdc_out);
+    if (!dc_src || !dc_dst || !dc_ref || !dc_out) {
+        fprintf(stderr, "no display DCs\n");
+        return 1;
+    }
+
+    test_coloroncolor();
+    test_halftone();
+    test_overlap();
+    test_null_brush();
+
+    gdi_delete_dc(&table, hdc_out);
+    gdi_delete_dc(&table, hdc_ref);
+    gdi_delete_dc(&table, hdc_dst);
+    gdi_delete_dc(&table, hdc_src);
+    return test_finish();
+}
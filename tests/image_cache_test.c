@@ -0,0 +1,214 @@
+/*
+ * Image cache tests
+ *
+ * Runs the loader's cache protocol against a temp directory: a first load
+ * stores the relocated image and its bindings, a second one maps it back
+ * and reuses the bindings. Then checks invalidation: a changed file, another
+ * base, a dependency rebuilt or rebased, and truncated or foreign entries.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "loader/image_cache.h"
+#include "test_util.h"
+
+#define IMAGE_SIZE      0x3000
+#define BASE            0x10000000
+#define DEP_BASE        0x7C800000
+
+static char cache_dir[64];
+
+/* What is "loaded" in this run */
+static pe_file_id_t loaded_dep_id;
+static uint32_t loaded_dep_base;
+static int checks;
+
+static bool dep_current(void *ctx, const image_cache_dep_t *dep)
+{
+    (void)ctx;
+    checks++;
+    return strcmp(dep->name, "kernel32.dll") == 0 && dep->base_va == loaded_dep_base &&
+           image_cache_same_file(&dep->file_id, &loaded_dep_id);
+}
+
+static pe_image_t make_pe(uint64_t mtime)
+{
+    pe_image_t pe;
+    memset(&pe, 0, sizeof(pe));
+    pe.size_of_image = IMAGE_SIZE;
+    pe.file_id.dev = 1;
+    pe.file_id.ino = 42;
+    pe.file_id.size = 0x2400;
+    pe.file_id.mtime_sec = (int64_t)mtime;
+    return pe;
+}
+
+static void fill_image(uint8_t *image, uint32_t seed)
+{
+    for (uint32_t i = 0; i < IMAGE_SIZE; i++) {
+        image[i] = (uint8_t)(i * 31 + seed);
+    }
+}
+
+/* One "load": map from the cache or lay out and begin, then bind 3 slots */
+static bool load(image_cache_t *cache, const pe_image_t *pe, uint32_t base, uint32_t seed,
+                 int *cached_binds)
+{
+    static uint8_t image[IMAGE_SIZE];
+    memset(image, 0, sizeof(image));
+
+    image_cache_entry_t *entry = image_cache_load(cache, "/c/app.dll", pe, base, image);
+    bool hit = entry != NULL;
+    if (!hit) {
+        fill_image(image, seed);
+        entry = image_cache_begin(cache, "/c/app.dll", pe, base, image);
+        CHECK(entry != NULL, "begin entry");
+    } else {
+        uint8_t want[IMAGE_SIZE];
+        fill_image(want, seed);
+        CHECK(memcmp(image, want, IMAGE_SIZE) == 0, "cached image matches");
+    }
+
+    image_cache_dep_t dep = { "kernel32.dll", loaded_dep_id, loaded_dep_base };
+    *cached_binds = 0;
+    for (uint32_t slot = 0; slot < 3; slot++) {
+        uint32_t rva = 0x2000 + slot * 4;
+        uint32_t want = loaded_dep_base + 0x1000 + slot * 0x10;
+        uint32_t value;
+        if (image_cache_use_bind(entry, rva, dep_current, NULL, &value)) {
+            CHECK(value == want, "cached binding value");
+            (*cached_binds)++;
+        } else {
+            image_cache_record_bind(entry, rva, want, &dep);
+        }
+    }
+
+    CHECK(image_cache_commit(cache, entry) == 0, "commit");
+    return hit;
+}
+
+static int count_files(void)
+{
+    int n = 0;
+    DIR *d = opendir(cache_dir);
+    struct dirent *de;
+    while (d && (de = readdir(d))) {
+        if (de->d_name[0] != '.') n++;
+    }
+    if (d) closedir(d);
+    return n;
+}
+
+static void corrupt_entries(long truncate_to)
+{
+    DIR *d = opendir(cache_dir);
+    struct dirent *de;
+    while (d && (de = readdir(d))) {
+        if (de->d_name[0] == '.') continue;
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", cache_dir, de->d_name);
+        CHECK(truncate(path, truncate_to) == 0, "truncate entry");
+    }
+    if (d) closedir(d);
+}
+
+static void test_protocol(void)
+{
+    image_cache_t cache;
+    CHECK(image_cache_init(&cache, cache_dir) == 0, "init");
+
+    loaded_dep_id = make_pe(500).file_id;
+    loaded_dep_id.ino = 7;
+    loaded_dep_base = DEP_BASE;
+    pe_image_t pe = make_pe(1000);
+    int binds;
+
+    CHECK(!load(&cache, &pe, BASE, 1, &binds), "first load misses");
+    CHECK(cache.stores == 1 && count_files() == 1, "entry stored");
+
+    CHECK(load(&cache, &pe, BASE, 1, &binds), "second load hits");
+    CHECK(binds == 3 && checks == 1, "bindings reused, dependency checked once");
+    CHECK(cache.stores == 1, "clean hit is not rewritten");
+
+    /* Another base is another entry */
+    CHECK(!load(&cache, &pe, BASE + 0x100000, 2, &binds), "other base misses");
+    CHECK(count_files() == 2, "second entry");
+
+    /* Dependency rebased: image reused, bindings redone and rewritten */
+    loaded_dep_base = DEP_BASE + 0x10000;
+    CHECK(load(&cache, &pe, BASE, 1, &binds), "hit with rebased dependency");
+    CHECK(binds == 0, "stale bindings not used");
+    CHECK(cache.stores == 3, "entry rewritten");
+    CHECK(load(&cache, &pe, BASE, 1, &binds) && binds == 3, "new bindings reused");
+
+    /* Dependency rebuilt */
+    loaded_dep_id.mtime_nsec = 1;
+    CHECK(load(&cache, &pe, BASE, 1, &binds) && binds == 0, "rebuilt dependency");
+    CHECK(load(&cache, &pe, BASE, 1, &binds) && binds == 3, "rebound after rebuild");
+
+    /* The file itself changed */
+    pe_image_t changed = make_pe(1001);
+    CHECK(!load(&cache, &changed, BASE, 3, &binds), "changed file misses");
+    CHECK(binds == 0, "no bindings for a changed file");
+
+    /* Truncated entries are ignored and replaced */
+    corrupt_entries(100);
+    CHECK(!load(&cache, &changed, BASE, 3, &binds), "truncated entry misses");
+    CHECK(load(&cache, &changed, BASE, 3, &binds) && binds == 3, "replaced entry hits");
+
+    /* No stray temp files */
+    CHECK(count_files() == 3, "three entries, no temp files");
+
+    /* An abandoned entry leaves nothing behind */
+    uint8_t image[IMAGE_SIZE] = {0};
+    pe_image_t other = make_pe(2000);
+    image_cache_entry_t *entry = image_cache_begin(&cache, "/c/other.dll", &other, BASE, image);
+    CHECK(entry != NULL, "begin abandoned entry");
+    image_cache_entry_free(entry);
+    CHECK(count_files() == 3, "abandoned entry removed");
+
+    /* Unknown file identity is never cached */
+    pe_image_t anon = make_pe(0);
+    memset(&anon.file_id, 0, sizeof(anon.file_id));
+    CHECK(image_cache_begin(&cache, "/c/anon.dll", &anon, BASE, image) == NULL, "no identity");
+
+    image_cache_free(&cache);
+
+    /* Disabled cache */
+    CHECK(image_cache_init(&cache, NULL) == 0, "init disabled");
+    CHECK(image_cache_load(&cache, "/c/app.dll", &pe, BASE, image) == NULL, "disabled load");
+    CHECK(image_cache_begin(&cache, "/c/app.dll", &pe, BASE, image) == NULL, "disabled begin");
+    image_cache_free(&cache);
+}
+
+static void cleanup(void)
+{
+    DIR *d = opendir(cache_dir);
+    struct dirent *de;
+    while (d && (de = readdir(d))) {
+        if (de->d_name[0] == '.') continue;
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", cache_dir, de->d_name);
+        unlink(path);
+    }
+    if (d) closedir(d);
+    rmdir(cache_dir);
+}
+
+int main(void)
+{
+    snprintf(cache_dir, sizeof(cache_dir), "/tmp/wbox_image_cache_test.XXXXXX");
+    if (!mkdtemp(cache_dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    test_protocol();
+    cleanup();
+
+    return test_finish();
+}
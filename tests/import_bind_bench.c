@@ -0,0 +1,278 @@
+/*
+ * Import binding benchmark
+ *
+ * Builds in-memory DLL images shaped like the big system DLLs (user32,
+ * gdi32, msvcrt and a 3000-export one) and binds a large executable's
+ * import table against them: once with the hints a linker writes, once
+ * with stale hints (DLL rebuilt since) and once with the linear scan the
+ * loader used to do. Also checks that every lookup agrees with the scan
+ * and that unsorted name tables, aliases and misses are handled.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "loader/exports.h"
+#include "test_util.h"
+
+#define IMAGE_RVA       0x1000
+#define BIND_ROUNDS     50
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef struct {
+    const char *dll;
+    uint32_t exports;
+} dll_shape_t;
+
+static const dll_shape_t shapes[] = {
+    { "user32.dll", 730 },
+    { "gdi32.dll", 610 },
+    { "msvcrt.dll", 1300 },
+    { "big.dll", 3000 },
+};
+#define NUM_DLLS (sizeof(shapes) / sizeof(shapes[0]))
+
+typedef struct {
+    pe_image_t pe;
+    pe_section_t section;
+    loaded_module_t mod;
+    char **names;           /* Sorted, as in the name pointer table */
+} fake_dll_t;
+
+static fake_dll_t dlls[NUM_DLLS];
+
+/* Export names with realistic shared prefixes */
+static void make_name(char *buf, size_t size, uint32_t dll, uint32_t i)
+{
+    static const char *prefixes[] = { "Get", "Set", "Create", "Nt", "Rtl", "_", "Draw" };
+    snprintf(buf, size, "%s%sObject%05uEx%c", prefixes[i % 7], shapes[dll].dll, i * 7919 % 100000,
+             (i & 1) ? 'W' : 'A');
+}
+
+static int name_compare(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/*
+ * Lay out an export directory, EAT, name pointer table, ordinal table and
+ * the names in one section at IMAGE_RVA. If shuffle is set the name table
+ * is left unsorted. Names map to EAT slots in reverse, so name index and
+ * ordinal differ.
+ */
+static void build_dll(fake_dll_t *dll, uint32_t index, uint32_t count, bool shuffle)
+{
+    memset(dll, 0, sizeof(*dll));
+
+    dll->names = malloc(count * sizeof(char *));
+    for (uint32_t i = 0; i < count; i++) {
+        char buf[96];
+        make_name(buf, sizeof(buf), index, i);
+        dll->names[i] = strdup(buf);
+    }
+    qsort(dll->names, count, sizeof(char *), name_compare);
+    if (shuffle) {
+        for (uint32_t i = 0; i + 1 < count; i += 2) {
+            char *tmp = dll->names[i];
+            dll->names[i] = dll->names[i + 1];
+            dll->names[i + 1] = tmp;
+        }
+    }
+
+    uint32_t dir_off = 0;
+    uint32_t eat_off = dir_off + sizeof(IMAGE_EXPORT_DIRECTORY);
+    uint32_t npt_off = eat_off + count * 4;
+    uint32_t ord_off = npt_off + count * 4;
+    uint32_t str_off = (ord_off + count * 2 + 3) & ~3u;
+    uint32_t size = str_off + count * 96 + 64;
+
+    uint8_t *file = calloc(1, IMAGE_RVA + size);
+    uint8_t *sec = file + IMAGE_RVA;
+
+    IMAGE_EXPORT_DIRECTORY *dir = (IMAGE_EXPORT_DIRECTORY *)(sec + dir_off);
+    dir->Base = 1;
+    dir->NumberOfFunctions = count;
+    dir->NumberOfNames = count;
+    dir->AddressOfFunctions = IMAGE_RVA + eat_off;
+    dir->AddressOfNames = IMAGE_RVA + npt_off;
+    dir->AddressOfNameOrdinals = IMAGE_RVA + ord_off;
+
+    uint32_t *eat = (uint32_t *)(sec + eat_off);
+    uint32_t *npt = (uint32_t *)(sec + npt_off);
+    uint16_t *ord = (uint16_t *)(sec + ord_off);
+    uint32_t str = str_off;
+    for (uint32_t i = 0; i < count; i++) {
+        eat[i] = 0x100000 + i * 0x10;   /* Outside the directory: not forwarders */
+        npt[i] = IMAGE_RVA + str;
+        ord[i] = (uint16_t)(count - 1 - i);
+        strcpy((char *)sec + str, dll->names[i]);
+        str += strlen(dll->names[i]) + 1;
+    }
+    dir->Name = IMAGE_RVA + str;
+    strcpy((char *)sec + str, shapes[index].dll);
+
+    snprintf(dll->section.name, sizeof(dll->section.name), ".edata");
+    dll->section.virtual_address = IMAGE_RVA;
+    dll->section.virtual_size = size;
+    dll->section.raw_offset = IMAGE_RVA;
+    dll->section.raw_size = size;
+
+    dll->pe.file_data = file;
+    dll->pe.file_size = IMAGE_RVA + size;
+    dll->pe.size_of_headers = 0x400;
+    dll->pe.num_sections = 1;
+    dll->pe.sections = &dll->section;
+    dll->pe.data_dirs[IMAGE_DIRECTORY_ENTRY_EXPORT].virtual_address = IMAGE_RVA;
+    dll->pe.data_dirs[IMAGE_DIRECTORY_ENTRY_EXPORT].size = eat_off;
+
+    snprintf(dll->mod.name, sizeof(dll->mod.name), "%s", shapes[index].dll);
+}
+
+static void free_dll(fake_dll_t *dll, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        free(dll->names[i]);
+    }
+    free(dll->names);
+    free(dll->pe.file_data);
+    exports_free(&dll->mod);
+}
+
+/* The lookup the loader used before the name index */
+static export_lookup_t linear_lookup(const loaded_module_t *mod, const char *name)
+{
+    export_lookup_t result = { .found = false };
+    for (uint32_t i = 0; i < mod->num_exports; i++) {
+        if (mod->exports[i].name && strcmp(mod->exports[i].name, name) == 0) {
+            result.found = true;
+            result.rva = mod->exports[i].rva;
+            result.ordinal = mod->exports[i].ordinal;
+            return result;
+        }
+    }
+    return result;
+}
+
+/* One import of the executable: DLL, name and the hint the linker wrote */
+typedef struct {
+    uint32_t dll;
+    const char *name;
+    uint16_t hint;
+} import_t;
+
+static void bench_binding(void)
+{
+    double start = now_sec();
+    for (uint32_t d = 0; d < NUM_DLLS; d++) {
+        build_dll(&dlls[d], d, shapes[d].exports, false);
+        CHECK(exports_parse(&dlls[d].pe, &dlls[d].mod) == 0, "parse exports");
+        CHECK(dlls[d].mod.num_export_names == shapes[d].exports, "all names indexed");
+    }
+    double parse = now_sec() - start;
+
+    /* Import every other export of each DLL, as a big app would */
+    uint32_t num_imports = 0;
+    for (uint32_t d = 0; d < NUM_DLLS; d++) {
+        num_imports += (shapes[d].exports + 1) / 2;
+    }
+    import_t *imports = malloc(num_imports * sizeof(import_t));
+    uint32_t n = 0;
+    for (uint32_t d = 0; d < NUM_DLLS; d++) {
+        for (uint32_t i = 0; i < shapes[d].exports; i += 2) {
+            imports[n].dll = d;
+            imports[n].name = dlls[d].names[i];
+            imports[n].hint = (uint16_t)i;
+            n++;
+        }
+    }
+
+    /* Correctness against the linear scan */
+    for (uint32_t i = 0; i < num_imports; i++) {
+        const loaded_module_t *mod = &dlls[imports[i].dll].mod;
+        export_lookup_t ref = linear_lookup(mod, imports[i].name);
+        export_lookup_t hinted = exports_lookup_by_hint(mod, imports[i].name, imports[i].hint);
+        export_lookup_t stale = exports_lookup_by_hint(mod, imports[i].name, imports[i].hint + 1);
+        export_lookup_t named = exports_lookup_by_name(mod, imports[i].name);
+        CHECK(ref.found && hinted.found && stale.found && named.found, "import found");
+        CHECK(hinted.rva == ref.rva && stale.rva == ref.rva && named.rva == ref.rva,
+              "same export as the linear scan");
+        CHECK(hinted.ordinal == ref.ordinal, "same ordinal as the linear scan");
+    }
+
+    volatile uint32_t sink = 0;
+    double times[3];
+    for (int mode = 0; mode < 3; mode++) {
+        start = now_sec();
+        for (int round = 0; round < BIND_ROUNDS; round++) {
+            for (uint32_t i = 0; i < num_imports; i++) {
+                const loaded_module_t *mod = &dlls[imports[i].dll].mod;
+                export_lookup_t r;
+                if (mode == 0) {
+                    r = exports_lookup_by_hint(mod, imports[i].name, imports[i].hint);
+                } else if (mode == 1) {
+                    r = exports_lookup_by_hint(mod, imports[i].name, imports[i].hint ^ 1);
+                } else {
+                    r = linear_lookup(mod, imports[i].name);
+                }
+                sink += r.rva;
+            }
+        }
+        times[mode] = (now_sec() - start) / BIND_ROUNDS;
+    }
+    (void)sink;
+
+    printf("export index build for %u DLLs: %.3f ms\n", (unsigned)NUM_DLLS, parse * 1e3);
+    printf("bind %u imports: hinted %.3f ms, stale hints %.3f ms, linear scan %.3f ms (%.0fx)\n",
+           num_imports, times[0] * 1e3, times[1] * 1e3, times[2] * 1e3,
+           times[0] > 0 ? times[2] / times[0] : 0.0);
+    CHECK(times[0] < times[2] && times[1] < times[2], "index beats the linear scan");
+
+    free(imports);
+    for (uint32_t d = 0; d < NUM_DLLS; d++) {
+        free_dll(&dlls[d], shapes[d].exports);
+    }
+}
+
+/* Unsorted name tables, misses and ordinals */
+static void test_edge_cases(void)
+{
+    fake_dll_t dll;
+    build_dll(&dll, 0, 101, true);
+    CHECK(exports_parse(&dll.pe, &dll.mod) == 0, "parse unsorted exports");
+
+    for (uint32_t i = 0; i < 101; i++) {
+        export_lookup_t r = exports_lookup_by_hint(&dll.mod, dll.names[i], (uint16_t)i);
+        CHECK(r.found && r.rva == 0x100000 + (100 - i) * 0x10, "unsorted table still resolves");
+    }
+    CHECK(!exports_lookup_by_name(&dll.mod, "NoSuchExport").found, "miss");
+    CHECK(!exports_lookup_by_hint(&dll.mod, "NoSuchExport", 3).found, "miss with hint");
+    CHECK(!exports_lookup_by_hint(&dll.mod, "", 0xFFFF).found, "out-of-range hint");
+
+    export_lookup_t r = exports_lookup_by_ordinal(&dll.mod, 1);
+    CHECK(r.found && r.rva == 0x100000, "ordinal lookup");
+
+    /* Exports outside code sections are data: lazy binding leaves them alone */
+    CHECK(dll.mod.exports_data && !dll.mod.exports_forwarded, "data exports flagged");
+    CHECK(!exports_rva_is_code(&dll.pe, IMAGE_RVA), "non-code section");
+    dll.section.characteristics = IMAGE_SCN_CNT_CODE | IMAGE_SCN_MEM_EXECUTE;
+    CHECK(exports_rva_is_code(&dll.pe, IMAGE_RVA), "code section");
+    CHECK(!exports_rva_is_code(&dll.pe, 0x100000), "outside any section");
+
+    free_dll(&dll, 101);
+}
+
+int main(void)
+{
+    bench_binding();
+    test_edge_cases();
+
+    return test_finish();
+}
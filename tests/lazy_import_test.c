@@ -0,0 +1,526 @@
+/*
+ * Lazy import binding tests
+ *
+ * Resolves an executable's imports from in-memory DLLs with lazy binding
+ * on, against a fake guest: forwarders that end in a stub DLL, directly
+ * or through another DLL, are bound at load time while code exports get
+ * thunks; the thunks bind to the right target on first call; and a large
+ * import table stops taking thunks while the stub region still has room
+ * for every known stub.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+
+#include "loader/imports.h"
+#include "loader/exports.h"
+#include "loader/stubs.h"
+#include "loader/ntdll_stubs.h"
+#include "loader/win32k_stubs.h"
+#include "loader/image_cache.h"
+#include "vm/vm.h"
+#include "vm/paging.h"
+#include "cpu/mem.h"
+#include "test_util.h"
+
+#define PHYS_BASE       0x00100000
+#define PHYS_SIZE       (4 * 1024 * 1024)
+#define TEXT_RVA        0x1000
+#define DATA_RVA        0x8000
+#define EXE_BASE        0x00400000
+#define MANY_IMPORTS    4000
+
+/*
+ * Fake guest
+ */
+
+static uint8_t *phys_mem;
+static uint32_t exe_phys;
+static uint32_t exe_size;
+static int dll_loads;
+
+static uint8_t *phys_ptr(uint32_t addr, uint32_t size)
+{
+    if (addr < PHYS_BASE || addr - PHYS_BASE + size > PHYS_SIZE) {
+        return NULL;
+    }
+    return &phys_mem[addr - PHYS_BASE];
+}
+
+void mem_writeb_phys(uint32_t addr, uint8_t val)
+{
+    uint8_t *p = phys_ptr(addr, 1);
+    if (p) *p = val;
+}
+
+void mem_writew_phys(uint32_t addr, uint16_t val)
+{
+    uint8_t *p = phys_ptr(addr, 2);
+    if (p) memcpy(p, &val, 2);
+}
+
+void mem_writel_phys(uint32_t addr, uint32_t val)
+{
+    uint8_t *p = phys_ptr(addr, 4);
+    if (p) memcpy(p, &val, 4);
+}
+
+static uint32_t readl_phys(uint32_t addr)
+{
+    uint32_t val = 0;
+    uint8_t *p = phys_ptr(addr, 4);
+    if (p) memcpy(&val, p, 4);
+    return val;
+}
+
+uint32_t paging_alloc_phys(paging_context_t *ctx, uint32_t size)
+{
+    size = (size + PAGE_SIZE - 1) & PAGE_MASK;
+    if (ctx->phys_alloc_ptr + size > PHYS_BASE + PHYS_SIZE) {
+        return 0;
+    }
+    uint32_t addr = ctx->phys_alloc_ptr;
+    ctx->phys_alloc_ptr += size;
+    return addr;
+}
+
+int paging_map_page(paging_context_t *ctx, uint32_t virt, uint32_t phys, uint32_t flags)
+{
+    (void)ctx;
+    (void)virt;
+    (void)phys;
+    (void)flags;
+    return 0;
+}
+
+/* Only the executable's image is mapped */
+uint32_t vm_va_to_phys(vm_context_t *vm, uint32_t va)
+{
+    (void)vm;
+    if (va < EXE_BASE || va - EXE_BASE >= exe_size) {
+        return 0;
+    }
+    return exe_phys + (va - EXE_BASE);
+}
+
+/* No image cache */
+bool image_cache_use_bind(image_cache_entry_t *entry, uint32_t iat_rva,
+                          image_cache_check_fn check, void *ctx, uint32_t *value)
+{
+    (void)entry;
+    (void)iat_rva;
+    (void)check;
+    (void)ctx;
+    (void)value;
+    return false;
+}
+
+void image_cache_record_bind(image_cache_entry_t *entry, uint32_t iat_rva,
+                             uint32_t value, const image_cache_dep_t *target)
+{
+    (void)entry;
+    (void)iat_rva;
+    (void)value;
+    (void)target;
+}
+
+/*
+ * Fake DLLs
+ */
+
+/* One export: code at its index in .text, or a forwarder string */
+typedef struct {
+    const char *name;
+    const char *forwarder;
+} export_def_t;
+
+typedef struct {
+    pe_section_t sections[2];
+    loaded_module_t mod;
+} fake_dll_t;
+
+#define MAX_DLLS 4
+static fake_dll_t *dlls[MAX_DLLS];
+static int num_dlls;
+
+loaded_module_t *module_find_by_name(module_manager_t *mgr, const char *name)
+{
+    (void)mgr;
+    for (int i = 0; i < num_dlls; i++) {
+        if (strcasecmp(dlls[i]->mod.name, name) == 0) {
+            return &dlls[i]->mod;
+        }
+    }
+    return NULL;
+}
+
+loaded_module_t *module_load_by_name(module_manager_t *mgr, vm_context_t *vm,
+                                     const char *dll_name)
+{
+    (void)mgr;
+    (void)vm;
+    (void)dll_name;
+    dll_loads++;
+    return NULL;
+}
+
+loaded_module_t *module_find_by_address(module_manager_t *mgr, uint32_t va)
+{
+    (void)mgr;
+    (void)va;
+    return NULL;
+}
+
+static void add_section(pe_image_t *pe, pe_section_t *sec, const char *name,
+                        uint32_t rva, uint32_t size, uint32_t characteristics)
+{
+    snprintf(sec->name, sizeof(sec->name), "%s", name);
+    sec->virtual_address = rva;
+    sec->virtual_size = size;
+    sec->raw_offset = rva;
+    sec->raw_size = size;
+    sec->characteristics = characteristics;
+    pe->num_sections++;
+}
+
+/*
+ * Lay out .text (one 16-byte slot per export) and an .edata section with
+ * the export directory, tables, names and forwarder strings. Names must
+ * be given sorted.
+ */
+static fake_dll_t *build_dll(const char *dll_name, uint32_t base, const export_def_t *exports,
+                             uint32_t count)
+{
+    fake_dll_t *dll = calloc(1, sizeof(*dll));
+    pe_image_t *pe = &dll->mod.pe;
+
+    uint32_t eat_off = sizeof(IMAGE_EXPORT_DIRECTORY);
+    uint32_t npt_off = eat_off + count * 4;
+    uint32_t ord_off = npt_off + count * 4;
+    uint32_t str_off = (ord_off + count * 2 + 3) & ~3u;
+    uint32_t str_size = 64;
+    for (uint32_t i = 0; i < count; i++) {
+        str_size += strlen(exports[i].name) + 1;
+        if (exports[i].forwarder) {
+            str_size += strlen(exports[i].forwarder) + 1;
+        }
+    }
+    uint32_t data_size = str_off + str_size;
+    uint32_t text_size = count * 0x10 > PAGE_SIZE ? count * 0x10 : PAGE_SIZE;
+    uint32_t data_rva = (TEXT_RVA + text_size + PAGE_SIZE - 1) & PAGE_MASK;
+
+    uint8_t *file = calloc(1, data_rva + data_size);
+    uint8_t *sec = file + data_rva;
+    IMAGE_EXPORT_DIRECTORY *dir = (IMAGE_EXPORT_DIRECTORY *)sec;
+    dir->Base = 1;
+    dir->NumberOfFunctions = count;
+    dir->NumberOfNames = count;
+    dir->AddressOfFunctions = data_rva + eat_off;
+    dir->AddressOfNames = data_rva + npt_off;
+    dir->AddressOfNameOrdinals = data_rva + ord_off;
+
+    uint32_t *eat = (uint32_t *)(sec + eat_off);
+    uint32_t *npt = (uint32_t *)(sec + npt_off);
+    uint16_t *ord = (uint16_t *)(sec + ord_off);
+    uint32_t str = str_off;
+    for (uint32_t i = 0; i < count; i++) {
+        npt[i] = data_rva + str;
+        ord[i] = (uint16_t)i;
+        strcpy((char *)sec + str, exports[i].name);
+        str += strlen(exports[i].name) + 1;
+        if (exports[i].forwarder) {
+            eat[i] = data_rva + str;
+            strcpy((char *)sec + str, exports[i].forwarder);
+            str += strlen(exports[i].forwarder) + 1;
+        } else {
+            eat[i] = TEXT_RVA + i * 0x10;
+        }
+    }
+    dir->Name = data_rva + str;
+    strcpy((char *)sec + str, dll_name);
+
+    add_section(pe, &dll->sections[0], ".text", TEXT_RVA, text_size,
+                IMAGE_SCN_CNT_CODE | IMAGE_SCN_MEM_EXECUTE);
+    add_section(pe, &dll->sections[1], ".edata", data_rva, data_size, 0);
+    pe->file_data = file;
+    pe->file_size = data_rva + data_size;
+    pe->size_of_headers = 0x400;
+    pe->sections = dll->sections;
+    /* The whole section counts as the directory, so forwarder strings are in it */
+    pe->data_dirs[IMAGE_DIRECTORY_ENTRY_EXPORT].virtual_address = data_rva;
+    pe->data_dirs[IMAGE_DIRECTORY_ENTRY_EXPORT].size = data_size;
+
+    snprintf(dll->mod.name, sizeof(dll->mod.name), "%s", dll_name);
+    dll->mod.base_va = base;
+    CHECK(exports_parse(pe, &dll->mod) == 0, "parse exports");
+    dlls[num_dlls++] = dll;
+    return dll;
+}
+
+static void free_dlls(void)
+{
+    for (int i = 0; i < num_dlls; i++) {
+        exports_free(&dlls[i]->mod);
+        free(dlls[i]->mod.pe.file_data);
+        free(dlls[i]);
+    }
+    num_dlls = 0;
+}
+
+static uint32_t export_va(const fake_dll_t *dll, const char *name)
+{
+    export_lookup_t r = exports_lookup_by_name(&dll->mod, name);
+    return r.found && !r.is_forwarder ? dll->mod.base_va + r.rva : 0;
+}
+
+/*
+ * The executable: one import descriptor for dll_name with the given
+ * names, the IAT mapped into guest memory
+ */
+typedef struct {
+    pe_section_t section;
+    loaded_module_t mod;
+    uint32_t iat_rva;
+} fake_exe_t;
+
+static void build_exe(fake_exe_t *exe, const char *dll_name, const char *const *names,
+                      uint32_t count)
+{
+    memset(exe, 0, sizeof(*exe));
+    uint32_t int_off = 2 * sizeof(IMAGE_IMPORT_DESCRIPTOR);
+    uint32_t iat_off = int_off + (count + 1) * 4;
+    uint32_t str_off = iat_off + (count + 1) * 4;
+    uint32_t size = str_off + strlen(dll_name) + 1;
+    for (uint32_t i = 0; i < count; i++) {
+        size += 2 + strlen(names[i]) + 2;
+    }
+
+    uint8_t *file = calloc(1, DATA_RVA + size);
+    uint8_t *sec = file + DATA_RVA;
+    IMAGE_IMPORT_DESCRIPTOR *desc = (IMAGE_IMPORT_DESCRIPTOR *)sec;
+    desc->OriginalFirstThunk = DATA_RVA + int_off;
+    desc->FirstThunk = DATA_RVA + iat_off;
+
+    uint32_t *int_table = (uint32_t *)(sec + int_off);
+    uint32_t str = str_off;
+    for (uint32_t i = 0; i < count; i++) {
+        str = (str + 1) & ~1u;
+        int_table[i] = DATA_RVA + str;
+        memcpy(sec + str, &(uint16_t){ 0 }, 2);     /* No hint */
+        strcpy((char *)sec + str + 2, names[i]);
+        str += 2 + strlen(names[i]) + 1;
+    }
+    desc->Name = DATA_RVA + str;
+    strcpy((char *)sec + str, dll_name);
+
+    pe_image_t *pe = &exe->mod.pe;
+    add_section(pe, &exe->section, ".idata", DATA_RVA, size, 0);
+    pe->file_data = file;
+    pe->file_size = DATA_RVA + size;
+    pe->size_of_headers = 0x400;
+    pe->sections = &exe->section;
+    pe->data_dirs[IMAGE_DIRECTORY_ENTRY_IMPORT].virtual_address = DATA_RVA;
+    pe->data_dirs[IMAGE_DIRECTORY_ENTRY_IMPORT].size = 2 * sizeof(IMAGE_IMPORT_DESCRIPTOR);
+
+    snprintf(exe->mod.name, sizeof(exe->mod.name), "app.exe");
+    exe->mod.base_va = EXE_BASE;
+    exe->iat_rva = DATA_RVA + iat_off;
+}
+
+static uint32_t iat_slot(const fake_exe_t *exe, uint32_t i)
+{
+    return readl_phys(vm_va_to_phys(NULL, EXE_BASE + exe->iat_rva + i * 4));
+}
+
+/*
+ * Helpers
+ */
+
+static vm_context_t vm;
+static stub_manager_t stubs;
+static module_manager_t mgr;
+
+static void setup(uint32_t image_size)
+{
+    memset(&vm, 0, sizeof(vm));
+    memset(&mgr, 0, sizeof(mgr));
+    vm.paging.phys_alloc_ptr = PHYS_BASE;
+    CHECK(stubs_init(&stubs, &vm) == 0, "stubs_init");
+    exe_size = image_size;
+    exe_phys = paging_alloc_phys(&vm.paging, image_size);
+    CHECK(exe_phys != 0, "executable memory");
+
+    mgr.stubs = &stubs;
+    mgr.lazy_binding = true;
+    dll_loads = 0;
+}
+
+static void teardown(void)
+{
+    free(mgr.lazy_imports);
+    stubs_free(&stubs);
+    free_dlls();
+}
+
+static bool is_thunk(uint32_t va)
+{
+    return va >= stubs.stub_region_va && va < stubs.stub_region_va + stubs.stub_region_size &&
+           stubs_lookup(&stubs, "NtClose") != va;
+}
+
+static void test_forwarders(void)
+{
+    setup(DATA_RVA + PAGE_SIZE);
+
+    static const export_def_t ntdll_exports[] = {
+        { "NtClose", NULL },
+        { "RtlAllocateHeap", NULL },
+    };
+    static const export_def_t kernelbase_exports[] = {
+        { "GetLocaleInfoA", NULL },
+        { "HeapFree", "NTDLL.NtClose" },
+    };
+    static const export_def_t kernel32_exports[] = {
+        { "CloseHandle", "NTDLL.NtClose" },
+        { "CreateFileA", NULL },
+        { "GetLocaleInfoA", "KERNELBASE.GetLocaleInfoA" },
+        { "GetProcessHeap", "NTDLL.#1" },
+        { "HeapAlloc", "NTDLL.RtlAllocateHeap" },
+        { "HeapFree", "KERNELBASE.HeapFree" },
+        { "LoadLater", "NOTLOADED.Function" },
+    };
+    fake_dll_t *ntdll = build_dll("ntdll.dll", 0x77000000, ntdll_exports, 2);
+    fake_dll_t *kernelbase = build_dll("kernelbase.dll", 0x76000000, kernelbase_exports, 2);
+    fake_dll_t *kernel32 = build_dll("kernel32.dll", 0x75000000, kernel32_exports, 7);
+    CHECK(kernel32->mod.exports_forwarded, "kernel32 has forwarders");
+
+    static const char *const names[] = {
+        "CreateFileA", "HeapAlloc", "CloseHandle", "HeapFree", "GetLocaleInfoA",
+        "GetProcessHeap",
+    };
+    enum { CREATE_FILE, HEAP_ALLOC, CLOSE_HANDLE, HEAP_FREE, GET_LOCALE, GET_HEAP, COUNT };
+    fake_exe_t exe;
+    build_exe(&exe, "KERNEL32.dll", names, COUNT);
+
+    import_stats_t stats = {0};
+    CHECK(imports_resolve(&mgr, &vm, &exe.mod, &stats) == 0, "imports resolved");
+    CHECK(stats.total_imports == COUNT && stats.failed_imports == 0, "all imports bound");
+    CHECK(stats.lazy_imports == 2 && mgr.lazy_import_count == 2, "code exports deferred");
+    CHECK(stats.stubbed_imports == 2, "forwarders into ntdll stubs bound now");
+    CHECK(stats.direct_imports == 2, "forwarders into ntdll exports bound now");
+
+    uint32_t nt_close = stubs_lookup(&stubs, "NtClose");
+    CHECK(nt_close != 0, "NtClose stub generated");
+    CHECK(iat_slot(&exe, CLOSE_HANDLE) == nt_close, "CloseHandle -> NtClose stub");
+    CHECK(iat_slot(&exe, HEAP_FREE) == nt_close, "chained forwarder -> NtClose stub");
+    CHECK(iat_slot(&exe, HEAP_ALLOC) == export_va(ntdll, "RtlAllocateHeap"),
+          "HeapAlloc -> RtlAllocateHeap");
+    CHECK(iat_slot(&exe, GET_HEAP) == export_va(ntdll, "NtClose"),
+          "ordinal forwarder into ntdll bound now");
+    CHECK(is_thunk(iat_slot(&exe, CREATE_FILE)), "CreateFileA gets a thunk");
+    CHECK(is_thunk(iat_slot(&exe, GET_LOCALE)), "forwarder into a code export gets a thunk");
+
+    /* First calls bind through the thunks and patch the IAT */
+    for (uint32_t i = 0; i < mgr.lazy_import_count; i++) {
+        uint32_t target = 0;
+        CHECK(imports_bind_lazy(&mgr, &vm, i, &target) == 0, "lazy bind");
+        uint32_t slot = (mgr.lazy_imports[i].iat_va - EXE_BASE - exe.iat_rva) / 4;
+        uint32_t expect = slot == CREATE_FILE ? export_va(kernel32, "CreateFileA")
+                                              : export_va(kernelbase, "GetLocaleInfoA");
+        CHECK(target == expect && iat_slot(&exe, slot) == expect, "bound to the export");
+    }
+    uint32_t target = 0;
+    CHECK(imports_bind_lazy(&mgr, &vm, mgr.lazy_import_count, &target) == -1, "bad index");
+
+    /* A forwarder into a DLL that is not loaded is bound (and loaded) now */
+    static const char *const later[] = { "LoadLater" };
+    fake_exe_t exe2;
+    build_exe(&exe2, "kernel32.dll", later, 1);
+    stats = (import_stats_t){0};
+    CHECK(imports_resolve(&mgr, &vm, &exe2.mod, &stats) == -1 && dll_loads == 1,
+          "unloaded forwarder target loaded at bind time");
+    CHECK(stats.lazy_imports == 0, "not deferred");
+
+    free(exe.mod.pe.file_data);
+    free(exe2.mod.pe.file_data);
+    teardown();
+}
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(((const export_def_t *)a)->name, ((const export_def_t *)b)->name);
+}
+
+static uint32_t count_defs(const stub_def_t *defs)
+{
+    uint32_t n = 0;
+    while (defs[n].name) {
+        n++;
+    }
+    return n;
+}
+
+/* A big import table leaves room for every known stub */
+static void test_reserve(void)
+{
+    setup(DATA_RVA + 128 * 1024);
+
+    static char names[MANY_IMPORTS][16];
+    static export_def_t exports[MANY_IMPORTS];
+    static const char *import_names[MANY_IMPORTS];
+    for (uint32_t i = 0; i < MANY_IMPORTS; i++) {
+        snprintf(names[i], sizeof(names[i]), "Function%04u", i);
+        exports[i].name = names[i];
+        exports[i].forwarder = NULL;
+        import_names[i] = names[i];
+    }
+    qsort(exports, MANY_IMPORTS, sizeof(export_def_t), compare_names);
+    build_dll("big.dll", 0x60000000, exports, MANY_IMPORTS);
+
+    fake_exe_t exe;
+    build_exe(&exe, "big.dll", import_names, MANY_IMPORTS);
+    import_stats_t stats = {0};
+    CHECK(imports_resolve(&mgr, &vm, &exe.mod, &stats) == 0, "imports resolved");
+    CHECK(stats.total_imports == MANY_IMPORTS && stats.failed_imports == 0, "all imports bound");
+    CHECK(stats.lazy_imports > 0 && stats.lazy_imports < MANY_IMPORTS, "some deferred");
+    CHECK(stats.direct_imports == MANY_IMPORTS - stats.lazy_imports, "the rest bound now");
+
+    uint32_t free_slots = (stubs.stub_region_size - stubs.stub_alloc_ptr) / STUB_CODE_SIZE;
+    CHECK(free_slots >= STUB_LAZY_RESERVE, "reserve left free");
+    CHECK(stubs_generate_lazy_thunk(&stubs, 0) == 0, "no thunks out of the reserve");
+
+    /* Every known stub still fits */
+    uint32_t known = count_defs(ntdll_known_stubs) + count_defs(win32k_known_stubs);
+    CHECK(known <= STUB_LAZY_RESERVE, "reserve covers the stub tables");
+    bool all = true;
+    for (const stub_def_t *def = ntdll_known_stubs; def->name; def++) {
+        all &= stubs_get_or_create(&stubs, &vm, def) != 0;
+    }
+    for (const stub_def_t *def = win32k_known_stubs; def->name; def++) {
+        all &= stubs_get_or_create(&stubs, &vm, def) != 0;
+    }
+    CHECK(all, "every known stub generated after the thunks");
+
+    printf("%u imports: %u lazy, %u bound now, %u stub slots left of %u reserved\n",
+           MANY_IMPORTS, stats.lazy_imports, stats.direct_imports, free_slots,
+           STUB_LAZY_RESERVE);
+
+    free(exe.mod.pe.file_data);
+    teardown();
+}
+
+int main(void)
+{
+    phys_mem = calloc(1, PHYS_SIZE);
+    if (!phys_mem) {
+        return 1;
+    }
+
+    test_forwarders();
+    test_reserve();
+
+    free(phys_mem);
+    return test_finish();
+}
@@ -0,0 +1,233 @@
+/*
+ * Loader heap tests
+ *
+ * Runs the allocator against a fake guest address space: the heap grows
+ * past its initial commit in steps, stops at its reservation, hands out
+ * zeroed blocks, reuses and coalesces freed ones, and gives space back to
+ * the top. Then loads and unloads a few hundred modules' worth of LDR
+ * entries over and over, as a plugin host would, and checks the heap
+ * stops growing.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "loader/loader_heap.h"
+#include "test_util.h"
+
+#define BASE            0x7F100000
+#define RESERVE         (1024 * 1024)
+#define INITIAL         (16 * 1024)
+#define LDR_ENTRY_SIZE  0x50
+
+/* Fake guest memory: committed bytes start out as garbage, not zero */
+static uint8_t memory[RESERVE];
+static uint32_t committed;
+static int commits;
+static bool fail_commits;
+
+static int fake_commit(void *ctx, uint32_t va, uint32_t size)
+{
+    (void)ctx;
+    if (fail_commits || va != BASE + committed || size > RESERVE - committed) {
+        return -1;
+    }
+    memset(&memory[va - BASE], 0, size);
+    committed += size;
+    commits++;
+    return 0;
+}
+
+static void fake_clear(void *ctx, uint32_t va, uint32_t size)
+{
+    (void)ctx;
+    CHECK(va >= BASE && va - BASE + size <= committed, "clear inside committed memory");
+    memset(&memory[va - BASE], 0, size);
+}
+
+static bool is_zero(uint32_t va, uint32_t size)
+{
+    for (uint32_t i = 0; i < size; i++) {
+        if (memory[va - BASE + i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void scribble(uint32_t va, uint32_t size)
+{
+    memset(&memory[va - BASE], 0xA5, size);
+}
+
+static void init(loader_heap_t *heap)
+{
+    memset(memory, 0xCC, sizeof(memory));
+    committed = 0;
+    commits = 0;
+    fail_commits = false;
+    CHECK(loader_heap_init(heap, BASE, RESERVE, INITIAL, fake_commit, fake_clear, NULL) == 0,
+          "init");
+    CHECK(committed == INITIAL, "initial commit");
+}
+
+static void test_grow(void)
+{
+    loader_heap_t heap;
+    init(&heap);
+
+    uint32_t a = loader_heap_alloc(&heap, 3);
+    uint32_t b = loader_heap_alloc(&heap, 10);
+    CHECK(a == BASE && b == BASE + 4, "bump allocation, 4-byte aligned");
+
+    /* Past the initial commit */
+    uint32_t big = loader_heap_alloc(&heap, INITIAL);
+    CHECK(big == BASE + 16, "grown allocation");
+    CHECK(committed == INITIAL + LOADER_HEAP_COMMIT_STEP, "committed one step");
+    CHECK(is_zero(big, INITIAL), "grown memory zeroed");
+
+    /* Up to the reservation and no further */
+    uint32_t rest = RESERVE - heap.top;
+    CHECK(loader_heap_alloc(&heap, rest) != 0, "fill the reservation");
+    CHECK(committed == RESERVE, "whole reservation committed");
+    CHECK(loader_heap_alloc(&heap, 4) == 0, "reservation exhausted");
+    CHECK(loader_heap_alloc(&heap, 0xFFFFFFF0) == 0, "huge request");
+
+    loader_heap_destroy(&heap);
+
+    /* A failed commit fails the allocation, not the heap */
+    init(&heap);
+    fail_commits = true;
+    CHECK(loader_heap_alloc(&heap, INITIAL + 1) == 0, "commit failure");
+    fail_commits = false;
+    CHECK(loader_heap_alloc(&heap, INITIAL + 1) == BASE, "retry after commit failure");
+    loader_heap_destroy(&heap);
+}
+
+static void test_reuse(void)
+{
+    loader_heap_t heap;
+    init(&heap);
+
+    uint32_t a = loader_heap_alloc(&heap, 32);
+    uint32_t b = loader_heap_alloc(&heap, 32);
+    uint32_t c = loader_heap_alloc(&heap, 32);
+    uint32_t guard = loader_heap_alloc(&heap, 4);
+    scribble(a, 96);
+
+    /* Freed blocks are reused, zeroed */
+    loader_heap_free(&heap, b, 32);
+    CHECK(heap.free_count == 1 && heap.in_use == 68, "one free block");
+    CHECK(loader_heap_alloc(&heap, 20) == b, "reuse freed block");
+    CHECK(is_zero(b, 20), "reused block zeroed");
+    CHECK(heap.free_count == 1 && heap.free_blocks[0].va == b + 20, "remainder stays free");
+    loader_heap_free(&heap, b, 20);
+
+    /* Neighbours coalesce in any order */
+    loader_heap_free(&heap, a, 32);
+    loader_heap_free(&heap, c, 32);
+    CHECK(heap.free_count == 1 && heap.free_blocks[0].va == a &&
+          heap.free_blocks[0].size == 96, "coalesced");
+    CHECK(loader_heap_alloc(&heap, 96) == a, "coalesced block reused whole");
+    CHECK(heap.free_count == 0 && heap.reused == 2, "free list empty");
+
+    /* Best fit: the small hole, not the big one */
+    loader_heap_free(&heap, a, 96);
+    uint32_t small = loader_heap_alloc(&heap, 96);
+    CHECK(small == a, "refill");
+    uint32_t d = loader_heap_alloc(&heap, 200);
+    uint32_t e = loader_heap_alloc(&heap, 4);
+    CHECK(d && e, "big block below the top");
+    loader_heap_free(&heap, a + 64, 32);
+    loader_heap_free(&heap, d, 200);
+    CHECK(loader_heap_alloc(&heap, 24) == a + 64, "best fit");
+
+    /* Double and foreign frees are ignored */
+    uint32_t in_use = heap.in_use;
+    loader_heap_free(&heap, d, 200);
+    loader_heap_free(&heap, d + 8, 16);
+    loader_heap_free(&heap, BASE - 64, 32);
+    loader_heap_free(&heap, BASE + RESERVE - 4, 4);
+    CHECK(heap.in_use == in_use, "bad frees ignored");
+
+    (void)guard;
+    loader_heap_destroy(&heap);
+}
+
+static void test_top(void)
+{
+    loader_heap_t heap;
+    init(&heap);
+
+    uint32_t a = loader_heap_alloc(&heap, 64);
+    uint32_t b = loader_heap_alloc(&heap, 64);
+    uint32_t c = loader_heap_alloc(&heap, 64);
+    scribble(a, 192);
+
+    /* Freeing the last block lowers the top; freeing below merges in */
+    loader_heap_free(&heap, b, 64);
+    loader_heap_free(&heap, c, 64);
+    CHECK(heap.top == 64 && heap.free_count == 0, "free blocks returned to top");
+
+    /* Space below the high-water mark comes back zeroed */
+    uint32_t again = loader_heap_alloc(&heap, 128);
+    CHECK(again == b && is_zero(again, 128), "dirty top space cleared");
+
+    loader_heap_free(&heap, a, 64);
+    loader_heap_free(&heap, again, 128);
+    CHECK(heap.top == 0 && heap.in_use == 0, "heap empty");
+    loader_heap_destroy(&heap);
+}
+
+/* Plugin host: load 300 modules, unload them all, repeat */
+static void test_churn(void)
+{
+    loader_heap_t heap;
+    init(&heap);
+
+    enum { MODULES = 300, ROUNDS = 200 };
+    static uint32_t entry[MODULES], name[MODULES], name_size[MODULES];
+    uint32_t peak = 0;
+
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < MODULES; i++) {
+            name_size[i] = (uint32_t)(8 + (i * 7 + round) % 40) * 2;
+            entry[i] = loader_heap_alloc(&heap, LDR_ENTRY_SIZE);
+            name[i] = loader_heap_alloc(&heap, name_size[i]);
+            CHECK(entry[i] && name[i], "module allocations");
+            CHECK(is_zero(entry[i], LDR_ENTRY_SIZE), "fresh LDR entry");
+            scribble(entry[i], LDR_ENTRY_SIZE);
+            scribble(name[i], name_size[i]);
+        }
+        if (round == 0) {
+            peak = heap.top;
+        }
+
+        /* Unload in an order that leaves holes */
+        for (int i = 0; i < MODULES; i += 2) {
+            loader_heap_free(&heap, entry[i], LDR_ENTRY_SIZE);
+            loader_heap_free(&heap, name[i], name_size[i]);
+        }
+        for (int i = MODULES - 1; i > 0; i -= 2) {
+            loader_heap_free(&heap, name[i], name_size[i]);
+            loader_heap_free(&heap, entry[i], LDR_ENTRY_SIZE);
+        }
+        CHECK(heap.in_use == 0, "everything freed");
+    }
+
+    CHECK(heap.top == 0 && heap.free_count == 0, "fully coalesced");
+    CHECK(peak > INITIAL, "one round outgrows the initial commit");
+    CHECK(committed <= peak + 2 * LOADER_HEAP_COMMIT_STEP, "no growth across rounds");
+    loader_heap_destroy(&heap);
+}
+
+int main(void)
+{
+    test_grow();
+    test_reuse();
+    test_top();
+    test_churn();
+
+    return test_finish();
+}
@@ -0,0 +1,390 @@
+/*
+ * Module LDR entry tests
+ *
+ * Runs module.c against a fake guest (a flat physical memory and a page
+ * map for the loader heap and PEB): LDR entries are created into the
+ * PEB_LDR_DATA lists, module_free_ldr_entry unlinks them from every list
+ * they are on and gives their loader heap blocks back, and repeated
+ * load/unload cycles reuse those blocks instead of growing the heap.
+ * The module lookup indexes are checked too: case-folded name lookup, a
+ * later module shadowing an earlier one of the same name, and address
+ * lookup at image boundaries and in the gaps between images.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "loader/module.h"
+#include "loader/image_cache.h"
+#include "loader/exports.h"
+#include "vm/vm.h"
+#include "vm/paging.h"
+#include "cpu/mem.h"
+#include "process/process.h"
+#include "test_util.h"
+
+#define PHYS_BASE       0x00100000
+#define PHYS_SIZE       (16 * 1024 * 1024)
+#define VA_BASE         0x7F000000u
+#define VA_PAGES        4096
+#define PEB_VA          0x7FFDF000
+#define MODULES         8
+#define CHURN_MODULES   600
+
+/*
+ * Fake guest
+ */
+
+static uint8_t *phys_mem;
+static uint32_t page_map[VA_PAGES];     /* VA page -> physical page, 0 = unmapped */
+
+uint8_t *mem_phys_ptr(uint32_t addr, uint32_t size)
+{
+    if (addr < PHYS_BASE || addr - PHYS_BASE + size > PHYS_SIZE) {
+        return NULL;
+    }
+    return &phys_mem[addr - PHYS_BASE];
+}
+
+uint32_t mem_readl_phys(uint32_t addr)
+{
+    uint32_t val = 0;
+    uint8_t *p = mem_phys_ptr(addr, 4);
+    if (p) memcpy(&val, p, 4);
+    return val;
+}
+
+void mem_writeb_phys(uint32_t addr, uint8_t val)
+{
+    uint8_t *p = mem_phys_ptr(addr, 1);
+    if (p) *p = val;
+}
+
+void mem_writew_phys(uint32_t addr, uint16_t val)
+{
+    uint8_t *p = mem_phys_ptr(addr, 2);
+    if (p) memcpy(p, &val, 2);
+}
+
+void mem_writel_phys(uint32_t addr, uint32_t val)
+{
+    uint8_t *p = mem_phys_ptr(addr, 4);
+    if (p) memcpy(p, &val, 4);
+}
+
+uint32_t paging_alloc_phys(paging_context_t *ctx, uint32_t size)
+{
+    size = (size + PAGE_SIZE - 1) & PAGE_MASK;
+    if (ctx->phys_alloc_ptr + size > PHYS_BASE + PHYS_SIZE) {
+        return 0;
+    }
+    uint32_t addr = ctx->phys_alloc_ptr;
+    ctx->phys_alloc_ptr += size;
+    memset(mem_phys_ptr(addr, size), 0, size);
+    return addr;
+}
+
+int paging_map_range(paging_context_t *ctx, uint32_t virt, uint32_t phys,
+                     uint32_t size, uint32_t flags)
+{
+    (void)ctx;
+    (void)flags;
+    for (uint32_t off = 0; off < size; off += PAGE_SIZE) {
+        uint32_t page = (virt + off - VA_BASE) / PAGE_SIZE;
+        if (virt + off < VA_BASE || page >= VA_PAGES) {
+            return -1;
+        }
+        page_map[page] = phys + off;
+    }
+    return 0;
+}
+
+uint32_t paging_get_phys(paging_context_t *ctx, uint32_t virt)
+{
+    (void)ctx;
+    if (virt < VA_BASE || (virt - VA_BASE) / PAGE_SIZE >= VA_PAGES) {
+        return 0;
+    }
+    uint32_t page = page_map[(virt - VA_BASE) / PAGE_SIZE];
+    return page ? page + (virt & (PAGE_SIZE - 1)) : 0;
+}
+
+/* Module teardown is not under test */
+void image_cache_entry_free(image_cache_entry_t *entry) { (void)entry; }
+void exports_free(loaded_module_t *mod) { (void)mod; }
+void pe_free(pe_image_t *pe) { (void)pe; }
+
+/*
+ * Helpers
+ */
+
+static vm_context_t vm;
+static module_manager_t mgr;
+static loaded_module_t mods[MODULES];
+
+static uint32_t guest_l(uint32_t va)
+{
+    return mem_readl_phys(paging_get_phys(&vm.paging, va));
+}
+
+/* Walk a guest list from its head; returns the number of links, or -1 if broken */
+static int list_length(uint32_t head)
+{
+    int n = 0;
+    uint32_t prev = head;
+    for (uint32_t link = guest_l(head); link != head; link = guest_l(link)) {
+        if (link == 0 || guest_l(link + 4) != prev || ++n > 1000) {
+            return -1;
+        }
+        prev = link;
+    }
+    return guest_l(head + 4) == prev ? n : -1;
+}
+
+static bool list_contains(uint32_t head, uint32_t link)
+{
+    for (uint32_t l = guest_l(head); l != head && l != 0; l = guest_l(l)) {
+        if (l == link) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void setup(void)
+{
+    memset(&vm, 0, sizeof(vm));
+    memset(page_map, 0, sizeof(page_map));
+    memset(phys_mem, 0xCC, PHYS_SIZE);  /* Guest memory starts out dirty */
+    vm.paging.phys_alloc_ptr = PHYS_BASE;
+    vm.peb_addr = PEB_VA;
+
+    uint32_t peb_phys = paging_alloc_phys(&vm.paging, PAGE_SIZE);
+    paging_map_range(&vm.paging, PEB_VA, peb_phys, PAGE_SIZE, 0);
+
+    CHECK(module_manager_init(&mgr, &vm) == 0, "module_manager_init");
+    CHECK(module_init_peb_ldr(&mgr, &vm) == 0, "module_init_peb_ldr");
+    CHECK(guest_l(PEB_VA + PEB_LDR) == mgr.ldr_data_va, "PEB.Ldr");
+}
+
+static void create_module(loaded_module_t *mod, const char *name, uint32_t base)
+{
+    memset(mod, 0, sizeof(*mod));
+    snprintf(mod->name, sizeof(mod->name), "%s", name);
+    mod->base_va = base;
+    mod->size = 0x10000;
+    CHECK(module_create_ldr_entry(&mgr, &vm, mod) == 0, "module_create_ldr_entry");
+}
+
+static void test_unlink(void)
+{
+    setup();
+    uint32_t load_order = mgr.ldr_data_va + 0x0C;
+    uint32_t memory_order = mgr.ldr_data_va + 0x14;
+    uint32_t init_order = mgr.ldr_data_va + 0x1C;
+
+    /* A hash bucket, as LdrpHashTable would hold */
+    uint32_t bucket = module_heap_alloc(&mgr, 8);
+    mem_writel_phys(paging_get_phys(&vm.paging, bucket), bucket);
+    mem_writel_phys(paging_get_phys(&vm.paging, bucket + 4), bucket);
+    uint32_t baseline = mgr.heap.in_use;
+
+    char name[32];
+    for (int i = 0; i < MODULES; i++) {
+        snprintf(name, sizeof(name), "module%d.dll", i);
+        create_module(&mods[i], name, 0x10000000 + i * 0x100000);
+    }
+    CHECK(list_length(load_order) == MODULES, "load order list");
+    CHECK(list_length(memory_order) == MODULES, "memory order list");
+    CHECK(list_length(init_order) == 0, "nothing initialized yet");
+
+    /* Half have run DllMain; all are hashed */
+    for (int i = 0; i < MODULES; i += 2) {
+        list_insert_tail(&vm, init_order, mods[i].ldr_entry_va + 0x10);
+    }
+    for (int i = 0; i < MODULES; i++) {
+        list_insert_tail(&vm, bucket, mods[i].ldr_entry_va + 0x3C);
+    }
+    CHECK(list_length(init_order) == MODULES / 2, "init order list");
+    CHECK(list_length(bucket) == MODULES, "hash bucket");
+
+    /* Unload one initialized and one uninitialized module */
+    uint32_t in_use = mgr.heap.in_use;
+    uint32_t freed_entry = mods[2].ldr_entry_va;
+    uint32_t freed_name = mods[2].ldr_name_va;
+    module_free_ldr_entry(&mgr, &vm, &mods[2]);
+    module_free_ldr_entry(&mgr, &vm, &mods[5]);
+    CHECK(mods[2].ldr_entry_va == 0 && mods[2].ldr_name_va == 0, "entry forgotten");
+    CHECK(list_length(load_order) == MODULES - 2, "unlinked from load order");
+    CHECK(list_length(memory_order) == MODULES - 2, "unlinked from memory order");
+    CHECK(list_length(init_order) == MODULES / 2 - 1, "unlinked from init order");
+    CHECK(list_length(bucket) == MODULES - 2, "unlinked from hash bucket");
+    CHECK(!list_contains(load_order, freed_entry), "freed entry not reachable");
+    CHECK(list_contains(load_order, mods[3].ldr_entry_va), "neighbours still linked");
+    CHECK(mgr.heap.in_use < in_use, "heap blocks returned");
+
+    /* A second free of the same module changes nothing */
+    in_use = mgr.heap.in_use;
+    module_free_ldr_entry(&mgr, &vm, &mods[2]);
+    CHECK(mgr.heap.in_use == in_use, "double free ignored");
+    CHECK(list_length(load_order) == MODULES - 2, "lists intact after double free");
+
+    /* The next load reuses the freed blocks, zeroed */
+    uint32_t reused = mgr.heap.reused;
+    create_module(&mods[2], "module2.dll", 0x10200000);
+    CHECK(mgr.heap.reused == reused + 2, "blocks reused");
+    CHECK(mods[2].ldr_entry_va == freed_entry || mods[2].ldr_name_va == freed_name,
+          "freed addresses handed out again");
+    CHECK(guest_l(mods[2].ldr_entry_va + 0x18) == 0x10200000, "new DllBase");
+    CHECK(list_length(load_order) == MODULES - 1, "relinked");
+
+    for (int i = 0; i < MODULES; i++) {
+        module_free_ldr_entry(&mgr, &vm, &mods[i]);
+    }
+    CHECK(list_length(load_order) == 0 && list_length(memory_order) == 0 &&
+          list_length(init_order) == 0 && list_length(bucket) == 0, "all lists empty");
+    CHECK(mgr.heap.in_use == baseline, "only PEB_LDR_DATA and the bucket left");
+
+    module_manager_free(&mgr);
+}
+
+/* Loading and unloading the same set over and over does not grow the heap */
+static void test_churn(void)
+{
+    setup();
+    static loaded_module_t churn[CHURN_MODULES];
+    uint32_t committed = 0;
+    char name[64];
+
+    for (int round = 0; round < 50; round++) {
+        for (int i = 0; i < CHURN_MODULES; i++) {
+            snprintf(name, sizeof(name), "plugin_%d_%d.dll", i, round % 7);
+            create_module(&churn[i], name, 0x20000000 + i * 0x10000);
+        }
+        if (round == 0) {
+            committed = mgr.heap.committed;
+        }
+        for (int i = 0; i < CHURN_MODULES; i++) {
+            module_free_ldr_entry(&mgr, &vm, &churn[(i * 7) % CHURN_MODULES]);
+        }
+        CHECK(list_length(mgr.ldr_data_va + 0x0C) == 0, "load order empty");
+    }
+
+    CHECK(committed > LOADER_HEAP_SIZE, "one round outgrows the initial commit");
+    CHECK(mgr.heap.committed == committed, "no growth across rounds");
+    module_manager_free(&mgr);
+}
+
+/* Modules added to the manager are owned (and freed) by it */
+static loaded_module_t *add_module(const char *name, uint32_t base, uint32_t size)
+{
+    loaded_module_t *mod = calloc(1, sizeof(*mod));
+    if (!mod) {
+        return NULL;
+    }
+    snprintf(mod->name, sizeof(mod->name), "%s", name);
+    mod->base_va = base;
+    mod->size = size;
+    CHECK(module_manager_add(&mgr, mod) == 0, "module_manager_add");
+    return mod;
+}
+
+/* Name lookup: case folding, directories, shadowing, misses, growth */
+static void test_find_by_name(void)
+{
+    setup();
+    char name[64];
+
+    CHECK(module_find_by_name(&mgr, "ntdll.dll") == NULL, "empty manager misses");
+
+    loaded_module_t *ntdll = add_module("C:\\Windows\\System32\\ntdll.dll", 0x7C900000, 0xB0000);
+    loaded_module_t *k32 = add_module("/opt/dlls/Kernel32.DLL", 0x7C800000, 0xF6000);
+    CHECK(module_find_by_name(&mgr, "ntdll.dll") == ntdll, "found by base name");
+    CHECK(module_find_by_name(&mgr, "NTDLL.DLL") == ntdll, "lookup folds case");
+    CHECK(module_find_by_name(&mgr, "kernel32.dll") == k32, "stored name folds case");
+    CHECK(module_find_by_name(&mgr, "c:\\windows\\KERNEL32.dll") == k32,
+          "directories in the query ignored");
+    CHECK(module_find_by_name(&mgr, "/usr/lib/wine/ntdll.dll") == ntdll,
+          "unix directories in the query ignored");
+    CHECK(module_find_by_name(&mgr, "ntdll") == NULL, "name without extension misses");
+    CHECK(module_find_by_name(&mgr, "ntdll.dll2") == NULL, "longer name misses");
+    CHECK(module_find_by_name(&mgr, "kernel33.dll") == NULL, "near miss misses");
+    CHECK(module_find_by_name(&mgr, "") == NULL, "empty name misses");
+
+    /* A later module of the same name shadows the first */
+    loaded_module_t *k32_again = add_module("KERNEL32.dll", 0x10000000, 0x1000);
+    CHECK(module_find_by_name(&mgr, "kernel32.dll") == k32_again, "later module shadows");
+    CHECK(module_find_by_base(&mgr, 0x7C800000) == k32, "shadowed module still found by base");
+
+    /* Grow the index well past its initial size; the shadowing survives */
+    static loaded_module_t *many[CHURN_MODULES];
+    for (int i = 0; i < CHURN_MODULES; i++) {
+        snprintf(name, sizeof(name), "Plugin%03d.dll", i);
+        many[i] = add_module(name, 0x20000000 + i * 0x10000, 0x8000);
+    }
+    CHECK(mgr.name_index_mask + 1 >= 2 * mgr.module_count, "name index at most half full");
+    CHECK(module_find_by_name(&mgr, "kernel32.dll") == k32_again, "shadowing kept across growth");
+    CHECK(module_find_by_name(&mgr, "ntdll.dll") == ntdll, "ntdll kept across growth");
+
+    int found = 0;
+    for (int i = 0; i < CHURN_MODULES; i++) {
+        snprintf(name, sizeof(name), "PLUGIN%03d.DLL", i);
+        found += module_find_by_name(&mgr, name) == many[i];
+    }
+    CHECK(found == CHURN_MODULES, "every module found after growth");
+    CHECK(module_find_by_name(&mgr, "plugin600.dll") == NULL, "miss after growth");
+
+    module_manager_free(&mgr);
+}
+
+/* Address lookup at image boundaries, in gaps and outside every image */
+static void test_find_by_address(void)
+{
+    setup();
+
+    CHECK(module_find_by_address(&mgr, 0x00400000) == NULL, "empty manager misses");
+
+    /* Added out of address order; b and c are adjacent, gaps around them */
+    loaded_module_t *c = add_module("c.dll", 0x10030000, 0x10000);
+    loaded_module_t *a = add_module("a.dll", 0x10000000, 0x8000);
+    loaded_module_t *d = add_module("d.dll", 0x20000000, 0x1000);
+    loaded_module_t *b = add_module("b.dll", 0x10020000, 0x10000);
+
+    CHECK(module_find_by_address(&mgr, 0) == NULL, "null address misses");
+    CHECK(module_find_by_address(&mgr, 0x0FFFFFFF) == NULL, "below every image misses");
+    CHECK(module_find_by_address(&mgr, 0x10000000) == a, "first byte of an image");
+    CHECK(module_find_by_address(&mgr, 0x10007FFF) == a, "last byte of an image");
+    CHECK(module_find_by_address(&mgr, 0x10008000) == NULL, "one past the end misses");
+    CHECK(module_find_by_address(&mgr, 0x10010000) == NULL, "middle of a gap misses");
+    CHECK(module_find_by_address(&mgr, 0x1001FFFF) == NULL, "last byte of a gap misses");
+    CHECK(module_find_by_address(&mgr, 0x10020000) == b, "image after a gap");
+    CHECK(module_find_by_address(&mgr, 0x1002FFFF) == b, "end of the lower adjacent image");
+    CHECK(module_find_by_address(&mgr, 0x10030000) == c, "start of the upper adjacent image");
+    CHECK(module_find_by_address(&mgr, 0x10035000) == c, "inside an image");
+    CHECK(module_find_by_address(&mgr, 0x10040000) == NULL, "after adjacent images misses");
+    CHECK(module_find_by_address(&mgr, 0x20000FFF) == d, "last byte of the highest image");
+    CHECK(module_find_by_address(&mgr, 0x20001000) == NULL, "above every image misses");
+    CHECK(module_find_by_address(&mgr, 0xFFFFFFFF) == NULL, "top of memory misses");
+
+    CHECK(module_find_by_base(&mgr, 0x10020000) == b, "found by base");
+    CHECK(module_find_by_base(&mgr, 0x10020001) == NULL, "base lookup is exact");
+
+    module_manager_free(&mgr);
+}
+
+int main(void)
+{
+    phys_mem = malloc(PHYS_SIZE);
+    if (!phys_mem) {
+        return 1;
+    }
+
+    test_unlink();
+    test_churn();
+    test_find_by_name();
+    test_find_by_address();
+
+    free(phys_mem);
+    return test_finish();
+}
@@ -0,0 +1,311 @@
+/*
+ * PE image mapping benchmark
+ *
+ * Synthesizes a 20 MB set of DLL images (code sections dense with HIGHLOW
+ * fixups, data, BSS) and lays them out rebased, once with pe_map_image and
+ * pe_relocate_image and once the way the loader used to: byte stores for
+ * the sections and a file-offset translation per relocation entry. The two
+ * layouts must be identical. Also checks HIGH/LOW/HIGHADJ fixups and that
+ * malformed images are rejected.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "pe/pe_loader.h"
+#include "test_util.h"
+
+#define NUM_DLLS        10
+#define DLL_SIZE        (2 * 1024 * 1024)
+#define IMAGE_BASE      0x10000000
+#define LOAD_BASE       0x6F000000
+#define MAP_ROUNDS      3
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef struct {
+    pe_image_t pe;
+    pe_section_t sections[4];
+    uint32_t fixups;
+} fake_dll_t;
+
+static fake_dll_t dlls[NUM_DLLS];
+
+/*
+ * .text (a fixup every 16 bytes), .data, .bss (no raw data) and .reloc,
+ * file-aligned at 0x200 and section-aligned at 0x1000
+ */
+static void build_dll(fake_dll_t *dll, uint32_t seed)
+{
+    uint32_t text_size = DLL_SIZE * 3 / 4;
+    uint32_t data_size = DLL_SIZE / 8;
+    uint32_t bss_size = 0x40000;
+    uint32_t pages = text_size / 0x1000;
+    uint32_t per_page = 0x1000 / 16;
+    uint32_t reloc_size = pages * (8 + per_page * 2);
+
+    memset(dll, 0, sizeof(*dll));
+
+    uint32_t text_raw = 0x400;
+    uint32_t data_raw = text_raw + text_size;
+    uint32_t reloc_raw = data_raw + data_size;
+    uint32_t file_size = reloc_raw + reloc_size;
+
+    uint32_t text_rva = 0x1000;
+    uint32_t data_rva = text_rva + text_size;
+    uint32_t bss_rva = data_rva + data_size;
+    uint32_t reloc_rva = bss_rva + bss_size;
+
+    uint8_t *file = malloc(file_size);
+    for (uint32_t i = 0; i < file_size; i++) {
+        seed = seed * 1103515245 + 12345;
+        file[i] = (uint8_t)(seed >> 16);
+    }
+
+    /* Fixups point at absolute addresses inside the image */
+    uint8_t *reloc = file + reloc_raw;
+    for (uint32_t p = 0; p < pages; p++) {
+        uint32_t page_rva = text_rva + p * 0x1000;
+        uint32_t block_size = 8 + per_page * 2;
+        memcpy(reloc, &page_rva, 4);
+        memcpy(reloc + 4, &block_size, 4);
+        for (uint32_t e = 0; e < per_page; e++) {
+            uint16_t entry = (uint16_t)((IMAGE_REL_BASED_HIGHLOW << 12) | (e * 16));
+            memcpy(reloc + 8 + e * 2, &entry, 2);
+            uint32_t target = IMAGE_BASE + text_rva + (p * 0x1000 + e * 16) % text_size;
+            memcpy(file + text_raw + p * 0x1000 + e * 16, &target, 4);
+        }
+        reloc += block_size;
+        dll->fixups += per_page;
+    }
+
+    static const char *names[4] = { ".text", ".data", ".bss", ".reloc" };
+    const uint32_t rva[4] = { text_rva, data_rva, bss_rva, reloc_rva };
+    const uint32_t vsize[4] = { text_size, data_size + 0x123, bss_size, reloc_size };
+    const uint32_t raw[4] = { text_raw, data_raw, 0, reloc_raw };
+    const uint32_t rsize[4] = { text_size, data_size, 0, reloc_size };
+    for (int i = 0; i < 4; i++) {
+        snprintf(dll->sections[i].name, sizeof(dll->sections[i].name), "%s", names[i]);
+        dll->sections[i].virtual_address = rva[i];
+        dll->sections[i].virtual_size = vsize[i];
+        dll->sections[i].raw_offset = raw[i];
+        dll->sections[i].raw_size = rsize[i];
+    }
+
+    dll->pe.file_data = file;
+    dll->pe.file_size = file_size;
+    dll->pe.image_base = IMAGE_BASE;
+    dll->pe.size_of_headers = 0x400;
+    dll->pe.size_of_image = (reloc_rva + reloc_size + 0xFFF) & ~0xFFFu;
+    dll->pe.num_sections = 4;
+    dll->pe.sections = dll->sections;
+    dll->pe.data_dirs[IMAGE_DIRECTORY_ENTRY_BASERELOC].virtual_address = reloc_rva;
+    dll->pe.data_dirs[IMAGE_DIRECTORY_ENTRY_BASERELOC].size = reloc_size;
+}
+
+/* Stand-ins for the physical memory accessors the loader went through */
+static uint8_t *phys;
+static uint32_t phys_size;
+
+static __attribute__((noinline)) void writeb_phys(uint32_t addr, uint8_t val)
+{
+    if (addr < phys_size)
+        phys[addr] = val;
+}
+
+static __attribute__((noinline)) uint32_t readl_phys(uint32_t addr)
+{
+    uint32_t val = 0;
+    if (addr + 3 < phys_size)
+        memcpy(&val, &phys[addr], 4);
+    return val;
+}
+
+static __attribute__((noinline)) void writel_phys(uint32_t addr, uint32_t val)
+{
+    if (addr + 3 < phys_size)
+        memcpy(&phys[addr], &val, 4);
+}
+
+/* The loader's layout before bulk mapping, into a zeroed image */
+static void reference_map(const pe_image_t *pe, uint8_t *image, uint32_t new_base)
+{
+    phys = image;
+    phys_size = pe->size_of_image;
+
+    for (uint32_t i = 0; i < pe->size_of_headers; i++) {
+        writeb_phys(i, pe->file_data[i]);
+    }
+    for (int s = 0; s < pe->num_sections; s++) {
+        const pe_section_t *sec = &pe->sections[s];
+        uint32_t copy_size = sec->raw_size < sec->virtual_size ? sec->raw_size : sec->virtual_size;
+        for (uint32_t j = 0; j < copy_size; j++) {
+            writeb_phys(sec->virtual_address + j, pe->file_data[sec->raw_offset + j]);
+        }
+        for (uint32_t j = copy_size; j < sec->virtual_size; j++) {
+            writeb_phys(sec->virtual_address + j, 0);
+        }
+    }
+
+    uint32_t reloc_rva = pe->data_dirs[IMAGE_DIRECTORY_ENTRY_BASERELOC].virtual_address;
+    uint32_t reloc_size = pe->data_dirs[IMAGE_DIRECTORY_ENTRY_BASERELOC].size;
+    uint32_t delta = new_base - pe->image_base;
+    uint32_t offset = 0;
+    while (offset < reloc_size) {
+        uint32_t block_rva = *(uint32_t *)(pe->file_data +
+                              pe_rva_to_file_offset(pe, reloc_rva + offset));
+        uint32_t block_size = *(uint32_t *)(pe->file_data +
+                               pe_rva_to_file_offset(pe, reloc_rva + offset + 4));
+        if (block_size == 0)
+            break;
+        uint32_t entry_count = (block_size - 8) / 2;
+        for (uint32_t i = 0; i < entry_count; i++) {
+            uint16_t entry = *(uint16_t *)(pe->file_data +
+                              pe_rva_to_file_offset(pe, reloc_rva + offset + 8 + i * 2));
+            if ((entry >> 12) == IMAGE_REL_BASED_HIGHLOW) {
+                uint32_t addr = block_rva + (entry & 0xFFF);
+                writel_phys(addr, readl_phys(addr) + delta);
+            }
+        }
+        offset += block_size;
+    }
+}
+
+static void bench_mapping(void)
+{
+    uint64_t total = 0;
+    uint32_t fixups = 0;
+    uint32_t max_image = 0;
+
+    for (int d = 0; d < NUM_DLLS; d++) {
+        build_dll(&dlls[d], 0x1234 + d);
+        total += dlls[d].pe.file_size;
+        fixups += dlls[d].fixups;
+        if (dlls[d].pe.size_of_image > max_image) {
+            max_image = dlls[d].pe.size_of_image;
+        }
+    }
+
+    uint8_t *fast = malloc(max_image);
+    uint8_t *slow = malloc(max_image);
+    double best_fast = 1e9, best_slow = 1e9;
+
+    for (int round = 0; round < MAP_ROUNDS; round++) {
+        double t_fast = 0, t_slow = 0;
+        for (int d = 0; d < NUM_DLLS; d++) {
+            const pe_image_t *pe = &dlls[d].pe;
+
+            /* Zeroing stands in for paging_alloc_phys and is timed with both */
+            double start = now_sec();
+            memset(fast, 0, pe->size_of_image);
+            CHECK(pe_map_image(pe, fast) == 0, "map image");
+            CHECK(pe_relocate_image(pe, fast, LOAD_BASE) == (int)dlls[d].fixups, "all fixups applied");
+            t_fast += now_sec() - start;
+
+            start = now_sec();
+            memset(slow, 0, pe->size_of_image);
+            reference_map(pe, slow, LOAD_BASE);
+            t_slow += now_sec() - start;
+
+            if (round == 0) {
+                CHECK(memcmp(fast, slow, pe->size_of_image) == 0, "same layout as the byte loop");
+            }
+        }
+        if (t_fast < best_fast) best_fast = t_fast;
+        if (t_slow < best_slow) best_slow = t_slow;
+    }
+
+    printf("map %d DLLs (%.1f MB, %u fixups): bulk %.2f ms, byte loop %.2f ms (%.0fx)\n",
+           NUM_DLLS, total / (1024.0 * 1024.0), fixups, best_fast * 1e3, best_slow * 1e3,
+           best_fast > 0 ? best_slow / best_fast : 0.0);
+    CHECK(best_fast < best_slow, "bulk mapping beats the byte loop");
+
+    free(fast);
+    free(slow);
+    for (int d = 0; d < NUM_DLLS; d++) {
+        free(dlls[d].pe.file_data);
+    }
+}
+
+/* HIGH, LOW, HIGHADJ and ABSOLUTE entries, and rejected images */
+static void test_fixup_types(void)
+{
+    uint8_t file[0x2000] = {0};
+    pe_section_t sec = { .name = ".text", .virtual_address = 0x1000, .virtual_size = 0x1000,
+                         .raw_offset = 0x1000, .raw_size = 0x1000 };
+    pe_image_t pe = {
+        .file_data = file, .file_size = sizeof(file), .image_base = 0x10000000,
+        .size_of_headers = 0x400, .size_of_image = 0x2000, .num_sections = 1, .sections = &sec,
+    };
+
+    uint8_t *text = file + 0x1000;
+    uint32_t v32 = 0x10001234;
+    uint16_t hi = 0x1000, lo = 0x5678, adj = 0x1234;
+    memcpy(text + 0x00, &v32, 4);
+    memcpy(text + 0x10, &hi, 2);
+    memcpy(text + 0x20, &lo, 2);
+    memcpy(text + 0x30, &adj, 2);
+
+    /* One block at RVA 0x1000, placed at RVA 0x1800 */
+    uint16_t entries[] = {
+        (IMAGE_REL_BASED_HIGHLOW << 12) | 0x00,
+        (IMAGE_REL_BASED_HIGH << 12) | 0x10,
+        (IMAGE_REL_BASED_LOW << 12) | 0x20,
+        (IMAGE_REL_BASED_HIGHADJ << 12) | 0x30, 0x9000,   /* Low half 0x9000 (negative) */
+        (IMAGE_REL_BASED_ABSOLUTE << 12),
+    };
+    uint32_t page = 0x1000, size = 8 + sizeof(entries);
+    memcpy(text + 0x800, &page, 4);
+    memcpy(text + 0x804, &size, 4);
+    memcpy(text + 0x808, entries, sizeof(entries));
+    pe.data_dirs[IMAGE_DIRECTORY_ENTRY_BASERELOC].virtual_address = 0x1800;
+    pe.data_dirs[IMAGE_DIRECTORY_ENTRY_BASERELOC].size = size;
+
+    uint8_t image[0x2000] = {0};
+    CHECK(pe_map_image(&pe, image) == 0, "map small image");
+    CHECK(pe_relocate_image(&pe, image, 0x10000000) == 0, "no fixups at the preferred base");
+    CHECK(pe_relocate_image(&pe, image, 0x20018000) == 4, "four fixups, padding skipped");
+
+    memcpy(&v32, image + 0x1000, 4);
+    memcpy(&hi, image + 0x1010, 2);
+    memcpy(&lo, image + 0x1020, 2);
+    memcpy(&adj, image + 0x1030, 2);
+    CHECK(v32 == 0x20019234, "HIGHLOW");
+    CHECK(hi == 0x2001, "HIGH");
+    CHECK(lo == 0xD678, "LOW");
+    CHECK(adj == (uint16_t)((((0x1234u << 16) + 0xFFFF9000u) + 0x10018000u + 0x8000u) >> 16),
+          "HIGHADJ");
+
+    /* A section running past the end of the file is rejected */
+    pe_section_t bad = sec;
+    bad.raw_size = 0x2000;
+    bad.virtual_size = 0x2000;
+    pe.sections = &bad;
+    pe.size_of_image = 0x3000;
+    uint8_t big[0x3000] = {0};
+    CHECK(pe_map_image(&pe, big) != 0, "section past end of file");
+
+    /* So is a relocation block claiming more than the directory */
+    pe.sections = &sec;
+    pe.size_of_image = 0x2000;
+    memset(image, 0, sizeof(image));
+    size = 0x100;
+    memcpy(file + 0x1804, &size, 4);
+    CHECK(pe_map_image(&pe, image) == 0, "remap");
+    CHECK(pe_relocate_image(&pe, image, 0x20000000) < 0, "oversized relocation block");
+}
+
+int main(void)
+{
+    bench_mapping();
+    test_fixup_types();
+
+    return test_finish();
+}
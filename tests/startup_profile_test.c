@@ -0,0 +1,150 @@
+/*
+ * Startup profiler tests
+ *
+ * Drives the profiler with a fake instruction counter: nested phases are
+ * charged self time and self instructions only, repeated phases add up,
+ * frames left open by an error path are dropped, records come out slowest
+ * first, and the first window closes the program phase and writes JSON.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "vm/startup_profile.h"
+#include "test_util.h"
+
+static uint64_t instructions;
+
+static void sleep_ms(long ms)
+{
+    struct timespec ts = { 0, ms * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+static const profile_record_t *find(const startup_profile_t *sp, const char *module,
+                                    profile_phase_t phase)
+{
+    for (uint32_t i = 0; i < sp->record_count; i++) {
+        if (sp->records[i].phase == phase && strcmp(sp->records[i].module, module) == 0) {
+            return &sp->records[i];
+        }
+    }
+    return NULL;
+}
+
+static void test_disabled(void)
+{
+    /* A NULL profile is a no-op everywhere */
+    int mark = startup_profile_begin(NULL);
+    startup_profile_end(NULL, mark, "a.dll", PROFILE_PHASE_PARSE);
+    startup_profile_enter_program(NULL, "app.exe");
+    startup_profile_first_window(NULL);
+    startup_profile_finish(NULL);
+    startup_profile_free(NULL);
+    CHECK(mark < 0, "disabled mark");
+}
+
+static void test_nesting(void)
+{
+    startup_profile_t *sp = startup_profile_create(&instructions, NULL);
+    CHECK(sp != NULL, "create");
+
+    /* Resolving the exe's imports loads and initializes a DLL twice over */
+    int outer = startup_profile_begin(sp);
+    instructions += 100;
+    for (int i = 0; i < 2; i++) {
+        int inner = startup_profile_begin(sp);
+        instructions += 40;
+        sleep_ms(10);
+        startup_profile_end(sp, inner, "a.dll", PROFILE_PHASE_DLL_MAIN);
+    }
+    instructions += 5;
+    startup_profile_end(sp, outer, "app.exe", PROFILE_PHASE_IMPORTS);
+    CHECK(sp->depth == 0, "all frames closed");
+
+    const profile_record_t *dll = find(sp, "a.dll", PROFILE_PHASE_DLL_MAIN);
+    const profile_record_t *exe = find(sp, "app.exe", PROFILE_PHASE_IMPORTS);
+    CHECK(dll && exe, "records exist");
+    CHECK(dll && dll->calls == 2, "repeated phase merged");
+    CHECK(dll && dll->instructions == 80, "nested instructions");
+    CHECK(exe && exe->instructions == 105, "self instructions only");
+    CHECK(dll && dll->ns >= 20000000, "nested time");
+    CHECK(dll && exe && exe->ns < dll->ns, "self time excludes nested phases");
+
+    /* An error path leaves a frame open; the enclosing end drops it */
+    outer = startup_profile_begin(sp);
+    startup_profile_begin(sp);
+    startup_profile_end(sp, outer, "b.dll", PROFILE_PHASE_MAP);
+    CHECK(sp->depth == 0, "abandoned frame dropped");
+    CHECK(find(sp, "b.dll", PROFILE_PHASE_MAP) != NULL, "enclosing phase recorded");
+
+    /* Ending a mark twice does nothing */
+    startup_profile_end(sp, outer, "b.dll", PROFILE_PHASE_MAP);
+    CHECK(find(sp, "b.dll", PROFILE_PHASE_MAP)->calls == 1, "stale mark ignored");
+
+    startup_profile_sort(sp);
+    for (uint32_t i = 1; i < sp->record_count; i++) {
+        CHECK(sp->records[i - 1].ns >= sp->records[i].ns, "slowest first");
+    }
+    CHECK(strcmp(sp->records[0].module, "a.dll") == 0, "slowest record first");
+
+    startup_profile_free(sp);
+}
+
+static void test_first_window(void)
+{
+    char path[] = "/tmp/wbox_startup_profile_test.XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0, "mkstemp");
+    close(fd);
+
+    startup_profile_t *sp = startup_profile_create(&instructions, path);
+    int mark = startup_profile_begin(sp);
+    instructions += 7;
+    startup_profile_end(sp, mark, "k\"32.dll", PROFILE_PHASE_DLL_MAIN);
+
+    startup_profile_enter_program(sp, "app.exe");
+    instructions += 1000;
+    mark = startup_profile_begin(sp);
+    instructions += 10;
+    startup_profile_end(sp, mark, "late.dll", PROFILE_PHASE_PARSE);
+    startup_profile_first_window(sp);
+
+    const profile_record_t *win = find(sp, "app.exe", PROFILE_PHASE_FIRST_WINDOW);
+    CHECK(win && win->instructions == 1000, "program phase until first window");
+    CHECK(sp->first_window_ns != 0, "first window time");
+    CHECK(sp->finished && sp->depth == 0, "finished at first window");
+
+    /* A second window changes nothing */
+    startup_profile_first_window(sp);
+    CHECK(win && win->calls == 1, "only the first window counts");
+    startup_profile_free(sp);
+
+    FILE *f = fopen(path, "r");
+    CHECK(f != NULL, "JSON written");
+    char json[4096] = {0};
+    if (f) {
+        fread(json, 1, sizeof(json) - 1, f);
+        fclose(f);
+    }
+    unlink(path);
+
+    CHECK(json[0] == '{', "JSON object");
+    CHECK(strstr(json, "\"first_window_ms\": null") == NULL, "first window time in JSON");
+    CHECK(strstr(json, "\"module\": \"app.exe\", \"phase\": \"first_window\"") != NULL,
+          "program record in JSON");
+    CHECK(strstr(json, "\"module\": \"k\\\"32.dll\"") != NULL, "names escaped");
+    CHECK(strstr(json, "\"instructions\": 1000") != NULL, "instructions in JSON");
+}
+
+int main(void)
+{
+    test_disabled();
+    test_nesting();
+    test_first_window();
+
+    return test_finish();
+}
@@ -0,0 +1,255 @@
+/*
+ * Stub registry tests
+ *
+ * Runs the stub manager against a fake guest: the name registry grows and
+ * rehashes past its initial capacity with every stub still found at its
+ * address, names that were never generated (prefixes, near misses, the
+ * empty name) miss, a name is only registered once, and the definition
+ * table index agrees with a linear scan, first entry winning for
+ * duplicate names.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "loader/stubs.h"
+#include "loader/module.h"
+#include "loader/ntdll_stubs.h"
+#include "loader/win32k_stubs.h"
+#include "vm/vm.h"
+#include "vm/paging.h"
+#include "cpu/mem.h"
+#include "test_util.h"
+
+#define PHYS_BASE       0x00100000
+#define PHYS_SIZE       (1024 * 1024)
+#define MANY_STUBS      3000
+#define MANY_DEFS       1500
+
+/*
+ * Fake guest
+ */
+
+static uint8_t *phys_mem;
+
+static uint8_t *phys_ptr(uint32_t addr, uint32_t size)
+{
+    if (addr < PHYS_BASE || addr - PHYS_BASE + size > PHYS_SIZE) {
+        return NULL;
+    }
+    return &phys_mem[addr - PHYS_BASE];
+}
+
+void mem_writeb_phys(uint32_t addr, uint8_t val)
+{
+    uint8_t *p = phys_ptr(addr, 1);
+    if (p) *p = val;
+}
+
+void mem_writew_phys(uint32_t addr, uint16_t val)
+{
+    uint8_t *p = phys_ptr(addr, 2);
+    if (p) memcpy(p, &val, 2);
+}
+
+void mem_writel_phys(uint32_t addr, uint32_t val)
+{
+    uint8_t *p = phys_ptr(addr, 4);
+    if (p) memcpy(p, &val, 4);
+}
+
+uint32_t paging_alloc_phys(paging_context_t *ctx, uint32_t size)
+{
+    size = (size + PAGE_SIZE - 1) & PAGE_MASK;
+    if (ctx->phys_alloc_ptr + size > PHYS_BASE + PHYS_SIZE) {
+        return 0;
+    }
+    uint32_t addr = ctx->phys_alloc_ptr;
+    ctx->phys_alloc_ptr += size;
+    return addr;
+}
+
+int paging_map_page(paging_context_t *ctx, uint32_t virt, uint32_t phys, uint32_t flags)
+{
+    (void)ctx;
+    (void)virt;
+    (void)phys;
+    (void)flags;
+    return 0;
+}
+
+/*
+ * Helpers
+ */
+
+static vm_context_t vm;
+static stub_manager_t mgr;
+
+static void init(void)
+{
+    memset(&vm, 0, sizeof(vm));
+    vm.paging.phys_alloc_ptr = PHYS_BASE;
+    CHECK(stubs_init(&mgr, &vm) == 0, "stubs_init");
+}
+
+static void stub_name(char *buf, size_t size, int i)
+{
+    snprintf(buf, size, "NtStub%dEx", i);
+}
+
+/*
+ * Tests
+ */
+
+/* Thousands of stubs through growth and rehash, then misses */
+static void test_registry(void)
+{
+    char name[32];
+    static uint32_t va[MANY_STUBS];
+
+    init();
+    uint32_t initial_capacity = mgr.registry_capacity;
+
+    CHECK(stubs_lookup(&mgr, "NtClose") == 0, "lookup in an empty registry misses");
+
+    for (int i = 0; i < MANY_STUBS; i++) {
+        stub_name(name, sizeof(name), i);
+        stub_def_t def = { name, STUB_TYPE_SYSCALL, (uint32_t)i, 0, i % 8 };
+        va[i] = stubs_get_or_create(&mgr, &vm, &def);
+        if (!va[i]) {
+            CHECK(false, "stub generated");
+            break;
+        }
+
+        /* Earlier entries stay reachable across every rehash */
+        if ((i & (i - 1)) == 0) {
+            for (int j = 0; j <= i; j++) {
+                stub_name(name, sizeof(name), j);
+                if (stubs_lookup(&mgr, name) != va[j]) {
+                    CHECK(false, "stub found after growth");
+                    break;
+                }
+            }
+        }
+    }
+
+    CHECK(mgr.registry_count == MANY_STUBS, "every stub registered once");
+    CHECK(mgr.registry_capacity > initial_capacity, "registry grew");
+    CHECK(mgr.registry_index_mask + 1 >= 2 * mgr.registry_count, "index at most half full");
+    CHECK(va[1] == va[0] + STUB_CODE_SIZE, "stubs packed in the region");
+
+    int found = 0;
+    for (int i = 0; i < MANY_STUBS; i++) {
+        stub_name(name, sizeof(name), i);
+        found += stubs_lookup(&mgr, name) == va[i];
+    }
+    CHECK(found == MANY_STUBS, "every stub found at its address");
+
+    /* The generated code is the syscall stub for its number */
+    uint8_t *code = phys_ptr(mgr.stub_region_phys + (va[77] - mgr.stub_region_va), STUB_CODE_SIZE);
+    uint32_t num;
+    memcpy(&num, code + 1, 4);
+    CHECK(code[0] == 0xB8 && num == 77 && code[7] == 0x0F && code[8] == 0x34,
+          "stub code for its syscall number");
+
+    /* Misses: never generated, prefixes, extensions, case, empty */
+    CHECK(stubs_lookup(&mgr, "NtStub3000Ex") == 0, "unknown name misses");
+    CHECK(stubs_lookup(&mgr, "NtStub1") == 0, "prefix misses");
+    CHECK(stubs_lookup(&mgr, "NtStub1Ex2") == 0, "extension misses");
+    CHECK(stubs_lookup(&mgr, "ntstub1ex") == 0, "lookup is case-sensitive");
+    CHECK(stubs_lookup(&mgr, "") == 0, "empty name misses");
+
+    /* A name already registered keeps its first stub */
+    stub_def_t again = { "NtStub5Ex", STUB_TYPE_RETURN_ZERO, 0, 0, 0 };
+    uint32_t used = mgr.stub_alloc_ptr;
+    CHECK(stubs_get_or_create(&mgr, &vm, &again) == va[5], "existing stub reused");
+    CHECK(mgr.stub_alloc_ptr == used && mgr.registry_count == MANY_STUBS,
+          "reuse generates nothing");
+
+    /* Generating a duplicate directly does not shadow the first */
+    uint32_t dup = stubs_generate(&mgr, &vm, &again);
+    CHECK(dup != 0 && dup != va[5], "duplicate generated at a new address");
+    CHECK(stubs_lookup(&mgr, "NtStub5Ex") == va[5], "first stub for a name wins");
+
+    stubs_free(&mgr);
+    CHECK(mgr.registry == NULL && mgr.registry_index == NULL, "registry freed");
+}
+
+/* Definition table index: agreement with a scan, first duplicate wins */
+static void test_def_index(void)
+{
+    static stub_def_t defs[MANY_DEFS + 3];
+    static char names[MANY_DEFS][32];
+
+    for (int i = 0; i < MANY_DEFS; i++) {
+        stub_name(names[i], sizeof(names[i]), i);
+        defs[i] = (stub_def_t){ names[i], STUB_TYPE_SYSCALL, (uint32_t)i, 0, 1 };
+    }
+    /* Duplicates of an early and a late name, then the terminator */
+    defs[MANY_DEFS] = (stub_def_t){ names[3], STUB_TYPE_RETURN_ZERO, 0, 0, 0 };
+    defs[MANY_DEFS + 1] = (stub_def_t){ names[MANY_DEFS - 1], STUB_TYPE_RETURN_ERROR, 0, 5, 0 };
+    defs[MANY_DEFS + 2] = (stub_def_t){ NULL, 0, 0, 0, 0 };
+
+    stub_def_index_t index = { .defs = defs };
+    int found = 0;
+    for (int i = 0; i < MANY_DEFS; i++) {
+        found += stub_def_index_lookup(&index, names[i]) == &defs[i];
+    }
+    CHECK(found == MANY_DEFS, "every definition found");
+    CHECK(index.mask + 1 >= 2 * (MANY_DEFS + 2), "index at most half full");
+    CHECK(stub_def_index_lookup(&index, names[3]) == &defs[3], "first duplicate wins (early)");
+    CHECK(stub_def_index_lookup(&index, names[MANY_DEFS - 1]) == &defs[MANY_DEFS - 1],
+          "first duplicate wins (late)");
+    CHECK(stub_def_index_lookup(&index, "NtStub1500Ex") == NULL, "unknown definition misses");
+    CHECK(stub_def_index_lookup(&index, "NtStub1") == NULL, "prefix misses");
+    CHECK(stub_def_index_lookup(&index, "") == NULL, "empty name misses");
+    free(index.slots);
+
+    /* An empty table */
+    static const stub_def_t none[] = { { NULL, 0, 0, 0, 0 } };
+    stub_def_index_t empty = { .defs = none };
+    CHECK(stub_def_index_lookup(&empty, "NtClose") == NULL, "empty table misses");
+    free(empty.slots);
+}
+
+/* The real tables: the index returns what a linear scan would */
+static const stub_def_t *scan(const stub_def_t *defs, const char *name)
+{
+    for (; defs->name; defs++) {
+        if (strcmp(defs->name, name) == 0) {
+            return defs;
+        }
+    }
+    return NULL;
+}
+
+static void test_known_tables(void)
+{
+    int mismatches = 0;
+    for (const stub_def_t *def = ntdll_known_stubs; def->name; def++) {
+        mismatches += ntdll_lookup_stub(def->name) != scan(ntdll_known_stubs, def->name);
+    }
+    for (const stub_def_t *def = win32k_known_stubs; def->name; def++) {
+        mismatches += win32k_lookup_stub(def->name) != scan(win32k_known_stubs, def->name);
+    }
+    CHECK(mismatches == 0, "known stub tables agree with a scan");
+    CHECK(ntdll_lookup_stub("NtNoSuchCall") == NULL, "unknown ntdll stub misses");
+    CHECK(win32k_lookup_stub("NtUserNoSuchCall") == NULL, "unknown win32k stub misses");
+}
+
+int main(void)
+{
+    phys_mem = calloc(1, PHYS_SIZE);
+    if (!phys_mem) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    test_registry();
+    test_def_index();
+    test_known_tables();
+
+    free(phys_mem);
+    return test_finish();
+}
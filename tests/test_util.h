@@ -0,0 +1,31 @@
+/*
+ * Shared helpers for the standalone unit tests
+ *
+ * Each test program includes this once: CHECK records a failure and keeps
+ * going, test_finish prints the summary and gives main its exit status.
+ */
+#ifndef WBOX_TEST_UTIL_H
+#define WBOX_TEST_UTIL_H
+
+#include <stdio.h>
+
+static int failures = 0;
+
+#define CHECK(cond, msg) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "FAIL: %s (line %d)\n", msg, __LINE__); \
+        failures++; \
+    } \
+} while (0)
+
+static inline int test_finish(void)
+{
+    if (failures) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("PASS\n");
+    return 0;
+}
+
+#endif /* WBOX_TEST_UTIL_H */
@@ -0,0 +1,589 @@
+/*
+ * USER callback continuation tests
+ *
+ * Runs the real USER syscalls over a fake guest: the test plays the CPU,
+ * entering each syscall at a SYSENTER site, running the window procedure
+ * the guest was pointed at, returning through user_callback_return and
+ * re-entering the syscall when it is rewound. Covers SendMessage nested
+ * inside a window procedure (registers and stack of every level restored),
+ * CreateWindowEx through WM_NCCREATE and WM_CREATE including the failure
+ * returns of both, a cross-thread SendMessage whose sender parks while the
+ * receiver's GetMessage serves it and restarts, and the frames of a thread
+ * that exits in the middle of nested callbacks.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "user/user_syscalls.h"
+#include "user/user_callback.h"
+#include "user/user_class.h"
+#include "user/user_window.h"
+#include "user/user_message.h"
+#include "thread/thread.h"
+#include "thread/scheduler.h"
+#include "nt/sync.h"
+#include "nt/handles.h"
+#include "vm/vm.h"
+#include "vm/paging.h"
+#include "vm/startup_profile.h"
+#include "gdi/display.h"
+#include "cpu/cpu.h"
+#include "cpu/mem.h"
+#include "test_util.h"
+
+#define PHYS_BASE       0x00100000
+#define PHYS_SIZE       (8 * 1024 * 1024)
+#define PAGE_SLOTS      4096
+
+#define STACK_A         0x0020F000
+#define STACK_B         0x0030F000
+#define SITE_BASE       0x00500000      /* SYSENTER sites of the test's syscalls */
+#define CALLER_RET      0x00600000
+#define RETURN_STUB     0x7FFE0360
+
+#define PROC_ECHO       0x00401000      /* Returns wParam + lParam */
+#define PROC_RELAY      0x00402000      /* Sends msg - 1 to the window in wParam */
+#define PROC_CREATE     0x00403000      /* Answers WM_NCCREATE/WM_CREATE as told */
+#define PROC_REGS       0x00404000      /* Scribbles on every register */
+
+#define FNID_SENDMESSAGE 0x02B1
+#define MSG_RELAY       (WM_USER + 100)
+#define BAD_CLASS_ATOM  0xBEEF
+
+/*
+ * Fake guest memory: pages are mapped on first touch
+ */
+
+uint8_t *ram;
+cpu_state_t cpu_state;
+static vm_context_t vm;
+
+static struct {
+    uint32_t virt;
+    uint32_t phys;
+} page_map[PAGE_SLOTS];
+
+uint32_t paging_alloc_phys(paging_context_t *ctx, uint32_t size)
+{
+    size = (size + PAGE_SIZE - 1) & PAGE_MASK;
+    if (ctx->phys_alloc_ptr + size > PHYS_BASE + PHYS_SIZE) {
+        return 0;
+    }
+    uint32_t addr = ctx->phys_alloc_ptr;
+    ctx->phys_alloc_ptr += size;
+    return addr;
+}
+
+static uint32_t *page_slot(uint32_t virt)
+{
+    uint32_t page = virt & PAGE_MASK;
+    uint32_t i = (page >> 12) % PAGE_SLOTS;
+    while (page_map[i].phys && page_map[i].virt != page) {
+        i = (i + 1) % PAGE_SLOTS;
+    }
+    page_map[i].virt = page;
+    return &page_map[i].phys;
+}
+
+int paging_map_page(paging_context_t *ctx, uint32_t virt, uint32_t phys, uint32_t flags)
+{
+    (void)ctx;
+    (void)flags;
+    *page_slot(virt) = phys & PAGE_MASK;
+    return 0;
+}
+
+int paging_map_range(paging_context_t *ctx, uint32_t virt, uint32_t phys,
+                     uint32_t size, uint32_t flags)
+{
+    for (uint32_t off = 0; off < size; off += PAGE_SIZE) {
+        paging_map_page(ctx, virt + off, phys + off, flags);
+    }
+    return 0;
+}
+
+uint32_t paging_get_phys(paging_context_t *ctx, uint32_t virt)
+{
+    uint32_t *phys = page_slot(virt);
+    if (!*phys) {
+        *phys = paging_alloc_phys(ctx, PAGE_SIZE);
+    }
+    return *phys ? *phys | (virt & ~PAGE_MASK) : 0;
+}
+
+uint8_t mem_readb_phys(uint32_t addr) { return ram[addr]; }
+uint16_t mem_readw_phys(uint32_t addr) { uint16_t v; memcpy(&v, &ram[addr], 2); return v; }
+uint32_t mem_readl_phys(uint32_t addr) { uint32_t v; memcpy(&v, &ram[addr], 4); return v; }
+void mem_writeb_phys(uint32_t addr, uint8_t val) { ram[addr] = val; }
+void mem_writel_phys(uint32_t addr, uint32_t val) { memcpy(&ram[addr], &val, 4); }
+
+uint8_t readmembl(uint32_t addr) { return ram[paging_get_phys(&vm.paging, addr)]; }
+void writemembl(uint32_t addr, uint8_t val) { ram[paging_get_phys(&vm.paging, addr)] = val; }
+
+uint16_t readmemwl(uint32_t addr)
+{
+    return (uint16_t)(readmembl(addr) | readmembl(addr + 1) << 8);
+}
+
+void writememwl(uint32_t addr, uint16_t val)
+{
+    writemembl(addr, (uint8_t)val);
+    writemembl(addr + 1, (uint8_t)(val >> 8));
+}
+
+uint32_t readmemll(uint32_t addr)
+{
+    return readmemwl(addr) | (uint32_t)readmemwl(addr + 2) << 16;
+}
+
+void writememll(uint32_t addr, uint32_t val)
+{
+    writememwl(addr, (uint16_t)val);
+    writememwl(addr + 2, (uint16_t)(val >> 16));
+}
+
+vm_context_t *vm_get_context(void) { return &vm; }
+
+/*
+ * Fake threads and scheduler: a park rewinds onto SYSENTER and flags it,
+ * as the real one does, and the test decides who runs next
+ */
+
+static wbox_thread_t thread_a = { .thread_id = WBOX_THREAD_ID };
+static wbox_thread_t thread_b = { .thread_id = WBOX_THREAD_ID + 4 };
+static wbox_thread_t *current = &thread_a;
+static wbox_scheduler_t sched;
+static int parks;
+
+wbox_thread_t *thread_get_current(void) { return current; }
+uint32_t thread_get_current_id(void) { return current->thread_id; }
+wbox_scheduler_t *scheduler_get_instance(void) { return &sched; }
+uint64_t scheduler_get_time_100ns(void) { return 0; }
+
+bool scheduler_park_syscall(wbox_scheduler_t *s, void **objects, int *types, int count,
+                            uint64_t timeout)
+{
+    (void)objects;
+    (void)types;
+    (void)count;
+    (void)timeout;
+    parks++;
+    cpu_state.pc -= 2;
+    s->syscall_parked = true;
+    return true;
+}
+
+void scheduler_signal_object(wbox_scheduler_t *s, void *object, int type)
+{
+    (void)s;
+    (void)object;
+    (void)type;
+}
+
+wbox_event_t *sync_create_event(wbox_disp_type_t type, bool initial_state)
+{
+    (void)type;
+    wbox_event_t *event = calloc(1, sizeof(wbox_event_t));
+    if (event) {
+        event->header.signal_state = initial_state ? 1 : 0;
+    }
+    return event;
+}
+
+void sync_free_object(void *object, int type) { (void)type; free(object); }
+
+/* Nothing else the syscalls touch is under test */
+uint32_t handles_add_object(handle_table_t *ht, handle_type_t type, void *object_data)
+{
+    (void)ht; (void)type; (void)object_data;
+    return 0;
+}
+void handles_remove(handle_table_t *ht, uint32_t handle) { (void)ht; (void)handle; }
+void startup_profile_first_window(startup_profile_t *sp) { (void)sp; }
+bool display_poll_events(display_context_t *ctx) { (void)ctx; return false; }
+bool display_next_input(display_context_t *ctx, display_input_t *out)
+{
+    (void)ctx; (void)out;
+    return false;
+}
+void display_present(display_context_t *ctx) { (void)ctx; }
+
+/*
+ * The guest: SYSENTER sites, window procedures and their log
+ */
+
+typedef ntstatus_t (*syscall_fn)(void);
+
+static uint32_t next_site = SITE_BASE;
+static int entries;             /* Syscall handler runs, restarts included */
+
+typedef struct {
+    uint32_t proc, hwnd, msg, wparam, lparam;
+    int depth;
+} call_t;
+
+static call_t calls[64];
+static int num_calls;
+
+/* WM_NCCREATE and WM_CREATE answers of PROC_CREATE */
+static uint32_t nccreate_result = 1;
+static uint32_t create_result = 0;
+
+static void push(uint32_t val)
+{
+    ESP -= 4;
+    writememll(ESP, val);
+}
+
+static void run_wndproc(void);
+
+/*
+ * Execute the syscall at a new site the way the dispatcher and the guest
+ * would, until it returns to its caller (true) or parks (false). Callbacks
+ * it makes are run; a rewind onto SYSENTER enters it again.
+ */
+static bool run_syscall_at(syscall_fn fn, uint32_t site)
+{
+    for (;;) {
+        cpu_state.pc = site + 2;
+        entries++;
+        ntstatus_t status = fn();
+        if (status == STATUS_PENDING && sched.syscall_parked) {
+            sched.syscall_parked = false;
+            return false;
+        }
+        if (status != STATUS_PENDING || !user_callback_entered()) {
+            return true;
+        }
+        while (cpu_state.pc != site + 2 && cpu_state.pc != site) {
+            run_wndproc();
+        }
+        if (cpu_state.pc == site + 2) {
+            return true;
+        }
+    }
+}
+
+/* Push the arguments and both return addresses, as the ntdll stub does */
+static uint32_t push_syscall(const uint32_t *args, int count)
+{
+    for (int i = count; i-- > 0; ) {
+        push(args[i]);
+    }
+    push(CALLER_RET);
+    push(RETURN_STUB - 0x100);
+    uint32_t site = next_site;
+    next_site += 0x10;
+    return site;
+}
+
+/* A syscall that runs to completion: its EAX, with the stack checked and popped */
+static uint32_t syscall(syscall_fn fn, const uint32_t *args, int count)
+{
+    uint32_t esp = ESP;
+    uint32_t site = push_syscall(args, count);
+    uint32_t top = ESP;
+    bool done = run_syscall_at(fn, site);
+    CHECK(done, "syscall returns");
+    CHECK(ESP == top, "syscall stack restored");
+    ESP = esp;
+    return EAX;
+}
+
+static uint32_t send_message(uint32_t hwnd, uint32_t msg, uint32_t wparam, uint32_t lparam,
+                             uint32_t result_va)
+{
+    uint32_t args[7] = { hwnd, msg, wparam, lparam, result_va, FNID_SENDMESSAGE, 0 };
+    return syscall(sys_NtUserMessageCall, args, 7);
+}
+
+/* Window procedures */
+static uint32_t proc_relay(uint32_t hwnd, uint32_t msg, uint32_t wparam, uint32_t lparam)
+{
+    if (msg <= MSG_RELAY) {
+        return msg + wparam;
+    }
+
+    /* Answer with the inner procedure's result plus one */
+    uint32_t result_va = ESP - 0x40;
+    writememll(result_va, 0);
+    ESP -= 0x80;
+    uint32_t ok = send_message(wparam, msg - 1, wparam, lparam, result_va);
+    ESP += 0x80;
+    (void)hwnd;
+    return ok ? readmemll(result_va) + 1 : 0;
+}
+
+static uint32_t proc_create(uint32_t msg)
+{
+    if (msg == WM_NCCREATE) return nccreate_result;
+    if (msg == WM_CREATE) return create_result;
+    return 0;
+}
+
+/*
+ * Run the procedure the guest was pointed at: direct-call frame of
+ * [return stub][hwnd][msg][wParam][lParam], stdcall return, then the
+ * return stub's syscall
+ */
+static void run_wndproc(void)
+{
+    uint32_t proc = cpu_state.pc;
+    uint32_t ret = readmemll(ESP);
+    call_t c = { proc, readmemll(ESP + 4), readmemll(ESP + 8), readmemll(ESP + 12),
+                 readmemll(ESP + 16), user_callback_get_depth() };
+    if (num_calls < (int)(sizeof(calls) / sizeof(calls[0]))) {
+        calls[num_calls++] = c;
+    }
+    CHECK(ret == RETURN_STUB, "window procedure returns to the stub");
+
+    uint32_t result = 0;
+    switch (proc) {
+        case PROC_ECHO:
+            result = c.wparam + c.lparam;
+            break;
+        case PROC_RELAY:
+            result = proc_relay(c.hwnd, c.msg, c.wparam, c.lparam);
+            break;
+        case PROC_CREATE:
+            result = proc_create(c.msg);
+            break;
+        case PROC_REGS:
+            EBX = ESI = EDI = EBP = ECX = EDX = 0xDEADBEEF;
+            result = 7;
+            break;
+        default:
+            CHECK(false, "guest runs a known window procedure");
+            break;
+    }
+
+    ESP += 20;
+    EAX = result;
+    ECX = result;
+    user_callback_return(ECX);
+}
+
+/*
+ * Windows
+ */
+
+static uint16_t register_class(const wchar_t *name, uint32_t proc)
+{
+    WBOX_CLS *cls = calloc(1, sizeof(WBOX_CLS));
+    wcsncpy(cls->szClassName, name, MAX_CLASSNAME - 1);
+    cls->lpfnWndProc = proc;
+    cls->hModule = 0x00400000;
+    uint16_t atom = user_class_register(cls);
+    CHECK(atom != 0, "class registered");
+    return atom;
+}
+
+static uint32_t create_window(uint16_t atom, int cx, int cy)
+{
+    uint32_t args[15] = { 0, atom, 0, 0, 0, 10, 20, (uint32_t)cx, (uint32_t)cy,
+                          0, 0, 0x00400000, 0x1234, 0, 0 };
+    return syscall(sys_NtUserCreateWindowEx, args, 15);
+}
+
+static uint16_t atom_echo, atom_relay, atom_create, atom_regs;
+
+static void setup(void)
+{
+    ram = calloc(1, PHYS_BASE + PHYS_SIZE);
+    vm.paging.phys_alloc_ptr = PHYS_BASE;
+    thread_a.next = &thread_b;
+    sched.all_threads = &thread_a;
+    ESP = STACK_A;
+
+    /* The first CreateWindowEx brings USER up; the class does not exist */
+    CHECK(create_window(BAD_CLASS_ATOM, 10, 10) == 0, "unknown class fails");
+    CHECK(user_callback_init(&vm) == 0, "return stub");
+
+    atom_echo = register_class(L"Echo", PROC_ECHO);
+    atom_relay = register_class(L"Relay", PROC_RELAY);
+    atom_create = register_class(L"Create", PROC_CREATE);
+    atom_regs = register_class(L"Regs", PROC_REGS);
+}
+
+/*
+ * Tests
+ */
+
+/* SendMessage from inside window procedures, several levels deep */
+static void test_nested_send(void)
+{
+    uint32_t relay = create_window(atom_relay, 50, 50);
+    CHECK(relay != 0, "relay window");
+
+    uint32_t result_va = ESP - 0x200;
+    writememll(result_va, 0);
+    EBX = 0x11111111;
+    ESI = 0x22222222;
+    EDI = 0x33333333;
+    EBP = 0x44444444;
+    num_calls = 0;
+
+    /* MSG_RELAY + 5 relays down to MSG_RELAY: six procedures deep */
+    uint32_t ok = send_message(relay, MSG_RELAY + 5, relay, 0, result_va);
+    CHECK(ok == 1, "SendMessage succeeds");
+    CHECK(readmemll(result_va) == MSG_RELAY + relay + 5, "each level adds to the innermost result");
+    CHECK(num_calls == 6, "one procedure call per level");
+    bool depths = true;
+    for (int i = 0; i < num_calls; i++) {
+        depths &= calls[i].depth == i + 1 && calls[i].msg == MSG_RELAY + 5 - (uint32_t)i;
+    }
+    CHECK(depths, "levels nest one callback deeper each");
+    CHECK(user_callback_get_depth() == 0 && !user_callback_active(), "all frames popped");
+    CHECK(EBX == 0x11111111 && ESI == 0x22222222 && EDI == 0x33333333 && EBP == 0x44444444,
+          "caller registers restored");
+
+    /* A procedure that clobbers everything still leaves the syscall's state */
+    uint32_t regs = create_window(atom_regs, 10, 10);
+    EBX = 0x55555555;
+    EBP = 0x66666666;
+    ok = send_message(regs, WM_USER, 0, 0, result_va);
+    CHECK(ok == 1 && readmemll(result_va) == 7, "clobbering procedure answers");
+    CHECK(EBX == 0x55555555 && EBP == 0x66666666, "registers restored after the callback");
+}
+
+/* CreateWindowEx: WM_NCCREATE then WM_CREATE, and the failures of each */
+static void test_create_window(void)
+{
+    num_calls = 0;
+    nccreate_result = 1;
+    create_result = 0;
+    uint32_t hwnd = create_window(atom_create, 120, 80);
+    CHECK(hwnd != 0 && user_window_from_hwnd(hwnd) != NULL, "window created");
+    CHECK(num_calls == 2 && calls[0].msg == WM_NCCREATE && calls[1].msg == WM_CREATE,
+          "WM_NCCREATE then WM_CREATE");
+    CHECK(calls[0].hwnd == hwnd && calls[1].hwnd == hwnd, "both sent to the new window");
+    CHECK(calls[0].lparam == calls[1].lparam && calls[0].lparam < STACK_A &&
+          readmemll(calls[0].lparam + 0x14) == 120 && readmemll(calls[0].lparam + 0x10) == 80 &&
+          readmemll(calls[0].lparam) == 0x1234,
+          "both get the CREATESTRUCT on the guest stack");
+    CHECK(calls[0].depth == 1 && calls[1].depth == 1, "WM_CREATE follows, not nested");
+
+    /* WM_NCCREATE returning FALSE fails the call without WM_CREATE */
+    num_calls = 0;
+    nccreate_result = 0;
+    uint32_t failed = create_window(atom_create, 30, 30);
+    CHECK(failed == 0, "WM_NCCREATE FALSE fails CreateWindowEx");
+    CHECK(num_calls == 1 && calls[0].msg == WM_NCCREATE, "no WM_CREATE after a failed WM_NCCREATE");
+    CHECK(user_window_from_hwnd(calls[0].hwnd) == NULL, "window destroyed after WM_NCCREATE FALSE");
+
+    /* WM_CREATE returning -1 fails it after both */
+    num_calls = 0;
+    nccreate_result = 1;
+    create_result = (uint32_t)-1;
+    CHECK(create_window(atom_create, 30, 30) == 0, "WM_CREATE -1 fails CreateWindowEx");
+    CHECK(num_calls == 2 && user_window_from_hwnd(calls[1].hwnd) == NULL,
+          "window destroyed after WM_CREATE -1");
+    create_result = 0;
+    CHECK(user_callback_get_depth() == 0, "no frames left");
+}
+
+/*
+ * Thread B sends to thread A's window and parks; A's GetMessage serves
+ * the message in a callback and restarts; B's restarted SendMessage
+ * returns the answer
+ */
+static void test_park_and_restart(void)
+{
+    uint32_t echo = create_window(atom_echo, 10, 10);      /* Owned by thread A */
+    cpu_state_t cpu_a = cpu_state;
+
+    /* Thread B: SendMessage parks waiting for the answer */
+    current = &thread_b;
+    ESP = STACK_B;
+    uint32_t result_va = STACK_B - 0x100;
+    writememll(result_va, 0);
+    uint32_t b_esp = ESP;
+    uint32_t args[7] = { echo, WM_USER + 1, 40, 2, result_va, FNID_SENDMESSAGE, 0 };
+    uint32_t b_site = push_syscall(args, 7);
+    uint32_t b_top = ESP;
+    parks = 0;
+    CHECK(!run_syscall_at(sys_NtUserMessageCall, b_site), "cross-thread SendMessage parks");
+    CHECK(parks == 1 && cpu_state.pc == b_site, "sender rewound onto SYSENTER");
+    cpu_state_t cpu_b = cpu_state;
+
+    /* Thread A: GetMessage runs the procedure, restarts, then parks empty */
+    current = &thread_a;
+    cpu_state = cpu_a;
+    uint32_t msg_va = STACK_A - 0x300;
+    uint32_t a_args[4] = { msg_va, 0, 0, 0 };
+    uint32_t a_site = push_syscall(a_args, 4);
+    num_calls = 0;
+    entries = 0;
+    CHECK(!run_syscall_at(sys_NtUserGetMessage, a_site), "GetMessage parks once served");
+    CHECK(num_calls == 1 && calls[0].proc == PROC_ECHO && calls[0].msg == WM_USER + 1 &&
+          calls[0].depth == 1, "sent message served in a callback");
+    CHECK(entries == 2, "GetMessage restarted after the callback");
+    CHECK(user_callback_get_depth() == 0, "receiver frames popped");
+    WBOX_MSG_QUEUE *queue_a = msg_queue_current();
+    CHECK(queue_a->sentActive == NULL && queue_a->sentHead == NULL, "nothing left to serve");
+
+    /* Thread B runs again: the restarted SendMessage has its answer */
+    current = &thread_b;
+    cpu_state = cpu_b;
+    CHECK(run_syscall_at(sys_NtUserMessageCall, b_site), "restarted SendMessage returns");
+    CHECK(EAX == 1 && readmemll(result_va) == 42, "sender gets the procedure's result");
+    CHECK(ESP == b_top, "sender stack intact");
+    ESP = b_esp;
+
+    current = &thread_a;
+    cpu_state = cpu_a;
+}
+
+/* A thread exits with callbacks in progress; another thread is unaffected */
+static void test_thread_exit(void)
+{
+    /* Thread A waits in a callback of its own */
+    uint32_t echo = create_window(atom_echo, 10, 10);
+    uint32_t a_args[7] = { echo, WM_USER, 1, 2, 0, FNID_SENDMESSAGE, 0 };
+    uint32_t a_site = push_syscall(a_args, 7);
+    cpu_state.pc = a_site + 2;
+    CHECK(sys_NtUserMessageCall() == STATUS_PENDING && user_callback_entered(),
+          "thread A enters a callback");
+    CHECK(user_callback_get_depth() == 1, "thread A one deep");
+    cpu_state_t cpu_a = cpu_state;
+
+    /* Thread B gets two callbacks deep and exits there */
+    current = &thread_b;
+    ESP = STACK_B;
+    uint32_t echo_b = create_window(atom_echo, 10, 10);
+    for (int level = 0; level < 2; level++) {
+        uint32_t args[7] = { echo_b, WM_USER, 0, 0, 0, FNID_SENDMESSAGE, 0 };
+        cpu_state.pc = push_syscall(args, 7) + 2;
+        CHECK(sys_NtUserMessageCall() == STATUS_PENDING && user_callback_entered(),
+              "thread B enters a callback");
+    }
+    CHECK(user_callback_get_depth() == 2 && thread_b.callbacks != NULL, "thread B two deep");
+
+    msg_queue_thread_exit(&thread_b);
+    user_callback_thread_exit(&thread_b);
+    CHECK(thread_b.callbacks == NULL && user_callback_get_depth() == 0, "exiting thread's frames freed");
+
+    /* Thread A's callback still returns into its syscall */
+    current = &thread_a;
+    cpu_state = cpu_a;
+    CHECK(user_callback_get_depth() == 1, "thread A's frame kept");
+    run_wndproc();
+    CHECK(cpu_state.pc == a_site + 2 && EAX == 1, "thread A's SendMessage completes");
+    CHECK(user_callback_get_depth() == 0, "thread A back at depth 0");
+    CHECK(user_callback_return(0) == USER_CALLBACK_NONE, "stray return finds no frame");
+}
+
+int main(void)
+{
+    setup();
+
+    test_nested_send();
+    test_create_window();
+    test_park_and_restart();
+    test_thread_exit();
+
+    free(ram);
+    return test_finish();
+}
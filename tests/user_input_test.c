@@ -0,0 +1,464 @@
+/*
+ * USER input routing tests
+ *
+ * Queues host input with display_push_input the way display_poll_events
+ * does and routes it with user_input_process over a real window tree:
+ * consecutive mouse moves merge into one message carrying the last
+ * position, clicks hit-test to the client area, caption or border of the
+ * window under the pointer (children first, the bare desktop gets
+ * nothing), mouse capture redirects every mouse message to the capture
+ * window as client input, keys go to the focus window of the foreground
+ * thread or as WM_SYSKEY* to its active window, each message lands in the
+ * queue of the thread owning its target, and a full input queue drops and
+ * counts the excess.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "user/user_input.h"
+#include "user/user_window.h"
+#include "user/user_class.h"
+#include "user/user_message.h"
+#include "user/user_handle_table.h"
+#include "thread/thread.h"
+#include "thread/scheduler.h"
+#include "nt/sync.h"
+#include "nt/handles.h"
+#include "vm/vm.h"
+#include "vm/paging.h"
+#include "cpu/mem.h"
+#include "gdi/display.h"
+#include "test_util.h"
+
+#define VK_A            0x41
+
+/*
+ * Fake threads: A owns the first windows, B the last one
+ */
+
+static wbox_thread_t thread_a = { .thread_id = WBOX_THREAD_ID };
+static wbox_thread_t thread_b = { .thread_id = WBOX_THREAD_ID + 4 };
+static wbox_thread_t *current = &thread_a;
+static wbox_scheduler_t sched;
+
+wbox_thread_t *thread_get_current(void) { return current; }
+uint32_t thread_get_current_id(void) { return current->thread_id; }
+wbox_scheduler_t *scheduler_get_instance(void) { return &sched; }
+uint64_t scheduler_get_time_100ns(void) { return 0; }
+vm_context_t *vm_get_context(void) { return NULL; }
+
+bool scheduler_park_syscall(wbox_scheduler_t *s, void **objects, int *types, int count,
+                            uint64_t timeout)
+{
+    (void)s; (void)objects; (void)types; (void)count; (void)timeout;
+    return false;
+}
+
+void scheduler_signal_object(wbox_scheduler_t *s, void *object, int type)
+{
+    (void)s; (void)object; (void)type;
+}
+
+wbox_event_t *sync_create_event(wbox_disp_type_t type, bool initial_state)
+{
+    (void)type;
+    wbox_event_t *event = calloc(1, sizeof(wbox_event_t));
+    if (event) {
+        event->header.signal_state = initial_state ? 1 : 0;
+    }
+    return event;
+}
+
+void sync_free_object(void *object, int type) { (void)type; free(object); }
+
+/* No guest: there is no VM, so nothing is mirrored into guest memory */
+uint8_t *ram;
+uint32_t handles_add_object(handle_table_t *ht, handle_type_t type, void *object_data)
+{
+    (void)ht; (void)type; (void)object_data;
+    return 0;
+}
+void handles_remove(handle_table_t *ht, uint32_t handle) { (void)ht; (void)handle; }
+int user_callback_get_depth(void) { return 0; }
+uint32_t paging_alloc_phys(paging_context_t *ctx, uint32_t size) { (void)ctx; (void)size; return 0; }
+uint32_t paging_get_phys(paging_context_t *ctx, uint32_t virt) { (void)ctx; (void)virt; return 0; }
+int paging_map_page(paging_context_t *ctx, uint32_t virt, uint32_t phys, uint32_t flags)
+{
+    (void)ctx; (void)virt; (void)phys; (void)flags;
+    return -1;
+}
+int paging_map_range(paging_context_t *ctx, uint32_t virt, uint32_t phys,
+                     uint32_t size, uint32_t flags)
+{
+    (void)ctx; (void)virt; (void)phys; (void)size; (void)flags;
+    return -1;
+}
+uint32_t mem_readl_phys(uint32_t addr) { (void)addr; return 0; }
+void mem_writeb_phys(uint32_t addr, uint8_t val) { (void)addr; (void)val; }
+void mem_writel_phys(uint32_t addr, uint32_t val) { (void)addr; (void)val; }
+void writememll(uint32_t addr, uint32_t val) { (void)addr; (void)val; }
+void writememwl(uint32_t addr, uint16_t val) { (void)addr; (void)val; }
+
+/*
+ * Helpers
+ */
+
+static display_context_t display;
+static WBOX_CLS cls_plain;
+static WBOX_CLS cls_dblclk;
+static WBOX_WND *frame;         /* Captioned top-level window, thread A */
+static WBOX_WND *child;         /* Child control inside frame's client area */
+static WBOX_WND *other;         /* Captioned top-level window, thread B */
+static WBOX_MSG_QUEUE *queue_a;
+static WBOX_MSG_QUEUE *queue_b;
+
+static void push_move(int32_t x, int32_t y)
+{
+    display_input_t *in = display_push_input(&display, DISPLAY_INPUT_MOUSE_MOVE);
+    if (in) {
+        in->x = x;
+        in->y = y;
+    }
+}
+
+static void push_button(uint8_t button, bool down, uint8_t clicks, int32_t x, int32_t y)
+{
+    display_input_t *in = display_push_input(&display, DISPLAY_INPUT_MOUSE_BUTTON);
+    if (in) {
+        in->button = button;
+        in->down = down;
+        in->clicks = clicks;
+        in->x = x;
+        in->y = y;
+    }
+}
+
+static void push_key(uint8_t vk, uint8_t scancode, bool down)
+{
+    display_input_t *in = display_push_input(&display, DISPLAY_INPUT_KEY);
+    if (in) {
+        in->vk = vk;
+        in->scancode = scancode;
+        in->down = down;
+    }
+}
+
+static void click(int32_t x, int32_t y)
+{
+    push_button(DISPLAY_BUTTON_LEFT, true, 1, x, y);
+    push_button(DISPLAY_BUTTON_LEFT, false, 1, x, y);
+}
+
+/* Take the next message of a queue, 0 message if none */
+static WBOX_MSG next(WBOX_MSG_QUEUE *queue)
+{
+    WBOX_MSG msg;
+    memset(&msg, 0, sizeof(msg));
+    if (!msg_queue_peek(queue, &msg, 0, 0, 0, PM_REMOVE)) {
+        memset(&msg, 0, sizeof(msg));
+    }
+    return msg;
+}
+
+static void drain(void)
+{
+    while (next(queue_a).message) {}
+    while (next(queue_b).message) {}
+}
+
+static bool is_msg(WBOX_MSG m, const WBOX_WND *wnd, uint32_t message, uint32_t wParam,
+                   uint32_t lParam)
+{
+    return m.hwnd == wnd->hwnd && m.message == message && m.wParam == wParam &&
+           m.lParam == lParam;
+}
+
+static uint32_t client_point(const WBOX_WND *wnd, int x, int y)
+{
+    return MAKELPARAM(x - wnd->rcClient.left, y - wnd->rcClient.top);
+}
+
+static void setup(void)
+{
+    thread_a.next = &thread_b;
+    sched.all_threads = &thread_a;
+
+    CHECK(user_handle_table_global_init() == 0, "handle table");
+    CHECK(user_class_init() == 0, "classes");
+    msg_queue_init();
+    CHECK(user_window_init() == 0, "desktop");
+
+    wcscpy(cls_plain.szClassName, L"Plain");
+    wcscpy(cls_dblclk.szClassName, L"DblClk");
+    cls_dblclk.style = CS_DBLCLKS;
+
+    /* Thread B's window first so thread A's sits above it in z-order */
+    current = &thread_b;
+    other = user_window_create(&cls_plain, L"", WS_CAPTION | WS_VISIBLE, 0,
+                               250, 150, 200, 150, NULL, NULL, 0, 0, 0);
+    current = &thread_a;
+    frame = user_window_create(&cls_plain, L"", WS_CAPTION | WS_VISIBLE, 0,
+                               100, 100, 200, 150, NULL, NULL, 0, 0, 0);
+    child = user_window_create(&cls_dblclk, L"", WS_CHILD | WS_VISIBLE, 0,
+                               140, 160, 40, 30, frame, NULL, 0, 0, 0);
+    CHECK(frame && child && other, "windows created");
+
+    queue_a = msg_queue_current();
+    current = &thread_b;
+    queue_b = msg_queue_current();
+    current = &thread_a;
+    CHECK(msg_queue_for_window(other) == queue_b && msg_queue_for_window(frame) == queue_a,
+          "windows owned by their threads' queues");
+}
+
+/*
+ * Tests
+ */
+
+/* Mouse moves merge while nothing else is queued between them */
+static void test_move_merging(void)
+{
+    drain();
+    int x = frame->rcClient.left + 5;
+    int y = frame->rcClient.top + 5;
+
+    for (int i = 0; i < 50; i++) {
+        push_move(x + i, y);
+    }
+    CHECK(display.input_count == 1, "50 moves take one slot");
+
+    push_key(VK_A, 0x1E, true);
+    push_move(x + 1, y + 1);
+    push_move(x + 2, y + 2);
+    CHECK(display.input_count == 3, "a key separates moves");
+
+    user_input_process(&display);
+    CHECK(display.input_count == 0, "queue consumed");
+
+    /* Nothing is active yet: the key goes to the topmost window as a system key */
+    CHECK(is_msg(next(queue_a), frame, WM_MOUSEMOVE, 0, client_point(frame, x + 49, y)),
+          "merged move carries the last position");
+    CHECK(is_msg(next(queue_a), frame, WM_SYSKEYDOWN, VK_A, 1 | 0x1E << 16),
+          "key between the moves");
+    CHECK(is_msg(next(queue_a), frame, WM_MOUSEMOVE, 0, client_point(frame, x + 2, y + 2)),
+          "second run of moves merged");
+    CHECK(next(queue_a).message == 0 && next(queue_b).message == 0, "nothing else posted");
+    CHECK(user_input_get_foreground() == 0, "moves and keys activate nothing");
+
+    push_key(VK_A, 0x1E, false);
+    user_input_process(&display);
+    drain();
+}
+
+/* Hit testing: client, caption, border, child, other thread, desktop */
+static void test_hit_test(void)
+{
+    drain();
+
+    /* Client area of the frame; a click there also activates it */
+    int cx = frame->rcClient.left + 3, cy = frame->rcClient.top + 4;
+    click(cx, cy);
+    user_input_process(&display);
+    CHECK(is_msg(next(queue_a), frame, WM_ACTIVATE, WA_CLICKACTIVE, 0), "click activates the frame");
+    CHECK(is_msg(next(queue_a), frame, WM_SETFOCUS, 0, 0), "and focuses it");
+    CHECK(is_msg(next(queue_a), frame, WM_LBUTTONDOWN, MK_LBUTTON, MAKELPARAM(3, 4)),
+          "client click in client coordinates");
+    CHECK(is_msg(next(queue_a), frame, WM_LBUTTONUP, 0, MAKELPARAM(3, 4)), "client release");
+    CHECK(user_input_get_foreground() == frame->hwnd, "frame in the foreground");
+
+    /* Caption: non-client, screen coordinates, HTCAPTION */
+    int tx = frame->rcWindow.left + 50, ty = frame->rcClient.top - 3;
+    click(tx, ty);
+    user_input_process(&display);
+    CHECK(is_msg(next(queue_a), frame, WM_NCLBUTTONDOWN, HTCAPTION, MAKELPARAM(tx, ty)),
+          "caption click");
+    CHECK(is_msg(next(queue_a), frame, WM_NCLBUTTONUP, HTCAPTION, MAKELPARAM(tx, ty)),
+          "caption release");
+
+    /* Side frame beside the client area */
+    int bx = frame->rcWindow.left, by = frame->rcClient.top + 10;
+    push_move(bx, by);
+    user_input_process(&display);
+    CHECK(is_msg(next(queue_a), frame, WM_NCMOUSEMOVE, HTBORDER, MAKELPARAM(bx, by)),
+          "border hit");
+
+    /* The child takes clicks inside it, double-clicks included */
+    int hx = child->rcClient.left + 1, hy = child->rcClient.top + 2;
+    push_button(DISPLAY_BUTTON_LEFT, true, 2, hx, hy);
+    push_button(DISPLAY_BUTTON_LEFT, false, 2, hx, hy);
+    user_input_process(&display);
+    CHECK(is_msg(next(queue_a), child, WM_LBUTTONDBLCLK, MK_LBUTTON, MAKELPARAM(1, 2)),
+          "child gets the double-click");
+    CHECK(is_msg(next(queue_a), child, WM_LBUTTONUP, 0, MAKELPARAM(1, 2)), "child release");
+    CHECK(next(queue_a).message == 0, "frame stays active and focused");
+
+    /* Without CS_DBLCLKS a client double-click is a second down */
+    push_button(DISPLAY_BUTTON_LEFT, true, 2, cx, cy);
+    push_button(DISPLAY_BUTTON_LEFT, false, 2, cx, cy);
+    user_input_process(&display);
+    CHECK(is_msg(next(queue_a), frame, WM_LBUTTONDOWN, MK_LBUTTON, MAKELPARAM(3, 4)),
+          "no WM_LBUTTONDBLCLK without CS_DBLCLKS");
+    drain();
+
+    /* Thread B's window, where it is not covered by the frame */
+    int ox = other->rcClient.right - 5, oy = other->rcClient.bottom - 5;
+    push_move(ox, oy);
+    user_input_process(&display);
+    CHECK(next(queue_a).message == 0, "nothing for thread A");
+    CHECK(is_msg(next(queue_b), other, WM_MOUSEMOVE, 0, client_point(other, ox, oy)),
+          "thread B's window gets its move in B's queue");
+
+    /* Where they overlap the frame is on top */
+    int px = frame->rcClient.right - 2, py = frame->rcClient.bottom - 2;
+    CHECK(px >= other->rcClient.left && py >= other->rcClient.top, "windows overlap");
+    push_move(px, py);
+    user_input_process(&display);
+    CHECK(is_msg(next(queue_a), frame, WM_MOUSEMOVE, 0, client_point(frame, px, py)),
+          "top window wins the overlap");
+    CHECK(next(queue_b).message == 0, "window below gets nothing");
+
+    /* The bare desktop gets nothing */
+    click(5, 5);
+    user_input_process(&display);
+    CHECK(next(queue_a).message == 0 && next(queue_b).message == 0, "desktop clicks dropped");
+}
+
+/* Capture: every mouse message goes to the capture window as client input */
+static void test_capture(void)
+{
+    drain();
+    user_input_set_capture(queue_a, child->hwnd);
+
+    int ox = other->rcClient.right - 5, oy = other->rcClient.bottom - 5;
+    push_move(ox, oy);
+    push_button(DISPLAY_BUTTON_LEFT, true, 1, ox, oy);
+    int tx = frame->rcWindow.left + 50, ty = frame->rcClient.top - 3;
+    push_move(tx, ty);
+    push_button(DISPLAY_BUTTON_LEFT, false, 1, tx, ty);
+    user_input_process(&display);
+
+    CHECK(is_msg(next(queue_a), child, WM_MOUSEMOVE, 0, client_point(child, ox, oy)),
+          "move over another thread's window goes to the capture");
+    CHECK(is_msg(next(queue_a), child, WM_LBUTTONDOWN, MK_LBUTTON, client_point(child, ox, oy)),
+          "click goes to the capture");
+    CHECK(is_msg(next(queue_a), child, WM_MOUSEMOVE, MK_LBUTTON, client_point(child, tx, ty)),
+          "move over a caption is client input under capture");
+    CHECK(is_msg(next(queue_a), child, WM_LBUTTONUP, 0, client_point(child, tx, ty)),
+          "release goes to the capture");
+    CHECK(next(queue_b).message == 0, "window under the pointer gets nothing");
+    CHECK(user_input_get_foreground() == frame->hwnd, "captured clicks activate nothing");
+
+    user_input_set_capture(queue_a, 0);
+    CHECK(is_msg(next(queue_a), child, WM_CAPTURECHANGED, 0, 0), "capture released");
+
+    push_move(ox, oy);
+    user_input_process(&display);
+    CHECK(is_msg(next(queue_b), other, WM_MOUSEMOVE, 0, client_point(other, ox, oy)),
+          "hit testing resumes after release");
+
+    /* A destroyed capture window stops capturing */
+    WBOX_WND *popup = user_window_create(&cls_plain, L"", WS_VISIBLE, 0,
+                                         600, 400, 50, 50, NULL, NULL, 0, 0, 0);
+    user_input_set_capture(queue_a, popup->hwnd);
+    user_window_destroy(popup);
+    drain();
+    push_move(ox, oy);
+    user_input_process(&display);
+    CHECK(next(queue_a).message == 0 &&
+          is_msg(next(queue_b), other, WM_MOUSEMOVE, 0, client_point(other, ox, oy)),
+          "capture by a destroyed window ends");
+}
+
+/* Keys: focus window of the foreground thread, WM_SYSKEY* without focus or with ALT */
+static void test_keys(void)
+{
+    drain();
+    CHECK(user_input_get_foreground() == frame->hwnd && queue_a->hwndFocus == frame->hwnd,
+          "frame is foreground and focused");
+
+    user_input_set_focus(queue_a, child->hwnd);
+    drain();
+
+    push_key(VK_A, 0x1E, true);
+    push_key(VK_A, 0x1E, true);
+    push_key(VK_A, 0x1E, false);
+    user_input_process(&display);
+    CHECK(is_msg(next(queue_a), child, WM_KEYDOWN, VK_A, 1 | 0x1E << 16), "key to the focus window");
+    CHECK(is_msg(next(queue_a), child, WM_KEYDOWN, VK_A, 1 | 0x1E << 16 | 1u << 30),
+          "autorepeat has the previous-state bit");
+    CHECK(is_msg(next(queue_a), child, WM_KEYUP, VK_A, 1 | 0x1E << 16 | 3u << 30), "key release");
+    CHECK(next(queue_b).message == 0, "background thread gets no keys");
+
+    /* ALT makes system keys */
+    push_key(VK_MENU, 0x38, true);
+    push_key(VK_A, 0x1E, true);
+    push_key(VK_A, 0x1E, false);
+    push_key(VK_MENU, 0x38, false);
+    user_input_process(&display);
+    CHECK(next(queue_a).message == WM_SYSKEYDOWN, "ALT down is a system key");
+    CHECK(is_msg(next(queue_a), child, WM_SYSKEYDOWN, VK_A, 1 | 0x1E << 16 | 1u << 29),
+          "ALT+A is a system key with the context bit");
+    CHECK(next(queue_a).message == WM_SYSKEYUP && next(queue_a).message == WM_SYSKEYUP,
+          "both releases are system keys");
+
+    /* No focus: system keys to the active window */
+    user_input_set_focus(queue_a, 0);
+    drain();
+    push_key(VK_A, 0x1E, true);
+    user_input_process(&display);
+    CHECK(is_msg(next(queue_a), frame, WM_SYSKEYDOWN, VK_A, 1 | 0x1E << 16),
+          "without focus keys go to the active window as system keys");
+    push_key(VK_A, 0x1E, false);
+    user_input_process(&display);
+    drain();
+
+    /* Clicking thread B's window moves the keyboard there */
+    int ox = other->rcClient.right - 5, oy = other->rcClient.bottom - 5;
+    click(ox, oy);
+    push_key(VK_A, 0x1E, true);
+    push_key(VK_A, 0x1E, false);
+    user_input_process(&display);
+    CHECK(user_input_get_foreground() == other->hwnd, "click brings thread B forward");
+    CHECK(is_msg(next(queue_b), other, WM_ACTIVATE, WA_CLICKACTIVE, 0) &&
+          is_msg(next(queue_b), other, WM_SETFOCUS, 0, 0), "thread B's window activated");
+    next(queue_b);
+    next(queue_b);
+    CHECK(is_msg(next(queue_b), other, WM_KEYDOWN, VK_A, 1 | 0x1E << 16),
+          "keys follow the foreground thread");
+    CHECK(next(queue_b).message == WM_KEYUP && next(queue_a).message == 0,
+          "none for the old foreground thread");
+    drain();
+}
+
+/* The display queue drops and counts events past its size */
+static void test_queue_full(void)
+{
+    drain();
+    for (int i = 0; i < DISPLAY_INPUT_QUEUE_SIZE + 3; i++) {
+        push_key(VK_A, 0x1E, (i & 1) == 0);
+    }
+    CHECK(display.input_count == DISPLAY_INPUT_QUEUE_SIZE, "queue holds its size");
+    CHECK(display.input_dropped == 3, "excess counted");
+    push_move(1, 1);
+    CHECK(display.input_dropped == 4, "a move is not merged into a key");
+
+    user_input_process(&display);
+    CHECK(display.input_count == 0 && display.input_dropped == 0, "processed and reported");
+    drain();
+}
+
+int main(void)
+{
+    setup();
+
+    test_move_merging();
+    test_hit_test();
+    test_capture();
+    test_keys();
+    test_queue_full();
+
+    user_window_shutdown();
+    return test_finish();
+}
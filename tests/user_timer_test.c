@@ -0,0 +1,347 @@
+/*
+ * USER timer tests
+ *
+ * Runs GetMessage the way the syscall does, on a real message queue under
+ * a fake scheduler with a simulated millisecond clock: an idle thread
+ * parks with the deadline msg_queue_wait computes from the next timer,
+ * and the restarted syscall reads WM_TIMER, so the wakeup counts are
+ * exact. Also checks coalescing of late timers, period clamping,
+ * GetMessage filters, id allocation and heap ordering.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "user/user_timer.h"
+#include "user/user_message.h"
+#include "user/user_window.h"
+#include "user/user_callback.h"
+#include "thread/thread.h"
+#include "thread/scheduler.h"
+#include "nt/sync.h"
+#include "nt/handles.h"
+#include "vm/vm.h"
+#include "vm/paging.h"
+#include "cpu/mem.h"
+#include "test_util.h"
+
+#define HWND_APP    0x00010020
+
+/*
+ * Fake scheduler: a millisecond clock, and a park that records what the
+ * parked syscall waits for instead of switching threads
+ */
+
+static uint64_t fake_now_ms;
+static wbox_scheduler_t fake_sched;
+static wbox_thread_t main_thread = { .thread_id = WBOX_THREAD_ID };
+static bool sched_running = true;
+static int parks;
+static int signals;
+static uint64_t park_timeout;       /* Absolute, 100ns units, 0 = none */
+static void *park_object;
+
+uint64_t scheduler_get_time_100ns(void) { return fake_now_ms * 10000; }
+wbox_scheduler_t *scheduler_get_instance(void) { return sched_running ? &fake_sched : NULL; }
+wbox_thread_t *thread_get_current(void) { return &main_thread; }
+
+bool scheduler_park_syscall(wbox_scheduler_t *sched, void **objects, int *types, int count,
+                            uint64_t timeout)
+{
+    (void)sched;
+    (void)types;
+    CHECK(count == 1, "park on the wake event only");
+    parks++;
+    park_timeout = timeout;
+    park_object = objects[0];
+    return true;
+}
+
+void scheduler_signal_object(wbox_scheduler_t *sched, void *object, int type)
+{
+    (void)sched;
+    (void)type;
+    if (object == park_object) {
+        signals++;
+    }
+}
+
+wbox_event_t *sync_create_event(wbox_disp_type_t type, bool initial_state)
+{
+    (void)type;
+    wbox_event_t *event = calloc(1, sizeof(wbox_event_t));
+    if (event) {
+        event->header.signal_state = initial_state ? 1 : 0;
+    }
+    return event;
+}
+
+void sync_free_object(void *object, int type) { (void)type; free(object); }
+
+/* Nothing else the queue touches is under test */
+vm_context_t *vm_get_context(void) { return NULL; }
+uint32_t handles_add_object(handle_table_t *ht, handle_type_t type, void *object_data)
+{
+    (void)ht; (void)type; (void)object_data;
+    return 0;
+}
+void handles_remove(handle_table_t *ht, uint32_t handle) { (void)ht; (void)handle; }
+WBOX_WND *user_window_from_hwnd(uint32_t hwnd) { (void)hwnd; return NULL; }
+WBOX_WND *user_window_get_desktop(void) { return NULL; }
+bool user_window_is_visible(WBOX_WND *wnd) { (void)wnd; return false; }
+int user_callback_get_depth(void) { return 0; }
+uint32_t paging_get_phys(paging_context_t *ctx, uint32_t virt) { (void)ctx; (void)virt; return 0; }
+uint32_t mem_readl_phys(uint32_t addr) { (void)addr; return 0; }
+void mem_writel_phys(uint32_t addr, uint32_t val) { (void)addr; (void)val; }
+
+/* One run of NtUserGetMessage: read a message, or park and be restarted */
+static bool get_message(WBOX_MSG_QUEUE *queue, WBOX_MSG *msg)
+{
+    if (msg_queue_peek(queue, msg, 0, 0, 0, PM_REMOVE)) {
+        return true;
+    }
+    CHECK(msg_queue_wait(queue), "empty queue parks");
+    return false;
+}
+
+/* An idle GetMessage loop with one 1 s timer wakes once per second */
+static void test_idle_wakeups(void)
+{
+    fake_now_ms = 5000;
+    WBOX_MSG_QUEUE *queue = msg_queue_current();
+    WBOX_MSG msg;
+    CHECK(queue != NULL, "main thread queue");
+
+    /* Without timers the thread sleeps until woken */
+    parks = 0;
+    CHECK(!get_message(queue, &msg), "nothing to read");
+    CHECK(parks == 1 && park_timeout == 0, "no timer, no deadline");
+    CHECK(park_object == queue->wakeEvent && queue->wakeEvent->header.signal_state == 0,
+          "parked on the reset wake event");
+
+    CHECK(msg_queue_set_timer(queue, HWND_APP, 1, 1000, 0, 0) == 1, "set 1 s timer");
+
+    int wakeups = 0;
+    int timers = 0;
+    uint64_t end = fake_now_ms + 10000;
+    parks = 0;
+    for (int run = 0; run < 100; run++) {
+        if (get_message(queue, &msg)) {
+            CHECK(msg.message == WM_TIMER && msg.hwnd == HWND_APP && msg.wParam == 1,
+                  "WM_TIMER for the app timer");
+            CHECK(fake_now_ms % 1000 == 0, "woken exactly on the period");
+            timers++;
+            continue;
+        }
+
+        /* Parked: the scheduler restarts the syscall at the deadline */
+        uint64_t deadline = park_timeout / 10000;
+        CHECK(park_timeout % 10000 == 0, "deadline in whole milliseconds");
+        CHECK(deadline == fake_now_ms + 1000 - fake_now_ms % 1000, "deadline is the next timer");
+        if (deadline > end) {
+            break;
+        }
+        fake_now_ms = deadline;
+        wakeups++;
+    }
+
+    CHECK(wakeups == 10, "10 wakeups in 10 seconds");
+    CHECK(timers == 10, "10 WM_TIMER in 10 seconds");
+    CHECK(parks == 11, "one park per wakeup, plus the last");
+    printf("idle 1 s timer over 10 s: %d wakeups, %d WM_TIMER\n", wakeups, timers);
+
+    /* Input before the deadline wakes the thread early; the restarted
+     * syscall reads it and parks for the same timer again */
+    uint64_t due = park_timeout;
+    fake_now_ms += 300;
+    signals = 0;
+    CHECK(msg_queue_post_input(queue, HWND_APP, WM_KEYDOWN, 0x41, 0), "post input");
+    CHECK(signals == 1 && queue->wakeEvent->header.signal_state == 1, "wake event signaled");
+    CHECK(get_message(queue, &msg) && msg.message == WM_KEYDOWN, "restart reads the input");
+    CHECK(!get_message(queue, &msg), "then the queue is empty again");
+    CHECK(park_timeout == due, "same timer deadline after an early wake");
+    CHECK(queue->wakeEvent->header.signal_state == 0, "wake event reset for the new wait");
+
+    /* A late restart finds the overdue timer without parking */
+    fake_now_ms = due / 10000 + 2500;
+    parks = 0;
+    CHECK(get_message(queue, &msg) && msg.message == WM_TIMER, "overdue WM_TIMER");
+    CHECK(!get_message(queue, &msg) && parks == 1, "one WM_TIMER for the missed periods");
+    CHECK(park_timeout / 10000 > fake_now_ms, "next deadline after now");
+
+    /* Before the scheduler runs there is nothing to park on */
+    sched_running = false;
+    CHECK(!msg_queue_wait(queue), "cannot park without a scheduler");
+    sched_running = true;
+
+    msg_queue_thread_exit(&main_thread);
+}
+
+/* A reader that polls faster than the period still sees one WM_TIMER per
+ * period, and one that is late sees a single WM_TIMER for the missed ones */
+static void test_coalescing(void)
+{
+    WBOX_TIMER_HEAP heap = {0};
+    WBOX_TIMER timer;
+    uint64_t now = 0;
+    int timers = 0;
+
+    user_timer_set(&heap, HWND_APP, 7, 1000, 0, 0, now);
+    for (now = 250; now <= 4000; now += 250) {
+        user_timer_expire(&heap, now);
+        while (user_timer_take(&heap, 0, 0, 0, true, now, &timer)) {
+            timers++;
+        }
+    }
+    CHECK(timers == 4, "busy reader gets one WM_TIMER per period");
+
+    /* Sleep through 3.5 periods */
+    now = 7500;
+    user_timer_expire(&heap, now);
+    timers = 0;
+    while (user_timer_take(&heap, 0, 0, 0, true, now, &timer)) {
+        timers++;
+    }
+    CHECK(timers == 1, "late reader gets one WM_TIMER");
+    CHECK(user_timer_next_due(&heap, now) == 8500, "re-armed one period after the late read");
+
+    /* PM_NOREMOVE leaves the timer ready */
+    now = 8500;
+    user_timer_expire(&heap, now);
+    CHECK(user_timer_take(&heap, 0, 0, 0, false, now, &timer), "peek ready timer");
+    CHECK(user_timer_any_ready(&heap), "still ready after PM_NOREMOVE");
+    CHECK(user_timer_take(&heap, 0, 0, 0, true, now, &timer), "remove ready timer");
+    CHECK(!user_timer_any_ready(&heap), "not ready after PM_REMOVE");
+    CHECK(user_timer_next_due(&heap, now) == 9500, "keeps its cadence");
+
+    user_timer_heap_free(&heap);
+}
+
+static void test_set_and_kill(void)
+{
+    WBOX_TIMER_HEAP heap = {0};
+    WBOX_TIMER timer;
+
+    /* Periods are clamped, not rejected */
+    user_timer_set(&heap, HWND_APP, 1, 0, 0, 0, 100);
+    CHECK(user_timer_next_due(&heap, 100) == 100 + USER_TIMER_MINIMUM, "elapse clamped to minimum");
+
+    /* Resetting restarts the period and drops a pending WM_TIMER */
+    user_timer_expire(&heap, 200);
+    CHECK(user_timer_any_ready(&heap), "ready before reset");
+    CHECK(user_timer_set(&heap, HWND_APP, 1, 500, 0, 0, 200) == 1, "reset keeps the id");
+    CHECK(heap.count == 1, "reset does not add a timer");
+    CHECK(!user_timer_any_ready(&heap), "reset clears ready");
+    CHECK(user_timer_next_due(&heap, 200) == 700, "reset restarts the period");
+
+    /* Thread timers get their own ids */
+    uint32_t a = user_timer_set(&heap, 0, 0, 100, 0x401000, 0, 200);
+    uint32_t b = user_timer_set(&heap, 0, 0, 100, 0x401000, 0, 200);
+    CHECK(a != 0 && b != 0 && a != b, "distinct thread timer ids");
+    CHECK(user_timer_set(&heap, 0, a, 300, 0x401000, 0, 200) == a, "reset thread timer by id");
+    CHECK(user_timer_has_proc(&heap, 0x401000), "TIMERPROC registered");
+
+    /* hwnd -1 only matches thread timers; message filters apply */
+    user_timer_expire(&heap, 10000);
+    CHECK(user_timer_take(&heap, 0xFFFFFFFF, 0, 0, false, 10000, &timer) && timer.hwnd == 0,
+          "thread timers only");
+    CHECK(user_timer_take(&heap, HWND_APP, 0, 0, false, 10000, &timer) && timer.id == 1,
+          "window filter");
+    CHECK(!user_timer_take(&heap, 0, WM_TIMER + 1, WM_SYSTIMER, false, 10000, &timer),
+          "message filter excludes WM_TIMER");
+
+    /* System timers are a separate namespace */
+    user_timer_set(&heap, HWND_APP, 1, 100, 0, TMRF_SYSTEM, 10000);
+    CHECK(heap.count == 4, "system timer with the same id is separate");
+    user_timer_expire(&heap, 10100);
+    CHECK(user_timer_take(&heap, 0, WM_SYSTIMER, WM_SYSTIMER, true, 10100, &timer) &&
+          (timer.flags & TMRF_SYSTEM), "WM_SYSTIMER filter");
+
+    CHECK(user_timer_kill(&heap, 0, b, 0), "kill thread timer");
+    CHECK(!user_timer_kill(&heap, 0, b, 0), "kill twice fails");
+    user_timer_kill_window(&heap, HWND_APP);
+    CHECK(heap.count == 1, "window timers removed");
+    CHECK(heap.timers[0].hwnd == 0 && heap.timers[0].id == a, "thread timer kept");
+
+    user_timer_heap_free(&heap);
+}
+
+/* Many timers come out in due order, and only the ready ones */
+static void test_ordering(void)
+{
+    WBOX_TIMER_HEAP heap = {0};
+    WBOX_TIMER timer;
+    uint32_t seed = 1;
+
+    for (uint32_t i = 1; i <= 500; i++) {
+        seed = seed * 1103515245 + 12345;
+        user_timer_set(&heap, HWND_APP, i, 10 + (seed >> 16) % 5000, 0, 0, 0);
+    }
+
+    user_timer_expire(&heap, 2500);
+    uint64_t last = 0;
+    int taken = 0;
+    while (user_timer_take(&heap, 0, 0, 0, true, 2500, &timer)) {
+        CHECK(timer.due >= last, "taken in due order");
+        CHECK(timer.due <= 2500, "only expired timers");
+        last = timer.due;
+        taken++;
+    }
+    CHECK(taken > 0 && taken < 500, "part of the timers expired");
+    CHECK(user_timer_next_due(&heap, 2500) > 2500, "next deadline in the future");
+
+    for (uint32_t i = 0; i < heap.count; i++) {
+        uint32_t left = 2 * i + 1;
+        uint32_t right = left + 1;
+        CHECK(left >= heap.count || heap.timers[i].due <= heap.timers[left].due, "heap order");
+        CHECK(right >= heap.count || heap.timers[i].due <= heap.timers[right].due, "heap order");
+    }
+
+    user_timer_heap_free(&heap);
+}
+
+/* Killing one window's timers out of a mixed heap keeps the rest in order */
+static void test_kill_window(void)
+{
+    WBOX_TIMER_HEAP heap = {0};
+    WBOX_TIMER timer;
+    uint32_t seed = 7;
+
+    for (uint32_t i = 1; i <= 600; i++) {
+        seed = seed * 1103515245 + 12345;
+        uint32_t hwnd = (i % 3) ? HWND_APP : HWND_APP + 4;
+        user_timer_set(&heap, hwnd, i, 10 + (seed >> 16) % 5000, 0, 0, 0);
+    }
+
+    user_timer_kill_window(&heap, HWND_APP);
+    CHECK(heap.count == 200, "only the other window's timers left");
+
+    user_timer_expire(&heap, 10000);
+    uint64_t last = 0;
+    int taken = 0;
+    while (user_timer_take(&heap, 0, 0, 0, true, 10000, &timer)) {
+        CHECK(timer.hwnd == HWND_APP + 4, "killed window's timer not delivered");
+        CHECK(timer.due >= last, "remaining timers taken in due order");
+        last = timer.due;
+        taken++;
+    }
+    CHECK(taken == 200, "every remaining timer fires");
+
+    user_timer_kill_window(&heap, HWND_APP + 4);
+    CHECK(heap.count == 0, "all timers killed");
+    user_timer_kill_window(&heap, HWND_APP + 4);
+    CHECK(heap.count == 0, "killing an empty heap is harmless");
+
+    user_timer_heap_free(&heap);
+}
+
+int main(void)
+{
+    test_idle_wakeups();
+    test_coalescing();
+    test_set_and_kill();
+    test_ordering();
+    test_kill_window();
+
+    return test_finish();
+}